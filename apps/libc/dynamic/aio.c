@@ -0,0 +1,1587 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU Lesser General Public
+    License version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    aio.c
+
+Abstract:
+
+    This module implements POSIX asynchronous I/O on top of a kernel I/O ring.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    User Mode C Library
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include "libcp.h"
+#include <aio.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the sizes of the process-wide ring's queues. The number of
+// outstanding requests is capped at the completion queue size so that the
+// kernel never has to hold completions back.
+//
+
+#define AIO_SUBMISSION_COUNT 256
+#define AIO_COMPLETION_COUNT 1024
+#define AIO_MAX_OUTSTANDING AIO_COMPLETION_COUNT
+
+//
+// This macro evaluates to non-zero if the given notification requires the
+// background completion thread.
+//
+
+#define AIO_NEEDS_NOTIFICATION(_Event)                  \
+    (((_Event) != NULL) &&                              \
+     (((_Event)->sigev_notify == SIGEV_SIGNAL) ||       \
+      ((_Event)->sigev_notify == SIGEV_THREAD)))
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure stores the state for a list of requests queued by
+    lio_listio that share a single notification.
+
+Members:
+
+    Remaining - Stores the number of requests in the list that have not yet
+        completed.
+
+    Event - Stores the notification to deliver when the last request
+        completes.
+
+--*/
+
+typedef struct _AIO_GROUP {
+    ULONG Remaining;
+    struct sigevent Event;
+} AIO_GROUP, *PAIO_GROUP;
+
+/*++
+
+Structure Description:
+
+    This structure stores the parameters of a thread notification.
+
+Members:
+
+    Function - Stores a pointer to the function to call.
+
+    Value - Stores the value to pass to the function.
+
+--*/
+
+typedef struct _AIO_THREAD_NOTIFICATION {
+    void (*Function) (union sigval);
+    union sigval Value;
+} AIO_THREAD_NOTIFICATION, *PAIO_THREAD_NOTIFICATION;
+
+/*++
+
+Structure Description:
+
+    This structure stores the process-wide asynchronous I/O state.
+
+Members:
+
+    Lock - Stores the lock serializing access to the ring and the outstanding
+        list.
+
+    Condition - Stores the condition variable broadcast whenever completions
+        are reaped.
+
+    Ring - Stores the handle to the kernel I/O ring, or INVALID_HANDLE if the
+        ring has not been created yet.
+
+    Memory - Stores a pointer to the memory shared with the kernel.
+
+    MemorySize - Stores the size of the shared memory in bytes.
+
+    Header - Stores a pointer to the ring header.
+
+    Submissions - Stores a pointer to the submission queue.
+
+    Completions - Stores a pointer to the completion queue.
+
+    Outstanding - Stores the head of the list of outstanding control blocks.
+
+    OutstandingCount - Stores the number of outstanding control blocks.
+
+    Waiting - Stores a boolean indicating if a thread is currently blocked in
+        the kernel waiting for completions. Other waiters block on the
+        condition variable instead.
+
+    CompletionThreadRunning - Stores a boolean indicating whether the
+        background thread that delivers notifications has been started.
+
+    AtForkRegistered - Stores a boolean indicating whether the fork handler
+        has been registered.
+
+--*/
+
+typedef struct _AIO_CONTEXT {
+    pthread_mutex_t Lock;
+    pthread_cond_t Condition;
+    HANDLE Ring;
+    PVOID Memory;
+    UINTN MemorySize;
+    PIO_RING_HEADER Header;
+    PIO_RING_SUBMISSION Submissions;
+    PIO_RING_COMPLETION Completions;
+    struct aiocb *Outstanding;
+    ULONG OutstandingCount;
+    BOOL Waiting;
+    BOOL CompletionThreadRunning;
+    BOOL AtForkRegistered;
+} AIO_CONTEXT, *PAIO_CONTEXT;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+int
+ClpAioQueue (
+    struct aiocb *const *List,
+    int Count,
+    IO_RING_OPERATION Operation,
+    PAIO_GROUP Group
+    );
+
+int
+ClpAioInitializeRing (
+    VOID
+    );
+
+VOID
+ClpAioReap (
+    VOID
+    );
+
+VOID
+ClpAioCompleteRequest (
+    struct aiocb *Control,
+    LONGLONG Result
+    );
+
+VOID
+ClpAioNotify (
+    struct sigevent *Event
+    );
+
+int
+ClpAioWait (
+    const struct timespec *Deadline
+    );
+
+BOOL
+ClpAioDeadlinePassed (
+    const struct timespec *Deadline,
+    PULONG Milliseconds
+    );
+
+int
+ClpAioStartCompletionThread (
+    VOID
+    );
+
+void *
+ClpAioCompletionThread (
+    void *Parameter
+    );
+
+void *
+ClpAioNotificationThread (
+    void *Parameter
+    );
+
+void
+ClpAioForkChild (
+    void
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+AIO_CONTEXT ClAioContext = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    INVALID_HANDLE
+};
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+LIBC_API
+int
+aio_read (
+    struct aiocb *Control
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues an asynchronous read of aio_nbytes bytes from the
+    descriptor at aio_offset into aio_buf.
+
+Arguments:
+
+    Control - Supplies a pointer to the asynchronous I/O control block.
+
+Return Value:
+
+    0 if the request was queued.
+
+    -1 on failure, and errno will be set to contain more information. EAGAIN
+    is returned if too many requests are outstanding.
+
+--*/
+
+{
+
+    int Error;
+
+    Error = ClpAioQueue(&Control, 1, IoRingOperationRead, NULL);
+    if (Error != 0) {
+        errno = Error;
+        return -1;
+    }
+
+    return 0;
+}
+
+LIBC_API
+int
+aio_write (
+    struct aiocb *Control
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues an asynchronous write of aio_nbytes bytes from
+    aio_buf to the descriptor at aio_offset.
+
+Arguments:
+
+    Control - Supplies a pointer to the asynchronous I/O control block.
+
+Return Value:
+
+    0 if the request was queued.
+
+    -1 on failure, and errno will be set to contain more information. EAGAIN
+    is returned if too many requests are outstanding.
+
+--*/
+
+{
+
+    int Error;
+
+    Error = ClpAioQueue(&Control, 1, IoRingOperationWrite, NULL);
+    if (Error != 0) {
+        errno = Error;
+        return -1;
+    }
+
+    return 0;
+}
+
+LIBC_API
+int
+aio_fsync (
+    int Operation,
+    struct aiocb *Control
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues an asynchronous flush of the descriptor's data to its
+    backing storage.
+
+Arguments:
+
+    Operation - Supplies the kind of synchronization. Valid values are O_SYNC
+        and O_DSYNC.
+
+    Control - Supplies a pointer to the asynchronous I/O control block. Only
+        the descriptor and the notification are used.
+
+Return Value:
+
+    0 if the request was queued.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    int Error;
+
+    if ((Operation != O_SYNC) && (Operation != O_DSYNC)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    Error = ClpAioQueue(&Control, 1, IoRingOperationFlush, NULL);
+    if (Error != 0) {
+        errno = Error;
+        return -1;
+    }
+
+    return 0;
+}
+
+LIBC_API
+int
+aio_error (
+    const struct aiocb *Control
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the error status of an asynchronous I/O operation.
+
+Arguments:
+
+    Control - Supplies a pointer to the asynchronous I/O control block.
+
+Return Value:
+
+    EINPROGRESS if the operation has not yet completed.
+
+    0 if the operation completed successfully.
+
+    Returns the error number of the failed operation otherwise.
+
+--*/
+
+{
+
+    int Error;
+
+    Error = Control->__aio_error;
+    if (Error == EINPROGRESS) {
+        pthread_mutex_lock(&(ClAioContext.Lock));
+        ClpAioReap();
+        Error = Control->__aio_error;
+        pthread_mutex_unlock(&(ClAioContext.Lock));
+    }
+
+    return Error;
+}
+
+LIBC_API
+ssize_t
+aio_return (
+    struct aiocb *Control
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the final result of a completed asynchronous I/O
+    operation. It should be called exactly once per operation, after
+    aio_error reports that it is no longer in progress.
+
+Arguments:
+
+    Control - Supplies a pointer to the asynchronous I/O control block.
+
+Return Value:
+
+    Returns the value the equivalent synchronous call would have returned.
+
+    -1 if the operation failed or is still in progress.
+
+--*/
+
+{
+
+    int Error;
+
+    Error = aio_error(Control);
+    if (Error == EINPROGRESS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (Error != 0) {
+        errno = Error;
+        return -1;
+    }
+
+    return Control->__aio_return;
+}
+
+LIBC_API
+int
+aio_suspend (
+    const struct aiocb *const List[],
+    int Count,
+    const struct timespec *Timeout
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for at least one of the given asynchronous I/O
+    operations to complete.
+
+Arguments:
+
+    List - Supplies an array of pointers to control blocks. Null entries are
+        ignored.
+
+    Count - Supplies the number of elements in the array.
+
+    Timeout - Supplies an optional pointer to the relative amount of time to
+        wait. Supply NULL to wait indefinitely.
+
+Return Value:
+
+    0 if at least one of the operations has completed.
+
+    -1 on failure, and errno will be set to contain more information. EAGAIN
+    is returned if the timeout expired, and EINTR if a signal was caught.
+
+--*/
+
+{
+
+    struct timespec Deadline;
+    struct timespec *DeadlinePointer;
+    int Error;
+    int Index;
+    BOOL InProgress;
+
+    if (Count < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    DeadlinePointer = NULL;
+    if (Timeout != NULL) {
+        if ((Timeout->tv_sec < 0) || (Timeout->tv_nsec < 0) ||
+            (Timeout->tv_nsec >= NANOSECONDS_PER_SECOND)) {
+
+            errno = EINVAL;
+            return -1;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &Deadline);
+        Deadline.tv_sec += Timeout->tv_sec;
+        Deadline.tv_nsec += Timeout->tv_nsec;
+        if (Deadline.tv_nsec >= NANOSECONDS_PER_SECOND) {
+            Deadline.tv_sec += 1;
+            Deadline.tv_nsec -= NANOSECONDS_PER_SECOND;
+        }
+
+        DeadlinePointer = &Deadline;
+    }
+
+    Error = 0;
+    pthread_mutex_lock(&(ClAioContext.Lock));
+    while (TRUE) {
+        ClpAioReap();
+        InProgress = FALSE;
+        for (Index = 0; Index < Count; Index += 1) {
+            if (List[Index] == NULL) {
+                continue;
+            }
+
+            if (List[Index]->__aio_error != EINPROGRESS) {
+                break;
+            }
+
+            InProgress = TRUE;
+        }
+
+        //
+        // Stop if something completed, or if there was nothing to wait for.
+        //
+
+        if ((Index != Count) || (InProgress == FALSE)) {
+            break;
+        }
+
+        if (ClpAioDeadlinePassed(DeadlinePointer, NULL) != FALSE) {
+            Error = EAGAIN;
+            break;
+        }
+
+        Error = ClpAioWait(DeadlinePointer);
+        if (Error == ETIMEDOUT) {
+            Error = 0;
+
+        } else if (Error != 0) {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&(ClAioContext.Lock));
+    if (Error != 0) {
+        errno = Error;
+        return -1;
+    }
+
+    return 0;
+}
+
+LIBC_API
+int
+aio_cancel (
+    int FileDescriptor,
+    struct aiocb *Control
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to cancel outstanding asynchronous I/O operations.
+    Operations that have been handed to the kernel cannot be cancelled.
+
+Arguments:
+
+    FileDescriptor - Supplies the file descriptor whose operations should be
+        cancelled.
+
+    Control - Supplies an optional pointer to a specific control block to
+        cancel. If NULL, every operation on the descriptor is considered.
+
+Return Value:
+
+    AIO_CANCELED if all the operations were cancelled.
+
+    AIO_NOTCANCELED if at least one operation is still in progress.
+
+    AIO_ALLDONE if all the operations had already completed.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    struct aiocb *Current;
+    int Result;
+
+    if (fcntl(FileDescriptor, F_GETFD) < 0) {
+        return -1;
+    }
+
+    if ((Control != NULL) && (Control->aio_fildes != FileDescriptor)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    //
+    // Requests are handed to the kernel as soon as they are queued, so the
+    // best that can be done is to report whether they are still running.
+    //
+
+    Result = AIO_ALLDONE;
+    pthread_mutex_lock(&(ClAioContext.Lock));
+    ClpAioReap();
+    if (Control != NULL) {
+        if (Control->__aio_error == EINPROGRESS) {
+            Result = AIO_NOTCANCELED;
+        }
+
+    } else {
+        Current = ClAioContext.Outstanding;
+        while (Current != NULL) {
+            if (Current->aio_fildes == FileDescriptor) {
+                Result = AIO_NOTCANCELED;
+                break;
+            }
+
+            Current = Current->__aio_next;
+        }
+    }
+
+    pthread_mutex_unlock(&(ClAioContext.Lock));
+    return Result;
+}
+
+LIBC_API
+int
+lio_listio (
+    int Mode,
+    struct aiocb *const List[],
+    int Count,
+    struct sigevent *Event
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues a list of asynchronous I/O operations with a single
+    call.
+
+Arguments:
+
+    Mode - Supplies whether to wait for the operations to finish. See LIO_WAIT
+        and LIO_NOWAIT.
+
+    List - Supplies an array of pointers to control blocks. Null entries and
+        entries whose opcode is LIO_NOP are ignored.
+
+    Count - Supplies the number of elements in the array.
+
+    Event - Supplies an optional pointer to a notification to deliver once
+        every operation in the list has completed. This is only used with
+        LIO_NOWAIT.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information. EAGAIN
+    is returned if not all the operations could be queued, in which case
+    aio_error reports which ones were.
+
+--*/
+
+{
+
+    int Error;
+    PAIO_GROUP Group;
+    int Index;
+    int WaitError;
+
+    if (((Mode != LIO_WAIT) && (Mode != LIO_NOWAIT)) || (Count < 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    Group = NULL;
+    if ((Mode == LIO_NOWAIT) && (AIO_NEEDS_NOTIFICATION(Event))) {
+        Group = malloc(sizeof(AIO_GROUP));
+        if (Group == NULL) {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        Group->Remaining = 0;
+        Group->Event = *Event;
+    }
+
+    Error = ClpAioQueue(List, Count, IoRingOperationNop, Group);
+    if (Mode == LIO_WAIT) {
+        pthread_mutex_lock(&(ClAioContext.Lock));
+        Index = 0;
+        while (Index < Count) {
+            ClpAioReap();
+            while ((Index < Count) &&
+                   ((List[Index] == NULL) ||
+                    (List[Index]->__aio_error != EINPROGRESS))) {
+
+                Index += 1;
+            }
+
+            if (Index == Count) {
+                break;
+            }
+
+            WaitError = ClpAioWait(NULL);
+            if (WaitError != 0) {
+                Error = WaitError;
+                break;
+            }
+        }
+
+        pthread_mutex_unlock(&(ClAioContext.Lock));
+
+        //
+        // Report an I/O error if any of the requests failed.
+        //
+
+        if (Error == 0) {
+            for (Index = 0; Index < Count; Index += 1) {
+                if ((List[Index] != NULL) &&
+                    (List[Index]->aio_lio_opcode != LIO_NOP) &&
+                    (List[Index]->__aio_error != 0)) {
+
+                    Error = EIO;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (Error != 0) {
+        errno = Error;
+        return -1;
+    }
+
+    return 0;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+int
+ClpAioQueue (
+    struct aiocb *const *List,
+    int Count,
+    IO_RING_OPERATION Operation,
+    PAIO_GROUP Group
+    )
+
+/*++
+
+Routine Description:
+
+    This routine places a set of control blocks in the submission queue and
+    hands them to the kernel.
+
+Arguments:
+
+    List - Supplies an array of pointers to control blocks.
+
+    Count - Supplies the number of elements in the array.
+
+    Operation - Supplies the operation to perform on every control block.
+        Supply IoRingOperationNop to use each block's aio_lio_opcode.
+
+    Group - Supplies an optional pointer to the list notification the
+        requests belong to. This routine takes ownership of the group.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure. Control blocks that were not queued
+    have their error set.
+
+--*/
+
+{
+
+    struct aiocb *Control;
+    PAIO_CONTEXT Context;
+    ULONG Entry;
+    int Error;
+    PIO_RING_HEADER Header;
+    int Index;
+    BOOL Notify;
+    IO_RING_OPERATION RequestOperation;
+    KSTATUS Status;
+    PIO_RING_SUBMISSION Submission;
+    ULONG Submitted;
+    ULONG Tail;
+    ULONG Written;
+
+    Context = &ClAioContext;
+    Error = 0;
+    Notify = FALSE;
+    if (Group != NULL) {
+        Notify = TRUE;
+    }
+
+    pthread_mutex_lock(&(Context->Lock));
+    if (Context->Header == NULL) {
+        Error = ClpAioInitializeRing();
+        if (Error != 0) {
+            goto AioQueueEnd;
+        }
+    }
+
+    //
+    // Write the submission entries, pointing each one back at its control
+    // block.
+    //
+
+    Header = Context->Header;
+    Tail = Header->SubmissionTail;
+    Written = 0;
+    for (Index = 0; Index < Count; Index += 1) {
+        Control = List[Index];
+        if (Control == NULL) {
+            continue;
+        }
+
+        RequestOperation = Operation;
+        if (RequestOperation == IoRingOperationNop) {
+            switch (Control->aio_lio_opcode) {
+            case LIO_READ:
+                RequestOperation = IoRingOperationRead;
+                break;
+
+            case LIO_WRITE:
+                RequestOperation = IoRingOperationWrite;
+                break;
+
+            case LIO_NOP:
+                continue;
+
+            default:
+                Control->__aio_error = EINVAL;
+                Control->__aio_return = -1;
+                Error = EIO;
+                continue;
+            }
+        }
+
+        if ((Context->OutstandingCount + Written >= AIO_MAX_OUTSTANDING) ||
+            (Written == AIO_SUBMISSION_COUNT)) {
+
+            Control->__aio_error = EAGAIN;
+            Control->__aio_return = -1;
+            Error = EAGAIN;
+            continue;
+        }
+
+        if (AIO_NEEDS_NOTIFICATION(&(Control->aio_sigevent))) {
+            Notify = TRUE;
+        }
+
+        Submission = &(Context->Submissions[(Tail + Written) &
+                                            (AIO_SUBMISSION_COUNT - 1)]);
+
+        Submission->Operation = RequestOperation;
+        Submission->Flags = 0;
+        Submission->OperationFlags = 0;
+        Submission->Handle = (HANDLE)(UINTN)(Control->aio_fildes);
+        Submission->Buffer = (PVOID)(Control->aio_buf);
+        Submission->Length = Control->aio_nbytes;
+        Submission->Offset = Control->aio_offset;
+        Submission->Address = NULL;
+        Submission->UserData = (UINTN)Control;
+        Control->__aio_error = EINPROGRESS;
+        Control->__aio_return = 0;
+        Written += 1;
+    }
+
+    if (Written == 0) {
+        goto AioQueueEnd;
+    }
+
+    //
+    // The background thread must be running before any request that needs a
+    // notification is handed off, since nobody else may ever reap it.
+    //
+
+    RtlMemoryBarrier();
+    Header->SubmissionTail = Tail + Written;
+    Submitted = 0;
+    if (Notify != FALSE) {
+        Error = ClpAioStartCompletionThread();
+    }
+
+    if (Error != EAGAIN) {
+        Status = OsIoRingEnter(Context->Ring, Written, 0, 0, &Submitted);
+        if (!KSUCCESS(Status)) {
+            Error = ClConvertKstatusToErrorNumber(Status);
+            if (Error == EINTR) {
+                Error = EAGAIN;
+            }
+        }
+    }
+
+    //
+    // Pull back any entries the kernel did not consume. Nothing else enters
+    // the ring with a non-zero submit count without holding the lock, so the
+    // tail can be safely rewound.
+    //
+
+    if (Submitted < Written) {
+        Header->SubmissionTail = Tail + Submitted;
+        while (Written > Submitted) {
+            Written -= 1;
+            Submission = &(Context->Submissions[(Tail + Written) &
+                                                (AIO_SUBMISSION_COUNT - 1)]);
+
+            Control = (struct aiocb *)(UINTN)(Submission->UserData);
+            Control->__aio_error = EAGAIN;
+            Control->__aio_return = -1;
+        }
+
+        if (Error == 0) {
+            Error = EAGAIN;
+        }
+    }
+
+    //
+    // Track everything that made it in. Completions are only processed with
+    // the lock held, so none of these can have been reaped yet.
+    //
+
+    for (Entry = 0; Entry < Submitted; Entry += 1) {
+        Submission = &(Context->Submissions[(Tail + Entry) &
+                                            (AIO_SUBMISSION_COUNT - 1)]);
+
+        Control = (struct aiocb *)(UINTN)(Submission->UserData);
+        Control->__aio_group = Group;
+        Control->__aio_previous = NULL;
+        Control->__aio_next = Context->Outstanding;
+        if (Context->Outstanding != NULL) {
+            Context->Outstanding->__aio_previous = Control;
+        }
+
+        Context->Outstanding = Control;
+        Context->OutstandingCount += 1;
+        if (Group != NULL) {
+            Group->Remaining += 1;
+        }
+    }
+
+AioQueueEnd:
+    if ((Group != NULL) && (Group->Remaining == 0)) {
+        free(Group);
+    }
+
+    pthread_mutex_unlock(&(Context->Lock));
+    return Error;
+}
+
+int
+ClpAioInitializeRing (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the process-wide I/O ring. This routine assumes the
+    context lock is held.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    PAIO_CONTEXT Context;
+    PIO_RING_HEADER Header;
+    PVOID Memory;
+    UINTN Size;
+    KSTATUS Status;
+
+    Context = &ClAioContext;
+
+    assert(Context->Header == NULL);
+
+    if (Context->AtForkRegistered == FALSE) {
+        if (__register_atfork(NULL, NULL, ClpAioForkChild, NULL) != 0) {
+            return ENOMEM;
+        }
+
+        Context->AtForkRegistered = TRUE;
+    }
+
+    Size = IO_RING_SIZE(AIO_SUBMISSION_COUNT, AIO_COMPLETION_COUNT);
+    Memory = mmap(NULL,
+                  Size,
+                  PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS,
+                  -1,
+                  0);
+
+    if (Memory == MAP_FAILED) {
+        return errno;
+    }
+
+    Status = OsCreateIoRing(Memory,
+                            Size,
+                            AIO_SUBMISSION_COUNT,
+                            AIO_COMPLETION_COUNT,
+                            SYS_OPEN_FLAG_CLOSE_ON_EXECUTE,
+                            &(Context->Ring));
+
+    if (!KSUCCESS(Status)) {
+        munmap(Memory, Size);
+        return ClConvertKstatusToErrorNumber(Status);
+    }
+
+    Header = Memory;
+    Context->Memory = Memory;
+    Context->MemorySize = Size;
+    Context->Submissions = (PVOID)((PUCHAR)Memory +
+                                   Header->SubmissionOffset);
+
+    Context->Completions = (PVOID)((PUCHAR)Memory +
+                                   Header->CompletionOffset);
+
+    Context->Header = Header;
+    return 0;
+}
+
+VOID
+ClpAioReap (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine processes every entry in the completion queue. This routine
+    assumes the context lock is held.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_COMPLETION Completion;
+    PAIO_CONTEXT Context;
+    struct aiocb *Control;
+    ULONG Head;
+    PIO_RING_HEADER Header;
+    LONGLONG Result;
+    ULONG Tail;
+
+    Context = &ClAioContext;
+    Header = Context->Header;
+    if (Header == NULL) {
+        return;
+    }
+
+    Head = Header->CompletionHead;
+    Tail = Header->CompletionTail;
+    if (Head == Tail) {
+        return;
+    }
+
+    RtlMemoryBarrier();
+    while (Head != Tail) {
+        Completion = &(Context->Completions[Head &
+                                            (AIO_COMPLETION_COUNT - 1)]);
+
+        Control = (struct aiocb *)(UINTN)(Completion->UserData);
+        Result = Completion->Result;
+        Head += 1;
+        ClpAioCompleteRequest(Control, Result);
+    }
+
+    RtlMemoryBarrier();
+    Header->CompletionHead = Head;
+    pthread_cond_broadcast(&(Context->Condition));
+    return;
+}
+
+VOID
+ClpAioCompleteRequest (
+    struct aiocb *Control,
+    LONGLONG Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records the result of a finished request and delivers its
+    notifications. This routine assumes the context lock is held.
+
+Arguments:
+
+    Control - Supplies a pointer to the completed control block.
+
+    Result - Supplies the result from the kernel: a byte count on success or
+        a negative status code on failure.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PAIO_CONTEXT Context;
+    struct sigevent Event;
+    PAIO_GROUP Group;
+
+    Context = &ClAioContext;
+    if (Control->__aio_previous != NULL) {
+        Control->__aio_previous->__aio_next = Control->__aio_next;
+
+    } else {
+        Context->Outstanding = Control->__aio_next;
+    }
+
+    if (Control->__aio_next != NULL) {
+        Control->__aio_next->__aio_previous = Control->__aio_previous;
+    }
+
+    Control->__aio_next = NULL;
+    Control->__aio_previous = NULL;
+    Context->OutstandingCount -= 1;
+    Group = Control->__aio_group;
+    Control->__aio_group = NULL;
+
+    //
+    // Copy the notification out before publishing the result, as the caller
+    // is free to reuse the control block once it sees the operation is done.
+    //
+
+    Event = Control->aio_sigevent;
+    if (Result < 0) {
+        Control->__aio_return = -1;
+        Control->__aio_error = ClConvertKstatusToErrorNumber((KSTATUS)Result);
+
+    } else {
+        Control->__aio_return = (ssize_t)Result;
+        Control->__aio_error = 0;
+    }
+
+    ClpAioNotify(&Event);
+    if (Group != NULL) {
+
+        assert(Group->Remaining != 0);
+
+        Group->Remaining -= 1;
+        if (Group->Remaining == 0) {
+            ClpAioNotify(&(Group->Event));
+            free(Group);
+        }
+    }
+
+    return;
+}
+
+VOID
+ClpAioNotify (
+    struct sigevent *Event
+    )
+
+/*++
+
+Routine Description:
+
+    This routine delivers an asynchronous I/O notification.
+
+Arguments:
+
+    Event - Supplies a pointer to the notification to deliver.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    pthread_attr_t *Attributes;
+    PAIO_THREAD_NOTIFICATION Notification;
+    pthread_t Thread;
+
+    switch (Event->sigev_notify) {
+    case SIGEV_SIGNAL:
+        sigqueue(getpid(), Event->sigev_signo, Event->sigev_value);
+        break;
+
+    case SIGEV_THREAD:
+        Notification = malloc(sizeof(AIO_THREAD_NOTIFICATION));
+        if (Notification == NULL) {
+            break;
+        }
+
+        Notification->Function = Event->sigev_notify_function;
+        Notification->Value = Event->sigev_value;
+        Attributes = Event->sigev_notify_attributes;
+        if (pthread_create(&Thread,
+                           Attributes,
+                           ClpAioNotificationThread,
+                           Notification) != 0) {
+
+            free(Notification);
+            break;
+        }
+
+        pthread_detach(Thread);
+        break;
+
+    case SIGEV_NONE:
+    default:
+        break;
+    }
+
+    return;
+}
+
+int
+ClpAioWait (
+    const struct timespec *Deadline
+    )
+
+/*++
+
+Routine Description:
+
+    This routine blocks until completions may have arrived. The first waiter
+    blocks in the kernel on behalf of everyone and reaps what arrives; the
+    rest wait for it on the condition variable. This routine assumes the
+    context lock is held, and may drop it temporarily.
+
+Arguments:
+
+    Deadline - Supplies an optional pointer to the absolute real time at
+        which to give up.
+
+Return Value:
+
+    0 if the caller should re-check its requests.
+
+    ETIMEDOUT if the deadline expired.
+
+    EINTR if the wait was interrupted by a signal.
+
+--*/
+
+{
+
+    PAIO_CONTEXT Context;
+    int Error;
+    KSTATUS Status;
+    ULONG Submitted;
+    ULONG Timeout;
+
+    Context = &ClAioContext;
+    if (Context->Waiting != FALSE) {
+        if (Deadline != NULL) {
+            return pthread_cond_timedwait(&(Context->Condition),
+                                          &(Context->Lock),
+                                          Deadline);
+        }
+
+        return pthread_cond_wait(&(Context->Condition), &(Context->Lock));
+    }
+
+    if (Context->Header == NULL) {
+        return 0;
+    }
+
+    Timeout = SYS_WAIT_TIME_INDEFINITE;
+    if (ClpAioDeadlinePassed(Deadline, &Timeout) != FALSE) {
+        return ETIMEDOUT;
+    }
+
+    Context->Waiting = TRUE;
+    pthread_mutex_unlock(&(Context->Lock));
+    Status = OsIoRingEnter(Context->Ring, 0, 1, Timeout, &Submitted);
+    pthread_mutex_lock(&(Context->Lock));
+    Context->Waiting = FALSE;
+
+    //
+    // Reap and wake the followers even if nothing arrived, so that one of
+    // them takes over waiting in the kernel.
+    //
+
+    ClpAioReap();
+    pthread_cond_broadcast(&(Context->Condition));
+    Error = 0;
+    if (!KSUCCESS(Status)) {
+        Error = ClConvertKstatusToErrorNumber(Status);
+    }
+
+    return Error;
+}
+
+BOOL
+ClpAioDeadlinePassed (
+    const struct timespec *Deadline,
+    PULONG Milliseconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not the given deadline has expired.
+
+Arguments:
+
+    Deadline - Supplies an optional pointer to the absolute real time
+        deadline. If NULL, the deadline never passes.
+
+    Milliseconds - Supplies an optional pointer where the number of
+        milliseconds remaining until the deadline will be returned. This is
+        left untouched if there is no deadline.
+
+Return Value:
+
+    TRUE if the deadline has passed.
+
+    FALSE if there is time remaining.
+
+--*/
+
+{
+
+    struct timespec Now;
+    LONGLONG Remaining;
+
+    if (Deadline == NULL) {
+        return FALSE;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &Now);
+    Remaining = ((LONGLONG)(Deadline->tv_sec - Now.tv_sec) *
+                 MILLISECONDS_PER_SECOND) +
+                ((Deadline->tv_nsec - Now.tv_nsec) /
+                 NANOSECONDS_PER_MILLISECOND);
+
+    if (Remaining <= 0) {
+        return TRUE;
+    }
+
+    if (Milliseconds != NULL) {
+        if (Remaining >= SYS_WAIT_TIME_INDEFINITE) {
+            Remaining = SYS_WAIT_TIME_INDEFINITE - 1;
+        }
+
+        *Milliseconds = (ULONG)Remaining;
+    }
+
+    return FALSE;
+}
+
+int
+ClpAioStartCompletionThread (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts the background thread that reaps completions so that
+    notifications are delivered even if the application never calls back
+    into the library. This routine assumes the context lock is held.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    pthread_attr_t Attributes;
+    int Error;
+    pthread_t Thread;
+
+    if (ClAioContext.CompletionThreadRunning != FALSE) {
+        return 0;
+    }
+
+    pthread_attr_init(&Attributes);
+    pthread_attr_setdetachstate(&Attributes, PTHREAD_CREATE_DETACHED);
+    Error = pthread_create(&Thread,
+                           &Attributes,
+                           ClpAioCompletionThread,
+                           NULL);
+
+    pthread_attr_destroy(&Attributes);
+    if (Error != 0) {
+        return EAGAIN;
+    }
+
+    ClAioContext.CompletionThreadRunning = TRUE;
+    return 0;
+}
+
+void *
+ClpAioCompletionThread (
+    void *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the background completion thread, which waits for
+    and reaps completions forever.
+
+Arguments:
+
+    Parameter - Supplies an unused parameter.
+
+Return Value:
+
+    This routine does not return.
+
+--*/
+
+{
+
+    sigset_t Mask;
+
+    //
+    // Leave signals to the application's own threads.
+    //
+
+    sigfillset(&Mask);
+    pthread_sigmask(SIG_BLOCK, &Mask, NULL);
+    pthread_mutex_lock(&(ClAioContext.Lock));
+    while (TRUE) {
+        ClpAioReap();
+        ClpAioWait(NULL);
+    }
+
+    pthread_mutex_unlock(&(ClAioContext.Lock));
+    return NULL;
+}
+
+void *
+ClpAioNotificationThread (
+    void *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the thread that calls a SIGEV_THREAD notification
+    function.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the thread notification, which this
+        routine frees.
+
+Return Value:
+
+    NULL always.
+
+--*/
+
+{
+
+    AIO_THREAD_NOTIFICATION Notification;
+
+    Notification = *(PAIO_THREAD_NOTIFICATION)Parameter;
+    free(Parameter);
+    Notification.Function(Notification.Value);
+    return NULL;
+}
+
+void
+ClpAioForkChild (
+    void
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called in the child after a fork. The child does not
+    inherit the parent's outstanding requests, so it drops its copy of the
+    ring and starts over.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PAIO_CONTEXT Context;
+    struct aiocb *Control;
+
+    Context = &ClAioContext;
+    pthread_mutex_init(&(Context->Lock), NULL);
+    pthread_cond_init(&(Context->Condition), NULL);
+    while (Context->Outstanding != NULL) {
+        Control = Context->Outstanding;
+        Context->Outstanding = Control->__aio_next;
+        Control->__aio_next = NULL;
+        Control->__aio_previous = NULL;
+        Control->__aio_group = NULL;
+        Control->__aio_return = -1;
+        Control->__aio_error = ECANCELED;
+    }
+
+    if (Context->Header != NULL) {
+        OsClose(Context->Ring);
+        munmap(Context->Memory, Context->MemorySize);
+    }
+
+    Context->Ring = INVALID_HANDLE;
+    Context->Memory = NULL;
+    Context->MemorySize = 0;
+    Context->Header = NULL;
+    Context->Submissions = NULL;
+    Context->Completions = NULL;
+    Context->OutstandingCount = 0;
+    Context->Waiting = FALSE;
+    Context->CompletionThreadRunning = FALSE;
+    return;
+}
+
@@ -100,6 +100,7 @@ function build() {
     ];
 
     sources = [
+        "aio.c",
         "assert.c",
         "brk.c",
         "bsearch.c",
@@ -108,6 +109,7 @@ function build() {
         "dirio.c",
         "dynlib.c",
         "env.c",
+        "epoll.c",
         "err.c",
         "errno.c",
         "exec.c",
@@ -0,0 +1,385 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU Lesser General Public
+    License version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    epoll.c
+
+Abstract:
+
+    This module implements support for event poll sets.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    User Mode C Library
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include "libcp.h"
+#include <assert.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Make sure the event poll flags and structure line up with the kernel's.
+//
+
+#define ASSERT_EPOLL_EQUIVALENT()                                       \
+    assert((EPOLLIN == POLL_EVENT_IN) &&                                \
+           (EPOLLPRI == POLL_EVENT_IN_HIGH_PRIORITY) &&                 \
+           (EPOLLOUT == POLL_EVENT_OUT) &&                              \
+           (EPOLLWRBAND == POLL_EVENT_OUT_HIGH_PRIORITY) &&             \
+           (EPOLLERR == POLL_EVENT_ERROR) &&                            \
+           (EPOLLHUP == POLL_EVENT_DISCONNECTED) &&                     \
+           (EPOLLET == EVENT_POLL_FLAG_EDGE_TRIGGERED) &&               \
+           (EPOLLONESHOT == EVENT_POLL_FLAG_ONE_SHOT) &&                \
+           (EPOLL_CTL_ADD == EventPollOperationAdd) &&                  \
+           (EPOLL_CTL_DEL == EventPollOperationDelete) &&               \
+           (EPOLL_CTL_MOD == EventPollOperationModify) &&               \
+           (sizeof(struct epoll_event) == sizeof(EVENT_POLL_EVENT)) &&  \
+           (FIELD_OFFSET(struct epoll_event, data) ==                   \
+            FIELD_OFFSET(EVENT_POLL_EVENT, Data)))
+
+//
+// Define the set of events and flags that can be requested.
+//
+
+#define EPOLL_VALID_EVENTS                                              \
+    (EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLWRBAND | EPOLLERR | EPOLLHUP | \
+     EPOLLET | EPOLLONESHOT)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+LIBC_API
+int
+epoll_create (
+    int Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new event poll set.
+
+Arguments:
+
+    Size - Supplies a hint as to the number of descriptors that will be added.
+        This is ignored, but must be greater than zero.
+
+Return Value:
+
+    Returns a file descriptor for the new set on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    if (Size <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return epoll_create1(0);
+}
+
+LIBC_API
+int
+epoll_create1 (
+    int Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new event poll set.
+
+Arguments:
+
+    Flags - Supplies a bitfield of flags. The only valid flag is
+        EPOLL_CLOEXEC.
+
+Return Value:
+
+    Returns a file descriptor for the new set on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    HANDLE Handle;
+    ULONG OpenFlags;
+    KSTATUS Status;
+
+    if ((Flags & ~EPOLL_CLOEXEC) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    OpenFlags = 0;
+    if ((Flags & EPOLL_CLOEXEC) != 0) {
+        OpenFlags |= SYS_OPEN_FLAG_CLOSE_ON_EXECUTE;
+    }
+
+    Status = OsCreateEventPoll(OpenFlags, &Handle);
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    return (int)(UINTN)Handle;
+}
+
+LIBC_API
+int
+epoll_ctl (
+    int EventPoll,
+    int Operation,
+    int FileDescriptor,
+    struct epoll_event *Event
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds, modifies, or removes a file descriptor in an event poll
+    set.
+
+Arguments:
+
+    EventPoll - Supplies the file descriptor of the event poll set.
+
+    Operation - Supplies the operation to perform. See EPOLL_CTL_*
+        definitions.
+
+    FileDescriptor - Supplies the file descriptor to operate on.
+
+    Event - Supplies a pointer to the requested events and associated data.
+        This is ignored for EPOLL_CTL_DEL.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    EVENT_POLL_EVENT KernelEvent;
+    PEVENT_POLL_EVENT KernelEventPointer;
+    KSTATUS Status;
+
+    ASSERT_EPOLL_EQUIVALENT();
+
+    if (EventPoll == FileDescriptor) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    KernelEventPointer = NULL;
+    switch (Operation) {
+    case EPOLL_CTL_ADD:
+    case EPOLL_CTL_MOD:
+        if (Event == NULL) {
+            errno = EFAULT;
+            return -1;
+        }
+
+        KernelEvent.Events = Event->events & EPOLL_VALID_EVENTS;
+        KernelEvent.Data = Event->data.u64;
+        KernelEventPointer = &KernelEvent;
+        break;
+
+    case EPOLL_CTL_DEL:
+        break;
+
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+
+    Status = OsEventPollControl((HANDLE)(UINTN)EventPoll,
+                                Operation,
+                                (HANDLE)(UINTN)FileDescriptor,
+                                KernelEventPointer);
+
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    return 0;
+}
+
+LIBC_API
+int
+epoll_wait (
+    int EventPoll,
+    struct epoll_event *Events,
+    int MaxEvents,
+    int Timeout
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for file descriptors in an event poll set to become
+    ready.
+
+Arguments:
+
+    EventPoll - Supplies the file descriptor of the event poll set.
+
+    Events - Supplies a pointer to an array where the events for the ready
+        descriptors will be returned.
+
+    MaxEvents - Supplies the number of elements in the events array. This
+        must be greater than zero.
+
+    Timeout - Supplies the amount of time in milliseconds to block before
+        giving up and returning anyway. Supply 0 to not block at all, and
+        supply -1 to wait for an indefinite amount of time.
+
+Return Value:
+
+    Returns the number of ready descriptors on success.
+
+    Returns 0 to indicate a timeout.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    return epoll_pwait(EventPoll, Events, MaxEvents, Timeout, NULL);
+}
+
+LIBC_API
+int
+epoll_pwait (
+    int EventPoll,
+    struct epoll_event *Events,
+    int MaxEvents,
+    int Timeout,
+    const sigset_t *SignalMask
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for file descriptors in an event poll set to become
+    ready, atomically setting the signal mask for the duration of the wait.
+
+Arguments:
+
+    EventPoll - Supplies the file descriptor of the event poll set.
+
+    Events - Supplies a pointer to an array where the events for the ready
+        descriptors will be returned.
+
+    MaxEvents - Supplies the number of elements in the events array. This
+        must be greater than zero.
+
+    Timeout - Supplies the amount of time in milliseconds to block before
+        giving up and returning anyway. Supply 0 to not block at all, and
+        supply -1 to wait for an indefinite amount of time.
+
+    SignalMask - Supplies an optional pointer to a signal mask to set for the
+        duration of the wait.
+
+Return Value:
+
+    Returns the number of ready descriptors on success.
+
+    Returns 0 to indicate a timeout.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    ULONG EventsReturned;
+    KSTATUS Status;
+    ULONG TimeoutInMilliseconds;
+
+    ASSERT_EPOLL_EQUIVALENT();
+
+    if (MaxEvents <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (Timeout < 0) {
+        TimeoutInMilliseconds = SYS_WAIT_TIME_INDEFINITE;
+
+    } else {
+        TimeoutInMilliseconds = Timeout;
+    }
+
+    Status = OsEventPollWait((HANDLE)(UINTN)EventPoll,
+                             (PSIGNAL_SET)SignalMask,
+                             (PEVENT_POLL_EVENT)Events,
+                             MaxEvents,
+                             TimeoutInMilliseconds,
+                             &EventsReturned);
+
+    if (!KSUCCESS(Status)) {
+        if (Status == STATUS_TIMEOUT) {
+            return 0;
+        }
+
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    return (int)EventsReturned;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
@@ -39,6 +39,7 @@ Module Name:
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -266,7 +267,8 @@ Return Value:
 
     Returns some value other than -1 to indicate success. For some commands
     (like F_DUPFD) this is a file descriptor. For others (like F_GETFD and
-    F_GETFL) this is a bitfield of status flags.
+    F_GETFL) this is a bitfield of status flags. For F_GETPIPE_SZ and
+    F_SETPIPE_SZ this is the capacity of the pipe in bytes.
 
     -1 on error, and errno will be set to indicate the error.
 
@@ -282,6 +284,7 @@ Return Value:
     ULONG Flags;
     off_t Length;
     FILE_CONTROL_PARAMETERS_UNION Parameters;
+    int PipeSize;
     int ReturnValue;
     int SetFlags;
     struct stat Stat;
@@ -349,6 +352,10 @@ Return Value:
             Parameters.Flags |= SYS_OPEN_FLAG_ASYNCHRONOUS;
         }
 
+        if ((SetFlags & O_DIRECT) != 0) {
+            Parameters.Flags |= SYS_OPEN_FLAG_DIRECT;
+        }
+
         break;
 
     case F_GETOWN:
@@ -451,6 +458,22 @@ Return Value:
         FileControlCommand = FileControlCommandCloseFrom;
         break;
 
+    case F_GETPIPE_SZ:
+        FileControlCommand = FileControlCommandGetPipeSize;
+        Parameters.PipeSize = 0;
+        break;
+
+    case F_SETPIPE_SZ:
+        FileControlCommand = FileControlCommandSetPipeSize;
+        PipeSize = va_arg(ArgumentList, int);
+        if (PipeSize < 0) {
+            Status = STATUS_INVALID_PARAMETER;
+            goto fcntlEnd;
+        }
+
+        Parameters.PipeSize = PipeSize;
+        break;
+
     default:
         Status = STATUS_INVALID_PARAMETER;
         goto fcntlEnd;
@@ -561,6 +584,10 @@ Return Value:
             ReturnValue |= O_ASYNC;
         }
 
+        if ((Flags & SYS_OPEN_FLAG_DIRECT) != 0) {
+            ReturnValue |= O_DIRECT;
+        }
+
         break;
 
     case F_GETLK:
@@ -618,6 +645,11 @@ Return Value:
         ReturnValue = 0;
         break;
 
+    case F_GETPIPE_SZ:
+    case F_SETPIPE_SZ:
+        ReturnValue = Parameters.PipeSize;
+        break;
+
     default:
 
         assert(FALSE);
@@ -1112,6 +1144,91 @@ Return Value:
     return (ssize_t)BytesCompleted;
 }
 
+LIBC_API
+ssize_t
+sendfile (
+    int OutputDescriptor,
+    int InputDescriptor,
+    off_t *Offset,
+    size_t ByteCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies data from one file descriptor to another within the
+    kernel, which is more efficient than reading the data into a user buffer
+    and writing it back out. The input descriptor is usually a regular file,
+    and the output descriptor is usually a socket or pipe.
+
+Arguments:
+
+    OutputDescriptor - Supplies the file descriptor to write the data to.
+
+    InputDescriptor - Supplies the file descriptor to read the data from.
+
+    Offset - Supplies an optional pointer to the offset in the input file to
+        start reading from. On return, this is updated to the offset just
+        beyond the last byte read, and the input descriptor's file position
+        is left unchanged. If NULL, reading starts at the input descriptor's
+        current file position, which is updated.
+
+    ByteCount - Supplies the number of bytes to transfer.
+
+Return Value:
+
+    Returns the number of bytes transferred on success. This may be less than
+    requested.
+
+    -1 on failure, and errno will contain more information.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    IO_OFFSET IoOffset;
+    PIO_OFFSET IoOffsetPointer;
+    KSTATUS Status;
+
+    if (ByteCount > (size_t)SSIZE_MAX) {
+        ByteCount = (size_t)SSIZE_MAX;
+    }
+
+    IoOffsetPointer = NULL;
+    if (Offset != NULL) {
+        if (*Offset < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        IoOffset = *Offset;
+        IoOffsetPointer = &IoOffset;
+    }
+
+    Status = OsSendFile((HANDLE)(UINTN)OutputDescriptor,
+                        (HANDLE)(UINTN)InputDescriptor,
+                        IoOffsetPointer,
+                        ByteCount,
+                        &BytesCompleted);
+
+    if (Status == STATUS_TIMEOUT) {
+        errno = EAGAIN;
+        return -1;
+
+    } else if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    if (Offset != NULL) {
+        *Offset = IoOffset;
+    }
+
+    return (ssize_t)BytesCompleted;
+}
+
 LIBC_API
 int
 fsync (
@@ -3497,6 +3614,10 @@ Return Value:
         OsOpenFlags |= SYS_OPEN_FLAG_ASYNCHRONOUS;
     }
 
+    if ((OpenFlags & O_DIRECT) != 0) {
+        OsOpenFlags |= SYS_OPEN_FLAG_DIRECT;
+    }
+
     //
     // Set other flags.
     //
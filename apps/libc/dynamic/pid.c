@@ -416,6 +416,60 @@ Return Value:
     return -1;
 }
 
+LIBC_API
+__NOINLINE
+pid_t
+vfork (
+    void
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new process that temporarily shares the memory of
+    the calling process. The calling thread is suspended until the child
+    executes a new image or exits. The child must not return from the function
+    that called vfork, and should only call one of the exec functions or _exit.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns 0 to the child process.
+
+    Returns the process ID of the child process to the parent process.
+
+    Returns -1 to the parent process on error, and the errno variable will be
+    set to provide more information about the error.
+
+--*/
+
+{
+
+    PVOID FrameRestoreBase;
+    INTN Result;
+
+    //
+    // The child returns through this frame and then reuses the stack below
+    // the caller's frame. Have the kernel save everything up to and including
+    // this routine's saved frame pointer and return address, and put it back
+    // before the parent resumes. At-fork handlers are not run, since the
+    // child shares the parent's memory.
+    //
+
+    FrameRestoreBase = (PVOID *)__builtin_frame_address(0) + 2;
+    Result = OsForkProcess(FORK_FLAG_VFORK, FrameRestoreBase);
+    if (Result >= 0) {
+        return Result;
+    }
+
+    errno = ClConvertKstatusToErrorNumber(Result);
+    return -1;
+}
+
 LIBC_API
 uid_t
 getuid (
@@ -154,6 +154,14 @@ ClpGetPathFromSocketAddress (
     PUINTN PathSize
     );
 
+ssize_t
+ClpReceiveMessage (
+    int Socket,
+    struct msghdr *Message,
+    int Flags,
+    ULONG TimeoutInMilliseconds
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -1114,88 +1122,199 @@ Return Value:
 
 {
 
-    NETWORK_ADDRESS Address;
-    SOCKET_IO_PARAMETERS Parameters;
-    KSTATUS Status;
-    UINTN VectorIndex;
+    return ClpReceiveMessage(Socket, Message, Flags, SYS_WAIT_TIME_INDEFINITE);
+}
 
-    if (Message == NULL) {
+LIBC_API
+int
+sendmmsg (
+    int Socket,
+    struct mmsghdr *Messages,
+    unsigned int MessageCount,
+    int Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends a batch of messages out of a socket. Each message is
+    sent as if by sendmsg, and the number of bytes sent for each is stored in
+    its msg_len member.
+
+Arguments:
+
+    Socket - Supplies the file descriptor of the socket to send data out of.
+
+    Messages - Supplies an array of messages to send.
+
+    MessageCount - Supplies the number of elements in the messages array.
+
+    Flags - Supplies a bitfield of flags governing the transmission of the data.
+        See MSG_* definitions.
+
+Return Value:
+
+    Returns the number of messages sent on success. This may be less than the
+    message count if an error occurred after the first message was sent.
+
+    -1 on error, and the errno variable will be set to contain more information.
+
+--*/
+
+{
+
+    ssize_t BytesSent;
+    unsigned int Index;
+
+    if ((Messages == NULL) && (MessageCount != 0)) {
         errno = EINVAL;
         return -1;
     }
 
-    Parameters.Size = 0;
-    for (VectorIndex = 0; VectorIndex < Message->msg_iovlen; VectorIndex += 1) {
-        Parameters.Size += Message->msg_iov[VectorIndex].iov_len;
-    }
+    for (Index = 0; Index < MessageCount; Index += 1) {
+        BytesSent = sendmsg(Socket, &(Messages[Index].msg_hdr), Flags);
+        if (BytesSent < 0) {
 
-    //
-    // Truncate the byte count, so that it does not exceed the maximum number
-    // of bytes that can be returned.
-    //
+            //
+            // Report the messages that did make it out. The error will be
+            // seen again on the next call.
+            //
 
-    if (Parameters.Size > (UINTN)SSIZE_MAX) {
-        Parameters.Size = (UINTN)SSIZE_MAX;
+            if (Index != 0) {
+                break;
+            }
+
+            return -1;
+        }
+
+        Messages[Index].msg_len = BytesSent;
     }
 
-    ASSERT_SOCKET_IO_FLAGS_ARE_EQUIVALENT();
+    return Index;
+}
 
-    Parameters.BytesCompleted = 0;
-    Parameters.IoFlags = 0;
-    Parameters.SocketIoFlags = Flags;
-    Parameters.TimeoutInMilliseconds = SYS_WAIT_TIME_INDEFINITE;
-    Parameters.NetworkAddress = NULL;
-    Parameters.RemotePath = NULL;
-    Parameters.RemotePathSize = 0;
-    if ((Message->msg_name != NULL) && (Message->msg_namelen != 0)) {
-        Address.Domain = NetDomainInvalid;
-        ClpGetPathFromSocketAddress(Message->msg_name,
-                                    &(Message->msg_namelen),
-                                    &(Parameters.RemotePath),
-                                    &(Parameters.RemotePathSize));
+LIBC_API
+int
+recvmmsg (
+    int Socket,
+    struct mmsghdr *Messages,
+    unsigned int MessageCount,
+    int Flags,
+    struct timespec *Timeout
+    )
 
-        Parameters.NetworkAddress = &Address;
-    }
+/*++
 
-    Parameters.ControlData = Message->msg_control;
-    Parameters.ControlDataSize = Message->msg_controllen;
-    Status = OsSocketPerformVectoredIo((HANDLE)(UINTN)Socket,
-                                       &Parameters,
-                                       (PIO_VECTOR)(Message->msg_iov),
-                                       Message->msg_iovlen);
+Routine Description:
 
-    Message->msg_flags = Parameters.SocketIoFlags;
-    Message->msg_controllen = Parameters.ControlDataSize;
-    if ((!KSUCCESS(Status)) && (Status != STATUS_END_OF_FILE)) {
-        if (Status == STATUS_NOT_SUPPORTED) {
-            errno = EOPNOTSUPP;
+    This routine receives a batch of messages from a socket. Each message is
+    received as if by recvmsg, and the number of bytes received for each is
+    stored in its msg_len member.
 
-        } else {
-            errno = ClConvertKstatusToErrorNumber(Status);
-        }
+Arguments:
+
+    Socket - Supplies the file descriptor of the socket to receive data from.
+
+    Messages - Supplies an array of initialized messages where the received
+        data will be returned.
 
+    MessageCount - Supplies the number of elements in the messages array.
+
+    Flags - Supplies a bitfield of flags governing the reception of the data.
+        See MSG_* definitions. MSG_WAITFORONE makes every receive after the
+        first non-blocking.
+
+    Timeout - Supplies an optional pointer to the maximum amount of time to
+        spend receiving the batch. Supply NULL to wait indefinitely.
+
+Return Value:
+
+    Returns the number of messages received on success. This may be less than
+    the message count if an error occurred after the first message was
+    received or the timeout expired.
+
+    -1 on error, and the errno variable will be set to contain more information.
+
+--*/
+
+{
+
+    ssize_t BytesReceived;
+    ULONGLONG Elapsed;
+    ULONGLONG Frequency;
+    unsigned int Index;
+    int Result;
+    ULONGLONG StartTime;
+    ULONG TimeoutInMilliseconds;
+    ULONG WaitTime;
+
+    if ((Messages == NULL) && (MessageCount != 0)) {
+        errno = EINVAL;
         return -1;
     }
 
-    //
-    // If requested, attempt to translate the network address provided by the
-    // kernel to a C library socket address.
-    //
+    Result = ClpConvertSpecificTimeoutToSystemTimeout(Timeout,
+                                                      &TimeoutInMilliseconds);
 
-    if ((Message->msg_name != NULL) && (Message->msg_namelen != 0)) {
-        Status = ClConvertFromNetworkAddress(&Address,
-                                             Message->msg_name,
-                                             &(Message->msg_namelen),
-                                             Parameters.RemotePath,
-                                             Parameters.RemotePathSize);
+    if (Result != 0) {
+        errno = Result;
+        return -1;
+    }
+
+    Frequency = 0;
+    StartTime = 0;
+    if (TimeoutInMilliseconds != SYS_WAIT_TIME_INDEFINITE) {
+        Frequency = OsGetTimeCounterFrequency();
+        StartTime = OsGetRecentTimeCounter();
+    }
+
+    WaitTime = TimeoutInMilliseconds;
+    for (Index = 0; Index < MessageCount; Index += 1) {
+        BytesReceived = ClpReceiveMessage(Socket,
+                                          &(Messages[Index].msg_hdr),
+                                          Flags & ~MSG_WAITFORONE,
+                                          WaitTime);
+
+        if (BytesReceived < 0) {
+
+            //
+            // Running out of immediately available messages or time is the
+            // normal way for a partial batch to end. Other errors will be seen
+            // again on the next call.
+            //
+
+            if (Index != 0) {
+                break;
+            }
 
-        if (!KSUCCESS(Status)) {
-            errno = EINVAL;
             return -1;
         }
+
+        Messages[Index].msg_len = BytesReceived;
+
+        //
+        // Once one message is in hand, only take what is already queued.
+        //
+
+        if ((Flags & MSG_WAITFORONE) != 0) {
+            Flags |= MSG_DONTWAIT;
+        }
+
+        if (TimeoutInMilliseconds != SYS_WAIT_TIME_INDEFINITE) {
+            Elapsed = OsGetRecentTimeCounter() - StartTime;
+            Elapsed = (Elapsed * MILLISECONDS_PER_SECOND) / Frequency;
+
+            if (Elapsed >= TimeoutInMilliseconds) {
+                Index += 1;
+                break;
+            }
+
+            WaitTime = TimeoutInMilliseconds - Elapsed;
+        }
     }
 
-    return (ssize_t)(Parameters.BytesCompleted);
+    return Index;
 }
 
 LIBC_API
@@ -2035,3 +2154,124 @@ Return Value:
     return;
 }
 
+ssize_t
+ClpReceiveMessage (
+    int Socket,
+    struct msghdr *Message,
+    int Flags,
+    ULONG TimeoutInMilliseconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine receives a message from a socket, implementing recvmsg with
+    a caller-supplied timeout.
+
+Arguments:
+
+    Socket - Supplies the file descriptor of the socket to receive data from.
+
+    Message - Supplies a pointer to an initialized structure where the message
+        information will be returned.
+
+    Flags - Supplies a bitfield of flags governing the reception of the data.
+        See MSG_* definitions.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds to wait for
+        data, or SYS_WAIT_TIME_INDEFINITE to wait forever.
+
+Return Value:
+
+    Returns the number of bytes received on success.
+
+    -1 on error, and the errno variable will be set to contain more information.
+
+--*/
+
+{
+
+    NETWORK_ADDRESS Address;
+    SOCKET_IO_PARAMETERS Parameters;
+    KSTATUS Status;
+    UINTN VectorIndex;
+
+    if (Message == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    Parameters.Size = 0;
+    for (VectorIndex = 0; VectorIndex < Message->msg_iovlen; VectorIndex += 1) {
+        Parameters.Size += Message->msg_iov[VectorIndex].iov_len;
+    }
+
+    //
+    // Truncate the byte count, so that it does not exceed the maximum number
+    // of bytes that can be returned.
+    //
+
+    if (Parameters.Size > (UINTN)SSIZE_MAX) {
+        Parameters.Size = (UINTN)SSIZE_MAX;
+    }
+
+    ASSERT_SOCKET_IO_FLAGS_ARE_EQUIVALENT();
+
+    Parameters.BytesCompleted = 0;
+    Parameters.IoFlags = 0;
+    Parameters.SocketIoFlags = Flags;
+    Parameters.TimeoutInMilliseconds = TimeoutInMilliseconds;
+    Parameters.NetworkAddress = NULL;
+    Parameters.RemotePath = NULL;
+    Parameters.RemotePathSize = 0;
+    if ((Message->msg_name != NULL) && (Message->msg_namelen != 0)) {
+        Address.Domain = NetDomainInvalid;
+        ClpGetPathFromSocketAddress(Message->msg_name,
+                                    &(Message->msg_namelen),
+                                    &(Parameters.RemotePath),
+                                    &(Parameters.RemotePathSize));
+
+        Parameters.NetworkAddress = &Address;
+    }
+
+    Parameters.ControlData = Message->msg_control;
+    Parameters.ControlDataSize = Message->msg_controllen;
+    Status = OsSocketPerformVectoredIo((HANDLE)(UINTN)Socket,
+                                       &Parameters,
+                                       (PIO_VECTOR)(Message->msg_iov),
+                                       Message->msg_iovlen);
+
+    Message->msg_flags = Parameters.SocketIoFlags;
+    Message->msg_controllen = Parameters.ControlDataSize;
+    if ((!KSUCCESS(Status)) && (Status != STATUS_END_OF_FILE)) {
+        if (Status == STATUS_NOT_SUPPORTED) {
+            errno = EOPNOTSUPP;
+
+        } else {
+            errno = ClConvertKstatusToErrorNumber(Status);
+        }
+
+        return -1;
+    }
+
+    //
+    // If requested, attempt to translate the network address provided by the
+    // kernel to a C library socket address.
+    //
+
+    if ((Message->msg_name != NULL) && (Message->msg_namelen != 0)) {
+        Status = ClConvertFromNetworkAddress(&Address,
+                                             Message->msg_name,
+                                             &(Message->msg_namelen),
+                                             Parameters.RemotePath,
+                                             Parameters.RemotePathSize);
+
+        if (!KSUCCESS(Status)) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    return (ssize_t)(Parameters.BytesCompleted);
+}
@@ -33,6 +33,7 @@ Module Name:
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <spawn.h>
 #include <stdlib.h>
 #include <sys/wait.h>
@@ -1184,17 +1185,43 @@ Return Value:
 
 {
 
+    sigset_t AllSignals;
     volatile int Error;
+    sigset_t OriginalMask;
     pid_t Pid;
+    BOOL UseVfork;
 
     //
-    // TODO: Use vfork when it is implemented.
+    // Resetting signal dispositions in the child would modify the handler
+    // table in the parent's memory, so use a real fork in that case.
     //
 
+    UseVfork = TRUE;
+    if ((Attributes != NULL) &&
+        (((*Attributes)->Flags & POSIX_SPAWN_SETSIGDEF) != 0)) {
+
+        UseVfork = FALSE;
+    }
+
+    //
+    // Block all signals so that no handler runs in the child while it is
+    // sharing the parent's memory.
+    //
+
+    sigfillset(&AllSignals);
+    sigprocmask(SIG_SETMASK, &AllSignals, &OriginalMask);
     Error = 0;
-    Pid = fork();
+    if (UseVfork != FALSE) {
+        Pid = vfork();
+
+    } else {
+        Pid = fork();
+    }
+
     if (Pid == -1) {
-        return errno;
+        Error = errno;
+        sigprocmask(SIG_SETMASK, &OriginalMask, NULL);
+        return Error;
 
     //
     // In the child, process the attributes and execute the image. With vfork,
@@ -1203,6 +1230,12 @@ Return Value:
     //
 
     } else if (Pid == 0) {
+        if ((Attributes == NULL) ||
+            (((*Attributes)->Flags & POSIX_SPAWN_SETSIGMASK) == 0)) {
+
+            sigprocmask(SIG_SETMASK, &OriginalMask, NULL);
+        }
+
         if (Attributes != NULL) {
             Error = ClpProcessSpawnAttributes(*Attributes);
             if (Error != 0) {
@@ -1240,6 +1273,7 @@ Return Value:
     //
 
     } else {
+        sigprocmask(SIG_SETMASK, &OriginalMask, NULL);
 
         //
         // If the child had a problem, then with vfork the error variable will
@@ -0,0 +1,410 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU Lesser General Public
+    License version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details.
+
+Module Name:
+
+    aio.h
+
+Abstract:
+
+    This header contains definitions for POSIX asynchronous I/O.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+--*/
+
+#ifndef _AIO_H
+#define _AIO_H
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <time.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#ifdef __cplusplus
+
+extern "C" {
+
+#endif
+
+//
+// Define the values returned by aio_cancel.
+//
+
+//
+// All requested operations were cancelled.
+//
+
+#define AIO_CANCELED 1
+
+//
+// At least one of the requested operations could not be cancelled because it
+// was already in progress.
+//
+
+#define AIO_NOTCANCELED 2
+
+//
+// All of the requested operations had already completed.
+//
+
+#define AIO_ALLDONE 3
+
+//
+// Define the modes that can be passed to lio_listio.
+//
+
+//
+// Wait for every operation in the list to complete before returning.
+//
+
+#define LIO_WAIT 1
+
+//
+// Return as soon as the operations are queued.
+//
+
+#define LIO_NOWAIT 2
+
+//
+// Define the operations that can be specified in the aio_lio_opcode member of
+// an asynchronous I/O control block passed to lio_listio.
+//
+
+#define LIO_READ 1
+#define LIO_WRITE 2
+#define LIO_NOP 3
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines an asynchronous I/O control block. The control
+    block must not be modified or freed while the operation is in progress.
+
+Members:
+
+    aio_fildes - Stores the file descriptor to operate on.
+
+    aio_offset - Stores the file offset to perform the I/O at.
+
+    aio_buf - Stores a pointer to the buffer to transfer to or from.
+
+    aio_nbytes - Stores the number of bytes to transfer.
+
+    aio_reqprio - Stores the request priority offset. This is ignored.
+
+    aio_sigevent - Stores the notification to deliver when the operation
+        completes.
+
+    aio_lio_opcode - Stores the operation to perform for lio_listio. See
+        LIO_* definitions.
+
+    __aio_error - Stores the error number of the operation. This is
+        EINPROGRESS while the operation is outstanding. Use aio_error to read
+        it.
+
+    __aio_return - Stores the return value of the operation. Use aio_return
+        to read it.
+
+    __aio_group - Stores a pointer to the list notification this operation
+        belongs to, if any.
+
+    __aio_next - Stores a pointer to the next outstanding control block.
+
+    __aio_previous - Stores a pointer to the previous outstanding control
+        block.
+
+--*/
+
+struct aiocb {
+    int aio_fildes;
+    off_t aio_offset;
+    volatile void *aio_buf;
+    size_t aio_nbytes;
+    int aio_reqprio;
+    struct sigevent aio_sigevent;
+    int aio_lio_opcode;
+    int __aio_error;
+    ssize_t __aio_return;
+    void *__aio_group;
+    struct aiocb *__aio_next;
+    struct aiocb *__aio_previous;
+};
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+LIBC_API
+int
+aio_read (
+    struct aiocb *Control
+    );
+
+/*++
+
+Routine Description:
+
+    This routine queues an asynchronous read of aio_nbytes bytes from the
+    descriptor at aio_offset into aio_buf.
+
+Arguments:
+
+    Control - Supplies a pointer to the asynchronous I/O control block.
+
+Return Value:
+
+    0 if the request was queued.
+
+    -1 on failure, and errno will be set to contain more information. EAGAIN
+    is returned if too many requests are outstanding.
+
+--*/
+
+LIBC_API
+int
+aio_write (
+    struct aiocb *Control
+    );
+
+/*++
+
+Routine Description:
+
+    This routine queues an asynchronous write of aio_nbytes bytes from
+    aio_buf to the descriptor at aio_offset.
+
+Arguments:
+
+    Control - Supplies a pointer to the asynchronous I/O control block.
+
+Return Value:
+
+    0 if the request was queued.
+
+    -1 on failure, and errno will be set to contain more information. EAGAIN
+    is returned if too many requests are outstanding.
+
+--*/
+
+LIBC_API
+int
+aio_fsync (
+    int Operation,
+    struct aiocb *Control
+    );
+
+/*++
+
+Routine Description:
+
+    This routine queues an asynchronous flush of the descriptor's data to its
+    backing storage.
+
+Arguments:
+
+    Operation - Supplies the kind of synchronization. Valid values are O_SYNC
+        and O_DSYNC.
+
+    Control - Supplies a pointer to the asynchronous I/O control block. Only
+        the descriptor and the notification are used.
+
+Return Value:
+
+    0 if the request was queued.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+aio_error (
+    const struct aiocb *Control
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the error status of an asynchronous I/O operation.
+
+Arguments:
+
+    Control - Supplies a pointer to the asynchronous I/O control block.
+
+Return Value:
+
+    EINPROGRESS if the operation has not yet completed.
+
+    0 if the operation completed successfully.
+
+    Returns the error number of the failed operation otherwise.
+
+--*/
+
+LIBC_API
+ssize_t
+aio_return (
+    struct aiocb *Control
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the final result of a completed asynchronous I/O
+    operation. It should be called exactly once per operation, after
+    aio_error reports that it is no longer in progress.
+
+Arguments:
+
+    Control - Supplies a pointer to the asynchronous I/O control block.
+
+Return Value:
+
+    Returns the value the equivalent synchronous call would have returned.
+
+    -1 if the operation failed or is still in progress.
+
+--*/
+
+LIBC_API
+int
+aio_suspend (
+    const struct aiocb *const List[],
+    int Count,
+    const struct timespec *Timeout
+    );
+
+/*++
+
+Routine Description:
+
+    This routine waits for at least one of the given asynchronous I/O
+    operations to complete.
+
+Arguments:
+
+    List - Supplies an array of pointers to control blocks. Null entries are
+        ignored.
+
+    Count - Supplies the number of elements in the array.
+
+    Timeout - Supplies an optional pointer to the relative amount of time to
+        wait. Supply NULL to wait indefinitely.
+
+Return Value:
+
+    0 if at least one of the operations has completed.
+
+    -1 on failure, and errno will be set to contain more information. EAGAIN
+    is returned if the timeout expired, and EINTR if a signal was caught.
+
+--*/
+
+LIBC_API
+int
+aio_cancel (
+    int FileDescriptor,
+    struct aiocb *Control
+    );
+
+/*++
+
+Routine Description:
+
+    This routine attempts to cancel outstanding asynchronous I/O operations.
+    Operations that have been handed to the kernel cannot be cancelled.
+
+Arguments:
+
+    FileDescriptor - Supplies the file descriptor whose operations should be
+        cancelled.
+
+    Control - Supplies an optional pointer to a specific control block to
+        cancel. If NULL, every operation on the descriptor is considered.
+
+Return Value:
+
+    AIO_CANCELED if all the operations were cancelled.
+
+    AIO_NOTCANCELED if at least one operation is still in progress.
+
+    AIO_ALLDONE if all the operations had already completed.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+lio_listio (
+    int Mode,
+    struct aiocb *const List[],
+    int Count,
+    struct sigevent *Event
+    );
+
+/*++
+
+Routine Description:
+
+    This routine queues a list of asynchronous I/O operations with a single
+    call.
+
+Arguments:
+
+    Mode - Supplies whether to wait for the operations to finish. See LIO_WAIT
+        and LIO_NOWAIT.
+
+    List - Supplies an array of pointers to control blocks. Null entries and
+        entries whose opcode is LIO_NOP are ignored.
+
+    Count - Supplies the number of elements in the array.
+
+    Event - Supplies an optional pointer to a notification to deliver once
+        every operation in the list has completed. This is only used with
+        LIO_NOWAIT.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information. EAGAIN
+    is returned if not all the operations could be queued, in which case
+    aio_error reports which ones were.
+
+--*/
+
+#ifdef __cplusplus
+
+}
+
+#endif
+#endif
+
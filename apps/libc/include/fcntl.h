@@ -110,6 +110,19 @@ extern "C" {
 
 #define F_CLOSEM 11
 
+//
+// Get the capacity of a pipe, in bytes.
+//
+
+#define F_GETPIPE_SZ 12
+
+//
+// Set the capacity of a pipe, in bytes. The size is rounded up to a multiple
+// of the page size, and the resulting size is returned.
+//
+
+#define F_SETPIPE_SZ 13
+
 //
 // There's no need for 64-bit versions, since off_t is always 64 bits.
 //
@@ -257,6 +270,16 @@ extern "C" {
 #define O_ASYNC 0x00010000
 #define FASYNC O_ASYNC
 
+//
+// Set this flag to transfer data directly between the caller's buffer and the
+// underlying device, bypassing the file cache. Reads and writes whose offset
+// and size are not aligned to the block size (the page size for regular files)
+// still go through the cache. For best performance the buffer should also be
+// page aligned.
+//
+
+#define O_DIRECT 0x00020000
+
 //
 // Set this flag to enable opening files whose offsets cannot be described in
 // off_t types but can be described in off64_t. Since off_t is always 64-bits,
@@ -472,7 +495,8 @@ Return Value:
 
     Returns some value other than -1 to indicate success. For some commands
     (like F_DUPFD) this is a file descriptor. For others (like F_GETFD and
-    F_GETFL) this is a bitfield of status flags.
+    F_GETFL) this is a bitfield of status flags. For F_GETPIPE_SZ and
+    F_SETPIPE_SZ this is the capacity of the pipe in bytes.
 
     -1 on error, and errno will be set to indicate the error.
 
@@ -0,0 +1,344 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU Lesser General Public
+    License version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details.
+
+Module Name:
+
+    epoll.h
+
+Abstract:
+
+    This header contains definitions for event poll sets, which wait on a
+    persistent set of file descriptors.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+--*/
+
+#ifndef _SYS_EPOLL_H
+#define _SYS_EPOLL_H
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#ifdef __cplusplus
+
+extern "C" {
+
+#endif
+
+//
+// Define the events that can be waited on. These are the same as the poll
+// events.
+//
+
+#define EPOLLIN POLLIN
+#define EPOLLRDNORM POLLRDNORM
+#define EPOLLPRI POLLPRI
+#define EPOLLRDBAND POLLRDBAND
+#define EPOLLOUT POLLOUT
+#define EPOLLWRNORM POLLWRNORM
+#define EPOLLWRBAND POLLWRBAND
+
+//
+// These events are always reported, and are ignored if set in the requested
+// events.
+//
+
+#define EPOLLERR POLLERR
+#define EPOLLHUP POLLHUP
+
+//
+// Set this flag to only report the descriptor once each time one of the
+// requested events occurs, rather than for as long as the event remains set.
+//
+
+#define EPOLLET (1U << 31)
+
+//
+// Set this flag to disable the descriptor after it is reported once. It must
+// be re-armed with EPOLL_CTL_MOD.
+//
+
+#define EPOLLONESHOT (1U << 30)
+
+//
+// Define the flags that can be passed to epoll_create1.
+//
+
+#define EPOLL_CLOEXEC O_CLOEXEC
+
+//
+// Define the operations that can be passed to epoll_ctl.
+//
+
+//
+// Add a descriptor to the set.
+//
+
+#define EPOLL_CTL_ADD 1
+
+//
+// Remove a descriptor from the set.
+//
+
+#define EPOLL_CTL_DEL 2
+
+//
+// Change the events for a descriptor in the set.
+//
+
+#define EPOLL_CTL_MOD 3
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This union defines the data associated with a descriptor in an event poll
+    set. The data is returned untouched when the descriptor is ready.
+
+Members:
+
+    ptr - Stores a pointer value.
+
+    fd - Stores a file descriptor.
+
+    u32 - Stores a 32-bit value.
+
+    u64 - Stores a 64-bit value.
+
+--*/
+
+typedef union epoll_data {
+    void *ptr;
+    int fd;
+    uint32_t u32;
+    uint64_t u64;
+} epoll_data_t;
+
+/*++
+
+Structure Description:
+
+    This structure defines an event poll event.
+
+Members:
+
+    events - Stores the mask of events. When adding or modifying a descriptor
+        this is the set of requested events and flags. When returned from a
+        wait, this is the set of events that occurred.
+
+    data - Stores the data associated with the descriptor.
+
+--*/
+
+struct epoll_event {
+    uint32_t events;
+    epoll_data_t data;
+};
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+LIBC_API
+int
+epoll_create (
+    int Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a new event poll set.
+
+Arguments:
+
+    Size - Supplies a hint as to the number of descriptors that will be added.
+        This is ignored, but must be greater than zero.
+
+Return Value:
+
+    Returns a file descriptor for the new set on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+epoll_create1 (
+    int Flags
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a new event poll set.
+
+Arguments:
+
+    Flags - Supplies a bitfield of flags. The only valid flag is
+        EPOLL_CLOEXEC.
+
+Return Value:
+
+    Returns a file descriptor for the new set on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+epoll_ctl (
+    int EventPoll,
+    int Operation,
+    int FileDescriptor,
+    struct epoll_event *Event
+    );
+
+/*++
+
+Routine Description:
+
+    This routine adds, modifies, or removes a file descriptor in an event poll
+    set.
+
+Arguments:
+
+    EventPoll - Supplies the file descriptor of the event poll set.
+
+    Operation - Supplies the operation to perform. See EPOLL_CTL_*
+        definitions.
+
+    FileDescriptor - Supplies the file descriptor to operate on.
+
+    Event - Supplies a pointer to the requested events and associated data.
+        This is ignored for EPOLL_CTL_DEL.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+epoll_wait (
+    int EventPoll,
+    struct epoll_event *Events,
+    int MaxEvents,
+    int Timeout
+    );
+
+/*++
+
+Routine Description:
+
+    This routine waits for file descriptors in an event poll set to become
+    ready.
+
+Arguments:
+
+    EventPoll - Supplies the file descriptor of the event poll set.
+
+    Events - Supplies a pointer to an array where the events for the ready
+        descriptors will be returned.
+
+    MaxEvents - Supplies the number of elements in the events array. This
+        must be greater than zero.
+
+    Timeout - Supplies the amount of time in milliseconds to block before
+        giving up and returning anyway. Supply 0 to not block at all, and
+        supply -1 to wait for an indefinite amount of time.
+
+Return Value:
+
+    Returns the number of ready descriptors on success.
+
+    Returns 0 to indicate a timeout.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+epoll_pwait (
+    int EventPoll,
+    struct epoll_event *Events,
+    int MaxEvents,
+    int Timeout,
+    const sigset_t *SignalMask
+    );
+
+/*++
+
+Routine Description:
+
+    This routine waits for file descriptors in an event poll set to become
+    ready, atomically setting the signal mask for the duration of the wait.
+
+Arguments:
+
+    EventPoll - Supplies the file descriptor of the event poll set.
+
+    Events - Supplies a pointer to an array where the events for the ready
+        descriptors will be returned.
+
+    MaxEvents - Supplies the number of elements in the events array. This
+        must be greater than zero.
+
+    Timeout - Supplies the amount of time in milliseconds to block before
+        giving up and returning anyway. Supply 0 to not block at all, and
+        supply -1 to wait for an indefinite amount of time.
+
+    SignalMask - Supplies an optional pointer to a signal mask to set for the
+        duration of the wait.
+
+Return Value:
+
+    Returns the number of ready descriptors on success.
+
+    Returns 0 to indicate a timeout.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+#ifdef __cplusplus
+
+}
+
+#endif
+#endif
+
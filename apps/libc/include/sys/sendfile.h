@@ -0,0 +1,102 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU Lesser General Public
+    License version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details.
+
+Module Name:
+
+    sendfile.h
+
+Abstract:
+
+    This header contains definitions for transferring data between file
+    descriptors within the kernel.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+--*/
+
+#ifndef _SYS_SENDFILE_H
+#define _SYS_SENDFILE_H
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <sys/types.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#ifdef __cplusplus
+
+extern "C" {
+
+#endif
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+LIBC_API
+ssize_t
+sendfile (
+    int OutputDescriptor,
+    int InputDescriptor,
+    off_t *Offset,
+    size_t ByteCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine copies data from one file descriptor to another within the
+    kernel, which is more efficient than reading the data into a user buffer
+    and writing it back out. The input descriptor is usually a regular file,
+    and the output descriptor is usually a socket or pipe.
+
+Arguments:
+
+    OutputDescriptor - Supplies the file descriptor to write the data to.
+
+    InputDescriptor - Supplies the file descriptor to read the data from.
+
+    Offset - Supplies an optional pointer to the offset in the input file to
+        start reading from. On return, this is updated to the offset just
+        beyond the last byte read, and the input descriptor's file position
+        is left unchanged. If NULL, reading starts at the input descriptor's
+        current file position, which is updated.
+
+    ByteCount - Supplies the number of bytes to transfer.
+
+Return Value:
+
+    Returns the number of bytes transferred on success. This may be less than
+    requested.
+
+    -1 on failure, and errno will contain more information.
+
+--*/
+
+#ifdef __cplusplus
+
+}
+
+#endif
+#endif
+
@@ -29,6 +29,7 @@ Module Name:
 
 #include <sys/uio.h>
 #include <sys/ioctl.h>
+#include <time.h>
 
 //
 // --------------------------------------------------------------------- Macros
@@ -240,6 +241,14 @@ extern "C" {
 
 #define MSG_DONTROUTE 0x00000100
 
+//
+// This flag is only valid for recvmmsg, and requests that the call block only
+// until the first message arrives, returning whatever else is immediately
+// available after that.
+//
+
+#define MSG_WAITFORONE 0x00010000
+
 //
 // Define the shutdown types. Read closes the socket for further reading, write
 // closes the socket for further writing, and rdwr closes the socket for both
@@ -583,6 +592,26 @@ struct msghdr {
 
 /*++
 
+Structure Description:
+
+    This structure defines a single entry in a batch of messages sent or
+    received with sendmmsg or recvmmsg.
+
+Members:
+
+    msg_hdr - Stores the message itself.
+
+    msg_len - Stores the number of bytes sent or received for this message.
+
+--*/
+
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
+/*++
+
 Structure Description:
 
     This structure defines a socket control message, the header for the socket
@@ -1116,6 +1145,87 @@ Return Value:
 
 --*/
 
+LIBC_API
+int
+sendmmsg (
+    int Socket,
+    struct mmsghdr *Messages,
+    unsigned int MessageCount,
+    int Flags
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sends a batch of messages out of a socket. Each message is
+    sent as if by sendmsg, and the number of bytes sent for each is stored in
+    its msg_len member.
+
+Arguments:
+
+    Socket - Supplies the file descriptor of the socket to send data out of.
+
+    Messages - Supplies an array of messages to send.
+
+    MessageCount - Supplies the number of elements in the messages array.
+
+    Flags - Supplies a bitfield of flags governing the transmission of the data.
+        See MSG_* definitions.
+
+Return Value:
+
+    Returns the number of messages sent on success. This may be less than the
+    message count if an error occurred after the first message was sent.
+
+    -1 on error, and the errno variable will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+recvmmsg (
+    int Socket,
+    struct mmsghdr *Messages,
+    unsigned int MessageCount,
+    int Flags,
+    struct timespec *Timeout
+    );
+
+/*++
+
+Routine Description:
+
+    This routine receives a batch of messages from a socket. Each message is
+    received as if by recvmsg, and the number of bytes received for each is
+    stored in its msg_len member.
+
+Arguments:
+
+    Socket - Supplies the file descriptor of the socket to receive data from.
+
+    Messages - Supplies an array of initialized messages where the received
+        data will be returned.
+
+    MessageCount - Supplies the number of elements in the messages array.
+
+    Flags - Supplies a bitfield of flags governing the reception of the data.
+        See MSG_* definitions. MSG_WAITFORONE makes every receive after the
+        first non-blocking.
+
+    Timeout - Supplies an optional pointer to the maximum amount of time to
+        spend receiving the batch. Supply NULL to wait indefinitely.
+
+Return Value:
+
+    Returns the number of messages received on success. This may be less than
+    the message count if an error occurred after the first message was
+    received or the timeout expired.
+
+    -1 on error, and the errno variable will be set to contain more information.
+
+--*/
+
 LIBC_API
 int
 shutdown (
@@ -2799,6 +2799,36 @@ Return Value:
 
 --*/
 
+LIBC_API
+pid_t
+vfork (
+    void
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a new process that temporarily shares the memory of
+    the calling process. The calling thread is suspended until the child
+    executes a new image or exits. The child must not return from the function
+    that called vfork, and should only call one of the exec functions or _exit.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns 0 to the child process.
+
+    Returns the process ID of the child process to the parent process.
+
+    Returns -1 to the parent process on error, and the errno variable will be
+    set to provide more information about the error.
+
+--*/
+
 LIBC_API
 uid_t
 getuid (
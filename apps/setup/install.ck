@@ -97,6 +97,7 @@ var DriverFiles = [
     "acpi.drv",
     "ehci.drv",
     "fat.drv",
+    "loop.drv",
     "net80211.drv",
     "netcore.drv",
     "null.drv",
@@ -112,6 +113,7 @@ var DriverFiles = [
     "smsc95xx.drv",
     "sound.drv",
     "special.drv",
+    "tmpfs.drv",
     "usbcomp.drv",
     "usbcore.drv",
     "usbhid.drv",
@@ -150,9 +152,11 @@ if ((arch == "x86") || (arch == "x64")) {
 var BootDrivers = [
     "acpi.drv",
     "fat.drv",
+    "loop.drv",
     "null.drv",
     "part.drv",
     "special.drv",
+    "tmpfs.drv",
     "videocon.drv",
 ];
 
@@ -486,6 +490,7 @@ if (plat == "install-armv6") {
         "libcrypt.so.1",
         "libminocaos.so.1",
         "loadefi",
+        "loop.drv",
         "net80211.drv",
         "netcore.drv",
         "null.drv",
@@ -512,6 +517,7 @@ if (plat == "install-armv6") {
         "sound.drv",
         "spb.drv",
         "special.drv",
+        "tmpfs.drv",
         "tps65217.drv",
         "usbcomp.drv",
         "usbcore.drv",
@@ -612,6 +618,7 @@ if (plat == "install-armv7") {
         "libcrypt.so.1",
         "libminocaos.so.1",
         "loadefi",
+        "loop.drv",
         "net80211.drv",
         "netcore.drv",
         "null.drv",
@@ -642,6 +649,7 @@ if (plat == "install-armv7") {
         "sound.drv",
         "spb.drv",
         "special.drv",
+        "tmpfs.drv",
         "tps65217.drv",
         "usbcomp.drv",
         "usbcore.drv",
@@ -737,6 +745,7 @@ if ((plat == "install-x86") || (plat == "install-x64")) {
         "libminocaos.so.1",
         "loader",
         "loadefi",
+        "loop.drv",
         "mbr.bin",
         "net80211.drv",
         "netcore.drv",
@@ -756,6 +765,7 @@ if ((plat == "install-x86") || (plat == "install-x64")) {
         "smsc95xx.drv",
         "sound.drv",
         "special.drv",
+        "tmpfs.drv",
         "uhci.drv",
         "usbcomp.drv",
         "usbcore.drv",
@@ -1026,6 +1036,7 @@ if ((plat == "pc32-tiny") || (plat == "pc64-tiny")) {
         "part.drv",
         "pci.drv",
         "special.drv",
+        "tmpfs.drv",
         "usrinput.drv",
         "videocon.drv",
         "ata.drv",
@@ -1041,6 +1052,7 @@ if ((plat == "pc32-tiny") || (plat == "pc64-tiny")) {
         "part.drv",
         "pci.drv",
         "special.drv",
+        "tmpfs.drv",
         "videocon.drv",
     ];
 
@@ -29,6 +29,7 @@ Module Name:
 // ------------------------------------------------------------------- Includes
 //
 
+#include <aio.h>
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -36,9 +37,12 @@ Module Name:
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <minoca/lib/types.h>
 
@@ -52,6 +56,17 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// Define the parameters of the POSIX asynchronous I/O tests and benchmark.
+//
+
+#define TEST_AIO_FILE_NAME "aiotest.tmp"
+#define TEST_AIO_BLOCK_SIZE 4096
+#define TEST_AIO_BLOCK_COUNT 256
+#define TEST_AIO_LIST_SIZE 8
+#define TEST_AIO_BENCHMARK_MAX_DEPTH 128
+#define TEST_AIO_BENCHMARK_OPERATIONS 16384
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -70,6 +85,27 @@ TestAioExecute (
     int Pipe[2]
     );
 
+ULONG
+TestAioPosix (
+    VOID
+    );
+
+ULONG
+TestAioBenchmark (
+    VOID
+    );
+
+int
+TestAioCreateFile (
+    VOID
+    );
+
+ULONG
+TestAioWaitFor (
+    struct aiocb *Control,
+    ssize_t ExpectedResult
+    );
+
 void
 TestAioSigioHandler (
     int Signal,
@@ -97,7 +133,9 @@ main (
 
 Routine Description:
 
-    This routine implements the signal test program.
+    This routine implements the asynchronous I/O test program. Supply
+    "bench" as the first argument to run the queue depth benchmark instead of
+    the tests.
 
 Arguments:
 
@@ -118,7 +156,13 @@ Return Value:
 
     ULONG Failures;
 
-    Failures = TestAioRun();
+    if ((ArgumentCount > 1) && (strcmp(Arguments[1], "bench") == 0)) {
+        Failures = TestAioBenchmark();
+
+    } else {
+        Failures = TestAioRun();
+    }
+
     if (Failures == 0) {
         return 0;
     }
@@ -184,6 +228,7 @@ Return Value:
     }
 
     Failures += TestAioExecute(Pipe);
+    Failures += TestAioPosix();
 
 TestAioRunEnd:
     sigaction(SIGIO, &OldAction, NULL);
@@ -401,6 +446,459 @@ Return Value:
     return Failures;
 }
 
+ULONG
+TestAioPosix (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests the POSIX asynchronous I/O functions against a regular
+    file.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    0 on success.
+
+    Returns the number of errors on failure.
+
+--*/
+
+{
+
+    char *Buffer;
+    struct aiocb Control;
+    ULONG Failures;
+    int File;
+    int Index;
+    struct aiocb ListControls[TEST_AIO_LIST_SIZE];
+    struct aiocb *List[TEST_AIO_LIST_SIZE];
+    struct timespec Timeout;
+
+    Failures = 0;
+    Buffer = malloc(TEST_AIO_BLOCK_SIZE * TEST_AIO_LIST_SIZE);
+    if (Buffer == NULL) {
+        ERROR("Failed to allocate buffer.\n");
+        return 1;
+    }
+
+    File = TestAioCreateFile();
+    if (File < 0) {
+        Failures += 1;
+        goto TestAioPosixEnd;
+    }
+
+    //
+    // Write a block of recognizable data and read it back.
+    //
+
+    memset(&Control, 0, sizeof(Control));
+    memset(Buffer, 'A', TEST_AIO_BLOCK_SIZE);
+    Control.aio_fildes = File;
+    Control.aio_offset = TEST_AIO_BLOCK_SIZE;
+    Control.aio_buf = Buffer;
+    Control.aio_nbytes = TEST_AIO_BLOCK_SIZE;
+    Control.aio_sigevent.sigev_notify = SIGEV_NONE;
+    if (aio_write(&Control) != 0) {
+        ERROR("aio_write failed: %s.\n", strerror(errno));
+        Failures += 1;
+        goto TestAioPosixEnd;
+    }
+
+    Failures += TestAioWaitFor(&Control, TEST_AIO_BLOCK_SIZE);
+    if (aio_fsync(O_SYNC, &Control) != 0) {
+        ERROR("aio_fsync failed: %s.\n", strerror(errno));
+        Failures += 1;
+        goto TestAioPosixEnd;
+    }
+
+    Failures += TestAioWaitFor(&Control, 0);
+    memset(Buffer, 0, TEST_AIO_BLOCK_SIZE);
+    Control.aio_nbytes = TEST_AIO_BLOCK_SIZE;
+    if (aio_read(&Control) != 0) {
+        ERROR("aio_read failed: %s.\n", strerror(errno));
+        Failures += 1;
+        goto TestAioPosixEnd;
+    }
+
+    Failures += TestAioWaitFor(&Control, TEST_AIO_BLOCK_SIZE);
+    for (Index = 0; Index < TEST_AIO_BLOCK_SIZE; Index += 1) {
+        if (Buffer[Index] != 'A') {
+            ERROR("aio_read returned bad data at %d: %x.\n",
+                  Index,
+                  Buffer[Index]);
+
+            Failures += 1;
+            break;
+        }
+    }
+
+    //
+    // Reading at the end of the file should return zero bytes.
+    //
+
+    Control.aio_offset = TEST_AIO_BLOCK_SIZE * TEST_AIO_BLOCK_COUNT;
+    if (aio_read(&Control) != 0) {
+        ERROR("aio_read at EOF failed: %s.\n", strerror(errno));
+        Failures += 1;
+        goto TestAioPosixEnd;
+    }
+
+    Failures += TestAioWaitFor(&Control, 0);
+
+    //
+    // Read a list of blocks at once and wait for them all.
+    //
+
+    memset(ListControls, 0, sizeof(ListControls));
+    for (Index = 0; Index < TEST_AIO_LIST_SIZE; Index += 1) {
+        ListControls[Index].aio_fildes = File;
+        ListControls[Index].aio_offset = Index * TEST_AIO_BLOCK_SIZE;
+        ListControls[Index].aio_buf = Buffer + (Index * TEST_AIO_BLOCK_SIZE);
+        ListControls[Index].aio_nbytes = TEST_AIO_BLOCK_SIZE;
+        ListControls[Index].aio_lio_opcode = LIO_READ;
+        ListControls[Index].aio_sigevent.sigev_notify = SIGEV_NONE;
+        List[Index] = &(ListControls[Index]);
+    }
+
+    ListControls[TEST_AIO_LIST_SIZE - 1].aio_lio_opcode = LIO_NOP;
+    if (lio_listio(LIO_WAIT, List, TEST_AIO_LIST_SIZE, NULL) != 0) {
+        ERROR("lio_listio failed: %s.\n", strerror(errno));
+        Failures += 1;
+        goto TestAioPosixEnd;
+    }
+
+    for (Index = 0; Index < TEST_AIO_LIST_SIZE - 1; Index += 1) {
+        if ((aio_error(List[Index]) != 0) ||
+            (aio_return(List[Index]) != TEST_AIO_BLOCK_SIZE)) {
+
+            ERROR("lio_listio element %d failed.\n", Index);
+            Failures += 1;
+        }
+    }
+
+    if (Buffer[TEST_AIO_BLOCK_SIZE] != 'A') {
+        ERROR("lio_listio read bad data.\n");
+        Failures += 1;
+    }
+
+    //
+    // Waiting on nothing with a timeout should succeed immediately, and
+    // cancelling completed operations should report them as done.
+    //
+
+    Timeout.tv_sec = 0;
+    Timeout.tv_nsec = 1000000;
+    if (aio_suspend((const struct aiocb *const *)List, 1, &Timeout) != 0) {
+        ERROR("aio_suspend on completed request failed.\n");
+        Failures += 1;
+    }
+
+    if (aio_cancel(File, NULL) != AIO_ALLDONE) {
+        ERROR("aio_cancel did not return AIO_ALLDONE.\n");
+        Failures += 1;
+    }
+
+TestAioPosixEnd:
+    if (File >= 0) {
+        close(File);
+        unlink(TEST_AIO_FILE_NAME);
+    }
+
+    free(Buffer);
+    return Failures;
+}
+
+ULONG
+TestAioBenchmark (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine measures random read throughput through the POSIX
+    asynchronous I/O interface at queue depths from 1 to 128.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    0 on success.
+
+    Returns the number of errors on failure.
+
+--*/
+
+{
+
+    char *Buffer;
+    struct aiocb *Control;
+    struct aiocb *Controls;
+    int Depth;
+    double Elapsed;
+    struct timespec End;
+    ULONG Failures;
+    int File;
+    int Index;
+    ULONG Issued;
+    struct aiocb **List;
+    ULONG Retired;
+    struct timespec Start;
+
+    Failures = 0;
+    Buffer = malloc(TEST_AIO_BLOCK_SIZE * TEST_AIO_BENCHMARK_MAX_DEPTH);
+    Controls = calloc(TEST_AIO_BENCHMARK_MAX_DEPTH, sizeof(struct aiocb));
+    List = calloc(TEST_AIO_BENCHMARK_MAX_DEPTH, sizeof(struct aiocb *));
+    File = -1;
+    if ((Buffer == NULL) || (Controls == NULL) || (List == NULL)) {
+        ERROR("Failed to allocate benchmark buffers.\n");
+        Failures += 1;
+        goto TestAioBenchmarkEnd;
+    }
+
+    File = TestAioCreateFile();
+    if (File < 0) {
+        Failures += 1;
+        goto TestAioBenchmarkEnd;
+    }
+
+    srand(1);
+    printf("Depth     Ops/s      MB/s\n");
+    for (Depth = 1; Depth <= TEST_AIO_BENCHMARK_MAX_DEPTH; Depth *= 2) {
+        Issued = 0;
+        Retired = 0;
+        clock_gettime(CLOCK_MONOTONIC, &Start);
+
+        //
+        // Keep the given number of reads in flight, reissuing each one as
+        // soon as it completes.
+        //
+
+        for (Index = 0; Index < Depth; Index += 1) {
+            Control = &(Controls[Index]);
+            memset(Control, 0, sizeof(struct aiocb));
+            Control->aio_fildes = File;
+            Control->aio_buf = Buffer + (Index * TEST_AIO_BLOCK_SIZE);
+            Control->aio_nbytes = TEST_AIO_BLOCK_SIZE;
+            Control->aio_sigevent.sigev_notify = SIGEV_NONE;
+            Control->aio_offset = (rand() % TEST_AIO_BLOCK_COUNT) *
+                                  TEST_AIO_BLOCK_SIZE;
+
+            if (aio_read(Control) != 0) {
+                ERROR("aio_read failed: %s.\n", strerror(errno));
+                Failures += 1;
+                goto TestAioBenchmarkEnd;
+            }
+
+            List[Index] = Control;
+            Issued += 1;
+        }
+
+        while (Retired < Issued) {
+            if (aio_suspend((const struct aiocb *const *)List,
+                            Depth,
+                            NULL) != 0) {
+
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                ERROR("aio_suspend failed: %s.\n", strerror(errno));
+                Failures += 1;
+                goto TestAioBenchmarkEnd;
+            }
+
+            for (Index = 0; Index < Depth; Index += 1) {
+                Control = List[Index];
+                if ((Control == NULL) || (aio_error(Control) == EINPROGRESS)) {
+                    continue;
+                }
+
+                Retired += 1;
+                if (aio_return(Control) != TEST_AIO_BLOCK_SIZE) {
+                    ERROR("Benchmark read failed: %s.\n", strerror(errno));
+                    Failures += 1;
+                    goto TestAioBenchmarkEnd;
+                }
+
+                if (Issued == TEST_AIO_BENCHMARK_OPERATIONS) {
+                    List[Index] = NULL;
+                    continue;
+                }
+
+                Control->aio_offset = (rand() % TEST_AIO_BLOCK_COUNT) *
+                                      TEST_AIO_BLOCK_SIZE;
+
+                if (aio_read(Control) != 0) {
+                    ERROR("aio_read failed: %s.\n", strerror(errno));
+                    Failures += 1;
+                    goto TestAioBenchmarkEnd;
+                }
+
+                Issued += 1;
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &End);
+        Elapsed = (double)(End.tv_sec - Start.tv_sec) +
+                  ((double)(End.tv_nsec - Start.tv_nsec) / 1000000000.0);
+
+        if (Elapsed <= 0) {
+            Elapsed = 0.000001;
+        }
+
+        printf("%5d %9.0f %9.2f\n",
+               Depth,
+               Retired / Elapsed,
+               (Retired * (double)TEST_AIO_BLOCK_SIZE) /
+               (Elapsed * 1024.0 * 1024.0));
+    }
+
+TestAioBenchmarkEnd:
+    if (File >= 0) {
+        close(File);
+        unlink(TEST_AIO_FILE_NAME);
+    }
+
+    if (List != NULL) {
+        free(List);
+    }
+
+    if (Controls != NULL) {
+        free(Controls);
+    }
+
+    if (Buffer != NULL) {
+        free(Buffer);
+    }
+
+    return Failures;
+}
+
+int
+TestAioCreateFile (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates and fills the scratch file used by the POSIX
+    asynchronous I/O tests.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns an open file descriptor on success.
+
+    -1 on failure.
+
+--*/
+
+{
+
+    char Block[TEST_AIO_BLOCK_SIZE];
+    int File;
+    int Index;
+
+    File = open(TEST_AIO_FILE_NAME, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (File < 0) {
+        ERROR("Failed to create %s: %s.\n",
+              TEST_AIO_FILE_NAME,
+              strerror(errno));
+
+        return -1;
+    }
+
+    for (Index = 0; Index < TEST_AIO_BLOCK_COUNT; Index += 1) {
+        memset(Block, Index, TEST_AIO_BLOCK_SIZE);
+        if (write(File, Block, TEST_AIO_BLOCK_SIZE) != TEST_AIO_BLOCK_SIZE) {
+            ERROR("Failed to fill %s: %s.\n",
+                  TEST_AIO_FILE_NAME,
+                  strerror(errno));
+
+            close(File);
+            unlink(TEST_AIO_FILE_NAME);
+            return -1;
+        }
+    }
+
+    return File;
+}
+
+ULONG
+TestAioWaitFor (
+    struct aiocb *Control,
+    ssize_t ExpectedResult
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for an asynchronous operation to complete and checks
+    its result.
+
+Arguments:
+
+    Control - Supplies a pointer to the control block to wait for.
+
+    ExpectedResult - Supplies the expected return value of the operation.
+
+Return Value:
+
+    0 on success.
+
+    1 on failure.
+
+--*/
+
+{
+
+    const struct aiocb *List[1];
+    ssize_t Result;
+
+    List[0] = Control;
+    while (aio_error(Control) == EINPROGRESS) {
+        if ((aio_suspend(List, 1, NULL) != 0) && (errno != EINTR)) {
+            ERROR("aio_suspend failed: %s.\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    if (aio_error(Control) != 0) {
+        ERROR("Async operation failed: %s.\n",
+              strerror(aio_error(Control)));
+
+        return 1;
+    }
+
+    Result = aio_return(Control);
+    if (Result != ExpectedResult) {
+        ERROR("Async operation returned %ld, expected %ld.\n",
+              (long)Result,
+              (long)ExpectedResult);
+
+        return 1;
+    }
+
+    return 0;
+}
+
 void
 TestAioSigioHandler (
     int Signal,
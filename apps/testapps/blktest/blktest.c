@@ -0,0 +1,1135 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    blktest.c
+
+Abstract:
+
+    This module implements the block I/O scheduler test. It slows down a RAM
+    disk, reads from it with many threads at once, and checks that the
+    scheduler merged adjacent requests without mixing up anyone's data. It
+    also attaches a file to a loop device and checks that data and bandwidth
+    limits make it through.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    User Mode
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/lib/minocaos.h>
+#include <minoca/devinfo/loop.h>
+#include <minoca/devinfo/ramdisk.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+#define DEBUG_PRINT(...)                    \
+    if (BlockTestVerbose != FALSE) {        \
+        printf(__VA_ARGS__);                \
+    }
+
+#define PRINT_ERROR(...) printf(__VA_ARGS__)
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the size of the region of the RAM disk to read, and the size of each
+// read.
+//
+
+#define BLOCK_TEST_REGION_SIZE (1024 * 1024)
+#define BLOCK_TEST_CHUNK_SIZE 4096
+
+//
+// Define the number of threads reading at once.
+//
+
+#define BLOCK_TEST_THREAD_COUNT 8
+
+//
+// Define the latency to inject into each RAM disk request, in microseconds.
+// This keeps the device busy long enough for requests to pile up.
+//
+
+#define BLOCK_TEST_LATENCY 2000
+
+//
+// Define the queue depth to use during the test.
+//
+
+#define BLOCK_TEST_QUEUE_DEPTH 1
+
+//
+// Define the name and size of the file backing the loop device.
+//
+
+#define BLOCK_TEST_LOOP_FILE "blktest_loop.img"
+#define BLOCK_TEST_LOOP_SIZE (256 * 1024)
+
+//
+// Define the bandwidth limit to put on the loop device, in bytes per second.
+// Reading the whole device should then take a quarter of a second.
+//
+
+#define BLOCK_TEST_LOOP_BANDWIDTH (1024 * 1024)
+
+//
+// Define how many times to look for a new loop device to start, and how long
+// to wait between looks, in microseconds.
+//
+
+#define BLOCK_TEST_LOOP_RETRY_COUNT 100
+#define BLOCK_TEST_LOOP_RETRY_DELAY 10000
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines the context handed to each reader thread.
+
+Members:
+
+    Handle - Stores the open handle to the RAM disk.
+
+    Buffer - Stores a pointer to the buffer the whole region is read into.
+
+    RegionSize - Stores the size of the region being read.
+
+    Index - Stores the index of this thread. Thread N reads every chunk whose
+        index modulo the thread count is N, so neighboring threads ask for
+        neighboring chunks at the same time.
+
+    Status - Stores the result of the thread's reads.
+
+--*/
+
+typedef struct _BLOCK_TEST_THREAD {
+    HANDLE Handle;
+    PUCHAR Buffer;
+    UINTN RegionSize;
+    UINTN Index;
+    KSTATUS Status;
+} BLOCK_TEST_THREAD, *PBLOCK_TEST_THREAD;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+ULONG
+RunBlockQueueTest (
+    VOID
+    );
+
+ULONG
+RunLoopDeviceTest (
+    VOID
+    );
+
+KSTATUS
+BlockTestFindRamDisk (
+    PDEVICE_ID DeviceId,
+    PRAM_DISK_DEVICE_INFORMATION Information
+    );
+
+KSTATUS
+BlockTestGetQueue (
+    DEVICE_ID DeviceId,
+    PIO_BLOCK_QUEUE_INFORMATION Queue
+    );
+
+KSTATUS
+BlockTestSetQueueDepth (
+    DEVICE_ID DeviceId,
+    ULONG QueueDepth
+    );
+
+KSTATUS
+BlockTestSetLatency (
+    DEVICE_ID DeviceId,
+    ULONG Latency
+    );
+
+KSTATUS
+BlockTestAttachLoopDevice (
+    PCSTR Path,
+    PDEVICE_ID DeviceId
+    );
+
+KSTATUS
+BlockTestSetLoopDevice (
+    DEVICE_ID DeviceId,
+    ULONG Flags,
+    ULONGLONG Bandwidth
+    );
+
+void *
+BlockTestReaderThread (
+    void *Parameter
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Set this to TRUE to enable more verbose debug output.
+//
+
+BOOL BlockTestVerbose = TRUE;
+
+UUID BlockTestRamDiskUuid = RAM_DISK_DEVICE_INFORMATION_UUID;
+UUID BlockTestLoopControlUuid = LOOP_CONTROL_INFORMATION_UUID;
+UUID BlockTestLoopDeviceUuid = LOOP_DEVICE_INFORMATION_UUID;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+int
+main (
+    int ArgumentCount,
+    char **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the block I/O scheduler test program.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of elements in the arguments array.
+
+    Arguments - Supplies an array of strings. The array count is bounded by the
+        previous parameter, and the strings are null-terminated.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    ULONG Failures;
+
+    Failures = RunBlockQueueTest();
+    Failures += RunLoopDeviceTest();
+    if (Failures == 0) {
+        DEBUG_PRINT("All block I/O scheduler tests pass.\n");
+        return 0;
+    }
+
+    PRINT_ERROR("*** %d failures in block I/O scheduler test. ***\n",
+                Failures);
+
+    return 1;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+ULONG
+RunBlockQueueTest (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads a region of a slowed down RAM disk once on its own and
+    then again with several threads at once. The data must match, and the
+    concurrent reads should have been merged.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of failures in the test.
+
+--*/
+
+{
+
+    IO_BLOCK_QUEUE_INFORMATION After;
+    IO_BLOCK_QUEUE_INFORMATION Before;
+    UINTN BytesCompleted;
+    DEVICE_ID DeviceId;
+    ULONG Failures;
+    HANDLE Handle;
+    RAM_DISK_DEVICE_INFORMATION Information;
+    ULONGLONG Merges;
+    ULONG OriginalLatency;
+    PUCHAR Reference;
+    PUCHAR Result;
+    UINTN RegionSize;
+    BOOL Restore;
+    KSTATUS Status;
+    BLOCK_TEST_THREAD Threads[BLOCK_TEST_THREAD_COUNT];
+    pthread_t ThreadIds[BLOCK_TEST_THREAD_COUNT];
+    UINTN ThreadIndex;
+
+    Failures = 0;
+    Handle = INVALID_HANDLE;
+    Reference = NULL;
+    Restore = FALSE;
+    Result = NULL;
+    Status = BlockTestFindRamDisk(&DeviceId, &Information);
+    if (Status == STATUS_NO_SUCH_DEVICE) {
+        DEBUG_PRINT("No RAM disk found, skipping block I/O scheduler "
+                    "test.\n");
+
+        return 0;
+    }
+
+    if (!KSUCCESS(Status)) {
+        PRINT_ERROR("Failed to find RAM disk: %d\n", Status);
+        return 1;
+    }
+
+    OriginalLatency = Information.Latency;
+    RegionSize = BLOCK_TEST_REGION_SIZE;
+    if (RegionSize > Information.Size) {
+        RegionSize = Information.Size & ~(BLOCK_TEST_CHUNK_SIZE - 1);
+    }
+
+    Reference = malloc(RegionSize);
+    Result = malloc(RegionSize);
+    if ((Reference == NULL) || (Result == NULL)) {
+        PRINT_ERROR("Failed to allocate buffers.\n");
+        Failures += 1;
+        goto RunBlockQueueTestEnd;
+    }
+
+    Status = OsOpenDevice(DeviceId, SYS_OPEN_FLAG_READ, &Handle);
+    if (!KSUCCESS(Status)) {
+        PRINT_ERROR("Failed to open RAM disk 0x%llx: %d\n", DeviceId, Status);
+        Failures += 1;
+        goto RunBlockQueueTestEnd;
+    }
+
+    //
+    // Read the region in one go for reference. This also makes sure the
+    // device has a queue.
+    //
+
+    Status = OsPerformIo(Handle,
+                         0,
+                         RegionSize,
+                         0,
+                         SYS_WAIT_TIME_INDEFINITE,
+                         Reference,
+                         &BytesCompleted);
+
+    if ((!KSUCCESS(Status)) || (BytesCompleted != RegionSize)) {
+        PRINT_ERROR("Failed to read RAM disk: %d, %ld of %ld bytes\n",
+                    Status,
+                    BytesCompleted,
+                    RegionSize);
+
+        Failures += 1;
+        goto RunBlockQueueTestEnd;
+    }
+
+    Status = BlockTestGetQueue(DeviceId, &Before);
+    if (!KSUCCESS(Status)) {
+        PRINT_ERROR("Failed to get RAM disk queue: %d\n", Status);
+        Failures += 1;
+        goto RunBlockQueueTestEnd;
+    }
+
+    //
+    // Slow the disk down and only let one request at it at a time, so that
+    // the readers end up waiting in the queue together.
+    //
+
+    Restore = TRUE;
+    Status = BlockTestSetQueueDepth(DeviceId, BLOCK_TEST_QUEUE_DEPTH);
+    if (KSUCCESS(Status)) {
+        Status = BlockTestSetLatency(DeviceId, BLOCK_TEST_LATENCY);
+    }
+
+    if (!KSUCCESS(Status)) {
+        PRINT_ERROR("Failed to configure RAM disk: %d\n", Status);
+        Failures += 1;
+        goto RunBlockQueueTestEnd;
+    }
+
+    memset(Result, 0, RegionSize);
+    for (ThreadIndex = 0;
+         ThreadIndex < BLOCK_TEST_THREAD_COUNT;
+         ThreadIndex += 1) {
+
+        Threads[ThreadIndex].Handle = Handle;
+        Threads[ThreadIndex].Buffer = Result;
+        Threads[ThreadIndex].RegionSize = RegionSize;
+        Threads[ThreadIndex].Index = ThreadIndex;
+        Threads[ThreadIndex].Status = STATUS_NOT_STARTED;
+        if (pthread_create(&(ThreadIds[ThreadIndex]),
+                           NULL,
+                           BlockTestReaderThread,
+                           &(Threads[ThreadIndex])) != 0) {
+
+            PRINT_ERROR("Failed to create thread %ld.\n", ThreadIndex);
+            Failures += 1;
+            break;
+        }
+    }
+
+    while (ThreadIndex != 0) {
+        ThreadIndex -= 1;
+        pthread_join(ThreadIds[ThreadIndex], NULL);
+        if (!KSUCCESS(Threads[ThreadIndex].Status)) {
+            PRINT_ERROR("Thread %ld failed: %d\n",
+                        ThreadIndex,
+                        Threads[ThreadIndex].Status);
+
+            Failures += 1;
+        }
+    }
+
+    if (Failures != 0) {
+        goto RunBlockQueueTestEnd;
+    }
+
+    if (memcmp(Reference, Result, RegionSize) != 0) {
+        PRINT_ERROR("Data read concurrently does not match.\n");
+        Failures += 1;
+    }
+
+    Status = BlockTestGetQueue(DeviceId, &After);
+    if (!KSUCCESS(Status)) {
+        PRINT_ERROR("Failed to get RAM disk queue: %d\n", Status);
+        Failures += 1;
+        goto RunBlockQueueTestEnd;
+    }
+
+    Merges = (After.BackMergeCount - Before.BackMergeCount) +
+             (After.FrontMergeCount - Before.FrontMergeCount);
+
+    DEBUG_PRINT("%lld reads went to the device as %lld requests, with %lld "
+                "merges. Max wait %lldus.\n",
+                After.ReadCount - Before.ReadCount,
+                After.DispatchCount - Before.DispatchCount,
+                Merges,
+                After.MaxWaitMicroseconds);
+
+    if ((After.ReadCount - Before.ReadCount) <
+        (RegionSize / BLOCK_TEST_CHUNK_SIZE)) {
+
+        PRINT_ERROR("Expected at least %ld reads, got %lld.\n",
+                    RegionSize / BLOCK_TEST_CHUNK_SIZE,
+                    After.ReadCount - Before.ReadCount);
+
+        Failures += 1;
+    }
+
+    if (Merges == 0) {
+        PRINT_ERROR("No requests were merged.\n");
+        Failures += 1;
+    }
+
+    if ((After.QueuedCount != 0) || (After.InFlightCount != 0)) {
+        PRINT_ERROR("Queue not idle: %d queued, %d in flight.\n",
+                    After.QueuedCount,
+                    After.InFlightCount);
+
+        Failures += 1;
+    }
+
+RunBlockQueueTestEnd:
+    if (Restore != FALSE) {
+        BlockTestSetLatency(DeviceId, OriginalLatency);
+        BlockTestSetQueueDepth(DeviceId, Before.QueueDepth);
+    }
+
+    if (Handle != INVALID_HANDLE) {
+        OsClose(Handle);
+    }
+
+    if (Reference != NULL) {
+        free(Reference);
+    }
+
+    if (Result != NULL) {
+        free(Result);
+    }
+
+    return Failures;
+}
+
+ULONG
+RunLoopDeviceTest (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attaches a file to a new loop device, reads it back through
+    the device with a bandwidth limit in place, writes through the device,
+    and checks that the write landed in the file.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of failures in the test.
+
+--*/
+
+{
+
+    PUCHAR Buffer;
+    UINTN BytesCompleted;
+    DEVICE_ID DeviceId;
+    ULONGLONG Elapsed;
+    ULONG Failures;
+    FILE *File;
+    ULONGLONG Frequency;
+    HANDLE Handle;
+    UINTN Index;
+    ULONGLONG Minimum;
+    ULONGLONG Start;
+    KSTATUS Status;
+
+    DeviceId = 0;
+    Failures = 0;
+    Handle = INVALID_HANDLE;
+    Buffer = malloc(BLOCK_TEST_LOOP_SIZE);
+    if (Buffer == NULL) {
+        PRINT_ERROR("Failed to allocate buffer.\n");
+        return 1;
+    }
+
+    //
+    // Create the backing file with a known pattern.
+    //
+
+    for (Index = 0; Index < BLOCK_TEST_LOOP_SIZE; Index += 1) {
+        Buffer[Index] = (UCHAR)(Index ^ (Index >> 9));
+    }
+
+    File = fopen(BLOCK_TEST_LOOP_FILE, "wb");
+    if (File == NULL) {
+        PRINT_ERROR("Failed to create %s.\n", BLOCK_TEST_LOOP_FILE);
+        Failures += 1;
+        goto RunLoopDeviceTestEnd;
+    }
+
+    if ((fwrite(Buffer, 1, BLOCK_TEST_LOOP_SIZE, File) !=
+         BLOCK_TEST_LOOP_SIZE) ||
+        (fclose(File) != 0)) {
+
+        PRINT_ERROR("Failed to write %s.\n", BLOCK_TEST_LOOP_FILE);
+        Failures += 1;
+        goto RunLoopDeviceTestEnd;
+    }
+
+    Status = BlockTestAttachLoopDevice(BLOCK_TEST_LOOP_FILE, &DeviceId);
+    if (Status == STATUS_NO_SUCH_DEVICE) {
+        DEBUG_PRINT("No loop driver found, skipping loop device test.\n");
+        goto RunLoopDeviceTestEnd;
+    }
+
+    if (!KSUCCESS(Status)) {
+        PRINT_ERROR("Failed to attach loop device: %d\n", Status);
+        Failures += 1;
+        goto RunLoopDeviceTestEnd;
+    }
+
+    //
+    // Open the loop device for direct I/O so that every read below goes all
+    // the way down to the backing file.
+    //
+
+    Status = OsOpenDevice(DeviceId,
+                          SYS_OPEN_FLAG_READ | SYS_OPEN_FLAG_WRITE |
+                          SYS_OPEN_FLAG_DIRECT,
+                          &Handle);
+
+    if (!KSUCCESS(Status)) {
+        PRINT_ERROR("Failed to open loop device 0x%llx: %d\n",
+                    DeviceId,
+                    Status);
+
+        Failures += 1;
+        goto RunLoopDeviceTestEnd;
+    }
+
+    Status = BlockTestSetLoopDevice(DeviceId, 0, BLOCK_TEST_LOOP_BANDWIDTH);
+    if (!KSUCCESS(Status)) {
+        PRINT_ERROR("Failed to set loop bandwidth: %d\n", Status);
+        Failures += 1;
+        goto RunLoopDeviceTestEnd;
+    }
+
+    memset(Buffer, 0, BLOCK_TEST_LOOP_SIZE);
+    Frequency = OsGetTimeCounterFrequency();
+    Start = OsQueryTimeCounter();
+    Status = OsPerformIo(Handle,
+                         0,
+                         BLOCK_TEST_LOOP_SIZE,
+                         0,
+                         SYS_WAIT_TIME_INDEFINITE,
+                         Buffer,
+                         &BytesCompleted);
+
+    Elapsed = OsQueryTimeCounter() - Start;
+    if ((!KSUCCESS(Status)) || (BytesCompleted != BLOCK_TEST_LOOP_SIZE)) {
+        PRINT_ERROR("Failed to read loop device: %d, %ld of %d bytes\n",
+                    Status,
+                    BytesCompleted,
+                    BLOCK_TEST_LOOP_SIZE);
+
+        Failures += 1;
+        goto RunLoopDeviceTestEnd;
+    }
+
+    for (Index = 0; Index < BLOCK_TEST_LOOP_SIZE; Index += 1) {
+        if (Buffer[Index] != (UCHAR)(Index ^ (Index >> 9))) {
+            PRINT_ERROR("Loop device data mismatch at 0x%lx.\n", Index);
+            Failures += 1;
+            break;
+        }
+    }
+
+    //
+    // Allow some slack, as the device starts out idle.
+    //
+
+    Minimum = (Frequency * BLOCK_TEST_LOOP_SIZE) / BLOCK_TEST_LOOP_BANDWIDTH;
+    Minimum -= Minimum / 4;
+    DEBUG_PRINT("Read %d bytes from loop device in %lldus.\n",
+                BLOCK_TEST_LOOP_SIZE,
+                (Elapsed * 1000000ULL) / Frequency);
+
+    if (Elapsed < Minimum) {
+        PRINT_ERROR("Loop device read too fast for its bandwidth limit.\n");
+        Failures += 1;
+    }
+
+    Status = BlockTestSetLoopDevice(DeviceId, 0, 0);
+    if (!KSUCCESS(Status)) {
+        PRINT_ERROR("Failed to clear loop bandwidth: %d\n", Status);
+        Failures += 1;
+        goto RunLoopDeviceTestEnd;
+    }
+
+    //
+    // Write the first block through the loop device and look for it in the
+    // file.
+    //
+
+    memset(Buffer, 'L', BLOCK_TEST_CHUNK_SIZE);
+    Status = OsPerformIo(Handle,
+                         0,
+                         BLOCK_TEST_CHUNK_SIZE,
+                         SYS_IO_FLAG_WRITE,
+                         SYS_WAIT_TIME_INDEFINITE,
+                         Buffer,
+                         &BytesCompleted);
+
+    if ((!KSUCCESS(Status)) || (BytesCompleted != BLOCK_TEST_CHUNK_SIZE)) {
+        PRINT_ERROR("Failed to write loop device: %d, %ld of %d bytes\n",
+                    Status,
+                    BytesCompleted,
+                    BLOCK_TEST_CHUNK_SIZE);
+
+        Failures += 1;
+        goto RunLoopDeviceTestEnd;
+    }
+
+    memset(Buffer, 0, BLOCK_TEST_CHUNK_SIZE);
+    File = fopen(BLOCK_TEST_LOOP_FILE, "rb");
+    if ((File == NULL) ||
+        (fread(Buffer, 1, BLOCK_TEST_CHUNK_SIZE, File) !=
+         BLOCK_TEST_CHUNK_SIZE)) {
+
+        PRINT_ERROR("Failed to read back %s.\n", BLOCK_TEST_LOOP_FILE);
+        Failures += 1;
+
+    } else {
+        for (Index = 0; Index < BLOCK_TEST_CHUNK_SIZE; Index += 1) {
+            if (Buffer[Index] != 'L') {
+                PRINT_ERROR("Loop device write missing from file at 0x%lx.\n",
+                            Index);
+
+                Failures += 1;
+                break;
+            }
+        }
+    }
+
+    if (File != NULL) {
+        fclose(File);
+    }
+
+RunLoopDeviceTestEnd:
+    if (Handle != INVALID_HANDLE) {
+        OsClose(Handle);
+    }
+
+    if (DeviceId != 0) {
+        Status = BlockTestSetLoopDevice(DeviceId, LOOP_FLAG_DETACH, 0);
+        if (!KSUCCESS(Status)) {
+            PRINT_ERROR("Failed to detach loop device: %d\n", Status);
+            Failures += 1;
+        }
+    }
+
+    remove(BLOCK_TEST_LOOP_FILE);
+    free(Buffer);
+    return Failures;
+}
+
+KSTATUS
+BlockTestFindRamDisk (
+    PDEVICE_ID DeviceId,
+    PRAM_DISK_DEVICE_INFORMATION Information
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the first RAM disk in the system.
+
+Arguments:
+
+    DeviceId - Supplies a pointer where the RAM disk's device ID is returned.
+
+    Information - Supplies a pointer where the RAM disk's information is
+        returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NO_SUCH_DEVICE if there are no RAM disks.
+
+    Other error codes on failure.
+
+--*/
+
+{
+
+    UINTN DataSize;
+    DEVICE_INFORMATION_RESULT Result;
+    ULONG ResultCount;
+    KSTATUS Status;
+
+    ResultCount = 1;
+    Status = OsLocateDeviceInformation(&BlockTestRamDiskUuid,
+                                       NULL,
+                                       &Result,
+                                       &ResultCount);
+
+    if ((!KSUCCESS(Status)) && (Status != STATUS_BUFFER_TOO_SMALL)) {
+        return Status;
+    }
+
+    if (ResultCount == 0) {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    *DeviceId = Result.DeviceId;
+    DataSize = sizeof(RAM_DISK_DEVICE_INFORMATION);
+    return OsGetSetDeviceInformation(Result.DeviceId,
+                                     &BlockTestRamDiskUuid,
+                                     Information,
+                                     &DataSize,
+                                     FALSE);
+}
+
+KSTATUS
+BlockTestGetQueue (
+    DEVICE_ID DeviceId,
+    PIO_BLOCK_QUEUE_INFORMATION Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the I/O scheduler queue information for a device.
+
+Arguments:
+
+    DeviceId - Supplies the ID of the block device.
+
+    Queue - Supplies a pointer where the queue information is returned.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN Count;
+    UINTN DataSize;
+    UINTN Index;
+    PIO_BLOCK_QUEUE_INFORMATION Queues;
+    KSTATUS Status;
+
+    DataSize = 0;
+    Queues = NULL;
+    Status = OsGetSetSystemInformation(SystemInformationIo,
+                                       IoInformationBlockQueue,
+                                       NULL,
+                                       &DataSize,
+                                       FALSE);
+
+    if ((Status != STATUS_BUFFER_TOO_SMALL) && (!KSUCCESS(Status))) {
+        goto GetQueueEnd;
+    }
+
+    Queues = malloc(DataSize);
+    if (Queues == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto GetQueueEnd;
+    }
+
+    Status = OsGetSetSystemInformation(SystemInformationIo,
+                                       IoInformationBlockQueue,
+                                       Queues,
+                                       &DataSize,
+                                       FALSE);
+
+    if (!KSUCCESS(Status)) {
+        goto GetQueueEnd;
+    }
+
+    Status = STATUS_NOT_FOUND;
+    Count = DataSize / sizeof(IO_BLOCK_QUEUE_INFORMATION);
+    for (Index = 0; Index < Count; Index += 1) {
+        if (Queues[Index].DeviceId == DeviceId) {
+            memcpy(Queue, &(Queues[Index]), sizeof(IO_BLOCK_QUEUE_INFORMATION));
+            Status = STATUS_SUCCESS;
+            break;
+        }
+    }
+
+GetQueueEnd:
+    if (Queues != NULL) {
+        free(Queues);
+    }
+
+    return Status;
+}
+
+KSTATUS
+BlockTestSetQueueDepth (
+    DEVICE_ID DeviceId,
+    ULONG QueueDepth
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the I/O scheduler queue depth for a device.
+
+Arguments:
+
+    DeviceId - Supplies the ID of the block device.
+
+    QueueDepth - Supplies the new queue depth.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN DataSize;
+    IO_BLOCK_QUEUE_INFORMATION Queue;
+
+    memset(&Queue, 0, sizeof(IO_BLOCK_QUEUE_INFORMATION));
+    Queue.DeviceId = DeviceId;
+    Queue.QueueDepth = QueueDepth;
+    DataSize = sizeof(IO_BLOCK_QUEUE_INFORMATION);
+    return OsGetSetSystemInformation(SystemInformationIo,
+                                     IoInformationBlockQueue,
+                                     &Queue,
+                                     &DataSize,
+                                     TRUE);
+}
+
+KSTATUS
+BlockTestSetLatency (
+    DEVICE_ID DeviceId,
+    ULONG Latency
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the latency the RAM disk adds to each request.
+
+Arguments:
+
+    DeviceId - Supplies the ID of the RAM disk.
+
+    Latency - Supplies the latency to add, in microseconds.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN DataSize;
+    RAM_DISK_DEVICE_INFORMATION Information;
+
+    memset(&Information, 0, sizeof(RAM_DISK_DEVICE_INFORMATION));
+    Information.Version = RAM_DISK_DEVICE_INFORMATION_VERSION;
+    Information.Latency = Latency;
+    DataSize = sizeof(RAM_DISK_DEVICE_INFORMATION);
+    return OsGetSetDeviceInformation(DeviceId,
+                                     &BlockTestRamDiskUuid,
+                                     &Information,
+                                     &DataSize,
+                                     TRUE);
+}
+
+KSTATUS
+BlockTestAttachLoopDevice (
+    PCSTR Path,
+    PDEVICE_ID DeviceId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attaches a file to a new loop device and waits for the loop
+    device to start.
+
+Arguments:
+
+    Path - Supplies the path of the file to attach.
+
+    DeviceId - Supplies a pointer where the loop device's ID is returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NO_SUCH_DEVICE if there is no loop driver.
+
+    Other error codes on failure.
+
+--*/
+
+{
+
+    UINTN DataSize;
+    LOOP_CONTROL_INFORMATION Information;
+    DEVICE_INFORMATION_RESULT Result;
+    ULONG ResultCount;
+    ULONG Retry;
+    KSTATUS Status;
+
+    *DeviceId = 0;
+    ResultCount = 1;
+    Status = OsLocateDeviceInformation(&BlockTestLoopControlUuid,
+                                       NULL,
+                                       &Result,
+                                       &ResultCount);
+
+    if ((!KSUCCESS(Status)) && (Status != STATUS_BUFFER_TOO_SMALL)) {
+        return Status;
+    }
+
+    if (ResultCount == 0) {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    memset(&Information, 0, sizeof(LOOP_CONTROL_INFORMATION));
+    Information.Version = LOOP_CONTROL_INFORMATION_VERSION;
+    if (strlen(Path) >= LOOP_PATH_SIZE) {
+        return STATUS_NAME_TOO_LONG;
+    }
+
+    strcpy(Information.Path, Path);
+    DataSize = sizeof(LOOP_CONTROL_INFORMATION);
+    Status = OsGetSetDeviceInformation(Result.DeviceId,
+                                       &BlockTestLoopControlUuid,
+                                       &Information,
+                                       &DataSize,
+                                       TRUE);
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    *DeviceId = Information.DeviceId;
+
+    //
+    // The loop device publishes its information when it starts.
+    //
+
+    for (Retry = 0; Retry < BLOCK_TEST_LOOP_RETRY_COUNT; Retry += 1) {
+        ResultCount = 1;
+        Status = OsLocateDeviceInformation(&BlockTestLoopDeviceUuid,
+                                           DeviceId,
+                                           &Result,
+                                           &ResultCount);
+
+        if ((KSUCCESS(Status)) && (ResultCount != 0)) {
+            return STATUS_SUCCESS;
+        }
+
+        OsDelayExecution(FALSE, BLOCK_TEST_LOOP_RETRY_DELAY);
+    }
+
+    return STATUS_TIMEOUT;
+}
+
+KSTATUS
+BlockTestSetLoopDevice (
+    DEVICE_ID DeviceId,
+    ULONG Flags,
+    ULONGLONG Bandwidth
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the bandwidth limit of a loop device, or detaches it.
+
+Arguments:
+
+    DeviceId - Supplies the ID of the loop device.
+
+    Flags - Supplies the loop flags to set. See LOOP_FLAG_* definitions.
+
+    Bandwidth - Supplies the new bandwidth limit in bytes per second, or 0 for
+        no limit.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN DataSize;
+    LOOP_DEVICE_INFORMATION Information;
+
+    memset(&Information, 0, sizeof(LOOP_DEVICE_INFORMATION));
+    Information.Version = LOOP_DEVICE_INFORMATION_VERSION;
+    Information.Flags = Flags;
+    Information.Bandwidth = Bandwidth;
+    DataSize = sizeof(LOOP_DEVICE_INFORMATION);
+    return OsGetSetDeviceInformation(DeviceId,
+                                     &BlockTestLoopDeviceUuid,
+                                     &Information,
+                                     &DataSize,
+                                     TRUE);
+}
+
+void *
+BlockTestReaderThread (
+    void *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads this thread's share of the chunks in the test region.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the thread context.
+
+Return Value:
+
+    NULL always.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    UINTN Offset;
+    KSTATUS Status;
+    PBLOCK_TEST_THREAD Thread;
+
+    Thread = Parameter;
+    Status = STATUS_SUCCESS;
+    for (Offset = Thread->Index * BLOCK_TEST_CHUNK_SIZE;
+         Offset < Thread->RegionSize;
+         Offset += BLOCK_TEST_THREAD_COUNT * BLOCK_TEST_CHUNK_SIZE) {
+
+        Status = OsPerformIo(Thread->Handle,
+                             Offset,
+                             BLOCK_TEST_CHUNK_SIZE,
+                             0,
+                             SYS_WAIT_TIME_INDEFINITE,
+                             Thread->Buffer + Offset,
+                             &BytesCompleted);
+
+        if (KSUCCESS(Status) && (BytesCompleted != BLOCK_TEST_CHUNK_SIZE)) {
+            Status = STATUS_END_OF_FILE;
+        }
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+    }
+
+    Thread->Status = Status;
+    return NULL;
+}
+
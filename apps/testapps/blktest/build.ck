@@ -0,0 +1,58 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    Block I/O Scheduler Test
+
+Abstract:
+
+    This executable implements the block I/O scheduler test application.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    User
+
+--*/
+
+from menv import application;
+
+function build() {
+    var app;
+    var dynlibs;
+    var entries;
+    var includes;
+    var sources;
+
+    sources = [
+        "blktest.c"
+    ];
+
+    dynlibs = [
+        "apps/osbase:libminocaos"
+    ];
+
+    includes = [
+        "$S/apps/libc/include"
+    ];
+
+    app = {
+        "label": "blktest",
+        "inputs": sources + dynlibs,
+        "includes": includes
+    };
+
+    entries = application(app);
+    return entries;
+}
+
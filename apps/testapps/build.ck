@@ -34,6 +34,7 @@ function build() {
     var testappsGroup;
 
     appNames = [
+        "blktest",
         "dbgtest",
         "filetest",
         "ktest",
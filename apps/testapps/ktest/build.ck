@@ -47,9 +47,11 @@ function build() {
         "driver/ktestdrv.c",
         "driver/tblock.c",
         "driver/tdesc.c",
+        "driver/tirp.c",
         "driver/testsup.c",
         "driver/tpool.c",
         "driver/tthread.c",
+        "driver/twait.c",
         "driver/twork.c"
     ];
 
@@ -466,7 +466,35 @@ Return Value:
 
 {
 
-    RtlDebugPrint("KTestDispatchIo\n");
+    PIRP_READ_WRITE ReadWrite;
+    KSTATUS Status;
+
+    ASSERT(Irp->MajorCode == IrpMajorIo);
+
+    if (Irp->Direction != IrpDown) {
+        return;
+    }
+
+    //
+    // Reads return zeroes and writes are discarded, which gives tests a
+    // device that does nothing but exercise the I/O path.
+    //
+
+    ReadWrite = &(Irp->U.ReadWrite);
+    Status = STATUS_SUCCESS;
+    if ((Irp->MinorCode == IrpMinorIoRead) && (ReadWrite->IoSizeInBytes != 0)) {
+        Status = MmZeroIoBuffer(ReadWrite->IoBuffer,
+                                0,
+                                ReadWrite->IoSizeInBytes);
+    }
+
+    if (KSUCCESS(Status)) {
+        ReadWrite->IoBytesCompleted = ReadWrite->IoSizeInBytes;
+        ReadWrite->NewIoOffset = ReadWrite->IoOffset +
+                                 ReadWrite->IoBytesCompleted;
+    }
+
+    IoCompleteIrp(KTestDriver, Irp, Status);
     return;
 }
 
@@ -162,3 +162,51 @@ Return Value:
 
 --*/
 
+KSTATUS
+KTestIrpAllocationStart (
+    PKTEST_START_TEST Command,
+    PKTEST_ACTIVE_TEST Test
+    );
+
+/*++
+
+Routine Description:
+
+    This routine starts a new invocation of the IRP allocation test.
+
+Arguments:
+
+    Command - Supplies a pointer to the start command.
+
+    Test - Supplies a pointer to the active test structure to initialize.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+KTestObjectWaitStart (
+    PKTEST_START_TEST Command,
+    PKTEST_ACTIVE_TEST Test
+    );
+
+/*++
+
+Routine Description:
+
+    This routine starts a new invocation of the object wait test.
+
+Arguments:
+
+    Command - Supplies a pointer to the start command.
+
+    Test - Supplies a pointer to the active test structure to initialize.
+
+Return Value:
+
+    Status code.
+
+--*/
+
@@ -95,6 +95,8 @@ KTEST_FUNCTION_TABLE KTestFunctionTable[KTestCount] = {
     {KTestDescriptorStressStart},
     {KTestBlockStressStart},
     {KTestBlockStressStart},
+    {KTestIrpAllocationStart},
+    {KTestObjectWaitStart},
 };
 
 //
@@ -474,6 +476,53 @@ Return Value:
     return (ULONG)Value * 1103515245;
 }
 
+KSTATUS
+KTestGetPoolAllocationCount (
+    PUINTN Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the total number of paged and non-paged pool
+    allocations made since boot.
+
+Arguments:
+
+    Count - Supplies a pointer where the allocation count will be returned.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN Size;
+    MM_STATISTICS Statistics;
+    KSTATUS Status;
+
+    RtlZeroMemory(&Statistics, sizeof(MM_STATISTICS));
+    Statistics.Version = MM_STATISTICS_VERSION;
+    Size = sizeof(MM_STATISTICS);
+    Status = KeGetSetSystemInformation(SystemInformationMm,
+                                       MmInformationSystemMemory,
+                                       &Statistics,
+                                       &Size,
+                                       FALSE);
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    *Count = Statistics.NonPagedPool.TotalAllocationCalls +
+             Statistics.PagedPool.TotalAllocationCalls;
+
+    return STATUS_SUCCESS;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
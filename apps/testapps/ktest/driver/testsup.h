@@ -115,6 +115,12 @@ typedef struct _KTEST_FUNCTION_TABLE {
 // -------------------------------------------------------------------- Globals
 //
 
+//
+// Store a pointer to the test device, which tests can send I/O to.
+//
+
+extern PDEVICE KTestDevice;
+
 //
 // -------------------------------------------------------- Function Prototypes
 //
@@ -255,3 +261,25 @@ Return Value:
 
 --*/
 
+KSTATUS
+KTestGetPoolAllocationCount (
+    PUINTN Count
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the total number of paged and non-paged pool
+    allocations made since boot.
+
+Arguments:
+
+    Count - Supplies a pointer where the allocation count will be returned.
+
+Return Value:
+
+    Status code.
+
+--*/
+
@@ -0,0 +1,286 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    tirp.c
+
+Abstract:
+
+    This module implements the IRP allocation test, which measures how many
+    pool allocations a synchronous device read costs.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include "ktestdrv.h"
+#include "testsup.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define KTEST_IRP_DEFAULT_ITERATIONS 10000
+#define KTEST_IRP_DEFAULT_READ_SIZE 4096
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+VOID
+KTestIrpAllocationRoutine (
+    PVOID Parameter
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+KTestIrpAllocationStart (
+    PKTEST_START_TEST Command,
+    PKTEST_ACTIVE_TEST Test
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts a new invocation of the IRP allocation test.
+
+Arguments:
+
+    Command - Supplies a pointer to the start command.
+
+    Test - Supplies a pointer to the active test structure to initialize.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PKTEST_PARAMETERS Parameters;
+    KSTATUS Status;
+
+    Parameters = &(Test->Parameters);
+    RtlCopyMemory(Parameters, &(Command->Parameters), sizeof(KTEST_PARAMETERS));
+    if (Parameters->Iterations == 0) {
+        Parameters->Iterations = KTEST_IRP_DEFAULT_ITERATIONS;
+    }
+
+    //
+    // The pool counters are system-wide, so more than one thread would only
+    // count the other threads' allocations.
+    //
+
+    Parameters->Threads = 1;
+    if (Parameters->Parameters[0] == 0) {
+        Parameters->Parameters[0] = KTEST_IRP_DEFAULT_READ_SIZE;
+    }
+
+    Test->Total = Test->Parameters.Iterations;
+    Test->Results.Status = STATUS_SUCCESS;
+    Test->Results.Failures = 0;
+    Status = PsCreateKernelThread(KTestIrpAllocationRoutine,
+                                  Test,
+                                  "KTestIrpAllocationRoutine");
+
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+KTestIrpAllocationRoutine (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the IRP allocation test. It reads from the test
+    device over and over, and counts the pool allocations made along the way.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the thread parameter, which in this
+        case is a pointer to the active test structure.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN AllocationsAfter;
+    UINTN AllocationsBefore;
+    UINTN BytesCompleted;
+    ULONG Failures;
+    PIO_HANDLE Handle;
+    PKTEST_ACTIVE_TEST Information;
+    PIO_BUFFER IoBuffer;
+    UINTN Iteration;
+    PKTEST_PARAMETERS Parameters;
+    UINTN ReadSize;
+    UINTN Reads;
+    KSTATUS Status;
+
+    Failures = 0;
+    Handle = NULL;
+    Information = Parameter;
+    IoBuffer = NULL;
+    Parameters = &(Information->Parameters);
+    ReadSize = Parameters->Parameters[0];
+    Reads = 0;
+    RtlAtomicAdd32(&(Information->ThreadsStarted), 1);
+    Status = IoOpenDevice(KTestDevice,
+                          IO_ACCESS_READ,
+                          0,
+                          &Handle,
+                          NULL,
+                          NULL,
+                          NULL);
+
+    if (!KSUCCESS(Status)) {
+        Failures += 1;
+        goto IrpAllocationRoutineEnd;
+    }
+
+    IoBuffer = MmAllocateNonPagedIoBuffer(0, MAX_ULONGLONG, 0, ReadSize, 0);
+    if (IoBuffer == NULL) {
+        Failures += 1;
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto IrpAllocationRoutineEnd;
+    }
+
+    //
+    // Do one read up front so that any one-time setup along the path (and
+    // the IRP cache) is warmed up before counting.
+    //
+
+    Status = IoReadAtOffset(Handle,
+                            IoBuffer,
+                            0,
+                            ReadSize,
+                            0,
+                            WAIT_TIME_INDEFINITE,
+                            &BytesCompleted,
+                            NULL);
+
+    if (!KSUCCESS(Status)) {
+        Failures += 1;
+        goto IrpAllocationRoutineEnd;
+    }
+
+    Status = KTestGetPoolAllocationCount(&AllocationsBefore);
+    if (!KSUCCESS(Status)) {
+        Failures += 1;
+        goto IrpAllocationRoutineEnd;
+    }
+
+    for (Iteration = 0; Iteration < Parameters->Iterations; Iteration += 1) {
+        if (Information->Cancel != FALSE) {
+            break;
+        }
+
+        Information->Progress += 1;
+        Status = IoReadAtOffset(Handle,
+                                IoBuffer,
+                                0,
+                                ReadSize,
+                                0,
+                                WAIT_TIME_INDEFINITE,
+                                &BytesCompleted,
+                                NULL);
+
+        if ((!KSUCCESS(Status)) || (BytesCompleted != ReadSize)) {
+            Failures += 1;
+            if (KSUCCESS(Status)) {
+                Status = STATUS_DATA_LENGTH_MISMATCH;
+            }
+
+            goto IrpAllocationRoutineEnd;
+        }
+
+        Reads += 1;
+    }
+
+    Status = KTestGetPoolAllocationCount(&AllocationsAfter);
+    if (!KSUCCESS(Status)) {
+        Failures += 1;
+        goto IrpAllocationRoutineEnd;
+    }
+
+    Information->Results.Results[0] = AllocationsAfter - AllocationsBefore;
+    Information->Results.Results[1] = Reads;
+
+    //
+    // Allow for other activity in the system, but a steady state of one or
+    // more allocations per read means the IRP is not being reused.
+    //
+
+    if ((Reads != 0) && (Information->Results.Results[0] >= Reads)) {
+        RtlDebugPrint("KTest: %d allocations in %d reads.\n",
+                      Information->Results.Results[0],
+                      Reads);
+
+        Failures += 1;
+        Status = STATUS_UNSUCCESSFUL;
+    }
+
+IrpAllocationRoutineEnd:
+    if (IoBuffer != NULL) {
+        MmFreeIoBuffer(IoBuffer);
+    }
+
+    if (Handle != NULL) {
+        IoClose(Handle);
+    }
+
+    //
+    // Save the results.
+    //
+
+    if (!KSUCCESS(Status)) {
+        Information->Results.Status = Status;
+    }
+
+    Information->Results.Failures += Failures;
+    RtlAtomicAdd32(&(Information->ThreadsFinished), 1);
+    return;
+}
+
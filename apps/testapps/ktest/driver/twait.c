@@ -0,0 +1,344 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    twait.c
+
+Abstract:
+
+    This module implements the object wait test, which measures how long it
+    takes to wait on 1, 8, and 64 objects at once.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include "ktestdrv.h"
+#include "testsup.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define KTEST_WAIT_DEFAULT_ITERATIONS 10000
+
+//
+// Define the number of different object counts measured, and the largest of
+// them.
+//
+
+#define KTEST_WAIT_SIZE_COUNT 3
+#define KTEST_WAIT_MAX_OBJECTS 64
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+VOID
+KTestObjectWaitRoutine (
+    PVOID Parameter
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store the number of objects waited on in each round of the test.
+//
+
+const ULONG KTestWaitObjectCounts[KTEST_WAIT_SIZE_COUNT] = {
+    1,
+    8,
+    KTEST_WAIT_MAX_OBJECTS
+};
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+KTestObjectWaitStart (
+    PKTEST_START_TEST Command,
+    PKTEST_ACTIVE_TEST Test
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts a new invocation of the object wait test.
+
+Arguments:
+
+    Command - Supplies a pointer to the start command.
+
+    Test - Supplies a pointer to the active test structure to initialize.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PKTEST_PARAMETERS Parameters;
+    KSTATUS Status;
+
+    Parameters = &(Test->Parameters);
+    RtlCopyMemory(Parameters, &(Command->Parameters), sizeof(KTEST_PARAMETERS));
+    if (Parameters->Iterations == 0) {
+        Parameters->Iterations = KTEST_WAIT_DEFAULT_ITERATIONS;
+    }
+
+    //
+    // The timings and pool counters are only meaningful for one thread.
+    //
+
+    Parameters->Threads = 1;
+    Test->Total = Test->Parameters.Iterations * KTEST_WAIT_SIZE_COUNT;
+    Test->Results.Status = STATUS_SUCCESS;
+    Test->Results.Failures = 0;
+    Status = PsCreateKernelThread(KTestObjectWaitRoutine,
+                                  Test,
+                                  "KTestObjectWaitRoutine");
+
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+KTestObjectWaitRoutine (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the object wait test. For each object count it
+    waits on that many events over and over and reports the average time per
+    wait in nanoseconds. By default none of the events are signaled and each
+    wait has a zero timeout, which measures setting up and tearing down the
+    full wait. If the first test parameter is non-zero, the last event is
+    signaled, which measures the path for a wait that is already satisfied.
+    The pool allocations made during the largest waits are reported too.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the thread parameter, which in this
+        case is a pointer to the active test structure.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN AllocationsAfter;
+    UINTN AllocationsBefore;
+    PKEVENT Events[KTEST_WAIT_MAX_OBJECTS];
+    ULONG Failures;
+    ULONGLONG Frequency;
+    PKTEST_ACTIVE_TEST Information;
+    UINTN Iteration;
+    ULONG ObjectCount;
+    ULONG ObjectIndex;
+    PKTEST_PARAMETERS Parameters;
+    BOOL Signaled;
+    PVOID SignalingObject;
+    ULONG SizeIndex;
+    ULONGLONG StartTime;
+    KSTATUS Status;
+    KSTATUS WaitStatus;
+    ULONG WaitTimeout;
+
+    AllocationsAfter = 0;
+    AllocationsBefore = 0;
+    Failures = 0;
+    Information = Parameter;
+    Parameters = &(Information->Parameters);
+    Signaled = FALSE;
+    WaitStatus = STATUS_TIMEOUT;
+    WaitTimeout = 0;
+    if (Parameters->Parameters[0] != 0) {
+        Signaled = TRUE;
+        WaitStatus = STATUS_SUCCESS;
+        WaitTimeout = WAIT_TIME_INDEFINITE;
+    }
+
+    RtlZeroMemory(Events, sizeof(Events));
+    RtlAtomicAdd32(&(Information->ThreadsStarted), 1);
+    for (ObjectIndex = 0;
+         ObjectIndex < KTEST_WAIT_MAX_OBJECTS;
+         ObjectIndex += 1) {
+
+        Events[ObjectIndex] = KeCreateEvent(NULL);
+        if (Events[ObjectIndex] == NULL) {
+            Failures += 1;
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto ObjectWaitRoutineEnd;
+        }
+    }
+
+    Frequency = HlQueryTimeCounterFrequency();
+    Status = STATUS_SUCCESS;
+    for (SizeIndex = 0; SizeIndex < KTEST_WAIT_SIZE_COUNT; SizeIndex += 1) {
+        ObjectCount = KTestWaitObjectCounts[SizeIndex];
+        if (Signaled != FALSE) {
+            KeSignalEvent(Events[ObjectCount - 1], SignalOptionSignalAll);
+        }
+
+        //
+        // Do one wait up front so that the thread's wait blocks are already
+        // set up before counting.
+        //
+
+        Status = ObWaitOnObjects((PVOID *)Events,
+                                 ObjectCount,
+                                 0,
+                                 WaitTimeout,
+                                 NULL,
+                                 NULL);
+
+        if (Status != WaitStatus) {
+            Failures += 1;
+            if (KSUCCESS(Status)) {
+                Status = STATUS_UNSUCCESSFUL;
+            }
+
+            goto ObjectWaitRoutineEnd;
+        }
+
+        if (ObjectCount == KTEST_WAIT_MAX_OBJECTS) {
+            Status = KTestGetPoolAllocationCount(&AllocationsBefore);
+            if (!KSUCCESS(Status)) {
+                Failures += 1;
+                goto ObjectWaitRoutineEnd;
+            }
+        }
+
+        StartTime = HlQueryTimeCounter();
+        for (Iteration = 0;
+             Iteration < Parameters->Iterations;
+             Iteration += 1) {
+
+            if (Information->Cancel != FALSE) {
+                break;
+            }
+
+            Information->Progress += 1;
+            Status = ObWaitOnObjects((PVOID *)Events,
+                                     ObjectCount,
+                                     0,
+                                     WaitTimeout,
+                                     NULL,
+                                     &SignalingObject);
+
+            if ((Status != WaitStatus) ||
+                ((Signaled != FALSE) &&
+                 (SignalingObject != Events[ObjectCount - 1]))) {
+
+                Failures += 1;
+                if ((KSUCCESS(Status)) || (Status == WaitStatus)) {
+                    Status = STATUS_UNSUCCESSFUL;
+                }
+
+                goto ObjectWaitRoutineEnd;
+            }
+        }
+
+        if (Iteration != 0) {
+            Information->Results.Results[SizeIndex] =
+                         (UINTN)(((HlQueryTimeCounter() - StartTime) *
+                                  NANOSECONDS_PER_SECOND) /
+                                 (Frequency * Iteration));
+        }
+
+        if (ObjectCount == KTEST_WAIT_MAX_OBJECTS) {
+            Status = KTestGetPoolAllocationCount(&AllocationsAfter);
+            if (!KSUCCESS(Status)) {
+                Failures += 1;
+                goto ObjectWaitRoutineEnd;
+            }
+
+            Information->Results.Results[KTEST_WAIT_SIZE_COUNT] =
+                                          AllocationsAfter - AllocationsBefore;
+
+            //
+            // Allow for other activity in the system, but an allocation on
+            // every wait means the thread's wait block is not being reused.
+            //
+
+            if ((Iteration != 0) &&
+                (Information->Results.Results[KTEST_WAIT_SIZE_COUNT] >=
+                 Iteration)) {
+
+                RtlDebugPrint("KTest: %d allocations in %d waits.\n",
+                              AllocationsAfter - AllocationsBefore,
+                              Iteration);
+
+                Failures += 1;
+                Status = STATUS_UNSUCCESSFUL;
+                goto ObjectWaitRoutineEnd;
+            }
+        }
+
+        if (Signaled != FALSE) {
+            KeSignalEvent(Events[ObjectCount - 1], SignalOptionUnsignal);
+        }
+
+        Status = STATUS_SUCCESS;
+    }
+
+ObjectWaitRoutineEnd:
+    for (ObjectIndex = 0;
+         ObjectIndex < KTEST_WAIT_MAX_OBJECTS;
+         ObjectIndex += 1) {
+
+        if (Events[ObjectIndex] != NULL) {
+            KeDestroyEvent(Events[ObjectIndex]);
+        }
+    }
+
+    //
+    // Save the results.
+    //
+
+    if (!KSUCCESS(Status)) {
+        Information->Results.Status = Status;
+    }
+
+    Information->Results.Failures += Failures;
+    RtlAtomicAdd32(&(Information->ThreadsFinished), 1);
+    return;
+}
+
@@ -76,7 +76,11 @@ Module Name:
     "  -p, --threads <count> -- Set the number of threads to spin up.\n"       \
     "  -t, --test -- Set the test to perform. Valid values are all, \n"        \
     "      pagedpoolstress, nonpagedpoolstress, workstress, threadstress, \n"  \
-    "      descriptorstress, pagedblockstress and nonpagedblockstress.\n"      \
+    "      descriptorstress, pagedblockstress, nonpagedblockstress, \n"        \
+    "      irpalloc and objectwait. The irpalloc and objectwait tests \n"      \
+    "      measure system-wide pool allocations, so they are only run \n"      \
+    "      when requested by name. Pass -A 1 to objectwait to time waits \n"   \
+    "      that are already satisfied.\n"                                      \
     "  --debug -- Print lots of information about what's happening.\n"         \
     "  --quiet -- Print only errors.\n"                                        \
     "  --no-cleanup -- Leave test files around for debugging.\n"               \
@@ -176,6 +180,8 @@ PSTR KTestNames[KTestCount] = {
     "descriptorstress",
     "pagedblockstress",
     "nonpagedblockstress",
+    "irpalloc",
+    "objectwait",
 };
 
 //
@@ -473,6 +479,35 @@ Return Value:
         }
     }
 
+    //
+    // The IRP allocation test counts every pool allocation in the system, so
+    // the stress tests would throw it off. Only run it on its own.
+    //
+
+    if (Test == KTestIrpAllocation) {
+        Status = KTestSendStartRequest(DriverHandle,
+                                       KTestIrpAllocation,
+                                       &Start,
+                                       &HandleCount);
+
+        if (Status != 0) {
+            PRINT_ERROR("Failed to send start request.\n");
+            Failures += 1;
+        }
+    }
+
+    if (Test == KTestObjectWait) {
+        Status = KTestSendStartRequest(DriverHandle,
+                                       KTestObjectWait,
+                                       &Start,
+                                       &HandleCount);
+
+        if (Status != 0) {
+            PRINT_ERROR("Failed to send start request.\n");
+            Failures += 1;
+        }
+    }
+
     //
     // Poll the tests until they are all complete.
     //
@@ -582,6 +617,25 @@ Return Value:
 
                     break;
 
+                case KTestIrpAllocation:
+                    PRINT("%s: %d pool allocations in %d reads\n",
+                          TestName,
+                          Poll.Results.Results[0],
+                          Poll.Results.Results[1]);
+
+                    break;
+
+                case KTestObjectWait:
+                    PRINT("%s: %dns for 1 object, %dns for 8 objects, "
+                          "%dns for 64 objects, %d pool allocations\n",
+                          TestName,
+                          Poll.Results.Results[0],
+                          Poll.Results.Results[1],
+                          Poll.Results.Results[2],
+                          Poll.Results.Results[3]);
+
+                    break;
+
                 default:
 
                     assert(FALSE);
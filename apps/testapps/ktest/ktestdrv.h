@@ -63,6 +63,8 @@ typedef enum _KTEST_TYPE {
     KTestDescriptorStress,
     KTestPagedBlockStress,
     KTestNonPagedBlockStress,
+    KTestIrpAllocation,
+    KTestObjectWait,
     KTestCount
 } KTEST_TYPE, *PKTEST_TYPE;
 
@@ -36,24 +36,31 @@ function build() {
     var sources;
 
     sources = [
+        "cachescan.c",
         "copy.c",
         "create.c",
         "dlopen.c",
         "dup.c",
+        "filelock.c",
         "getppid.c",
         "exec.c",
         "fork.c",
+        "largedir.c",
         "malloc.c",
         "mmap.c",
         "mutex.c",
         "open.c",
+        "pathwalk.c",
         "perfsup.c",
         "perftest.c",
         "pipeio.c",
         "pthread.c",
         "read.c",
         "rename.c",
+        "sendfile.c",
         "signal.c",
+        "smallfile.c",
+        "spawn.c",
         "stat.c",
         "write.c"
     ];
@@ -0,0 +1,436 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    cachescan.c
+
+Abstract:
+
+    This module implements the performance benchmark test for how well the
+    file cache holds on to a small, frequently read file while another process
+    streams through a file far bigger than memory.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "perftest.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define PT_CACHE_SCAN_NAME_LENGTH 48
+#define PT_CACHE_SCAN_PAGE_SIZE 4096
+
+//
+// The hot file is read at random and should fit comfortably in the cache. The
+// cold file is streamed over and over, and is meant to be bigger than the
+// cache could ever hold. It is created sparse, which is still enough to fill
+// the cache with its pages when read.
+//
+
+#define PT_CACHE_SCAN_HOT_FILE_SIZE (16 * 1024 * 1024)
+#define PT_CACHE_SCAN_COLD_FILE_SIZE (2048LL * 1024 * 1024)
+#define PT_CACHE_SCAN_STREAM_BUFFER_SIZE (64 * 1024)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+int
+CacheScanCreateFiles (
+    char *HotFileName,
+    char *ColdFileName,
+    int *HotFile
+    );
+
+void
+CacheScanStream (
+    char *FileName
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+void
+CacheScanMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the cache scan resistance benchmark test. It counts
+    random single page reads from a small file while a child process streams
+    through a large one. The more of the small file the cache keeps, the more
+    reads complete.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    char *Buffer;
+    ssize_t BytesRead;
+    char ColdFileName[PT_CACHE_SCAN_NAME_LENGTH];
+    int FilesCreated;
+    char HotFileName[PT_CACHE_SCAN_NAME_LENGTH];
+    int HotFile;
+    unsigned long long Iterations;
+    off_t Offset;
+    long PageCount;
+    pid_t ProcessId;
+    int Status;
+    pid_t Streamer;
+
+    FilesCreated = 0;
+    HotFile = -1;
+    Iterations = 0;
+    Streamer = -1;
+    Result->Type = PtResultIterations;
+    Result->Status = 0;
+    PageCount = PT_CACHE_SCAN_HOT_FILE_SIZE / PT_CACHE_SCAN_PAGE_SIZE;
+    Buffer = malloc(PT_CACHE_SCAN_PAGE_SIZE);
+    if (Buffer == NULL) {
+        Result->Status = ENOMEM;
+        goto MainEnd;
+    }
+
+    ProcessId = getpid();
+    if ((snprintf(HotFileName,
+                  PT_CACHE_SCAN_NAME_LENGTH,
+                  "cache_hot_%d.txt",
+                  ProcessId) < 0) ||
+        (snprintf(ColdFileName,
+                  PT_CACHE_SCAN_NAME_LENGTH,
+                  "cache_cold_%d.txt",
+                  ProcessId) < 0)) {
+
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    FilesCreated = 1;
+    Status = CacheScanCreateFiles(HotFileName, ColdFileName, &HotFile);
+    if (Status != 0) {
+        Result->Status = Status;
+        goto MainEnd;
+    }
+
+    //
+    // Read the hot file through twice so every page of it has been used more
+    // than once before the streaming starts.
+    //
+
+    for (Offset = 0;
+         Offset < (2LL * PT_CACHE_SCAN_HOT_FILE_SIZE);
+         Offset += PT_CACHE_SCAN_PAGE_SIZE) {
+
+        BytesRead = pread(HotFile,
+                          Buffer,
+                          PT_CACHE_SCAN_PAGE_SIZE,
+                          Offset % PT_CACHE_SCAN_HOT_FILE_SIZE);
+
+        if (BytesRead != PT_CACHE_SCAN_PAGE_SIZE) {
+            Result->Status = (BytesRead < 0) ? errno : EIO;
+            goto MainEnd;
+        }
+    }
+
+    Streamer = fork();
+    if (Streamer < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    if (Streamer == 0) {
+        CacheScanStream(ColdFileName);
+        _exit(0);
+    }
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    //
+    // Read single pages from anywhere in the hot file.
+    //
+
+    srand(ProcessId);
+    while (PtIsTimedTestRunning() != 0) {
+        Offset = PtGetRandomIndex(PageCount);
+        Offset *= PT_CACHE_SCAN_PAGE_SIZE;
+        do {
+            BytesRead = pread(HotFile,
+                              Buffer,
+                              PT_CACHE_SCAN_PAGE_SIZE,
+                              Offset);
+
+        } while ((BytesRead < 0) && (errno == EINTR));
+
+        if (BytesRead != PT_CACHE_SCAN_PAGE_SIZE) {
+            Result->Status = (BytesRead < 0) ? errno : EIO;
+            break;
+        }
+
+        Iterations += 1;
+    }
+
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+MainEnd:
+    if (Streamer > 0) {
+        kill(Streamer, SIGKILL);
+        waitpid(Streamer, NULL, 0);
+    }
+
+    if (HotFile >= 0) {
+        close(HotFile);
+    }
+
+    if (FilesCreated != 0) {
+        remove(HotFileName);
+        remove(ColdFileName);
+    }
+
+    if (Buffer != NULL) {
+        free(Buffer);
+    }
+
+    Result->Data.Iterations = Iterations;
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+int
+CacheScanCreateFiles (
+    char *HotFileName,
+    char *ColdFileName,
+    int *HotFile
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the hot file, filled with data, and the sparse cold
+    file.
+
+Arguments:
+
+    HotFileName - Supplies the name of the hot file to create.
+
+    ColdFileName - Supplies the name of the cold file to create.
+
+    HotFile - Supplies a pointer where the open descriptor for the hot file
+        will be returned.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    char *Buffer;
+    ssize_t BytesWritten;
+    int ColdFile;
+    int Error;
+    int File;
+    long Index;
+
+    ColdFile = -1;
+    Error = 0;
+    Buffer = calloc(1, PT_CACHE_SCAN_STREAM_BUFFER_SIZE);
+    if (Buffer == NULL) {
+        return ENOMEM;
+    }
+
+    File = open(HotFileName, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (File < 0) {
+        Error = errno;
+        goto CreateFilesEnd;
+    }
+
+    for (Index = 0;
+         Index < (PT_CACHE_SCAN_HOT_FILE_SIZE /
+                  PT_CACHE_SCAN_STREAM_BUFFER_SIZE);
+         Index += 1) {
+
+        do {
+            BytesWritten = write(File,
+                                 Buffer,
+                                 PT_CACHE_SCAN_STREAM_BUFFER_SIZE);
+
+        } while ((BytesWritten < 0) && (errno == EINTR));
+
+        if (BytesWritten != PT_CACHE_SCAN_STREAM_BUFFER_SIZE) {
+            Error = (BytesWritten < 0) ? errno : EIO;
+            goto CreateFilesEnd;
+        }
+    }
+
+    if (fsync(File) != 0) {
+        Error = errno;
+        goto CreateFilesEnd;
+    }
+
+    //
+    // Writing the last byte is enough to size the cold file.
+    //
+
+    ColdFile = open(ColdFileName,
+                    O_RDWR | O_CREAT | O_TRUNC,
+                    S_IRUSR | S_IWUSR);
+
+    if (ColdFile < 0) {
+        Error = errno;
+        goto CreateFilesEnd;
+    }
+
+    if ((lseek(ColdFile, PT_CACHE_SCAN_COLD_FILE_SIZE - 1, SEEK_SET) < 0) ||
+        (write(ColdFile, "", 1) != 1)) {
+
+        Error = errno;
+        goto CreateFilesEnd;
+    }
+
+CreateFilesEnd:
+    if (ColdFile >= 0) {
+        close(ColdFile);
+    }
+
+    if (Error != 0) {
+        if (File >= 0) {
+            close(File);
+            File = -1;
+        }
+    }
+
+    *HotFile = File;
+    free(Buffer);
+    return Error;
+}
+
+void
+CacheScanStream (
+    char *FileName
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads through the given file from start to finish over and
+    over again. It does not return unless something fails.
+
+Arguments:
+
+    FileName - Supplies the name of the file to stream.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    char *Buffer;
+    ssize_t BytesRead;
+    int File;
+
+    Buffer = malloc(PT_CACHE_SCAN_STREAM_BUFFER_SIZE);
+    if (Buffer == NULL) {
+        return;
+    }
+
+    File = open(FileName, O_RDONLY);
+    if (File < 0) {
+        free(Buffer);
+        return;
+    }
+
+    while (1) {
+        BytesRead = read(File, Buffer, PT_CACHE_SCAN_STREAM_BUFFER_SIZE);
+        if (BytesRead == 0) {
+            if (lseek(File, 0, SEEK_SET) != 0) {
+                break;
+            }
+
+            continue;
+        }
+
+        if ((BytesRead < 0) && (errno != EINTR)) {
+            break;
+        }
+    }
+
+    close(File);
+    free(Buffer);
+    return;
+}
+
@@ -0,0 +1,409 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    filelock.c
+
+Abstract:
+
+    This module implements the performance benchmark test for byte-range
+    file locks on a file that already has thousands of locks on it.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "perftest.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define PT_FILE_LOCK_NAME_LENGTH 48
+
+//
+// The child holds this many single byte read locks, one on every other byte
+// of the file. The parent locks ranges that each cover a handful of them.
+//
+
+#define PT_FILE_LOCK_HELD_COUNT 4096
+#define PT_FILE_LOCK_RANGE_SIZE 64
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+int
+FileLockSet (
+    int File,
+    short Type,
+    off_t Offset,
+    off_t Size,
+    int *Error
+    );
+
+void
+FileLockHolder (
+    int File,
+    int ReadyPipe,
+    int ExitPipe
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+void
+FileLockMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the file lock benchmark test. A child process takes
+    thousands of read locks on a file. The parent then counts how many times
+    it can take and release a read lock on a random range, and fail to take a
+    write lock on the same range.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ssize_t BytesRead;
+    int Error;
+    int ExitPipe[2];
+    int File;
+    char FileName[PT_FILE_LOCK_NAME_LENGTH];
+    pid_t Holder;
+    unsigned long long Iterations;
+    off_t Offset;
+    pid_t ProcessId;
+    char Ready;
+    int ReadyPipe[2];
+    int Status;
+
+    File = -1;
+    Holder = -1;
+    Iterations = 0;
+    ExitPipe[0] = -1;
+    ExitPipe[1] = -1;
+    ReadyPipe[0] = -1;
+    ReadyPipe[1] = -1;
+    Result->Type = PtResultIterations;
+    Result->Status = 0;
+    ProcessId = getpid();
+    if (snprintf(FileName,
+                 PT_FILE_LOCK_NAME_LENGTH,
+                 "file_lock_%d.txt",
+                 ProcessId) < 0) {
+
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    File = open(FileName, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (File < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    if ((pipe(ReadyPipe) != 0) || (pipe(ExitPipe) != 0)) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    //
+    // Fire up the child that holds all the locks, and wait for it to get
+    // them.
+    //
+
+    Holder = fork();
+    if (Holder < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    if (Holder == 0) {
+        close(ReadyPipe[0]);
+        close(ExitPipe[1]);
+        FileLockHolder(File, ReadyPipe[1], ExitPipe[0]);
+        _exit(0);
+    }
+
+    close(ReadyPipe[1]);
+    ReadyPipe[1] = -1;
+    close(ExitPipe[0]);
+    ExitPipe[0] = -1;
+    do {
+        BytesRead = read(ReadyPipe[0], &Ready, 1);
+
+    } while ((BytesRead < 0) && (errno == EINTR));
+
+    if (BytesRead != 1) {
+        Result->Status = (BytesRead < 0) ? errno : EIO;
+        goto MainEnd;
+    }
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    srand(ProcessId);
+    while (PtIsTimedTestRunning() != 0) {
+        Offset = rand() % ((PT_FILE_LOCK_HELD_COUNT * 2) -
+                           PT_FILE_LOCK_RANGE_SIZE);
+
+        //
+        // A read lock coexists with the child's read locks.
+        //
+
+        Status = FileLockSet(File,
+                             F_RDLCK,
+                             Offset,
+                             PT_FILE_LOCK_RANGE_SIZE,
+                             &Error);
+
+        if (Status != 0) {
+            Result->Status = Error;
+            break;
+        }
+
+        Status = FileLockSet(File,
+                             F_UNLCK,
+                             Offset,
+                             PT_FILE_LOCK_RANGE_SIZE,
+                             &Error);
+
+        if (Status != 0) {
+            Result->Status = Error;
+            break;
+        }
+
+        //
+        // A write lock conflicts with them.
+        //
+
+        Status = FileLockSet(File,
+                             F_WRLCK,
+                             Offset,
+                             PT_FILE_LOCK_RANGE_SIZE,
+                             &Error);
+
+        if (Status == 0) {
+            Result->Status = EINVAL;
+            break;
+        }
+
+        if ((Error != EAGAIN) && (Error != EACCES)) {
+            Result->Status = Error;
+            break;
+        }
+
+        Iterations += 1;
+    }
+
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+MainEnd:
+    if (ExitPipe[1] >= 0) {
+        close(ExitPipe[1]);
+    }
+
+    if (Holder > 0) {
+        waitpid(Holder, NULL, 0);
+    }
+
+    if (ExitPipe[0] >= 0) {
+        close(ExitPipe[0]);
+    }
+
+    if (ReadyPipe[0] >= 0) {
+        close(ReadyPipe[0]);
+    }
+
+    if (ReadyPipe[1] >= 0) {
+        close(ReadyPipe[1]);
+    }
+
+    if (File >= 0) {
+        close(File);
+        remove(FileName);
+    }
+
+    Result->Data.Iterations = Iterations;
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+int
+FileLockSet (
+    int File,
+    short Type,
+    off_t Offset,
+    off_t Size,
+    int *Error
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets or clears a file lock without blocking.
+
+Arguments:
+
+    File - Supplies the open file descriptor.
+
+    Type - Supplies the lock type: F_RDLCK, F_WRLCK, or F_UNLCK.
+
+    Offset - Supplies the offset of the lock.
+
+    Size - Supplies the size of the lock.
+
+    Error - Supplies a pointer where the error number will be returned on
+        failure.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure.
+
+--*/
+
+{
+
+    struct flock Lock;
+    int Status;
+
+    memset(&Lock, 0, sizeof(struct flock));
+    Lock.l_type = Type;
+    Lock.l_whence = SEEK_SET;
+    Lock.l_start = Offset;
+    Lock.l_len = Size;
+    Status = fcntl(File, F_SETLK, &Lock);
+    if (Status != 0) {
+        *Error = errno;
+    }
+
+    return Status;
+}
+
+void
+FileLockHolder (
+    int File,
+    int ReadyPipe,
+    int ExitPipe
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the child process that holds the file locks. It
+    takes a read lock on every other byte, reports that it's ready, and then
+    holds the locks until the parent closes the exit pipe.
+
+Arguments:
+
+    File - Supplies the open file descriptor.
+
+    ReadyPipe - Supplies the pipe to write to once the locks are held.
+
+    ExitPipe - Supplies the pipe to wait on before exiting.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ssize_t BytesRead;
+    int Error;
+    int Index;
+    char Ready;
+    int Status;
+
+    for (Index = 0; Index < PT_FILE_LOCK_HELD_COUNT; Index += 1) {
+        Status = FileLockSet(File, F_RDLCK, Index * 2, 1, &Error);
+        if (Status != 0) {
+            return;
+        }
+    }
+
+    Ready = 0;
+    if (write(ReadyPipe, &Ready, 1) != 1) {
+        return;
+    }
+
+    do {
+        BytesRead = read(ExitPipe, &Ready, 1);
+
+    } while ((BytesRead < 0) && (errno == EINTR));
+
+    return;
+}
+
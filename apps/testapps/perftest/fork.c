@@ -32,6 +32,7 @@ Module Name:
 
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
 
@@ -41,6 +42,14 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// Define the heap sizes the parent allocates and touches before running the
+// larger fork tests.
+//
+
+#define FORK_64M_HEAP_SIZE (64 * 1024 * 1024)
+#define FORK_512M_HEAP_SIZE (512 * 1024 * 1024)
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -67,7 +76,7 @@ ForkMain (
 
 Routine Description:
 
-    This routine performs the fork performance benchmark test.
+    This routine performs the fork performance benchmark tests.
 
 Arguments:
 
@@ -85,12 +94,59 @@ Return Value:
 {
 
     pid_t Child;
+    char *ChildArguments[SPAWN_CHILD_ARGUMENT_COUNT + 1];
+    int Exec;
+    void *Heap;
+    size_t HeapSize;
     unsigned long long Iterations;
     int Status;
 
+    Exec = 0;
+    Heap = NULL;
+    HeapSize = 0;
     Iterations = 0;
     Result->Type = PtResultIterations;
     Result->Status = 0;
+    switch (Test->TestType) {
+    case PtTestFork64M:
+        HeapSize = FORK_64M_HEAP_SIZE;
+        break;
+
+    case PtTestFork512M:
+        HeapSize = FORK_512M_HEAP_SIZE;
+        break;
+
+    case PtTestForkExec:
+        Exec = 1;
+        break;
+
+    case PtTestForkExec512M:
+        Exec = 1;
+        HeapSize = FORK_512M_HEAP_SIZE;
+        break;
+
+    default:
+        break;
+    }
+
+    //
+    // Grow the resident set of the parent so that the cost of copying the
+    // address space shows up in the results.
+    //
+
+    if (HeapSize != 0) {
+        Heap = malloc(HeapSize);
+        if (Heap == NULL) {
+            Result->Status = errno;
+            goto MainEnd;
+        }
+
+        memset(Heap, 1, HeapSize);
+    }
+
+    ChildArguments[0] = PtProgramPath;
+    ChildArguments[1] = SPAWN_TEST_NAME;
+    ChildArguments[2] = NULL;
 
     //
     // Start the test. This snaps resource usage and starts the clock ticking.
@@ -105,7 +161,8 @@ Return Value:
     //
     // Measure the performance of the fork() C library routine by counting the
     // number of times a forked child can be waited on during the given
-    // duration. The child, in this case, exits immediately.
+    // duration. The child, in this case, exits immediately or executes an
+    // image that exits immediately.
     //
 
     while (PtIsTimedTestRunning() != 0) {
@@ -115,6 +172,11 @@ Return Value:
             break;
 
         } else if (Child == 0) {
+            if (Exec != 0) {
+                execv(PtProgramPath, ChildArguments);
+                _exit(errno);
+            }
+
             exit(0);
 
         } else {
@@ -143,6 +205,10 @@ Return Value:
     }
 
 MainEnd:
+    if (Heap != NULL) {
+        free(Heap);
+    }
+
     Result->Data.Iterations = Iterations;
     return;
 }
@@ -0,0 +1,361 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    largedir.c
+
+Abstract:
+
+    This module implements the performance benchmark tests for path lookups
+    in a directory with a large number of entries.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "perftest.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define PT_LARGE_DIRECTORY_NAME_LENGTH 48
+#define PT_LARGE_DIRECTORY_PATH_LENGTH 80
+
+//
+// Define the number of files created in the large directory.
+//
+
+#define PT_LARGE_DIRECTORY_FILE_COUNT 50000
+
+//
+// Define the number of distinct missing names looked up by the negative
+// lookup test.
+//
+
+#define PT_LARGE_DIRECTORY_MISSING_COUNT 1024
+
+//
+// Define the stride used to walk the files in a scattered order. This is
+// relatively prime to the file count.
+//
+
+#define PT_LARGE_DIRECTORY_STRIDE 7919
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+int
+LargeDirectoryCreate (
+    char *DirectoryName,
+    int *FileCount
+    );
+
+void
+LargeDirectoryDestroy (
+    char *DirectoryName,
+    int FileCount
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+void
+LargeDirectoryMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the large directory open and stat performance
+    benchmark tests.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    char DirectoryName[PT_LARGE_DIRECTORY_NAME_LENGTH];
+    int FileCount;
+    int FileDescriptor;
+    int Index;
+    unsigned long long Iterations;
+    char Path[PT_LARGE_DIRECTORY_PATH_LENGTH];
+    pid_t ProcessId;
+    struct stat Stat;
+    int Status;
+
+    DirectoryName[0] = '\0';
+    FileCount = 0;
+    Index = 0;
+    Iterations = 0;
+    Result->Type = PtResultIterations;
+    Result->Status = 0;
+
+    //
+    // Get the process ID and create a process safe directory full of files.
+    //
+
+    ProcessId = getpid();
+    Status = snprintf(DirectoryName,
+                      PT_LARGE_DIRECTORY_NAME_LENGTH,
+                      "largedir_%d",
+                      ProcessId);
+
+    if (Status < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    Status = LargeDirectoryCreate(DirectoryName, &FileCount);
+    if (Status != 0) {
+        Result->Status = Status;
+        goto MainEnd;
+    }
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    //
+    // Measure the performance of looking up entries in the large directory,
+    // scattering the accesses across all of the files. The missing name test
+    // cycles through a smaller set of names that never exist.
+    //
+
+    while (PtIsTimedTestRunning() != 0) {
+        switch (Test->TestType) {
+        case PtTestOpenLargeDirectory:
+            snprintf(Path,
+                     PT_LARGE_DIRECTORY_PATH_LENGTH,
+                     "%s/f%d",
+                     DirectoryName,
+                     Index);
+
+            FileDescriptor = open(Path, O_RDONLY);
+            if (FileDescriptor < 0) {
+                Result->Status = errno;
+                break;
+            }
+
+            close(FileDescriptor);
+            break;
+
+        case PtTestStatLargeDirectory:
+            snprintf(Path,
+                     PT_LARGE_DIRECTORY_PATH_LENGTH,
+                     "%s/f%d",
+                     DirectoryName,
+                     Index);
+
+            Status = stat(Path, &Stat);
+            if (Status != 0) {
+                Result->Status = errno;
+            }
+
+            break;
+
+        case PtTestStatMissingLargeDirectory:
+            snprintf(Path,
+                     PT_LARGE_DIRECTORY_PATH_LENGTH,
+                     "%s/missing%d",
+                     DirectoryName,
+                     Index % PT_LARGE_DIRECTORY_MISSING_COUNT);
+
+            Status = stat(Path, &Stat);
+            if (Status == 0) {
+                Result->Status = EEXIST;
+
+            } else if (errno != ENOENT) {
+                Result->Status = errno;
+            }
+
+            break;
+
+        default:
+            Result->Status = EINVAL;
+            break;
+        }
+
+        if (Result->Status != 0) {
+            break;
+        }
+
+        Index = (Index + PT_LARGE_DIRECTORY_STRIDE) % FileCount;
+        Iterations += 1;
+    }
+
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+MainEnd:
+    if (DirectoryName[0] != '\0') {
+        LargeDirectoryDestroy(DirectoryName, FileCount);
+    }
+
+    Result->Data.Iterations = Iterations;
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+int
+LargeDirectoryCreate (
+    char *DirectoryName,
+    int *FileCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the large directory and fills it with empty files.
+
+Arguments:
+
+    DirectoryName - Supplies a pointer to the name of the directory to create.
+
+    FileCount - Supplies a pointer that receives the number of files created.
+        This is valid even on failure so that the caller can clean up.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    int FileDescriptor;
+    int Index;
+    char Path[PT_LARGE_DIRECTORY_PATH_LENGTH];
+    int Status;
+
+    *FileCount = 0;
+    Status = mkdir(DirectoryName, S_IRWXU);
+    if (Status != 0) {
+        return errno;
+    }
+
+    for (Index = 0; Index < PT_LARGE_DIRECTORY_FILE_COUNT; Index += 1) {
+        snprintf(Path,
+                 PT_LARGE_DIRECTORY_PATH_LENGTH,
+                 "%s/f%d",
+                 DirectoryName,
+                 Index);
+
+        FileDescriptor = creat(Path, S_IRUSR | S_IWUSR);
+        if (FileDescriptor < 0) {
+            return errno;
+        }
+
+        close(FileDescriptor);
+        *FileCount = Index + 1;
+    }
+
+    return 0;
+}
+
+void
+LargeDirectoryDestroy (
+    char *DirectoryName,
+    int FileCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes the files in the large directory and then the
+    directory itself.
+
+Arguments:
+
+    DirectoryName - Supplies a pointer to the name of the directory.
+
+    FileCount - Supplies the number of files that were created in the
+        directory.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    int Index;
+    char Path[PT_LARGE_DIRECTORY_PATH_LENGTH];
+
+    for (Index = 0; Index < FileCount; Index += 1) {
+        snprintf(Path,
+                 PT_LARGE_DIRECTORY_PATH_LENGTH,
+                 "%s/f%d",
+                 DirectoryName,
+                 Index);
+
+        remove(Path);
+    }
+
+    rmdir(DirectoryName);
+    return;
+}
+
@@ -0,0 +1,506 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    pathwalk.c
+
+Abstract:
+
+    This module implements the performance benchmark tests for walking deep
+    paths, both from a single thread and from many threads at once.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "perftest.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define PT_PATH_WALK_PATH_LENGTH 128
+
+//
+// Define the number of directories between the test directory and the file
+// being looked up.
+//
+
+#define PT_PATH_WALK_DEPTH 6
+
+//
+// Define the number of additional threads walking the path in the threaded
+// test.
+//
+
+#define PT_PATH_WALK_THREAD_COUNT 7
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines the context handed to each path walk thread.
+
+Members:
+
+    Path - Stores a pointer to the path to stat.
+
+    Iterations - Stores the number of successful iterations the thread ran.
+
+    Status - Stores 0 on success or an error number on failure.
+
+--*/
+
+typedef struct _PT_PATH_WALK_THREAD {
+    const char *Path;
+    unsigned long long Iterations;
+    int Status;
+} PT_PATH_WALK_THREAD, *PPT_PATH_WALK_THREAD;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+void *
+PathWalkStartRoutine (
+    void *Parameter
+    );
+
+int
+PathWalkCreateTree (
+    char *DirectoryName,
+    char *Path,
+    int *Depth
+    );
+
+void
+PathWalkDestroyTree (
+    char *DirectoryName,
+    int Depth
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+pthread_mutex_t PathWalkReadyLock = PTHREAD_MUTEX_INITIALIZER;
+volatile int PathWalkReadyThreadCount;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+void
+PathWalkMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the deep path walk performance benchmark tests.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    int Depth;
+    char DirectoryName[PT_PATH_WALK_PATH_LENGTH];
+    unsigned long long Iterations;
+    char Path[PT_PATH_WALK_PATH_LENGTH];
+    pid_t ProcessId;
+    struct stat Stat;
+    int Status;
+    int ThreadCount;
+    PPT_PATH_WALK_THREAD ThreadContexts;
+    int ThreadIndex;
+    pthread_t *Threads;
+
+    Depth = 0;
+    DirectoryName[0] = '\0';
+    Iterations = 0;
+    ThreadContexts = NULL;
+    ThreadIndex = 0;
+    Threads = NULL;
+    Result->Type = PtResultIterations;
+    Result->Status = 0;
+
+    //
+    // Get the process ID and create a process safe directory tree with a file
+    // at the bottom.
+    //
+
+    ProcessId = getpid();
+    Status = snprintf(DirectoryName,
+                      PT_PATH_WALK_PATH_LENGTH,
+                      "pathwalk_%d",
+                      ProcessId);
+
+    if (Status < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    Status = PathWalkCreateTree(DirectoryName, Path, &Depth);
+    if (Status != 0) {
+        Result->Status = Status;
+        goto MainEnd;
+    }
+
+    //
+    // Fire up the other threads for the threaded test.
+    //
+
+    switch (Test->TestType) {
+    case PtTestStatDeepPath:
+        break;
+
+    case PtTestStatDeepPathThreaded:
+        Threads = malloc(sizeof(pthread_t) * PT_PATH_WALK_THREAD_COUNT);
+        ThreadContexts = malloc(sizeof(PT_PATH_WALK_THREAD) *
+                                PT_PATH_WALK_THREAD_COUNT);
+
+        if ((Threads == NULL) || (ThreadContexts == NULL)) {
+            Result->Status = ENOMEM;
+            goto MainEnd;
+        }
+
+        memset(ThreadContexts,
+               0,
+               sizeof(PT_PATH_WALK_THREAD) * PT_PATH_WALK_THREAD_COUNT);
+
+        for (ThreadIndex = 0;
+             ThreadIndex < PT_PATH_WALK_THREAD_COUNT;
+             ThreadIndex += 1) {
+
+            ThreadContexts[ThreadIndex].Path = Path;
+            Status = pthread_create(&(Threads[ThreadIndex]),
+                                    NULL,
+                                    PathWalkStartRoutine,
+                                    &(ThreadContexts[ThreadIndex]));
+
+            if (Status != 0) {
+                Result->Status = Status;
+                goto MainEnd;
+            }
+        }
+
+        //
+        // Wait until all threads are spun up.
+        //
+
+        while (PathWalkReadyThreadCount != PT_PATH_WALK_THREAD_COUNT) {
+            sleep(1);
+        }
+
+        break;
+
+    default:
+        Result->Status = EINVAL;
+        goto MainEnd;
+    }
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    //
+    // Measure the performance of walking the deep path by counting the number
+    // of times the file at the bottom can be stat'd.
+    //
+
+    while (PtIsTimedTestRunning() != 0) {
+        Status = stat(Path, &Stat);
+        if (Status != 0) {
+            Result->Status = errno;
+            break;
+        }
+
+        Iterations += 1;
+    }
+
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+MainEnd:
+
+    //
+    // Wait for the other threads to notice the test is over and add up their
+    // work. If something failed before the test started, cancel them.
+    //
+
+    if (Threads != NULL) {
+        ThreadCount = ThreadIndex;
+        for (ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex += 1) {
+            if (Result->Status != 0) {
+                pthread_cancel(Threads[ThreadIndex]);
+            }
+
+            pthread_join(Threads[ThreadIndex], NULL);
+            Iterations += ThreadContexts[ThreadIndex].Iterations;
+            if ((Result->Status == 0) &&
+                (ThreadContexts[ThreadIndex].Status != 0)) {
+
+                Result->Status = ThreadContexts[ThreadIndex].Status;
+            }
+        }
+
+        free(Threads);
+    }
+
+    if (ThreadContexts != NULL) {
+        free(ThreadContexts);
+    }
+
+    if (DirectoryName[0] != '\0') {
+        PathWalkDestroyTree(DirectoryName, Depth);
+    }
+
+    Result->Data.Iterations = Iterations;
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+void *
+PathWalkStartRoutine (
+    void *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the start routine for a path walk test thread. It
+    waits for the test to start and then stats the deep path until the test
+    ends.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the thread's context.
+
+Return Value:
+
+    Returns the NULL pointer.
+
+--*/
+
+{
+
+    PPT_PATH_WALK_THREAD Context;
+    struct stat Stat;
+
+    Context = (PPT_PATH_WALK_THREAD)Parameter;
+
+    //
+    // Announce that the thread is ready.
+    //
+
+    pthread_mutex_lock(&PathWalkReadyLock);
+    PathWalkReadyThreadCount += 1;
+    pthread_mutex_unlock(&PathWalkReadyLock);
+
+    //
+    // Busy spin waiting for the test to start.
+    //
+
+    while (PtIsTimedTestRunning() == 0) {
+        pthread_testcancel();
+    }
+
+    //
+    // Loop running the test.
+    //
+
+    while (PtIsTimedTestRunning() != 0) {
+        if (stat(Context->Path, &Stat) != 0) {
+            Context->Status = errno;
+            break;
+        }
+
+        Context->Iterations += 1;
+    }
+
+    return NULL;
+}
+
+int
+PathWalkCreateTree (
+    char *DirectoryName,
+    char *Path,
+    int *Depth
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the nested directories and the file at the bottom.
+
+Arguments:
+
+    DirectoryName - Supplies a pointer to the name of the top level directory
+        to create.
+
+    Path - Supplies a pointer to a buffer of PT_PATH_WALK_PATH_LENGTH bytes
+        that receives the path to the file at the bottom of the tree.
+
+    Depth - Supplies a pointer that receives the number of directories
+        successfully created below the top level directory. This is valid even
+        on failure so that the caller can clean up.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    int FileDescriptor;
+    int Index;
+    size_t Length;
+
+    *Depth = 0;
+    if (mkdir(DirectoryName, S_IRWXU) != 0) {
+        return errno;
+    }
+
+    Length = snprintf(Path, PT_PATH_WALK_PATH_LENGTH, "%s", DirectoryName);
+    for (Index = 0; Index < PT_PATH_WALK_DEPTH; Index += 1) {
+        Length += snprintf(Path + Length,
+                           PT_PATH_WALK_PATH_LENGTH - Length,
+                           "/d%d",
+                           Index);
+
+        if (mkdir(Path, S_IRWXU) != 0) {
+            return errno;
+        }
+
+        *Depth = Index + 1;
+    }
+
+    snprintf(Path + Length, PT_PATH_WALK_PATH_LENGTH - Length, "/file");
+    FileDescriptor = creat(Path, S_IRUSR | S_IWUSR);
+    if (FileDescriptor < 0) {
+        return errno;
+    }
+
+    close(FileDescriptor);
+    return 0;
+}
+
+void
+PathWalkDestroyTree (
+    char *DirectoryName,
+    int Depth
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes the file at the bottom of the tree and then each
+    directory on the way back up.
+
+Arguments:
+
+    DirectoryName - Supplies a pointer to the name of the top level directory.
+
+    Depth - Supplies the number of directories that were created below the top
+        level directory.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    int Component;
+    int Index;
+    size_t Length;
+    char Path[PT_PATH_WALK_PATH_LENGTH];
+
+    //
+    // Remove the deepest directory first, working back up to the top level
+    // directory. The file only exists if the whole tree got created.
+    //
+
+    for (Index = Depth; Index >= 0; Index -= 1) {
+        Length = snprintf(Path, PT_PATH_WALK_PATH_LENGTH, "%s", DirectoryName);
+        for (Component = 0; Component < Index; Component += 1) {
+            Length += snprintf(Path + Length,
+                               PT_PATH_WALK_PATH_LENGTH - Length,
+                               "/d%d",
+                               Component);
+        }
+
+        if (Index == PT_PATH_WALK_DEPTH) {
+            snprintf(Path + Length, PT_PATH_WALK_PATH_LENGTH - Length, "/file");
+            remove(Path);
+            Path[Length] = '\0';
+        }
+
+        rmdir(Path);
+    }
+
+    return;
+}
+
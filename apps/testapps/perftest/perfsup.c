@@ -32,6 +32,7 @@ Module Name:
 
 #include <errno.h>
 #include <signal.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/resource.h>
@@ -404,6 +405,43 @@ Return Value:
     return 0;
 }
 
+long
+PtGetRandomIndex (
+    long Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns a random index for picking among a number of items,
+    such as the pages of a file. The caller should seed the generator with
+    srand first.
+
+Arguments:
+
+    Count - Supplies the number of items to pick from. This must be greater
+        than zero.
+
+Return Value:
+
+    Returns a random value between zero and the count minus one.
+
+--*/
+
+{
+
+    unsigned long long Value;
+
+    //
+    // Combine two calls so that the result covers large counts even where
+    // RAND_MAX is small. Build it unsigned so the shift cannot overflow.
+    //
+
+    Value = ((unsigned long long)rand() << 32) ^ (unsigned long long)rand();
+    return (long)(Value % (unsigned long long)Count);
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
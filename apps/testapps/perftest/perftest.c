@@ -413,6 +413,195 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtTestSignalRestart,
      PtResultIterations,
      SIGNAL_RESTART_DEFAULT_DURATION},
+
+    {VFORK_TEST_NAME,
+     VFORK_TEST_DESCRIPTION,
+     SpawnMain,
+     PtTestVfork,
+     PtResultIterations,
+     VFORK_TEST_DEFAULT_DURATION},
+
+    {SPAWN_TEST_NAME,
+     SPAWN_TEST_DESCRIPTION,
+     SpawnMain,
+     PtTestSpawn,
+     PtResultIterations,
+     SPAWN_TEST_DEFAULT_DURATION},
+
+    {SPAWN_LARGE_HEAP_TEST_NAME,
+     SPAWN_LARGE_HEAP_TEST_DESCRIPTION,
+     SpawnMain,
+     PtTestSpawnLargeHeap,
+     PtResultIterations,
+     SPAWN_LARGE_HEAP_TEST_DEFAULT_DURATION},
+
+    {FORK_64M_TEST_NAME,
+     FORK_64M_TEST_DESCRIPTION,
+     ForkMain,
+     PtTestFork64M,
+     PtResultIterations,
+     FORK_64M_TEST_DEFAULT_DURATION},
+
+    {FORK_512M_TEST_NAME,
+     FORK_512M_TEST_DESCRIPTION,
+     ForkMain,
+     PtTestFork512M,
+     PtResultIterations,
+     FORK_512M_TEST_DEFAULT_DURATION},
+
+    {FORK_EXEC_TEST_NAME,
+     FORK_EXEC_TEST_DESCRIPTION,
+     ForkMain,
+     PtTestForkExec,
+     PtResultIterations,
+     FORK_EXEC_TEST_DEFAULT_DURATION},
+
+    {FORK_EXEC_512M_TEST_NAME,
+     FORK_EXEC_512M_TEST_DESCRIPTION,
+     ForkMain,
+     PtTestForkExec512M,
+     PtResultIterations,
+     FORK_EXEC_512M_TEST_DEFAULT_DURATION},
+
+    {OPEN_LARGE_DIRECTORY_TEST_NAME,
+     OPEN_LARGE_DIRECTORY_TEST_DESCRIPTION,
+     LargeDirectoryMain,
+     PtTestOpenLargeDirectory,
+     PtResultIterations,
+     OPEN_LARGE_DIRECTORY_TEST_DEFAULT_DURATION},
+
+    {STAT_LARGE_DIRECTORY_TEST_NAME,
+     STAT_LARGE_DIRECTORY_TEST_DESCRIPTION,
+     LargeDirectoryMain,
+     PtTestStatLargeDirectory,
+     PtResultIterations,
+     STAT_LARGE_DIRECTORY_TEST_DEFAULT_DURATION},
+
+    {STAT_MISSING_LARGE_DIRECTORY_TEST_NAME,
+     STAT_MISSING_LARGE_DIRECTORY_TEST_DESCRIPTION,
+     LargeDirectoryMain,
+     PtTestStatMissingLargeDirectory,
+     PtResultIterations,
+     STAT_MISSING_LARGE_DIRECTORY_TEST_DEFAULT_DURATION},
+
+    {STAT_DEEP_PATH_TEST_NAME,
+     STAT_DEEP_PATH_TEST_DESCRIPTION,
+     PathWalkMain,
+     PtTestStatDeepPath,
+     PtResultIterations,
+     STAT_DEEP_PATH_TEST_DEFAULT_DURATION},
+
+    {STAT_DEEP_PATH_THREADED_TEST_NAME,
+     STAT_DEEP_PATH_THREADED_TEST_DESCRIPTION,
+     PathWalkMain,
+     PtTestStatDeepPathThreaded,
+     PtResultIterations,
+     STAT_DEEP_PATH_THREADED_TEST_DEFAULT_DURATION},
+
+    {SOCKET_READ_WRITE_TEST_NAME,
+     SOCKET_READ_WRITE_TEST_DESCRIPTION,
+     SendFileMain,
+     PtTestSocketReadWrite,
+     PtResultBytes,
+     SOCKET_READ_WRITE_TEST_DEFAULT_DURATION},
+
+    {SEND_FILE_TEST_NAME,
+     SEND_FILE_TEST_DESCRIPTION,
+     SendFileMain,
+     PtTestSendFile,
+     PtResultBytes,
+     SEND_FILE_TEST_DEFAULT_DURATION},
+
+    {RANDOM_READ_TEST_NAME,
+     RANDOM_READ_TEST_DESCRIPTION,
+     ReadMain,
+     PtTestRandomRead,
+     PtResultBytes,
+     RANDOM_READ_TEST_DEFAULT_DURATION},
+
+    {CACHE_SCAN_TEST_NAME,
+     CACHE_SCAN_TEST_DESCRIPTION,
+     CacheScanMain,
+     PtTestCacheScan,
+     PtResultIterations,
+     CACHE_SCAN_TEST_DEFAULT_DURATION},
+
+    {DIRECT_READ_TEST_NAME,
+     DIRECT_READ_TEST_DESCRIPTION,
+     ReadMain,
+     PtTestDirectRead,
+     PtResultBytes,
+     DIRECT_READ_TEST_DEFAULT_DURATION},
+
+    {DIRECT_WRITE_TEST_NAME,
+     DIRECT_WRITE_TEST_DESCRIPTION,
+     WriteMain,
+     PtTestDirectWrite,
+     PtResultBytes,
+     DIRECT_WRITE_TEST_DEFAULT_DURATION},
+
+    {PIPE_IO_64K_TEST_NAME,
+     PIPE_IO_64K_TEST_DESCRIPTION,
+     PipeIoMain,
+     PtTestPipeIo64K,
+     PtResultBytes,
+     PIPE_IO_64K_TEST_DEFAULT_DURATION},
+
+    {PIPE_IO_1M_TEST_NAME,
+     PIPE_IO_1M_TEST_DESCRIPTION,
+     PipeIoMain,
+     PtTestPipeIo1M,
+     PtResultBytes,
+     PIPE_IO_1M_TEST_DEFAULT_DURATION},
+
+    {FILE_LOCK_TEST_NAME,
+     FILE_LOCK_TEST_DESCRIPTION,
+     FileLockMain,
+     PtTestFileLock,
+     PtResultIterations,
+     FILE_LOCK_TEST_DEFAULT_DURATION},
+
+    {THREADED_READ_TEST_NAME,
+     THREADED_READ_TEST_DESCRIPTION,
+     ReadMain,
+     PtTestThreadedRead,
+     PtResultBytes,
+     THREADED_READ_TEST_DEFAULT_DURATION},
+
+    {READV_16_TEST_NAME,
+     READV_16_TEST_DESCRIPTION,
+     ReadMain,
+     PtTestReadv16,
+     PtResultBytes,
+     READV_16_TEST_DEFAULT_DURATION},
+
+    {READV_64_TEST_NAME,
+     READV_64_TEST_DESCRIPTION,
+     ReadMain,
+     PtTestReadv64,
+     PtResultBytes,
+     READV_64_TEST_DEFAULT_DURATION},
+
+    {WRITEV_16_TEST_NAME,
+     WRITEV_16_TEST_DESCRIPTION,
+     WriteMain,
+     PtTestWritev16,
+     PtResultBytes,
+     WRITEV_16_TEST_DEFAULT_DURATION},
+
+    {WRITEV_64_TEST_NAME,
+     WRITEV_64_TEST_DESCRIPTION,
+     WriteMain,
+     PtTestWritev64,
+     PtResultBytes,
+     WRITEV_64_TEST_DEFAULT_DURATION},
+
+    {SMALL_FILE_TEST_NAME,
+     SMALL_FILE_TEST_DESCRIPTION,
+     SmallFileMain,
+     PtTestSmallFile,
+     PtResultIterations,
+     SMALL_FILE_TEST_DEFAULT_DURATION},
 };
 
 //
@@ -498,6 +687,16 @@ Return Value:
         return ExecLoop(ArgumentCount, Arguments);
     }
 
+    //
+    // Children of the spawn tests just exit immediately.
+    //
+
+    if ((ArgumentCount == SPAWN_CHILD_ARGUMENT_COUNT) &&
+        (strcasecmp(Arguments[1], SPAWN_TEST_NAME) == 0)) {
+
+        return 0;
+    }
+
     Duration = 0;
     Failures = 0;
     ProcessCount = PT_DEFAULT_PROCESS_COUNT;
@@ -25,6 +25,7 @@ Module Name:
 // ------------------------------------------------------------------- Includes
 //
 
+#include <fcntl.h>
 #include <sys/time.h>
 
 //
@@ -57,8 +58,24 @@ Module Name:
 #define GETPPID_TEST_DESCRIPTION "Benchmarks the getppid() C library routine."
 #define PIPE_IO_TEST_NAME "pipe_io"
 #define PIPE_IO_TEST_DESCRIPTION "Benchmarks pipe I/O throughput."
+#define PIPE_IO_64K_TEST_NAME "pipe_io_64k"
+#define PIPE_IO_64K_TEST_DESCRIPTION \
+    "Benchmarks pipe I/O throughput with 64KB transfers."
+
+#define PIPE_IO_1M_TEST_NAME "pipe_io_1m"
+#define PIPE_IO_1M_TEST_DESCRIPTION \
+    "Benchmarks pipe I/O throughput with 1MB transfers."
+
 #define READ_TEST_NAME "read"
 #define READ_TEST_DESCRIPTION "Benchmarks read() throughput."
+#define RANDOM_READ_TEST_NAME "random_read"
+#define RANDOM_READ_TEST_DESCRIPTION \
+    "Benchmarks cached random 4KB pread() throughput on a 256MB file."
+
+#define THREADED_READ_TEST_NAME "read_threaded"
+#define THREADED_READ_TEST_DESCRIPTION \
+    "Benchmarks small pread() calls from 8 threads on separate descriptors."
+
 #define WRITE_TEST_NAME "write"
 #define WRITE_TEST_DESCRIPTION "Benchmarks write() throughput."
 #define COPY_TEST_NAME "copy"
@@ -145,6 +162,97 @@ Module Name:
 #define SIGNAL_RESTART_DESCRIPTION \
     "Benchmarks how many system call restarts can be made."
 
+#define VFORK_TEST_NAME "vfork"
+#define VFORK_TEST_DESCRIPTION "Benchmarks the vfork() C library routine."
+
+#define SPAWN_TEST_NAME "spawn"
+#define SPAWN_TEST_DESCRIPTION \
+    "Benchmarks the posix_spawn() C library routine."
+
+#define SPAWN_LARGE_HEAP_TEST_NAME "spawn_large_heap"
+#define SPAWN_LARGE_HEAP_TEST_DESCRIPTION \
+    "Benchmarks posix_spawn() from a parent with a 1GB heap."
+
+#define FORK_64M_TEST_NAME "fork_64m"
+#define FORK_64M_TEST_DESCRIPTION \
+    "Benchmarks fork() from a parent with a 64MB heap."
+
+#define FORK_512M_TEST_NAME "fork_512m"
+#define FORK_512M_TEST_DESCRIPTION \
+    "Benchmarks fork() from a parent with a 512MB heap."
+
+#define FORK_EXEC_TEST_NAME "fork_exec"
+#define FORK_EXEC_TEST_DESCRIPTION \
+    "Benchmarks fork() followed by exec() in the child."
+
+#define FORK_EXEC_512M_TEST_NAME "fork_exec_512m"
+#define FORK_EXEC_512M_TEST_DESCRIPTION \
+    "Benchmarks fork() and exec() from a parent with a 512MB heap."
+
+#define OPEN_LARGE_DIRECTORY_TEST_NAME "open_large_dir"
+#define OPEN_LARGE_DIRECTORY_TEST_DESCRIPTION \
+    "Benchmarks open() and close() on files in a 50,000 entry directory."
+
+#define STAT_LARGE_DIRECTORY_TEST_NAME "stat_large_dir"
+#define STAT_LARGE_DIRECTORY_TEST_DESCRIPTION \
+    "Benchmarks stat() on files in a 50,000 entry directory."
+
+#define STAT_MISSING_LARGE_DIRECTORY_TEST_NAME "stat_missing_large_dir"
+#define STAT_MISSING_LARGE_DIRECTORY_TEST_DESCRIPTION \
+    "Benchmarks stat() on missing files in a 50,000 entry directory."
+
+#define STAT_DEEP_PATH_TEST_NAME "stat_deep"
+#define STAT_DEEP_PATH_TEST_DESCRIPTION \
+    "Benchmarks stat() on a file six directories deep."
+
+#define STAT_DEEP_PATH_THREADED_TEST_NAME "stat_deep_threaded"
+#define STAT_DEEP_PATH_THREADED_TEST_DESCRIPTION \
+    "Benchmarks stat() on a file six directories deep from eight threads."
+
+#define SOCKET_READ_WRITE_TEST_NAME "socket_read_write"
+#define SOCKET_READ_WRITE_TEST_DESCRIPTION \
+    "Benchmarks read() and write() of a 1GB file over loopback TCP."
+
+#define SEND_FILE_TEST_NAME "sendfile"
+#define SEND_FILE_TEST_DESCRIPTION \
+    "Benchmarks sendfile() of a 1GB file over loopback TCP."
+
+#define CACHE_SCAN_TEST_NAME "cache_scan"
+#define CACHE_SCAN_TEST_DESCRIPTION \
+    "Benchmarks cached random reads while a large file is streamed."
+
+#define DIRECT_READ_TEST_NAME "direct_read"
+#define DIRECT_READ_TEST_DESCRIPTION \
+    "Benchmarks read() throughput on a file opened with O_DIRECT."
+
+#define DIRECT_WRITE_TEST_NAME "direct_write"
+#define DIRECT_WRITE_TEST_DESCRIPTION \
+    "Benchmarks write() throughput on a file opened with O_DIRECT."
+
+#define READV_16_TEST_NAME "readv_16"
+#define READV_16_TEST_DESCRIPTION \
+    "Benchmarks readv() throughput with 16 separate 4KB vectors per call."
+
+#define READV_64_TEST_NAME "readv_64"
+#define READV_64_TEST_DESCRIPTION \
+    "Benchmarks readv() throughput with 64 separate 4KB vectors per call."
+
+#define WRITEV_16_TEST_NAME "writev_16"
+#define WRITEV_16_TEST_DESCRIPTION \
+    "Benchmarks writev() throughput with 16 separate 4KB vectors per call."
+
+#define WRITEV_64_TEST_NAME "writev_64"
+#define WRITEV_64_TEST_DESCRIPTION \
+    "Benchmarks writev() throughput with 64 separate 4KB vectors per call."
+
+#define FILE_LOCK_TEST_NAME "file_lock"
+#define FILE_LOCK_TEST_DESCRIPTION \
+    "Benchmarks fcntl() byte-range locks on a file with 4096 locks held."
+
+#define SMALL_FILE_TEST_NAME "small_file"
+#define SMALL_FILE_TEST_DESCRIPTION \
+    "Benchmarks creating, writing, reading, renaming, and removing 4KB files."
+
 //
 // Default test durations, in seconds.
 //
@@ -158,6 +266,7 @@ Module Name:
 #define GETPPID_TEST_DEFAULT_DURATION 10
 #define PIPE_IO_TEST_DEFAULT_DURATION 30
 #define READ_TEST_DEFAULT_DURATION 60
+#define RANDOM_READ_TEST_DEFAULT_DURATION 30
 #define WRITE_TEST_DEFAULT_DURATION 60
 #define COPY_TEST_DEFAULT_DURATION 60
 #define DLOPEN_TEST_DEFAULT_DURATION 30
@@ -180,6 +289,41 @@ Module Name:
 #define SIGNAL_IGNORED_DEFAULT_DURATION 30
 #define SIGNAL_HANDLED_DEFAULT_DURATION 30
 #define SIGNAL_RESTART_DEFAULT_DURATION 30
+#define VFORK_TEST_DEFAULT_DURATION 30
+#define SPAWN_TEST_DEFAULT_DURATION 60
+#define SPAWN_LARGE_HEAP_TEST_DEFAULT_DURATION 60
+#define FORK_64M_TEST_DEFAULT_DURATION 30
+#define FORK_512M_TEST_DEFAULT_DURATION 30
+#define FORK_EXEC_TEST_DEFAULT_DURATION 30
+#define FORK_EXEC_512M_TEST_DEFAULT_DURATION 30
+#define OPEN_LARGE_DIRECTORY_TEST_DEFAULT_DURATION 30
+#define STAT_LARGE_DIRECTORY_TEST_DEFAULT_DURATION 30
+#define STAT_MISSING_LARGE_DIRECTORY_TEST_DEFAULT_DURATION 30
+#define STAT_DEEP_PATH_TEST_DEFAULT_DURATION 30
+#define STAT_DEEP_PATH_THREADED_TEST_DEFAULT_DURATION 30
+#define SOCKET_READ_WRITE_TEST_DEFAULT_DURATION 30
+#define SEND_FILE_TEST_DEFAULT_DURATION 30
+#define CACHE_SCAN_TEST_DEFAULT_DURATION 30
+#define DIRECT_READ_TEST_DEFAULT_DURATION 60
+#define DIRECT_WRITE_TEST_DEFAULT_DURATION 60
+#define PIPE_IO_64K_TEST_DEFAULT_DURATION 30
+#define PIPE_IO_1M_TEST_DEFAULT_DURATION 30
+#define FILE_LOCK_TEST_DEFAULT_DURATION 30
+#define THREADED_READ_TEST_DEFAULT_DURATION 30
+#define READV_16_TEST_DEFAULT_DURATION 30
+#define READV_64_TEST_DEFAULT_DURATION 30
+#define WRITEV_16_TEST_DEFAULT_DURATION 30
+#define WRITEV_64_TEST_DEFAULT_DURATION 30
+#define SMALL_FILE_TEST_DEFAULT_DURATION 30
+
+//
+// O_DIRECT is not part of POSIX. Where it is missing, the direct I/O tests
+// fall back to measuring cached I/O.
+//
+
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
 
 //
 // Define the number of variables supplied to an iteration of the execute test
@@ -188,6 +332,12 @@ Module Name:
 
 #define EXEC_LOOP_ARGUMENT_COUNT 5
 
+//
+// Define the number of arguments supplied to a child of the spawn tests.
+//
+
+#define SPAWN_CHILD_ARGUMENT_COUNT 2
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -225,6 +375,33 @@ typedef enum _PT_TEST_TYPE {
     PtTestSignalIgnored,
     PtTestSignalHandled,
     PtTestSignalRestart,
+    PtTestVfork,
+    PtTestSpawn,
+    PtTestSpawnLargeHeap,
+    PtTestFork64M,
+    PtTestFork512M,
+    PtTestForkExec,
+    PtTestForkExec512M,
+    PtTestOpenLargeDirectory,
+    PtTestStatLargeDirectory,
+    PtTestStatMissingLargeDirectory,
+    PtTestStatDeepPath,
+    PtTestStatDeepPathThreaded,
+    PtTestSocketReadWrite,
+    PtTestSendFile,
+    PtTestRandomRead,
+    PtTestCacheScan,
+    PtTestDirectRead,
+    PtTestDirectWrite,
+    PtTestPipeIo64K,
+    PtTestPipeIo1M,
+    PtTestFileLock,
+    PtTestThreadedRead,
+    PtTestReadv16,
+    PtTestReadv64,
+    PtTestWritev16,
+    PtTestWritev64,
+    PtTestSmallFile,
     PtTestTypeCount
 } PT_TEST_TYPE, *PPT_TEST_TYPE;
 
@@ -515,6 +692,30 @@ Return Value:
 
 --*/
 
+long
+PtGetRandomIndex (
+    long Count
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns a random index for picking among a number of items,
+    such as the pages of a file. The caller should seed the generator with
+    srand first.
+
+Arguments:
+
+    Count - Supplies the number of items to pick from. This must be greater
+        than zero.
+
+Return Value:
+
+    Returns a random value between zero and the count minus one.
+
+--*/
+
 //
 // Individual test routines.
 //
@@ -529,7 +730,7 @@ ForkMain (
 
 Routine Description:
 
-    This routine performs the fork performance benchmark test.
+    This routine performs the fork performance benchmark tests.
 
 Arguments:
 
@@ -731,7 +932,7 @@ PipeIoMain (
 
 Routine Description:
 
-    This routine performs the pipe I/O performance benchmark test.
+    This routine performs the pipe I/O performance benchmark tests.
 
 Arguments:
 
@@ -1021,3 +1222,184 @@ Return Value:
 
 --*/
 
+void
+SpawnMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the vfork and spawn performance benchmark tests.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+void
+LargeDirectoryMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the large directory open and stat performance
+    benchmark tests.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+
+void
+PathWalkMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the deep path walk performance benchmark tests.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+void
+SendFileMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the file-to-socket transfer performance benchmark
+    tests, comparing read() and write() against sendfile().
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+void
+CacheScanMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the cache scan resistance benchmark test, timing
+    random reads of a small file while another process streams a large one.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+void
+FileLockMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the file lock benchmark test, timing byte-range
+    lock operations on a file that another process holds many locks on.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+void
+SmallFileMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the small file benchmark test, timing the create,
+    write, read, rename, and remove cycle of a 4KB file in the current
+    directory.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
@@ -31,6 +31,7 @@ Module Name:
 
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 
@@ -41,6 +42,8 @@ Module Name:
 //
 
 #define PT_PIPE_IO_BUFFER_SIZE 4096
+#define PT_PIPE_IO_64K_BUFFER_SIZE (64 * 1024)
+#define PT_PIPE_IO_1M_BUFFER_SIZE (1024 * 1024)
 
 //
 // ------------------------------------------------------ Data Type Definitions
@@ -68,7 +71,7 @@ PipeIoMain (
 
 Routine Description:
 
-    This routine performs the pipe I/O performance benchmark test.
+    This routine performs the pipe I/O performance benchmark tests.
 
 Arguments:
 
@@ -87,6 +90,7 @@ Return Value:
 
     char *Buffer;
     ssize_t BytesCompleted;
+    size_t BufferSize;
     unsigned long long Iterations;
     int PipeCreated;
     int PipeDescriptors[2];
@@ -94,14 +98,28 @@ Return Value:
 
     Iterations = 0;
     PipeCreated = 0;
-    Result->Type = PtResultIterations;
+    Result->Type = Test->ResultType;
     Result->Status = 0;
+    switch (Test->TestType) {
+    case PtTestPipeIo64K:
+        BufferSize = PT_PIPE_IO_64K_BUFFER_SIZE;
+        break;
+
+    case PtTestPipeIo1M:
+        BufferSize = PT_PIPE_IO_1M_BUFFER_SIZE;
+        break;
+
+    case PtTestPipeIo:
+    default:
+        BufferSize = PT_PIPE_IO_BUFFER_SIZE;
+        break;
+    }
 
     //
     // Allocate a scratch buffer to use for reads and writes.
     //
 
-    Buffer = malloc(PT_PIPE_IO_BUFFER_SIZE);
+    Buffer = malloc(BufferSize);
     if (Buffer == NULL) {
         Result->Status = ENOMEM;
         goto MainEnd;
@@ -119,6 +137,34 @@ Return Value:
 
     PipeCreated = 1;
 
+    //
+    // Each write is read back before the next one, so the whole transfer
+    // needs to fit in the pipe.
+    //
+
+    if (BufferSize > PT_PIPE_IO_BUFFER_SIZE) {
+
+#ifdef F_SETPIPE_SZ
+
+        Status = fcntl(PipeDescriptors[1], F_SETPIPE_SZ, (int)BufferSize);
+        if (Status < (int)BufferSize) {
+            Result->Status = errno;
+            if (Status >= 0) {
+                Result->Status = ENOSPC;
+            }
+
+            goto MainEnd;
+        }
+
+#else
+
+        Result->Status = ENOSYS;
+        goto MainEnd;
+
+#endif
+
+    }
+
     //
     // Start the test. This snaps resource usage and starts the clock ticking.
     //
@@ -136,13 +182,11 @@ Return Value:
 
     while (PtIsTimedTestRunning() != 0) {
         do {
-            BytesCompleted = write(PipeDescriptors[1],
-                                   Buffer,
-                                   PT_PIPE_IO_BUFFER_SIZE);
+            BytesCompleted = write(PipeDescriptors[1], Buffer, BufferSize);
 
         } while ((BytesCompleted < 0) && (errno == EINTR));
 
-        if (BytesCompleted != PT_PIPE_IO_BUFFER_SIZE) {
+        if (BytesCompleted != BufferSize) {
             if (errno == 0) {
                 errno = EIO;
             }
@@ -152,13 +196,11 @@ Return Value:
         }
 
         do {
-            BytesCompleted = read(PipeDescriptors[0],
-                                  Buffer,
-                                  PT_PIPE_IO_BUFFER_SIZE);
+            BytesCompleted = read(PipeDescriptors[0], Buffer, BufferSize);
 
         } while ((BytesCompleted < 0) && (errno == EINTR));
 
-        if (BytesCompleted != PT_PIPE_IO_BUFFER_SIZE) {
+        if (BytesCompleted != BufferSize) {
             if (errno == 0) {
                 errno = EIO;
             }
@@ -185,7 +227,13 @@ Return Value:
         free(Buffer);
     }
 
-    Result->Data.Iterations = Iterations;
+    if (Result->Type == PtResultBytes) {
+        Result->Data.Bytes = Iterations * BufferSize;
+
+    } else {
+        Result->Data.Iterations = Iterations;
+    }
+
     return;
 }
 
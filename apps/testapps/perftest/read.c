@@ -14,7 +14,9 @@ Module Name:
 Abstract:
 
     This module implements the performance benchmark tests for the read() C
-    library routine.
+    library routine, both streaming through a small file and reading single
+    pages at random out of a large one. A threaded variant has several threads
+    reading at once, each through its own descriptor.
 
 Author:
 
@@ -32,8 +34,11 @@ Module Name:
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "perftest.h"
@@ -46,18 +51,77 @@ Module Name:
 #define PT_READ_TEST_FILE_SIZE (2 * 1024 * 1024)
 #define PT_READ_TEST_BUFFER_SIZE 4096
 
+//
+// The random read test uses a file big enough that finding a page in the cache
+// is not free, but small enough to stay cached.
+//
+
+#define PT_RANDOM_READ_TEST_FILE_SIZE (256 * 1024 * 1024)
+
+//
+// The threaded read test uses small reads so that the per-call overhead of
+// looking up the descriptor dominates over copying the data.
+//
+
+#define PT_THREADED_READ_TEST_READ_SIZE 64
+
+//
+// Define the number of additional threads reading in the threaded test.
+//
+
+#define PT_THREADED_READ_TEST_THREAD_COUNT 7
+
+//
+// The vectored read tests read a page into each vector. The vectors point at
+// every other page of their buffer so that the kernel can't merge neighbors
+// into a single fragment.
+//
+
+#define PT_READV_16_TEST_VECTOR_COUNT 16
+#define PT_READV_64_TEST_VECTOR_COUNT 64
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines the context handed to each threaded read thread.
+
+Members:
+
+    Path - Stores a pointer to the path of the file to open and read.
+
+    Bytes - Stores the number of bytes the thread read.
+
+    Status - Stores 0 on success or an error number on failure.
+
+--*/
+
+typedef struct _PT_READ_THREAD {
+    const char *Path;
+    unsigned long long Bytes;
+    int Status;
+} PT_READ_THREAD, *PPT_READ_THREAD;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+void *
+ReadStartRoutine (
+    void *Parameter
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
+pthread_mutex_t ReadReadyLock = PTHREAD_MUTEX_INITIALIZER;
+volatile int ReadReadyThreadCount;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -72,7 +136,7 @@ ReadMain (
 
 Routine Description:
 
-    This routine performs the read performance benchmark test.
+    This routine performs the read performance benchmark tests.
 
 Arguments:
 
@@ -95,27 +159,94 @@ Return Value:
     int FileCreated;
     int FileDescriptor;
     char FileName[PT_READ_TEST_FILE_NAME_LENGTH];
+    long FileSize;
     int Index;
+    off_t Offset;
+    long PageCount;
     pid_t ProcessId;
     int Status;
+    int ThreadCount;
+    PPT_READ_THREAD ThreadContexts;
+    int ThreadIndex;
+    pthread_t *Threads;
     unsigned long long TotalBytes;
+    ssize_t TransferSize;
+    char *VectorBuffer;
+    int VectorCount;
+    struct iovec *Vectors;
 
     FileCreated = 0;
     FileDescriptor = -1;
+    ThreadContexts = NULL;
+    ThreadIndex = 0;
+    Threads = NULL;
+    VectorBuffer = NULL;
+    Vectors = NULL;
     Result->Type = PtResultBytes;
     Result->Status = 0;
     TotalBytes = 0;
+    FileSize = PT_READ_TEST_FILE_SIZE;
+    if (Test->TestType == PtTestRandomRead) {
+        FileSize = PT_RANDOM_READ_TEST_FILE_SIZE;
+    }
+
+    PageCount = FileSize / PT_READ_TEST_BUFFER_SIZE;
+    VectorCount = 0;
+    if (Test->TestType == PtTestReadv16) {
+        VectorCount = PT_READV_16_TEST_VECTOR_COUNT;
+
+    } else if (Test->TestType == PtTestReadv64) {
+        VectorCount = PT_READV_64_TEST_VECTOR_COUNT;
+    }
+
+    TransferSize = PT_READ_TEST_BUFFER_SIZE;
 
     //
-    // Allocate a buffer for the reads.
+    // Allocate a buffer for the reads. Direct I/O wants it aligned, so align
+    // it for every variant to keep the comparison fair.
     //
 
-    Buffer = malloc(PT_READ_TEST_BUFFER_SIZE);
-    if (Buffer == NULL) {
-        Result->Status = ENOMEM;
+    Status = posix_memalign((void **)&Buffer,
+                            PT_READ_TEST_BUFFER_SIZE,
+                            PT_READ_TEST_BUFFER_SIZE);
+
+    if (Status != 0) {
+        Buffer = NULL;
+        Result->Status = Status;
         goto MainEnd;
     }
 
+    //
+    // The vectored variants read a page into every other page of a buffer
+    // twice the size of the transfer.
+    //
+
+    if (VectorCount != 0) {
+        TransferSize = VectorCount * PT_READ_TEST_BUFFER_SIZE;
+        Status = posix_memalign((void **)&VectorBuffer,
+                                PT_READ_TEST_BUFFER_SIZE,
+                                TransferSize * 2);
+
+        if (Status != 0) {
+            VectorBuffer = NULL;
+            Result->Status = Status;
+            goto MainEnd;
+        }
+
+        Vectors = malloc(sizeof(struct iovec) * VectorCount);
+        if (Vectors == NULL) {
+            Result->Status = ENOMEM;
+            goto MainEnd;
+        }
+
+        for (Index = 0; Index < VectorCount; Index += 1) {
+            Vectors[Index].iov_base = VectorBuffer +
+                                      (Index * 2 * PT_READ_TEST_BUFFER_SIZE);
+
+            Vectors[Index].iov_len = PT_READ_TEST_BUFFER_SIZE;
+        }
+    }
+
     //
     // Get the process ID and create a process safe file path.
     //
@@ -154,9 +285,7 @@ Return Value:
     // various implementations of fruncate() file extension.
     //
 
-    for (Index = 0;
-         Index < (PT_READ_TEST_FILE_SIZE / PT_READ_TEST_BUFFER_SIZE);
-         Index += 1) {
+    for (Index = 0; Index < PageCount; Index += 1) {
 
         do {
             BytesWritten = write(FileDescriptor,
@@ -186,6 +315,66 @@ Return Value:
         goto MainEnd;
     }
 
+    //
+    // The direct variant switches the descriptor over to O_DIRECT now that the
+    // file exists, so every timed read goes straight to the disk.
+    //
+
+    if (Test->TestType == PtTestDirectRead) {
+        Status = fcntl(FileDescriptor, F_GETFL);
+        if ((Status < 0) ||
+            (fcntl(FileDescriptor, F_SETFL, Status | O_DIRECT) != 0)) {
+
+            Result->Status = errno;
+            goto MainEnd;
+        }
+    }
+
+    //
+    // The threaded variant fires up the other threads, which each open their
+    // own descriptor to the file.
+    //
+
+    if (Test->TestType == PtTestThreadedRead) {
+        ThreadCount = PT_THREADED_READ_TEST_THREAD_COUNT;
+        Threads = malloc(sizeof(pthread_t) * ThreadCount);
+        ThreadContexts = malloc(sizeof(PT_READ_THREAD) *
+                                PT_THREADED_READ_TEST_THREAD_COUNT);
+
+        if ((Threads == NULL) || (ThreadContexts == NULL)) {
+            Result->Status = ENOMEM;
+            goto MainEnd;
+        }
+
+        memset(ThreadContexts,
+               0,
+               sizeof(PT_READ_THREAD) * PT_THREADED_READ_TEST_THREAD_COUNT);
+
+        for (ThreadIndex = 0;
+             ThreadIndex < PT_THREADED_READ_TEST_THREAD_COUNT;
+             ThreadIndex += 1) {
+
+            ThreadContexts[ThreadIndex].Path = FileName;
+            Status = pthread_create(&(Threads[ThreadIndex]),
+                                    NULL,
+                                    ReadStartRoutine,
+                                    &(ThreadContexts[ThreadIndex]));
+
+            if (Status != 0) {
+                Result->Status = Status;
+                goto MainEnd;
+            }
+        }
+
+        //
+        // Wait until all threads are spun up.
+        //
+
+        while (ReadReadyThreadCount != PT_THREADED_READ_TEST_THREAD_COUNT) {
+            sleep(1);
+        }
+    }
+
     //
     // Start the test. This snaps resource usage and starts the clock ticking.
     //
@@ -201,23 +390,80 @@ Return Value:
     // number of bytes that can be read in.
     //
 
+    srand(ProcessId);
     while (PtIsTimedTestRunning() != 0) {
-        do {
-            BytesRead = read(FileDescriptor, Buffer, PT_READ_TEST_BUFFER_SIZE);
 
-        } while ((BytesRead < 0) && (errno == EINTR));
+        //
+        // The random variant picks a page anywhere in the file for every
+        // read.
+        //
+
+        if (Test->TestType == PtTestRandomRead) {
+            Offset = PtGetRandomIndex(PageCount);
+            Offset *= PT_READ_TEST_BUFFER_SIZE;
+            do {
+                BytesRead = pread(FileDescriptor,
+                                  Buffer,
+                                  PT_READ_TEST_BUFFER_SIZE,
+                                  Offset);
+
+            } while ((BytesRead < 0) && (errno == EINTR));
+
+        } else if (Test->TestType == PtTestThreadedRead) {
+            do {
+                BytesRead = pread(FileDescriptor,
+                                  Buffer,
+                                  PT_THREADED_READ_TEST_READ_SIZE,
+                                  0);
+
+            } while ((BytesRead < 0) && (errno == EINTR));
+
+        } else if (VectorCount != 0) {
+            do {
+                BytesRead = readv(FileDescriptor, Vectors, VectorCount);
+
+            } while ((BytesRead < 0) && (errno == EINTR));
+
+        } else {
+            do {
+                BytesRead = read(FileDescriptor,
+                                 Buffer,
+                                 PT_READ_TEST_BUFFER_SIZE);
+
+            } while ((BytesRead < 0) && (errno == EINTR));
+        }
 
         if (BytesRead < 0) {
             Result->Status = errno;
             break;
         }
 
+        if (Test->TestType == PtTestRandomRead) {
+            if (BytesRead != PT_READ_TEST_BUFFER_SIZE) {
+                Result->Status = EIO;
+                break;
+            }
+
+            TotalBytes += (unsigned long long)BytesRead;
+            continue;
+        }
+
+        if (Test->TestType == PtTestThreadedRead) {
+            if (BytesRead != PT_THREADED_READ_TEST_READ_SIZE) {
+                Result->Status = EIO;
+                break;
+            }
+
+            TotalBytes += (unsigned long long)BytesRead;
+            continue;
+        }
+
         //
         // If the bytes read did not fill the entire buffer, then the end of
         // the file was likely reached. Seek back to the beginning.
         //
 
-        if (BytesRead != PT_READ_TEST_BUFFER_SIZE) {
+        if (BytesRead != TransferSize) {
             Status = lseek(FileDescriptor, 0, SEEK_SET);
             if (Status != 0) {
                 if (Status < 0) {
@@ -240,6 +486,35 @@ Return Value:
     }
 
 MainEnd:
+
+    //
+    // Wait for the other threads to notice the test is over and add up their
+    // work. If something failed before the test started, cancel them.
+    //
+
+    if (Threads != NULL) {
+        ThreadCount = ThreadIndex;
+        for (ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex += 1) {
+            if (Result->Status != 0) {
+                pthread_cancel(Threads[ThreadIndex]);
+            }
+
+            pthread_join(Threads[ThreadIndex], NULL);
+            TotalBytes += ThreadContexts[ThreadIndex].Bytes;
+            if ((Result->Status == 0) &&
+                (ThreadContexts[ThreadIndex].Status != 0)) {
+
+                Result->Status = ThreadContexts[ThreadIndex].Status;
+            }
+        }
+
+        free(Threads);
+    }
+
+    if (ThreadContexts != NULL) {
+        free(ThreadContexts);
+    }
+
     if (FileCreated != 0) {
         close(FileDescriptor);
         remove(FileName);
@@ -249,6 +524,14 @@ Return Value:
         free(Buffer);
     }
 
+    if (Vectors != NULL) {
+        free(Vectors);
+    }
+
+    if (VectorBuffer != NULL) {
+        free(VectorBuffer);
+    }
+
     Result->Data.Bytes = TotalBytes;
     return;
 }
@@ -257,3 +540,82 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+void *
+ReadStartRoutine (
+    void *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the start routine for a threaded read test
+    thread. It opens its own descriptor to the file, waits for the test to
+    start, and then reads from the file until the test ends.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the thread's context.
+
+Return Value:
+
+    Returns the NULL pointer.
+
+--*/
+
+{
+
+    char Buffer[PT_THREADED_READ_TEST_READ_SIZE];
+    ssize_t BytesRead;
+    PPT_READ_THREAD Context;
+    int FileDescriptor;
+
+    Context = (PPT_READ_THREAD)Parameter;
+    FileDescriptor = open(Context->Path, O_RDONLY);
+    if (FileDescriptor < 0) {
+        Context->Status = errno;
+    }
+
+    //
+    // Announce that the thread is ready.
+    //
+
+    pthread_mutex_lock(&ReadReadyLock);
+    ReadReadyThreadCount += 1;
+    pthread_mutex_unlock(&ReadReadyLock);
+    if (FileDescriptor < 0) {
+        return NULL;
+    }
+
+    //
+    // Busy spin waiting for the test to start.
+    //
+
+    while (PtIsTimedTestRunning() == 0) {
+        pthread_testcancel();
+    }
+
+    //
+    // Loop running the test.
+    //
+
+    while (PtIsTimedTestRunning() != 0) {
+        do {
+            BytesRead = pread(FileDescriptor,
+                              Buffer,
+                              PT_THREADED_READ_TEST_READ_SIZE,
+                              0);
+
+        } while ((BytesRead < 0) && (errno == EINTR));
+
+        if (BytesRead != PT_THREADED_READ_TEST_READ_SIZE) {
+            Context->Status = (BytesRead < 0) ? errno : EIO;
+            break;
+        }
+
+        Context->Bytes += (unsigned long long)BytesRead;
+    }
+
+    close(FileDescriptor);
+    return NULL;
+}
@@ -0,0 +1,443 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    sendfile.c
+
+Abstract:
+
+    This module implements the performance benchmark tests for serving a file
+    over a loopback TCP connection, comparing read() and write() against
+    sendfile().
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "perftest.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define PT_SEND_FILE_NAME_LENGTH 48
+#define PT_SEND_FILE_SIZE (1024LL * 1024 * 1024)
+#define PT_SEND_FILE_BUFFER_SIZE (64 * 1024)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+int
+SendFileConnect (
+    int *Sender,
+    pid_t *Receiver
+    );
+
+void
+SendFileReceive (
+    int Socket
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+void
+SendFileMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the file-to-socket transfer performance benchmark
+    tests, comparing read() and write() against sendfile().
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    char *Buffer;
+    ssize_t BytesRead;
+    ssize_t BytesWritten;
+    int FileCreated;
+    int FileDescriptor;
+    char FileName[PT_SEND_FILE_NAME_LENGTH];
+    off_t Offset;
+    pid_t ProcessId;
+    pid_t Receiver;
+    int Sender;
+    int Status;
+    unsigned long long TotalBytes;
+
+    Buffer = NULL;
+    FileCreated = 0;
+    FileDescriptor = -1;
+    Receiver = -1;
+    Sender = -1;
+    Result->Type = PtResultBytes;
+    Result->Status = 0;
+    TotalBytes = 0;
+
+    //
+    // Ignore SIGPIPE so that a dying receiver shows up as an error.
+    //
+
+    signal(SIGPIPE, SIG_IGN);
+    if (Test->TestType == PtTestSocketReadWrite) {
+        Buffer = malloc(PT_SEND_FILE_BUFFER_SIZE);
+        if (Buffer == NULL) {
+            Result->Status = ENOMEM;
+            goto MainEnd;
+        }
+    }
+
+    //
+    // Create the file. Writing the last byte is enough to size it; the rest
+    // reads back as zeros through the page cache just the same.
+    //
+
+    ProcessId = getpid();
+    Status = snprintf(FileName,
+                      PT_SEND_FILE_NAME_LENGTH,
+                      "sendfile_%d.txt",
+                      ProcessId);
+
+    if (Status < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    FileDescriptor = open(FileName,
+                          O_RDWR | O_CREAT | O_TRUNC,
+                          S_IRUSR | S_IWUSR);
+
+    if (FileDescriptor < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    FileCreated = 1;
+    if ((lseek(FileDescriptor, PT_SEND_FILE_SIZE - 1, SEEK_SET) < 0) ||
+        (write(FileDescriptor, "", 1) != 1) ||
+        (lseek(FileDescriptor, 0, SEEK_SET) != 0)) {
+
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    Status = SendFileConnect(&Sender, &Receiver);
+    if (Status != 0) {
+        Result->Status = Status;
+        goto MainEnd;
+    }
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    //
+    // Push the file through the socket over and over, starting back at the
+    // beginning each time the end is reached.
+    //
+
+    Offset = 0;
+    while (PtIsTimedTestRunning() != 0) {
+        if (Test->TestType == PtTestSendFile) {
+            BytesWritten = sendfile(Sender,
+                                    FileDescriptor,
+                                    &Offset,
+                                    PT_SEND_FILE_BUFFER_SIZE);
+
+            if (BytesWritten < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                Result->Status = errno;
+                break;
+            }
+
+            if (BytesWritten == 0) {
+                Offset = 0;
+            }
+
+        } else {
+            do {
+                BytesRead = read(FileDescriptor,
+                                 Buffer,
+                                 PT_SEND_FILE_BUFFER_SIZE);
+
+            } while ((BytesRead < 0) && (errno == EINTR));
+
+            if (BytesRead < 0) {
+                Result->Status = errno;
+                break;
+            }
+
+            if (BytesRead == 0) {
+                if (lseek(FileDescriptor, 0, SEEK_SET) != 0) {
+                    Result->Status = errno;
+                    break;
+                }
+
+                continue;
+            }
+
+            do {
+                BytesWritten = write(Sender, Buffer, BytesRead);
+
+            } while ((BytesWritten < 0) && (errno == EINTR));
+
+            if (BytesWritten != BytesRead) {
+                if (BytesWritten >= 0) {
+                    errno = EIO;
+                }
+
+                Result->Status = errno;
+                break;
+            }
+        }
+
+        TotalBytes += (unsigned long long)BytesWritten;
+    }
+
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+MainEnd:
+    if (Sender >= 0) {
+        close(Sender);
+    }
+
+    if (Receiver > 0) {
+        waitpid(Receiver, NULL, 0);
+    }
+
+    if (FileCreated != 0) {
+        close(FileDescriptor);
+        remove(FileName);
+    }
+
+    if (Buffer != NULL) {
+        free(Buffer);
+    }
+
+    Result->Data.Bytes = TotalBytes;
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+int
+SendFileConnect (
+    int *Sender,
+    pid_t *Receiver
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a loopback TCP connection and forks a child process
+    to drain the receiving end.
+
+Arguments:
+
+    Sender - Supplies a pointer where the sending socket will be returned.
+
+    Receiver - Supplies a pointer where the process ID of the child draining
+        the connection will be returned.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    struct sockaddr_in Address;
+    socklen_t AddressLength;
+    pid_t Child;
+    int Error;
+    int Listener;
+    int Socket;
+
+    Socket = -1;
+    Listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (Listener < 0) {
+        return errno;
+    }
+
+    memset(&Address, 0, sizeof(Address));
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    AddressLength = sizeof(Address);
+    if ((bind(Listener, (struct sockaddr *)&Address, AddressLength) != 0) ||
+        (listen(Listener, 1) != 0) ||
+        (getsockname(Listener,
+                     (struct sockaddr *)&Address,
+                     &AddressLength) != 0)) {
+
+        Error = errno;
+        goto ConnectEnd;
+    }
+
+    Socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (Socket < 0) {
+        Error = errno;
+        goto ConnectEnd;
+    }
+
+    if (connect(Socket, (struct sockaddr *)&Address, AddressLength) != 0) {
+        Error = errno;
+        goto ConnectEnd;
+    }
+
+    Child = fork();
+    if (Child < 0) {
+        Error = errno;
+        goto ConnectEnd;
+    }
+
+    //
+    // The child accepts the connection and reads until the sender closes
+    // its end.
+    //
+
+    if (Child == 0) {
+        close(Socket);
+        Socket = accept(Listener, NULL, NULL);
+        close(Listener);
+        if (Socket >= 0) {
+            SendFileReceive(Socket);
+        }
+
+        _exit(0);
+    }
+
+    *Receiver = Child;
+    *Sender = Socket;
+    Socket = -1;
+    Error = 0;
+
+ConnectEnd:
+    if (Socket >= 0) {
+        close(Socket);
+    }
+
+    close(Listener);
+    return Error;
+}
+
+void
+SendFileReceive (
+    int Socket
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads and discards everything sent over the given socket.
+
+Arguments:
+
+    Socket - Supplies the socket to drain. This routine closes it.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    char *Buffer;
+    ssize_t BytesRead;
+
+    Buffer = malloc(PT_SEND_FILE_BUFFER_SIZE);
+    if (Buffer != NULL) {
+        while (1) {
+            BytesRead = read(Socket, Buffer, PT_SEND_FILE_BUFFER_SIZE);
+            if (BytesRead == 0) {
+                break;
+            }
+
+            if ((BytesRead < 0) && (errno != EINTR)) {
+                break;
+            }
+        }
+
+        free(Buffer);
+    }
+
+    close(Socket);
+    return;
+}
+
@@ -0,0 +1,198 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    smallfile.c
+
+Abstract:
+
+    This module implements the performance benchmark test for the life cycle
+    of a small file: create, write, read back, rename, and unlink. Run it in a
+    directory on the file system being measured (for example /tmp, or a FAT
+    formatted ramdisk).
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "perftest.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define PT_SMALL_FILE_NAME_LENGTH 48
+#define PT_SMALL_FILE_SIZE 4096
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+void
+SmallFileMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the small file benchmark test. It counts how many
+    times a 4KB file can be created, written, read back, renamed, and
+    removed.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    char Buffer[PT_SMALL_FILE_SIZE];
+    ssize_t BytesDone;
+    int File;
+    char FileName[PT_SMALL_FILE_NAME_LENGTH];
+    unsigned long long Iterations;
+    char NewFileName[PT_SMALL_FILE_NAME_LENGTH];
+    pid_t ProcessId;
+    int Status;
+
+    File = -1;
+    Iterations = 0;
+    Result->Type = PtResultIterations;
+    Result->Status = 0;
+    ProcessId = getpid();
+    if ((snprintf(FileName,
+                  PT_SMALL_FILE_NAME_LENGTH,
+                  "small_file_%d.txt",
+                  ProcessId) < 0) ||
+        (snprintf(NewFileName,
+                  PT_SMALL_FILE_NAME_LENGTH,
+                  "small_file_%d.new",
+                  ProcessId) < 0)) {
+
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    memset(Buffer, 'S', PT_SMALL_FILE_SIZE);
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    while (PtIsTimedTestRunning() != 0) {
+        File = open(FileName,
+                    O_RDWR | O_CREAT | O_TRUNC,
+                    S_IRUSR | S_IWUSR);
+
+        if (File < 0) {
+            Result->Status = errno;
+            break;
+        }
+
+        BytesDone = write(File, Buffer, PT_SMALL_FILE_SIZE);
+        if (BytesDone != PT_SMALL_FILE_SIZE) {
+            Result->Status = (BytesDone < 0) ? errno : EIO;
+            break;
+        }
+
+        BytesDone = pread(File, Buffer, PT_SMALL_FILE_SIZE, 0);
+        if (BytesDone != PT_SMALL_FILE_SIZE) {
+            Result->Status = (BytesDone < 0) ? errno : EIO;
+            break;
+        }
+
+        Status = close(File);
+        File = -1;
+        if (Status != 0) {
+            Result->Status = errno;
+            break;
+        }
+
+        Status = rename(FileName, NewFileName);
+        if (Status != 0) {
+            Result->Status = errno;
+            break;
+        }
+
+        Status = remove(NewFileName);
+        if (Status != 0) {
+            Result->Status = errno;
+            break;
+        }
+
+        Iterations += 1;
+    }
+
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+MainEnd:
+    if (File >= 0) {
+        close(File);
+    }
+
+    remove(FileName);
+    remove(NewFileName);
+    Result->Data.Iterations = Iterations;
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
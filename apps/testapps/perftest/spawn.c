@@ -0,0 +1,202 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    spawn.c
+
+Abstract:
+
+    This module implements the performance benchmark tests for the vfork()
+    and posix_spawn() C library calls.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <errno.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "perftest.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the size of the heap the parent allocates and touches before running
+// the large heap spawn test.
+//
+
+#define SPAWN_LARGE_HEAP_SIZE (1024 * 1024 * 1024)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+void
+SpawnMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the vfork and spawn performance benchmark tests.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    char *Arguments[SPAWN_CHILD_ARGUMENT_COUNT + 1];
+    pid_t Child;
+    void *Heap;
+    unsigned long long Iterations;
+    int Status;
+
+    Heap = NULL;
+    Iterations = 0;
+    Result->Type = PtResultIterations;
+    Result->Status = 0;
+    Arguments[0] = PtProgramPath;
+    Arguments[1] = SPAWN_TEST_NAME;
+    Arguments[SPAWN_CHILD_ARGUMENT_COUNT] = NULL;
+
+    //
+    // Give the parent a large, fully resident heap so that any per-page work
+    // done when creating the child shows up in the results.
+    //
+
+    if (Test->TestType == PtTestSpawnLargeHeap) {
+        Heap = malloc(SPAWN_LARGE_HEAP_SIZE);
+        if (Heap == NULL) {
+            Result->Status = ENOMEM;
+            goto MainEnd;
+        }
+
+        memset(Heap, 1, SPAWN_LARGE_HEAP_SIZE);
+    }
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    //
+    // Measure how many children can be created and waited on during the
+    // given duration. The vfork children exit immediately, and the spawned
+    // children re-execute this application, which exits immediately.
+    //
+
+    while (PtIsTimedTestRunning() != 0) {
+        if (Test->TestType == PtTestVfork) {
+            Child = vfork();
+            if (Child == 0) {
+                _exit(0);
+            }
+
+            if (Child < 0) {
+                Result->Status = errno;
+                break;
+            }
+
+        } else {
+            Status = posix_spawn(&Child,
+                                 PtProgramPath,
+                                 NULL,
+                                 NULL,
+                                 Arguments,
+                                 NULL);
+
+            if (Status != 0) {
+                Result->Status = Status;
+                break;
+            }
+        }
+
+        Child = waitpid(Child, &Status, 0);
+        if (Child == -1) {
+            if (PtIsTimedTestRunning() == 0) {
+                break;
+            }
+
+            Result->Status = errno;
+            break;
+        }
+
+        if (Status != 0) {
+            Result->Status = WEXITSTATUS(Status);
+            break;
+        }
+
+        Iterations += 1;
+    }
+
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+MainEnd:
+    if (Heap != NULL) {
+        free(Heap);
+    }
+
+    Result->Data.Iterations = Iterations;
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
@@ -35,6 +35,7 @@ Module Name:
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "perftest.h"
@@ -47,6 +48,15 @@ Module Name:
 #define PT_WRITE_TEST_FILE_SIZE (2 * 1024 * 1024)
 #define PT_WRITE_TEST_BUFFER_SIZE 4096
 
+//
+// The vectored write tests write a page from each vector. The vectors point at
+// every other page of their buffer so that the kernel can't merge neighbors
+// into a single fragment.
+//
+
+#define PT_WRITEV_16_TEST_VECTOR_COUNT 16
+#define PT_WRITEV_64_TEST_VECTOR_COUNT 64
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -99,23 +109,74 @@ Return Value:
     pid_t ProcessId;
     int Status;
     unsigned long long TotalBytes;
+    ssize_t TransferSize;
+    char *VectorBuffer;
+    int VectorCount;
+    struct iovec *Vectors;
 
     FileCreated = 0;
     FileDescriptor = -1;
+    VectorBuffer = NULL;
+    Vectors = NULL;
     Result->Type = PtResultBytes;
     Result->Status = 0;
     TotalBytes = 0;
+    VectorCount = 0;
+    if (Test->TestType == PtTestWritev16) {
+        VectorCount = PT_WRITEV_16_TEST_VECTOR_COUNT;
+
+    } else if (Test->TestType == PtTestWritev64) {
+        VectorCount = PT_WRITEV_64_TEST_VECTOR_COUNT;
+    }
+
+    TransferSize = PT_WRITE_TEST_BUFFER_SIZE;
 
     //
-    // Allocate a buffer for the writes.
+    // Allocate a buffer for the writes. Direct I/O wants it aligned, so align
+    // it for every variant to keep the comparison fair.
     //
 
-    Buffer = malloc(PT_WRITE_TEST_BUFFER_SIZE);
-    if (Buffer == NULL) {
-        Result->Status = ENOMEM;
+    Status = posix_memalign((void **)&Buffer,
+                            PT_WRITE_TEST_BUFFER_SIZE,
+                            PT_WRITE_TEST_BUFFER_SIZE);
+
+    if (Status != 0) {
+        Buffer = NULL;
+        Result->Status = Status;
         goto MainEnd;
     }
 
+    //
+    // The vectored variants write a page from every other page of a buffer
+    // twice the size of the transfer.
+    //
+
+    if (VectorCount != 0) {
+        TransferSize = VectorCount * PT_WRITE_TEST_BUFFER_SIZE;
+        Status = posix_memalign((void **)&VectorBuffer,
+                                PT_WRITE_TEST_BUFFER_SIZE,
+                                TransferSize * 2);
+
+        if (Status != 0) {
+            VectorBuffer = NULL;
+            Result->Status = Status;
+            goto MainEnd;
+        }
+
+        Vectors = malloc(sizeof(struct iovec) * VectorCount);
+        if (Vectors == NULL) {
+            Result->Status = ENOMEM;
+            goto MainEnd;
+        }
+
+        for (Index = 0; Index < VectorCount; Index += 1) {
+            Vectors[Index].iov_base = VectorBuffer +
+                                      (Index * 2 * PT_WRITE_TEST_BUFFER_SIZE);
+
+            Vectors[Index].iov_len = PT_WRITE_TEST_BUFFER_SIZE;
+        }
+    }
+
     //
     // Get the process ID and create a process safe file path.
     //
@@ -181,6 +242,21 @@ Return Value:
         goto MainEnd;
     }
 
+    //
+    // The direct variant switches the descriptor over to O_DIRECT now that the
+    // file exists, so every timed write goes straight to the disk.
+    //
+
+    if (Test->TestType == PtTestDirectWrite) {
+        Status = fcntl(FileDescriptor, F_GETFL);
+        if ((Status < 0) ||
+            (fcntl(FileDescriptor, F_SETFL, Status | O_DIRECT) != 0)) {
+
+            Result->Status = errno;
+            goto MainEnd;
+        }
+    }
+
     //
     // Start the test. This snaps resource usage and starts the clock ticking.
     //
@@ -198,26 +274,35 @@ Return Value:
 
     Index = 0;
     while (PtIsTimedTestRunning() != 0) {
-        do {
-            BytesWritten = write(FileDescriptor,
-                                 Buffer,
-                                 PT_WRITE_TEST_BUFFER_SIZE);
+        if (VectorCount != 0) {
+            do {
+                BytesWritten = writev(FileDescriptor, Vectors, VectorCount);
 
-        } while ((BytesWritten < 0) && (errno == EINTR));
+            } while ((BytesWritten < 0) && (errno == EINTR));
+
+        } else {
+            do {
+                BytesWritten = write(FileDescriptor,
+                                     Buffer,
+                                     PT_WRITE_TEST_BUFFER_SIZE);
+
+            } while ((BytesWritten < 0) && (errno == EINTR));
+        }
 
         if (BytesWritten < 0) {
             Result->Status = errno;
             break;
         }
 
-        if (BytesWritten != PT_WRITE_TEST_BUFFER_SIZE) {
+        if (BytesWritten != TransferSize) {
             Result->Status = EIO;
             break;
         }
 
         TotalBytes += (unsigned long long)BytesWritten;
-        Index += 1;
+        Index += TransferSize / PT_WRITE_TEST_BUFFER_SIZE;
         if (Index >= (PT_WRITE_TEST_FILE_SIZE / PT_WRITE_TEST_BUFFER_SIZE)) {
+            Index = 0;
             Status = lseek(FileDescriptor, 0, SEEK_SET);
             if (Status != 0) {
                 if (Status < 0) {
@@ -247,6 +332,14 @@ Return Value:
         free(Buffer);
     }
 
+    if (Vectors != NULL) {
+        free(Vectors);
+    }
+
+    if (VectorBuffer != NULL) {
+        free(VectorBuffer);
+    }
+
     Result->Data.Bytes = TotalBytes;
     return;
 }
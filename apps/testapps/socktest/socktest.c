@@ -36,14 +36,55 @@ Module Name:
 #include <errno.h>
 #include <netinet/in.h>
 #include <stdio.h>
+#include <poll.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 //
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// Define the default parameters for the event poll scaling test.
+//
+
+#define EVENT_POLL_TEST_IDLE_COUNT 10000
+#define EVENT_POLL_TEST_ACTIVE_COUNT 100
+#define EVENT_POLL_TEST_ROUND_COUNT 1000
+
+//
+// Define the number of events harvested per call to epoll_wait.
+//
+
+#define EVENT_POLL_TEST_BATCH_SIZE 64
+
+//
+// Define the default parameters for the local socket benchmarks. The message
+// size is representative of small RPC requests.
+//
+
+#define UNIX_SOCKET_TEST_MESSAGE_SIZE 64
+#define UNIX_SOCKET_TEST_ROUND_COUNT 100000
+#define UNIX_SOCKET_TEST_MESSAGE_COUNT 500000
+
+//
+// Define the number of datagrams passed to each sendmmsg and recvmmsg call.
+//
+
+#define UNIX_SOCKET_TEST_BATCH_SIZE 32
+
+//
+// Define the size of the buffer the stream receiver reads into.
+//
+
+#define UNIX_SOCKET_TEST_STREAM_BUFFER_SIZE 0x10000
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -58,6 +99,69 @@ TestTransmitThroughput (
     ULONG ChunkCount
     );
 
+ULONG
+TestEventPollScaling (
+    ULONG IdleCount,
+    ULONG ActiveCount,
+    ULONG RoundCount
+    );
+
+ULONG
+TestEventPollRounds (
+    int *Sockets,
+    ULONG SocketCount,
+    ULONG ActiveCount,
+    ULONG RoundCount,
+    int EventPoll,
+    struct pollfd *PollDescriptors
+    );
+
+ULONG
+TestUnixSocketPerformance (
+    ULONG MessageSize,
+    ULONG RoundCount,
+    ULONG MessageCount
+    );
+
+ULONG
+TestUnixSocketLatency (
+    ULONG MessageSize,
+    ULONG RoundCount
+    );
+
+ULONG
+TestUnixSocketThroughput (
+    int Type,
+    ULONG MessageSize,
+    ULONG MessageCount
+    );
+
+int
+TestUnixSocketReceiveAll (
+    int Type,
+    int Socket,
+    ULONG MessageSize,
+    ULONG MessageCount
+    );
+
+int
+TestUnixSocketTransfer (
+    int Socket,
+    PVOID Buffer,
+    ULONG Size,
+    BOOL Write
+    );
+
+ULONG
+TestWaitForChild (
+    pid_t Child
+    );
+
+double
+TestGetElapsedMicroseconds (
+    struct timespec *Start
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -76,7 +180,10 @@ main (
 
 Routine Description:
 
-    This routine implements the socket test program.
+    This routine implements the socket test program. With no arguments, it
+    runs the transmit throughput test. With an argument of "epoll", it runs
+    the event poll scaling benchmark. With an argument of "unix", it runs the
+    local socket latency and throughput benchmarks.
 
 Arguments:
 
@@ -95,6 +202,18 @@ Return Value:
 
 {
 
+    if ((ArgumentCount > 1) && (strcmp(Arguments[1], "epoll") == 0)) {
+        return TestEventPollScaling(EVENT_POLL_TEST_IDLE_COUNT,
+                                    EVENT_POLL_TEST_ACTIVE_COUNT,
+                                    EVENT_POLL_TEST_ROUND_COUNT);
+    }
+
+    if ((ArgumentCount > 1) && (strcmp(Arguments[1], "unix") == 0)) {
+        return TestUnixSocketPerformance(UNIX_SOCKET_TEST_MESSAGE_SIZE,
+                                         UNIX_SOCKET_TEST_ROUND_COUNT,
+                                         UNIX_SOCKET_TEST_MESSAGE_COUNT);
+    }
+
     return TestTransmitThroughput(64 * 1024, 16);
 }
 
@@ -233,3 +352,920 @@ Return Value:
     return Errors;
 }
 
+ULONG
+TestEventPollScaling (
+    ULONG IdleCount,
+    ULONG ActiveCount,
+    ULONG RoundCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine measures the cost of waiting on a large number of mostly idle
+    connections. It creates the given number of local socket pairs, registers
+    the read side of each with both an event poll set and a poll array, and
+    then times rounds where only the active connections receive data.
+
+Arguments:
+
+    IdleCount - Supplies the number of connections that never see traffic.
+
+    ActiveCount - Supplies the number of connections that receive a byte each
+        round.
+
+    RoundCount - Supplies the number of rounds to time for each mechanism.
+
+Return Value:
+
+    Returns the number of failures that occurred in the test.
+
+--*/
+
+{
+
+    ULONG ConnectionCount;
+    ULONG Errors;
+    struct epoll_event Event;
+    int EventPoll;
+    ULONG Index;
+    struct rlimit Limit;
+    struct pollfd *PollDescriptors;
+    int Result;
+    int *Sockets;
+
+    ConnectionCount = IdleCount + ActiveCount;
+    Errors = 0;
+    EventPoll = -1;
+    PollDescriptors = NULL;
+    Sockets = NULL;
+
+    //
+    // Make sure there are enough descriptors for both sides of every pair.
+    //
+
+    Result = getrlimit(RLIMIT_NOFILE, &Limit);
+    if (Result == 0) {
+        if (Limit.rlim_cur < (ConnectionCount * 2) + 16) {
+            Limit.rlim_cur = (ConnectionCount * 2) + 16;
+            if (Limit.rlim_max < Limit.rlim_cur) {
+                Limit.rlim_max = Limit.rlim_cur;
+            }
+
+            setrlimit(RLIMIT_NOFILE, &Limit);
+        }
+    }
+
+    Sockets = malloc(sizeof(int) * 2 * ConnectionCount);
+    PollDescriptors = malloc(sizeof(struct pollfd) * ConnectionCount);
+    if ((Sockets == NULL) || (PollDescriptors == NULL)) {
+        printf("Failed to allocate socket arrays.\n");
+        Errors += 1;
+        goto TestEventPollScalingEnd;
+    }
+
+    for (Index = 0; Index < ConnectionCount * 2; Index += 1) {
+        Sockets[Index] = -1;
+    }
+
+    EventPoll = epoll_create1(EPOLL_CLOEXEC);
+    if (EventPoll < 0) {
+        printf("epoll_create1() failed. Errno = %d.\n", errno);
+        Errors += 1;
+        goto TestEventPollScalingEnd;
+    }
+
+    //
+    // Create the connections. The active connections are placed at the end.
+    //
+
+    for (Index = 0; Index < ConnectionCount; Index += 1) {
+        Result = socketpair(AF_UNIX, SOCK_STREAM, 0, &(Sockets[Index * 2]));
+        if (Result != 0) {
+            printf("socketpair() %d failed. Errno = %d.\n", Index, errno);
+            Errors += 1;
+            goto TestEventPollScalingEnd;
+        }
+
+        memset(&Event, 0, sizeof(Event));
+        Event.events = EPOLLIN;
+        Event.data.u32 = Index;
+        Result = epoll_ctl(EventPoll,
+                           EPOLL_CTL_ADD,
+                           Sockets[Index * 2],
+                           &Event);
+
+        if (Result != 0) {
+            printf("epoll_ctl() %d failed. Errno = %d.\n", Index, errno);
+            Errors += 1;
+            goto TestEventPollScalingEnd;
+        }
+
+        PollDescriptors[Index].fd = Sockets[Index * 2];
+        PollDescriptors[Index].events = POLLIN;
+        PollDescriptors[Index].revents = 0;
+    }
+
+    printf("Created %d connections, %d active.\n",
+           ConnectionCount,
+           ActiveCount);
+
+    Errors += TestEventPollRounds(Sockets,
+                                  ConnectionCount,
+                                  ActiveCount,
+                                  RoundCount,
+                                  EventPoll,
+                                  NULL);
+
+    Errors += TestEventPollRounds(Sockets,
+                                  ConnectionCount,
+                                  ActiveCount,
+                                  RoundCount,
+                                  -1,
+                                  PollDescriptors);
+
+TestEventPollScalingEnd:
+    if (Sockets != NULL) {
+        for (Index = 0; Index < ConnectionCount * 2; Index += 1) {
+            if (Sockets[Index] >= 0) {
+                close(Sockets[Index]);
+            }
+        }
+
+        free(Sockets);
+    }
+
+    if (PollDescriptors != NULL) {
+        free(PollDescriptors);
+    }
+
+    if (EventPoll >= 0) {
+        close(EventPoll);
+    }
+
+    printf("TestEventPollScaling done. %d errors found.\n", Errors);
+    return Errors;
+}
+
+ULONG
+TestEventPollRounds (
+    int *Sockets,
+    ULONG SocketCount,
+    ULONG ActiveCount,
+    ULONG RoundCount,
+    int EventPoll,
+    struct pollfd *PollDescriptors
+    )
+
+/*++
+
+Routine Description:
+
+    This routine times rounds of waking up the active connections and
+    collecting them with either epoll_wait or poll.
+
+Arguments:
+
+    Sockets - Supplies the array of socket pairs. The even elements are the
+        read sides, and the odd elements are the write sides.
+
+    SocketCount - Supplies the number of socket pairs.
+
+    ActiveCount - Supplies the number of pairs at the end of the array that
+        receive data each round.
+
+    RoundCount - Supplies the number of rounds to perform.
+
+    EventPoll - Supplies the event poll descriptor to wait on, or -1 to use
+        poll instead.
+
+    PollDescriptors - Supplies the poll array to use if no event poll
+        descriptor was supplied.
+
+Return Value:
+
+    Returns the number of failures that occurred.
+
+--*/
+
+{
+
+    char Buffer;
+    ULONG Collected;
+    ULONG Connection;
+    double Elapsed;
+    ULONG Errors;
+    struct epoll_event Events[EVENT_POLL_TEST_BATCH_SIZE];
+    ULONG FirstActive;
+    ULONG Index;
+    int ReadyCount;
+    ULONG Round;
+    struct timespec Start;
+
+    Buffer = 'x';
+    Errors = 0;
+    FirstActive = SocketCount - ActiveCount;
+    clock_gettime(CLOCK_MONOTONIC, &Start);
+    for (Round = 0; Round < RoundCount; Round += 1) {
+        for (Index = FirstActive; Index < SocketCount; Index += 1) {
+            if (write(Sockets[(Index * 2) + 1], &Buffer, 1) != 1) {
+                printf("write() failed. Errno = %d.\n", errno);
+                return Errors + 1;
+            }
+        }
+
+        Collected = 0;
+        while (Collected < ActiveCount) {
+            if (EventPoll >= 0) {
+                ReadyCount = epoll_wait(EventPoll,
+                                        Events,
+                                        EVENT_POLL_TEST_BATCH_SIZE,
+                                        -1);
+
+                if (ReadyCount < 0) {
+                    printf("epoll_wait() failed. Errno = %d.\n", errno);
+                    return Errors + 1;
+                }
+
+                for (Index = 0; Index < ReadyCount; Index += 1) {
+                    Connection = Events[Index].data.u32;
+                    if (Connection < FirstActive) {
+                        printf("Idle connection %d reported ready.\n",
+                               Connection);
+
+                        Errors += 1;
+                        continue;
+                    }
+
+                    read(Sockets[Connection * 2], &Buffer, 1);
+                    Collected += 1;
+                }
+
+            } else {
+                ReadyCount = poll(PollDescriptors, SocketCount, -1);
+                if (ReadyCount < 0) {
+                    printf("poll() failed. Errno = %d.\n", errno);
+                    return Errors + 1;
+                }
+
+                for (Index = 0; Index < SocketCount; Index += 1) {
+                    if ((PollDescriptors[Index].revents & POLLIN) != 0) {
+                        read(Sockets[Index * 2], &Buffer, 1);
+                        Collected += 1;
+                    }
+                }
+            }
+
+            if (Errors > 10) {
+                return Errors;
+            }
+        }
+    }
+
+    Elapsed = TestGetElapsedMicroseconds(&Start);
+    printf("%s: %d rounds of %d/%d ready in %.0fus, %.2fus per round.\n",
+           (EventPoll >= 0) ? "epoll_wait" : "poll",
+           RoundCount,
+           ActiveCount,
+           SocketCount,
+           Elapsed,
+           Elapsed / RoundCount);
+
+    return Errors;
+}
+
+ULONG
+TestUnixSocketPerformance (
+    ULONG MessageSize,
+    ULONG RoundCount,
+    ULONG MessageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine benchmarks small message traffic over local sockets: the
+    round trip latency of a request/response exchange, and the throughput of
+    one-way streams and datagram batches.
+
+Arguments:
+
+    MessageSize - Supplies the size of each message in bytes.
+
+    RoundCount - Supplies the number of request/response round trips to time.
+
+    MessageCount - Supplies the number of messages to send for the throughput
+        tests.
+
+Return Value:
+
+    Returns the number of failures that occurred in the test.
+
+--*/
+
+{
+
+    ULONG Errors;
+
+    Errors = TestUnixSocketLatency(MessageSize, RoundCount);
+    Errors += TestUnixSocketThroughput(SOCK_STREAM, MessageSize, MessageCount);
+    Errors += TestUnixSocketThroughput(SOCK_DGRAM, MessageSize, MessageCount);
+    printf("TestUnixSocketPerformance done. %d errors found.\n", Errors);
+    return Errors;
+}
+
+ULONG
+TestUnixSocketLatency (
+    ULONG MessageSize,
+    ULONG RoundCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine times request/response round trips between two processes
+    over a local stream socket pair. The child echoes every request back.
+
+Arguments:
+
+    MessageSize - Supplies the size of each request and response in bytes.
+
+    RoundCount - Supplies the number of round trips to perform.
+
+Return Value:
+
+    Returns the number of failures that occurred.
+
+--*/
+
+{
+
+    PCHAR Buffer;
+    pid_t Child;
+    double Elapsed;
+    ULONG Errors;
+    int Result;
+    ULONG Round;
+    int Sockets[2];
+    struct timespec Start;
+
+    Errors = 0;
+    Buffer = malloc(MessageSize);
+    if (Buffer == NULL) {
+        printf("Failed to allocate message buffer.\n");
+        return 1;
+    }
+
+    Result = socketpair(AF_UNIX, SOCK_STREAM, 0, Sockets);
+    if (Result != 0) {
+        printf("socketpair() failed. Errno = %d.\n", errno);
+        free(Buffer);
+        return 1;
+    }
+
+    Child = fork();
+    if (Child < 0) {
+        printf("fork() failed. Errno = %d.\n", errno);
+        Errors += 1;
+        goto TestUnixSocketLatencyEnd;
+    }
+
+    //
+    // The child is the server, echoing each request back as the response.
+    //
+
+    if (Child == 0) {
+        close(Sockets[0]);
+        Result = 0;
+        for (Round = 0; Round < RoundCount; Round += 1) {
+            Result = TestUnixSocketTransfer(Sockets[1],
+                                            Buffer,
+                                            MessageSize,
+                                            FALSE);
+
+            if (Result != 0) {
+                break;
+            }
+
+            Result = TestUnixSocketTransfer(Sockets[1],
+                                            Buffer,
+                                            MessageSize,
+                                            TRUE);
+
+            if (Result != 0) {
+                break;
+            }
+        }
+
+        close(Sockets[1]);
+        exit(Result);
+    }
+
+    memset(Buffer, 'r', MessageSize);
+    clock_gettime(CLOCK_MONOTONIC, &Start);
+    for (Round = 0; Round < RoundCount; Round += 1) {
+        Result = TestUnixSocketTransfer(Sockets[0], Buffer, MessageSize, TRUE);
+        if (Result == 0) {
+            Result = TestUnixSocketTransfer(Sockets[0],
+                                            Buffer,
+                                            MessageSize,
+                                            FALSE);
+        }
+
+        if (Result != 0) {
+            printf("Request/response %d failed. Errno = %d.\n", Round, errno);
+            Errors += 1;
+            break;
+        }
+    }
+
+    Elapsed = TestGetElapsedMicroseconds(&Start);
+    if (Errors == 0) {
+        printf("AF_UNIX request/response: %d rounds of %d bytes in %.0fus, "
+               "%.2fus per round trip.\n",
+               RoundCount,
+               MessageSize,
+               Elapsed,
+               Elapsed / RoundCount);
+    }
+
+    //
+    // Close both ends so the child cannot block forever if this side bailed
+    // out early.
+    //
+
+    close(Sockets[0]);
+    Sockets[0] = -1;
+    close(Sockets[1]);
+    Sockets[1] = -1;
+    Errors += TestWaitForChild(Child);
+
+TestUnixSocketLatencyEnd:
+    if (Sockets[0] >= 0) {
+        close(Sockets[0]);
+    }
+
+    if (Sockets[1] >= 0) {
+        close(Sockets[1]);
+    }
+
+    free(Buffer);
+    return Errors;
+}
+
+ULONG
+TestUnixSocketThroughput (
+    int Type,
+    ULONG MessageSize,
+    ULONG MessageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine times sending a large number of small messages one way
+    between two processes over a local socket pair. Stream sockets send each
+    message with its own write call, and datagram sockets send them in
+    batches with sendmmsg. The child receives everything and then replies with
+    a single byte so the timing covers delivery.
+
+Arguments:
+
+    Type - Supplies the socket type, either SOCK_STREAM or SOCK_DGRAM.
+
+    MessageSize - Supplies the size of each message in bytes.
+
+    MessageCount - Supplies the number of messages to send.
+
+Return Value:
+
+    Returns the number of failures that occurred.
+
+--*/
+
+{
+
+    ULONG BatchSize;
+    PCHAR Buffer;
+    pid_t Child;
+    double Elapsed;
+    ULONG Errors;
+    ULONG Index;
+    struct mmsghdr Messages[UNIX_SOCKET_TEST_BATCH_SIZE];
+    ULONG MessagesSent;
+    int Result;
+    int Sockets[2];
+    struct timespec Start;
+    struct iovec Vectors[UNIX_SOCKET_TEST_BATCH_SIZE];
+
+    Errors = 0;
+    Buffer = malloc(MessageSize);
+    if (Buffer == NULL) {
+        printf("Failed to allocate message buffer.\n");
+        return 1;
+    }
+
+    memset(Buffer, 't', MessageSize);
+    Result = socketpair(AF_UNIX, Type, 0, Sockets);
+    if (Result != 0) {
+        printf("socketpair() failed. Errno = %d.\n", errno);
+        free(Buffer);
+        return 1;
+    }
+
+    Child = fork();
+    if (Child < 0) {
+        printf("fork() failed. Errno = %d.\n", errno);
+        Errors += 1;
+        goto TestUnixSocketThroughputEnd;
+    }
+
+    if (Child == 0) {
+        close(Sockets[0]);
+        Result = TestUnixSocketReceiveAll(Type,
+                                          Sockets[1],
+                                          MessageSize,
+                                          MessageCount);
+
+        if (Result == 0) {
+            Result = TestUnixSocketTransfer(Sockets[1], Buffer, 1, TRUE);
+        }
+
+        close(Sockets[1]);
+        exit(Result);
+    }
+
+    memset(Messages, 0, sizeof(Messages));
+    for (Index = 0; Index < UNIX_SOCKET_TEST_BATCH_SIZE; Index += 1) {
+        Vectors[Index].iov_base = Buffer;
+        Vectors[Index].iov_len = MessageSize;
+        Messages[Index].msg_hdr.msg_iov = &(Vectors[Index]);
+        Messages[Index].msg_hdr.msg_iovlen = 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &Start);
+    MessagesSent = 0;
+    while (MessagesSent < MessageCount) {
+        if (Type == SOCK_STREAM) {
+            Result = TestUnixSocketTransfer(Sockets[0],
+                                            Buffer,
+                                            MessageSize,
+                                            TRUE);
+
+            if (Result != 0) {
+                printf("write() failed. Errno = %d.\n", errno);
+                Errors += 1;
+                break;
+            }
+
+            MessagesSent += 1;
+
+        } else {
+            BatchSize = MessageCount - MessagesSent;
+            if (BatchSize > UNIX_SOCKET_TEST_BATCH_SIZE) {
+                BatchSize = UNIX_SOCKET_TEST_BATCH_SIZE;
+            }
+
+            Result = sendmmsg(Sockets[0], Messages, BatchSize, 0);
+            if (Result <= 0) {
+                printf("sendmmsg() failed. Errno = %d.\n", errno);
+                Errors += 1;
+                break;
+            }
+
+            for (Index = 0; Index < Result; Index += 1) {
+                if (Messages[Index].msg_len != MessageSize) {
+                    printf("sendmmsg() sent %d of %d bytes.\n",
+                           Messages[Index].msg_len,
+                           MessageSize);
+
+                    Errors += 1;
+                }
+            }
+
+            MessagesSent += Result;
+        }
+    }
+
+    //
+    // Wait for the receiver to say everything arrived.
+    //
+
+    if (Errors == 0) {
+        Result = TestUnixSocketTransfer(Sockets[0], Buffer, 1, FALSE);
+        if (Result != 0) {
+            printf("Failed to get receiver acknowledgment. Errno = %d.\n",
+                   errno);
+
+            Errors += 1;
+        }
+    }
+
+    Elapsed = TestGetElapsedMicroseconds(&Start);
+    if (Errors == 0) {
+        printf("AF_UNIX %s: %d messages of %d bytes in %.0fus, "
+               "%.0f messages/s, %.2f MB/s.\n",
+               (Type == SOCK_STREAM) ? "stream" : "datagram batch",
+               MessageCount,
+               MessageSize,
+               Elapsed,
+               (MessageCount * 1000000.0) / Elapsed,
+               ((double)MessageCount * MessageSize) / Elapsed);
+    }
+
+    //
+    // Close both ends so the child cannot block forever if this side bailed
+    // out early.
+    //
+
+    close(Sockets[0]);
+    Sockets[0] = -1;
+    close(Sockets[1]);
+    Sockets[1] = -1;
+    Errors += TestWaitForChild(Child);
+
+TestUnixSocketThroughputEnd:
+    if (Sockets[0] >= 0) {
+        close(Sockets[0]);
+    }
+
+    if (Sockets[1] >= 0) {
+        close(Sockets[1]);
+    }
+
+    free(Buffer);
+    return Errors;
+}
+
+int
+TestUnixSocketReceiveAll (
+    int Type,
+    int Socket,
+    ULONG MessageSize,
+    ULONG MessageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the receiving side of the throughput test. Stream
+    data is read in large chunks, and datagrams are received in batches with
+    recvmmsg.
+
+Arguments:
+
+    Type - Supplies the socket type, either SOCK_STREAM or SOCK_DGRAM.
+
+    Socket - Supplies the socket to receive from.
+
+    MessageSize - Supplies the size of each message in bytes.
+
+    MessageCount - Supplies the number of messages to receive.
+
+Return Value:
+
+    0 if all the data arrived intact.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    PCHAR Buffer;
+    ssize_t BytesRead;
+    ULONG BufferSize;
+    ULONG Index;
+    struct mmsghdr Messages[UNIX_SOCKET_TEST_BATCH_SIZE];
+    ULONG MessagesReceived;
+    int Result;
+    ULONGLONG TotalBytes;
+    ULONGLONG TotalReceived;
+    struct iovec Vectors[UNIX_SOCKET_TEST_BATCH_SIZE];
+
+    BufferSize = MessageSize * UNIX_SOCKET_TEST_BATCH_SIZE;
+    if (BufferSize < UNIX_SOCKET_TEST_STREAM_BUFFER_SIZE) {
+        BufferSize = UNIX_SOCKET_TEST_STREAM_BUFFER_SIZE;
+    }
+
+    Buffer = malloc(BufferSize);
+    if (Buffer == NULL) {
+        printf("Failed to allocate receive buffer.\n");
+        return 1;
+    }
+
+    Result = 0;
+    if (Type == SOCK_STREAM) {
+        TotalBytes = (ULONGLONG)MessageSize * MessageCount;
+        TotalReceived = 0;
+        while (TotalReceived < TotalBytes) {
+            BytesRead = read(Socket, Buffer, BufferSize);
+            if (BytesRead <= 0) {
+                printf("read() failed after %lld of %lld bytes. "
+                       "Errno = %d.\n",
+                       TotalReceived,
+                       TotalBytes,
+                       errno);
+
+                Result = 1;
+                break;
+            }
+
+            TotalReceived += BytesRead;
+        }
+
+    } else {
+        memset(Messages, 0, sizeof(Messages));
+        for (Index = 0; Index < UNIX_SOCKET_TEST_BATCH_SIZE; Index += 1) {
+            Vectors[Index].iov_base = Buffer + (Index * MessageSize);
+            Vectors[Index].iov_len = MessageSize;
+            Messages[Index].msg_hdr.msg_iov = &(Vectors[Index]);
+            Messages[Index].msg_hdr.msg_iovlen = 1;
+        }
+
+        MessagesReceived = 0;
+        while (MessagesReceived < MessageCount) {
+            Result = recvmmsg(Socket,
+                              Messages,
+                              UNIX_SOCKET_TEST_BATCH_SIZE,
+                              MSG_WAITFORONE,
+                              NULL);
+
+            if (Result <= 0) {
+                printf("recvmmsg() failed after %d of %d messages. "
+                       "Errno = %d.\n",
+                       MessagesReceived,
+                       MessageCount,
+                       errno);
+
+                Result = 1;
+                break;
+            }
+
+            for (Index = 0; Index < Result; Index += 1) {
+                if (Messages[Index].msg_len != MessageSize) {
+                    printf("recvmmsg() got %d of %d bytes.\n",
+                           Messages[Index].msg_len,
+                           MessageSize);
+
+                    Result = 1;
+                    break;
+                }
+            }
+
+            if (Index != Result) {
+                break;
+            }
+
+            MessagesReceived += Result;
+            Result = 0;
+        }
+    }
+
+    free(Buffer);
+    return Result;
+}
+
+int
+TestUnixSocketTransfer (
+    int Socket,
+    PVOID Buffer,
+    ULONG Size,
+    BOOL Write
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads or writes the full given size on a stream socket.
+
+Arguments:
+
+    Socket - Supplies the socket to do I/O on.
+
+    Buffer - Supplies the buffer to read into or write from.
+
+    Size - Supplies the number of bytes to transfer.
+
+    Write - Supplies a boolean indicating whether to write (TRUE) or read
+        (FALSE).
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure or end of file.
+
+--*/
+
+{
+
+    ssize_t BytesDone;
+    ULONG TotalDone;
+
+    TotalDone = 0;
+    while (TotalDone < Size) {
+        if (Write != FALSE) {
+            BytesDone = write(Socket,
+                              (PCHAR)Buffer + TotalDone,
+                              Size - TotalDone);
+
+        } else {
+            BytesDone = read(Socket,
+                             (PCHAR)Buffer + TotalDone,
+                             Size - TotalDone);
+        }
+
+        if (BytesDone <= 0) {
+            if ((BytesDone < 0) && (errno == EINTR)) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        TotalDone += BytesDone;
+    }
+
+    return 0;
+}
+
+ULONG
+TestWaitForChild (
+    pid_t Child
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for a benchmark child process to exit.
+
+Arguments:
+
+    Child - Supplies the process ID of the child.
+
+Return Value:
+
+    0 if the child exited successfully.
+
+    1 if the child failed.
+
+--*/
+
+{
+
+    pid_t Result;
+    int Status;
+
+    Result = waitpid(Child, &Status, 0);
+    if (Result != Child) {
+        printf("waitpid() failed. Errno = %d.\n", errno);
+        return 1;
+    }
+
+    if ((!WIFEXITED(Status)) || (WEXITSTATUS(Status) != 0)) {
+        printf("Child %d failed with status 0x%x.\n", Child, Status);
+        return 1;
+    }
+
+    return 0;
+}
+
+double
+TestGetElapsedMicroseconds (
+    struct timespec *Start
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the number of microseconds elapsed since the given
+    monotonic time.
+
+Arguments:
+
+    Start - Supplies a pointer to the starting time.
+
+Return Value:
+
+    Returns the elapsed time in microseconds.
+
+--*/
+
+{
+
+    struct timespec End;
+
+    clock_gettime(CLOCK_MONOTONIC, &End);
+    return ((double)(End.tv_sec - Start->tv_sec) * 1000000.0) +
+           ((double)(End.tv_nsec - Start->tv_nsec) / 1000.0);
+}
+
@@ -48,13 +48,17 @@ Module Name:
 #define VMSTAT_VERSION_MINOR 0
 
 #define VMSTAT_USAGE                                                       \
-    "usage: vmstat\n\n"                                                    \
+    "usage: vmstat [-d [interval [count]]]\n\n"                            \
     "The vmstat utility prints information about current system memory \n" \
     "usage. Options are:\n"                                                \
+    "  -d, --disk -- Display per-device block I/O statistics instead. The\n"\
+    "      first report covers the time since boot. If an interval in\n"   \
+    "      seconds is given, each further report covers one interval,\n"   \
+    "      until count reports have been printed.\n"                       \
     "  --help -- Display this help text.\n"                                \
     "  --version -- Display the application version and exit.\n\n"
 
-#define VMSTAT_OPTIONS_STRING "hV"
+#define VMSTAT_OPTIONS_STRING "dhV"
 
 //
 // ------------------------------------------------------ Data Type Definitions
@@ -69,11 +73,31 @@ VmstatPrintInformation (
     VOID
     );
 
+INT
+VmstatPrintDeviceStatistics (
+    ULONG Interval,
+    ULONG Count
+    );
+
+INT
+VmstatGetDeviceStatistics (
+    PIO_DEVICE_STATISTICS *Statistics,
+    PUINTN Count
+    );
+
+VOID
+VmstatPrintDevice (
+    PIO_DEVICE_STATISTICS Current,
+    PIO_DEVICE_STATISTICS Previous,
+    double Seconds
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
 struct option VmstatLongOptions[] = {
+    {"disk", no_argument, 0, 'd'},
     {"help", no_argument, 0, 'h'},
     {"version", no_argument, 0, 'V'},
     {NULL, 0, 0, 0}
@@ -112,10 +136,17 @@ Return Value:
 
 {
 
+    PSTR AfterScan;
     ULONG ArgumentIndex;
+    ULONG Count;
+    BOOL Disk;
+    ULONG Interval;
     INT Option;
     INT ReturnValue;
 
+    Count = 0;
+    Disk = FALSE;
+    Interval = 0;
     ReturnValue = 0;
 
     //
@@ -148,6 +179,10 @@ Return Value:
         }
 
         switch (Option) {
+        case 'd':
+            Disk = TRUE;
+            break;
+
         case 'V':
             printf("vmstat version %d.%02d\n",
                    VMSTAT_VERSION_MAJOR,
@@ -174,6 +209,40 @@ Return Value:
         ArgumentIndex = ArgumentCount;
     }
 
+    //
+    // The disk report takes an optional interval and count.
+    //
+
+    if (Disk != FALSE) {
+        if (ArgumentIndex < ArgumentCount) {
+            Interval = strtoul(Arguments[ArgumentIndex], &AfterScan, 10);
+            if ((Interval == 0) || (*AfterScan != '\0')) {
+                fprintf(stderr,
+                        "vmstat: Invalid interval %s\n",
+                        Arguments[ArgumentIndex]);
+
+                ReturnValue = EINVAL;
+                goto mainEnd;
+            }
+
+            ArgumentIndex += 1;
+        }
+
+        if (ArgumentIndex < ArgumentCount) {
+            Count = strtoul(Arguments[ArgumentIndex], &AfterScan, 10);
+            if ((Count == 0) || (*AfterScan != '\0')) {
+                fprintf(stderr,
+                        "vmstat: Invalid count %s\n",
+                        Arguments[ArgumentIndex]);
+
+                ReturnValue = EINVAL;
+                goto mainEnd;
+            }
+
+            ArgumentIndex += 1;
+        }
+    }
+
     if (ArgumentIndex < ArgumentCount) {
         fprintf(stderr,
                 "vmstat: Unexpected argument %s\n",
@@ -181,6 +250,9 @@ Return Value:
     }
 
     ReturnValue = 0;
+    if (Disk != FALSE) {
+        ReturnValue = VmstatPrintDeviceStatistics(Interval, Count);
+    }
 
 mainEnd:
     return ReturnValue;
@@ -218,6 +290,8 @@ Return Value:
     IO_CACHE_STATISTICS IoCache;
     ULONGLONG Megabytes;
     MM_STATISTICS MmStatistics;
+    double Ratio;
+    ULONGLONG ReadPages;
     INT ReturnValue;
     UINTN Size;
     KSTATUS Status;
@@ -303,6 +377,315 @@ Return Value:
     printf("Page Cache Size: %lldMB\n", Megabytes);
     Megabytes = (IoCache.DirtyPageCount * MmStatistics.PageSize) / _1MB;
     printf("Dirty Page Cache Size: %lldMB\n", Megabytes);
+    printf("Read-Ahead Pages: %lld (used %lld, wasted %lld)\n",
+           IoCache.ReadAheadPageCount,
+           IoCache.ReadAheadHitPageCount,
+           IoCache.ReadAheadWastePageCount);
+    printf("Page Cache Entries: %ld (%ld active)\n",
+           IoCache.EntryCount,
+           IoCache.ActiveEntryCount);
+
+    ReadPages = IoCache.ReadHitPageCount + IoCache.ReadMissPageCount;
+    if (ReadPages != 0) {
+        Ratio = ((double)IoCache.ReadHitPageCount * 100.0) / ReadPages;
+        printf("Read Cache Hits: %lld of %lld pages (%.1f%%)\n",
+               IoCache.ReadHitPageCount,
+               ReadPages,
+               Ratio);
+    }
+
+    printf("Refaulted Pages: %lld (%lld activated)\n",
+           IoCache.RefaultPageCount,
+           IoCache.RefaultActivatePageCount);
+
     return ReturnValue;
 }
 
+INT
+VmstatPrintDeviceStatistics (
+    ULONG Interval,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints per-device block I/O statistics, in the style of
+    iostat. The first report covers the time since boot, and each following
+    report covers one interval.
+
+Arguments:
+
+    Interval - Supplies the number of seconds between reports. Supply zero to
+        print a single report.
+
+    Count - Supplies the number of reports to print. Supply zero to print
+        reports until interrupted.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    PIO_DEVICE_STATISTICS Current;
+    UINTN CurrentCount;
+    ULONGLONG CurrentTime;
+    ULONGLONG Frequency;
+    UINTN Index;
+    IO_DEVICE_STATISTICS None;
+    PIO_DEVICE_STATISTICS Previous;
+    UINTN PreviousCount;
+    PIO_DEVICE_STATISTICS PreviousElement;
+    UINTN PreviousIndex;
+    ULONGLONG PreviousTime;
+    ULONG Report;
+    INT ReturnValue;
+    double Seconds;
+
+    Frequency = OsGetTimeCounterFrequency();
+    memset(&None, 0, sizeof(IO_DEVICE_STATISTICS));
+    Previous = NULL;
+    PreviousCount = 0;
+    PreviousTime = 0;
+    Report = 0;
+    while (TRUE) {
+        ReturnValue = VmstatGetDeviceStatistics(&Current, &CurrentCount);
+        if (ReturnValue != 0) {
+            break;
+        }
+
+        CurrentTime = OsQueryTimeCounter();
+        Seconds = (double)(CurrentTime - PreviousTime) / (double)Frequency;
+        printf("%-8s %8s %8s %10s %10s %7s %7s %6s %6s %6s\n",
+               "Device",
+               "r/s",
+               "w/s",
+               "rkB/s",
+               "wkB/s",
+               "qwait",
+               "svc",
+               "queued",
+               "active",
+               "%util");
+
+        //
+        // Match each device with its previous sample. A device that showed up
+        // since then is compared against zero.
+        //
+
+        for (Index = 0; Index < CurrentCount; Index += 1) {
+            PreviousElement = &None;
+            for (PreviousIndex = 0;
+                 PreviousIndex < PreviousCount;
+                 PreviousIndex += 1) {
+
+                if (Previous[PreviousIndex].DeviceId ==
+                    Current[Index].DeviceId) {
+
+                    PreviousElement = &(Previous[PreviousIndex]);
+                    break;
+                }
+            }
+
+            VmstatPrintDevice(&(Current[Index]), PreviousElement, Seconds);
+        }
+
+        if (Previous != NULL) {
+            free(Previous);
+        }
+
+        Previous = Current;
+        PreviousCount = CurrentCount;
+        PreviousTime = CurrentTime;
+        Report += 1;
+        if ((Interval == 0) || ((Count != 0) && (Report >= Count))) {
+            break;
+        }
+
+        printf("\n");
+        sleep(Interval);
+    }
+
+    if (Previous != NULL) {
+        free(Previous);
+    }
+
+    return ReturnValue;
+}
+
+INT
+VmstatGetDeviceStatistics (
+    PIO_DEVICE_STATISTICS *Statistics,
+    PUINTN Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the I/O statistics for every block device.
+
+Arguments:
+
+    Statistics - Supplies a pointer where an array of statistics will be
+        returned on success. The caller is responsible for freeing this
+        array.
+
+    Count - Supplies a pointer where the number of elements in the array will
+        be returned.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    PIO_DEVICE_STATISTICS Buffer;
+    UINTN DataSize;
+    INT ReturnValue;
+    KSTATUS Status;
+
+    //
+    // Devices may show up between getting the size and getting the data, so
+    // keep trying until the buffer is big enough.
+    //
+
+    Buffer = NULL;
+    DataSize = 0;
+    while (TRUE) {
+        Status = OsGetSetSystemInformation(SystemInformationIo,
+                                           IoInformationDeviceStatistics,
+                                           Buffer,
+                                           &DataSize,
+                                           FALSE);
+
+        if (Status != STATUS_BUFFER_TOO_SMALL) {
+            break;
+        }
+
+        if (Buffer != NULL) {
+            free(Buffer);
+        }
+
+        Buffer = malloc(DataSize);
+        if (Buffer == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+    }
+
+    if (!KSUCCESS(Status)) {
+        ReturnValue = ClConvertKstatusToErrorNumber(Status);
+        fprintf(stderr,
+                "Error: failed to get device I/O statistics: status %d: "
+                "%s.\n",
+                Status,
+                strerror(ReturnValue));
+
+        if (Buffer != NULL) {
+            free(Buffer);
+        }
+
+        return ReturnValue;
+    }
+
+    *Statistics = Buffer;
+    *Count = DataSize / sizeof(IO_DEVICE_STATISTICS);
+    return 0;
+}
+
+VOID
+VmstatPrintDevice (
+    PIO_DEVICE_STATISTICS Current,
+    PIO_DEVICE_STATISTICS Previous,
+    double Seconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints one line of block I/O statistics for a device.
+
+Arguments:
+
+    Current - Supplies a pointer to the current sample for the device.
+
+    Previous - Supplies a pointer to the previous sample for the device.
+
+    Seconds - Supplies the time between the two samples, in seconds.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG Busy;
+    double QueueWait;
+    ULONGLONG Reads;
+    ULONGLONG Requests;
+    double ServiceWait;
+    double Utilization;
+    ULONGLONG Writes;
+
+    if (Seconds <= 0.0) {
+        Seconds = 1.0;
+    }
+
+    Reads = Current->ReadCount - Previous->ReadCount;
+    Writes = Current->WriteCount - Previous->WriteCount;
+    Requests = Reads + Writes;
+
+    //
+    // Show the average time each request spent in the queue and at the
+    // device, in milliseconds.
+    //
+
+    QueueWait = 0.0;
+    ServiceWait = 0.0;
+    if (Requests != 0) {
+        QueueWait = (double)(Current->QueueMicroseconds -
+                             Previous->QueueMicroseconds) /
+                    (1000.0 * Requests);
+
+        ServiceWait = (double)(Current->ServiceMicroseconds -
+                               Previous->ServiceMicroseconds) /
+                      (1000.0 * Requests);
+    }
+
+    Busy = Current->BusyMicroseconds - Previous->BusyMicroseconds;
+    Utilization = ((double)Busy * 100.0) / (Seconds * 1000000.0);
+    if (Utilization > 100.0) {
+        Utilization = 100.0;
+    }
+
+    printf("%-8lld %8.1f %8.1f %10.1f %10.1f %7.2f %7.2f %6d %6d %6.1f\n",
+           Current->DeviceId,
+           (double)Reads / Seconds,
+           (double)Writes / Seconds,
+           (double)(Current->BytesRead - Previous->BytesRead) /
+           (1024.0 * Seconds),
+           (double)(Current->BytesWritten - Previous->BytesWritten) /
+           (1024.0 * Seconds),
+           QueueWait,
+           ServiceWait,
+           Current->QueuedCount,
+           Current->InFlightCount,
+           Utilization);
+
+    return;
+}
+
@@ -40,6 +40,7 @@ function build() {
         "drivers/devrem:devrem",
         "drivers/fat:fat",
         "drivers/input:input_drivers",
+        "drivers/loop:loop",
         "drivers/net:net_drivers",
         "drivers/null:null",
         "drivers/part:part",
@@ -50,6 +51,7 @@ function build() {
         "drivers/sound:sound_drivers",
         "drivers/special:special",
         "drivers/term/ser16550:ser16550",
+        "drivers/tmpfs:tmpfs",
         "drivers/usb:usb_drivers",
         "drivers/videocon:videocon"
     ];
@@ -0,0 +1,1264 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    loop.c
+
+Abstract:
+
+    This module implements loopback block devices. A loop device exposes a
+    regular file as a disk, so that the partition driver and file systems can
+    be exercised on an image file. The backing file is opened for direct I/O,
+    so data is only cached once, above the loop device. Loop devices can be
+    slowed down with a per-request latency and a bandwidth limit to behave
+    like SD cards or hard drives.
+
+    Loop devices are created by setting the device information of the loop
+    control device, and removed by setting the detach flag in the loop
+    device's own information.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include <minoca/devinfo/loop.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define LOOP_ALLOCATION_TAG 0x706F6F4C // 'pooL'
+#define LOOP_SECTOR_SIZE 0x200
+
+//
+// Define the size of a loop device ID string: "Loop", up to eight hex
+// digits, and a null terminator.
+//
+
+#define LOOP_DEVICE_ID_SIZE 13
+
+//
+// Define the I/O flags that are passed along to the backing file.
+//
+
+#define LOOP_IO_FLAG_MASK \
+    (IO_FLAG_DATA_SYNCHRONIZED | IO_FLAG_METADATA_SYNCHRONIZED)
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _LOOP_OBJECT_TYPE {
+    LoopObjectInvalid,
+    LoopObjectControl,
+    LoopObjectDisk
+} LOOP_OBJECT_TYPE, *PLOOP_OBJECT_TYPE;
+
+/*++
+
+Structure Description:
+
+    This structure defines state associated with a loop device.
+
+Members:
+
+    Type - Stores the object type, which is always LoopObjectDisk.
+
+    ReferenceCount - Stores the reference count on the loop device. The
+        device itself holds one reference until it is removed, and each open
+        holds another.
+
+    Device - Stores a pointer to the OS device.
+
+    BackingHandle - Stores the I/O handle to the backing file, opened for
+        direct I/O.
+
+    Size - Stores the size of the loop device, in bytes.
+
+    Flags - Stores a bitmask of flags. See LOOP_FLAG_* definitions.
+
+    Latency - Stores the number of microseconds to wait before starting each
+        I/O request.
+
+    Lock - Stores a pointer to the lock that protects the bandwidth and busy
+        time.
+
+    Bandwidth - Stores the number of bytes per second the device may
+        transfer, or 0 for no limit.
+
+    BusyUntil - Stores the time counter value at which the data transfers
+        already granted will have finished. New transfers are scheduled after
+        this, which limits the bandwidth across concurrent requests.
+
+--*/
+
+typedef struct _LOOP_DISK {
+    LOOP_OBJECT_TYPE Type;
+    volatile ULONG ReferenceCount;
+    PDEVICE Device;
+    PIO_HANDLE BackingHandle;
+    ULONGLONG Size;
+    ULONG Flags;
+    volatile ULONG Latency;
+    PQUEUED_LOCK Lock;
+    ULONGLONG Bandwidth;
+    ULONGLONG BusyUntil;
+} LOOP_DISK, *PLOOP_DISK;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+LoopAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    );
+
+VOID
+LoopDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+LoopDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+LoopDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+LoopDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+LoopDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+LooppHandleControlInformationRequest (
+    PIRP Irp
+    );
+
+VOID
+LooppHandleDeviceInformationRequest (
+    PIRP Irp,
+    PLOOP_DISK Disk
+    );
+
+KSTATUS
+LooppCreateDisk (
+    PLOOP_CONTROL_INFORMATION Information
+    );
+
+VOID
+LooppShapeIo (
+    PLOOP_DISK Disk,
+    UINTN Size
+    );
+
+VOID
+LooppDiskAddReference (
+    PLOOP_DISK Disk
+    );
+
+VOID
+LooppDiskReleaseReference (
+    PLOOP_DISK Disk
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store a pointer to the driver object.
+//
+
+PDRIVER LoopDriver = NULL;
+
+//
+// Store the next loop device identifier.
+//
+
+volatile ULONG LoopNextIdentifier = 0;
+
+//
+// Store the context of the loop control device.
+//
+
+LOOP_OBJECT_TYPE LoopControl = LoopObjectControl;
+
+UUID LoopControlInformationUuid = LOOP_CONTROL_INFORMATION_UUID;
+UUID LoopDeviceInformationUuid = LOOP_DEVICE_INFORMATION_UUID;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+__USED
+KSTATUS
+DriverEntry (
+    PDRIVER Driver
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point for the loop driver. It registers its
+    other dispatch functions and creates the loop control device.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver object.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code on error.
+
+--*/
+
+{
+
+    DRIVER_FUNCTION_TABLE FunctionTable;
+    KSTATUS Status;
+
+    LoopDriver = Driver;
+    RtlZeroMemory(&FunctionTable, sizeof(DRIVER_FUNCTION_TABLE));
+    FunctionTable.Version = DRIVER_FUNCTION_TABLE_VERSION;
+    FunctionTable.AddDevice = LoopAddDevice;
+    FunctionTable.DispatchStateChange = LoopDispatchStateChange;
+    FunctionTable.DispatchOpen = LoopDispatchOpen;
+    FunctionTable.DispatchClose = LoopDispatchClose;
+    FunctionTable.DispatchIo = LoopDispatchIo;
+    FunctionTable.DispatchSystemControl = LoopDispatchSystemControl;
+    Status = IoRegisterDriverFunctions(Driver, &FunctionTable);
+    if (!KSUCCESS(Status)) {
+        goto DriverEntryEnd;
+    }
+
+    //
+    // Like the RAM disk, the loop devices are not enumerated by any bus. The
+    // driver creates the control device itself, and the loop devices later
+    // on request.
+    //
+
+    Status = IoCreateDevice(LoopDriver,
+                            &LoopControl,
+                            NULL,
+                            "LoopControl",
+                            NULL,
+                            NULL,
+                            NULL);
+
+DriverEntryEnd:
+    return Status;
+}
+
+KSTATUS
+LoopAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a device is detected for which the loop driver
+    acts as the function driver. The loop driver never attaches to devices.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver being called.
+
+    DeviceId - Supplies a pointer to a string with the device ID.
+
+    ClassId - Supplies a pointer to a string containing the device's class ID.
+
+    CompatibleIds - Supplies a pointer to a string containing device IDs
+        that would be compatible with this device.
+
+    DeviceToken - Supplies an opaque token that the driver can use to identify
+        the device in the system. This token should be used when attaching to
+        the stack.
+
+Return Value:
+
+    STATUS_NOT_IMPLEMENTED always.
+
+--*/
+
+{
+
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+VOID
+LoopDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles State Change IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL CompleteIrp;
+    PLOOP_DISK Disk;
+    PUUID InformationUuid;
+    KSTATUS Status;
+    PLOOP_OBJECT_TYPE Type;
+
+    ASSERT(Irp->MajorCode == IrpMajorStateChange);
+
+    Type = DeviceContext;
+    Disk = NULL;
+    InformationUuid = &LoopControlInformationUuid;
+    if (*Type == LoopObjectDisk) {
+        Disk = DeviceContext;
+        InformationUuid = &LoopDeviceInformationUuid;
+    }
+
+    //
+    // The loop driver is the bus driver for all of its devices, so it
+    // completes state change IRPs on the way down.
+    //
+
+    if (Irp->Direction == IrpDown) {
+        Status = STATUS_NOT_SUPPORTED;
+        CompleteIrp = TRUE;
+        switch (Irp->MinorCode) {
+        case IrpMinorQueryResources:
+            Status = STATUS_SUCCESS;
+            break;
+
+        case IrpMinorStartDevice:
+            Status = IoRegisterDeviceInformation(Irp->Device,
+                                                 InformationUuid,
+                                                 TRUE);
+
+            break;
+
+        case IrpMinorQueryChildren:
+            Irp->U.QueryChildren.Children = NULL;
+            Irp->U.QueryChildren.ChildCount = 0;
+            Status = STATUS_SUCCESS;
+            break;
+
+        //
+        // A detached loop device goes away here. Opens may still hold
+        // references, in which case the backing file is closed when the last
+        // one does.
+        //
+
+        case IrpMinorRemoveDevice:
+            IoRegisterDeviceInformation(Irp->Device, InformationUuid, FALSE);
+            if (Disk != NULL) {
+                LooppDiskReleaseReference(Disk);
+            }
+
+            Status = STATUS_SUCCESS;
+            break;
+
+        //
+        // Pass all other IRPs down.
+        //
+
+        default:
+            CompleteIrp = FALSE;
+            break;
+        }
+
+        if (CompleteIrp != FALSE) {
+            IoCompleteIrp(LoopDriver, Irp, Status);
+        }
+
+    } else {
+
+        ASSERT(Irp->Direction == IrpUp);
+    }
+
+    return;
+}
+
+VOID
+LoopDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Open IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLOOP_DISK Disk;
+    KSTATUS Status;
+    PLOOP_OBJECT_TYPE Type;
+
+    Type = DeviceContext;
+    if (*Type != LoopObjectDisk) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto DispatchOpenEnd;
+    }
+
+    Disk = DeviceContext;
+    if (((Disk->Flags & LOOP_FLAG_READ_ONLY) != 0) &&
+        ((Irp->U.Open.DesiredAccess & IO_ACCESS_WRITE) != 0)) {
+
+        Status = STATUS_ACCESS_DENIED;
+        goto DispatchOpenEnd;
+    }
+
+    LooppDiskAddReference(Disk);
+    Irp->U.Open.DeviceContext = Disk;
+    Status = STATUS_SUCCESS;
+
+DispatchOpenEnd:
+    IoCompleteIrp(LoopDriver, Irp, Status);
+    return;
+}
+
+VOID
+LoopDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Close IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    LooppDiskReleaseReference(Irp->U.Close.DeviceContext);
+    IoCompleteIrp(LoopDriver, Irp, STATUS_SUCCESS);
+    return;
+}
+
+VOID
+LoopDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles I/O IRPs. The request is passed on to the backing
+    file using the caller's I/O buffer.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    UINTN BytesToComplete;
+    PLOOP_DISK Disk;
+    ULONG Flags;
+    IO_OFFSET IoOffset;
+    KSTATUS Status;
+
+    ASSERT(Irp->Direction == IrpDown);
+
+    Disk = Irp->U.ReadWrite.DeviceContext;
+
+    ASSERT(Disk->Type == LoopObjectDisk);
+    ASSERT(IS_ALIGNED(Irp->U.ReadWrite.IoOffset, LOOP_SECTOR_SIZE));
+    ASSERT(IS_ALIGNED(Irp->U.ReadWrite.IoSizeInBytes, LOOP_SECTOR_SIZE));
+    ASSERT(Irp->U.ReadWrite.IoBuffer != NULL);
+
+    BytesCompleted = 0;
+    IoOffset = Irp->U.ReadWrite.IoOffset;
+    if (IoOffset >= Disk->Size) {
+        Status = STATUS_OUT_OF_BOUNDS;
+        goto DispatchIoEnd;
+    }
+
+    BytesToComplete = Irp->U.ReadWrite.IoSizeInBytes;
+    if ((IoOffset + BytesToComplete) > Disk->Size) {
+        BytesToComplete = Disk->Size - IoOffset;
+    }
+
+    LooppShapeIo(Disk, BytesToComplete);
+
+    //
+    // The backing handle was opened for direct I/O, so aligned requests move
+    // straight between the caller's buffer and the file system's device.
+    //
+
+    Flags = Irp->U.ReadWrite.IoFlags & LOOP_IO_FLAG_MASK;
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        if ((Disk->Flags & LOOP_FLAG_READ_ONLY) != 0) {
+            Status = STATUS_ACCESS_DENIED;
+            goto DispatchIoEnd;
+        }
+
+        Status = IoWriteAtOffset(Disk->BackingHandle,
+                                 Irp->U.ReadWrite.IoBuffer,
+                                 IoOffset,
+                                 BytesToComplete,
+                                 Flags,
+                                 Irp->U.ReadWrite.TimeoutInMilliseconds,
+                                 &BytesCompleted,
+                                 NULL);
+
+    } else {
+
+        ASSERT(Irp->MinorCode == IrpMinorIoRead);
+
+        Status = IoReadAtOffset(Disk->BackingHandle,
+                                Irp->U.ReadWrite.IoBuffer,
+                                IoOffset,
+                                BytesToComplete,
+                                Flags,
+                                Irp->U.ReadWrite.TimeoutInMilliseconds,
+                                &BytesCompleted,
+                                NULL);
+    }
+
+DispatchIoEnd:
+    Irp->U.ReadWrite.IoBytesCompleted = BytesCompleted;
+    Irp->U.ReadWrite.NewIoOffset = IoOffset + BytesCompleted;
+    IoCompleteIrp(LoopDriver, Irp, Status);
+    return;
+}
+
+VOID
+LoopDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID Context;
+    PLOOP_DISK Disk;
+    PSYSTEM_CONTROL_FILE_OPERATION FileOperation;
+    PSYSTEM_CONTROL_LOOKUP Lookup;
+    PFILE_PROPERTIES Properties;
+    ULONGLONG PropertiesFileSize;
+    KSTATUS Status;
+    PLOOP_OBJECT_TYPE Type;
+
+    Context = Irp->U.SystemControl.SystemContext;
+    Type = DeviceContext;
+
+    //
+    // The control device only deals in device information. It cannot be
+    // opened.
+    //
+
+    if (*Type == LoopObjectControl) {
+        switch (Irp->MinorCode) {
+        case IrpMinorSystemControlDeviceInformation:
+            LooppHandleControlInformationRequest(Irp);
+            break;
+
+        case IrpMinorSystemControlLookup:
+            IoCompleteIrp(LoopDriver, Irp, STATUS_PATH_NOT_FOUND);
+            break;
+
+        default:
+            IoCompleteIrp(LoopDriver, Irp, STATUS_NOT_SUPPORTED);
+            break;
+        }
+
+        return;
+    }
+
+    ASSERT(*Type == LoopObjectDisk);
+
+    Disk = DeviceContext;
+    switch (Irp->MinorCode) {
+    case IrpMinorSystemControlLookup:
+        Lookup = (PSYSTEM_CONTROL_LOOKUP)Context;
+        Status = STATUS_PATH_NOT_FOUND;
+        if (Lookup->Root != FALSE) {
+
+            //
+            // Enable opening of the root as a single file. Unlike the RAM
+            // disk, the loop device is cached above like any other disk. The
+            // backing file is not, so the data is only cached once.
+            //
+
+            Properties = Lookup->Properties;
+            Properties->FileId = 0;
+            Properties->Type = IoObjectBlockDevice;
+            Properties->HardLinkCount = 1;
+            Properties->BlockSize = LOOP_SECTOR_SIZE;
+            Properties->BlockCount = Disk->Size / LOOP_SECTOR_SIZE;
+            Properties->Size = Disk->Size;
+            Status = STATUS_SUCCESS;
+        }
+
+        IoCompleteIrp(LoopDriver, Irp, Status);
+        break;
+
+    //
+    // Writes to the disk's properties are not allowed. Fail if the data
+    // has changed.
+    //
+
+    case IrpMinorSystemControlWriteFileProperties:
+        FileOperation = (PSYSTEM_CONTROL_FILE_OPERATION)Context;
+        Properties = FileOperation->FileProperties;
+        PropertiesFileSize = Properties->Size;
+        if ((Properties->FileId != 0) ||
+            (Properties->Type != IoObjectBlockDevice) ||
+            (Properties->HardLinkCount != 1) ||
+            (Properties->BlockSize != LOOP_SECTOR_SIZE) ||
+            (Properties->BlockCount != (Disk->Size / LOOP_SECTOR_SIZE)) ||
+            (PropertiesFileSize != Disk->Size)) {
+
+            Status = STATUS_NOT_SUPPORTED;
+
+        } else {
+            Status = STATUS_SUCCESS;
+        }
+
+        IoCompleteIrp(LoopDriver, Irp, Status);
+        break;
+
+    //
+    // The size of a loop device is fixed when it is created.
+    //
+
+    case IrpMinorSystemControlTruncate:
+        IoCompleteIrp(LoopDriver, Irp, STATUS_NOT_SUPPORTED);
+        break;
+
+    case IrpMinorSystemControlDeviceInformation:
+        LooppHandleDeviceInformationRequest(Irp, Disk);
+        break;
+
+    //
+    // Make sure whatever the backing file has cached (from unaligned
+    // requests or its file system's metadata) reaches its disk.
+    //
+
+    case IrpMinorSystemControlSynchronize:
+        Status = IoFlush(Disk->BackingHandle, 0, -1, 0);
+        IoCompleteIrp(LoopDriver, Irp, Status);
+        break;
+
+    //
+    // Ignore everything unrecognized.
+    //
+
+    default:
+
+        ASSERT(FALSE);
+
+        break;
+    }
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+LooppHandleControlInformationRequest (
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles requests to get and set the loop control device
+    information. Setting it creates a new loop device.
+
+Arguments:
+
+    Irp - Supplies a pointer to the system control IRP.
+
+Return Value:
+
+    None. The IRP is completed.
+
+--*/
+
+{
+
+    PLOOP_CONTROL_INFORMATION Information;
+    BOOL Match;
+    PSYSTEM_CONTROL_DEVICE_INFORMATION Request;
+    KSTATUS Status;
+
+    Request = Irp->U.SystemControl.SystemContext;
+    Match = RtlAreUuidsEqual(&(Request->Uuid), &LoopControlInformationUuid);
+    if (Match == FALSE) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto HandleControlInformationRequestEnd;
+    }
+
+    if (Request->DataSize < sizeof(LOOP_CONTROL_INFORMATION)) {
+        Request->DataSize = sizeof(LOOP_CONTROL_INFORMATION);
+        Status = STATUS_BUFFER_TOO_SMALL;
+        goto HandleControlInformationRequestEnd;
+    }
+
+    Request->DataSize = sizeof(LOOP_CONTROL_INFORMATION);
+    Information = Request->Data;
+    if (Request->Set == FALSE) {
+        RtlZeroMemory(Information, sizeof(LOOP_CONTROL_INFORMATION));
+        Information->Version = LOOP_CONTROL_INFORMATION_VERSION;
+        Status = STATUS_SUCCESS;
+        goto HandleControlInformationRequestEnd;
+    }
+
+    if (Information->Version < LOOP_CONTROL_INFORMATION_VERSION) {
+        Status = STATUS_VERSION_MISMATCH;
+        goto HandleControlInformationRequestEnd;
+    }
+
+    Status = PsCheckPermission(PERMISSION_SYSTEM_ADMINISTRATOR);
+    if (!KSUCCESS(Status)) {
+        goto HandleControlInformationRequestEnd;
+    }
+
+    Status = LooppCreateDisk(Information);
+
+HandleControlInformationRequestEnd:
+    IoCompleteIrp(LoopDriver, Irp, Status);
+    return;
+}
+
+VOID
+LooppHandleDeviceInformationRequest (
+    PIRP Irp,
+    PLOOP_DISK Disk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles requests to get and set device information for a
+    loop device.
+
+Arguments:
+
+    Irp - Supplies a pointer to the system control IRP.
+
+    Disk - Supplies a pointer to the loop device.
+
+Return Value:
+
+    None. The IRP is completed.
+
+--*/
+
+{
+
+    PLOOP_DEVICE_INFORMATION Information;
+    BOOL Match;
+    PSYSTEM_CONTROL_DEVICE_INFORMATION Request;
+    KSTATUS Status;
+
+    Request = Irp->U.SystemControl.SystemContext;
+    Match = RtlAreUuidsEqual(&(Request->Uuid), &LoopDeviceInformationUuid);
+    if (Match == FALSE) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto HandleDeviceInformationRequestEnd;
+    }
+
+    if (Request->DataSize < sizeof(LOOP_DEVICE_INFORMATION)) {
+        Request->DataSize = sizeof(LOOP_DEVICE_INFORMATION);
+        Status = STATUS_BUFFER_TOO_SMALL;
+        goto HandleDeviceInformationRequestEnd;
+    }
+
+    Request->DataSize = sizeof(LOOP_DEVICE_INFORMATION);
+    Information = Request->Data;
+
+    //
+    // The latency and bandwidth can be changed, and the device can be asked
+    // to go away.
+    //
+
+    if (Request->Set != FALSE) {
+        if (Information->Version < LOOP_DEVICE_INFORMATION_VERSION) {
+            Status = STATUS_VERSION_MISMATCH;
+            goto HandleDeviceInformationRequestEnd;
+        }
+
+        Status = PsCheckPermission(PERMISSION_SYSTEM_ADMINISTRATOR);
+        if (!KSUCCESS(Status)) {
+            goto HandleDeviceInformationRequestEnd;
+        }
+
+        if ((Information->Flags & LOOP_FLAG_DETACH) != 0) {
+            Status = IoRemoveUnreportedDevice(Disk->Device);
+            if (!KSUCCESS(Status)) {
+                goto HandleDeviceInformationRequestEnd;
+            }
+
+        } else {
+            Disk->Latency = Information->Latency;
+            KeAcquireQueuedLock(Disk->Lock);
+            Disk->Bandwidth = Information->Bandwidth;
+            KeReleaseQueuedLock(Disk->Lock);
+        }
+    }
+
+    RtlZeroMemory(Information, sizeof(LOOP_DEVICE_INFORMATION));
+    Information->Version = LOOP_DEVICE_INFORMATION_VERSION;
+    Information->Flags = Disk->Flags;
+    Information->Size = Disk->Size;
+    Information->Latency = Disk->Latency;
+    KeAcquireQueuedLock(Disk->Lock);
+    Information->Bandwidth = Disk->Bandwidth;
+    KeReleaseQueuedLock(Disk->Lock);
+    Status = STATUS_SUCCESS;
+
+HandleDeviceInformationRequestEnd:
+    IoCompleteIrp(LoopDriver, Irp, Status);
+    return;
+}
+
+KSTATUS
+LooppCreateDisk (
+    PLOOP_CONTROL_INFORMATION Information
+    )
+
+/*++
+
+Routine Description:
+
+    This routine opens the file named in the given control information and
+    creates a loop device on top of it. The file is opened on behalf of the
+    calling thread, so its permissions and root directory apply.
+
+Arguments:
+
+    Information - Supplies a pointer to the loop control information. The
+        device ID of the new loop device is returned here on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Access;
+    PIO_HANDLE BackingHandle;
+    PDEVICE Device;
+    CHAR DeviceId[LOOP_DEVICE_ID_SIZE];
+    PLOOP_DISK Disk;
+    ULONG Identifier;
+    ULONG PathLength;
+    FILE_PROPERTIES Properties;
+    KSTATUS Status;
+
+    BackingHandle = NULL;
+    Disk = NULL;
+    Information->DeviceId = 0;
+    if (Information->Path[LOOP_PATH_SIZE - 1] != '\0') {
+        Status = STATUS_NAME_TOO_LONG;
+        goto CreateDiskEnd;
+    }
+
+    PathLength = RtlStringLength(Information->Path) + 1;
+    if (PathLength == 1) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto CreateDiskEnd;
+    }
+
+    Access = IO_ACCESS_READ;
+    if ((Information->Flags & LOOP_FLAG_READ_ONLY) == 0) {
+        Access |= IO_ACCESS_WRITE;
+    }
+
+    Status = IoOpen(FALSE,
+                    NULL,
+                    Information->Path,
+                    PathLength,
+                    Access,
+                    OPEN_FLAG_DIRECT,
+                    0,
+                    &BackingHandle);
+
+    if (!KSUCCESS(Status)) {
+        goto CreateDiskEnd;
+    }
+
+    Status = IoGetFileInformation(BackingHandle, &Properties);
+    if (!KSUCCESS(Status)) {
+        goto CreateDiskEnd;
+    }
+
+    if (Properties.Type != IoObjectRegularFile) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto CreateDiskEnd;
+    }
+
+    Disk = MmAllocateNonPagedPool(sizeof(LOOP_DISK), LOOP_ALLOCATION_TAG);
+    if (Disk == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateDiskEnd;
+    }
+
+    RtlZeroMemory(Disk, sizeof(LOOP_DISK));
+    Disk->Type = LoopObjectDisk;
+    Disk->ReferenceCount = 1;
+    Disk->Flags = Information->Flags & LOOP_FLAG_READ_ONLY;
+    Disk->Size = ALIGN_RANGE_DOWN(Properties.Size, LOOP_SECTOR_SIZE);
+    if (Disk->Size == 0) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto CreateDiskEnd;
+    }
+
+    Disk->Lock = KeCreateQueuedLock();
+    if (Disk->Lock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateDiskEnd;
+    }
+
+    Disk->BackingHandle = BackingHandle;
+    BackingHandle = NULL;
+    Identifier = RtlAtomicAdd32(&LoopNextIdentifier, 1);
+    RtlPrintToString(DeviceId,
+                     LOOP_DEVICE_ID_SIZE,
+                     CharacterEncodingDefault,
+                     "Loop%x",
+                     Identifier);
+
+    //
+    // Create the loop device as a disk, so the partition driver picks it up
+    // and file systems can mount its partitions. The reference on the loop
+    // device is handed to the device, and dropped when it is removed.
+    //
+
+    Status = IoCreateDevice(LoopDriver,
+                            Disk,
+                            NULL,
+                            DeviceId,
+                            DISK_CLASS_ID,
+                            NULL,
+                            &Device);
+
+    if (!KSUCCESS(Status)) {
+        goto CreateDiskEnd;
+    }
+
+    Disk->Device = Device;
+    Information->DeviceId = IoGetDeviceNumericId(Device);
+    Disk = NULL;
+
+CreateDiskEnd:
+    if (BackingHandle != NULL) {
+        IoClose(BackingHandle);
+    }
+
+    if (Disk != NULL) {
+        LooppDiskReleaseReference(Disk);
+    }
+
+    return Status;
+}
+
+VOID
+LooppShapeIo (
+    PLOOP_DISK Disk,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine delays an I/O request to make the loop device look like a
+    slower disk. Each request first waits out the latency on its own. The
+    data transfer is then queued up behind all transfers already granted, so
+    that the bandwidth limit holds however many requests are in flight.
+
+Arguments:
+
+    Disk - Supplies a pointer to the loop device.
+
+    Size - Supplies the number of bytes the request transfers.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG Bandwidth;
+    ULONGLONG Current;
+    ULONGLONG Frequency;
+    ULONG Latency;
+    ULONGLONG TransferDone;
+
+    Latency = Disk->Latency;
+    if (Latency != 0) {
+        KeDelayExecution(FALSE, FALSE, Latency);
+    }
+
+    //
+    // Peek at the bandwidth without the lock, as it is almost always zero.
+    //
+
+    Bandwidth = Disk->Bandwidth;
+    if (Bandwidth == 0) {
+        return;
+    }
+
+    Frequency = HlQueryTimeCounterFrequency();
+    KeAcquireQueuedLock(Disk->Lock);
+    Bandwidth = Disk->Bandwidth;
+    if (Bandwidth == 0) {
+        KeReleaseQueuedLock(Disk->Lock);
+        return;
+    }
+
+    Current = HlQueryTimeCounter();
+    if (Disk->BusyUntil < Current) {
+        Disk->BusyUntil = Current;
+    }
+
+    Disk->BusyUntil += (Size * Frequency) / Bandwidth;
+    TransferDone = Disk->BusyUntil;
+    KeReleaseQueuedLock(Disk->Lock);
+    KeDelayExecution(FALSE, TRUE, TransferDone);
+    return;
+}
+
+VOID
+LooppDiskAddReference (
+    PLOOP_DISK Disk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a reference to a loop device.
+
+Arguments:
+
+    Disk - Supplies a pointer to the loop device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+
+    OldReferenceCount = RtlAtomicAdd32(&(Disk->ReferenceCount), 1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x10000000));
+
+    return;
+}
+
+VOID
+LooppDiskReleaseReference (
+    PLOOP_DISK Disk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a reference on a loop device. When the last
+    reference goes away, the backing file is closed and the loop device is
+    freed.
+
+Arguments:
+
+    Disk - Supplies a pointer to the loop device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+
+    OldReferenceCount = RtlAtomicAdd32(&(Disk->ReferenceCount), (ULONG)-1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x10000000));
+
+    if (OldReferenceCount != 1) {
+        return;
+    }
+
+    if (Disk->BackingHandle != NULL) {
+        IoClose(Disk->BackingHandle);
+    }
+
+    if (Disk->Lock != NULL) {
+        KeDestroyQueuedLock(Disk->Lock);
+    }
+
+    MmFreeNonPagedPool(Disk);
+    return;
+}
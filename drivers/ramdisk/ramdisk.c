@@ -36,6 +36,7 @@ Module Name:
 
 #include <minoca/kernel/driver.h>
 #include <minoca/kernel/sysres.h>
+#include <minoca/devinfo/ramdisk.h>
 
 //
 // ---------------------------------------------------------------- Definitions
@@ -66,12 +67,16 @@ Structure Description:
 
     Size - Stores the total size of the RAM disk, in bytes.
 
+    Latency - Stores the number of microseconds to wait before completing each
+        I/O request, used to test how the system copes with slow disks.
+
 --*/
 
 typedef struct _RAM_DISK_DEVICE {
     PHYSICAL_ADDRESS PhysicalAddress;
     PVOID Buffer;
     ULONGLONG Size;
+    volatile ULONG Latency;
 } RAM_DISK_DEVICE, *PRAM_DISK_DEVICE;
 
 //
@@ -122,6 +127,20 @@ RamDiskDispatchSystemControl (
     PVOID IrpContext
     );
 
+VOID
+RamDiskHandleDeviceInformationRequest (
+    PIRP Irp,
+    PRAM_DISK_DEVICE Disk
+    );
+
+BOOL
+RamDiskIsIoBufferInPlace (
+    PRAM_DISK_DEVICE Disk,
+    PIO_BUFFER IoBuffer,
+    IO_OFFSET IoOffset,
+    UINTN Size
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -138,6 +157,8 @@ PDRIVER RamDiskDriver = NULL;
 
 volatile ULONG RamDiskNextIdentifier = 0;
 
+UUID RamDiskDeviceInformationUuid = RAM_DISK_DEVICE_INFORMATION_UUID;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -352,7 +373,16 @@ Return Value:
             break;
 
         case IrpMinorStartDevice:
-            Status = STATUS_SUCCESS;
+
+            //
+            // Publish the RAM disk device information so its latency can be
+            // adjusted.
+            //
+
+            Status = IoRegisterDeviceInformation(Irp->Device,
+                                                 &RamDiskDeviceInformationUuid,
+                                                 TRUE);
+
             break;
 
         case IrpMinorQueryChildren:
@@ -520,6 +550,7 @@ Return Value:
     PRAM_DISK_DEVICE Disk;
     IO_OFFSET IoOffset;
     ULONG IrpReadWriteFlags;
+    ULONG Latency;
     BOOL ReadWriteIrpPrepared;
     KSTATUS Status;
     BOOL ToIoBuffer;
@@ -552,6 +583,38 @@ Return Value:
         IrpReadWriteFlags |= IRP_READ_WRITE_FLAG_WRITE;
     }
 
+    //
+    // Pretend to be a slower device if asked to. The latency lives in the
+    // device, not the per-open copy of the disk.
+    //
+
+    Latency = ((PRAM_DISK_DEVICE)DeviceContext)->Latency;
+    if (Latency != 0) {
+        KeDelayExecution(FALSE, FALSE, Latency);
+    }
+
+    //
+    // When filling the page cache, hand over the disk's own pages rather than
+    // a copy of them. The cache keeps them in place, so writes to the cached
+    // data land directly on the disk. If the buffer or range do not allow it,
+    // fall back to copying.
+    //
+
+    if ((ToIoBuffer != FALSE) &&
+        ((Irp->U.ReadWrite.IoFlags & IO_FLAG_CACHE_FILL) != 0) &&
+        (BytesToComplete == Irp->U.ReadWrite.IoSizeInBytes)) {
+
+        Status = MmIoBufferAppendDeviceMemory(Irp->U.ReadWrite.IoBuffer,
+                                              (PUCHAR)Disk->Buffer + IoOffset,
+                                              Disk->PhysicalAddress + IoOffset,
+                                              BytesToComplete);
+
+        if (KSUCCESS(Status)) {
+            Irp->U.ReadWrite.IoBytesCompleted = BytesToComplete;
+            goto DispatchIoEnd;
+        }
+    }
+
     //
     // Prepare the I/O buffer for polled I/O.
     //
@@ -569,17 +632,26 @@ Return Value:
     ReadWriteIrpPrepared = TRUE;
 
     //
-    // Transfer the data between the disk and I/O buffer.
+    // Transfer the data between the disk and I/O buffer. Flushing cached
+    // pages that were lent by this disk writes them onto themselves, so skip
+    // the copy in that case.
     //
 
-    Status = MmCopyIoBufferData(Irp->U.ReadWrite.IoBuffer,
-                                (PUCHAR)Disk->Buffer + IoOffset,
-                                0,
-                                BytesToComplete,
-                                ToIoBuffer);
+    if ((ToIoBuffer != FALSE) ||
+        (RamDiskIsIoBufferInPlace(Disk,
+                                  Irp->U.ReadWrite.IoBuffer,
+                                  IoOffset,
+                                  BytesToComplete) == FALSE)) {
 
-    if (!KSUCCESS(Status)) {
-        goto DispatchIoEnd;
+        Status = MmCopyIoBufferData(Irp->U.ReadWrite.IoBuffer,
+                                    (PUCHAR)Disk->Buffer + IoOffset,
+                                    0,
+                                    BytesToComplete,
+                                    ToIoBuffer);
+
+        if (!KSUCCESS(Status)) {
+            goto DispatchIoEnd;
+        }
     }
 
     Irp->U.ReadWrite.IoBytesCompleted = BytesToComplete;
@@ -658,7 +730,7 @@ Return Value:
             Properties->BlockSize = RAM_DISK_SECTOR_SIZE;
             Properties->BlockCount = Disk->Size / RAM_DISK_SECTOR_SIZE;
             Properties->Size = Disk->Size;
-            Lookup->Flags = LOOKUP_FLAG_NO_PAGE_CACHE;
+            Lookup->Flags = 0;
             Status = STATUS_SUCCESS;
         }
 
@@ -703,7 +775,7 @@ Return Value:
     //
 
     case IrpMinorSystemControlDeviceInformation:
-        IoCompleteIrp(RamDiskDriver, Irp, STATUS_NOT_SUPPORTED);
+        RamDiskHandleDeviceInformationRequest(Irp, Disk);
         break;
 
     case IrpMinorSystemControlSynchronize:
@@ -728,3 +800,151 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+VOID
+RamDiskHandleDeviceInformationRequest (
+    PIRP Irp,
+    PRAM_DISK_DEVICE Disk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles requests to get and set device information for the
+    RAM disk.
+
+Arguments:
+
+    Irp - Supplies a pointer to the system control IRP.
+
+    Disk - Supplies a pointer to the RAM disk device.
+
+Return Value:
+
+    None. The IRP is completed.
+
+--*/
+
+{
+
+    PRAM_DISK_DEVICE_INFORMATION Information;
+    BOOL Match;
+    PSYSTEM_CONTROL_DEVICE_INFORMATION Request;
+    KSTATUS Status;
+
+    Request = Irp->U.SystemControl.SystemContext;
+    Match = RtlAreUuidsEqual(&(Request->Uuid), &RamDiskDeviceInformationUuid);
+    if (Match == FALSE) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto HandleDeviceInformationRequestEnd;
+    }
+
+    if (Request->DataSize < sizeof(RAM_DISK_DEVICE_INFORMATION)) {
+        Request->DataSize = sizeof(RAM_DISK_DEVICE_INFORMATION);
+        Status = STATUS_BUFFER_TOO_SMALL;
+        goto HandleDeviceInformationRequestEnd;
+    }
+
+    Request->DataSize = sizeof(RAM_DISK_DEVICE_INFORMATION);
+    Information = Request->Data;
+
+    //
+    // Only the latency can be changed.
+    //
+
+    if (Request->Set != FALSE) {
+        if (Information->Version < RAM_DISK_DEVICE_INFORMATION_VERSION) {
+            Status = STATUS_VERSION_MISMATCH;
+            goto HandleDeviceInformationRequestEnd;
+        }
+
+        Status = PsCheckPermission(PERMISSION_SYSTEM_ADMINISTRATOR);
+        if (!KSUCCESS(Status)) {
+            goto HandleDeviceInformationRequestEnd;
+        }
+
+        Disk->Latency = Information->Latency;
+    }
+
+    RtlZeroMemory(Information, sizeof(RAM_DISK_DEVICE_INFORMATION));
+    Information->Version = RAM_DISK_DEVICE_INFORMATION_VERSION;
+    Information->Size = Disk->Size;
+    Information->Latency = Disk->Latency;
+    Status = STATUS_SUCCESS;
+
+HandleDeviceInformationRequestEnd:
+    IoCompleteIrp(RamDiskDriver, Irp, Status);
+    return;
+}
+
+BOOL
+RamDiskIsIoBufferInPlace (
+    PRAM_DISK_DEVICE Disk,
+    PIO_BUFFER IoBuffer,
+    IO_OFFSET IoOffset,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not the given I/O buffer is backed by
+    the disk's own memory at the given offset, which is the case when the page
+    cache writes back pages the disk lent it.
+
+Arguments:
+
+    Disk - Supplies a pointer to the RAM disk.
+
+    IoBuffer - Supplies a pointer to the validated I/O buffer.
+
+    IoOffset - Supplies the offset into the disk where the I/O starts.
+
+    Size - Supplies the number of bytes in the I/O.
+
+Return Value:
+
+    TRUE if the I/O buffer's memory is exactly the disk's memory for the range.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    UINTN BufferOffset;
+    PIO_BUFFER_FRAGMENT Fragment;
+    UINTN FragmentIndex;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    UINTN RunSize;
+
+    PhysicalAddress = Disk->PhysicalAddress + IoOffset;
+    BufferOffset = MmGetIoBufferCurrentOffset(IoBuffer);
+    for (FragmentIndex = 0;
+         FragmentIndex < IoBuffer->FragmentCount;
+         FragmentIndex += 1) {
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        if (BufferOffset >= Fragment->Size) {
+            BufferOffset -= Fragment->Size;
+            continue;
+        }
+
+        if ((Fragment->PhysicalAddress + BufferOffset) != PhysicalAddress) {
+            return FALSE;
+        }
+
+        RunSize = Fragment->Size - BufferOffset;
+        if (RunSize >= Size) {
+            return TRUE;
+        }
+
+        BufferOffset = 0;
+        PhysicalAddress += RunSize;
+        Size -= RunSize;
+    }
+
+    return FALSE;
+}
+
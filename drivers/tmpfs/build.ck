@@ -0,0 +1,50 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    TmpFs
+
+Abstract:
+
+    This module implements the temporary file system driver, which keeps file
+    contents in the page cache and the page file rather than on a disk.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+from menv import driver;
+
+function build() {
+    var drv;
+    var entries;
+    var name = "tmpfs";
+    var sources;
+
+    sources = [
+        "tmpfs.c",
+        "tmpnode.c"
+    ];
+
+    drv = {
+        "label": name,
+        "inputs": sources,
+    };
+
+    entries = driver(drv);
+    return entries;
+}
+
@@ -0,0 +1,1102 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    tmpfs.c
+
+Abstract:
+
+    This module implements the temporary file system driver. It keeps file
+    contents in the page cache and spills them to the page file under memory
+    pressure, so it never touches a block device.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include "tmpfsp.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define TMPFS_DEVICE_ID_SIZE 16
+
+//
+// Define the share of physical memory a volume is allowed to fill, as a
+// shift. Each volume may use up to half of memory by default.
+//
+
+#define TMPFS_CAPACITY_SHIFT 1
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+TmpFsAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    );
+
+VOID
+TmpFsDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpFsDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpFsDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpFsDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpFsDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpFspDispatchDeviceSystemControl (
+    PIRP Irp,
+    PTMPFS_DEVICE Device
+    );
+
+KSTATUS
+TmpFspCreateDevices (
+    PDRIVER Driver
+    );
+
+ULONGLONG
+TmpFspGetDefaultCapacity (
+    VOID
+    );
+
+VOID
+TmpFspVolumeAddReference (
+    PTMPFS_VOLUME Volume
+    );
+
+VOID
+TmpFspVolumeReleaseReference (
+    PTMPFS_VOLUME Volume
+    );
+
+VOID
+TmpFspDestroyVolume (
+    PTMPFS_VOLUME Volume
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+PDRIVER TmpFsDriver = NULL;
+
+//
+// Store the devices this driver created. Only volumes on these devices are
+// claimed.
+//
+
+PTMPFS_DEVICE TmpFsDevices[TMPFS_DEVICE_COUNT];
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+__USED
+KSTATUS
+DriverEntry (
+    PDRIVER Driver
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point for the temporary file system driver. It
+    registers its other dispatch functions, registers itself as a file
+    system, and creates the devices that the temporary volumes mount on.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver object.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code on error.
+
+--*/
+
+{
+
+    DRIVER_FUNCTION_TABLE FunctionTable;
+    KSTATUS Status;
+
+    TmpFsDriver = Driver;
+    RtlZeroMemory(&FunctionTable, sizeof(DRIVER_FUNCTION_TABLE));
+    FunctionTable.Version = DRIVER_FUNCTION_TABLE_VERSION;
+    FunctionTable.AddDevice = TmpFsAddDevice;
+    FunctionTable.DispatchStateChange = TmpFsDispatchStateChange;
+    FunctionTable.DispatchOpen = TmpFsDispatchOpen;
+    FunctionTable.DispatchClose = TmpFsDispatchClose;
+    FunctionTable.DispatchIo = TmpFsDispatchIo;
+    FunctionTable.DispatchSystemControl = TmpFsDispatchSystemControl;
+    Status = IoRegisterDriverFunctions(Driver, &FunctionTable);
+    if (!KSUCCESS(Status)) {
+        goto DriverEntryEnd;
+    }
+
+    Status = IoRegisterFileSystem(Driver);
+    if (!KSUCCESS(Status)) {
+        goto DriverEntryEnd;
+    }
+
+    Status = TmpFspCreateDevices(Driver);
+    if (!KSUCCESS(Status)) {
+        goto DriverEntryEnd;
+    }
+
+DriverEntryEnd:
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+TmpFsAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a volume is detected. The temporary file
+    system only attaches to volumes on top of its own devices.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver being called.
+
+    DeviceId - Supplies a pointer to a string with the device ID.
+
+    ClassId - Supplies a pointer to a string containing the device's class ID.
+
+    CompatibleIds - Supplies a pointer to a string containing device IDs
+        that would be compatible with this device.
+
+    DeviceToken - Supplies an opaque token that the driver can use to identify
+        the device in the system. This token should be used when attaching to
+        the stack.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code if the driver was unsuccessful in attaching itself.
+
+--*/
+
+{
+
+    ULONG Index;
+    KSTATUS Status;
+    PDEVICE TargetDevice;
+    PTMPFS_VOLUME Volume;
+
+    Volume = NULL;
+    TargetDevice = IoGetTargetDevice(DeviceToken);
+    for (Index = 0; Index < TMPFS_DEVICE_COUNT; Index += 1) {
+        if ((TmpFsDevices[Index] != NULL) &&
+            (TmpFsDevices[Index]->Device == TargetDevice)) {
+
+            break;
+        }
+    }
+
+    if (Index == TMPFS_DEVICE_COUNT) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto AddDeviceEnd;
+    }
+
+    Volume = MmAllocatePagedPool(sizeof(TMPFS_VOLUME), TMPFS_ALLOCATION_TAG);
+    if (Volume == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto AddDeviceEnd;
+    }
+
+    RtlZeroMemory(Volume, sizeof(TMPFS_VOLUME));
+    Volume->Type = TmpFsObjectVolume;
+    Volume->Capacity = TmpFspGetDefaultCapacity();
+    Volume->Lock = KeCreateQueuedLock();
+    if (Volume->Lock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto AddDeviceEnd;
+    }
+
+    Status = TmpFspInitializeVolume(Volume);
+    if (!KSUCCESS(Status)) {
+        goto AddDeviceEnd;
+    }
+
+    Status = IoAttachDriverToDevice(Driver, DeviceToken, Volume);
+    if (!KSUCCESS(Status)) {
+        goto AddDeviceEnd;
+    }
+
+    //
+    // Now that it has been fully initialized, mark it as attached and give it
+    // a reference of 1.
+    //
+
+    Volume->ReferenceCount = 1;
+    Volume->Attached = TRUE;
+
+AddDeviceEnd:
+    if (!KSUCCESS(Status)) {
+        if (Volume != NULL) {
+            TmpFspDestroyVolume(Volume);
+        }
+    }
+
+    return Status;
+}
+
+VOID
+TmpFsDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles State Change IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_OBJECT_TYPE Type;
+    PTMPFS_VOLUME Volume;
+
+    ASSERT(Irp->MajorCode == IrpMajorStateChange);
+
+    Type = DeviceContext;
+    if (Irp->Direction == IrpDown) {
+        switch (Irp->MinorCode) {
+        case IrpMinorQueryResources:
+        case IrpMinorStartDevice:
+            IoCompleteIrp(TmpFsDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        case IrpMinorQueryChildren:
+            Irp->U.QueryChildren.ChildCount = 0;
+            Irp->U.QueryChildren.Children = NULL;
+            IoCompleteIrp(TmpFsDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        //
+        // The devices are never removed. A volume releases the reference
+        // taken when it was attached. The system may still be holding on to
+        // the root path, in which case the last reference goes away when it
+        // closes.
+        //
+
+        case IrpMinorRemoveDevice:
+            if (*Type == TmpFsObjectVolume) {
+                Volume = DeviceContext;
+
+                ASSERT(Volume->Attached != FALSE);
+
+                Volume->Attached = FALSE;
+                TmpFspVolumeReleaseReference(Volume);
+            }
+
+            IoCompleteIrp(TmpFsDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return;
+}
+
+VOID
+TmpFsDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Open IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_NODE Node;
+    IO_OBJECT_TYPE ObjectType;
+    ULONG OpenFlags;
+    KSTATUS Status;
+    PTMPFS_OBJECT_TYPE Type;
+    PTMPFS_VOLUME Volume;
+
+    ASSERT(Irp->MajorCode == IrpMajorOpen);
+    ASSERT(Irp->MinorCode == IrpMinorOpen);
+
+    //
+    // The backing devices have no contents. Failing the open here also keeps
+    // other file systems from trying to mount them.
+    //
+
+    Type = DeviceContext;
+    if (*Type != TmpFsObjectVolume) {
+        IoCompleteIrp(TmpFsDriver, Irp, STATUS_NOT_SUPPORTED);
+        return;
+    }
+
+    Volume = DeviceContext;
+
+    ASSERT(Volume->Attached != FALSE);
+
+    //
+    // File contents only live in the page cache, so opens that bypass it
+    // would have nowhere to put the data. The page file cannot live here for
+    // the same reason.
+    //
+
+    ObjectType = Irp->U.Open.FileProperties->Type;
+    OpenFlags = Irp->U.Open.OpenFlags;
+    if (((OpenFlags & OPEN_FLAG_PAGE_FILE) != 0) ||
+        (((OpenFlags & OPEN_FLAG_NO_PAGE_CACHE) != 0) &&
+         ((ObjectType == IoObjectRegularFile) ||
+          (ObjectType == IoObjectSymbolicLink)))) {
+
+        Status = STATUS_NOT_SUPPORTED;
+        goto DispatchOpenEnd;
+    }
+
+    KeAcquireQueuedLock(Volume->Lock);
+    Node = TmpFspGetNode(Volume, Irp->U.Open.FileProperties->FileId);
+    KeReleaseQueuedLock(Volume->Lock);
+    if (Node == NULL) {
+        Status = STATUS_PATH_NOT_FOUND;
+        goto DispatchOpenEnd;
+    }
+
+    TmpFspVolumeAddReference(Volume);
+    Irp->U.Open.DeviceContext = Node;
+    Status = STATUS_SUCCESS;
+
+DispatchOpenEnd:
+    IoCompleteIrp(TmpFsDriver, Irp, Status);
+    return;
+}
+
+VOID
+TmpFsDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Close IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_VOLUME Volume;
+
+    ASSERT(Irp->MajorCode == IrpMajorClose);
+    ASSERT(Irp->MinorCode == IrpMinorClose);
+
+    Volume = DeviceContext;
+
+    ASSERT(Volume->Type == TmpFsObjectVolume);
+
+    TmpFspVolumeReleaseReference(Volume);
+    IoCompleteIrp(TmpFsDriver, Irp, STATUS_SUCCESS);
+    return;
+}
+
+VOID
+TmpFsDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles I/O IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+    PTMPFS_VOLUME Volume;
+    BOOL Write;
+
+    ASSERT(Irp->Direction == IrpDown);
+    ASSERT(Irp->MajorCode == IrpMajorIo);
+
+    Volume = DeviceContext;
+
+    ASSERT(Volume->Type == TmpFsObjectVolume);
+
+    if (Volume->Attached == FALSE) {
+        IoCompleteIrp(TmpFsDriver, Irp, STATUS_DEVICE_NOT_CONNECTED);
+        return;
+    }
+
+    Node = Irp->U.ReadWrite.DeviceContext;
+    Write = FALSE;
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        Write = TRUE;
+    }
+
+    ASSERT(Irp->U.ReadWrite.IoBuffer != NULL);
+
+    if (Node->Properties.Type == IoObjectRegularDirectory) {
+
+        //
+        // Directories cannot be written to directly.
+        //
+
+        if (Write != FALSE) {
+            Status = STATUS_ACCESS_DENIED;
+            goto DispatchIoEnd;
+        }
+
+        ASSERT(Irp->U.ReadWrite.IoOffset >= DIRECTORY_CONTENTS_OFFSET);
+
+        Status = TmpFspEnumerateDirectory(Volume,
+                                          Node,
+                                          Irp->U.ReadWrite.IoOffset,
+                                          Irp->U.ReadWrite.IoBuffer,
+                                          Irp->U.ReadWrite.IoSizeInBytes,
+                                          &(Irp->U.ReadWrite.IoBytesCompleted),
+                                          &(Irp->U.ReadWrite.NewIoOffset));
+
+        goto DispatchIoEnd;
+    }
+
+    Status = TmpFspPerformIo(Volume, Node, &(Irp->U.ReadWrite), Write);
+
+DispatchIoEnd:
+    IoCompleteIrp(TmpFsDriver, Irp, Status);
+    return;
+}
+
+VOID
+TmpFsDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID Context;
+    PSYSTEM_CONTROL_CREATE Create;
+    FILE_ID DirectoryFileId;
+    PSYSTEM_CONTROL_FILE_OPERATION FileOperation;
+    PSYSTEM_CONTROL_LOOKUP Lookup;
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+    PSYSTEM_CONTROL_TRUNCATE Truncate;
+    PTMPFS_OBJECT_TYPE Type;
+    PSYSTEM_CONTROL_UNLINK Unlink;
+    PTMPFS_VOLUME Volume;
+
+    Type = DeviceContext;
+    if (*Type == TmpFsObjectDevice) {
+        TmpFspDispatchDeviceSystemControl(Irp, DeviceContext);
+        return;
+    }
+
+    Volume = DeviceContext;
+
+    ASSERT(Volume->Type == TmpFsObjectVolume);
+    ASSERT(Volume->Attached != FALSE);
+
+    Context = Irp->U.SystemControl.SystemContext;
+    switch (Irp->MinorCode) {
+
+    //
+    // Search for a file within a directory.
+    //
+
+    case IrpMinorSystemControlLookup:
+        Lookup = (PSYSTEM_CONTROL_LOOKUP)Context;
+        DirectoryFileId = 0;
+        if (Lookup->DirectoryProperties != NULL) {
+
+            //
+            // The system shouldn't be allowing look-ups on directories that
+            // don't have any hard links.
+            //
+
+            ASSERT(Lookup->DirectoryProperties->HardLinkCount != 0);
+
+            DirectoryFileId = Lookup->DirectoryProperties->FileId;
+        }
+
+        Status = TmpFspLookup(Volume,
+                              Lookup->Root,
+                              DirectoryFileId,
+                              Lookup->FileName,
+                              Lookup->FileNameSize,
+                              Lookup->Properties,
+                              &(Lookup->Flags));
+
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    //
+    // Create a new file.
+    //
+
+    case IrpMinorSystemControlCreate:
+        Create = (PSYSTEM_CONTROL_CREATE)Context;
+
+        ASSERT(Create->DirectoryProperties->HardLinkCount != 0);
+
+        Status = TmpFspCreate(Volume,
+                              Create->DirectoryProperties->FileId,
+                              Create->Name,
+                              Create->NameSize,
+                              &(Create->FileProperties),
+                              &(Create->Flags));
+
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    //
+    // Free the node now that the system can no longer reference it.
+    //
+
+    case IrpMinorSystemControlDelete:
+        FileOperation = (PSYSTEM_CONTROL_FILE_OPERATION)Context;
+
+        ASSERT(FileOperation->FileProperties->HardLinkCount == 0);
+        ASSERT(FileOperation->FileProperties->FileId != TMPFS_ROOT_FILE_ID);
+
+        Status = TmpFspDelete(Volume, FileOperation->FileProperties->FileId);
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    //
+    // Save the file properties so they can be handed back on the next lookup.
+    //
+
+    case IrpMinorSystemControlWriteFileProperties:
+        FileOperation = (PSYSTEM_CONTROL_FILE_OPERATION)Context;
+        Status = TmpFspWriteFileProperties(Volume,
+                                           FileOperation->FileProperties);
+
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    //
+    // Remove the given file or empty directory from its directory.
+    //
+
+    case IrpMinorSystemControlUnlink:
+        Unlink = (PSYSTEM_CONTROL_UNLINK)Context;
+
+        ASSERT(Unlink->FileProperties->FileId != TMPFS_ROOT_FILE_ID);
+
+        Status = TmpFspUnlink(Volume,
+                              Unlink->DirectoryProperties->FileId,
+                              Unlink->FileProperties->FileId,
+                              Unlink->Name,
+                              Unlink->NameSize,
+                              &(Unlink->Unlinked));
+
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    //
+    // Rename a file or directory.
+    //
+
+    case IrpMinorSystemControlRename:
+        Status = TmpFspRename(Volume, (PSYSTEM_CONTROL_RENAME)Context);
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    //
+    // Truncate the file. The system shouldn't pass directories down for
+    // truncation.
+    //
+
+    case IrpMinorSystemControlTruncate:
+        Truncate = (PSYSTEM_CONTROL_TRUNCATE)Context;
+
+        ASSERT(Truncate->FileProperties->Type != IoObjectRegularDirectory);
+        ASSERT(Truncate->DeviceContext != NULL);
+
+        Node = Truncate->DeviceContext;
+        Status = TmpFspTruncate(Volume, Node, Truncate->NewSize);
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    //
+    // There are no blocks to report, and nothing to synchronize. Ignore
+    // everything else.
+    //
+
+    default:
+        break;
+    }
+
+    return;
+}
+
+VOID
+TmpFspDispatchDeviceSystemControl (
+    PIRP Irp,
+    PTMPFS_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs sent to one of the backing
+    devices, rather than to a volume.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Device - Supplies a pointer to the device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PSYSTEM_CONTROL_LOOKUP Lookup;
+    PFILE_PROPERTIES Properties;
+    KSTATUS Status;
+
+    ASSERT(Device->Type == TmpFsObjectDevice);
+
+    switch (Irp->MinorCode) {
+
+    //
+    // Let the device be opened as an empty block device. This is what lets it
+    // be the target of a mount.
+    //
+
+    case IrpMinorSystemControlLookup:
+        Lookup = (PSYSTEM_CONTROL_LOOKUP)Irp->U.SystemControl.SystemContext;
+        Status = STATUS_PATH_NOT_FOUND;
+        if (Lookup->Root != FALSE) {
+            Properties = Lookup->Properties;
+            Properties->FileId = 0;
+            Properties->Type = IoObjectBlockDevice;
+            Properties->HardLinkCount = 1;
+            Properties->BlockSize = MmPageSize();
+            Properties->BlockCount = 0;
+            Properties->Size = 0;
+            Lookup->Flags = LOOKUP_FLAG_NO_PAGE_CACHE;
+            Status = STATUS_SUCCESS;
+        }
+
+        IoCompleteIrp(TmpFsDriver, Irp, Status);
+        break;
+
+    //
+    // There are no properties to save.
+    //
+
+    case IrpMinorSystemControlWriteFileProperties:
+        IoCompleteIrp(TmpFsDriver, Irp, STATUS_SUCCESS);
+        break;
+
+    default:
+        break;
+    }
+
+    return;
+}
+
+KSTATUS
+TmpFspCreateDevices (
+    PDRIVER Driver
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the devices that temporary volumes mount on and
+    marks them mountable, so that volumes get created for them once they
+    start.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver object.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    CHAR DeviceId[TMPFS_DEVICE_ID_SIZE];
+    ULONG Index;
+    PDEVICE NewDevice;
+    KSTATUS Status;
+    PTMPFS_DEVICE TmpDevice;
+
+    Status = STATUS_SUCCESS;
+    for (Index = 0; Index < TMPFS_DEVICE_COUNT; Index += 1) {
+        TmpDevice = MmAllocateNonPagedPool(sizeof(TMPFS_DEVICE),
+                                           TMPFS_ALLOCATION_TAG);
+
+        if (TmpDevice == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        RtlZeroMemory(TmpDevice, sizeof(TMPFS_DEVICE));
+        TmpDevice->Type = TmpFsObjectDevice;
+        RtlPrintToString(DeviceId,
+                         TMPFS_DEVICE_ID_SIZE,
+                         CharacterEncodingDefault,
+                         "TmpFs%d",
+                         Index);
+
+        Status = IoCreateDevice(Driver,
+                                TmpDevice,
+                                NULL,
+                                DeviceId,
+                                TMPFS_CLASS_ID,
+                                NULL,
+                                &NewDevice);
+
+        if (!KSUCCESS(Status)) {
+            MmFreeNonPagedPool(TmpDevice);
+            break;
+        }
+
+        TmpDevice->Device = NewDevice;
+        TmpFsDevices[Index] = TmpDevice;
+        IoSetDeviceMountable(NewDevice);
+    }
+
+    return Status;
+}
+
+ULONGLONG
+TmpFspGetDefaultCapacity (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines how much file data a new volume may hold.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the capacity of a new volume, in bytes.
+
+--*/
+
+{
+
+    UINTN Size;
+    MM_STATISTICS Statistics;
+    KSTATUS Status;
+
+    RtlZeroMemory(&Statistics, sizeof(MM_STATISTICS));
+    Statistics.Version = MM_STATISTICS_VERSION;
+    Size = sizeof(MM_STATISTICS);
+    Status = KeGetSetSystemInformation(SystemInformationMm,
+                                       MmInformationSystemMemory,
+                                       &Statistics,
+                                       &Size,
+                                       FALSE);
+
+    if (!KSUCCESS(Status)) {
+        return 0;
+    }
+
+    return ((ULONGLONG)Statistics.PhysicalPages * Statistics.PageSize) >>
+           TMPFS_CAPACITY_SHIFT;
+}
+
+VOID
+TmpFspVolumeAddReference (
+    PTMPFS_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine increments the reference count on the given volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume whose reference count should be
+        incremented.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+
+    OldReferenceCount = RtlAtomicAdd32(&(Volume->ReferenceCount), 1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x30000000));
+
+    return;
+}
+
+VOID
+TmpFspVolumeReleaseReference (
+    PTMPFS_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine decrements the reference count on the given volume, and
+    destroys it if it hits zero.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume whose reference count should be
+        decremented.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+
+    OldReferenceCount = RtlAtomicAdd32(&(Volume->ReferenceCount), -1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x30000000));
+
+    if (OldReferenceCount == 1) {
+
+        ASSERT(Volume->Attached == FALSE);
+
+        TmpFspDestroyVolume(Volume);
+    }
+
+    return;
+}
+
+VOID
+TmpFspDestroyVolume (
+    PTMPFS_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys the given volume and everything on it.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume that is to be destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    TmpFspDestroyVolumeNodes(Volume);
+    if (Volume->Lock != NULL) {
+        KeDestroyQueuedLock(Volume->Lock);
+    }
+
+    MmFreePagedPool(Volume);
+    return;
+}
+
@@ -0,0 +1,672 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    tmpfsp.h
+
+Abstract:
+
+    This header contains internal definitions for the temporary file system
+    driver.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define TMPFS_ALLOCATION_TAG 0x46706D54 // 'FpmT'
+
+//
+// Define the number of temporary file system devices created at boot, one for
+// /tmp and one for /run.
+//
+
+#define TMPFS_DEVICE_COUNT 2
+
+//
+// Define the class ID of the temporary file system devices.
+//
+
+#define TMPFS_CLASS_ID "TmpFs"
+
+//
+// Define the file ID of the root directory of every volume.
+//
+
+#define TMPFS_ROOT_FILE_ID 1
+
+//
+// Define the longest allowed file name, not including the null terminator.
+//
+
+#define TMPFS_MAX_NAME_LENGTH 255
+
+//
+// Define the maximum size of a backing region in the page file. This keeps a
+// large file from needing a huge contiguous chunk of the page file just to
+// page out a few pages. Do not increase this beyond 128KB so that the
+// region's dirty bitmap can remain one ULONG.
+//
+
+#define TMPFS_MAX_BACKING_REGION_SIZE _128KB
+
+//
+// Define the parameters of the directory hash tables. Small directories are
+// searched linearly. Once a directory grows beyond the threshold it gets a
+// hash table, which doubles whenever the load factor is exceeded.
+//
+
+#define TMPFS_HASH_THRESHOLD 8
+#define TMPFS_HASH_MINIMUM_SIZE 16
+#define TMPFS_HASH_LOAD_FACTOR 2
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _TMPFS_OBJECT_TYPE {
+    TmpFsObjectInvalid,
+    TmpFsObjectDevice,
+    TmpFsObjectVolume
+} TMPFS_OBJECT_TYPE, *PTMPFS_OBJECT_TYPE;
+
+typedef struct _TMPFS_NODE TMPFS_NODE, *PTMPFS_NODE;
+
+/*++
+
+Structure Description:
+
+    This structure stores information about a temporary file system device.
+    These devices have no contents of their own, they only exist so that the
+    system has something to mount a volume on.
+
+Members:
+
+    Type - Stores the object type, which is always TmpFsObjectDevice.
+
+    Device - Stores a pointer to the OS device object.
+
+--*/
+
+typedef struct _TMPFS_DEVICE {
+    TMPFS_OBJECT_TYPE Type;
+    PDEVICE Device;
+} TMPFS_DEVICE, *PTMPFS_DEVICE;
+
+/*++
+
+Structure Description:
+
+    This structure stores information about a temporary file system volume.
+
+Members:
+
+    Type - Stores the object type, which is always TmpFsObjectVolume.
+
+    Attached - Stores a boolean indicating whether the volume is attached.
+
+    ReferenceCount - Stores the reference count of the volume.
+
+    Lock - Stores a pointer to the lock that protects the node tree, the
+        directory contents, the cached node properties, and the usage count.
+
+    NodeTree - Stores the tree of all nodes on the volume, keyed by file ID.
+
+    NextFileId - Stores the file ID to hand out to the next new node.
+
+    RootNode - Stores a pointer to the root directory node.
+
+    Capacity - Stores the maximum number of bytes of file data the volume can
+        hold.
+
+    Usage - Stores the number of bytes of file data currently charged to the
+        volume.
+
+--*/
+
+typedef struct _TMPFS_VOLUME {
+    TMPFS_OBJECT_TYPE Type;
+    BOOL Attached;
+    volatile ULONG ReferenceCount;
+    PQUEUED_LOCK Lock;
+    RED_BLACK_TREE NodeTree;
+    FILE_ID NextFileId;
+    PTMPFS_NODE RootNode;
+    ULONGLONG Capacity;
+    ULONGLONG Usage;
+} TMPFS_VOLUME, *PTMPFS_VOLUME;
+
+/*++
+
+Structure Description:
+
+    This structure stores a name within a temporary file system directory.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous entries in the
+        directory, in the order they were added.
+
+    HashListEntry - Stores pointers to the next and previous entries in the
+        same hash bucket. This is unused if the directory has no hash table.
+
+    Directory - Stores a pointer to the directory node containing the entry.
+
+    Node - Stores a pointer to the node the entry refers to.
+
+    Offset - Stores the directory offset of this entry. Offsets only grow, so
+        enumeration can resume after entries are added or removed.
+
+    Hash - Stores the hash of the name.
+
+    NameSize - Stores the size of the name in bytes, including the null
+        terminator.
+
+    Name - Stores the null terminated name, which is allocated along with the
+        entry.
+
+--*/
+
+typedef struct _TMPFS_DIRECTORY_ENTRY {
+    LIST_ENTRY ListEntry;
+    LIST_ENTRY HashListEntry;
+    PTMPFS_NODE Directory;
+    PTMPFS_NODE Node;
+    IO_OFFSET Offset;
+    ULONG Hash;
+    ULONG NameSize;
+    CHAR Name[ANYSIZE_ARRAY];
+} TMPFS_DIRECTORY_ENTRY, *PTMPFS_DIRECTORY_ENTRY;
+
+/*++
+
+Structure Description:
+
+    This structure defines a region of the page file that holds pages of a
+    file that were evicted from the page cache.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous backing regions of
+        the file, in file offset order.
+
+    ImageBacking - Stores the page file space for the region.
+
+    Offset - Stores the file offset where this backing region starts.
+
+    Size - Stores the size of the region, in bytes.
+
+    DirtyBitmap - Stores a bitmap of which pages in the region have actually
+        been written to the page file. Clean pages cannot be read from, as
+        they would hand back uninitialized data.
+
+--*/
+
+typedef struct _TMPFS_BACKING_REGION {
+    LIST_ENTRY ListEntry;
+    IMAGE_BACKING ImageBacking;
+    IO_OFFSET Offset;
+    ULONG Size;
+    ULONG DirtyBitmap;
+} TMPFS_BACKING_REGION, *PTMPFS_BACKING_REGION;
+
+/*++
+
+Structure Description:
+
+    This structure stores a file, directory, or symbolic link on a temporary
+    file system volume. The contents of files and symbolic links live in the
+    page cache; pages only land in the page file when the page cache evicts
+    them.
+
+Members:
+
+    TreeNode - Stores the node's entry in the volume's node tree.
+
+    Properties - Stores the most recently written properties of the node.
+
+    Entry - Stores a pointer to the directory entry naming this node, or NULL
+        if the node has been unlinked (or is the root).
+
+    ChargedSize - Stores the number of bytes charged against the volume's
+        capacity on behalf of this node.
+
+    Lock - Stores a pointer to the lock that protects the backing region list.
+        Directories do not have one.
+
+    RegionList - Stores the head of the list of page file backing regions.
+
+    EntryList - Stores the head of the list of directory entries, in offset
+        order. This is only used for directories.
+
+    HashTable - Stores an optional array of hash buckets indexing the
+        directory entries by name.
+
+    HashTableSize - Stores the number of buckets in the hash table. This is
+        always a power of two.
+
+    EntryCount - Stores the number of entries in the directory.
+
+    NextOffset - Stores the directory offset to give the next entry added.
+
+--*/
+
+struct _TMPFS_NODE {
+    RED_BLACK_TREE_NODE TreeNode;
+    FILE_PROPERTIES Properties;
+    PTMPFS_DIRECTORY_ENTRY Entry;
+    ULONGLONG ChargedSize;
+    PQUEUED_LOCK Lock;
+    LIST_ENTRY RegionList;
+    LIST_ENTRY EntryList;
+    PLIST_ENTRY HashTable;
+    ULONG HashTableSize;
+    ULONG EntryCount;
+    IO_OFFSET NextOffset;
+};
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+KSTATUS
+TmpFspInitializeVolume (
+    PTMPFS_VOLUME Volume
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates the root directory of a new, empty volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the zeroed volume, whose lock has already
+        been created.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VOID
+TmpFspDestroyVolumeNodes (
+    PTMPFS_VOLUME Volume
+    );
+
+/*++
+
+Routine Description:
+
+    This routine destroys every node on the given volume. The volume must not
+    be in use.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume to empty.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+TmpFspLookup (
+    PTMPFS_VOLUME Volume,
+    BOOL Root,
+    FILE_ID DirectoryFileId,
+    PCSTR Name,
+    ULONG NameSize,
+    PFILE_PROPERTIES Properties,
+    PULONG Flags
+    );
+
+/*++
+
+Routine Description:
+
+    This routine looks up a name within a directory.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Root - Supplies a boolean indicating if the root directory is being looked
+        up, in which case the remaining parameters are ignored.
+
+    DirectoryFileId - Supplies the file ID of the directory to search.
+
+    Name - Supplies a pointer to the name, which may not be null terminated.
+
+    NameSize - Supplies the size of the name buffer including space for a null
+        terminator.
+
+    Properties - Supplies a pointer where the file properties are returned on
+        success.
+
+    Flags - Supplies a pointer where the lookup flags for the file are
+        returned. See LOOKUP_FLAG_* definitions.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_PATH_NOT_FOUND if the name does not exist in the directory.
+
+--*/
+
+KSTATUS
+TmpFspCreate (
+    PTMPFS_VOLUME Volume,
+    FILE_ID DirectoryFileId,
+    PCSTR Name,
+    ULONG NameSize,
+    PFILE_PROPERTIES Properties,
+    PULONG Flags
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a new file, directory, or symbolic link.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    DirectoryFileId - Supplies the file ID of the directory to create the new
+        node in.
+
+    Name - Supplies a pointer to the name, which may not be null terminated.
+
+    NameSize - Supplies the size of the name buffer including space for a null
+        terminator.
+
+    Properties - Supplies a pointer to the properties of the new node. On
+        success, the file ID and size information is filled in.
+
+    Flags - Supplies a pointer where the lookup flags for the new file are
+        returned. See LOOKUP_FLAG_* definitions.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+TmpFspUnlink (
+    PTMPFS_VOLUME Volume,
+    FILE_ID DirectoryFileId,
+    FILE_ID FileId,
+    PCSTR Name,
+    ULONG NameSize,
+    PBOOL Unlinked
+    );
+
+/*++
+
+Routine Description:
+
+    This routine removes a name from a directory. The node itself lives on
+    until the system sends a delete request.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    DirectoryFileId - Supplies the file ID of the directory containing the
+        name.
+
+    FileId - Supplies the file ID of the node being unlinked.
+
+    Name - Supplies a pointer to the name, which may not be null terminated.
+
+    NameSize - Supplies the size of the name buffer including space for a null
+        terminator.
+
+    Unlinked - Supplies a pointer where a boolean is returned indicating
+        whether the name was removed.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+TmpFspRename (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_RENAME Rename
+    );
+
+/*++
+
+Routine Description:
+
+    This routine moves a name from one directory entry to another, replacing
+    whatever was at the destination.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Rename - Supplies a pointer to the rename request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+TmpFspWriteFileProperties (
+    PTMPFS_VOLUME Volume,
+    PFILE_PROPERTIES Properties
+    );
+
+/*++
+
+Routine Description:
+
+    This routine saves new file properties for a node.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Properties - Supplies a pointer to the new properties.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+TmpFspDelete (
+    PTMPFS_VOLUME Volume,
+    FILE_ID FileId
+    );
+
+/*++
+
+Routine Description:
+
+    This routine destroys a node that has no more links and is no longer in
+    use, releasing its page file space and its charge against the volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    FileId - Supplies the file ID of the node to destroy.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+TmpFspTruncate (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    ULONGLONG NewSize
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets the size of a file, charging the volume for growth and
+    releasing any page file space beyond a smaller size.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Node - Supplies a pointer to the file's node.
+
+    NewSize - Supplies the new file size.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_VOLUME_FULL if growing the file would exceed the volume capacity.
+
+--*/
+
+PTMPFS_NODE
+TmpFspGetNode (
+    PTMPFS_VOLUME Volume,
+    FILE_ID FileId
+    );
+
+/*++
+
+Routine Description:
+
+    This routine finds the node with the given file ID.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    FileId - Supplies the file ID to look up.
+
+Return Value:
+
+    Returns a pointer to the node on success.
+
+    NULL if no node has the given file ID.
+
+--*/
+
+KSTATUS
+TmpFspEnumerateDirectory (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Directory,
+    IO_OFFSET Offset,
+    PIO_BUFFER IoBuffer,
+    UINTN BufferSize,
+    PUINTN BytesCompleted,
+    PIO_OFFSET NewOffset
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads directory entries out of a directory.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Directory - Supplies a pointer to the directory node.
+
+    Offset - Supplies the directory offset to start reading at.
+
+    IoBuffer - Supplies a pointer to the buffer to fill with DIRECTORY_ENTRY
+        structures.
+
+    BufferSize - Supplies the size of the buffer in bytes.
+
+    BytesCompleted - Supplies a pointer that on input contains the number of
+        bytes of the buffer already used. On output, contains the updated
+        number of bytes used.
+
+    NewOffset - Supplies a pointer where the directory offset to resume at is
+        returned.
+
+Return Value:
+
+    STATUS_SUCCESS if the end of the directory was reached.
+
+    STATUS_MORE_PROCESSING_REQUIRED if the buffer filled up first.
+
+    STATUS_END_OF_FILE if there were no entries to read at all.
+
+--*/
+
+KSTATUS
+TmpFspPerformIo (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    PIRP_READ_WRITE ReadWrite,
+    BOOL Write
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads or writes the contents of a file or symbolic link.
+    Soft writes only charge the volume for the space, as the data stays in
+    the page cache. Hard flushes push evicted pages out to the page file, and
+    reads bring them back in.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Node - Supplies a pointer to the file's node.
+
+    ReadWrite - Supplies a pointer to the I/O request parameters. The bytes
+        completed and new offset are filled in.
+
+    Write - Supplies a boolean indicating whether this is a write (TRUE) or a
+        read (FALSE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
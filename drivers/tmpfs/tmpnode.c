@@ -0,0 +1,2199 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    tmpnode.c
+
+Abstract:
+
+    This module implements the files, directories, and backing storage of the
+    temporary file system.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include "tmpfsp.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the permissions of a volume's root directory: everyone can create
+// files, but only owners can delete them.
+//
+
+#define TMPFS_ROOT_PERMISSIONS \
+    (FILE_PERMISSION_ALL | FILE_PERMISSION_RESTRICTED)
+
+//
+// This macro returns a mask of the given number of low pages in a backing
+// region's dirty bitmap. A full region covers all 32 bits.
+//
+
+#define TMPFS_PAGE_MASK(_PageCount) \
+    (((_PageCount) >= 32) ? MAX_ULONG : ((1UL << (_PageCount)) - 1))
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+PTMPFS_NODE
+TmpFspCreateNode (
+    PTMPFS_VOLUME Volume,
+    PFILE_PROPERTIES Properties
+    );
+
+VOID
+TmpFspDestroyNode (
+    PTMPFS_NODE Node
+    );
+
+VOID
+TmpFspGetNodeProperties (
+    PTMPFS_NODE Node,
+    PFILE_PROPERTIES Properties,
+    PULONG Flags
+    );
+
+KSTATUS
+TmpFspChargeNode (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    ULONGLONG NewSize
+    );
+
+KSTATUS
+TmpFspGetNameLength (
+    PCSTR Name,
+    ULONG NameSize,
+    PULONG Length
+    );
+
+PTMPFS_DIRECTORY_ENTRY
+TmpFspCreateDirectoryEntry (
+    PCSTR Name,
+    ULONG Length
+    );
+
+PTMPFS_DIRECTORY_ENTRY
+TmpFspFindDirectoryEntry (
+    PTMPFS_NODE Directory,
+    PCSTR Name,
+    ULONG Length
+    );
+
+VOID
+TmpFspInsertDirectoryEntry (
+    PTMPFS_NODE Directory,
+    PTMPFS_DIRECTORY_ENTRY Entry,
+    PTMPFS_NODE Node
+    );
+
+VOID
+TmpFspRemoveDirectoryEntry (
+    PTMPFS_DIRECTORY_ENTRY Entry
+    );
+
+KSTATUS
+TmpFspResizeHashTable (
+    PTMPFS_NODE Directory,
+    ULONG NewSize
+    );
+
+PTMPFS_BACKING_REGION
+TmpFspCreateBackingRegion (
+    PTMPFS_NODE Node,
+    IO_OFFSET Offset,
+    PTMPFS_BACKING_REGION NextRegion
+    );
+
+VOID
+TmpFspDestroyBackingRegion (
+    PTMPFS_BACKING_REGION Region
+    );
+
+COMPARISON_RESULT
+TmpFspCompareNodes (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+TmpFspInitializeVolume (
+    PTMPFS_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the root directory of a new, empty volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the zeroed volume, whose lock has already
+        been created.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    FILE_PROPERTIES Properties;
+
+    RtlRedBlackTreeInitialize(&(Volume->NodeTree), 0, TmpFspCompareNodes);
+    RtlZeroMemory(&Properties, sizeof(FILE_PROPERTIES));
+    Properties.FileId = TMPFS_ROOT_FILE_ID;
+    Properties.Type = IoObjectRegularDirectory;
+    Properties.Permissions = TMPFS_ROOT_PERMISSIONS;
+    Properties.HardLinkCount = 1;
+    KeGetSystemTime(&(Properties.StatusChangeTime));
+    RtlCopyMemory(&(Properties.ModifiedTime),
+                  &(Properties.StatusChangeTime),
+                  sizeof(SYSTEM_TIME));
+
+    RtlCopyMemory(&(Properties.AccessTime),
+                  &(Properties.StatusChangeTime),
+                  sizeof(SYSTEM_TIME));
+
+    RtlCopyMemory(&(Properties.CreationTime),
+                  &(Properties.StatusChangeTime),
+                  sizeof(SYSTEM_TIME));
+
+    Volume->RootNode = TmpFspCreateNode(Volume, &Properties);
+    if (Volume->RootNode == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Volume->NextFileId = TMPFS_ROOT_FILE_ID + 1;
+    return STATUS_SUCCESS;
+}
+
+VOID
+TmpFspDestroyVolumeNodes (
+    PTMPFS_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys every node on the given volume. The volume must not
+    be in use.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume to empty.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_NODE Node;
+    PRED_BLACK_TREE_NODE TreeNode;
+
+    //
+    // A volume that failed to initialize may never have set up its tree.
+    //
+
+    if (Volume->RootNode == NULL) {
+        return;
+    }
+
+    while (TRUE) {
+        TreeNode = RtlRedBlackTreeGetLowestNode(&(Volume->NodeTree));
+        if (TreeNode == NULL) {
+            break;
+        }
+
+        RtlRedBlackTreeRemove(&(Volume->NodeTree), TreeNode);
+        Node = RED_BLACK_TREE_VALUE(TreeNode, TMPFS_NODE, TreeNode);
+        TmpFspDestroyNode(Node);
+    }
+
+    Volume->RootNode = NULL;
+    Volume->Usage = 0;
+    return;
+}
+
+KSTATUS
+TmpFspLookup (
+    PTMPFS_VOLUME Volume,
+    BOOL Root,
+    FILE_ID DirectoryFileId,
+    PCSTR Name,
+    ULONG NameSize,
+    PFILE_PROPERTIES Properties,
+    PULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up a name within a directory.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Root - Supplies a boolean indicating if the root directory is being looked
+        up, in which case the remaining parameters are ignored.
+
+    DirectoryFileId - Supplies the file ID of the directory to search.
+
+    Name - Supplies a pointer to the name, which may not be null terminated.
+
+    NameSize - Supplies the size of the name buffer including space for a null
+        terminator.
+
+    Properties - Supplies a pointer where the file properties are returned on
+        success.
+
+    Flags - Supplies a pointer where the lookup flags for the file are
+        returned. See LOOKUP_FLAG_* definitions.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_PATH_NOT_FOUND if the name does not exist in the directory.
+
+--*/
+
+{
+
+    PTMPFS_NODE Directory;
+    PTMPFS_DIRECTORY_ENTRY Entry;
+    ULONG Length;
+    KSTATUS Status;
+
+    KeAcquireQueuedLock(Volume->Lock);
+    if (Root != FALSE) {
+        TmpFspGetNodeProperties(Volume->RootNode, Properties, Flags);
+        Status = STATUS_SUCCESS;
+        goto LookupEnd;
+    }
+
+    Status = TmpFspGetNameLength(Name, NameSize, &Length);
+    if (!KSUCCESS(Status)) {
+        goto LookupEnd;
+    }
+
+    Directory = TmpFspGetNode(Volume, DirectoryFileId);
+    if ((Directory == NULL) ||
+        (Directory->Properties.Type != IoObjectRegularDirectory)) {
+
+        Status = STATUS_PATH_NOT_FOUND;
+        goto LookupEnd;
+    }
+
+    Entry = TmpFspFindDirectoryEntry(Directory, Name, Length);
+    if (Entry == NULL) {
+        Status = STATUS_PATH_NOT_FOUND;
+        goto LookupEnd;
+    }
+
+    TmpFspGetNodeProperties(Entry->Node, Properties, Flags);
+    Status = STATUS_SUCCESS;
+
+LookupEnd:
+    KeReleaseQueuedLock(Volume->Lock);
+    return Status;
+}
+
+KSTATUS
+TmpFspCreate (
+    PTMPFS_VOLUME Volume,
+    FILE_ID DirectoryFileId,
+    PCSTR Name,
+    ULONG NameSize,
+    PFILE_PROPERTIES Properties,
+    PULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new file, directory, or symbolic link.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    DirectoryFileId - Supplies the file ID of the directory to create the new
+        node in.
+
+    Name - Supplies a pointer to the name, which may not be null terminated.
+
+    NameSize - Supplies the size of the name buffer including space for a null
+        terminator.
+
+    Properties - Supplies a pointer to the properties of the new node. On
+        success, the file ID and size information is filled in.
+
+    Flags - Supplies a pointer where the lookup flags for the new file are
+        returned. See LOOKUP_FLAG_* definitions.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PTMPFS_NODE Directory;
+    PTMPFS_DIRECTORY_ENTRY Entry;
+    ULONG Length;
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+
+    Entry = NULL;
+    Status = TmpFspGetNameLength(Name, NameSize, &Length);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Entry = TmpFspCreateDirectoryEntry(Name, Length);
+    if (Entry == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeAcquireQueuedLock(Volume->Lock);
+    Directory = TmpFspGetNode(Volume, DirectoryFileId);
+    if ((Directory == NULL) ||
+        (Directory->Properties.Type != IoObjectRegularDirectory)) {
+
+        Status = STATUS_PATH_NOT_FOUND;
+        goto CreateEnd;
+    }
+
+    if (TmpFspFindDirectoryEntry(Directory, Name, Length) != NULL) {
+        Status = STATUS_FILE_EXISTS;
+        goto CreateEnd;
+    }
+
+    Properties->FileId = Volume->NextFileId;
+    Properties->Size = 0;
+    Properties->BlockSize = MmPageSize();
+    Properties->BlockCount = 0;
+    Node = TmpFspCreateNode(Volume, Properties);
+    if (Node == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateEnd;
+    }
+
+    Volume->NextFileId += 1;
+    TmpFspInsertDirectoryEntry(Directory, Entry, Node);
+    Entry = NULL;
+    TmpFspGetNodeProperties(Node, Properties, Flags);
+    Status = STATUS_SUCCESS;
+
+CreateEnd:
+    KeReleaseQueuedLock(Volume->Lock);
+    if (Entry != NULL) {
+        MmFreePagedPool(Entry);
+    }
+
+    return Status;
+}
+
+KSTATUS
+TmpFspUnlink (
+    PTMPFS_VOLUME Volume,
+    FILE_ID DirectoryFileId,
+    FILE_ID FileId,
+    PCSTR Name,
+    ULONG NameSize,
+    PBOOL Unlinked
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a name from a directory. The node itself lives on
+    until the system sends a delete request.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    DirectoryFileId - Supplies the file ID of the directory containing the
+        name.
+
+    FileId - Supplies the file ID of the node being unlinked.
+
+    Name - Supplies a pointer to the name, which may not be null terminated.
+
+    NameSize - Supplies the size of the name buffer including space for a null
+        terminator.
+
+    Unlinked - Supplies a pointer where a boolean is returned indicating
+        whether the name was removed.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PTMPFS_NODE Directory;
+    PTMPFS_DIRECTORY_ENTRY Entry;
+    ULONG Length;
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+
+    *Unlinked = FALSE;
+    Entry = NULL;
+    Status = TmpFspGetNameLength(Name, NameSize, &Length);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    KeAcquireQueuedLock(Volume->Lock);
+    Directory = TmpFspGetNode(Volume, DirectoryFileId);
+    if (Directory == NULL) {
+        Status = STATUS_PATH_NOT_FOUND;
+        goto UnlinkEnd;
+    }
+
+    Entry = TmpFspFindDirectoryEntry(Directory, Name, Length);
+    if ((Entry == NULL) || (Entry->Node->Properties.FileId != FileId)) {
+        Entry = NULL;
+        Status = STATUS_PATH_NOT_FOUND;
+        goto UnlinkEnd;
+    }
+
+    Node = Entry->Node;
+    if ((Node->Properties.Type == IoObjectRegularDirectory) &&
+        (Node->EntryCount != 0)) {
+
+        Entry = NULL;
+        Status = STATUS_DIRECTORY_NOT_EMPTY;
+        goto UnlinkEnd;
+    }
+
+    TmpFspRemoveDirectoryEntry(Entry);
+    Node->Properties.HardLinkCount -= 1;
+    *Unlinked = TRUE;
+    Status = STATUS_SUCCESS;
+
+UnlinkEnd:
+    KeReleaseQueuedLock(Volume->Lock);
+    if (Entry != NULL) {
+        MmFreePagedPool(Entry);
+    }
+
+    return Status;
+}
+
+KSTATUS
+TmpFspRename (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_RENAME Rename
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves a name from one directory entry to another, replacing
+    whatever was at the destination.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Rename - Supplies a pointer to the rename request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PTMPFS_NODE Destination;
+    PTMPFS_NODE DestinationDirectory;
+    PTMPFS_DIRECTORY_ENTRY DestinationEntry;
+    FILE_ID DestinationDirectoryId;
+    ULONG Length;
+    PTMPFS_DIRECTORY_ENTRY NewEntry;
+    PTMPFS_NODE Source;
+    PTMPFS_DIRECTORY_ENTRY SourceEntry;
+    KSTATUS Status;
+
+    Rename->SourceFileHardLinkDelta = 0;
+    Rename->DestinationFileUnlinked = FALSE;
+    DestinationEntry = NULL;
+    Status = TmpFspGetNameLength(Rename->Name, Rename->NameSize, &Length);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    //
+    // Allocate the new name up front so that nothing can fail once the
+    // destination has been unlinked.
+    //
+
+    NewEntry = TmpFspCreateDirectoryEntry(Rename->Name, Length);
+    if (NewEntry == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeAcquireQueuedLock(Volume->Lock);
+    Source = TmpFspGetNode(Volume, Rename->SourceFileProperties->FileId);
+    DestinationDirectoryId = Rename->DestinationDirectoryProperties->FileId;
+    DestinationDirectory = TmpFspGetNode(Volume, DestinationDirectoryId);
+
+    if ((Source == NULL) ||
+        (Source->Entry == NULL) ||
+        (Source->Entry->Directory->Properties.FileId !=
+         Rename->SourceDirectoryProperties->FileId) ||
+        (DestinationDirectory == NULL) ||
+        (DestinationDirectory->Properties.Type != IoObjectRegularDirectory)) {
+
+        Status = STATUS_PATH_NOT_FOUND;
+        goto RenameEnd;
+    }
+
+    //
+    // If something already sits at the destination, it is the file the
+    // system expects to be replaced. Directories can only be replaced if
+    // they're empty.
+    //
+
+    DestinationEntry = TmpFspFindDirectoryEntry(DestinationDirectory,
+                                                Rename->Name,
+                                                Length);
+
+    if (DestinationEntry != NULL) {
+        Destination = DestinationEntry->Node;
+        if ((Rename->DestinationFileProperties == NULL) ||
+            (Rename->DestinationFileProperties->FileId !=
+             Destination->Properties.FileId)) {
+
+            DestinationEntry = NULL;
+            Status = STATUS_FILE_EXISTS;
+            goto RenameEnd;
+        }
+
+        //
+        // Renaming a file onto itself does nothing.
+        //
+
+        if (Destination == Source) {
+            DestinationEntry = NULL;
+            Status = STATUS_SUCCESS;
+            goto RenameEnd;
+        }
+
+        if ((Destination->Properties.Type == IoObjectRegularDirectory) &&
+            (Destination->EntryCount != 0)) {
+
+            DestinationEntry = NULL;
+            Status = STATUS_DIRECTORY_NOT_EMPTY;
+            goto RenameEnd;
+        }
+
+        TmpFspRemoveDirectoryEntry(DestinationEntry);
+        Destination->Properties.HardLinkCount -= 1;
+        Rename->DestinationFileUnlinked = TRUE;
+    }
+
+    //
+    // Move the source node over to the new name.
+    //
+
+    SourceEntry = Source->Entry;
+    TmpFspRemoveDirectoryEntry(SourceEntry);
+    MmFreePagedPool(SourceEntry);
+    TmpFspInsertDirectoryEntry(DestinationDirectory, NewEntry, Source);
+    NewEntry = NULL;
+    Status = STATUS_SUCCESS;
+
+RenameEnd:
+    KeReleaseQueuedLock(Volume->Lock);
+    if (DestinationEntry != NULL) {
+        MmFreePagedPool(DestinationEntry);
+    }
+
+    if (NewEntry != NULL) {
+        MmFreePagedPool(NewEntry);
+    }
+
+    return Status;
+}
+
+KSTATUS
+TmpFspWriteFileProperties (
+    PTMPFS_VOLUME Volume,
+    PFILE_PROPERTIES Properties
+    )
+
+/*++
+
+Routine Description:
+
+    This routine saves new file properties for a node.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Properties - Supplies a pointer to the new properties.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+
+    KeAcquireQueuedLock(Volume->Lock);
+    Node = TmpFspGetNode(Volume, Properties->FileId);
+    if (Node == NULL) {
+        Status = STATUS_PATH_NOT_FOUND;
+        goto WriteFilePropertiesEnd;
+    }
+
+    ASSERT(Node->Properties.Type == Properties->Type);
+
+    RtlCopyMemory(&(Node->Properties), Properties, sizeof(FILE_PROPERTIES));
+    Status = STATUS_SUCCESS;
+
+WriteFilePropertiesEnd:
+    KeReleaseQueuedLock(Volume->Lock);
+    return Status;
+}
+
+KSTATUS
+TmpFspDelete (
+    PTMPFS_VOLUME Volume,
+    FILE_ID FileId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a node that has no more links and is no longer in
+    use, releasing its page file space and its charge against the volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    FileId - Supplies the file ID of the node to destroy.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PTMPFS_NODE Node;
+
+    KeAcquireQueuedLock(Volume->Lock);
+    Node = TmpFspGetNode(Volume, FileId);
+    if (Node == NULL) {
+        KeReleaseQueuedLock(Volume->Lock);
+        return STATUS_PATH_NOT_FOUND;
+    }
+
+    ASSERT((Node->Entry == NULL) && (Node->EntryCount == 0));
+    ASSERT(Volume->Usage >= Node->ChargedSize);
+
+    RtlRedBlackTreeRemove(&(Volume->NodeTree), &(Node->TreeNode));
+    Volume->Usage -= Node->ChargedSize;
+    KeReleaseQueuedLock(Volume->Lock);
+    TmpFspDestroyNode(Node);
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+TmpFspTruncate (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    ULONGLONG NewSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the size of a file, charging the volume for growth and
+    releasing any page file space beyond a smaller size.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Node - Supplies a pointer to the file's node.
+
+    NewSize - Supplies the new file size.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_VOLUME_FULL if growing the file would exceed the volume capacity.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    ULONG PageCount;
+    ULONG PageShift;
+    ULONG PageSize;
+    PTMPFS_BACKING_REGION Region;
+    ULONG RegionSize;
+    KSTATUS Status;
+
+    ASSERT(Node->Lock != NULL);
+
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    KeAcquireQueuedLock(Volume->Lock);
+    Status = TmpFspChargeNode(Volume, Node, NewSize);
+    KeReleaseQueuedLock(Volume->Lock);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    //
+    // Free page file regions beyond the end of the new file size.
+    //
+
+    KeAcquireQueuedLock(Node->Lock);
+    CurrentEntry = Node->RegionList.Next;
+    while (CurrentEntry != &(Node->RegionList)) {
+        Region = LIST_VALUE(CurrentEntry, TMPFS_BACKING_REGION, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+
+        //
+        // If the region is beyond the end of the new file size, then the
+        // whole region should be released from the page file.
+        //
+
+        if (Region->Offset >= NewSize) {
+            LIST_REMOVE(&(Region->ListEntry));
+            Region->ListEntry.Next = NULL;
+            TmpFspDestroyBackingRegion(Region);
+
+        //
+        // If only the end is beyond the new size, don't bother with a partial
+        // page file free in case the file grows again. Just clear the dirty
+        // bitmap for pages beyond the end of the file so they read back as
+        // zeroes.
+        //
+
+        } else if ((Region->Offset + Region->Size) > NewSize) {
+            RegionSize = (ULONG)(NewSize - Region->Offset);
+            RegionSize = ALIGN_RANGE_UP(RegionSize, PageSize);
+            PageCount = RegionSize >> PageShift;
+            Region->DirtyBitmap &= TMPFS_PAGE_MASK(PageCount);
+        }
+    }
+
+    KeReleaseQueuedLock(Node->Lock);
+    return STATUS_SUCCESS;
+}
+
+PTMPFS_NODE
+TmpFspGetNode (
+    PTMPFS_VOLUME Volume,
+    FILE_ID FileId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the node with the given file ID.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    FileId - Supplies the file ID to look up.
+
+Return Value:
+
+    Returns a pointer to the node on success.
+
+    NULL if no node has the given file ID.
+
+--*/
+
+{
+
+    PRED_BLACK_TREE_NODE FoundNode;
+    TMPFS_NODE SearchNode;
+
+    SearchNode.Properties.FileId = FileId;
+    FoundNode = RtlRedBlackTreeSearch(&(Volume->NodeTree),
+                                      &(SearchNode.TreeNode));
+
+    if (FoundNode == NULL) {
+        return NULL;
+    }
+
+    return RED_BLACK_TREE_VALUE(FoundNode, TMPFS_NODE, TreeNode);
+}
+
+KSTATUS
+TmpFspEnumerateDirectory (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Directory,
+    IO_OFFSET Offset,
+    PIO_BUFFER IoBuffer,
+    UINTN BufferSize,
+    PUINTN BytesCompleted,
+    PIO_OFFSET NewOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads directory entries out of a directory.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Directory - Supplies a pointer to the directory node.
+
+    Offset - Supplies the directory offset to start reading at.
+
+    IoBuffer - Supplies a pointer to the buffer to fill with DIRECTORY_ENTRY
+        structures.
+
+    BufferSize - Supplies the size of the buffer in bytes.
+
+    BytesCompleted - Supplies a pointer that on input contains the number of
+        bytes of the buffer already used. On output, contains the updated
+        number of bytes used.
+
+    NewOffset - Supplies a pointer where the directory offset to resume at is
+        returned.
+
+Return Value:
+
+    STATUS_SUCCESS if the end of the directory was reached.
+
+    STATUS_MORE_PROCESSING_REQUIRED if the buffer filled up first.
+
+    STATUS_END_OF_FILE if there were no entries to read at all.
+
+--*/
+
+{
+
+    UINTN BufferOffset;
+    UINTN BytesWritten;
+    PLIST_ENTRY CurrentEntry;
+    DIRECTORY_ENTRY DirectoryEntry;
+    PTMPFS_DIRECTORY_ENTRY Entry;
+    ULONG EntrySize;
+    KSTATUS Status;
+
+    ASSERT(Directory->Properties.Type == IoObjectRegularDirectory);
+
+    BufferOffset = *BytesCompleted;
+    BytesWritten = 0;
+    Status = STATUS_END_OF_FILE;
+    KeAcquireQueuedLock(Volume->Lock);
+
+    //
+    // The entries are kept in offset order, and offsets are never reused, so
+    // entries added or removed since the last read do not disturb where the
+    // enumeration picks back up.
+    //
+
+    CurrentEntry = Directory->EntryList.Next;
+    while (CurrentEntry != &(Directory->EntryList)) {
+        Entry = LIST_VALUE(CurrentEntry, TMPFS_DIRECTORY_ENTRY, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (Entry->Offset < Offset) {
+            continue;
+        }
+
+        EntrySize = ALIGN_RANGE_UP(sizeof(DIRECTORY_ENTRY) + Entry->NameSize,
+                                   8);
+
+        if (BufferOffset + EntrySize > BufferSize) {
+            Status = STATUS_MORE_PROCESSING_REQUIRED;
+            break;
+        }
+
+        DirectoryEntry.FileId = Entry->Node->Properties.FileId;
+        DirectoryEntry.NextOffset = Entry->Offset + 1;
+        DirectoryEntry.Size = EntrySize;
+        DirectoryEntry.Type = Entry->Node->Properties.Type;
+        Status = MmCopyIoBufferData(IoBuffer,
+                                    &DirectoryEntry,
+                                    BufferOffset,
+                                    sizeof(DIRECTORY_ENTRY),
+                                    TRUE);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        Status = MmCopyIoBufferData(IoBuffer,
+                                    Entry->Name,
+                                    BufferOffset + sizeof(DIRECTORY_ENTRY),
+                                    Entry->NameSize,
+                                    TRUE);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        BufferOffset += EntrySize;
+        BytesWritten += EntrySize;
+        Offset = DirectoryEntry.NextOffset;
+        Status = STATUS_END_OF_FILE;
+    }
+
+    KeReleaseQueuedLock(Volume->Lock);
+    if ((Status == STATUS_END_OF_FILE) && (BytesWritten != 0)) {
+        Status = STATUS_SUCCESS;
+    }
+
+    *BytesCompleted = BufferOffset;
+    *NewOffset = Offset;
+    return Status;
+}
+
+KSTATUS
+TmpFspPerformIo (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    PIRP_READ_WRITE ReadWrite,
+    BOOL Write
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads or writes the contents of a file or symbolic link.
+    Soft writes only charge the volume for the space, as the data stays in
+    the page cache. Hard flushes push evicted pages out to the page file, and
+    reads bring them back in.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Node - Supplies a pointer to the file's node.
+
+    ReadWrite - Supplies a pointer to the I/O request parameters. The bytes
+        completed and new offset are filled in.
+
+    Write - Supplies a boolean indicating whether this is a write (TRUE) or a
+        read (FALSE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN AlignedSize;
+    UINTN BytesCompleted;
+    UINTN BytesCompletedThisRound;
+    UINTN BytesRemaining;
+    UINTN BytesThisRound;
+    PLIST_ENTRY CurrentEntry;
+    IO_OFFSET CurrentOffset;
+    ULONGLONG FileSize;
+    PIO_BUFFER IoBuffer;
+    IO_OFFSET IoEnd;
+    BOOL LockHeld;
+    UINTN OriginalIoBufferOffset;
+    ULONG PageCount;
+    ULONG PageIndex;
+    ULONG PageMask;
+    ULONG PageShift;
+    ULONG PageSize;
+    PTMPFS_BACKING_REGION Region;
+    IO_OFFSET RegionEnd;
+    ULONG RegionOffset;
+    KSTATUS Status;
+
+    ASSERT(Node->Lock != NULL);
+    ASSERT(ReadWrite->FileProperties != NULL);
+
+    IoBuffer = ReadWrite->IoBuffer;
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    BytesCompleted = 0;
+    LockHeld = FALSE;
+    OriginalIoBufferOffset = MmGetIoBufferCurrentOffset(IoBuffer);
+    AlignedSize = ALIGN_RANGE_UP(ReadWrite->IoSizeInBytes, PageSize);
+    FileSize = ReadWrite->FileProperties->Size;
+
+    //
+    // If this is a write but not a hard flush, the data stays in the page
+    // cache. Charge the volume for any growth and act like the write
+    // succeeded.
+    //
+
+    if (Write != FALSE) {
+        if ((ReadWrite->IoFlags & IO_FLAG_HARD_FLUSH) == 0) {
+            IoEnd = ReadWrite->IoOffset + ReadWrite->IoSizeInBytes;
+            Status = STATUS_SUCCESS;
+            KeAcquireQueuedLock(Volume->Lock);
+            if (ALIGN_RANGE_UP(IoEnd, PageSize) > Node->ChargedSize) {
+                Status = TmpFspChargeNode(Volume, Node, IoEnd);
+            }
+
+            KeReleaseQueuedLock(Volume->Lock);
+            if (KSUCCESS(Status)) {
+                BytesCompleted = ReadWrite->IoSizeInBytes;
+            }
+
+            goto PerformIoEnd;
+        }
+
+        //
+        // The page file write is a no-allocate IRP path. Make sure the I/O
+        // buffer is mapped before the write happens.
+        //
+
+        MmMapIoBuffer(IoBuffer, FALSE, FALSE, FALSE);
+
+    } else {
+        if (ReadWrite->IoOffset >= FileSize) {
+            Status = STATUS_END_OF_FILE;
+            goto PerformIoEnd;
+        }
+
+        //
+        // The page file read is a no-allocate IRP path. It is not allowed to
+        // extend the I/O buffers. Zero the buffer, as pages that never made
+        // it out to the page file read back as zeroes.
+        //
+
+        MmZeroIoBuffer(IoBuffer, 0, AlignedSize);
+    }
+
+    //
+    // All I/O comes from the page cache, so it should be page aligned.
+    //
+
+    ASSERT(IS_ALIGNED(ReadWrite->IoOffset, PageSize) != FALSE);
+
+    KeAcquireQueuedLock(Node->Lock);
+    LockHeld = TRUE;
+    Status = STATUS_SUCCESS;
+    BytesRemaining = AlignedSize;
+
+    //
+    // Look through the backing regions for the right areas of the page file
+    // to read from and write to.
+    //
+
+    CurrentOffset = ReadWrite->IoOffset;
+    CurrentEntry = Node->RegionList.Next;
+    IoEnd = CurrentOffset + BytesRemaining;
+    while (BytesRemaining != 0) {
+
+        //
+        // If the current entry is the head of the list, there are no more
+        // backing regions. One will have to be allocated below.
+        //
+
+        if (CurrentEntry == &(Node->RegionList)) {
+            Region = NULL;
+            BytesThisRound = BytesRemaining;
+
+        //
+        // Get the next region and determine if any of it overlaps with the
+        // I/O offset and size.
+        //
+
+        } else {
+            Region = LIST_VALUE(CurrentEntry, TMPFS_BACKING_REGION, ListEntry);
+            RegionEnd = Region->Offset + Region->Size;
+            if (CurrentOffset >= RegionEnd) {
+                CurrentEntry = CurrentEntry->Next;
+                continue;
+            }
+
+            if (RegionEnd < IoEnd) {
+                BytesThisRound = RegionEnd - CurrentOffset;
+
+            } else {
+                BytesThisRound = IoEnd - CurrentOffset;
+            }
+        }
+
+        ASSERT(IS_ALIGNED(BytesThisRound, PageSize) != FALSE);
+
+        //
+        // If there is no region or the region starts beyond the current
+        // offset, then there is a gap in the backing regions. If this is only
+        // a read, the I/O buffer was zeroed above and the gap can be skipped.
+        // If this is a write, then allocate a new region to fill the gap.
+        //
+
+        if ((Region == NULL) || (CurrentOffset < Region->Offset)) {
+            if (Write == FALSE) {
+                if ((Region != NULL) &&
+                    (Region->Offset - CurrentOffset < BytesThisRound)) {
+
+                    BytesThisRound = Region->Offset - CurrentOffset;
+                }
+
+                MmIoBufferIncrementOffset(IoBuffer, BytesThisRound);
+                BytesRemaining -= BytesThisRound;
+                BytesCompleted += BytesThisRound;
+                CurrentOffset += BytesThisRound;
+
+            } else {
+                Region = TmpFspCreateBackingRegion(Node, CurrentOffset, Region);
+                if (Region == NULL) {
+                    Status = STATUS_INSUFFICIENT_RESOURCES;
+                    goto PerformIoEnd;
+                }
+
+                CurrentEntry = &(Region->ListEntry);
+            }
+
+            continue;
+        }
+
+        RegionOffset = (ULONG)(CurrentOffset - Region->Offset);
+
+        //
+        // On read, the backing region may contain some invalid data. Only
+        // read from the pages that were previously marked dirty by a write.
+        //
+
+        if (Write == FALSE) {
+
+            //
+            // Skip clean pages, they were already zeroed above.
+            //
+
+            PageIndex = RegionOffset >> PageShift;
+            PageCount = BytesThisRound >> PageShift;
+            PageMask = TMPFS_PAGE_MASK(PageCount);
+            PageMask &= (Region->DirtyBitmap >> PageIndex);
+            if (PageMask != 0) {
+                PageCount = RtlCountTrailingZeros32(PageMask);
+            }
+
+            BytesThisRound = PageCount << PageShift;
+            MmIoBufferIncrementOffset(IoBuffer, BytesThisRound);
+            BytesRemaining -= BytesThisRound;
+            BytesCompleted += BytesThisRound;
+            CurrentOffset += BytesThisRound;
+            RegionOffset += BytesThisRound;
+
+            //
+            // Count the number of dirty pages in a row that actually need to
+            // be read. If they are all clean, move on to the next region.
+            //
+
+            BytesThisRound = 0;
+            if (PageMask != 0) {
+                PageMask >>= PageCount;
+                PageCount = 32;
+                if (~PageMask != 0) {
+                    PageCount = RtlCountTrailingZeros32(~PageMask);
+                }
+
+                BytesThisRound = PageCount << PageShift;
+            }
+
+            if (BytesThisRound == 0) {
+
+                ASSERT((CurrentOffset == RegionEnd) || (BytesRemaining == 0));
+
+                CurrentEntry = CurrentEntry->Next;
+                continue;
+            }
+        }
+
+        Status = MmPageFilePerformIo(&(Region->ImageBacking),
+                                     IoBuffer,
+                                     RegionOffset,
+                                     BytesThisRound,
+                                     ReadWrite->IoFlags,
+                                     ReadWrite->TimeoutInMilliseconds,
+                                     Write,
+                                     &BytesCompletedThisRound);
+
+        if (!KSUCCESS(Status)) {
+            goto PerformIoEnd;
+        }
+
+        ASSERT(BytesThisRound == BytesCompletedThisRound);
+
+        //
+        // Update the dirty bitmap on write, so that the next read will go get
+        // the saved pages.
+        //
+
+        if (Write != FALSE) {
+            PageIndex = RegionOffset >> PageShift;
+            PageMask = TMPFS_PAGE_MASK(BytesCompletedThisRound >> PageShift);
+            Region->DirtyBitmap |= (PageMask << PageIndex);
+        }
+
+        MmIoBufferIncrementOffset(IoBuffer, BytesCompletedThisRound);
+        BytesRemaining -= BytesCompletedThisRound;
+        BytesCompleted += BytesCompletedThisRound;
+        CurrentOffset += BytesCompletedThisRound;
+        if (CurrentOffset >= RegionEnd) {
+            CurrentEntry = CurrentEntry->Next;
+        }
+    }
+
+PerformIoEnd:
+    if (LockHeld != FALSE) {
+        KeReleaseQueuedLock(Node->Lock);
+    }
+
+    //
+    // The I/O size may have been aligned up to a page. Make sure the bytes
+    // completed is not larger than the request, and that reads stop at the
+    // end of the file.
+    //
+
+    if (BytesCompleted > ReadWrite->IoSizeInBytes) {
+        BytesCompleted = ReadWrite->IoSizeInBytes;
+    }
+
+    if ((Write == FALSE) &&
+        (ReadWrite->IoOffset + BytesCompleted > FileSize)) {
+
+        BytesCompleted = FileSize - ReadWrite->IoOffset;
+    }
+
+    MmSetIoBufferCurrentOffset(IoBuffer, OriginalIoBufferOffset);
+    ReadWrite->IoBytesCompleted = BytesCompleted;
+    ReadWrite->NewIoOffset = ReadWrite->IoOffset + BytesCompleted;
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+PTMPFS_NODE
+TmpFspCreateNode (
+    PTMPFS_VOLUME Volume,
+    PFILE_PROPERTIES Properties
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new node and inserts it into the volume's node
+    tree. This routine assumes the volume lock is held or the volume is not
+    yet in use.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Properties - Supplies a pointer to the initial properties of the node,
+        including its file ID.
+
+Return Value:
+
+    Returns a pointer to the new node on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    PTMPFS_NODE Node;
+
+    Node = MmAllocatePagedPool(sizeof(TMPFS_NODE), TMPFS_ALLOCATION_TAG);
+    if (Node == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(Node, sizeof(TMPFS_NODE));
+    RtlCopyMemory(&(Node->Properties), Properties, sizeof(FILE_PROPERTIES));
+    INITIALIZE_LIST_HEAD(&(Node->RegionList));
+    INITIALIZE_LIST_HEAD(&(Node->EntryList));
+    Node->NextOffset = DIRECTORY_CONTENTS_OFFSET;
+    if (Properties->Type != IoObjectRegularDirectory) {
+        Node->Lock = KeCreateQueuedLock();
+        if (Node->Lock == NULL) {
+            MmFreePagedPool(Node);
+            return NULL;
+        }
+    }
+
+    RtlRedBlackTreeInsert(&(Volume->NodeTree), &(Node->TreeNode));
+    return Node;
+}
+
+VOID
+TmpFspDestroyNode (
+    PTMPFS_NODE Node
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a node, its backing regions, and any directory
+    entries it still contains. The node must already be out of the volume's
+    node tree.
+
+Arguments:
+
+    Node - Supplies a pointer to the node to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_DIRECTORY_ENTRY Entry;
+    PTMPFS_BACKING_REGION Region;
+
+    while (LIST_EMPTY(&(Node->RegionList)) == FALSE) {
+        Region = LIST_VALUE(Node->RegionList.Next,
+                            TMPFS_BACKING_REGION,
+                            ListEntry);
+
+        LIST_REMOVE(&(Region->ListEntry));
+        Region->ListEntry.Next = NULL;
+        TmpFspDestroyBackingRegion(Region);
+    }
+
+    while (LIST_EMPTY(&(Node->EntryList)) == FALSE) {
+        Entry = LIST_VALUE(Node->EntryList.Next,
+                           TMPFS_DIRECTORY_ENTRY,
+                           ListEntry);
+
+        LIST_REMOVE(&(Entry->ListEntry));
+        MmFreePagedPool(Entry);
+    }
+
+    if (Node->HashTable != NULL) {
+        MmFreePagedPool(Node->HashTable);
+    }
+
+    if (Node->Lock != NULL) {
+        KeDestroyQueuedLock(Node->Lock);
+    }
+
+    MmFreePagedPool(Node);
+    return;
+}
+
+VOID
+TmpFspGetNodeProperties (
+    PTMPFS_NODE Node,
+    PFILE_PROPERTIES Properties,
+    PULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the properties and lookup flags of a node. This
+    routine assumes the volume lock is held.
+
+Arguments:
+
+    Node - Supplies a pointer to the node.
+
+    Properties - Supplies a pointer where the properties are returned.
+
+    Flags - Supplies a pointer where the lookup flags are returned. See
+        LOOKUP_FLAG_* definitions.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RtlCopyMemory(Properties, &(Node->Properties), sizeof(FILE_PROPERTIES));
+    Properties->BlockSize = MmPageSize();
+    Properties->BlockCount = Node->ChargedSize >> MmPageShift();
+
+    //
+    // File contents only ever live in the page cache, so page cache entries
+    // must be written out to the page file before they can be evicted.
+    //
+
+    *Flags = 0;
+    if (Node->Properties.Type != IoObjectRegularDirectory) {
+        *Flags = LOOKUP_FLAG_HARD_FLUSH_REQUIRED;
+    }
+
+    return;
+}
+
+KSTATUS
+TmpFspChargeNode (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    ULONGLONG NewSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the amount of volume space charged to a node. This
+    routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Node - Supplies a pointer to the node.
+
+    NewSize - Supplies the new size of the node's contents. The charge is this
+        size rounded up to a page.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_VOLUME_FULL if the new charge would exceed the volume capacity.
+
+--*/
+
+{
+
+    ULONGLONG Charge;
+    ULONGLONG Growth;
+
+    ASSERT(KeIsQueuedLockHeld(Volume->Lock) != FALSE);
+
+    Charge = ALIGN_RANGE_UP(NewSize, MmPageSize());
+    if (Charge > Node->ChargedSize) {
+        Growth = Charge - Node->ChargedSize;
+        if ((Volume->Usage + Growth > Volume->Capacity) ||
+            (Volume->Usage + Growth < Volume->Usage)) {
+
+            return STATUS_VOLUME_FULL;
+        }
+
+        Volume->Usage += Growth;
+
+    } else {
+
+        ASSERT(Volume->Usage >= Node->ChargedSize - Charge);
+
+        Volume->Usage -= Node->ChargedSize - Charge;
+    }
+
+    Node->ChargedSize = Charge;
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+TmpFspGetNameLength (
+    PCSTR Name,
+    ULONG NameSize,
+    PULONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine validates a name handed down by the system and returns its
+    length.
+
+Arguments:
+
+    Name - Supplies a pointer to the name, which may not be null terminated.
+
+    NameSize - Supplies the size of the name buffer including space for a null
+        terminator.
+
+    Length - Supplies a pointer where the length of the name, not including
+        the null terminator, is returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the name is empty.
+
+    STATUS_NAME_TOO_LONG if the name is too long.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    Index = 0;
+    if (NameSize != 0) {
+        while ((Index < NameSize - 1) && (Name[Index] != '\0')) {
+            Index += 1;
+        }
+    }
+
+    if (Index == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Index > TMPFS_MAX_NAME_LENGTH) {
+        return STATUS_NAME_TOO_LONG;
+    }
+
+    *Length = Index;
+    return STATUS_SUCCESS;
+}
+
+PTMPFS_DIRECTORY_ENTRY
+TmpFspCreateDirectoryEntry (
+    PCSTR Name,
+    ULONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a new directory entry.
+
+Arguments:
+
+    Name - Supplies a pointer to the name, which may not be null terminated.
+
+    Length - Supplies the length of the name, not including a null
+        terminator.
+
+Return Value:
+
+    Returns a pointer to the new directory entry on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    PTMPFS_DIRECTORY_ENTRY Entry;
+    UINTN Size;
+
+    Size = FIELD_OFFSET(TMPFS_DIRECTORY_ENTRY, Name) + Length + 1;
+    Entry = MmAllocatePagedPool(Size, TMPFS_ALLOCATION_TAG);
+    if (Entry == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(Entry, FIELD_OFFSET(TMPFS_DIRECTORY_ENTRY, Name));
+    RtlCopyMemory(Entry->Name, Name, Length);
+    Entry->Name[Length] = '\0';
+    Entry->NameSize = Length + 1;
+    Entry->Hash = RtlComputeCrc32(0, Name, Length);
+    return Entry;
+}
+
+PTMPFS_DIRECTORY_ENTRY
+TmpFspFindDirectoryEntry (
+    PTMPFS_NODE Directory,
+    PCSTR Name,
+    ULONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds an entry within a directory. This routine assumes the
+    volume lock is held.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory to search.
+
+    Name - Supplies a pointer to the name, which may not be null terminated.
+
+    Length - Supplies the length of the name, not including a null
+        terminator.
+
+Return Value:
+
+    Returns a pointer to the entry on success.
+
+    NULL if the name is not in the directory.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PTMPFS_DIRECTORY_ENTRY Entry;
+    ULONG Hash;
+    PLIST_ENTRY Head;
+
+    ASSERT(Directory->Properties.Type == IoObjectRegularDirectory);
+
+    Hash = RtlComputeCrc32(0, Name, Length);
+
+    //
+    // Search the one hash bucket if the directory is big enough to have
+    // a hash table, or the whole list otherwise.
+    //
+
+    if (Directory->HashTable != NULL) {
+        Head = &(Directory->HashTable[Hash & (Directory->HashTableSize - 1)]);
+        CurrentEntry = Head->Next;
+        while (CurrentEntry != Head) {
+            Entry = LIST_VALUE(CurrentEntry,
+                               TMPFS_DIRECTORY_ENTRY,
+                               HashListEntry);
+
+            if ((Entry->Hash == Hash) &&
+                (Entry->NameSize == Length + 1) &&
+                (RtlCompareMemory(Entry->Name, Name, Length) != FALSE)) {
+
+                return Entry;
+            }
+
+            CurrentEntry = CurrentEntry->Next;
+        }
+
+        return NULL;
+    }
+
+    CurrentEntry = Directory->EntryList.Next;
+    while (CurrentEntry != &(Directory->EntryList)) {
+        Entry = LIST_VALUE(CurrentEntry, TMPFS_DIRECTORY_ENTRY, ListEntry);
+        if ((Entry->Hash == Hash) &&
+            (Entry->NameSize == Length + 1) &&
+            (RtlCompareMemory(Entry->Name, Name, Length) != FALSE)) {
+
+            return Entry;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    return NULL;
+}
+
+VOID
+TmpFspInsertDirectoryEntry (
+    PTMPFS_NODE Directory,
+    PTMPFS_DIRECTORY_ENTRY Entry,
+    PTMPFS_NODE Node
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds an entry to the end of a directory, growing the
+    directory's hash table if needed. This routine assumes the volume lock is
+    held.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory.
+
+    Entry - Supplies a pointer to the new entry, whose name is filled in.
+
+    Node - Supplies a pointer to the node the entry refers to.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG NewSize;
+
+    ASSERT(Node->Entry == NULL);
+
+    Entry->Directory = Directory;
+    Entry->Node = Node;
+    Entry->Offset = Directory->NextOffset;
+    Directory->NextOffset += 1;
+    INSERT_BEFORE(&(Entry->ListEntry), &(Directory->EntryList));
+    Directory->EntryCount += 1;
+    Node->Entry = Entry;
+    if (Directory->HashTable != NULL) {
+        INSERT_BEFORE(&(Entry->HashListEntry),
+                      &(Directory->HashTable[Entry->Hash &
+                                             (Directory->HashTableSize - 1)]));
+    }
+
+    //
+    // Build or grow the hash table once the directory gets big. Failure here
+    // only costs lookup speed.
+    //
+
+    NewSize = 0;
+    if (Directory->HashTable == NULL) {
+        if (Directory->EntryCount > TMPFS_HASH_THRESHOLD) {
+            NewSize = TMPFS_HASH_MINIMUM_SIZE;
+        }
+
+    } else if (Directory->EntryCount >
+               Directory->HashTableSize * TMPFS_HASH_LOAD_FACTOR) {
+
+        NewSize = Directory->HashTableSize << 1;
+    }
+
+    if (NewSize != 0) {
+        TmpFspResizeHashTable(Directory, NewSize);
+    }
+
+    return;
+}
+
+VOID
+TmpFspRemoveDirectoryEntry (
+    PTMPFS_DIRECTORY_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes an entry from its directory, but does not free it.
+    This routine assumes the volume lock is held.
+
+Arguments:
+
+    Entry - Supplies a pointer to the entry to remove.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_NODE Directory;
+
+    Directory = Entry->Directory;
+
+    ASSERT((Directory->EntryCount != 0) && (Entry->Node->Entry == Entry));
+
+    LIST_REMOVE(&(Entry->ListEntry));
+    if (Directory->HashTable != NULL) {
+        LIST_REMOVE(&(Entry->HashListEntry));
+    }
+
+    Directory->EntryCount -= 1;
+    Entry->Node->Entry = NULL;
+    Entry->Directory = NULL;
+
+    //
+    // Go back to searching linearly once the directory empties out.
+    //
+
+    if ((Directory->EntryCount == 0) && (Directory->HashTable != NULL)) {
+        TmpFspResizeHashTable(Directory, 0);
+    }
+
+    return;
+}
+
+KSTATUS
+TmpFspResizeHashTable (
+    PTMPFS_NODE Directory,
+    ULONG NewSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine rebuilds the hash table indexing the given directory's
+    entries. This routine assumes the volume lock is held.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory whose hash table should
+        be resized.
+
+    NewSize - Supplies the new number of buckets, which must be a power of
+        two. Supply zero to free the table and go back to searching the entry
+        list linearly.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if the new table could not be allocated. The
+    existing table is left untouched in this case.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PTMPFS_DIRECTORY_ENTRY Entry;
+    ULONG Index;
+    PLIST_ENTRY NewTable;
+
+    ASSERT(POWER_OF_2(NewSize) != FALSE);
+
+    NewTable = NULL;
+    if (NewSize != 0) {
+        NewTable = MmAllocatePagedPool(sizeof(LIST_ENTRY) * NewSize,
+                                       TMPFS_ALLOCATION_TAG);
+
+        if (NewTable == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        for (Index = 0; Index < NewSize; Index += 1) {
+            INITIALIZE_LIST_HEAD(&(NewTable[Index]));
+        }
+    }
+
+    //
+    // Rehash every entry. The old buckets are simply abandoned, so there is
+    // no need to unlink the entries from them first.
+    //
+
+    CurrentEntry = Directory->EntryList.Next;
+    while (CurrentEntry != &(Directory->EntryList)) {
+        Entry = LIST_VALUE(CurrentEntry, TMPFS_DIRECTORY_ENTRY, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (NewTable != NULL) {
+            INSERT_BEFORE(&(Entry->HashListEntry),
+                          &(NewTable[Entry->Hash & (NewSize - 1)]));
+
+        } else {
+            Entry->HashListEntry.Next = NULL;
+        }
+    }
+
+    if (Directory->HashTable != NULL) {
+        MmFreePagedPool(Directory->HashTable);
+    }
+
+    Directory->HashTable = NewTable;
+    Directory->HashTableSize = NewSize;
+    return STATUS_SUCCESS;
+}
+
+PTMPFS_BACKING_REGION
+TmpFspCreateBackingRegion (
+    PTMPFS_NODE Node,
+    IO_OFFSET Offset,
+    PTMPFS_BACKING_REGION NextRegion
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new backing region for the given node and
+    allocates the associated page file space. This routine assumes the node's
+    lock is held.
+
+Arguments:
+
+    Node - Supplies a pointer to the file's node.
+
+    Offset - Supplies the desired file offset of the backing region.
+
+    NextRegion - Supplies a pointer to the backing region before which the new
+        region should be placed. This parameter should be NULL if the region is
+        to be placed at the end of the list.
+
+Return Value:
+
+    Returns a pointer to the newly allocated backing region on success.
+
+    NULL on failure.
+
+--*/
+
+{
+
+    PTMPFS_BACKING_REGION NewRegion;
+    ULONG PageSize;
+    IO_OFFSET PreviousEnd;
+    PTMPFS_BACKING_REGION PreviousRegion;
+    IO_OFFSET RegionEnd;
+    PLIST_ENTRY RegionList;
+    IO_OFFSET RegionOffset;
+    UINTN RegionSize;
+    ULONG RetryCount;
+    KSTATUS Status;
+
+    ASSERT(KeIsQueuedLockHeld(Node->Lock) != FALSE);
+
+    NewRegion = MmAllocatePagedPool(sizeof(TMPFS_BACKING_REGION),
+                                   TMPFS_ALLOCATION_TAG);
+
+    if (NewRegion == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateBackingRegionEnd;
+    }
+
+    RtlZeroMemory(NewRegion, sizeof(TMPFS_BACKING_REGION));
+    NewRegion->ImageBacking.DeviceHandle = INVALID_HANDLE;
+
+    //
+    // Find the previous region.
+    //
+
+    RegionList = &(Node->RegionList);
+    PreviousRegion = NULL;
+    if (NextRegion == NULL) {
+        if (LIST_EMPTY(RegionList) == FALSE) {
+            PreviousRegion = LIST_VALUE(RegionList->Previous,
+                                        TMPFS_BACKING_REGION,
+                                        ListEntry);
+        }
+
+    } else {
+        if (NextRegion->ListEntry.Previous != RegionList) {
+            PreviousRegion = LIST_VALUE(NextRegion->ListEntry.Previous,
+                                        TMPFS_BACKING_REGION,
+                                        ListEntry);
+        }
+    }
+
+    //
+    // Try to allocate backing regions of the maximum size, aligning the region
+    // offset down. Fail gracefully if page file space appears to be tight.
+    // This might extend beyond the end of the file, but that's OK. It will
+    // only get touched if the file grows.
+    //
+
+    RetryCount = 0;
+    RegionSize = TMPFS_MAX_BACKING_REGION_SIZE;
+    PageSize = MmPageSize();
+    Status = STATUS_INSUFFICIENT_RESOURCES;
+    while (RegionSize >= PageSize) {
+        RegionOffset = ALIGN_RANGE_DOWN(Offset, RegionSize);
+
+        //
+        // Adjust the offset and size based on the previous and next regions.
+        //
+
+        if (PreviousRegion != NULL) {
+            PreviousEnd = PreviousRegion->Offset + PreviousRegion->Size;
+            if (PreviousEnd > RegionOffset) {
+                RegionSize -= (PreviousEnd - RegionOffset);
+                RegionOffset = PreviousEnd;
+            }
+        }
+
+        if (NextRegion != NULL) {
+            RegionEnd = RegionOffset + RegionSize;
+            if (NextRegion->Offset < RegionEnd) {
+                RegionSize -= (RegionEnd - NextRegion->Offset);
+            }
+        }
+
+        ASSERT(RegionSize >= PageSize);
+
+        Status = MmAllocatePageFileSpace(&(NewRegion->ImageBacking),
+                                         RegionSize);
+
+        if (KSUCCESS(Status)) {
+            break;
+        }
+
+        //
+        // Attempts to allocate a smaller portion of page file space are only
+        // allowed if insufficient resources were reported.
+        //
+
+        if (Status != STATUS_INSUFFICIENT_RESOURCES) {
+            goto CreateBackingRegionEnd;
+        }
+
+        ASSERT(IS_ALIGNED(RegionSize, PageSize) != FALSE);
+
+        RetryCount += 1;
+        RegionSize = TMPFS_MAX_BACKING_REGION_SIZE >> RetryCount;
+    }
+
+    if (!KSUCCESS(Status)) {
+        goto CreateBackingRegionEnd;
+    }
+
+    NewRegion->Offset = RegionOffset;
+    NewRegion->Size = RegionSize;
+    if (NextRegion != NULL) {
+        INSERT_BEFORE(&(NewRegion->ListEntry), &(NextRegion->ListEntry));
+
+    } else {
+        INSERT_BEFORE(&(NewRegion->ListEntry), RegionList);
+    }
+
+    Status = STATUS_SUCCESS;
+
+CreateBackingRegionEnd:
+    if (!KSUCCESS(Status)) {
+        if (NewRegion != NULL) {
+            MmFreePagedPool(NewRegion);
+            NewRegion = NULL;
+        }
+    }
+
+    return NewRegion;
+}
+
+VOID
+TmpFspDestroyBackingRegion (
+    PTMPFS_BACKING_REGION Region
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a backing region and its associated page file
+    space.
+
+Arguments:
+
+    Region - Supplies a pointer to the backing region to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Region->ListEntry.Next == NULL);
+
+    MmFreePageFileSpace(&(Region->ImageBacking), Region->Size);
+    MmFreePagedPool(Region);
+    return;
+}
+
+COMPARISON_RESULT
+TmpFspCompareNodes (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two temporary file system nodes by their file IDs.
+
+Arguments:
+
+    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+
+    FirstNode - Supplies a pointer to the left side of the comparison.
+
+    SecondNode - Supplies a pointer to the second side of the comparison.
+
+Return Value:
+
+    Same if the two nodes have the same value.
+
+    Ascending if the first node is less than the second node.
+
+    Descending if the second node is less than the first node.
+
+--*/
+
+{
+
+    PTMPFS_NODE First;
+    PTMPFS_NODE Second;
+
+    First = RED_BLACK_TREE_VALUE(FirstNode, TMPFS_NODE, TreeNode);
+    Second = RED_BLACK_TREE_VALUE(SecondNode, TMPFS_NODE, TreeNode);
+    if (First->Properties.FileId > Second->Properties.FileId) {
+        return ComparisonResultDescending;
+    }
+
+    if (First->Properties.FileId < Second->Properties.FileId) {
+        return ComparisonResultAscending;
+    }
+
+    return ComparisonResultSame;
+}
+
@@ -0,0 +1,145 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    loop.h
+
+Abstract:
+
+    This header contains definitions for loopback block device information.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// The loop control device publishes this information type. Setting it
+// attaches a file to a new loop device.
+//
+
+#define LOOP_CONTROL_INFORMATION_UUID \
+    {{0xED76EBA6, 0xEC434056, 0x9FA232CB, 0x295DE689}}
+
+#define LOOP_CONTROL_INFORMATION_VERSION 0x00010000
+
+//
+// Each loop device publishes this information type.
+//
+
+#define LOOP_DEVICE_INFORMATION_UUID \
+    {{0xD7518DCD, 0x2DDC4A9F, 0x92A90ACE, 0x463DCFEE}}
+
+#define LOOP_DEVICE_INFORMATION_VERSION 0x00010000
+
+//
+// Define the size of the path buffer in the loop control information,
+// including the null terminator.
+//
+
+#define LOOP_PATH_SIZE 256
+
+//
+// Set this flag to make the loop device read-only. The backing file is then
+// only opened for reading.
+//
+
+#define LOOP_FLAG_READ_ONLY 0x00000001
+
+//
+// Set this flag in a set request to the loop device information to detach
+// the backing file and remove the loop device.
+//
+
+#define LOOP_FLAG_DETACH 0x00000002
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure stores the information used to create a loop device.
+
+Members:
+
+    Version - Stores the table version. Future revisions will be backwards
+        compatible. Set to LOOP_CONTROL_INFORMATION_VERSION.
+
+    Flags - Stores a bitfield of flags for the new loop device. See
+        LOOP_FLAG_* definitions.
+
+    DeviceId - Stores the device ID of the newly created loop device on
+        success. Its loop device information shows up once the device has
+        started.
+
+    Path - Stores the null terminated path of the regular file to attach,
+        resolved the same way an open from the caller would be.
+
+--*/
+
+typedef struct _LOOP_CONTROL_INFORMATION {
+    ULONG Version;
+    ULONG Flags;
+    ULONGLONG DeviceId;
+    CHAR Path[LOOP_PATH_SIZE];
+} LOOP_CONTROL_INFORMATION, *PLOOP_CONTROL_INFORMATION;
+
+/*++
+
+Structure Description:
+
+    This structure stores the device information published by a loop device.
+
+Members:
+
+    Version - Stores the table version. Future revisions will be backwards
+        compatible. Set to LOOP_DEVICE_INFORMATION_VERSION.
+
+    Flags - Stores a bitfield of flags. See LOOP_FLAG_* definitions. Only the
+        detach flag can be set.
+
+    Size - Stores the size of the loop device in bytes.
+
+    Latency - Stores the number of microseconds the loop device waits before
+        starting each I/O request.
+
+    Bandwidth - Stores the number of bytes per second the loop device moves
+        across all of its requests, or 0 for no limit. Together with the
+        latency this makes the loop device behave like a slower disk.
+
+--*/
+
+typedef struct _LOOP_DEVICE_INFORMATION {
+    ULONG Version;
+    ULONG Flags;
+    ULONGLONG Size;
+    ULONG Latency;
+    ULONGLONG Bandwidth;
+} LOOP_DEVICE_INFORMATION, *PLOOP_DEVICE_INFORMATION;
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
@@ -0,0 +1,72 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ramdisk.h
+
+Abstract:
+
+    This header contains definitions for RAM disk device information.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define RAM_DISK_DEVICE_INFORMATION_UUID \
+    {{0x5C0B4A61, 0x3E2F4D18, 0x9A7C1B55, 0xE6D2F039}}
+
+#define RAM_DISK_DEVICE_INFORMATION_VERSION 0x00010000
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure stores the device information published by a RAM disk.
+
+Members:
+
+    Version - Stores the table version. Future revisions will be backwards
+        compatible. Set to RAM_DISK_DEVICE_INFORMATION_VERSION.
+
+    Size - Stores the size of the RAM disk in bytes.
+
+    Latency - Stores the number of microseconds the RAM disk waits before
+        completing each I/O request. This makes the RAM disk behave like a
+        slower device, and is the only member that can be set.
+
+--*/
+
+typedef struct _RAM_DISK_DEVICE_INFORMATION {
+    ULONG Version;
+    ULONGLONG Size;
+    ULONG Latency;
+} RAM_DISK_DEVICE_INFORMATION, *PRAM_DISK_DEVICE_INFORMATION;
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
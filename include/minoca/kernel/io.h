@@ -244,6 +244,14 @@ Module Name:
 
 #define OPEN_FLAG_ASYNCHRONOUS 0x00000800
 
+//
+// Set this flag to have reads and writes bypass the page cache and go straight
+// between the caller's buffer and the backing device. Requests that are not
+// aligned to the block size of the file or device still use the cache.
+//
+
+#define OPEN_FLAG_DIRECT 0x00001000
+
 //
 // Set this flag if mount points should not be followed on the final component.
 //
@@ -316,6 +324,16 @@ Module Name:
 
 #define IO_FLAG_HARD_FLUSH_ALLOWED 0x10000000
 
+//
+// This flag is reserved for use by the page cache. It indicates that a read is
+// filling a block device's page cache with an empty I/O buffer. A device whose
+// storage is memory may lend its own pages to the buffer (see
+// MmIoBufferAppendDeviceMemory) instead of copying, and the page cache will
+// cache them in place.
+//
+
+#define IO_FLAG_CACHE_FILL 0x20000000
+
 //
 // This flag indicates that a write I/O operation should flush all the file
 // data provided before returning.
@@ -346,6 +364,14 @@ Module Name:
 
 #define IO_FLAG_FS_METADATA 0x00000010
 
+//
+// This flag indicates that the I/O should bypass the page cache, transferring
+// data directly between the supplied buffer and the backing device. File
+// systems should pass it along on the device I/O they issue for the request.
+//
+
+#define IO_FLAG_DIRECT 0x00000020
+
 //
 // Set this flag if the IRP needs to execute in a no-allocate code path. As a
 // result none of the data or code it touches can be pagable.
@@ -823,6 +849,12 @@ Module Name:
 
 #define PIPE_ATOMIC_WRITE_SIZE 4096
 
+//
+// Define the largest size an unprivileged caller can grow a pipe to.
+//
+
+#define PIPE_MAX_SIZE _1MB
+
 //
 // Define I/O test hook bits.
 //
@@ -856,11 +888,20 @@ Module Name:
 
 #define LOOKUP_FLAG_NON_PAGED_IO_STATE 0x00000002
 
+//
+// Set this flag if the file system does not keep the file's contents anywhere
+// but the page cache. Soft flushes to such a file are not expected to
+// preserve the data, so the system must send a hard flush before evicting a
+// page that was ever dirty.
+//
+
+#define LOOKUP_FLAG_HARD_FLUSH_REQUIRED 0x00000004
+
 //
 // Define the version number for the I/O cache statistics.
 //
 
-#define IO_CACHE_STATISTICS_VERSION 0x1
+#define IO_CACHE_STATISTICS_VERSION 0x3
 #define IO_CACHE_STATISTICS_MAX_VERSION 0x10000000
 
 //
@@ -945,6 +986,7 @@ typedef struct _IRP IRP, *PIRP;
 typedef struct _STREAM_BUFFER STREAM_BUFFER, *PSTREAM_BUFFER;
 typedef struct _IO_HANDLE IO_HANDLE, *PIO_HANDLE;
 typedef struct _PAGE_CACHE_ENTRY PAGE_CACHE_ENTRY, *PPAGE_CACHE_ENTRY;
+typedef struct _EVENT_POLL_WATCH EVENT_POLL_WATCH, *PEVENT_POLL_WATCH;
 
 typedef enum _SEEK_COMMAND {
     SeekCommandInvalid,
@@ -1038,8 +1080,18 @@ typedef enum _IO_INFORMATION_TYPE {
     IoInformationBoot,
     IoInformationMountPoints,
     IoInformationCacheStatistics,
+    IoInformationWritebackStatistics,
+    IoInformationBlockQueue,
+    IoInformationDeviceStatistics,
 } IO_INFORMATION_TYPE, *PIO_INFORMATION_TYPE;
 
+typedef enum _IO_SCHEDULER_TYPE {
+    IoSchedulerInvalid,
+    IoSchedulerNoop,
+    IoSchedulerDeadline,
+    IoSchedulerTypeCount
+} IO_SCHEDULER_TYPE, *PIO_SCHEDULER_TYPE;
+
 typedef enum _SHARED_MEMORY_COMMAND {
     SharedMemoryCommandInvalid,
     SharedMemoryCommandUnlink,
@@ -1507,6 +1559,8 @@ typedef enum _IO_OBJECT_TYPE {
     IoObjectTerminalSlave,
     IoObjectSharedMemoryObject,
     IoObjectSymbolicLink,
+    IoObjectEventPoll,
+    IoObjectIoRing,
     IoObjectTypeCount
 } IO_OBJECT_TYPE, *PIO_OBJECT_TYPE;
 
@@ -1731,6 +1785,10 @@ Structure Description:
 
     Async - Stores an optional pointer to the asynchronous object state.
 
+    EventPollWatch - Stores an optional pointer to the list of event poll
+        entries interested in this object. This is allocated the first time
+        the object is added to an event poll set.
+
 --*/
 
 typedef struct _IO_OBJECT_STATE {
@@ -1741,6 +1799,7 @@ typedef struct _IO_OBJECT_STATE {
     PKEVENT ErrorEvent;
     volatile ULONG Events;
     PIO_ASYNC_STATE Async;
+    PEVENT_POLL_WATCH EventPollWatch;
 } IO_OBJECT_STATE, *PIO_OBJECT_STATE;
 
 typedef enum _IRP_MAJOR_CODE {
@@ -2285,6 +2344,9 @@ Structure Description:
         permissions, object type, user ID, group ID, and access times are all
         valid from the system.
 
+    Flags - Stores a bitmask of flags returned by the file system, the same
+        as those returned by lookup. See LOOKUP_FLAG_* for definitions.
+
 --*/
 
 typedef struct _SYSTEM_CONTROL_CREATE {
@@ -2293,6 +2355,7 @@ typedef struct _SYSTEM_CONTROL_CREATE {
     PCSTR Name;
     ULONG NameSize;
     FILE_PROPERTIES FileProperties;
+    ULONG Flags;
 } SYSTEM_CONTROL_CREATE, *PSYSTEM_CONTROL_CREATE;
 
 /*++
@@ -2628,6 +2691,32 @@ Structure Description:
     LastCleanTime - Stores a time counter value for the last time the page
         cache was cleaned.
 
+    ReadAheadPageCount - Stores the total number of pages read into the cache
+        ahead of sequential readers.
+
+    ReadAheadHitPageCount - Stores the total number of read-ahead pages that
+        were subsequently consumed by a sequential reader.
+
+    ReadAheadWastePageCount - Stores the total number of read-ahead pages that
+        were abandoned because the reader switched to random access.
+
+    EntryCount - Stores the current number of page cache entries.
+
+    ActiveEntryCount - Stores the number of page cache entries on the active
+        list, which are protected from eviction until they age out.
+
+    ReadHitPageCount - Stores the total number of pages cached reads found in
+        the cache.
+
+    ReadMissPageCount - Stores the total number of pages cached reads had to
+        fetch from the backing store.
+
+    RefaultPageCount - Stores the total number of pages read back into the
+        cache while their shadow entry from eviction was still around.
+
+    RefaultActivatePageCount - Stores the number of refaulted pages that were
+        evicted recently enough to go straight onto the active list.
+
 --*/
 
 typedef struct _IO_CACHE_STATISTICS {
@@ -2639,10 +2728,167 @@ typedef struct _IO_CACHE_STATISTICS {
     UINTN PhysicalPageCount;
     UINTN DirtyPageCount;
     ULONGLONG LastCleanTime;
+    ULONGLONG ReadAheadPageCount;
+    ULONGLONG ReadAheadHitPageCount;
+    ULONGLONG ReadAheadWastePageCount;
+    UINTN EntryCount;
+    UINTN ActiveEntryCount;
+    ULONGLONG ReadHitPageCount;
+    ULONGLONG ReadMissPageCount;
+    ULONGLONG RefaultPageCount;
+    ULONGLONG RefaultActivatePageCount;
 } IO_CACHE_STATISTICS, *PIO_CACHE_STATISTICS;
 
 /*++
 
+Structure Description:
+
+    This structure defines the page cache writeback statistics for a single
+    backing device.
+
+Members:
+
+    DeviceId - Stores the ID of the backing device.
+
+    DirtyPageCount - Stores the number of dirty page cache pages waiting to be
+        written to the device.
+
+    WritebackPageCount - Stores the number of pages currently being written
+        to the device.
+
+    WrittenPageCount - Stores the total number of pages written to the device.
+
+    Bandwidth - Stores the recent rate at which the device has been writing
+        pages, in pages per second.
+
+    DirtyLimit - Stores the number of dirty pages the device may accumulate
+        before writers to it are throttled.
+
+--*/
+
+typedef struct _IO_WRITEBACK_STATISTICS {
+    DEVICE_ID DeviceId;
+    UINTN DirtyPageCount;
+    UINTN WritebackPageCount;
+    UINTN WrittenPageCount;
+    UINTN Bandwidth;
+    UINTN DirtyLimit;
+} IO_WRITEBACK_STATISTICS, *PIO_WRITEBACK_STATISTICS;
+
+/*++
+
+Structure Description:
+
+    This structure defines the I/O scheduler settings and statistics for a
+    single block device's request queue. On a set operation, only the
+    scheduler type and queue depth are used, and zero values are ignored.
+
+Members:
+
+    DeviceId - Stores the ID of the block device.
+
+    Scheduler - Stores the policy used to pick the next request to send to
+        the device.
+
+    QueueDepth - Stores the maximum number of requests that may be
+        outstanding at the device at once.
+
+    QueuedCount - Stores the number of requests currently waiting in the
+        queue.
+
+    InFlightCount - Stores the number of requests currently at the device.
+
+    ReadCount - Stores the total number of read requests submitted.
+
+    WriteCount - Stores the total number of write requests submitted.
+
+    DispatchCount - Stores the total number of requests sent to the device,
+        after merging.
+
+    BackMergeCount - Stores the number of requests merged onto the end of a
+        queued request.
+
+    FrontMergeCount - Stores the number of requests merged onto the front of a
+        queued request.
+
+    ExpiredCount - Stores the number of requests that were sent to the device
+        because their deadline had passed.
+
+    TotalWaitMicroseconds - Stores the total time requests have spent waiting
+        in the queue, in microseconds.
+
+    MaxWaitMicroseconds - Stores the longest time a single request has waited
+        in the queue, in microseconds.
+
+--*/
+
+typedef struct _IO_BLOCK_QUEUE_INFORMATION {
+    DEVICE_ID DeviceId;
+    IO_SCHEDULER_TYPE Scheduler;
+    ULONG QueueDepth;
+    ULONG QueuedCount;
+    ULONG InFlightCount;
+    ULONGLONG ReadCount;
+    ULONGLONG WriteCount;
+    ULONGLONG DispatchCount;
+    ULONGLONG BackMergeCount;
+    ULONGLONG FrontMergeCount;
+    ULONGLONG ExpiredCount;
+    ULONGLONG TotalWaitMicroseconds;
+    ULONGLONG MaxWaitMicroseconds;
+} IO_BLOCK_QUEUE_INFORMATION, *PIO_BLOCK_QUEUE_INFORMATION;
+
+/*++
+
+Structure Description:
+
+    This structure defines the I/O statistics for a single block device. The
+    counters only ever go up, so rates come from the difference between two
+    samples.
+
+Members:
+
+    DeviceId - Stores the ID of the block device.
+
+    QueuedCount - Stores the number of requests currently waiting in the
+        queue.
+
+    InFlightCount - Stores the number of requests currently at the device.
+
+    ReadCount - Stores the total number of read requests completed.
+
+    WriteCount - Stores the total number of write requests completed.
+
+    BytesRead - Stores the total number of bytes read from the device.
+
+    BytesWritten - Stores the total number of bytes written to the device.
+
+    QueueMicroseconds - Stores the total time completed requests spent
+        waiting in the queue, in microseconds.
+
+    ServiceMicroseconds - Stores the total time completed requests spent at
+        the device, in microseconds.
+
+    BusyMicroseconds - Stores the total time the device has had at least one
+        request outstanding, in microseconds.
+
+--*/
+
+typedef struct _IO_DEVICE_STATISTICS {
+    DEVICE_ID DeviceId;
+    ULONG QueuedCount;
+    ULONG InFlightCount;
+    ULONGLONG ReadCount;
+    ULONGLONG WriteCount;
+    ULONGLONG BytesRead;
+    ULONGLONG BytesWritten;
+    ULONGLONG QueueMicroseconds;
+    ULONGLONG ServiceMicroseconds;
+    ULONGLONG BusyMicroseconds;
+} IO_DEVICE_STATISTICS, *PIO_DEVICE_STATISTICS;
+
+/*++
+
 Structure Description:
 
     This structure defines a set of I/O cache statistics.
@@ -4368,6 +4614,53 @@ Return Value:
 
 --*/
 
+KERNEL_API
+KSTATUS
+IoSendFile (
+    PIO_HANDLE Destination,
+    PIO_HANDLE Source,
+    PIO_OFFSET Offset,
+    UINTN SizeInBytes,
+    ULONG TimeoutInMilliseconds,
+    PUINTN BytesCompleted
+    );
+
+/*++
+
+Routine Description:
+
+    This routine transfers data from one I/O handle to another without
+    passing through a caller-supplied buffer. When the source is backed by the
+    page cache, the destination is handed the page cache pages directly, so
+    the data is copied at most once.
+
+Arguments:
+
+    Destination - Supplies the handle to write the data to.
+
+    Source - Supplies the handle to read the data from.
+
+    Offset - Supplies a pointer to the offset in the source to start reading
+        from. Supply IO_OFFSET_NONE to use and update the source's current
+        file position. On return, this is updated to the offset just beyond
+        the last byte transferred, unless IO_OFFSET_NONE was supplied.
+
+    SizeInBytes - Supplies the number of bytes to transfer.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds that each
+        read and write should be waited on before timing out. Use
+        WAIT_TIME_INDEFINITE to wait forever.
+
+    BytesCompleted - Supplies a pointer where the number of bytes actually
+        transferred will be returned.
+
+Return Value:
+
+    Status code. A failing status code does not necessarily mean no data was
+    transferred. Check the bytes completed value to find out how much was.
+
+--*/
+
 KERNEL_API
 KSTATUS
 IoFlush (
@@ -5772,6 +6065,165 @@ Return Value:
 
 --*/
 
+INTN
+IoSysCreateEventPoll (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for creating a new event poll
+    set.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+INTN
+IoSysEventPollControl (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for adding, modifying, or removing
+    an I/O handle in an event poll set.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+INTN
+IoSysEventPollWait (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for waiting on an event poll set.
+    Only the entries that are ready are returned.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or the number of events returned (a positive integer) on
+    success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
+INTN
+IoSysCreateIoRing (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for creating a new I/O ring from
+    memory shared with user mode.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+INTN
+IoSysIoRingEnter (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for submitting requests from an
+    I/O ring's submission queue and waiting for completions.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or the number of requests submitted (a positive integer) on
+    success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
+INTN
+IoSysSendFile (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for transferring data from a file
+    to another handle within the kernel.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or the number of bytes transferred (a positive integer) on
+    success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
 INTN
 IoSysDuplicateHandle (
     PVOID SystemCallParameter
@@ -7347,7 +7799,7 @@ Routine Description:
         buffer. See STREAM_BUFFER_FLAG_* definitions.
 
     BufferSize - Supplies the size of the buffer. Supply zero to use a default
-        system value.
+        system value. The size is rounded up to a multiple of the page size.
 
     AtomicWriteSize - Supplies the number of bytes that can always be written
         to the stream atomically (without interleaving).
@@ -7511,6 +7963,61 @@ Return Value:
 
 --*/
 
+ULONG
+IoStreamBufferGetSize (
+    PSTREAM_BUFFER StreamBuffer
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the capacity of a stream buffer.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer.
+
+Return Value:
+
+    Returns the number of bytes the stream buffer can hold.
+
+--*/
+
+KSTATUS
+IoStreamBufferSetSize (
+    PSTREAM_BUFFER StreamBuffer,
+    ULONG Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine changes the capacity of a stream buffer. Any data sitting in
+    the buffer is preserved.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer.
+
+    Size - Supplies the new size of the buffer, in bytes. This is rounded up
+        to a multiple of the page size, and is never made smaller than the
+        atomic write size.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_RESOURCE_IN_USE if the buffer currently holds more data than would
+    fit in the new size.
+
+    STATUS_INVALID_PARAMETER if the size is too large.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+--*/
+
 KSTATUS
 IoGetCacheStatistics (
     PIO_CACHE_STATISTICS Statistics
@@ -7536,6 +8043,36 @@ Return Value:
 
 --*/
 
+KSTATUS
+IoGetWritebackStatistics (
+    PIO_WRITEBACK_STATISTICS Statistics,
+    PUINTN BufferSize
+    );
+
+/*++
+
+Routine Description:
+
+    This routine collects the page cache writeback statistics for every
+    backing device that currently has file objects in the system.
+
+Arguments:
+
+    Statistics - Supplies a pointer to an array that receives one element per
+        backing device.
+
+    BufferSize - Supplies a pointer to the size of the array in bytes. Upon
+        return this either holds the number of bytes actually used or, if the
+        buffer is too small, the expected buffer size.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_BUFFER_TOO_SMALL if the array cannot hold every device.
+
+--*/
+
 KERNEL_API
 ULONG
 IoGetCacheEntryDataSize (
@@ -94,6 +94,12 @@ Module Name:
 #define KERNEL_MAX_ARGUMENT_VALUES 10
 #define KERNEL_MAX_COMMAND_LINE 4096
 
+//
+// Define the number of freed kernel stacks each processor keeps on hand.
+//
+
+#define PROCESSOR_KERNEL_STACK_CACHE_SIZE 2
+
 //
 // Work queue flags.
 //
@@ -647,6 +653,11 @@ Structure Description:
 
     CpuVersion - Stores the processor identification information for this CPU.
 
+    KernelStackCache - Stores a small cache of freed default-sized kernel
+        stacks, used before falling back to the global kernel stack cache.
+        Entries are claimed and released with atomic exchanges so that other
+        processors can trim them.
+
 --*/
 
 typedef struct _PROCESSOR_BLOCK PROCESSOR_BLOCK, *PPROCESSOR_BLOCK;
@@ -682,6 +693,7 @@ struct _PROCESSOR_BLOCK {
     PVOID SwapPage;
     UINTN NmiCount;
     PROCESSOR_IDENTIFICATION CpuVersion;
+    volatile UINTN KernelStackCache[PROCESSOR_KERNEL_STACK_CACHE_SIZE];
 };
 
 /*++
@@ -610,6 +610,13 @@ Structure Description:
     MapFlags - Stores any additional mapping flags mandated by the file object
         for this I/O buffer. See MAP_FLAG_* definitions.
 
+    LookupFragment - Stores the index of the fragment most recently found by
+        offset. Copies tend to walk a buffer front to back, so lookups start
+        here rather than at the first fragment.
+
+    LookupOffset - Stores the byte offset into the buffer at which the lookup
+        fragment begins.
+
     Fragment - Stores an I/O buffer fragment structure used for stack-allocated
         I/O buffers that only require one fragment.
 
@@ -624,6 +631,8 @@ typedef struct _IO_BUFFER_INTERNAL {
     PVOID PageCacheEntry;
     PVOID *PageCacheEntries;
     ULONG MapFlags;
+    UINTN LookupFragment;
+    UINTN LookupOffset;
     IO_BUFFER_FRAGMENT Fragment;
 } IO_BUFFER_INTERNAL, *PIO_BUFFER_INTERNAL;
 
@@ -1621,6 +1630,72 @@ Return Value:
 
 --*/
 
+KERNEL_API
+KSTATUS
+MmIoBufferAppendDeviceMemory (
+    PIO_BUFFER IoBuffer,
+    PVOID VirtualAddress,
+    PHYSICAL_ADDRESS PhysicalAddress,
+    UINTN SizeInBytes
+    );
+
+/*++
+
+Routine Description:
+
+    This routine appends a run of memory owned by a device to the end of the
+    given I/O buffer. A device whose storage is memory (like a RAM disk) can
+    use this to hand its own pages to a read that is filling an empty,
+    extendable I/O buffer rather than copying into freshly allocated pages.
+    The pages remain the device's; they are never freed with the buffer.
+
+Arguments:
+
+    IoBuffer - Supplies a pointer to the I/O buffer. It must be extendable and
+        not yet backed by any pages beyond its current offset.
+
+    VirtualAddress - Supplies the page aligned virtual address of the device
+        memory. It must stay mapped for as long as the device exists.
+
+    PhysicalAddress - Supplies the page aligned physical address of the device
+        memory.
+
+    SizeInBytes - Supplies the number of bytes to append. This must be a
+        multiple of the page size and must fill the rest of the buffer.
+
+Return Value:
+
+    STATUS_SUCCESS if the device memory now backs the I/O buffer.
+
+    STATUS_NOT_SUPPORTED if the I/O buffer or memory cannot be used this way.
+    The caller should copy the data instead.
+
+--*/
+
+BOOL
+MmIsIoBufferDeviceMemory (
+    PIO_BUFFER IoBuffer
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not the given I/O buffer was filled
+    with memory lent by a device.
+
+Arguments:
+
+    IoBuffer - Supplies a pointer to an I/O buffer.
+
+Return Value:
+
+    TRUE if the I/O buffer's pages belong to a device.
+
+    FALSE if the I/O buffer's pages are ordinary memory.
+
+--*/
+
 KERNEL_API
 UINTN
 MmGetIoBufferSize (
@@ -3455,6 +3530,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 KSTATUS
 MmAllocatePageFileSpace (
     PIMAGE_BACKING ImageBacking,
@@ -3483,6 +3559,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 VOID
 MmFreePageFileSpace (
     PIMAGE_BACKING ImageBacking,
@@ -3537,6 +3614,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 KSTATUS
 MmPageFilePerformIo (
     PIMAGE_BACKING ImageBacking,
@@ -82,10 +82,12 @@ Module Name:
 #define WAIT_FLAG_INTERRUPTIBLE 0x00000002
 
 //
-// Define the number of built in wait block entries.
+// Define the number of built in wait block entries. This includes the timeout
+// timer slot, and is sized so that the common waits (including a poll on a
+// handful of descriptors) never need a larger wait block.
 //
 
-#define BUILTIN_WAIT_BLOCK_ENTRY_COUNT 8
+#define BUILTIN_WAIT_BLOCK_ENTRY_COUNT 16
 
 //
 // Define a constant that can be passed to wait routines to indicate that the
@@ -225,8 +227,10 @@ VOID
 
 Routine Description:
 
-    This routine is called whenever a handle is looked up. It is called with
-    the handle table lock still held.
+    This routine is called whenever a handle is looked up. It is called
+    without the handle table lock held, but the handle value is guaranteed not
+    to be released by a destroy or replace of the handle until this routine
+    returns.
 
 Arguments:
 
@@ -555,7 +559,8 @@ Routine Description:
 
     This routine creates a wait block. While this can be done on the fly,
     creating a wait block ahead of time is potentially faster if the number of
-    elements being waited on is fairly large (greater than approximately 7).
+    elements being waited on is fairly large (greater than approximately 15)
+    and varies between waits.
 
 Arguments:
 
@@ -1139,7 +1144,7 @@ ObGetHandleValue (
 Routine Description:
 
     This routine looks up the given handle and returns the value associated
-    with that handle.
+    with that handle. This routine does not acquire the handle table lock.
 
 Arguments:
 
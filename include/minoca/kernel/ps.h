@@ -532,6 +532,21 @@ Module Name:
 
 #define FORK_FLAG_REALM_UTS 0x00000001
 
+//
+// Set this flag to have the child process borrow the parent's address space
+// rather than getting a copy of it. The calling thread in the parent is
+// suspended until the child executes a new image or exits.
+//
+
+#define FORK_FLAG_VFORK 0x00000002
+
+//
+// Define the maximum size of the stack region that can be restored for the
+// parent of a vfork operation.
+//
+
+#define VFORK_MAX_FRAME_RESTORE_SIZE 0x1000
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -1440,6 +1455,13 @@ Structure Description:
 
     Realm - Stores the set of realms the process belongs to.
 
+    VforkAddressSpace - Stores a pointer to the process' own address space
+        while it is borrowing its parent's address space after a vfork. This is
+        NULL if the process is not in the middle of a vfork.
+
+    VforkEvent - Stores a pointer to the event the vfork parent waits on. It
+        is signaled when the child stops borrowing the parent's address space.
+
 --*/
 
 struct _KPROCESS {
@@ -1486,6 +1508,8 @@ struct _KPROCESS {
     ULONG Umask;
     PVOID ControllingTerminal;
     PROCESS_REALMS Realm;
+    PADDRESS_SPACE VforkAddressSpace;
+    PVOID VforkEvent;
 };
 
 /*++
@@ -1637,6 +1661,10 @@ Structure Description:
     BuiltinWaitBlock - Stores a pointer to the built-in wait block that comes
         with every thread.
 
+    SpareWaitBlock - Stores an optional pointer to a larger wait block kept
+        around from a previous wait on more objects than fit in the built-in
+        wait block. It is only touched by the thread itself.
+
     WaitBlock - Stores a pointer to the wait block this thread is currently
         blocking on.
 
@@ -1717,6 +1745,7 @@ struct _KTHREAD {
     SCHEDULER_ENTRY SchedulerEntry;
     PVOID BuiltinTimer;
     PWAIT_BLOCK BuiltinWaitBlock;
+    PWAIT_BLOCK SpareWaitBlock;
     PWAIT_BLOCK WaitBlock;
     SIGNAL_SET PendingSignals;
     SIGNAL_SET BlockedSignals;
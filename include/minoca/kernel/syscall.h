@@ -93,6 +93,7 @@ Module Name:
 #define SYS_OPEN_FLAG_NO_CONTROLLING_TERMINAL 0x00000200
 #define SYS_OPEN_FLAG_NO_ACCESS_TIME          0x00000400
 #define SYS_OPEN_FLAG_ASYNCHRONOUS            0x00000800
+#define SYS_OPEN_FLAG_DIRECT                  0x00001000
 
 #define SYS_OPEN_ACCESS_SHIFT 29
 #define SYS_OPEN_FLAG_READ    (IO_ACCESS_READ << SYS_OPEN_ACCESS_SHIFT)
@@ -118,14 +119,16 @@ Module Name:
      SYS_OPEN_FLAG_SYNCHRONIZED |               \
      SYS_OPEN_FLAG_NO_CONTROLLING_TERMINAL |    \
      SYS_OPEN_FLAG_NO_ACCESS_TIME |             \
-     SYS_OPEN_FLAG_ASYNCHRONOUS)
+     SYS_OPEN_FLAG_ASYNCHRONOUS |               \
+     SYS_OPEN_FLAG_DIRECT)
 
 #define SYS_FILE_CONTROL_EDITABLE_STATUS_FLAGS \
     (SYS_OPEN_FLAG_APPEND |                    \
      SYS_OPEN_FLAG_NON_BLOCKING |              \
      SYS_OPEN_FLAG_SYNCHRONIZED |              \
      SYS_OPEN_FLAG_NO_ACCESS_TIME |            \
-     SYS_OPEN_FLAG_ASYNCHRONOUS)
+     SYS_OPEN_FLAG_ASYNCHRONOUS |              \
+     SYS_OPEN_FLAG_DIRECT)
 
 //
 // Define delete flags.
@@ -259,6 +262,53 @@ Module Name:
     (POLL_EVENT_IN | POLL_EVENT_IN_HIGH_PRIORITY | POLL_EVENT_OUT | \
      POLL_EVENT_OUT_HIGH_PRIORITY)
 
+//
+// Define the event poll flags, which are combined with the poll events when
+// registering interest in an I/O handle. Edge triggered entries are only
+// reported once each time the I/O object signals one of the requested events.
+// One-shot entries are disabled after they are reported once, and must be
+// re-armed with a modify operation.
+//
+
+#define EVENT_POLL_FLAG_ONE_SHOT       0x40000000
+#define EVENT_POLL_FLAG_EDGE_TRIGGERED 0x80000000
+
+#define EVENT_POLL_FLAG_MASK \
+    (EVENT_POLL_FLAG_ONE_SHOT | EVENT_POLL_FLAG_EDGE_TRIGGERED)
+
+//
+// Define the maximum number of entries in an I/O ring's submission or
+// completion queue. Both counts must be a power of two.
+//
+
+#define IO_RING_MAX_ENTRIES 4096
+
+//
+// Define the alignment of the submission queue within the shared I/O ring
+// memory.
+//
+
+#define IO_RING_QUEUE_ALIGNMENT 64
+
+//
+// Define the size of the shared memory needed for an I/O ring with the given
+// number of submission and completion entries.
+//
+
+#define IO_RING_SIZE(_SubmissionCount, _CompletionCount)                   \
+    (ALIGN_RANGE_UP(sizeof(IO_RING_HEADER), IO_RING_QUEUE_ALIGNMENT) +     \
+     ((_SubmissionCount) * sizeof(IO_RING_SUBMISSION)) +                  \
+     ((_CompletionCount) * sizeof(IO_RING_COMPLETION)))
+
+//
+// Set this flag in an I/O ring submission to always hand the request to a
+// worker, rather than first trying to complete it without blocking.
+//
+
+#define IO_RING_SUBMISSION_FLAG_ASYNC 0x00000001
+
+#define IO_RING_SUBMISSION_FLAG_MASK IO_RING_SUBMISSION_FLAG_ASYNC
+
 //
 // Define the effective access permission flags.
 //
@@ -357,6 +407,12 @@ typedef enum _SYSTEM_CALL_NUMBER {
     SystemCallSetITimer,
     SystemCallSetResourceLimit,
     SystemCallSetBreak,
+    SystemCallCreateEventPoll,
+    SystemCallEventPollControl,
+    SystemCallEventPollWait,
+    SystemCallCreateIoRing,
+    SystemCallIoRingEnter,
+    SystemCallSendFile,
     SystemCallCount
 } SYSTEM_CALL_NUMBER, *PSYSTEM_CALL_NUMBER;
 
@@ -410,6 +466,8 @@ typedef enum _FILE_CONTROL_COMMAND {
     FileControlCommandSetDirectoryFlag,
     FileControlCommandCloseFrom,
     FileControlCommandGetPath,
+    FileControlCommandGetPipeSize,
+    FileControlCommandSetPipeSize,
     FileControlCommandCount
 } FILE_CONTROL_COMMAND, *PFILE_CONTROL_COMMAND;
 
@@ -435,6 +493,28 @@ typedef enum _RESOURCE_USAGE_REQUEST {
     ResourceUsageRequestThread,
 } RESOURCE_USAGE_REQUEST, *PRESOURCE_USAGE_REQUEST;
 
+typedef enum _EVENT_POLL_OPERATION {
+    EventPollOperationInvalid,
+    EventPollOperationAdd,
+    EventPollOperationDelete,
+    EventPollOperationModify
+} EVENT_POLL_OPERATION, *PEVENT_POLL_OPERATION;
+
+typedef enum _IO_RING_OPERATION {
+    IoRingOperationNop,
+    IoRingOperationRead,
+    IoRingOperationWrite,
+    IoRingOperationReadVector,
+    IoRingOperationWriteVector,
+    IoRingOperationFlush,
+    IoRingOperationPoll,
+    IoRingOperationAccept,
+    IoRingOperationConnect,
+    IoRingOperationSend,
+    IoRingOperationReceive,
+    IoRingOperationCount
+} IO_RING_OPERATION, *PIO_RING_OPERATION;
+
 //
 // System call parameter structures
 //
@@ -976,6 +1056,148 @@ typedef struct _SYSTEM_CALL_POLL {
 
 /*++
 
+Structure Description:
+
+    This structure defines an event poll event, used both to register interest
+    in an I/O handle and to report that the handle is ready.
+
+Members:
+
+    Events - Stores the bitmask of poll events. When registering, this
+        contains the events of interest and any EVENT_POLL_FLAG_* flags. When
+        returned from a wait, this contains the events that occurred. See
+        POLL_EVENT_* definitions.
+
+    Data - Stores an opaque value supplied at registration time and returned
+        untouched when the handle is ready.
+
+--*/
+
+typedef struct _EVENT_POLL_EVENT {
+    ULONG Events;
+    ULONGLONG Data;
+} EVENT_POLL_EVENT, *PEVENT_POLL_EVENT;
+
+/*++
+
+Structure Description:
+
+    This structure defines the header at the start of the memory shared
+    between user mode and the kernel for an I/O ring. User mode produces
+    submissions at the submission tail and consumes completions at the
+    completion head. The kernel does the opposite.
+
+Members:
+
+    SubmissionHead - Stores the index of the next submission the kernel will
+        consume. This is only written by the kernel.
+
+    SubmissionTail - Stores the index one beyond the last submission written
+        by user mode. This is only written by user mode.
+
+    CompletionHead - Stores the index of the next completion user mode will
+        consume. This is only written by user mode.
+
+    CompletionTail - Stores the index one beyond the last completion written
+        by the kernel. This is only written by the kernel.
+
+    SubmissionCount - Stores the number of entries in the submission queue.
+
+    CompletionCount - Stores the number of entries in the completion queue.
+
+    SubmissionOffset - Stores the offset in bytes from the start of the shared
+        memory to the submission queue.
+
+    CompletionOffset - Stores the offset in bytes from the start of the shared
+        memory to the completion queue.
+
+--*/
+
+typedef struct _IO_RING_HEADER {
+    volatile ULONG SubmissionHead;
+    volatile ULONG SubmissionTail;
+    volatile ULONG CompletionHead;
+    volatile ULONG CompletionTail;
+    ULONG SubmissionCount;
+    ULONG CompletionCount;
+    ULONG SubmissionOffset;
+    ULONG CompletionOffset;
+} IO_RING_HEADER, *PIO_RING_HEADER;
+
+/*++
+
+Structure Description:
+
+    This structure defines a single request in an I/O ring's submission
+    queue.
+
+Members:
+
+    Operation - Stores the operation to perform.
+
+    Flags - Stores a bitfield of flags. See IO_RING_SUBMISSION_FLAG_*
+        definitions.
+
+    OperationFlags - Stores flags specific to the operation. For polls these
+        are the POLL_EVENT_* events to wait for. For sends and receives these
+        are SOCKET_IO_* flags. For accepts these are the SYS_OPEN_FLAG_* flags
+        to apply to the new handle. For flushes these are SYS_FLUSH_FLAG_*
+        flags.
+
+    Handle - Stores the handle to perform the operation on.
+
+    Buffer - Stores a pointer to the data buffer. For vectored operations
+        this points to an array of I/O vectors. For connects this points to
+        the remote path, if any.
+
+    Length - Stores the size of the data buffer in bytes. For vectored
+        operations this is the number of I/O vectors. For connects this is
+        the size of the remote path, including the null terminator.
+
+    Offset - Stores the file offset for reads and writes, or IO_OFFSET_NONE
+        to use and update the handle's current offset.
+
+    Address - Stores a pointer to the network address to connect to.
+
+    UserData - Stores an opaque value returned untouched in the completion.
+
+--*/
+
+typedef struct _IO_RING_SUBMISSION {
+    IO_RING_OPERATION Operation;
+    ULONG Flags;
+    ULONG OperationFlags;
+    HANDLE Handle;
+    PVOID Buffer;
+    UINTN Length;
+    IO_OFFSET Offset;
+    PNETWORK_ADDRESS Address;
+    ULONGLONG UserData;
+} IO_RING_SUBMISSION, *PIO_RING_SUBMISSION;
+
+/*++
+
+Structure Description:
+
+    This structure defines a single entry in an I/O ring's completion queue.
+
+Members:
+
+    UserData - Stores the opaque value from the submission.
+
+    Result - Stores the result of the operation. This is the number of bytes
+        transferred for data operations, the returned events for polls, and
+        the new handle for accepts. It is a negative status code on failure.
+
+--*/
+
+typedef struct _IO_RING_COMPLETION {
+    ULONGLONG UserData;
+    LONGLONG Result;
+} IO_RING_COMPLETION, *PIO_RING_COMPLETION;
+
+/*++
+
 Structure Description:
 
     This structure defines the system call parameters for creating a new
@@ -1245,6 +1467,9 @@ Structure Description:
     Owner - Stores the ID of the process to receive signals on asynchronous
         I/O events.
 
+    PipeSize - Stores the capacity of a pipe, in bytes. When setting, this
+        holds the requested size on input and the actual size on output.
+
 --*/
 
 typedef union _FILE_CONTROL_PARAMETERS_UNION {
@@ -1254,6 +1479,7 @@ typedef union _FILE_CONTROL_PARAMETERS_UNION {
     ULONG Flags;
     FILE_PATH FilePath;
     PROCESS_ID Owner;
+    ULONG PipeSize;
 } FILE_CONTROL_PARAMETERS_UNION, *PFILE_CONTROL_PARAMETERS_UNION;
 
 /*++
@@ -2512,6 +2738,184 @@ typedef struct _SYSTEM_CALL_SET_RESOURCE_LIMIT {
 
 /*++
 
+Structure Description:
+
+    This structure defines the system call parameters for creating a new event
+    poll set.
+
+Members:
+
+    OpenFlags - Stores the set of open flags associated with the handle. Only
+        SYS_OPEN_FLAG_CLOSE_ON_EXECUTE is accepted.
+
+    Handle - Stores the returned handle to the event poll set.
+
+--*/
+
+typedef struct _SYSTEM_CALL_CREATE_EVENT_POLL {
+    ULONG OpenFlags;
+    HANDLE Handle;
+} SYSCALL_STRUCT SYSTEM_CALL_CREATE_EVENT_POLL,
+    *PSYSTEM_CALL_CREATE_EVENT_POLL;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for adding, modifying,
+    or removing an I/O handle in an event poll set.
+
+Members:
+
+    EventPoll - Stores the handle to the event poll set.
+
+    Operation - Stores the operation to perform.
+
+    Handle - Stores the I/O handle to add, modify, or remove.
+
+    Event - Stores the events of interest and the opaque data to return when
+        the handle is ready. This is ignored for delete operations.
+
+--*/
+
+typedef struct _SYSTEM_CALL_EVENT_POLL_CONTROL {
+    HANDLE EventPoll;
+    EVENT_POLL_OPERATION Operation;
+    HANDLE Handle;
+    EVENT_POLL_EVENT Event;
+} SYSCALL_STRUCT SYSTEM_CALL_EVENT_POLL_CONTROL,
+    *PSYSTEM_CALL_EVENT_POLL_CONTROL;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for waiting on an event
+    poll set.
+
+Members:
+
+    EventPoll - Stores the handle to the event poll set.
+
+    SignalMask - Stores an optional pointer to a signal mask to set for the
+        duration of the wait.
+
+    Events - Stores a pointer to a buffer where the ready events will be
+        returned.
+
+    EventCount - Stores the maximum number of elements in the events array.
+
+    TimeoutInMilliseconds - Stores the number of milliseconds to wait for an
+        entry to become ready before giving up.
+
+--*/
+
+typedef struct _SYSTEM_CALL_EVENT_POLL_WAIT {
+    HANDLE EventPoll;
+    PSIGNAL_SET SignalMask;
+    PEVENT_POLL_EVENT Events;
+    LONG EventCount;
+    ULONG TimeoutInMilliseconds;
+} SYSCALL_STRUCT SYSTEM_CALL_EVENT_POLL_WAIT, *PSYSTEM_CALL_EVENT_POLL_WAIT;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for creating a new I/O
+    ring.
+
+Members:
+
+    Ring - Stores a pointer to the memory to share with the kernel. This must
+        be page aligned, and should be a shared mapping so that it is not
+        copied on write after a fork.
+
+    RingSize - Stores the size of the shared memory in bytes. This must be at
+        least IO_RING_SIZE of the requested counts.
+
+    SubmissionCount - Stores the number of entries in the submission queue.
+        This must be a power of two no larger than IO_RING_MAX_ENTRIES.
+
+    CompletionCount - Stores the number of entries in the completion queue.
+        This must be a power of two no larger than IO_RING_MAX_ENTRIES.
+
+    OpenFlags - Stores the set of open flags associated with the handle. Only
+        SYS_OPEN_FLAG_CLOSE_ON_EXECUTE is accepted.
+
+    Handle - Stores the returned handle to the I/O ring.
+
+--*/
+
+typedef struct _SYSTEM_CALL_CREATE_IO_RING {
+    PVOID Ring;
+    UINTN RingSize;
+    ULONG SubmissionCount;
+    ULONG CompletionCount;
+    ULONG OpenFlags;
+    HANDLE Handle;
+} SYSCALL_STRUCT SYSTEM_CALL_CREATE_IO_RING, *PSYSTEM_CALL_CREATE_IO_RING;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for submitting requests
+    to an I/O ring and waiting for their completion.
+
+Members:
+
+    Ring - Stores the handle to the I/O ring.
+
+    SubmitCount - Stores the maximum number of requests to consume from the
+        submission queue.
+
+    WaitCount - Stores the number of completions that must be available in
+        the completion queue before the call returns.
+
+    TimeoutInMilliseconds - Stores the number of milliseconds to wait for
+        the completions before giving up.
+
+--*/
+
+typedef struct _SYSTEM_CALL_IO_RING_ENTER {
+    HANDLE Ring;
+    ULONG SubmitCount;
+    ULONG WaitCount;
+    ULONG TimeoutInMilliseconds;
+} SYSCALL_STRUCT SYSTEM_CALL_IO_RING_ENTER, *PSYSTEM_CALL_IO_RING_ENTER;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for transferring data
+    from a file directly to another handle within the kernel.
+
+Members:
+
+    Destination - Stores the handle to write the data to. This is usually a
+        socket or pipe, but may be any writable handle.
+
+    Source - Stores the handle to read the data from.
+
+    Offset - Stores the offset in the source to start reading from. Supply
+        -1ULL to use and update the source's current file position. On
+        return, contains the offset just beyond the last byte transferred.
+
+    Size - Stores the number of bytes to transfer.
+
+--*/
+
+typedef struct _SYSTEM_CALL_SEND_FILE {
+    HANDLE Destination;
+    HANDLE Source;
+    IO_OFFSET Offset;
+    INTN Size;
+} SYSCALL_STRUCT SYSTEM_CALL_SEND_FILE, *PSYSTEM_CALL_SEND_FILE;
+
+/*++
+
 Structure Description:
 
     This structure defines a union of all possible system call parameter
@@ -2589,6 +2993,12 @@ typedef union _SYSTEM_CALL_PARAMETER_UNION {
     SYSTEM_CALL_SET_ITIMER SetITimer;
     SYSTEM_CALL_SET_RESOURCE_LIMIT SetResourceLimit;
     SYSTEM_CALL_SET_BREAK SetBreak;
+    SYSTEM_CALL_CREATE_EVENT_POLL CreateEventPoll;
+    SYSTEM_CALL_EVENT_POLL_CONTROL EventPollControl;
+    SYSTEM_CALL_EVENT_POLL_WAIT EventPollWait;
+    SYSTEM_CALL_CREATE_IO_RING CreateIoRing;
+    SYSTEM_CALL_IO_RING_ENTER IoRingEnter;
+    SYSTEM_CALL_SEND_FILE SendFile;
 } SYSCALL_STRUCT SYSTEM_CALL_PARAMETER_UNION, *PSYSTEM_CALL_PARAMETER_UNION;
 
 typedef
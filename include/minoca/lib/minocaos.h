@@ -891,6 +891,256 @@ Return Value:
 
 --*/
 
+OS_API
+KSTATUS
+OsCreateEventPoll (
+    ULONG OpenFlags,
+    PHANDLE Handle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a new event poll set, which is a persistent set of
+    I/O handles that can be waited on together.
+
+Arguments:
+
+    OpenFlags - Supplies the open flags for the new handle. Only
+        SYS_OPEN_FLAG_CLOSE_ON_EXECUTE is accepted.
+
+    Handle - Supplies a pointer where the handle to the new event poll set
+        will be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+OS_API
+KSTATUS
+OsEventPollControl (
+    HANDLE EventPoll,
+    EVENT_POLL_OPERATION Operation,
+    HANDLE Handle,
+    PEVENT_POLL_EVENT Event
+    );
+
+/*++
+
+Routine Description:
+
+    This routine adds, modifies, or removes an I/O handle in an event poll set.
+
+Arguments:
+
+    EventPoll - Supplies the handle to the event poll set.
+
+    Operation - Supplies the operation to perform.
+
+    Handle - Supplies the I/O handle to operate on.
+
+    Event - Supplies an optional pointer to the events of interest and the
+        data to return when the handle is ready. This is required for add and
+        modify operations.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_FILE_EXISTS if the handle was already added to the set.
+
+    STATUS_NOT_FOUND if the handle is not in the set for a modify or delete
+    operation.
+
+    STATUS_PERMISSION_DENIED if the handle refers to a regular file or
+    directory.
+
+    Other error codes on failure.
+
+--*/
+
+OS_API
+KSTATUS
+OsEventPollWait (
+    HANDLE EventPoll,
+    PSIGNAL_SET SignalMask,
+    PEVENT_POLL_EVENT Events,
+    ULONG EventCount,
+    ULONG TimeoutInMilliseconds,
+    PULONG EventsReturned
+    );
+
+/*++
+
+Routine Description:
+
+    This routine waits for I/O handles in an event poll set to become ready.
+
+Arguments:
+
+    EventPoll - Supplies the handle to the event poll set.
+
+    SignalMask - Supplies an optional pointer to a mask to set for the
+        duration of the wait.
+
+    Events - Supplies a pointer to an array where the events for the ready
+        handles will be returned.
+
+    EventCount - Supplies the maximum number of elements in the events array.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds to wait before
+        giving up.
+
+    EventsReturned - Supplies a pointer where the number of events returned
+        will be stored on success.
+
+Return Value:
+
+    STATUS_SUCCESS if one or more handles is ready.
+
+    STATUS_INTERRUPTED if a signal was caught during the wait.
+
+    STATUS_TIMEOUT if no handles were ready in the given amount of time.
+
+    STATUS_INVALID_PARAMETER if zero or more than MAX_LONG events are
+    requested.
+
+--*/
+
+OS_API
+KSTATUS
+OsCreateIoRing (
+    PVOID Ring,
+    UINTN RingSize,
+    ULONG SubmissionCount,
+    ULONG CompletionCount,
+    ULONG OpenFlags,
+    PHANDLE Handle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a new I/O ring on top of the given memory. The kernel
+    initializes the ring header in the memory, and from then on it is shared
+    between the caller and the kernel.
+
+Arguments:
+
+    Ring - Supplies a pointer to the page aligned memory to share with the
+        kernel. This should be a shared mapping.
+
+    RingSize - Supplies the size of the memory in bytes. This must be at least
+        IO_RING_SIZE of the given counts.
+
+    SubmissionCount - Supplies the number of submission queue entries. This
+        must be a power of two.
+
+    CompletionCount - Supplies the number of completion queue entries. This
+        must be a power of two.
+
+    OpenFlags - Supplies the open flags for the new handle. Only
+        SYS_OPEN_FLAG_CLOSE_ON_EXECUTE is accepted.
+
+    Handle - Supplies a pointer where the handle to the new I/O ring will be
+        returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+OS_API
+KSTATUS
+OsIoRingEnter (
+    HANDLE Ring,
+    ULONG SubmitCount,
+    ULONG WaitCount,
+    ULONG TimeoutInMilliseconds,
+    PULONG Submitted
+    );
+
+/*++
+
+Routine Description:
+
+    This routine submits requests from an I/O ring's submission queue and
+    optionally waits for completions to arrive.
+
+Arguments:
+
+    Ring - Supplies the handle to the I/O ring.
+
+    SubmitCount - Supplies the maximum number of submission queue entries to
+        consume.
+
+    WaitCount - Supplies the number of completions that need to be available
+        in the completion queue before returning.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds to wait for
+        the completions. Running out of time is not an error.
+
+    Submitted - Supplies a pointer where the number of submission queue
+        entries consumed will be returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_TRY_AGAIN if nothing could be submitted because too many requests
+    are outstanding. Reap some completions and try again.
+
+    STATUS_INTERRUPTED if a signal was caught before anything was submitted.
+
+    Other error codes on failure.
+
+--*/
+
+OS_API
+KSTATUS
+OsSendFile (
+    HANDLE Destination,
+    HANDLE Source,
+    PIO_OFFSET Offset,
+    UINTN Size,
+    PUINTN BytesCompleted
+    );
+
+/*++
+
+Routine Description:
+
+    This routine transfers data from one handle to another within the kernel,
+    avoiding a round trip through a user mode buffer. When the source is a
+    cached file, the data is copied at most once.
+
+Arguments:
+
+    Destination - Supplies the handle to write the data to.
+
+    Source - Supplies the handle to read the data from.
+
+    Offset - Supplies an optional pointer to the offset in the source to start
+        reading from. On return, this is updated to the offset just beyond the
+        last byte transferred. If NULL, the source's current file position is
+        used and updated instead.
+
+    Size - Supplies the number of bytes to transfer.
+
+    BytesCompleted - Supplies a pointer where the number of bytes transferred
+        will be returned.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 OS_API
 PSIGNAL_HANDLER_ROUTINE
 OsSetSignalHandler (
@@ -99,6 +99,19 @@ rm -rf "$WORLD/tmp" "$WORLD/dev"
 mkdir -p "$WORLD/dev"
 mkdir -p -m1777 "$WORLD/tmp"
 
+##
+## Put /tmp and /var/run on temporary file system volumes if the driver is
+## around. Their contents then stay in memory and start empty every boot.
+##
+
+if test -e /Device/TmpFs0; then
+    mount /Device/TmpFs0 "$WORLD/tmp"
+fi
+
+if test -e /Device/TmpFs1; then
+    mount /Device/TmpFs1 "$WORLD/var/run"
+fi
+
 ##
 ## Symlink swiss binaries.
 ##
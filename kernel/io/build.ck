@@ -46,6 +46,7 @@ function build() {
         "devrem.c",
         "devres.c",
         "driver.c",
+        "evpoll.c",
         "fileobj.c",
         "filesys.c",
         "flock.c",
@@ -55,10 +56,13 @@ function build() {
         "intrupt.c",
         "iobase.c",
         "iohandle.c",
+        "ioring.c",
+        "iosched.c",
         "irp.c",
         "mount.c",
         "obfs.c",
         "pagecach.c",
+        "pagecidx.c",
         "path.c",
         "perm.c",
         "pipe.c",
@@ -67,12 +71,14 @@ function build() {
         "pstate.c",
         "pty.c",
         "pwropt.c",
+        "sendfile.c",
         "shmemobj.c",
         "socket.c",
         "stream.c",
         "testhook.c",
         "unsocket.c",
-        "userio.c"
+        "userio.c",
+        "writebk.c"
     ];
 
     if ((arch == "armv7") || (arch == "armv6")) {
@@ -96,13 +96,38 @@ typedef struct _IO_WRITE_CONTEXT {
     ULONG IoFlags;
 } IO_WRITE_CONTEXT, *PIO_WRITE_CONTEXT;
 
+/*++
+
+Structure Description:
+
+    This structure defines an asynchronous read-ahead request queued on behalf
+    of a sequential reader.
+
+Members:
+
+    FileObject - Stores a pointer to the file object to read ahead in. The
+        request holds a reference on the file object.
+
+    Offset - Stores the page-aligned file offset where the read-ahead begins.
+
+    Size - Stores the number of bytes to read ahead, a multiple of the page
+        size.
+
+--*/
+
+typedef struct _IO_READ_AHEAD_REQUEST {
+    PFILE_OBJECT FileObject;
+    IO_OFFSET Offset;
+    UINTN Size;
+} IO_READ_AHEAD_REQUEST, *PIO_READ_AHEAD_REQUEST;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
 KSTATUS
 IopPerformCachedRead (
-    PFILE_OBJECT FileObject,
+    PIO_HANDLE Handle,
     PIO_CONTEXT IoContext,
     PBOOL LockHeldExclusive
     );
@@ -129,7 +154,26 @@ IopHandleCacheWriteHit (
 KSTATUS
 IopHandleCacheReadMiss (
     PFILE_OBJECT FileObject,
-    PIO_CONTEXT IoContext
+    PIO_CONTEXT IoContext,
+    UINTN ReadAheadSize
+    );
+
+UINTN
+IopUpdateReadAheadWindow (
+    PIO_HANDLE Handle,
+    IO_OFFSET Offset,
+    UINTN Size
+    );
+
+VOID
+IopQueueReadAhead (
+    PIO_HANDLE Handle,
+    IO_OFFSET ReadEnd
+    );
+
+VOID
+IopReadAheadWorker (
+    PVOID Parameter
     );
 
 KSTATUS
@@ -161,6 +205,33 @@ IopPerformDefaultPartialWrite (
     UINTN IoBufferOffset
     );
 
+KSTATUS
+IopFlushForDirectIo (
+    PIO_HANDLE Handle,
+    PIO_CONTEXT IoContext
+    );
+
+BOOL
+IopCanPerformDirectIo (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext
+    );
+
+KSTATUS
+IopPerformDirectIo (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext,
+    PVOID DeviceContext
+    );
+
+VOID
+IopUpdatePageCacheForDirectWrite (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset,
+    PIO_BUFFER IoBuffer,
+    UINTN SizeInBytes
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -198,8 +269,10 @@ Return Value:
 
 {
 
+    BOOL Direct;
     PFILE_OBJECT FileObject;
     UINTN FlushCount;
+    DEVICE_ID FlushDeviceId;
     BOOL LockHeldExclusive;
     IO_OFFSET OriginalOffset;
     ULONG PageShift;
@@ -217,6 +290,25 @@ Return Value:
     OriginalOffset = IoContext->Offset;
     StartOffset = OriginalOffset;
 
+    //
+    // Direct I/O goes around the page cache, so dirty cached data overlapping
+    // the request must reach the backing store first. This is done before the
+    // file object lock is acquired below, as flushing acquires it shared.
+    //
+
+    Direct = FALSE;
+    if ((IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) &&
+        (((Handle->OpenFlags & OPEN_FLAG_DIRECT) != 0) ||
+         ((IoContext->Flags & IO_FLAG_DIRECT) != 0))) {
+
+        Status = IopFlushForDirectIo(Handle, IoContext);
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        Direct = TRUE;
+    }
+
     //
     // Assuming this call is going to generate more pages, ask this thread to
     // do some trimming if things are too big. If this is the file system
@@ -243,17 +335,20 @@ Return Value:
 
         //
         // It's important to prevent runaway writers from making things
-        // overwhelmingly dirty.
+        // overwhelmingly dirty, either overall or on a device that cannot
+        // keep up with its share.
         // 1) If it's a write to a block device, make it synchronized. This
         //    covers the case of the file system writing tons of zeros to catch
         //    up to a far offset.
         // 2) Otherwise if the FS flags are set, let the write go through
         //    unimpeded.
-        // 3) Otherwise go clean some entries.
+        // 3) Otherwise go clean some entries on the writer's own device, in
+        //    proportion to the size of the write. A writer to a slow device
+        //    pays for it without holding up writers to other devices.
         //
 
         if ((IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) &&
-            (IopIsPageCacheTooDirty() != FALSE)) {
+            (IopIsPageCacheTooDirty(FileObject->Writeback) != FALSE)) {
 
             if (FileObject->Properties.Type == IoObjectBlockDevice) {
                 IoContext->Flags |= IO_FLAG_DATA_SYNCHRONIZED;
@@ -265,7 +360,12 @@ Return Value:
                     FlushCount = (IoContext->SizeInBytes >> PageShift) + 1;
                 }
 
-                Status = IopFlushFileObjects(0, 0, &FlushCount);
+                FlushDeviceId = 0;
+                if (FileObject->Writeback != NULL) {
+                    FlushDeviceId = FileObject->Writeback->DeviceId;
+                }
+
+                Status = IopFlushFileObjects(FlushDeviceId, 0, &FlushCount);
                 if (!KSUCCESS(Status)) {
                     return Status;
                 }
@@ -289,7 +389,14 @@ Return Value:
             IoContext->Offset = FileObject->Properties.Size;
         }
 
-        if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
+        if ((Direct != FALSE) &&
+            (IopCanPerformDirectIo(FileObject, IoContext) != FALSE)) {
+
+            Status = IopPerformDirectIo(FileObject,
+                                        IoContext,
+                                        Handle->DeviceContext);
+
+        } else if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
             Status = IopPerformCachedWrite(FileObject, IoContext);
 
         } else {
@@ -315,8 +422,15 @@ Return Value:
         }
 
         LockHeldExclusive = FALSE;
-        if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
-            Status = IopPerformCachedRead(FileObject,
+        if ((Direct != FALSE) &&
+            (IopCanPerformDirectIo(FileObject, IoContext) != FALSE)) {
+
+            Status = IopPerformDirectIo(FileObject,
+                                        IoContext,
+                                        Handle->DeviceContext);
+
+        } else if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
+            Status = IopPerformCachedRead(Handle,
                                           IoContext,
                                           &LockHeldExclusive);
 
@@ -488,7 +602,7 @@ Return Value:
 
 KSTATUS
 IopPerformCachedRead (
-    PFILE_OBJECT FileObject,
+    PIO_HANDLE Handle,
     PIO_CONTEXT IoContext,
     PBOOL LockHeldExclusive
     )
@@ -499,11 +613,12 @@ Routine Description:
 
     This routine performs reads from the page cache. If any of the reads miss
     the cache, then they are read into the cache. Only cacheable objects are
-    supported by this routine.
+    supported by this routine. Sequential reads of regular files also read
+    ahead of the caller.
 
 Arguments:
 
-    FileObject - Supplies a pointer to the file object for the device or file.
+    Handle - Supplies a pointer to the I/O handle being read from.
 
     IoContext - Supplies a pointer to the I/O context.
 
@@ -527,19 +642,28 @@ Return Value:
     IO_OFFSET CurrentOffset;
     ULONG DestinationByteOffset;
     PIO_BUFFER DestinationIoBuffer;
+    PFILE_OBJECT FileObject;
     ULONGLONG FileSize;
+    UINTN HitCount;
     IO_CONTEXT MissContext;
     UINTN MissSize;
     PIO_BUFFER PageAlignedIoBuffer;
     IO_OFFSET PageAlignedOffset;
     UINTN PageAlignedSize;
     PPAGE_CACHE_ENTRY PageCacheEntry;
+    UINTN PageCount;
     ULONG PageSize;
+    IO_OFFSET PreviousEnd;
+    IO_OFFSET ReadAheadEnd;
+    UINTN ReadAheadSize;
     IO_OFFSET ReadEnd;
+    IO_OFFSET RepeatOffset;
     UINTN SizeInBytes;
     KSTATUS Status;
     UINTN TotalBytesRead;
 
+    FileObject = Handle->FileObject;
+
     ASSERT(IoContext->IoBuffer != NULL);
     ASSERT(IoContext->SizeInBytes != 0);
     ASSERT(IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE);
@@ -588,6 +712,26 @@ Return Value:
         goto PerformCachedReadEnd;
     }
 
+    //
+    // A reader working through a page in small pieces only counts as one use
+    // of the page; otherwise every page of a single sequential pass would look
+    // like it was used over and over. Note the page this read shares with the
+    // end of the last one before the read-ahead state moves on.
+    //
+
+    RepeatOffset = -1;
+    PreviousEnd = Handle->ReadAheadOffset;
+    if ((PreviousEnd > IoContext->Offset) &&
+        (ALIGN_RANGE_DOWN(PreviousEnd - 1, PageSize) ==
+         ALIGN_RANGE_DOWN(IoContext->Offset, PageSize))) {
+
+        RepeatOffset = ALIGN_RANGE_DOWN(IoContext->Offset, PageSize);
+    }
+
+    ReadAheadSize = IopUpdateReadAheadWindow(Handle,
+                                             IoContext->Offset,
+                                             SizeInBytes);
+
     //
     // Page-align the offset and size. Note that the size does not get aligned
     // up to a page, just down.
@@ -629,6 +773,7 @@ Return Value:
     CurrentOffset = PageAlignedOffset;
     CacheMissOffset = CurrentOffset;
     BytesRemaining = PageAlignedSize;
+    HitCount = 0;
     while (BytesRemaining != 0) {
         if (BytesRemaining < PageSize) {
             BytesThisRound = BytesRemaining;
@@ -644,8 +789,12 @@ Return Value:
 
         ASSERT(IS_ALIGNED(CurrentOffset, PageSize) != FALSE);
 
-        PageCacheEntry = IopLookupPageCacheEntry(FileObject, CurrentOffset);
+        PageCacheEntry = IopLookupPageCacheEntry(FileObject,
+                                                 CurrentOffset,
+                                                 CurrentOffset != RepeatOffset);
+
         if (PageCacheEntry != NULL) {
+            HitCount += 1;
 
             //
             // Now read in the missed data and add it into the page-aligned
@@ -666,7 +815,7 @@ Return Value:
                                               IoContext->TimeoutInMilliseconds;
 
                 MissContext.Write = FALSE;
-                Status = IopHandleCacheReadMiss(FileObject, &MissContext);
+                Status = IopHandleCacheReadMiss(FileObject, &MissContext, 0);
 
                 //
                 // This should not fail due to end of file because the cache
@@ -730,8 +879,19 @@ Return Value:
         BytesRemaining -= BytesThisRound;
     }
 
+    PageCount = ALIGN_RANGE_UP(PageAlignedSize, PageSize) >> MmPageShift();
+    if (HitCount != 0) {
+        RtlAtomicAdd64((PULONGLONG)&IoPageCacheReadHitPageCount, HitCount);
+    }
+
+    if (HitCount != PageCount) {
+        RtlAtomicAdd64((PULONGLONG)&IoPageCacheReadMissPageCount,
+                       PageCount - HitCount);
+    }
+
     //
-    // Handle any final cache read misses.
+    // Handle any final cache read misses. This is where a sequential reader
+    // synchronously reads ahead, extending the miss by the current window.
     //
 
     if (CacheMiss != FALSE) {
@@ -746,7 +906,9 @@ Return Value:
         MissContext.Flags = IoContext->Flags;
         MissContext.TimeoutInMilliseconds = IoContext->TimeoutInMilliseconds;
         MissContext.Write = FALSE;
-        Status = IopHandleCacheReadMiss(FileObject, &MissContext);
+        Status = IopHandleCacheReadMiss(FileObject,
+                                        &MissContext,
+                                        ReadAheadSize);
 
         ASSERT(Status != STATUS_END_OF_FILE);
 
@@ -757,6 +919,18 @@ Return Value:
         ASSERT(MissContext.BytesCompleted == (CurrentOffset - CacheMissOffset));
 
         TotalBytesRead += MissContext.BytesCompleted;
+        if (ReadAheadSize != 0) {
+            ReadAheadEnd = ALIGN_RANGE_UP(CurrentOffset, PageSize) +
+                           ReadAheadSize;
+
+            if (ReadAheadEnd > ALIGN_RANGE_UP(FileSize, PageSize)) {
+                ReadAheadEnd = ALIGN_RANGE_UP(FileSize, PageSize);
+            }
+
+            if (ReadAheadEnd > Handle->ReadAheadEnd) {
+                Handle->ReadAheadEnd = ReadAheadEnd;
+            }
+        }
     }
 
     //
@@ -780,6 +954,15 @@ Return Value:
         }
     }
 
+    //
+    // Kick off the next chunk of read-ahead before the reader catches up to
+    // the end of what has been read so far.
+    //
+
+    if (ReadAheadSize != 0) {
+        IopQueueReadAhead(Handle, IoContext->Offset + SizeInBytes);
+    }
+
 PerformCachedReadEnd:
 
     //
@@ -979,13 +1162,17 @@ Return Value:
 
         //
         // Look for the page in the page cache and if it is found, hand the
-        // work off to the cache write hit routine.
+        // work off to the cache write hit routine. A write that picks up
+        // partway into a page is most likely appending to what an earlier
+        // write left there, so don't count it as another use of the page.
         //
 
         ASSERT(IS_ALIGNED(WriteContext.FileOffset, PageSize) != FALSE);
 
-        PageCacheEntry = IopLookupPageCacheEntry(FileObject,
-                                                 WriteContext.FileOffset);
+        PageCacheEntry = IopLookupPageCacheEntry(
+                                           FileObject,
+                                           WriteContext.FileOffset,
+                                           WriteContext.PageByteOffset == 0);
 
         if (PageCacheEntry != NULL) {
             Status = IopHandleCacheWriteHit(PageCacheEntry, &WriteContext);
@@ -1206,7 +1393,7 @@ Return Value:
         MissContext.Flags = WriteContext->IoFlags;
         MissContext.TimeoutInMilliseconds = TimeoutInMilliseconds;
         MissContext.Write = TRUE;
-        Status = IopHandleCacheReadMiss(FileObject, &MissContext);
+        Status = IopHandleCacheReadMiss(FileObject, &MissContext, 0);
         if ((!KSUCCESS(Status)) &&
             ((Status != STATUS_END_OF_FILE) ||
              (MissContext.BytesCompleted == 0))) {
@@ -1502,7 +1689,8 @@ Return Value:
                                                  WriteContext->PageByteOffset,
                                                  WriteContext->SourceBuffer,
                                                  WriteContext->SourceOffset,
-                                                 WriteContext->BytesThisRound);
+                                                 WriteContext->BytesThisRound,
+                                                 TRUE);
 
         if (!KSUCCESS(Status)) {
             goto HandleCacheWriteHitEnd;
@@ -1534,7 +1722,8 @@ Return Value:
 KSTATUS
 IopHandleCacheReadMiss (
     PFILE_OBJECT FileObject,
-    PIO_CONTEXT IoContext
+    PIO_CONTEXT IoContext,
+    UINTN ReadAheadSize
     )
 
 /*++
@@ -1552,6 +1741,10 @@ Routine Description:
 
     IoContext - Supplies a pointer to the I/O context for the cache miss.
 
+    ReadAheadSize - Supplies the number of additional bytes beyond the miss to
+        read into the cache on behalf of a sequential reader. Supply zero to
+        get the default behavior for the object type.
+
 Return Value:
 
     Status code.
@@ -1567,6 +1760,7 @@ Return Value:
     UINTN BytesCopied;
     UINTN CopySize;
     ULONGLONG FileSize;
+    UINTN MissSize;
     ULONG PageSize;
     PIO_BUFFER ReadIoBuffer;
     IO_CONTEXT ReadIoContext;
@@ -1601,6 +1795,8 @@ Return Value:
 
     ASSERT(IS_ALIGNED(BlockAlignedOffset, PageSize) != FALSE);
 
+    MissSize = BlockAlignedSize;
+
     //
     // If this is a miss for a device, read ahead some amount in anticipation
     // of accessing the next pages of the device in the near future. Don't read
@@ -1622,6 +1818,29 @@ Return Value:
             BlockAlignedSize = FileSize - BlockAlignedOffset;
             BlockAlignedSize = ALIGN_RANGE_UP(BlockAlignedSize, PageSize);
         }
+
+    //
+    // A sequential reader asked for the read to be extended. Don't read past
+    // the page containing the end of the file.
+    //
+
+    } else if (ReadAheadSize != 0) {
+        FileSize = FileObject->Properties.Size;
+
+        ASSERT(IS_ALIGNED(ReadAheadSize, PageSize) != FALSE);
+        ASSERT(FileSize > BlockAlignedOffset);
+
+        BlockAlignedSize += ReadAheadSize;
+        if (((BlockAlignedOffset + BlockAlignedSize) < BlockAlignedOffset) ||
+            ((BlockAlignedOffset + BlockAlignedSize) > FileSize)) {
+
+            BlockAlignedSize = FileSize - BlockAlignedOffset;
+            BlockAlignedSize = ALIGN_RANGE_UP(BlockAlignedSize, BlockSize);
+            BlockAlignedSize = ALIGN_RANGE_UP(BlockAlignedSize, PageSize);
+            if (BlockAlignedSize < MissSize) {
+                BlockAlignedSize = MissSize;
+            }
+        }
     }
 
     //
@@ -1649,6 +1868,16 @@ Return Value:
     ReadIoContext.Flags = IoContext->Flags;
     ReadIoContext.TimeoutInMilliseconds = IoContext->TimeoutInMilliseconds;
     ReadIoContext.Write = FALSE;
+
+    //
+    // A block device may lend its own memory to this buffer, since the pages
+    // only ever get cached at the same device offset.
+    //
+
+    if (FileObject->Properties.Type == IoObjectBlockDevice) {
+        ReadIoContext.Flags |= IO_FLAG_CACHE_FILL;
+    }
+
     Status = IopPerformNonCachedRead(FileObject, &ReadIoContext, NULL);
     if ((!KSUCCESS(Status)) &&
         ((Status != STATUS_END_OF_FILE) ||
@@ -1697,6 +1926,11 @@ Return Value:
 
     ASSERT(BytesCopied != 0);
 
+    if ((ReadAheadSize != 0) && (BlockAlignedSize > MissSize)) {
+        RtlAtomicAdd64((PULONGLONG)&IoReadAheadPageCount,
+                       (BlockAlignedSize - MissSize) >> MmPageShift());
+    }
+
     //
     // Report back the number of bytes copied but never more than the size
     // requested.
@@ -1717,6 +1951,344 @@ Return Value:
     return Status;
 }
 
+UINTN
+IopUpdateReadAheadWindow (
+    PIO_HANDLE Handle,
+    IO_OFFSET Offset,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tracks the access pattern of reads on the given handle and
+    sizes the read-ahead window accordingly. A read that starts where the last
+    one ended grows the window, and any other read collapses it. The file
+    object lock must be held at least shared. Reads from multiple threads on
+    the same handle may race here, which only makes the heuristic less
+    accurate.
+
+Arguments:
+
+    Handle - Supplies a pointer to the I/O handle being read from.
+
+    Offset - Supplies the file offset where the read begins.
+
+    Size - Supplies the number of bytes being read, already truncated to the
+        end of the file.
+
+Return Value:
+
+    Returns the number of bytes to read ahead of this read, which is zero if
+    the handle is not being read sequentially.
+
+--*/
+
+{
+
+    IO_OFFSET HitEnd;
+    ULONG PageShift;
+    ULONG PageSize;
+    IO_OFFSET ReadAheadOffset;
+    UINTN Window;
+
+    if (Handle->FileObject->Properties.Type != IoObjectRegularFile) {
+        return 0;
+    }
+
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    ReadAheadOffset = Handle->ReadAheadOffset;
+    Window = Handle->ReadAheadWindow;
+    if (Offset == ReadAheadOffset) {
+
+        //
+        // Count pages completed by this read that were brought in by an
+        // earlier read-ahead. A page counts when a read reaches its end, so
+        // small reads don't count the same page more than once.
+        //
+
+        HitEnd = Offset + Size;
+        if (HitEnd > Handle->ReadAheadEnd) {
+            HitEnd = Handle->ReadAheadEnd;
+        }
+
+        HitEnd = ALIGN_RANGE_DOWN(HitEnd, PageSize);
+        if (HitEnd > ALIGN_RANGE_DOWN(Offset, PageSize)) {
+            RtlAtomicAdd64(
+                       (PULONGLONG)&IoReadAheadHitPageCount,
+                       (HitEnd - ALIGN_RANGE_DOWN(Offset, PageSize)) >>
+                       PageShift);
+        }
+
+        if (Window == 0) {
+            Window = IO_READ_AHEAD_MINIMUM_SIZE;
+
+        } else if (Window < IO_READ_AHEAD_MAXIMUM_SIZE) {
+            Window <<= 1;
+        }
+
+    //
+    // The reader jumped. Anything read ahead but not yet consumed is wasted,
+    // and the window collapses until a sequential pattern reappears.
+    //
+
+    } else {
+        ReadAheadOffset = ALIGN_RANGE_UP(ReadAheadOffset, PageSize);
+        if (Handle->ReadAheadEnd > ReadAheadOffset) {
+            RtlAtomicAdd64((PULONGLONG)&IoReadAheadWastePageCount,
+                           (Handle->ReadAheadEnd - ReadAheadOffset) >>
+                           PageShift);
+        }
+
+        Handle->ReadAheadEnd = 0;
+        Window = 0;
+    }
+
+    Handle->ReadAheadOffset = Offset + Size;
+    Handle->ReadAheadWindow = Window;
+
+    //
+    // Keep tracking the pattern, but don't read anything extra if memory is
+    // tight.
+    //
+
+    if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevelNone) {
+        return 0;
+    }
+
+    return Window;
+}
+
+VOID
+IopQueueReadAhead (
+    PIO_HANDLE Handle,
+    IO_OFFSET ReadEnd
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues an asynchronous read-ahead for a sequential reader if
+    the reader has consumed at least half of the data read ahead so far. This
+    keeps the next window arriving before the reader needs it. The file object
+    lock must be held.
+
+Arguments:
+
+    Handle - Supplies a pointer to the I/O handle being read from.
+
+    ReadEnd - Supplies the file offset where the read that just completed
+        ended.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    IO_OFFSET End;
+    PFILE_OBJECT FileObject;
+    ULONG PageSize;
+    PIO_READ_AHEAD_REQUEST Request;
+    IO_OFFSET Start;
+    KSTATUS Status;
+    UINTN Window;
+
+    Window = Handle->ReadAheadWindow;
+    if (Window == 0) {
+        return;
+    }
+
+    if ((Handle->ReadAheadEnd > ReadEnd) &&
+        ((Handle->ReadAheadEnd - ReadEnd) > (Window >> 1))) {
+
+        return;
+    }
+
+    FileObject = Handle->FileObject;
+    PageSize = MmPageSize();
+    Start = ALIGN_RANGE_UP(ReadEnd, PageSize);
+    if (Start < Handle->ReadAheadEnd) {
+        Start = Handle->ReadAheadEnd;
+    }
+
+    End = Start + Window;
+    if (End > ALIGN_RANGE_UP(FileObject->Properties.Size, PageSize)) {
+        End = ALIGN_RANGE_UP(FileObject->Properties.Size, PageSize);
+    }
+
+    if (Start >= End) {
+        return;
+    }
+
+    Request = MmAllocatePagedPool(sizeof(IO_READ_AHEAD_REQUEST),
+                                  IO_ALLOCATION_TAG);
+
+    if (Request == NULL) {
+        return;
+    }
+
+    IopFileObjectAddReference(FileObject);
+    Request->FileObject = FileObject;
+    Request->Offset = Start;
+    Request->Size = (UINTN)(End - Start);
+    Status = KeCreateAndQueueWorkItem(NULL,
+                                      WorkPriorityNormal,
+                                      IopReadAheadWorker,
+                                      Request);
+
+    if (!KSUCCESS(Status)) {
+        IopFileObjectReleaseReference(FileObject);
+        MmFreePagedPool(Request);
+        return;
+    }
+
+    Handle->ReadAheadEnd = End;
+    return;
+}
+
+VOID
+IopReadAheadWorker (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs an asynchronous read-ahead, reading any pages in the
+    requested range that are not yet cached into the page cache.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the read-ahead request. This routine
+        releases the file object reference and frees the request.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BytesCopied;
+    IO_OFFSET End;
+    PFILE_OBJECT FileObject;
+    ULONGLONG FileSize;
+    IO_OFFSET Offset;
+    PPAGE_CACHE_ENTRY PageCacheEntry;
+    ULONG PageSize;
+    PIO_BUFFER ReadIoBuffer;
+    IO_CONTEXT ReadIoContext;
+    PIO_READ_AHEAD_REQUEST Request;
+    UINTN Size;
+    KSTATUS Status;
+
+    Request = Parameter;
+    FileObject = Request->FileObject;
+    PageSize = MmPageSize();
+    ReadIoBuffer = NULL;
+    KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
+
+    //
+    // The file may have shrunk since the request was queued.
+    //
+
+    FileSize = FileObject->Properties.Size;
+    End = Request->Offset + Request->Size;
+    if (End > ALIGN_RANGE_UP(FileSize, PageSize)) {
+        End = ALIGN_RANGE_UP(FileSize, PageSize);
+    }
+
+    //
+    // Skip over the leading pages that are already cached. Pages cached
+    // after the first miss are looked up rather than replaced when the read
+    // is cached below.
+    //
+
+    Offset = Request->Offset;
+    while (Offset < End) {
+        PageCacheEntry = IopLookupPageCacheEntry(FileObject, Offset, FALSE);
+        if (PageCacheEntry == NULL) {
+            break;
+        }
+
+        IoPageCacheEntryReleaseReference(PageCacheEntry);
+        Offset += PageSize;
+    }
+
+    if (Offset >= End) {
+        goto ReadAheadWorkerEnd;
+    }
+
+    ASSERT(IS_ALIGNED(Offset, FileObject->Properties.BlockSize) != FALSE);
+
+    Size = (UINTN)(End - Offset);
+    ReadIoBuffer = MmAllocateUninitializedIoBuffer(Size, 0);
+    if (ReadIoBuffer == NULL) {
+        goto ReadAheadWorkerEnd;
+    }
+
+    ReadIoContext.IoBuffer = ReadIoBuffer;
+    ReadIoContext.Offset = Offset;
+    ReadIoContext.SizeInBytes = Size;
+    ReadIoContext.BytesCompleted = 0;
+    ReadIoContext.Flags = 0;
+    if (FileObject->Properties.Type == IoObjectBlockDevice) {
+        ReadIoContext.Flags = IO_FLAG_CACHE_FILL;
+    }
+
+    ReadIoContext.TimeoutInMilliseconds = WAIT_TIME_INDEFINITE;
+    ReadIoContext.Write = FALSE;
+    Status = IopPerformNonCachedRead(FileObject, &ReadIoContext, NULL);
+    if ((!KSUCCESS(Status)) &&
+        ((Status != STATUS_END_OF_FILE) ||
+         (ReadIoContext.BytesCompleted == 0))) {
+
+        goto ReadAheadWorkerEnd;
+    }
+
+    if (Size != ReadIoContext.BytesCompleted) {
+        Status = MmZeroIoBuffer(ReadIoBuffer,
+                                ReadIoContext.BytesCompleted,
+                                Size - ReadIoContext.BytesCompleted);
+
+        if (!KSUCCESS(Status)) {
+            goto ReadAheadWorkerEnd;
+        }
+    }
+
+    Status = IopCopyAndCacheIoBuffer(FileObject,
+                                     Offset,
+                                     NULL,
+                                     0,
+                                     ReadIoBuffer,
+                                     Size,
+                                     0,
+                                     &BytesCopied);
+
+    if (KSUCCESS(Status)) {
+        RtlAtomicAdd64((PULONGLONG)&IoReadAheadPageCount,
+                       Size >> MmPageShift());
+    }
+
+ReadAheadWorkerEnd:
+    KeReleaseSharedExclusiveLockExclusive(FileObject->Lock);
+    if (ReadIoBuffer != NULL) {
+        MmFreeIoBuffer(ReadIoBuffer);
+    }
+
+    IopFileObjectReleaseReference(FileObject);
+    MmFreePagedPool(Request);
+    return;
+}
+
 KSTATUS
 IopPerformCachedIoBufferWrite (
     PFILE_OBJECT FileObject,
@@ -1844,7 +2416,7 @@ Return Value:
     //
 
     } else {
-        IopSchedulePageCacheThread();
+        IopScheduleWriteback(FileObject);
         IoContext->BytesCompleted = IoContext->SizeInBytes;
         Status = STATUS_SUCCESS;
     }
@@ -2446,3 +3018,339 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+IopFlushForDirectIo (
+    PIO_HANDLE Handle,
+    PIO_CONTEXT IoContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes out any dirty page cache entries that overlap a direct
+    I/O request, so that the request neither reads stale data from the device
+    nor has its write later overwritten by an older cached copy. The file
+    object lock must not be held.
+
+Arguments:
+
+    Handle - Supplies a pointer to the I/O handle the request is on.
+
+    IoContext - Supplies a pointer to the I/O context of the direct request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    IO_OFFSET End;
+    PFILE_OBJECT FileObject;
+    IO_OFFSET Offset;
+    ULONG PageSize;
+    ULONGLONG Size;
+    KSTATUS Status;
+
+    FileObject = Handle->FileObject;
+    if ((FileObject->Flags & FILE_OBJECT_FLAG_DIRTY_DATA) == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // The offset of a request without one is only settled once the file
+    // object lock is held. Use a snapshot of the current offset; it only
+    // moves underneath this request if another thread is racing on the same
+    // handle. Appends land wherever the end of the file is by then, so flush
+    // everything for those.
+    //
+
+    Offset = IoContext->Offset;
+    if (Offset == IO_OFFSET_NONE) {
+        Offset = RtlAtomicOr64((PULONGLONG)&(Handle->CurrentOffset), 0);
+    }
+
+    PageSize = MmPageSize();
+    End = ALIGN_RANGE_UP(Offset + IoContext->SizeInBytes, PageSize);
+    Offset = ALIGN_RANGE_DOWN(Offset, PageSize);
+    Size = End - Offset;
+    if ((IoContext->Write != FALSE) &&
+        ((Handle->OpenFlags & OPEN_FLAG_APPEND) != 0)) {
+
+        Offset = 0;
+        Size = -1ULL;
+    }
+
+    KeAcquireSharedExclusiveLockShared(FileObject->Lock);
+    Status = IopFlushPageCacheEntries(FileObject, Offset, Size, 0, NULL);
+    KeReleaseSharedExclusiveLockShared(FileObject->Lock);
+    return Status;
+}
+
+BOOL
+IopCanPerformDirectIo (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not a request on a handle opened for
+    direct I/O can actually bypass the page cache. Only requests aligned to
+    the block size of the object can; others fall back to the cache. So do
+    requests without a buffer to fill, such as page-ins of mapped files, which
+    want the page cache's own pages. The file object lock must be held and the
+    request's offset must be resolved.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object being read or written.
+
+    IoContext - Supplies a pointer to the I/O context.
+
+Return Value:
+
+    TRUE if the request can be performed directly.
+
+    FALSE if the request should go through the page cache.
+
+--*/
+
+{
+
+    ULONG BlockSize;
+
+    ASSERT(IoContext->Offset != IO_OFFSET_NONE);
+
+    if (FileObject->Properties.Type == IoObjectBlockDevice) {
+        BlockSize = FileObject->Properties.BlockSize;
+
+    } else if (FileObject->Properties.Type == IoObjectRegularFile) {
+        BlockSize = MmPageSize();
+
+    } else {
+        return FALSE;
+    }
+
+    if ((IS_ALIGNED(IoContext->Offset, BlockSize) == FALSE) ||
+        (IS_ALIGNED(IoContext->SizeInBytes, BlockSize) == FALSE)) {
+
+        return FALSE;
+    }
+
+    if (MmGetIoBufferSize(IoContext->IoBuffer) < IoContext->SizeInBytes) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+KSTATUS
+IopPerformDirectIo (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext,
+    PVOID DeviceContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a block-aligned read or write straight between the
+    caller's buffer and the backing device, skipping the page cache. The
+    buffer is locked once here so that neither the file system nor the block
+    driver below has to lock it again. Cached pages the write overlaps are
+    updated to match. It is assumed the file object lock is held, shared for
+    reads and exclusive for writes.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object for the file or device.
+
+    IoContext - Supplies a pointer to the I/O context.
+
+    DeviceContext - Supplies a pointer to the device context to use when
+        performing I/O on the backing device.
+
+Return Value:
+
+    Status code. A failing status code does not necessarily mean no I/O made it
+    in or out. Check the bytes completed value in the I/O context to find out
+    how much occurred.
+
+--*/
+
+{
+
+    ULONGLONG FileSize;
+    PIO_BUFFER LockedBuffer;
+    BOOL LockedCopy;
+    PIO_BUFFER OriginalBuffer;
+    KSTATUS Status;
+
+    ASSERT(IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE);
+
+    IoContext->BytesCompleted = 0;
+    OriginalBuffer = IoContext->IoBuffer;
+    LockedBuffer = OriginalBuffer;
+    if ((IoContext->Write == FALSE) &&
+        (FileObject->Properties.Type != IoObjectBlockDevice)) {
+
+        FileSize = FileObject->Properties.Size;
+        if (IoContext->Offset >= FileSize) {
+            Status = STATUS_END_OF_FILE;
+            goto PerformDirectIoEnd;
+        }
+    }
+
+    //
+    // With no alignment or address requirements, validation only pins the
+    // pages. Drivers with stricter needs still get their own copies.
+    //
+
+    Status = MmValidateIoBuffer(0,
+                                MAX_ULONGLONG,
+                                0,
+                                IoContext->SizeInBytes,
+                                FALSE,
+                                &LockedBuffer,
+                                &LockedCopy);
+
+    if (!KSUCCESS(Status)) {
+        goto PerformDirectIoEnd;
+    }
+
+    ASSERT((LockedBuffer == OriginalBuffer) || (LockedCopy != FALSE));
+
+    //
+    // Mark the request direct so the file system does the same for the
+    // device I/O it issues on behalf of this request.
+    //
+
+    IoContext->IoBuffer = LockedBuffer;
+    IoContext->Flags |= IO_FLAG_DIRECT;
+    if (IoContext->Write != FALSE) {
+        Status = IopPerformNonCachedWrite(FileObject, IoContext, DeviceContext);
+        if (IoContext->BytesCompleted != 0) {
+            IopUpdatePageCacheForDirectWrite(FileObject,
+                                             IoContext->Offset,
+                                             LockedBuffer,
+                                             IoContext->BytesCompleted);
+        }
+
+    } else {
+        Status = IopPerformNonCachedRead(FileObject, IoContext, DeviceContext);
+
+        //
+        // The tail of a file is read as a full block. Do not report anything
+        // beyond the end of the file, and succeed if anything was read.
+        //
+
+        if (FileObject->Properties.Type != IoObjectBlockDevice) {
+            FileSize = FileObject->Properties.Size;
+            if ((IoContext->Offset + IoContext->BytesCompleted) > FileSize) {
+                IoContext->BytesCompleted = FileSize - IoContext->Offset;
+            }
+        }
+
+        if ((Status == STATUS_END_OF_FILE) &&
+            (IoContext->BytesCompleted != 0)) {
+
+            Status = STATUS_SUCCESS;
+        }
+    }
+
+    IoContext->IoBuffer = OriginalBuffer;
+
+PerformDirectIoEnd:
+    if (LockedBuffer != OriginalBuffer) {
+        MmFreeIoBuffer(LockedBuffer);
+    }
+
+    return Status;
+}
+
+VOID
+IopUpdatePageCacheForDirectWrite (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset,
+    PIO_BUFFER IoBuffer,
+    UINTN SizeInBytes
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies the data of a completed direct write into any page
+    cache entries that hold the written range, keeping cached readers and
+    memory mappings coherent with the device. The entries are not marked
+    dirty, as the device already has the data. The file object lock must be
+    held exclusively.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object that was written.
+
+    Offset - Supplies the file or device offset the write started at.
+
+    IoBuffer - Supplies a pointer to the I/O buffer holding the written data.
+
+    SizeInBytes - Supplies the number of bytes that were written.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BytesThisRound;
+    IO_OFFSET CurrentOffset;
+    IO_OFFSET End;
+    PPAGE_CACHE_ENTRY PageCacheEntry;
+    ULONG PageOffset;
+    ULONG PageSize;
+
+    ASSERT(KeIsSharedExclusiveLockHeldExclusive(FileObject->Lock) != FALSE);
+
+    if (PAGE_CACHE_INDEX_EMPTY(&(FileObject->PageCacheIndex)) != FALSE) {
+        return;
+    }
+
+    PageSize = MmPageSize();
+    CurrentOffset = Offset;
+    End = Offset + SizeInBytes;
+    while (CurrentOffset < End) {
+        PageOffset = REMAINDER(CurrentOffset, PageSize);
+        BytesThisRound = PageSize - PageOffset;
+        if (BytesThisRound > (End - CurrentOffset)) {
+            BytesThisRound = End - CurrentOffset;
+        }
+
+        PageCacheEntry = IopLookupPageCacheEntry(FileObject,
+                                                 CurrentOffset - PageOffset,
+                                                 FALSE);
+
+        if (PageCacheEntry != NULL) {
+            IopCopyIoBufferToPageCacheEntry(PageCacheEntry,
+                                            PageOffset,
+                                            IoBuffer,
+                                            CurrentOffset - Offset,
+                                            BytesThisRound,
+                                            FALSE);
+
+            IoPageCacheEntryReleaseReference(PageCacheEntry);
+        }
+
+        CurrentOffset += BytesThisRound;
+    }
+
+    return;
+}
+
@@ -686,6 +686,12 @@ Return Value:
 
     ASSERT(LIST_EMPTY(&(Device->WorkQueue)) != FALSE);
 
+    //
+    // Tear down the I/O scheduler, which should have nothing queued.
+    //
+
+    IopDestroyIoScheduler(Device);
+
     //
     // Detached the drivers from the device.
     //
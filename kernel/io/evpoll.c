@@ -0,0 +1,1804 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    evpoll.c
+
+Abstract:
+
+    This module implements event poll sets, which are persistent sets of I/O
+    handles that can be waited on together. Unlike poll, the interest set is
+    registered once, and I/O objects queue their entries to a ready list as
+    their state changes, so a wait only touches the handles that are ready.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define EVENT_POLL_ALLOCATION_TAG 0x6C6F5045 // 'loPE'
+
+//
+// Define the number of ready events gathered on the stack before being copied
+// out to user mode.
+//
+
+#define EVENT_POLL_HARVEST_BATCH 32
+
+//
+// This flag is set on a one-shot entry once it has been reported. It is
+// cleared when the entry is modified.
+//
+
+#define EVENT_POLL_ENTRY_FLAG_DISABLED 0x00000001
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines an event poll set. It is allocated from non-paged
+    pool, as the ready list is manipulated when I/O object state changes,
+    which may happen at dispatch level.
+
+Members:
+
+    ReferenceCount - Stores the reference count on the set. The file object
+        holds one reference.
+
+    Lock - Stores a pointer to the queued lock that protects the tree of
+        entries and serializes waits.
+
+    EntryTree - Stores the tree of entries in the set, keyed by I/O handle.
+
+    ReadyLock - Stores the spin lock that protects the ready list.
+
+    ReadyList - Stores the head of the list of entries that may be ready.
+
+    IoState - Stores a pointer to the set's own I/O object state. This is
+        signaled for read whenever the ready list is not empty.
+
+--*/
+
+typedef struct _EVENT_POLL {
+    volatile ULONG ReferenceCount;
+    PQUEUED_LOCK Lock;
+    RED_BLACK_TREE EntryTree;
+    KSPIN_LOCK ReadyLock;
+    LIST_ENTRY ReadyList;
+    PIO_OBJECT_STATE IoState;
+} EVENT_POLL, *PEVENT_POLL;
+
+/*++
+
+Structure Description:
+
+    This structure defines a single I/O handle's registration in an event poll
+    set. It is allocated from non-paged pool.
+
+Members:
+
+    TreeNode - Stores the node in the event poll set's tree of entries.
+
+    WatchListEntry - Stores pointers to the next and previous entries watching
+        the same I/O object state.
+
+    ReadyListEntry - Stores pointers to the next and previous entries on the
+        set's ready list. The next pointer is NULL if the entry is not queued.
+
+    EventPoll - Stores a pointer to the set that owns this entry.
+
+    Key - Stores the I/O handle this entry was registered for. This is only
+        used to find the entry in the tree.
+
+    Handle - Stores a pointer to the registered I/O handle. No reference is
+        held, and this is set to NULL if the handle is closed while the set is
+        being destroyed.
+
+    FileObject - Stores a pointer to the handle's file object. A reference is
+        held on the file object to keep the I/O state alive.
+
+    IoState - Stores a pointer to the I/O object state being watched.
+
+    Events - Stores the mask of poll events of interest, along with the
+        EVENT_POLL_FLAG_* flags.
+
+    Flags - Stores internal state. See EVENT_POLL_ENTRY_FLAG_* definitions.
+
+    Data - Stores the opaque data returned to user mode with the events.
+
+--*/
+
+typedef struct _EVENT_POLL_ENTRY {
+    RED_BLACK_TREE_NODE TreeNode;
+    LIST_ENTRY WatchListEntry;
+    LIST_ENTRY ReadyListEntry;
+    PEVENT_POLL EventPoll;
+    PIO_HANDLE Key;
+    PIO_HANDLE Handle;
+    PFILE_OBJECT FileObject;
+    PIO_OBJECT_STATE IoState;
+    ULONG Events;
+    ULONG Flags;
+    ULONGLONG Data;
+} EVENT_POLL_ENTRY, *PEVENT_POLL_ENTRY;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+IopGetEventPollFromHandle (
+    HANDLE Handle,
+    PIO_HANDLE *IoHandle,
+    PEVENT_POLL *EventPoll
+    );
+
+KSTATUS
+IopEventPollAdd (
+    PEVENT_POLL EventPoll,
+    PIO_HANDLE Handle,
+    PEVENT_POLL_EVENT Event
+    );
+
+KSTATUS
+IopEventPollModify (
+    PEVENT_POLL EventPoll,
+    PIO_HANDLE Handle,
+    PEVENT_POLL_EVENT Event
+    );
+
+KSTATUS
+IopEventPollHarvest (
+    PEVENT_POLL EventPoll,
+    PEVENT_POLL_EVENT UserEvents,
+    ULONG EventCount,
+    PULONG ReturnedCount
+    );
+
+VOID
+IopEventPollQueueIfReady (
+    PEVENT_POLL_ENTRY Entry
+    );
+
+VOID
+IopEventPollRemoveEntry (
+    PEVENT_POLL EventPoll,
+    PEVENT_POLL_ENTRY Entry
+    );
+
+PEVENT_POLL_ENTRY
+IopFindEventPollEntry (
+    PEVENT_POLL EventPoll,
+    PIO_HANDLE Handle
+    );
+
+VOID
+IopUpdateEventPollReadiness (
+    PEVENT_POLL EventPoll
+    );
+
+PEVENT_POLL_WATCH
+IopGetEventPollWatch (
+    PIO_OBJECT_STATE IoState
+    );
+
+BOOL
+IopEventPollTryAddReference (
+    PEVENT_POLL EventPoll
+    );
+
+VOID
+IopDestroyEventPoll (
+    PEVENT_POLL EventPoll
+    );
+
+COMPARISON_RESULT
+IopCompareEventPollEntries (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INTN
+IoSysCreateEventPoll (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for creating a new event poll
+    set.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+{
+
+    CREATE_PARAMETERS Create;
+    ULONG HandleFlags;
+    PIO_HANDLE IoHandle;
+    PSYSTEM_CALL_CREATE_EVENT_POLL Parameters;
+    PKPROCESS Process;
+    KSTATUS Status;
+
+    Parameters = (PSYSTEM_CALL_CREATE_EVENT_POLL)SystemCallParameter;
+    Parameters->Handle = INVALID_HANDLE;
+    Process = PsGetCurrentProcess();
+
+    ASSERT(Process != PsGetKernelProcess());
+
+    IoHandle = NULL;
+    if ((Parameters->OpenFlags & ~SYS_OPEN_FLAG_CLOSE_ON_EXECUTE) != 0) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto SysCreateEventPollEnd;
+    }
+
+    HandleFlags = 0;
+    if ((Parameters->OpenFlags & SYS_OPEN_FLAG_CLOSE_ON_EXECUTE) != 0) {
+        HandleFlags |= FILE_DESCRIPTOR_CLOSE_ON_EXECUTE;
+    }
+
+    Create.Type = IoObjectEventPoll;
+    Create.Context = NULL;
+    Create.Permissions = FILE_PERMISSION_USER_READ | FILE_PERMISSION_USER_WRITE;
+    Create.Created = FALSE;
+    Status = IopOpen(FALSE,
+                     NULL,
+                     NULL,
+                     0,
+                     IO_ACCESS_READ,
+                     OPEN_FLAG_CREATE,
+                     &Create,
+                     &IoHandle);
+
+    if (!KSUCCESS(Status)) {
+        goto SysCreateEventPollEnd;
+    }
+
+    Status = ObCreateHandle(Process->HandleTable,
+                            IoHandle,
+                            HandleFlags,
+                            &(Parameters->Handle));
+
+SysCreateEventPollEnd:
+    if (!KSUCCESS(Status)) {
+        if (IoHandle != NULL) {
+            IoIoHandleReleaseReference(IoHandle);
+        }
+
+        Parameters->Handle = INVALID_HANDLE;
+    }
+
+    return Status;
+}
+
+INTN
+IoSysEventPollControl (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for adding, modifying, or removing
+    an I/O handle in an event poll set.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+{
+
+    PEVENT_POLL_ENTRY Entry;
+    PEVENT_POLL EventPoll;
+    PIO_HANDLE EventPollHandle;
+    PIO_HANDLE IoHandle;
+    PSYSTEM_CALL_EVENT_POLL_CONTROL Parameters;
+    PKPROCESS Process;
+    KSTATUS Status;
+
+    Parameters = (PSYSTEM_CALL_EVENT_POLL_CONTROL)SystemCallParameter;
+    Process = PsGetCurrentProcess();
+    IoHandle = NULL;
+    Status = IopGetEventPollFromHandle(Parameters->EventPoll,
+                                       &EventPollHandle,
+                                       &EventPoll);
+
+    if (!KSUCCESS(Status)) {
+        goto SysEventPollControlEnd;
+    }
+
+    IoHandle = ObGetHandleValue(Process->HandleTable, Parameters->Handle, NULL);
+    if (IoHandle == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto SysEventPollControlEnd;
+    }
+
+    switch (Parameters->Operation) {
+    case EventPollOperationAdd:
+        Status = IopEventPollAdd(EventPoll, IoHandle, &(Parameters->Event));
+        break;
+
+    case EventPollOperationModify:
+        Status = IopEventPollModify(EventPoll, IoHandle, &(Parameters->Event));
+        break;
+
+    case EventPollOperationDelete:
+        KeAcquireQueuedLock(EventPoll->Lock);
+        Entry = IopFindEventPollEntry(EventPoll, IoHandle);
+        if (Entry == NULL) {
+            Status = STATUS_NOT_FOUND;
+
+        } else {
+            IopEventPollRemoveEntry(EventPoll, Entry);
+            Status = STATUS_SUCCESS;
+        }
+
+        KeReleaseQueuedLock(EventPoll->Lock);
+        break;
+
+    default:
+        Status = STATUS_INVALID_PARAMETER;
+        break;
+    }
+
+SysEventPollControlEnd:
+    if (IoHandle != NULL) {
+        IoIoHandleReleaseReference(IoHandle);
+    }
+
+    if (EventPollHandle != NULL) {
+        IoIoHandleReleaseReference(EventPollHandle);
+    }
+
+    return Status;
+}
+
+INTN
+IoSysEventPollWait (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for waiting on an event poll set.
+    Only the entries that are ready are returned.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or the number of events returned (a positive integer) on
+    success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
+{
+
+    ULONGLONG ElapsedTimeInMilliseconds;
+    PEVENT_POLL EventPoll;
+    PIO_HANDLE EventPollHandle;
+    ULONGLONG Frequency;
+    SIGNAL_SET OldSignalSet;
+    PSYSTEM_CALL_EVENT_POLL_WAIT Parameters;
+    BOOL RestoreSignalMask;
+    INTN Result;
+    ULONG ReturnedCount;
+    SIGNAL_SET SignalMask;
+    ULONGLONG StartTime;
+    KSTATUS Status;
+    PKTHREAD Thread;
+    ULONG Timeout;
+
+    Parameters = (PSYSTEM_CALL_EVENT_POLL_WAIT)SystemCallParameter;
+    Thread = KeGetCurrentThread();
+    RestoreSignalMask = FALSE;
+    ReturnedCount = 0;
+    Status = IopGetEventPollFromHandle(Parameters->EventPoll,
+                                       &EventPollHandle,
+                                       &EventPoll);
+
+    if (!KSUCCESS(Status)) {
+        goto SysEventPollWaitEnd;
+    }
+
+    if ((Parameters->Events == NULL) || (Parameters->EventCount <= 0)) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto SysEventPollWaitEnd;
+    }
+
+    //
+    // Set the signal mask if supplied.
+    //
+
+    if (Parameters->SignalMask != NULL) {
+        Status = MmCopyFromUserMode(&SignalMask,
+                                    Parameters->SignalMask,
+                                    sizeof(SIGNAL_SET));
+
+        if (!KSUCCESS(Status)) {
+            goto SysEventPollWaitEnd;
+        }
+
+        PsSetSignalMask(&SignalMask, &OldSignalSet);
+        RestoreSignalMask = TRUE;
+    }
+
+    Timeout = Parameters->TimeoutInMilliseconds;
+    StartTime = 0;
+    if ((Timeout != 0) && (Timeout != WAIT_TIME_INDEFINITE)) {
+        StartTime = KeGetRecentTimeCounter();
+    }
+
+    //
+    // Harvest the ready list, and wait for it to become non-empty if nothing
+    // was ready. Entries can be queued and then found not to be ready when
+    // examined, so loop until something is returned or time runs out.
+    //
+
+    while (TRUE) {
+        KeAcquireQueuedLock(EventPoll->Lock);
+        Status = IopEventPollHarvest(EventPoll,
+                                     Parameters->Events,
+                                     (ULONG)Parameters->EventCount,
+                                     &ReturnedCount);
+
+        KeReleaseQueuedLock(EventPoll->Lock);
+        if ((!KSUCCESS(Status)) || (ReturnedCount != 0)) {
+            break;
+        }
+
+        if (Timeout == 0) {
+            Status = STATUS_TIMEOUT;
+            break;
+        }
+
+        Status = IoWaitForIoObjectState(EventPoll->IoState,
+                                        POLL_EVENT_IN,
+                                        TRUE,
+                                        Timeout,
+                                        NULL);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        if (Timeout != WAIT_TIME_INDEFINITE) {
+            Frequency = HlQueryTimeCounterFrequency();
+            ElapsedTimeInMilliseconds = ((KeGetRecentTimeCounter() -
+                                          StartTime) *
+                                         MILLISECONDS_PER_SECOND) /
+                                        Frequency;
+
+            if (ElapsedTimeInMilliseconds <
+                Parameters->TimeoutInMilliseconds) {
+
+                Timeout = Parameters->TimeoutInMilliseconds -
+                          ElapsedTimeInMilliseconds;
+
+            } else {
+                Timeout = 0;
+            }
+        }
+    }
+
+SysEventPollWaitEnd:
+    if (RestoreSignalMask != FALSE) {
+
+        //
+        // If a signal arrived during the wait, then do not restore the blocked
+        // mask until it gets a chance to be dispatched. Save the old signal
+        // set to be restored during signal dispatch.
+        //
+
+        PsCheckRuntimeTimers(Thread);
+        if (Thread->SignalPending == ThreadSignalPending) {
+            Thread->RestoreSignals = OldSignalSet;
+            Thread->Flags |= THREAD_FLAG_RESTORE_SIGNALS;
+
+        } else {
+            PsSetSignalMask(&OldSignalSet, NULL);
+        }
+    }
+
+    if (EventPollHandle != NULL) {
+        IoIoHandleReleaseReference(EventPollHandle);
+    }
+
+    Result = Status;
+    if (KSUCCESS(Result)) {
+        Result = ReturnedCount;
+    }
+
+    return Result;
+}
+
+KSTATUS
+IopCreateEventPoll (
+    PCREATE_PARAMETERS Create,
+    PFILE_OBJECT *FileObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new event poll set.
+
+Arguments:
+
+    Create - Supplies a pointer to the creation parameters.
+
+    FileObject - Supplies a pointer where the new file object representing the
+        event poll set will be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PEVENT_POLL EventPoll;
+    PFILE_OBJECT NewFileObject;
+    FILE_PROPERTIES Properties;
+    KSTATUS Status;
+    PKTHREAD Thread;
+
+    ASSERT(*FileObject == NULL);
+
+    Create->Created = FALSE;
+    NewFileObject = NULL;
+    EventPoll = MmAllocateNonPagedPool(sizeof(EVENT_POLL),
+                                       EVENT_POLL_ALLOCATION_TAG);
+
+    if (EventPoll == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateEventPollEnd;
+    }
+
+    RtlZeroMemory(EventPoll, sizeof(EVENT_POLL));
+    EventPoll->ReferenceCount = 1;
+    RtlRedBlackTreeInitialize(&(EventPoll->EntryTree),
+                              0,
+                              IopCompareEventPollEntries);
+
+    KeInitializeSpinLock(&(EventPoll->ReadyLock));
+    INITIALIZE_LIST_HEAD(&(EventPoll->ReadyList));
+    EventPoll->Lock = KeCreateQueuedLock();
+    if (EventPoll->Lock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateEventPollEnd;
+    }
+
+    //
+    // The I/O state is signaled from within the ready lock, so it must be
+    // non-paged.
+    //
+
+    EventPoll->IoState = IoCreateIoObjectState(FALSE, TRUE);
+    if (EventPoll->IoState == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateEventPollEnd;
+    }
+
+    Thread = KeGetCurrentThread();
+    RtlZeroMemory(&Properties, sizeof(FILE_PROPERTIES));
+    Properties.DeviceId = OBJECT_MANAGER_DEVICE_ID;
+    Properties.FileId = (UINTN)EventPoll;
+    Properties.Type = IoObjectEventPoll;
+    Properties.UserId = Thread->Identity.EffectiveUserId;
+    Properties.GroupId = Thread->Identity.EffectiveGroupId;
+    Properties.HardLinkCount = 1;
+    Properties.Permissions = Create->Permissions;
+    KeGetSystemTime(&(Properties.StatusChangeTime));
+    RtlCopyMemory(&(Properties.ModifiedTime),
+                  &(Properties.StatusChangeTime),
+                  sizeof(SYSTEM_TIME));
+
+    RtlCopyMemory(&(Properties.AccessTime),
+                  &(Properties.StatusChangeTime),
+                  sizeof(SYSTEM_TIME));
+
+    Status = IopCreateOrLookupFileObject(&Properties,
+                                         ObGetRootObject(),
+                                         FILE_OBJECT_FLAG_EXTERNAL_IO_STATE,
+                                         0,
+                                         &NewFileObject,
+                                         &(Create->Created));
+
+    if (!KSUCCESS(Status)) {
+        goto CreateEventPollEnd;
+    }
+
+    ASSERT(Create->Created != FALSE);
+    ASSERT((NewFileObject->IoState == NULL) &&
+           ((NewFileObject->Flags & FILE_OBJECT_FLAG_EXTERNAL_IO_STATE) != 0));
+
+    //
+    // The file object takes over the initial reference on the set.
+    //
+
+    NewFileObject->IoState = EventPoll->IoState;
+    NewFileObject->SpecialIo = EventPoll;
+    *FileObject = NewFileObject;
+    Status = STATUS_SUCCESS;
+
+CreateEventPollEnd:
+
+    //
+    // On both success and failure, the file object's ready event needs to be
+    // signaled. Other threads may be waiting on the event.
+    //
+
+    if (NewFileObject != NULL) {
+        KeSignalEvent(NewFileObject->ReadyEvent, SignalOptionSignalAll);
+    }
+
+    if (!KSUCCESS(Status)) {
+        if (NewFileObject != NULL) {
+            IopFileObjectReleaseReference(NewFileObject);
+        }
+
+        if (EventPoll != NULL) {
+            IopDestroyEventPoll(EventPoll);
+        }
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopCloseEventPoll (
+    PIO_HANDLE IoHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when the last handle to an event poll set is
+    closed. It removes every entry from the set.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle being closed.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PEVENT_POLL_ENTRY Entry;
+    PEVENT_POLL EventPoll;
+    PRED_BLACK_TREE_NODE Node;
+
+    EventPoll = IoHandle->FileObject->SpecialIo;
+
+    ASSERT(IoHandle->FileObject->Properties.Type == IoObjectEventPoll);
+
+    KeAcquireQueuedLock(EventPoll->Lock);
+    while (TRUE) {
+        Node = RtlRedBlackTreeGetLowestNode(&(EventPoll->EntryTree));
+        if (Node == NULL) {
+            break;
+        }
+
+        Entry = RED_BLACK_TREE_VALUE(Node, EVENT_POLL_ENTRY, TreeNode);
+        IopEventPollRemoveEntry(EventPoll, Entry);
+    }
+
+    KeReleaseQueuedLock(EventPoll->Lock);
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopEventPollReleaseReference (
+    PVOID EventPoll
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a reference on an event poll set, destroying it if
+    this was the last reference.
+
+Arguments:
+
+    EventPoll - Supplies a pointer to the event poll set.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+    PEVENT_POLL Poll;
+
+    Poll = EventPoll;
+    OldReferenceCount = RtlAtomicAdd32(&(Poll->ReferenceCount), -1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x10000000));
+
+    if (OldReferenceCount == 1) {
+        IopDestroyEventPoll(Poll);
+    }
+
+    return;
+}
+
+VOID
+IopSignalEventPolls (
+    PIO_OBJECT_STATE IoState,
+    ULONG Events
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues every event poll entry watching the given I/O object
+    state that is interested in the given events onto its set's ready list.
+    This routine can be called at dispatch level.
+
+Arguments:
+
+    IoState - Supplies a pointer to the I/O object state that was signaled.
+
+    Events - Supplies the mask of poll events that were just set.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PEVENT_POLL_ENTRY Entry;
+    PEVENT_POLL EventPoll;
+    RUNLEVEL OldRunLevel;
+    PEVENT_POLL_WATCH Watch;
+
+    Watch = IoState->EventPollWatch;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Watch->Lock));
+    CurrentEntry = Watch->EntryList.Next;
+    while (CurrentEntry != &(Watch->EntryList)) {
+        Entry = LIST_VALUE(CurrentEntry, EVENT_POLL_ENTRY, WatchListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (((Entry->Flags & EVENT_POLL_ENTRY_FLAG_DISABLED) != 0) ||
+            ((Events & (Entry->Events | POLL_NONMASKABLE_EVENTS)) == 0)) {
+
+            continue;
+        }
+
+        EventPoll = Entry->EventPoll;
+        KeAcquireSpinLock(&(EventPoll->ReadyLock));
+        if (Entry->ReadyListEntry.Next == NULL) {
+            INSERT_BEFORE(&(Entry->ReadyListEntry), &(EventPoll->ReadyList));
+            IopUpdateEventPollReadiness(EventPoll);
+        }
+
+        KeReleaseSpinLock(&(EventPoll->ReadyLock));
+    }
+
+    KeReleaseSpinLock(&(Watch->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    return;
+}
+
+VOID
+IopRemoveEventPollHandle (
+    PIO_HANDLE IoHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes the given I/O handle from every event poll set it is
+    registered with. It is called when the handle is closed.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle being closed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PEVENT_POLL_ENTRY Entry;
+    PEVENT_POLL EventPoll;
+    RUNLEVEL OldRunLevel;
+    PEVENT_POLL_WATCH Watch;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Watch = IoHandle->FileObject->IoState->EventPollWatch;
+
+    ASSERT(Watch != NULL);
+
+    while (IoHandle->EventPollCount != 0) {
+
+        //
+        // Find an entry for this handle and grab a reference on its set. If
+        // the set is already being torn down, just disassociate the entry
+        // from the handle, as the set's own teardown will free the entry.
+        //
+
+        EventPoll = NULL;
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Watch->Lock));
+        CurrentEntry = Watch->EntryList.Next;
+        while (CurrentEntry != &(Watch->EntryList)) {
+            Entry = LIST_VALUE(CurrentEntry, EVENT_POLL_ENTRY, WatchListEntry);
+            CurrentEntry = CurrentEntry->Next;
+            if (Entry->Handle != IoHandle) {
+                continue;
+            }
+
+            if (IopEventPollTryAddReference(Entry->EventPoll) != FALSE) {
+                EventPoll = Entry->EventPoll;
+                break;
+            }
+
+            Entry->Handle = NULL;
+            IoHandle->EventPollCount -= 1;
+        }
+
+        KeReleaseSpinLock(&(Watch->Lock));
+        KeLowerRunLevel(OldRunLevel);
+        if (EventPoll == NULL) {
+            break;
+        }
+
+        //
+        // Remove the entry under the set's lock. The set may have beaten
+        // this routine to it.
+        //
+
+        KeAcquireQueuedLock(EventPoll->Lock);
+        Entry = IopFindEventPollEntry(EventPoll, IoHandle);
+        if (Entry != NULL) {
+            IopEventPollRemoveEntry(EventPoll, Entry);
+        }
+
+        KeReleaseQueuedLock(EventPoll->Lock);
+        IopEventPollReleaseReference(EventPoll);
+    }
+
+    ASSERT(IoHandle->EventPollCount == 0);
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+IopGetEventPollFromHandle (
+    HANDLE Handle,
+    PIO_HANDLE *IoHandle,
+    PEVENT_POLL *EventPoll
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up an event poll set from a user mode handle.
+
+Arguments:
+
+    Handle - Supplies the user mode handle to the event poll set.
+
+    IoHandle - Supplies a pointer where the I/O handle will be returned on
+        success. The caller is responsible for releasing the reference added
+        to it. NULL is returned on failure.
+
+    EventPoll - Supplies a pointer where a pointer to the event poll set will
+        be returned on success.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_HANDLE if the handle is not valid.
+
+    STATUS_INVALID_PARAMETER if the handle is not an event poll set.
+
+--*/
+
+{
+
+    PIO_HANDLE LocalHandle;
+    PKPROCESS Process;
+
+    *IoHandle = NULL;
+    *EventPoll = NULL;
+    Process = PsGetCurrentProcess();
+    LocalHandle = ObGetHandleValue(Process->HandleTable, Handle, NULL);
+    if (LocalHandle == NULL) {
+        return STATUS_INVALID_HANDLE;
+    }
+
+    if (LocalHandle->FileObject->Properties.Type != IoObjectEventPoll) {
+        IoIoHandleReleaseReference(LocalHandle);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *IoHandle = LocalHandle;
+    *EventPoll = LocalHandle->FileObject->SpecialIo;
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IopEventPollAdd (
+    PEVENT_POLL EventPoll,
+    PIO_HANDLE Handle,
+    PEVENT_POLL_EVENT Event
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds an I/O handle to an event poll set.
+
+Arguments:
+
+    EventPoll - Supplies a pointer to the event poll set.
+
+    Handle - Supplies a pointer to the I/O handle to add.
+
+    Event - Supplies a pointer to the events of interest and the data to
+        return.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_FILE_EXISTS if the handle is already in the set.
+
+    STATUS_PERMISSION_DENIED if the handle refers to a regular file or
+    directory, which are always ready.
+
+    STATUS_INVALID_PARAMETER if the handle refers to an event poll set. Nested
+    sets are not supported.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+--*/
+
+{
+
+    PEVENT_POLL_ENTRY Entry;
+    PFILE_OBJECT FileObject;
+    PIO_OBJECT_STATE IoState;
+    BOOL LockHeld;
+    RUNLEVEL OldRunLevel;
+    KSTATUS Status;
+    PEVENT_POLL_WATCH Watch;
+
+    Entry = NULL;
+    LockHeld = FALSE;
+    FileObject = Handle->FileObject;
+    IoState = FileObject->IoState;
+    if (FileObject->Properties.Type == IoObjectEventPoll) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto EventPollAddEnd;
+    }
+
+    if (IoState == NULL) {
+        Status = STATUS_PERMISSION_DENIED;
+        goto EventPollAddEnd;
+    }
+
+    Watch = IopGetEventPollWatch(IoState);
+    if (Watch == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto EventPollAddEnd;
+    }
+
+    Entry = MmAllocateNonPagedPool(sizeof(EVENT_POLL_ENTRY),
+                                   EVENT_POLL_ALLOCATION_TAG);
+
+    if (Entry == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto EventPollAddEnd;
+    }
+
+    RtlZeroMemory(Entry, sizeof(EVENT_POLL_ENTRY));
+    Entry->EventPoll = EventPoll;
+    Entry->Key = Handle;
+    Entry->Handle = Handle;
+    Entry->FileObject = FileObject;
+    Entry->IoState = IoState;
+    Entry->Events = Event->Events;
+    Entry->Data = Event->Data;
+    KeAcquireQueuedLock(EventPoll->Lock);
+    LockHeld = TRUE;
+    if (IopFindEventPollEntry(EventPoll, Handle) != NULL) {
+        Status = STATUS_FILE_EXISTS;
+        goto EventPollAddEnd;
+    }
+
+    IopFileObjectAddReference(FileObject);
+    RtlRedBlackTreeInsert(&(EventPoll->EntryTree), &(Entry->TreeNode));
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Watch->Lock));
+    INSERT_BEFORE(&(Entry->WatchListEntry), &(Watch->EntryList));
+    Handle->EventPollCount += 1;
+    KeReleaseSpinLock(&(Watch->Lock));
+    KeLowerRunLevel(OldRunLevel);
+
+    //
+    // If the object is already ready, it won't get signaled again, so queue
+    // the entry now.
+    //
+
+    IopEventPollQueueIfReady(Entry);
+    Entry = NULL;
+    Status = STATUS_SUCCESS;
+
+EventPollAddEnd:
+    if (LockHeld != FALSE) {
+        KeReleaseQueuedLock(EventPoll->Lock);
+    }
+
+    if (Entry != NULL) {
+        MmFreeNonPagedPool(Entry);
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopEventPollModify (
+    PEVENT_POLL EventPoll,
+    PIO_HANDLE Handle,
+    PEVENT_POLL_EVENT Event
+    )
+
+/*++
+
+Routine Description:
+
+    This routine changes the events of interest for an I/O handle already in
+    an event poll set. This also re-arms a disabled one-shot entry.
+
+Arguments:
+
+    EventPoll - Supplies a pointer to the event poll set.
+
+    Handle - Supplies a pointer to the I/O handle to modify.
+
+    Event - Supplies a pointer to the new events of interest and the data to
+        return.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_FOUND if the handle is not in the set.
+
+--*/
+
+{
+
+    PEVENT_POLL_ENTRY Entry;
+    RUNLEVEL OldRunLevel;
+    KSTATUS Status;
+    PEVENT_POLL_WATCH Watch;
+
+    KeAcquireQueuedLock(EventPoll->Lock);
+    Entry = IopFindEventPollEntry(EventPoll, Handle);
+    if (Entry == NULL) {
+        Status = STATUS_NOT_FOUND;
+        goto EventPollModifyEnd;
+    }
+
+    Watch = Entry->IoState->EventPollWatch;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Watch->Lock));
+    Entry->Events = Event->Events;
+    Entry->Flags &= ~EVENT_POLL_ENTRY_FLAG_DISABLED;
+    Entry->Data = Event->Data;
+    KeReleaseSpinLock(&(Watch->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    IopEventPollQueueIfReady(Entry);
+    Status = STATUS_SUCCESS;
+
+EventPollModifyEnd:
+    KeReleaseQueuedLock(EventPoll->Lock);
+    return Status;
+}
+
+KSTATUS
+IopEventPollHarvest (
+    PEVENT_POLL EventPoll,
+    PEVENT_POLL_EVENT UserEvents,
+    ULONG EventCount,
+    PULONG ReturnedCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine collects ready entries from an event poll set and copies
+    their events out to user mode. Level triggered entries that are still
+    ready are put back on the ready list at the end. This routine assumes the
+    set's lock is held.
+
+Arguments:
+
+    EventPoll - Supplies a pointer to the event poll set.
+
+    UserEvents - Supplies a user mode pointer to the array where the ready
+        events are returned.
+
+    EventCount - Supplies the maximum number of events to return.
+
+    ReturnedCount - Supplies a pointer where the number of events returned is
+        stored.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    EVENT_POLL_EVENT Batch[EVENT_POLL_HARVEST_BATCH];
+    ULONG BatchCount;
+    PEVENT_POLL_ENTRY Entry;
+    ULONG Events;
+    LIST_ENTRY HarvestList;
+    RUNLEVEL OldRunLevel;
+    BOOL Requeue;
+    LIST_ENTRY RequeueList;
+    ULONG Returned;
+    KSTATUS Status;
+    PEVENT_POLL_WATCH Watch;
+
+    ASSERT(KeIsQueuedLockHeld(EventPoll->Lock) != FALSE);
+
+    INITIALIZE_LIST_HEAD(&HarvestList);
+    INITIALIZE_LIST_HEAD(&RequeueList);
+    BatchCount = 0;
+    Returned = 0;
+    Status = STATUS_SUCCESS;
+
+    //
+    // Take the whole ready list. Entries on the harvest list still look
+    // queued, so signals that arrive while it's being processed don't move
+    // them.
+    //
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(EventPoll->ReadyLock));
+    if (LIST_EMPTY(&(EventPoll->ReadyList)) == FALSE) {
+        MOVE_LIST(&(EventPoll->ReadyList), &HarvestList);
+        INITIALIZE_LIST_HEAD(&(EventPoll->ReadyList));
+    }
+
+    KeReleaseSpinLock(&(EventPoll->ReadyLock));
+    KeLowerRunLevel(OldRunLevel);
+    while ((Returned + BatchCount) < EventCount) {
+
+        //
+        // Pull the next entry off the harvest list. Once it's off, new
+        // signals can queue it to the ready list again.
+        //
+
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(EventPoll->ReadyLock));
+        Entry = NULL;
+        if (LIST_EMPTY(&HarvestList) == FALSE) {
+            Entry = LIST_VALUE(HarvestList.Next,
+                               EVENT_POLL_ENTRY,
+                               ReadyListEntry);
+
+            LIST_REMOVE(&(Entry->ReadyListEntry));
+            Entry->ReadyListEntry.Next = NULL;
+        }
+
+        KeReleaseSpinLock(&(EventPoll->ReadyLock));
+        KeLowerRunLevel(OldRunLevel);
+        if (Entry == NULL) {
+            break;
+        }
+
+        //
+        // The entry was queued because the object signaled, but it may not
+        // still be ready by now. Those entries are simply dropped; they get
+        // queued again when the object signals again.
+        //
+
+        if ((Entry->Flags & EVENT_POLL_ENTRY_FLAG_DISABLED) != 0) {
+            continue;
+        }
+
+        Events = Entry->IoState->Events &
+                 (Entry->Events | POLL_NONMASKABLE_EVENTS);
+
+        if (Events == 0) {
+            continue;
+        }
+
+        Batch[BatchCount].Events = Events;
+        Batch[BatchCount].Data = Entry->Data;
+        BatchCount += 1;
+
+        //
+        // One-shot entries are disabled until modified. Pull it back off the
+        // ready list in case it was signaled again in the meantime.
+        //
+
+        if ((Entry->Events & EVENT_POLL_FLAG_ONE_SHOT) != 0) {
+            Watch = Entry->IoState->EventPollWatch;
+            OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+            KeAcquireSpinLock(&(Watch->Lock));
+            Entry->Flags |= EVENT_POLL_ENTRY_FLAG_DISABLED;
+            KeAcquireSpinLock(&(EventPoll->ReadyLock));
+            if (Entry->ReadyListEntry.Next != NULL) {
+                LIST_REMOVE(&(Entry->ReadyListEntry));
+                Entry->ReadyListEntry.Next = NULL;
+            }
+
+            KeReleaseSpinLock(&(EventPoll->ReadyLock));
+            KeReleaseSpinLock(&(Watch->Lock));
+            KeLowerRunLevel(OldRunLevel);
+
+        //
+        // Level triggered entries go back on the list to be checked again
+        // next time. Edge triggered entries only go back if they were
+        // signaled again while being processed. Either way, hold them aside
+        // so they aren't reported twice in this round.
+        //
+
+        } else {
+            OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+            KeAcquireSpinLock(&(EventPoll->ReadyLock));
+            Requeue = FALSE;
+            if ((Entry->Events & EVENT_POLL_FLAG_EDGE_TRIGGERED) == 0) {
+                Requeue = TRUE;
+            }
+
+            if (Entry->ReadyListEntry.Next != NULL) {
+                LIST_REMOVE(&(Entry->ReadyListEntry));
+                Requeue = TRUE;
+            }
+
+            if (Requeue != FALSE) {
+                INSERT_BEFORE(&(Entry->ReadyListEntry), &RequeueList);
+            }
+
+            KeReleaseSpinLock(&(EventPoll->ReadyLock));
+            KeLowerRunLevel(OldRunLevel);
+        }
+
+        if (BatchCount == EVENT_POLL_HARVEST_BATCH) {
+            Status = MmCopyToUserMode(UserEvents + Returned,
+                                      Batch,
+                                      BatchCount * sizeof(EVENT_POLL_EVENT));
+
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+
+            Returned += BatchCount;
+            BatchCount = 0;
+        }
+    }
+
+    if ((KSUCCESS(Status)) && (BatchCount != 0)) {
+        Status = MmCopyToUserMode(UserEvents + Returned,
+                                  Batch,
+                                  BatchCount * sizeof(EVENT_POLL_EVENT));
+
+        if (KSUCCESS(Status)) {
+            Returned += BatchCount;
+        }
+    }
+
+    //
+    // Put anything not yet looked at back on the front of the ready list, and
+    // the entries to be checked again on the back.
+    //
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(EventPoll->ReadyLock));
+    if (LIST_EMPTY(&HarvestList) == FALSE) {
+        if (LIST_EMPTY(&(EventPoll->ReadyList)) == FALSE) {
+            APPEND_LIST(&(EventPoll->ReadyList), &HarvestList);
+        }
+
+        MOVE_LIST(&HarvestList, &(EventPoll->ReadyList));
+    }
+
+    if (LIST_EMPTY(&RequeueList) == FALSE) {
+        APPEND_LIST(&RequeueList, &(EventPoll->ReadyList));
+    }
+
+    IopUpdateEventPollReadiness(EventPoll);
+    KeReleaseSpinLock(&(EventPoll->ReadyLock));
+    KeLowerRunLevel(OldRunLevel);
+    *ReturnedCount = Returned;
+    return Status;
+}
+
+VOID
+IopEventPollQueueIfReady (
+    PEVENT_POLL_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues an event poll entry on its set's ready list if its
+    I/O object currently has any of the requested events set.
+
+Arguments:
+
+    Entry - Supplies a pointer to the entry.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PEVENT_POLL EventPoll;
+    RUNLEVEL OldRunLevel;
+
+    if ((Entry->IoState->Events &
+         (Entry->Events | POLL_NONMASKABLE_EVENTS)) == 0) {
+
+        return;
+    }
+
+    EventPoll = Entry->EventPoll;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(EventPoll->ReadyLock));
+    if (Entry->ReadyListEntry.Next == NULL) {
+        INSERT_BEFORE(&(Entry->ReadyListEntry), &(EventPoll->ReadyList));
+        IopUpdateEventPollReadiness(EventPoll);
+    }
+
+    KeReleaseSpinLock(&(EventPoll->ReadyLock));
+    KeLowerRunLevel(OldRunLevel);
+    return;
+}
+
+VOID
+IopEventPollRemoveEntry (
+    PEVENT_POLL EventPoll,
+    PEVENT_POLL_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes and destroys an event poll entry. This routine
+    assumes the set's lock is held.
+
+Arguments:
+
+    EventPoll - Supplies a pointer to the event poll set.
+
+    Entry - Supplies a pointer to the entry to remove.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RUNLEVEL OldRunLevel;
+    PEVENT_POLL_WATCH Watch;
+
+    ASSERT(KeIsQueuedLockHeld(EventPoll->Lock) != FALSE);
+
+    RtlRedBlackTreeRemove(&(EventPoll->EntryTree), &(Entry->TreeNode));
+    Watch = Entry->IoState->EventPollWatch;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Watch->Lock));
+    LIST_REMOVE(&(Entry->WatchListEntry));
+    if (Entry->Handle != NULL) {
+
+        ASSERT(Entry->Handle->EventPollCount != 0);
+
+        Entry->Handle->EventPollCount -= 1;
+        Entry->Handle = NULL;
+    }
+
+    KeAcquireSpinLock(&(EventPoll->ReadyLock));
+    if (Entry->ReadyListEntry.Next != NULL) {
+        LIST_REMOVE(&(Entry->ReadyListEntry));
+        Entry->ReadyListEntry.Next = NULL;
+        IopUpdateEventPollReadiness(EventPoll);
+    }
+
+    KeReleaseSpinLock(&(EventPoll->ReadyLock));
+    KeReleaseSpinLock(&(Watch->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    IopFileObjectReleaseReference(Entry->FileObject);
+    MmFreeNonPagedPool(Entry);
+    return;
+}
+
+PEVENT_POLL_ENTRY
+IopFindEventPollEntry (
+    PEVENT_POLL EventPoll,
+    PIO_HANDLE Handle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the entry for the given I/O handle in an event poll
+    set. This routine assumes the set's lock is held.
+
+Arguments:
+
+    EventPoll - Supplies a pointer to the event poll set.
+
+    Handle - Supplies a pointer to the I/O handle to find.
+
+Return Value:
+
+    Returns a pointer to the entry on success.
+
+    NULL if the handle is not in the set.
+
+--*/
+
+{
+
+    PRED_BLACK_TREE_NODE FoundNode;
+    EVENT_POLL_ENTRY SearchEntry;
+
+    SearchEntry.Key = Handle;
+    FoundNode = RtlRedBlackTreeSearch(&(EventPoll->EntryTree),
+                                      &(SearchEntry.TreeNode));
+
+    if (FoundNode == NULL) {
+        return NULL;
+    }
+
+    return RED_BLACK_TREE_VALUE(FoundNode, EVENT_POLL_ENTRY, TreeNode);
+}
+
+VOID
+IopUpdateEventPollReadiness (
+    PEVENT_POLL EventPoll
+    )
+
+/*++
+
+Routine Description:
+
+    This routine signals or unsignals an event poll set's I/O state based on
+    whether or not its ready list is empty. This routine assumes the ready
+    lock is held. The I/O state is manipulated directly rather than through
+    IoSetIoObjectState, since that may try to send asynchronous signals, which
+    cannot be done at dispatch level.
+
+Arguments:
+
+    EventPoll - Supplies a pointer to the event poll set.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_OBJECT_STATE IoState;
+
+    IoState = EventPoll->IoState;
+    if (LIST_EMPTY(&(EventPoll->ReadyList)) != FALSE) {
+        if ((IoState->Events & POLL_EVENT_IN) != 0) {
+            RtlAtomicAnd32(&(IoState->Events), ~POLL_EVENT_IN);
+            KeSignalEvent(IoState->ReadEvent, SignalOptionUnsignal);
+        }
+
+    } else if ((IoState->Events & POLL_EVENT_IN) == 0) {
+        RtlAtomicOr32(&(IoState->Events), POLL_EVENT_IN);
+        KeSignalEvent(IoState->ReadEvent, SignalOptionSignalAll);
+    }
+
+    return;
+}
+
+PEVENT_POLL_WATCH
+IopGetEventPollWatch (
+    PIO_OBJECT_STATE IoState
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns or attempts to create the event poll watch list for
+    an I/O object state.
+
+Arguments:
+
+    IoState - Supplies a pointer to the I/O object state.
+
+Return Value:
+
+    Returns a pointer to the watch list on success. This may have just been
+    created.
+
+    NULL if no watch list exists and none could be created.
+
+--*/
+
+{
+
+    PEVENT_POLL_WATCH OldValue;
+    PEVENT_POLL_WATCH Watch;
+
+    if (IoState->EventPollWatch != NULL) {
+        return IoState->EventPollWatch;
+    }
+
+    Watch = MmAllocateNonPagedPool(sizeof(EVENT_POLL_WATCH),
+                                   EVENT_POLL_ALLOCATION_TAG);
+
+    if (Watch == NULL) {
+        return NULL;
+    }
+
+    KeInitializeSpinLock(&(Watch->Lock));
+    INITIALIZE_LIST_HEAD(&(Watch->EntryList));
+
+    //
+    // Try to atomically set the watch list. Someone else may race and win.
+    //
+
+    OldValue = (PEVENT_POLL_WATCH)RtlAtomicCompareExchange(
+                                             (PUINTN)&(IoState->EventPollWatch),
+                                             (UINTN)Watch,
+                                             (UINTN)NULL);
+
+    if (OldValue != NULL) {
+        MmFreeNonPagedPool(Watch);
+    }
+
+    return IoState->EventPollWatch;
+}
+
+BOOL
+IopEventPollTryAddReference (
+    PEVENT_POLL EventPoll
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to add a reference to an event poll set. It fails if
+    the set is already being destroyed.
+
+Arguments:
+
+    EventPoll - Supplies a pointer to the event poll set.
+
+Return Value:
+
+    TRUE if a reference was added.
+
+    FALSE if the reference count had already dropped to zero.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+    ULONG PreviousValue;
+
+    OldReferenceCount = EventPoll->ReferenceCount;
+    while (OldReferenceCount != 0) {
+
+        ASSERT(OldReferenceCount < 0x10000000);
+
+        PreviousValue = RtlAtomicCompareExchange32(
+                                               &(EventPoll->ReferenceCount),
+                                               OldReferenceCount + 1,
+                                               OldReferenceCount);
+
+        if (PreviousValue == OldReferenceCount) {
+            return TRUE;
+        }
+
+        OldReferenceCount = PreviousValue;
+    }
+
+    return FALSE;
+}
+
+VOID
+IopDestroyEventPoll (
+    PEVENT_POLL EventPoll
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys an event poll set. All entries must already have
+    been removed.
+
+Arguments:
+
+    EventPoll - Supplies a pointer to the event poll set.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(RED_BLACK_TREE_EMPTY(&(EventPoll->EntryTree)) != FALSE);
+    ASSERT(LIST_EMPTY(&(EventPoll->ReadyList)) != FALSE);
+
+    if (EventPoll->IoState != NULL) {
+        IoDestroyIoObjectState(EventPoll->IoState, TRUE);
+    }
+
+    if (EventPoll->Lock != NULL) {
+        KeDestroyQueuedLock(EventPoll->Lock);
+    }
+
+    MmFreeNonPagedPool(EventPoll);
+    return;
+}
+
+COMPARISON_RESULT
+IopCompareEventPollEntries (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two event poll entries by their I/O handle.
+
+Arguments:
+
+    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+
+    FirstNode - Supplies a pointer to the left side of the comparison.
+
+    SecondNode - Supplies a pointer to the second side of the comparison.
+
+Return Value:
+
+    Same if the two nodes have the same value.
+
+    Ascending if the first node is less than the second node.
+
+    Descending if the second node is less than the first node.
+
+--*/
+
+{
+
+    PEVENT_POLL_ENTRY FirstEntry;
+    PEVENT_POLL_ENTRY SecondEntry;
+
+    FirstEntry = RED_BLACK_TREE_VALUE(FirstNode, EVENT_POLL_ENTRY, TreeNode);
+    SecondEntry = RED_BLACK_TREE_VALUE(SecondNode, EVENT_POLL_ENTRY, TreeNode);
+    if (FirstEntry->Key < SecondEntry->Key) {
+        return ComparisonResultAscending;
+
+    } else if (FirstEntry->Key > SecondEntry->Key) {
+        return ComparisonResultDescending;
+    }
+
+    return ComparisonResultSame;
+}
+
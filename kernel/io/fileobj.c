@@ -40,6 +40,21 @@ Module Name:
 #define FILE_OBJECT_ALLOCATION_TAG 0x624F6946 // 'bOiF'
 #define FILE_OBJECT_MAX_REFERENCE_COUNT 0x10000000
 
+//
+// This macro determines whether or not a dirty file object is covered by a
+// flush of the given device ID. Zero covers everything. A real device ID
+// covers the file objects on that device as well as those whose data is
+// stored on it.
+//
+
+#define IS_FILE_OBJECT_IN_FLUSH(_FileObject, _DeviceId)                      \
+    (((_DeviceId) == 0) ||                                                   \
+     (((_DeviceId) == FLUSH_DEVICE_ID_UNOWNED) ?                             \
+      ((_FileObject)->Writeback == NULL) :                                   \
+      (((_FileObject)->Properties.DeviceId == (_DeviceId)) ||                \
+       (((_FileObject)->Writeback != NULL) &&                                \
+        ((_FileObject)->Writeback->DeviceId == (_DeviceId))))))
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -196,6 +211,14 @@ Return Value:
         KeSignalEvent(IoState->ErrorEvent, SignalOption);
     }
 
+    //
+    // Queue any interested event poll entries to their ready lists.
+    //
+
+    if ((Set != FALSE) && (IoState->EventPollWatch != NULL)) {
+        IopSignalEventPolls(IoState, Events);
+    }
+
     //
     // If read or write just went high, potentially signal the owner.
     //
@@ -511,6 +534,13 @@ Return Value:
         KeDestroyEvent(State->ErrorEvent);
     }
 
+    if (State->EventPollWatch != NULL) {
+
+        ASSERT(LIST_EMPTY(&(State->EventPollWatch->EntryList)) != FALSE);
+
+        MmFreeNonPagedPool(State->EventPollWatch);
+    }
+
     if (NonPaged != FALSE) {
         MmFreeNonPagedPool(State);
 
@@ -816,11 +846,9 @@ Return Value:
                 }
 
                 RtlZeroMemory(NewObject, sizeof(FILE_OBJECT));
-                INITIALIZE_LIST_HEAD(&(NewObject->FileLockList));
+                INITIALIZE_LIST_HEAD(&(NewObject->FileLockWaitList));
                 INITIALIZE_LIST_HEAD(&(NewObject->DirtyPageList));
-                RtlRedBlackTreeInitialize(&(NewObject->PageCacheTree),
-                                          0,
-                                          IopComparePageCacheEntries);
+                IopInitializePageCacheIndex(&(NewObject->PageCacheIndex));
 
                 NewObject->Lock = KeCreateSharedExclusiveLock();
                 if (NewObject->Lock == NULL) {
@@ -864,6 +892,23 @@ Return Value:
                 NewObject->Device = Device;
                 ObAddReference(Device);
 
+                //
+                // File objects whose data lives on a backing device get
+                // flushed by that device's writeback thread.
+                //
+
+                if ((IO_IS_WRITEBACK_TYPE(Properties->Type) != FALSE) &&
+                    (Properties->DeviceId != OBJECT_MANAGER_DEVICE_ID) &&
+                    (IS_DEVICE_OR_VOLUME(Device) != FALSE)) {
+
+                    Status = IopGetWritebackDevice(Device,
+                                                   &(NewObject->Writeback));
+
+                    if (!KSUCCESS(Status)) {
+                        goto CreateOrLookupFileObjectEnd;
+                    }
+                }
+
                 //
                 // If the device is a special device, then more state needs to
                 // be set up. Don't let additional lookups come in and use the
@@ -876,6 +921,8 @@ Return Value:
                 case IoObjectTerminalMaster:
                 case IoObjectTerminalSlave:
                 case IoObjectSharedMemoryObject:
+                case IoObjectEventPoll:
+                case IoObjectIoRing:
                     break;
 
                 default:
@@ -985,7 +1032,14 @@ Return Value:
             KeDestroyEvent(NewObject->ReadyEvent);
         }
 
-        ObReleaseReference(NewObject->Device);
+        if (NewObject->Writeback != NULL) {
+            IopWritebackDeviceReleaseReference(NewObject->Writeback);
+        }
+
+        if (NewObject->Device != NULL) {
+            ObReleaseReference(NewObject->Device);
+        }
+
         MmFreePagedPool(NewObject);
     }
 
@@ -1220,16 +1274,21 @@ Return Value:
         ASSERT(Object->ListEntry.Next == NULL);
         ASSERT((Object->Flags & FILE_OBJECT_FLAG_CLOSING) != 0);
         ASSERT(Object->PathEntryCount == 0);
-        ASSERT(LIST_EMPTY(&(Object->FileLockList)) != FALSE);
+        ASSERT(Object->FileLockTree == NULL);
+        ASSERT(LIST_EMPTY(&(Object->FileLockWaitList)) != FALSE);
 
         //
         // If this was an object manager object, release the reference on the
-        // file. The only exception here is sockets, which are not official
-        // object manager objects. They get destroyed differently.
+        // file. The only exceptions here are sockets, event poll sets, and
+        // I/O rings, which are not official object manager objects. They get
+        // destroyed differently.
         //
 
         if (Object->Properties.DeviceId == OBJECT_MANAGER_DEVICE_ID) {
-            if (Object->Properties.Type != IoObjectSocket) {
+            if ((Object->Properties.Type != IoObjectSocket) &&
+                (Object->Properties.Type != IoObjectEventPoll) &&
+                (Object->Properties.Type != IoObjectIoRing)) {
+
                 ObReleaseReference((PVOID)(UINTN)Object->Properties.FileId);
             }
         }
@@ -1240,6 +1299,14 @@ Return Value:
                 IoSocketReleaseReference(Object->SpecialIo);
                 break;
 
+            case IoObjectEventPoll:
+                IopEventPollReleaseReference(Object->SpecialIo);
+                break;
+
+            case IoObjectIoRing:
+                IopIoRingReleaseReference(Object->SpecialIo);
+                break;
+
             case IoObjectPipe:
             case IoObjectTerminalMaster:
             case IoObjectTerminalSlave:
@@ -1264,9 +1331,13 @@ Return Value:
             MmDestroyImageSectionList(Object->ImageSectionList);
         }
 
-        ASSERT(RED_BLACK_TREE_EMPTY(&(Object->PageCacheTree)));
+        ASSERT(PAGE_CACHE_INDEX_EMPTY(&(Object->PageCacheIndex)));
         ASSERT(LIST_EMPTY(&(Object->DirtyPageList)));
 
+        if (Object->Writeback != NULL) {
+            IopWritebackDeviceReleaseReference(Object->Writeback);
+        }
+
         if (Object->Lock != NULL) {
             KeDestroySharedExclusiveLock(Object->Lock);
         }
@@ -1286,10 +1357,6 @@ Return Value:
             KeDestroyEvent(Object->ReadyEvent);
         }
 
-        if (Object->FileLockEvent != NULL) {
-            KeDestroyEvent(Object->FileLockEvent);
-        }
-
         MmFreePagedPool(Object);
         Object = NULL;
 
@@ -1534,7 +1601,10 @@ Routine Description:
 Arguments:
 
     DeviceId - Supplies an optional device ID filter. Supply 0 to iterate over
-        dirty file objects for all devices.
+        dirty file objects for all devices. A device ID also covers the file
+        objects whose data is written back to that device. Supply
+        FLUSH_DEVICE_ID_UNOWNED to flush only the file objects with no
+        writeback device.
 
     Flags - Supplies a bitmask of I/O flags. See IO_FLAG_* for definitions.
 
@@ -1619,21 +1689,13 @@ Return Value:
 
         KeAcquireQueuedLock(IoFileObjectsDirtyListLock);
         CurrentEntry = IoFileObjectsDirtyList.Next;
-        if (DeviceId == 0) {
+        while (CurrentEntry != &IoFileObjectsDirtyList) {
             CurrentObject = LIST_VALUE(CurrentEntry, FILE_OBJECT, ListEntry);
-
-        } else {
-            while (CurrentEntry != &IoFileObjectsDirtyList) {
-                CurrentObject = LIST_VALUE(CurrentEntry,
-                                           FILE_OBJECT,
-                                           ListEntry);
-
-                if (CurrentObject->Properties.DeviceId == DeviceId) {
-                    break;
-                }
-
-                CurrentEntry = CurrentEntry->Next;
+            if (IS_FILE_OBJECT_IN_FLUSH(CurrentObject, DeviceId)) {
+                break;
             }
+
+            CurrentEntry = CurrentEntry->Next;
         }
 
         if (CurrentEntry == &IoFileObjectsDirtyList) {
@@ -1690,29 +1752,17 @@ Return Value:
                 CurrentEntry = IoFileObjectsDirtyList.Next;
             }
 
-            if (DeviceId == 0) {
-                if (CurrentEntry != &IoFileObjectsDirtyList) {
-                    NextObject = LIST_VALUE(CurrentEntry,
-                                            FILE_OBJECT,
-                                            ListEntry);
+            while (CurrentEntry != &IoFileObjectsDirtyList) {
+                NextObject = LIST_VALUE(CurrentEntry, FILE_OBJECT, ListEntry);
+                if (IS_FILE_OBJECT_IN_FLUSH(NextObject, DeviceId)) {
+                    break;
                 }
 
-            } else {
-                while (CurrentEntry != &IoFileObjectsDirtyList) {
-                    NextObject = LIST_VALUE(CurrentEntry,
-                                            FILE_OBJECT,
-                                            ListEntry);
-
-                    if (NextObject->Properties.DeviceId == DeviceId) {
-                        break;
-                    }
-
-                    CurrentEntry = CurrentEntry->Next;
-                }
+                CurrentEntry = CurrentEntry->Next;
+            }
 
-                if (CurrentEntry == &IoFileObjectsDirtyList) {
-                    NextObject = NULL;
-                }
+            if (CurrentEntry == &IoFileObjectsDirtyList) {
+                NextObject = NULL;
             }
 
             //
@@ -1747,6 +1797,58 @@ Return Value:
     return TotalStatus;
 }
 
+BOOL
+IopHasDirtyFileObjects (
+    DEVICE_ID DeviceId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not any file object in the global dirty
+    file objects list would be covered by a flush of the given device.
+
+Arguments:
+
+    DeviceId - Supplies the device ID filter, as it would be passed to flush
+        file objects.
+
+Return Value:
+
+    TRUE if there is at least one matching dirty file object.
+
+    FALSE if there are none.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PFILE_OBJECT CurrentObject;
+    BOOL Dirty;
+
+    if (LIST_EMPTY(&IoFileObjectsDirtyList) != FALSE) {
+        return FALSE;
+    }
+
+    Dirty = FALSE;
+    KeAcquireQueuedLock(IoFileObjectsDirtyListLock);
+    CurrentEntry = IoFileObjectsDirtyList.Next;
+    while (CurrentEntry != &IoFileObjectsDirtyList) {
+        CurrentObject = LIST_VALUE(CurrentEntry, FILE_OBJECT, ListEntry);
+        if (IS_FILE_OBJECT_IN_FLUSH(CurrentObject, DeviceId)) {
+            Dirty = TRUE;
+            break;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    KeReleaseQueuedLock(IoFileObjectsDirtyListLock);
+    return Dirty;
+}
+
 VOID
 IopEvictFileObject (
     PFILE_OBJECT FileObject,
@@ -2460,7 +2562,7 @@ Return Value:
         }
 
         KeReleaseQueuedLock(IoFileObjectsDirtyListLock);
-        IopSchedulePageCacheThread();
+        IopScheduleWriteback(FileObject);
     }
 
     return;
@@ -36,6 +36,12 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// Define the end offset of a lock that extends to the end of the file.
+//
+
+#define FILE_LOCK_END_OF_FILE MAX_ULONGLONG
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -44,12 +50,27 @@ Module Name:
 
 Structure Description:
 
-    This structure defines an active file lock.
+    This structure defines an active file lock. File locks are kept in an
+    interval tree, which is an AVL tree sorted by offset where each node also
+    remembers the highest end offset in its subtree.
 
 Members:
 
-    ListEntry - Stores pointers to the next and previous lock entries in the
-        file object.
+    Left - Stores a pointer to the left child, whose locks start before this
+        one.
+
+    Right - Stores a pointer to the right child, whose locks start after this
+        one.
+
+    Height - Stores the height of the subtree rooted at this node.
+
+    MaxEnd - Stores the highest end offset of any lock in this subtree.
+
+    MaxWriteEnd - Stores the highest end offset of any write lock in this
+        subtree, or zero if there are none.
+
+    ListEntry - Stores pointers to the next and previous lock entries when the
+        lock is on a local list (it is not used while in the tree).
 
     Type - Stores the lock type.
 
@@ -62,13 +83,44 @@ Structure Description:
 
 --*/
 
-typedef struct _FILE_LOCK_ENTRY {
+struct _FILE_LOCK_ENTRY {
+    PFILE_LOCK_ENTRY Left;
+    PFILE_LOCK_ENTRY Right;
+    ULONG Height;
+    ULONGLONG MaxEnd;
+    ULONGLONG MaxWriteEnd;
     LIST_ENTRY ListEntry;
     FILE_LOCK_TYPE Type;
     PKPROCESS Process;
     ULONGLONG Offset;
     ULONGLONG Size;
-} FILE_LOCK_ENTRY, *PFILE_LOCK_ENTRY;
+};
+
+/*++
+
+Structure Description:
+
+    This structure defines a thread blocked waiting to acquire a file lock.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous waiters on the file
+        object. This is set to NULL once the waiter has been woken.
+
+    WaitQueue - Stores the queue the thread waits on.
+
+    Offset - Stores the offset of the lock being waited for.
+
+    End - Stores the end offset (exclusive) of the lock being waited for.
+
+--*/
+
+typedef struct _FILE_LOCK_WAITER {
+    LIST_ENTRY ListEntry;
+    WAIT_QUEUE WaitQueue;
+    ULONGLONG Offset;
+    ULONGLONG End;
+} FILE_LOCK_WAITER, *PFILE_LOCK_WAITER;
 
 //
 // ----------------------------------------------- Internal Function Prototypes
@@ -82,11 +134,73 @@ IopTryToSetFileLock (
     BOOL DryRun
     );
 
+VOID
+IopWakeFileLockWaiters (
+    PFILE_OBJECT FileObject,
+    ULONGLONG Offset,
+    ULONGLONG End
+    );
+
+PFILE_LOCK_ENTRY
+IopFindFileLock (
+    PFILE_LOCK_ENTRY Node,
+    ULONGLONG Offset,
+    ULONGLONG End,
+    BOOL WriteLocksOnly,
+    PFILE_LOCK_ENTRY Previous
+    );
+
+PFILE_LOCK_ENTRY
+IopInsertFileLock (
+    PFILE_LOCK_ENTRY Node,
+    PFILE_LOCK_ENTRY Entry
+    );
+
+PFILE_LOCK_ENTRY
+IopRemoveFileLock (
+    PFILE_LOCK_ENTRY Node,
+    PFILE_LOCK_ENTRY Entry
+    );
+
+PFILE_LOCK_ENTRY
+IopRemoveLowestFileLock (
+    PFILE_LOCK_ENTRY Node,
+    PFILE_LOCK_ENTRY *Lowest
+    );
+
+PFILE_LOCK_ENTRY
+IopBalanceFileLockTree (
+    PFILE_LOCK_ENTRY Node
+    );
+
+PFILE_LOCK_ENTRY
+IopRotateFileLockTree (
+    PFILE_LOCK_ENTRY Node,
+    BOOL Left
+    );
+
+VOID
+IopUpdateFileLockNode (
+    PFILE_LOCK_ENTRY Node
+    );
+
+COMPARISON_RESULT
+IopCompareFileLocks (
+    PFILE_LOCK_ENTRY FirstEntry,
+    PFILE_LOCK_ENTRY SecondEntry
+    );
+
 BOOL
-IopDoFileLocksOverlap (
-    ULONGLONG IncomingOffset,
-    ULONGLONG IncomingSize,
-    PFILE_LOCK_ENTRY LockEntry
+IopDoesFileLockOverlap (
+    PFILE_LOCK_ENTRY LockEntry,
+    ULONGLONG Offset,
+    ULONGLONG End
+    );
+
+ULONGLONG
+IopGetFileLockEnd (
+    ULONGLONG Offset,
+    ULONGLONG Size
     );
 
 //
@@ -126,11 +240,10 @@ Return Value:
 
 {
 
-    PLIST_ENTRY CurrentEntry;
+    ULONGLONG End;
     PFILE_OBJECT FileObject;
     PFILE_LOCK_ENTRY FoundEntry;
-    PFILE_LOCK_ENTRY LockEntry;
-    BOOL Overlap;
+    BOOL WriteLocksOnly;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
@@ -138,29 +251,24 @@ Return Value:
         return STATUS_INVALID_PARAMETER;
     }
 
-    FileObject = IoHandle->FileObject;
-    FoundEntry = NULL;
-    KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
-    CurrentEntry = FileObject->FileLockList.Next;
-    while (CurrentEntry != &(FileObject->FileLockList)) {
-        LockEntry = LIST_VALUE(CurrentEntry, FILE_LOCK_ENTRY, ListEntry);
-        CurrentEntry = CurrentEntry->Next;
-
-        //
-        // If the caller only wants write locks, then skip read locks.
-        //
-
-        if ((Lock->Type == FileLockRead) && (LockEntry->Type == FileLockRead)) {
-            continue;
-        }
+    //
+    // If the caller only wants write locks, then skip read locks.
+    //
 
-        Overlap = IopDoFileLocksOverlap(Lock->Offset, Lock->Size, LockEntry);
-        if (Overlap != FALSE) {
-            FoundEntry = LockEntry;
-            break;
-        }
+    WriteLocksOnly = FALSE;
+    if (Lock->Type == FileLockRead) {
+        WriteLocksOnly = TRUE;
     }
 
+    FileObject = IoHandle->FileObject;
+    End = IopGetFileLockEnd(Lock->Offset, Lock->Size);
+    KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
+    FoundEntry = IopFindFileLock(FileObject->FileLockTree,
+                                 Lock->Offset,
+                                 End,
+                                 WriteLocksOnly,
+                                 NULL);
+
     if (FoundEntry != NULL) {
         Lock->Type = FoundEntry->Type;
         Lock->Offset = FoundEntry->Offset;
@@ -212,11 +320,10 @@ Return Value:
     LIST_ENTRY FreeList;
     BOOL LockHeld;
     PFILE_LOCK_ENTRY NewEntry;
-    PKEVENT NewEvent;
-    PKEVENT PreviousEvent;
     FILE_LOCK_ENTRY RemoveEntry;
     PFILE_LOCK_ENTRY SplitEntry;
     KSTATUS Status;
+    FILE_LOCK_WAITER Waiter;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
@@ -281,28 +388,9 @@ Return Value:
     }
 
     INSERT_BEFORE(&(SplitEntry->ListEntry), &FreeList);
-
-    //
-    // Race to create the event if not created.
-    //
-
-    if (FileObject->FileLockEvent == NULL) {
-        NewEvent = KeCreateEvent(NULL);
-        if (NewEvent == NULL) {
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto SetFileLockEnd;
-        }
-
-        PreviousEvent = (PKEVENT)RtlAtomicCompareExchange(
-                                          (PUINTN)&(FileObject->FileLockEvent),
-                                          (UINTN)NewEvent,
-                                          (UINTN)NULL);
-
-        if (PreviousEvent != NULL) {
-            KeDestroyEvent(NewEvent);
-        }
-    }
-
+    Waiter.ListEntry.Next = NULL;
+    Waiter.Offset = NewEntry->Offset;
+    Waiter.End = IopGetFileLockEnd(NewEntry->Offset, NewEntry->Size);
     while (TRUE) {
         if (LockHeld == FALSE) {
             KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
@@ -323,15 +411,34 @@ Return Value:
             if (!KSUCCESS(Status)) {
 
                 //
-                // Wait for something to unlock.
+                // Wait for a lock overlapping this region to be released. Get
+                // on the wait list before dropping the file lock so that no
+                // release can be missed.
                 //
 
                 if (Blocking != FALSE) {
+                    ObInitializeWaitQueue(&(Waiter.WaitQueue), NotSignaled);
+                    INSERT_BEFORE(&(Waiter.ListEntry),
+                                  &(FileObject->FileLockWaitList));
+
                     KeReleaseSharedExclusiveLockExclusive(FileObject->Lock);
                     LockHeld = FALSE;
-                    Status = KeWaitForEvent(FileObject->FileLockEvent,
-                                            TRUE,
-                                            WAIT_TIME_INDEFINITE);
+                    Status = ObWaitOnQueue(&(Waiter.WaitQueue),
+                                           WAIT_FLAG_INTERRUPTIBLE,
+                                           WAIT_TIME_INDEFINITE);
+
+                    //
+                    // Get off the wait list if nobody woke this thread. The
+                    // waker removes the waiter, so reacquire the lock either
+                    // way to make sure it is done with the wait queue.
+                    //
+
+                    KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
+                    LockHeld = TRUE;
+                    if (Waiter.ListEntry.Next != NULL) {
+                        LIST_REMOVE(&(Waiter.ListEntry));
+                        Waiter.ListEntry.Next = NULL;
+                    }
 
                     //
                     // The thread was interrupted.
@@ -429,7 +536,7 @@ Return Value:
     //
 
     FileObject = IoHandle->FileObject;
-    if (LIST_EMPTY(&(FileObject->FileLockList)) != FALSE) {
+    if (FileObject->FileLockTree == NULL) {
         return;
     }
 
@@ -437,25 +544,43 @@ Return Value:
     KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
 
     //
-    // Loop through and remove any active locks belonging to this process.
+    // Collect the active locks belonging to this process. The tree can't be
+    // modified while it's being walked.
     //
 
-    CurrentEntry = FileObject->FileLockList.Next;
-    while (CurrentEntry != &(FileObject->FileLockList)) {
-        LockEntry = LIST_VALUE(CurrentEntry, FILE_LOCK_ENTRY, ListEntry);
-        CurrentEntry = CurrentEntry->Next;
+    LockEntry = IopFindFileLock(FileObject->FileLockTree,
+                                0,
+                                FILE_LOCK_END_OF_FILE,
+                                FALSE,
+                                NULL);
+
+    while (LockEntry != NULL) {
         if (LockEntry->Process == Process) {
-            LIST_REMOVE(&(LockEntry->ListEntry));
             INSERT_BEFORE(&(LockEntry->ListEntry), &FreeList);
         }
+
+        LockEntry = IopFindFileLock(FileObject->FileLockTree,
+                                    0,
+                                    FILE_LOCK_END_OF_FILE,
+                                    FALSE,
+                                    LockEntry);
     }
 
     //
-    // If locks were removed, signal anyone blocked on this file.
+    // Pull them out of the tree, and wake anyone blocked on those regions.
     //
 
-    if (LIST_EMPTY(&FreeList) == FALSE) {
-        KeSignalEvent(FileObject->FileLockEvent, SignalOptionSignalAll);
+    CurrentEntry = FreeList.Next;
+    while (CurrentEntry != &FreeList) {
+        LockEntry = LIST_VALUE(CurrentEntry, FILE_LOCK_ENTRY, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        FileObject->FileLockTree = IopRemoveFileLock(FileObject->FileLockTree,
+                                                     LockEntry);
+
+        IopWakeFileLockWaiters(FileObject,
+                               LockEntry->Offset,
+                               IopGetFileLockEnd(LockEntry->Offset,
+                                                 LockEntry->Size));
     }
 
     KeReleaseSharedExclusiveLockExclusive(FileObject->Lock);
@@ -515,231 +640,783 @@ Return Value:
 
 {
 
-    PLIST_ENTRY CurrentEntry;
+    ULONGLONG LockEnd;
     PFILE_LOCK_ENTRY LockEntry;
-    BOOL LocksRemoved;
     ULONGLONG NewEnd;
-    BOOL Overlap;
+    LIST_ENTRY OverlapList;
     PKPROCESS Process;
     PFILE_LOCK_ENTRY SplitEntry;
-    KSTATUS Status;
+    ULONGLONG WakeEnd;
+    ULONGLONG WakeOffset;
+    BOOL WriteLocksOnly;
 
-    LocksRemoved = FALSE;
-    NewEnd = NewEntry->Offset + NewEntry->Size;
+    NewEnd = IopGetFileLockEnd(NewEntry->Offset, NewEntry->Size);
     Process = PsGetCurrentProcess();
-    Status = STATUS_SUCCESS;
-    CurrentEntry = FileObject->FileLockList.Next;
-    while (CurrentEntry != &(FileObject->FileLockList)) {
-        LockEntry = LIST_VALUE(CurrentEntry, FILE_LOCK_ENTRY, ListEntry);
-        CurrentEntry = CurrentEntry->Next;
 
-        //
-        // If the lock belongs to the current process and overlaps the given
-        // region, it is to be removed.
-        //
+    //
+    // For a dry run, look for a lock owned by another process that overlaps
+    // the new one. Read locks can coexist, so a read lock only needs to look
+    // at write locks.
+    //
 
-        if (LockEntry->Process == Process) {
-            Overlap = IopDoFileLocksOverlap(NewEntry->Offset,
-                                            NewEntry->Size,
-                                            LockEntry);
+    if (DryRun != FALSE) {
 
-            if ((Overlap != FALSE) && (DryRun == FALSE)) {
-                LocksRemoved = TRUE;
+        ASSERT(NewEntry->Type != FileLockUnlock);
 
-                //
-                // If the existing entry starts before the new one, it needs to
-                // be shrunk or split.
-                //
+        WriteLocksOnly = FALSE;
+        if (NewEntry->Type == FileLockRead) {
+            WriteLocksOnly = TRUE;
+        }
 
-                if (LockEntry->Offset < NewEntry->Offset) {
+        LockEntry = IopFindFileLock(FileObject->FileLockTree,
+                                    NewEntry->Offset,
+                                    NewEnd,
+                                    WriteLocksOnly,
+                                    NULL);
 
-                    //
-                    // If it ends after the new one, split it.
-                    //
+        while (LockEntry != NULL) {
+            if (LockEntry->Process != Process) {
+                return STATUS_RESOURCE_IN_USE;
+            }
 
-                    if ((NewEntry->Size != 0) &&
-                        ((LockEntry->Offset + LockEntry->Size > NewEnd) ||
-                         (LockEntry->Size == 0))) {
+            LockEntry = IopFindFileLock(FileObject->FileLockTree,
+                                        NewEntry->Offset,
+                                        NewEnd,
+                                        WriteLocksOnly,
+                                        LockEntry);
+        }
 
-                        ASSERT(LIST_EMPTY(FreeList) == FALSE);
+        return STATUS_SUCCESS;
+    }
 
-                        SplitEntry = LIST_VALUE(FreeList->Next,
-                                                FILE_LOCK_ENTRY,
-                                                ListEntry);
+    //
+    // Gather the locks belonging to the current process that overlap the
+    // given region, as they are to be replaced. The tree is not modified
+    // until the search is done.
+    //
 
-                        LIST_REMOVE(&(SplitEntry->ListEntry));
-                        SplitEntry->Type = LockEntry->Type;
-                        SplitEntry->Offset = NewEnd;
-                        if (LockEntry->Size == 0) {
-                            SplitEntry->Size = 0;
+    INITIALIZE_LIST_HEAD(&OverlapList);
+    LockEntry = IopFindFileLock(FileObject->FileLockTree,
+                                NewEntry->Offset,
+                                NewEnd,
+                                FALSE,
+                                NULL);
 
-                        } else {
-                            SplitEntry->Size = LockEntry->Offset +
-                                               LockEntry->Size - NewEnd;
-                        }
+    while (LockEntry != NULL) {
+        if (LockEntry->Process == Process) {
+            INSERT_BEFORE(&(LockEntry->ListEntry), &OverlapList);
 
-                        INSERT_AFTER(&(SplitEntry->ListEntry),
-                                     &(LockEntry->ListEntry));
-                    }
+        //
+        // This routine should not be discovering overlaps on the real deal.
+        //
 
-                    //
-                    // Shrink its length.
-                    //
+        } else {
 
-                    LockEntry->Size = NewEntry->Offset - LockEntry->Offset;
+            ASSERT((NewEntry->Type == FileLockUnlock) ||
+                   ((NewEntry->Type == FileLockRead) &&
+                    (LockEntry->Type == FileLockRead)));
+        }
 
-                //
-                // The current entry starts within the new entry. If it
-                // ends after the new entry, shrink it.
-                //
+        LockEntry = IopFindFileLock(FileObject->FileLockTree,
+                                    NewEntry->Offset,
+                                    NewEnd,
+                                    FALSE,
+                                    LockEntry);
+    }
 
-                } else if ((NewEntry->Size != 0) &&
-                           ((LockEntry->Offset + LockEntry->Size > NewEnd) ||
-                            (LockEntry->Size == 0))) {
+    while (LIST_EMPTY(&OverlapList) == FALSE) {
+        LockEntry = LIST_VALUE(OverlapList.Next, FILE_LOCK_ENTRY, ListEntry);
+        LIST_REMOVE(&(LockEntry->ListEntry));
+        FileObject->FileLockTree = IopRemoveFileLock(FileObject->FileLockTree,
+                                                     LockEntry);
 
-                    if (LockEntry->Size != 0) {
-                        LockEntry->Size = LockEntry->Offset + LockEntry->Size -
-                                          NewEnd;
-                    }
+        //
+        // Wake anyone waiting on the part of the old lock that is going away
+        // or changing type.
+        //
 
-                    LockEntry->Offset = NewEnd;
+        LockEnd = IopGetFileLockEnd(LockEntry->Offset, LockEntry->Size);
+        WakeOffset = LockEntry->Offset;
+        if (WakeOffset < NewEntry->Offset) {
+            WakeOffset = NewEntry->Offset;
+        }
 
-                //
-                // The new entry completely swallows the existing one.
-                //
+        WakeEnd = LockEnd;
+        if (WakeEnd > NewEnd) {
+            WakeEnd = NewEnd;
+        }
 
-                } else {
-                    LIST_REMOVE(&(LockEntry->ListEntry));
-                    INSERT_BEFORE(&(LockEntry->ListEntry), FreeList);
-                }
-            }
+        IopWakeFileLockWaiters(FileObject, WakeOffset, WakeEnd);
 
         //
-        // Another process owns this lock.
+        // If the existing entry starts before the new one, it needs to be
+        // shrunk or split.
         //
 
-        } else if (NewEntry->Type != FileLockUnlock) {
+        if (LockEntry->Offset < NewEntry->Offset) {
 
             //
-            // Read locks can coexist.
+            // If it ends after the new one, split it.
             //
 
-            if ((NewEntry->Type == FileLockRead) &&
-                (LockEntry->Type == FileLockRead)) {
+            if (LockEnd > NewEnd) {
 
-                continue;
-            }
+                ASSERT(LIST_EMPTY(FreeList) == FALSE);
 
-            //
-            // If the file lock overlaps with the incoming one, then fail.
-            //
+                SplitEntry = LIST_VALUE(FreeList->Next,
+                                        FILE_LOCK_ENTRY,
+                                        ListEntry);
+
+                LIST_REMOVE(&(SplitEntry->ListEntry));
+                SplitEntry->Type = LockEntry->Type;
+                SplitEntry->Process = LockEntry->Process;
+                SplitEntry->Offset = NewEnd;
+                if (LockEntry->Size == 0) {
+                    SplitEntry->Size = 0;
+
+                } else {
+                    SplitEntry->Size = LockEnd - NewEnd;
+                }
 
-            Overlap = IopDoFileLocksOverlap(NewEntry->Offset,
-                                            NewEntry->Size,
-                                            LockEntry);
+                FileObject->FileLockTree =
+                       IopInsertFileLock(FileObject->FileLockTree, SplitEntry);
+            }
 
             //
-            // This routine should not be discovering overlaps on the real
-            // deal.
+            // Shrink its length.
             //
 
-            ASSERT((Overlap == FALSE) || (DryRun != FALSE));
+            LockEntry->Size = NewEntry->Offset - LockEntry->Offset;
+            FileObject->FileLockTree =
+                        IopInsertFileLock(FileObject->FileLockTree, LockEntry);
 
-            if (Overlap != FALSE) {
-                Status = STATUS_RESOURCE_IN_USE;
-                KeSignalEvent(FileObject->FileLockEvent, SignalOptionUnsignal);
-                break;
+        //
+        // The current entry starts within the new entry. If it ends after the
+        // new entry, shrink it.
+        //
+
+        } else if (LockEnd > NewEnd) {
+            if (LockEntry->Size != 0) {
+                LockEntry->Size = LockEnd - NewEnd;
             }
+
+            LockEntry->Offset = NewEnd;
+            FileObject->FileLockTree =
+                        IopInsertFileLock(FileObject->FileLockTree, LockEntry);
+
+        //
+        // The new entry completely swallows the existing one.
+        //
+
+        } else {
+            INSERT_BEFORE(&(LockEntry->ListEntry), FreeList);
         }
     }
 
     //
-    // Add the new entry if conditions are right.
+    // Add the new entry if this is not an unlock.
     //
 
-    if ((KSUCCESS(Status)) && (DryRun == FALSE) &&
-        (NewEntry->Type != FileLockUnlock)) {
-
-        INSERT_AFTER(&(NewEntry->ListEntry), &(FileObject->FileLockList));
+    if (NewEntry->Type != FileLockUnlock) {
+        FileObject->FileLockTree = IopInsertFileLock(FileObject->FileLockTree,
+                                                     NewEntry);
     }
 
-    if (LocksRemoved != FALSE) {
-        KeSignalEvent(FileObject->FileLockEvent, SignalOptionSignalAll);
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopWakeFileLockWaiters (
+    PFILE_OBJECT FileObject,
+    ULONGLONG Offset,
+    ULONGLONG End
+    )
+
+/*++
+
+Routine Description:
+
+    This routine wakes every thread waiting for a file lock that overlaps the
+    given region. This routine assumes the file object lock is held
+    exclusively.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object.
+
+    Offset - Supplies the offset of the released region.
+
+    End - Supplies the end offset (exclusive) of the released region.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PFILE_LOCK_WAITER Waiter;
+
+    CurrentEntry = FileObject->FileLockWaitList.Next;
+    while (CurrentEntry != &(FileObject->FileLockWaitList)) {
+        Waiter = LIST_VALUE(CurrentEntry, FILE_LOCK_WAITER, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if ((Waiter->Offset < End) && (Waiter->End > Offset)) {
+            LIST_REMOVE(&(Waiter->ListEntry));
+            Waiter->ListEntry.Next = NULL;
+            ObSignalQueue(&(Waiter->WaitQueue), SignalOptionSignalAll);
+        }
     }
 
-    return Status;
+    return;
 }
 
-BOOL
-IopDoFileLocksOverlap (
-    ULONGLONG IncomingOffset,
-    ULONGLONG IncomingSize,
-    PFILE_LOCK_ENTRY LockEntry
+PFILE_LOCK_ENTRY
+IopFindFileLock (
+    PFILE_LOCK_ENTRY Node,
+    ULONGLONG Offset,
+    ULONGLONG End,
+    BOOL WriteLocksOnly,
+    PFILE_LOCK_ENTRY Previous
     )
 
 /*++
 
 Routine Description:
 
-    This routine checks to see if the given lock entry overlaps with the
-    incoming lock. The lock types are not checked by this routine, only the
-    regions.
+    This routine finds the first lock in the given subtree (in tree order) that
+    overlaps the given region and comes after the given previous lock.
+    Subtrees whose locks all end before the region are skipped, so this takes
+    logarithmic time per lock found.
 
 Arguments:
 
-    IncomingOffset - Supplies the file offset of the incoming lock.
+    Node - Supplies a pointer to the root of the subtree to search.
 
-    IncomingSize - Supplies the file size of the incoming lock.
+    Offset - Supplies the offset of the region.
 
-    LockEntry - Supplies a pointer to the existing lock entry.
+    End - Supplies the end offset (exclusive) of the region.
+
+    WriteLocksOnly - Supplies a boolean indicating whether to only return
+        write locks (TRUE) or locks of either type (FALSE).
+
+    Previous - Supplies an optional pointer to the lock returned by the
+        previous call, to continue a search.
 
 Return Value:
 
-    TRUE if the lock entry overlaps the incoming lock.
+    Returns a pointer to the next overlapping lock on success.
 
-    FALSE if the lock entry does not overlap.
+    NULL if there are no more overlapping locks.
 
 --*/
 
 {
 
-    //
-    // If the incoming lock goes to the end of the file, then this lock
-    // overlaps if it has an offset greater than the incoming one or its
-    // size is also zero.
-    //
+    PFILE_LOCK_ENTRY Found;
+    ULONGLONG MaxEnd;
 
-    if (IncomingSize == 0) {
-        if ((LockEntry->Size == 0) || (LockEntry->Offset >= IncomingOffset)) {
-            return TRUE;
+    while (Node != NULL) {
+        MaxEnd = Node->MaxEnd;
+        if (WriteLocksOnly != FALSE) {
+            MaxEnd = Node->MaxWriteEnd;
         }
 
-    //
-    // The incoming lock spans a specific region. This lock overlaps if
-    // one of these conditions is met:
-    // 1. Size == 0 and the offset starts before the incoming lock's end.
-    // 2. Offset <= IncomingOffset and Offset + Size > IncomingOffset.
-    // 3. Offset > IncomingOffset and Offset < IncomingOffset + IncomingSize.
-    //
+        if (MaxEnd <= Offset) {
+            break;
+        }
 
-    } else {
-        if (LockEntry->Size == 0) {
-            if (LockEntry->Offset < IncomingOffset + IncomingSize) {
-                return TRUE;
-            }
+        //
+        // Everything to the left and this node itself only come after the
+        // previous lock if this node does.
+        //
+
+        if ((Previous == NULL) ||
+            (IopCompareFileLocks(Previous, Node) ==
+             ComparisonResultAscending)) {
+
+            Found = IopFindFileLock(Node->Left,
+                                    Offset,
+                                    End,
+                                    WriteLocksOnly,
+                                    Previous);
 
-        } else if (LockEntry->Offset <= IncomingOffset) {
-            if (LockEntry->Offset + LockEntry->Size > IncomingOffset) {
-                return TRUE;
+            if (Found != NULL) {
+                return Found;
             }
 
-        } else {
-            if (LockEntry->Offset < IncomingOffset + IncomingSize) {
-                return TRUE;
+            if (((WriteLocksOnly == FALSE) ||
+                 (Node->Type == FileLockReadWrite)) &&
+                (IopDoesFileLockOverlap(Node, Offset, End) != FALSE)) {
+
+                return Node;
             }
         }
+
+        //
+        // Everything to the right starts at or after this node, so if this
+        // node starts after the region there's nothing more to find.
+        //
+
+        if (Node->Offset >= End) {
+            break;
+        }
+
+        Node = Node->Right;
+    }
+
+    return NULL;
+}
+
+PFILE_LOCK_ENTRY
+IopInsertFileLock (
+    PFILE_LOCK_ENTRY Node,
+    PFILE_LOCK_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine inserts a lock into the file lock tree.
+
+Arguments:
+
+    Node - Supplies a pointer to the root of the subtree to insert into.
+
+    Entry - Supplies a pointer to the lock to insert.
+
+Return Value:
+
+    Returns the new root of the subtree.
+
+--*/
+
+{
+
+    if (Node == NULL) {
+        Entry->Left = NULL;
+        Entry->Right = NULL;
+        IopUpdateFileLockNode(Entry);
+        return Entry;
+    }
+
+    if (IopCompareFileLocks(Entry, Node) == ComparisonResultAscending) {
+        Node->Left = IopInsertFileLock(Node->Left, Entry);
+
+    } else {
+        Node->Right = IopInsertFileLock(Node->Right, Entry);
+    }
+
+    return IopBalanceFileLockTree(Node);
+}
+
+PFILE_LOCK_ENTRY
+IopRemoveFileLock (
+    PFILE_LOCK_ENTRY Node,
+    PFILE_LOCK_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a lock from the file lock tree. The lock's offset must
+    not have changed since it was inserted.
+
+Arguments:
+
+    Node - Supplies a pointer to the root of the subtree containing the lock.
+
+    Entry - Supplies a pointer to the lock to remove.
+
+Return Value:
+
+    Returns the new root of the subtree.
+
+--*/
+
+{
+
+    PFILE_LOCK_ENTRY Lowest;
+    PFILE_LOCK_ENTRY Right;
+
+    ASSERT(Node != NULL);
+
+    if (Node == Entry) {
+        if (Node->Left == NULL) {
+            return Node->Right;
+        }
+
+        if (Node->Right == NULL) {
+            return Node->Left;
+        }
+
+        //
+        // Replace the node with the lowest node from its right subtree.
+        //
+
+        Right = IopRemoveLowestFileLock(Node->Right, &Lowest);
+        Lowest->Left = Node->Left;
+        Lowest->Right = Right;
+        return IopBalanceFileLockTree(Lowest);
+    }
+
+    if (IopCompareFileLocks(Entry, Node) == ComparisonResultAscending) {
+        Node->Left = IopRemoveFileLock(Node->Left, Entry);
+
+    } else {
+        Node->Right = IopRemoveFileLock(Node->Right, Entry);
+    }
+
+    return IopBalanceFileLockTree(Node);
+}
+
+PFILE_LOCK_ENTRY
+IopRemoveLowestFileLock (
+    PFILE_LOCK_ENTRY Node,
+    PFILE_LOCK_ENTRY *Lowest
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes the lowest lock from a file lock subtree.
+
+Arguments:
+
+    Node - Supplies a pointer to the root of the subtree.
+
+    Lowest - Supplies a pointer where a pointer to the removed lock will be
+        returned.
+
+Return Value:
+
+    Returns the new root of the subtree.
+
+--*/
+
+{
+
+    if (Node->Left == NULL) {
+        *Lowest = Node;
+        return Node->Right;
+    }
+
+    Node->Left = IopRemoveLowestFileLock(Node->Left, Lowest);
+    return IopBalanceFileLockTree(Node);
+}
+
+PFILE_LOCK_ENTRY
+IopBalanceFileLockTree (
+    PFILE_LOCK_ENTRY Node
+    )
+
+/*++
+
+Routine Description:
+
+    This routine updates a file lock tree node whose children have changed,
+    and rotates it if its subtrees are out of balance.
+
+Arguments:
+
+    Node - Supplies a pointer to the node to balance.
+
+Return Value:
+
+    Returns the new root of the subtree.
+
+--*/
+
+{
+
+    ULONG LeftHeight;
+    ULONG RightHeight;
+
+    IopUpdateFileLockNode(Node);
+    LeftHeight = 0;
+    if (Node->Left != NULL) {
+        LeftHeight = Node->Left->Height;
+    }
+
+    RightHeight = 0;
+    if (Node->Right != NULL) {
+        RightHeight = Node->Right->Height;
+    }
+
+    if (LeftHeight > RightHeight + 1) {
+        LeftHeight = 0;
+        if (Node->Left->Left != NULL) {
+            LeftHeight = Node->Left->Left->Height;
+        }
+
+        RightHeight = 0;
+        if (Node->Left->Right != NULL) {
+            RightHeight = Node->Left->Right->Height;
+        }
+
+        if (LeftHeight < RightHeight) {
+            Node->Left = IopRotateFileLockTree(Node->Left, TRUE);
+        }
+
+        return IopRotateFileLockTree(Node, FALSE);
+    }
+
+    if (RightHeight > LeftHeight + 1) {
+        LeftHeight = 0;
+        if (Node->Right->Left != NULL) {
+            LeftHeight = Node->Right->Left->Height;
+        }
+
+        RightHeight = 0;
+        if (Node->Right->Right != NULL) {
+            RightHeight = Node->Right->Right->Height;
+        }
+
+        if (RightHeight < LeftHeight) {
+            Node->Right = IopRotateFileLockTree(Node->Right, FALSE);
+        }
+
+        return IopRotateFileLockTree(Node, TRUE);
+    }
+
+    return Node;
+}
+
+PFILE_LOCK_ENTRY
+IopRotateFileLockTree (
+    PFILE_LOCK_ENTRY Node,
+    BOOL Left
+    )
+
+/*++
+
+Routine Description:
+
+    This routine rotates a file lock subtree.
+
+Arguments:
+
+    Node - Supplies a pointer to the root of the subtree to rotate.
+
+    Left - Supplies a boolean indicating whether to rotate left (TRUE), making
+        the right child the new root, or right (FALSE), making the left child
+        the new root.
+
+Return Value:
+
+    Returns the new root of the subtree.
+
+--*/
+
+{
+
+    PFILE_LOCK_ENTRY NewRoot;
+
+    if (Left != FALSE) {
+        NewRoot = Node->Right;
+        Node->Right = NewRoot->Left;
+        NewRoot->Left = Node;
+
+    } else {
+        NewRoot = Node->Left;
+        Node->Left = NewRoot->Right;
+        NewRoot->Right = Node;
+    }
+
+    IopUpdateFileLockNode(Node);
+    IopUpdateFileLockNode(NewRoot);
+    return NewRoot;
+}
+
+VOID
+IopUpdateFileLockNode (
+    PFILE_LOCK_ENTRY Node
+    )
+
+/*++
+
+Routine Description:
+
+    This routine recomputes the height and maximum end offsets of a file lock
+    tree node from its children.
+
+Arguments:
+
+    Node - Supplies a pointer to the node to update.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFILE_LOCK_ENTRY Child;
+    ULONG ChildIndex;
+    ULONGLONG End;
+
+    End = IopGetFileLockEnd(Node->Offset, Node->Size);
+    Node->Height = 1;
+    Node->MaxEnd = End;
+    Node->MaxWriteEnd = 0;
+    if (Node->Type == FileLockReadWrite) {
+        Node->MaxWriteEnd = End;
+    }
+
+    for (ChildIndex = 0; ChildIndex < 2; ChildIndex += 1) {
+        Child = Node->Left;
+        if (ChildIndex != 0) {
+            Child = Node->Right;
+        }
+
+        if (Child == NULL) {
+            continue;
+        }
+
+        if (Child->Height + 1 > Node->Height) {
+            Node->Height = Child->Height + 1;
+        }
+
+        if (Child->MaxEnd > Node->MaxEnd) {
+            Node->MaxEnd = Child->MaxEnd;
+        }
+
+        if (Child->MaxWriteEnd > Node->MaxWriteEnd) {
+            Node->MaxWriteEnd = Child->MaxWriteEnd;
+        }
+    }
+
+    return;
+}
+
+COMPARISON_RESULT
+IopCompareFileLocks (
+    PFILE_LOCK_ENTRY FirstEntry,
+    PFILE_LOCK_ENTRY SecondEntry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares the position of two file locks in the tree. Locks
+    are sorted by offset, and locks at the same offset are sorted by address
+    so that every lock has a unique place in the tree.
+
+Arguments:
+
+    FirstEntry - Supplies a pointer to the first lock.
+
+    SecondEntry - Supplies a pointer to the second lock.
+
+Return Value:
+
+    Same if the two locks are the same lock.
+
+    Ascending if the first lock comes before the second.
+
+    Descending if the second lock comes before the first.
+
+--*/
+
+{
+
+    if (FirstEntry->Offset < SecondEntry->Offset) {
+        return ComparisonResultAscending;
+
+    } else if (FirstEntry->Offset > SecondEntry->Offset) {
+        return ComparisonResultDescending;
+
+    } else if ((UINTN)FirstEntry < (UINTN)SecondEntry) {
+        return ComparisonResultAscending;
+
+    } else if ((UINTN)FirstEntry > (UINTN)SecondEntry) {
+        return ComparisonResultDescending;
+    }
+
+    return ComparisonResultSame;
+}
+
+BOOL
+IopDoesFileLockOverlap (
+    PFILE_LOCK_ENTRY LockEntry,
+    ULONGLONG Offset,
+    ULONGLONG End
+    )
+
+/*++
+
+Routine Description:
+
+    This routine checks to see if the given lock entry overlaps with the
+    given region. The lock types are not checked by this routine, only the
+    regions.
+
+Arguments:
+
+    LockEntry - Supplies a pointer to the existing lock entry.
+
+    Offset - Supplies the offset of the region.
+
+    End - Supplies the end offset (exclusive) of the region.
+
+Return Value:
+
+    TRUE if the lock entry overlaps the region.
+
+    FALSE if the lock entry does not overlap.
+
+--*/
+
+{
+
+    if ((LockEntry->Offset < End) &&
+        (IopGetFileLockEnd(LockEntry->Offset, LockEntry->Size) > Offset)) {
+
+        return TRUE;
     }
 
     return FALSE;
 }
 
+ULONGLONG
+IopGetFileLockEnd (
+    ULONGLONG Offset,
+    ULONGLONG Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the end offset (exclusive) of a lock region.
+
+Arguments:
+
+    Offset - Supplies the offset of the lock.
+
+    Size - Supplies the size of the lock. Zero means the lock extends to the
+        end of the file.
+
+Return Value:
+
+    Returns the end offset of the lock, or FILE_LOCK_END_OF_FILE if the lock
+    extends to the end of the file.
+
+--*/
+
+{
+
+    if ((Size == 0) || (Offset + Size < Offset)) {
+        return FILE_LOCK_END_OF_FILE;
+    }
+
+    return Offset + Size;
+}
+
@@ -59,6 +59,27 @@ IopGetCacheStatistics (
     BOOL Set
     );
 
+KSTATUS
+IopGetWritebackStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+KSTATUS
+IopGetSetBlockQueueInformation (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+KSTATUS
+IopGetDeviceStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -128,6 +149,18 @@ Return Value:
         Status = IopGetCacheStatistics(Data, DataSize, Set);
         break;
 
+    case IoInformationWritebackStatistics:
+        Status = IopGetWritebackStatistics(Data, DataSize, Set);
+        break;
+
+    case IoInformationBlockQueue:
+        Status = IopGetSetBlockQueueInformation(Data, DataSize, Set);
+        break;
+
+    case IoInformationDeviceStatistics:
+        Status = IopGetDeviceStatistics(Data, DataSize, Set);
+        break;
+
     default:
         Status = STATUS_INVALID_PARAMETER;
         *DataSize = 0;
@@ -231,3 +264,138 @@ Return Value:
     return IoGetCacheStatistics(Data);
 }
 
+KSTATUS
+IopGetWritebackStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the per-device page cache writeback statistics.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    if (Set != FALSE) {
+        *DataSize = 0;
+        return STATUS_ACCESS_DENIED;
+    }
+
+    return IoGetWritebackStatistics(Data, DataSize);
+}
+
+KSTATUS
+IopGetSetBlockQueueInformation (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the per-device block I/O queue information, or sets the
+    scheduler type and queue depth of block devices.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    if (Set == FALSE) {
+        return IopGetBlockQueueInformation(Data, DataSize);
+    }
+
+    Status = PsCheckPermission(PERMISSION_SYSTEM_ADMINISTRATOR);
+    if (!KSUCCESS(Status)) {
+        *DataSize = 0;
+        return Status;
+    }
+
+    if ((*DataSize % sizeof(IO_BLOCK_QUEUE_INFORMATION)) != 0) {
+        *DataSize = 0;
+        return STATUS_DATA_LENGTH_MISMATCH;
+    }
+
+    return IopSetBlockQueueInformation(
+                               Data,
+                               *DataSize / sizeof(IO_BLOCK_QUEUE_INFORMATION));
+}
+
+KSTATUS
+IopGetDeviceStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the per-device block I/O statistics.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    if (Set != FALSE) {
+        *DataSize = 0;
+        return STATUS_ACCESS_DENIED;
+    }
+
+    return IopGetDeviceIoStatistics(Data, DataSize);
+}
+
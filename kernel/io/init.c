@@ -231,6 +231,8 @@ Return Value:
         goto InitializeEnd;
     }
 
+    IopInitializeIrpCache();
+
     //
     // Create the pipe directory.
     //
@@ -325,6 +327,24 @@ Return Value:
         goto InitializeEnd;
     }
 
+    //
+    // Initialize support for per-device writeback.
+    //
+
+    Status = IopInitializeWriteback();
+    if (!KSUCCESS(Status)) {
+        goto InitializeEnd;
+    }
+
+    //
+    // Initialize support for block I/O scheduling.
+    //
+
+    Status = IopInitializeIoScheduler();
+    if (!KSUCCESS(Status)) {
+        goto InitializeEnd;
+    }
+
     //
     // Initialize support for terminals.
     //
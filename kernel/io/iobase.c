@@ -903,6 +903,7 @@ Return Value:
         }
 
         IopSchedulePageCacheThread();
+        IopWakeWritebackThreads();
         Status = STATUS_SUCCESS;
         goto FlushEnd;
     }
@@ -2329,20 +2330,20 @@ Return Value:
                                        SourceFileObject);
 
             if (NewPathEntry != NULL) {
-                INSERT_BEFORE(
-                        &(NewPathEntry->SiblingListEntry),
-                        &(DestinationDirectoryPathPoint.PathEntry->ChildList));
-
+                IopPathLink(NewPathEntry);
                 IopFileObjectAddReference(SourceFileObject);
             }
         }
 
         //
         // Unlink the source file path from its parent so new paths walks will
-        // not find it and so that delete will see that it's too late.
+        // not find it and so that delete will see that it's too late. Bump
+        // the path generation so that lock-free walks that passed through
+        // the source (if it's a directory) start over.
         //
 
         IopPathUnlink(SourcePathPoint.PathEntry);
+        RtlAtomicAdd32(&IoPathGeneration, 1);
 
         //
         // Also update the size of the destination directory.
@@ -3539,6 +3540,15 @@ Return Value:
         Status = IopTerminalOpenSlave(NewHandle);
         break;
 
+    //
+    // Event poll sets and I/O rings don't need anything to be opened either.
+    //
+
+    case IoObjectEventPoll:
+    case IoObjectIoRing:
+        Status = STATUS_SUCCESS;
+        break;
+
     case IoObjectSharedMemoryObject:
         if ((Flags & OPEN_FLAG_TRUNCATE) != 0) {
             Status = IopModifyFileObjectSize(FileObject, NULL, 0);
@@ -3717,6 +3727,14 @@ Return Value:
         Status = IopCreateSocket(Create, FileObject);
         break;
 
+    case IoObjectEventPoll:
+        Status = IopCreateEventPoll(Create, FileObject);
+        break;
+
+    case IoObjectIoRing:
+        Status = IopCreateIoRing(Create, FileObject);
+        break;
+
     case IoObjectTerminalMaster:
     case IoObjectTerminalSlave:
         Status = IopCreateTerminal(Create, FileObject);
@@ -3822,6 +3840,14 @@ Return Value:
             Status = IopTerminalCloseSlave(IoHandle);
             break;
 
+        case IoObjectEventPoll:
+            Status = IopCloseEventPoll(IoHandle);
+            break;
+
+        case IoObjectIoRing:
+            Status = IopCloseIoRing(IoHandle);
+            break;
+
         default:
             Status = STATUS_SUCCESS;
             break;
@@ -3842,6 +3868,14 @@ Return Value:
         IoHandle->Async = NULL;
     }
 
+    //
+    // Pull this handle out of any event poll sets it was added to.
+    //
+
+    if (IoHandle->EventPollCount != 0) {
+        IopRemoveEventPollHandle(IoHandle);
+    }
+
     //
     // Let go of the path point, and slide gently into the night. Be careful,
     // as anonymous objects do not have a mount point. Also handles that failed
@@ -4328,6 +4362,10 @@ Return Value:
         *Flags |= FILE_OBJECT_FLAG_NON_PAGED_IO_STATE;
     }
 
+    if ((Request.Flags & LOOKUP_FLAG_HARD_FLUSH_REQUIRED) != 0) {
+        *Flags |= FILE_OBJECT_FLAG_HARD_FLUSH_REQUIRED;
+    }
+
     *MapFlags = Request.MapFlags;
     return Status;
 }
@@ -4338,7 +4376,8 @@ IopSendCreateRequest (
     PFILE_OBJECT Directory,
     PCSTR Name,
     ULONG NameSize,
-    PFILE_PROPERTIES Properties
+    PFILE_PROPERTIES Properties,
+    PULONG Flags
     )
 
 /*++
@@ -4366,6 +4405,9 @@ Routine Description:
         on success. The permissions, object type, user ID, group ID, and access
         times are all valid from the system.
 
+    Flags - Supplies a pointer where the translated file object flags will be
+        returned. See FILE_OBJECT_FLAG_* definitions.
+
 Return Value:
 
     Status code.
@@ -4396,6 +4438,19 @@ Return Value:
                   &(Request.FileProperties),
                   sizeof(FILE_PROPERTIES));
 
+    *Flags = 0;
+    if ((Request.Flags & LOOKUP_FLAG_NO_PAGE_CACHE) != 0) {
+        *Flags |= FILE_OBJECT_FLAG_NO_PAGE_CACHE;
+    }
+
+    if ((Request.Flags & LOOKUP_FLAG_NON_PAGED_IO_STATE) != 0) {
+        *Flags |= FILE_OBJECT_FLAG_NON_PAGED_IO_STATE;
+    }
+
+    if ((Request.Flags & LOOKUP_FLAG_HARD_FLUSH_REQUIRED) != 0) {
+        *Flags |= FILE_OBJECT_FLAG_HARD_FLUSH_REQUIRED;
+    }
+
     //
     // Update the access time and modified time if file was created.
     //
@@ -5390,6 +5445,16 @@ Return Value:
         Status = IopPerformObjectIoOperation(Handle, Context);
         break;
 
+    //
+    // Event poll sets and I/O rings can only be waited on, not read or
+    // written.
+    //
+
+    case IoObjectEventPoll:
+    case IoObjectIoRing:
+        Status = STATUS_INVALID_PARAMETER;
+        break;
+
     default:
 
         ASSERT(FALSE);
@@ -130,6 +130,13 @@ Module Name:
 
 #define IRP_ACTIVE 0x00000004
 
+//
+// This flag is set in an IRP that lives on the stack of the thread sending
+// it rather than in pool.
+//
+
+#define IRP_LOCAL 0x00000008
+
 //
 // This flag is used during processing Query Children to mark pre-existing
 // devices and notice missing ones.
@@ -240,6 +247,44 @@ Module Name:
 
 #define IO_READ_AHEAD_SIZE _128KB
 
+//
+// Define the bounds of the adaptive read-ahead window used for sequential
+// reads of regular files. The window starts at the minimum once a handle is
+// seen reading sequentially and doubles with each sequential read up to the
+// maximum.
+//
+
+#define IO_READ_AHEAD_MINIMUM_SIZE _64KB
+#define IO_READ_AHEAD_MAXIMUM_SIZE _1MB
+
+//
+// Define the number of children above which a path entry indexes its children
+// in a hash table, and the number of buckets that table starts with. The
+// table doubles when the average chain exceeds the load factor, halves when
+// it drops below a quarter full, and is freed when the directory shrinks
+// back under half the threshold.
+//
+
+#define PATH_ENTRY_HASH_THRESHOLD 32
+#define PATH_ENTRY_HASH_MINIMUM_SIZE 64
+#define PATH_ENTRY_HASH_LOAD_FACTOR 2
+
+//
+// Define the number of key bits resolved at each level of a page cache index,
+// and the resulting number of slots in each index node.
+//
+
+#define PAGE_CACHE_INDEX_SHIFT 6
+#define PAGE_CACHE_INDEX_SLOTS (1 << PAGE_CACHE_INDEX_SHIFT)
+#define PAGE_CACHE_INDEX_MASK (PAGE_CACHE_INDEX_SLOTS - 1)
+
+//
+// Define the device ID filter that flushes only the dirty file objects with
+// no writeback device of their own. Device ID 0 flushes everything.
+//
+
+#define FLUSH_DEVICE_ID_UNOWNED MAX_ULONGLONG
+
 //
 // This flag is set to indicate that the eviction operation is executing as a
 // result of a truncate. All image sections should be unmapped and all page
@@ -323,6 +368,17 @@ Module Name:
     ((_IoObjectType == IoObjectBlockDevice) ||      \
      IO_IS_CACHEABLE_FILE(_IoObjectType))
 
+//
+// This macro determines whether or not a file type keeps its data on a
+// backing device, and is therefore flushed by that device's writeback thread.
+//
+
+#define IO_IS_WRITEBACK_TYPE(_IoObjectType)         \
+    ((_IoObjectType == IoObjectRegularFile) ||      \
+     (_IoObjectType == IoObjectRegularDirectory) || \
+     (_IoObjectType == IoObjectSymbolicLink) ||     \
+     (_IoObjectType == IoObjectBlockDevice))
+
 //
 // This macro determines whether or not a file object is cacheable.
 //
@@ -331,6 +387,12 @@ Module Name:
     ((IO_IS_CACHEABLE_TYPE(_FileObject->Properties.Type) != FALSE) &&        \
      ((_FileObject->Flags & FILE_OBJECT_FLAG_NO_PAGE_CACHE) == 0))
 
+//
+// This macro determines whether or not a page cache index is empty.
+//
+
+#define PAGE_CACHE_INDEX_EMPTY(_Index) ((_Index)->Root == NULL)
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -342,6 +404,137 @@ typedef enum _FILE_OBJECT_TIME_TYPE {
 } FILE_OBJECT_TIME_TYPE, *PFILE_OBJECT_TIME_TYPE;
 
 typedef struct _DEVICE_POWER DEVICE_POWER, *PDEVICE_POWER;
+typedef struct _IO_SCHEDULER IO_SCHEDULER, *PIO_SCHEDULER;
+
+typedef enum _WRITEBACK_STATE {
+    WritebackStateInvalid,
+    WritebackStateClean,
+    WritebackStateDirty,
+} WRITEBACK_STATE, *PWRITEBACK_STATE;
+
+typedef enum _PAGE_CACHE_INDEX_TAG {
+    PageCacheIndexTagDirty,
+    PageCacheIndexTagCount,
+} PAGE_CACHE_INDEX_TAG, *PPAGE_CACHE_INDEX_TAG;
+
+/*++
+
+Structure Description:
+
+    This structure defines a node in a page cache index. Leaf nodes point at
+    page cache entries, and all other nodes point at the next level down.
+
+Members:
+
+    Parent - Stores a pointer to the parent node, or NULL for the root.
+
+    ParentSlot - Stores the index of the slot in the parent that points at
+        this node.
+
+    Shift - Stores the number of key bits below this node's level. Leaf nodes
+        have a shift of zero.
+
+    Present - Stores a bitmap of the slots that are in use.
+
+    Tags - Stores a bitmap of tagged slots for each tag. A slot in an interior
+        node is tagged if anything beneath it is tagged.
+
+    Slots - Stores the child nodes or page cache entries.
+
+--*/
+
+typedef struct _PAGE_CACHE_INDEX_NODE
+    PAGE_CACHE_INDEX_NODE, *PPAGE_CACHE_INDEX_NODE;
+
+struct _PAGE_CACHE_INDEX_NODE {
+    PPAGE_CACHE_INDEX_NODE Parent;
+    ULONG ParentSlot;
+    ULONG Shift;
+    ULONGLONG Present;
+    volatile ULONGLONG Tags[PageCacheIndexTagCount];
+    PVOID Slots[PAGE_CACHE_INDEX_SLOTS];
+};
+
+/*++
+
+Structure Description:
+
+    This structure defines a radix index of page cache entries, keyed by page
+    number. Lookups and walks require the file object lock. Changing the
+    shape of the index requires the file object lock exclusive, and tags are
+    synchronized separately by the page cache list lock.
+
+Members:
+
+    Root - Stores a pointer to the root node, or NULL if the index is empty.
+
+--*/
+
+typedef struct _PAGE_CACHE_INDEX {
+    PPAGE_CACHE_INDEX_NODE Root;
+} PAGE_CACHE_INDEX, *PPAGE_CACHE_INDEX;
+
+/*++
+
+Structure Description:
+
+    This structure defines the writeback state for a backing device. Every
+    file object whose data ultimately lands on the device shares one of these,
+    and with it a flusher thread and a set of dirty page counters.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous writeback devices in
+        the global list.
+
+    DeviceId - Stores the ID of the backing device.
+
+    ReferenceCount - Stores the number of file objects using this structure.
+        This is protected by the global writeback list lock.
+
+    State - Stores the scheduling state of the flusher thread. See
+        WRITEBACK_STATE.
+
+    Exiting - Stores a boolean indicating that the last file object is gone
+        and the flusher thread should tear the structure down.
+
+    Timer - Stores a pointer to the timer that delays the flusher thread so
+        writes have a chance to pool.
+
+    Event - Stores a pointer to the event used to wake the flusher thread
+        immediately.
+
+    Thread - Stores a pointer to the flusher thread.
+
+    DirtyPageCount - Stores the number of dirty pages owned by the file
+        objects of this device.
+
+    WritebackPageCount - Stores the number of pages currently being written
+        out to the device.
+
+    WrittenPageCount - Stores the total number of pages written out to the
+        device.
+
+    Bandwidth - Stores a moving average of the rate the device retires pages,
+        in pages per second. The device's share of the dirty page limit is
+        proportional to this.
+
+--*/
+
+typedef struct _WRITEBACK_DEVICE {
+    LIST_ENTRY ListEntry;
+    DEVICE_ID DeviceId;
+    ULONG ReferenceCount;
+    volatile ULONG State;
+    volatile BOOL Exiting;
+    PKTIMER Timer;
+    PKEVENT Event;
+    PKTHREAD Thread;
+    volatile UINTN DirtyPageCount;
+    volatile UINTN WritebackPageCount;
+    volatile UINTN WrittenPageCount;
+    volatile UINTN Bandwidth;
+} WRITEBACK_DEVICE, *PWRITEBACK_DEVICE;
 
 /*++
 
@@ -356,8 +549,8 @@ Structure Description:
 
     ListEntry - Stores an entry into the list of file objects.
 
-    PageCacheTree - Stores a tree root for the page cache entries that
-        belong to this file object.
+    PageCacheIndex - Stores the index of the page cache entries that belong
+        to this file object.
 
     DirtyPageList - Stores the head of the list of dirty page cache entries
         in this file object. This list is synchronized by the global page
@@ -374,6 +567,10 @@ Structure Description:
     Device - Stores a pointer to the device or volume that owns the file serial
         number.
 
+    Writeback - Stores an optional pointer to the writeback state of the
+        device the file's data is stored on. File objects without one are
+        flushed by the page cache thread.
+
     Directory - Stores a pointer to an open handle to the file's directory,
         which is used to synchronize deletes, opens, and metadata updates.
 
@@ -403,23 +600,25 @@ Structure Description:
 
     Properties - Stores the characteristics for this file.
 
-    FileLockList - Stores the head of the list of file locks held on this
-        file object. This is a user mode thing.
+    FileLockTree - Stores a pointer to the root of the interval tree of file
+        locks held on this file object. This is a user mode thing.
 
-    FileLockEvent - Stores a pointer to the event that's signalled when a file
-        object lock is released.
+    FileLockWaitList - Stores the head of the list of threads waiting to
+        acquire a file lock on this file object.
 
 --*/
 
+typedef struct _FILE_LOCK_ENTRY FILE_LOCK_ENTRY, *PFILE_LOCK_ENTRY;
 typedef struct _FILE_OBJECT FILE_OBJECT, *PFILE_OBJECT;
 struct _FILE_OBJECT {
     RED_BLACK_TREE_NODE TreeEntry;
     LIST_ENTRY ListEntry;
-    RED_BLACK_TREE PageCacheTree;
+    PAGE_CACHE_INDEX PageCacheIndex;
     LIST_ENTRY DirtyPageList;
     volatile ULONG ReferenceCount;
     volatile ULONG PathEntryCount;
     PDEVICE Device;
+    PWRITEBACK_DEVICE Writeback;
     PSHARED_EXCLUSIVE_LOCK Lock;
     PIO_OBJECT_STATE IoState;
     PVOID SpecialIo;
@@ -429,8 +628,8 @@ struct _FILE_OBJECT {
     volatile ULONG Flags;
     ULONG MapFlags;
     FILE_PROPERTIES Properties;
-    LIST_ENTRY FileLockList;
-    PKEVENT FileLockEvent;
+    PFILE_LOCK_ENTRY FileLockTree;
+    LIST_ENTRY FileLockWaitList;
 };
 
 /*++
@@ -444,6 +643,10 @@ Structure Description:
     SiblingListEntry - Stores pointers to the next and previous entries in
         the parent directory.
 
+    HashListEntry - Stores pointers to the next and previous entries in the
+        parent's child hash table bucket. The next pointer is NULL if the
+        parent is not hashing its children.
+
     CacheListEntry - Stores pointers to the next and previous entries in the
         LRU list of the path entry cache.
 
@@ -475,12 +678,27 @@ Structure Description:
 
     ChildList - Stores the list of children for this node.
 
+    ChildHashTable - Stores an optional pointer to an array of list heads
+        indexing the children by name hash. This is only allocated once the
+        number of children crosses the hash threshold.
+
+    ChildHashTableSize - Stores the number of buckets in the child hash table.
+        This is always a power of two.
+
+    ChildCount - Stores the number of path entries on the child list.
+
+    ChildSequence - Stores a sequence number that is odd while the child list
+        or child hash table is being changed, and is incremented again once
+        the change is complete. Lock-free path walks use this to detect
+        concurrent changes to the directory.
+
     FileObject - Stores a pointer to the file object backing this path entry.
 
 --*/
 
 struct _PATH_ENTRY {
     LIST_ENTRY SiblingListEntry;
+    LIST_ENTRY HashListEntry;
     LIST_ENTRY CacheListEntry;
     volatile ULONG ReferenceCount;
     volatile ULONG MountCount;
@@ -491,6 +709,10 @@ struct _PATH_ENTRY {
     ULONG Hash;
     PPATH_ENTRY Parent;
     LIST_ENTRY ChildList;
+    PLIST_ENTRY ChildHashTable;
+    ULONG ChildHashTableSize;
+    ULONG ChildCount;
+    volatile ULONG ChildSequence;
     PFILE_OBJECT FileObject;
 };
 
@@ -593,6 +815,19 @@ Structure Description:
 
     Async - Stores an optional pointer to the asynchronous receiver state.
 
+    ReadAheadOffset - Stores the file offset where the next read is expected
+        to begin if the handle is being read sequentially.
+
+    ReadAheadEnd - Stores the file offset up to which read-ahead has already
+        been requested on behalf of this handle.
+
+    ReadAheadWindow - Stores the current size of the read-ahead window, in
+        bytes. This is zero if the handle is not being read sequentially.
+
+    EventPollCount - Stores the number of event poll sets this handle is
+        registered with. This is protected by the event poll watch lock of the
+        file object's I/O state.
+
 --*/
 
 struct _IO_HANDLE {
@@ -605,6 +840,10 @@ struct _IO_HANDLE {
     PFILE_OBJECT FileObject;
     IO_OFFSET CurrentOffset;
     PASYNC_IO_RECEIVER Async;
+    IO_OFFSET ReadAheadOffset;
+    IO_OFFSET ReadAheadEnd;
+    UINTN ReadAheadWindow;
+    volatile ULONG EventPollCount;
 };
 
 /*++
@@ -989,6 +1228,10 @@ Structure Description:
 
     Power - Stores the power management information for the device.
 
+    Scheduler - Stores an optional pointer to the I/O scheduler that queues
+        block I/O requests sent to this device. It is created on the first
+        scheduled request.
+
 --*/
 
 struct _DEVICE {
@@ -1020,6 +1263,7 @@ struct _DEVICE {
     PRESOURCE_ALLOCATION_LIST ProcessorLocalResources;
     PRESOURCE_ALLOCATION_LIST BootResources;
     PDEVICE_POWER Power;
+    PIO_SCHEDULER Scheduler;
 };
 
 /*++
@@ -1125,6 +1369,29 @@ typedef struct _CREATE_PARAMETERS {
     BOOL Created;
 } CREATE_PARAMETERS, *PCREATE_PARAMETERS;
 
+/*++
+
+Structure Description:
+
+    This structure defines the set of event poll entries watching an I/O
+    object state. It is allocated from non-paged pool, since it is used to
+    queue entries to their event poll sets when the object's state changes.
+
+Members:
+
+    Lock - Stores the spin lock protecting the entry list, and the handle
+        pointer and events of each entry on it.
+
+    EntryList - Stores the head of the list of event poll entries watching the
+        I/O object state.
+
+--*/
+
+struct _EVENT_POLL_WATCH {
+    KSPIN_LOCK Lock;
+    LIST_ENTRY EntryList;
+};
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -1235,6 +1502,13 @@ extern PATH_POINT IoSharedMemoryRoot;
 
 extern PSHARED_EXCLUSIVE_LOCK IoMountLock;
 
+//
+// Store the path generation number, which is incremented whenever a mount
+// or rename changes the shape of the path tree.
+//
+
+extern volatile ULONG IoPathGeneration;
+
 //
 // Store the path to the system directory on the system volume.
 //
@@ -2167,7 +2441,8 @@ IopSendCreateRequest (
     PFILE_OBJECT Directory,
     PCSTR Name,
     ULONG NameSize,
-    PFILE_PROPERTIES Properties
+    PFILE_PROPERTIES Properties,
+    PULONG Flags
     );
 
 /*++
@@ -2194,6 +2469,9 @@ Routine Description:
         on success. The permissions, object type, user ID, group ID, and access
         times are all valid from the system.
 
+    Flags - Supplies a pointer where the translated file object flags will be
+        returned. See FILE_OBJECT_FLAG_* definitions.
+
 Return Value:
 
     Status code.
@@ -2629,7 +2907,10 @@ Routine Description:
 Arguments:
 
     DeviceId - Supplies an optional device ID filter. Supply 0 to iterate over
-        dirty file objects for all devices.
+        dirty file objects for all devices. A device ID also covers the file
+        objects whose data is written back to that device. Supply
+        FLUSH_DEVICE_ID_UNOWNED to flush only the file objects with no
+        writeback device.
 
     Flags - Supplies a bitmask of I/O flags. See IO_FLAG_* for definitions.
 
@@ -2648,6 +2929,31 @@ Return Value:
 
 --*/
 
+BOOL
+IopHasDirtyFileObjects (
+    DEVICE_ID DeviceId
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not any file object in the global dirty
+    file objects list would be covered by a flush of the given device.
+
+Arguments:
+
+    DeviceId - Supplies the device ID filter, as it would be passed to flush
+        file objects.
+
+Return Value:
+
+    TRUE if there is at least one matching dirty file object.
+
+    FALSE if there are none.
+
+--*/
+
 VOID
 IopEvictFileObject (
     PFILE_OBJECT FileObject,
@@ -3062,54 +3368,46 @@ Return Value:
 
 --*/
 
-POBJECT_HEADER
-IopGetPipeDirectory (
-    VOID
+KSTATUS
+IopCreateEventPoll (
+    PCREATE_PARAMETERS Create,
+    PFILE_OBJECT *FileObject
     );
 
 /*++
 
 Routine Description:
 
-    This routine returns the pipe root directory in the object system. This is
-    the only place in the object system pipe creation is allowed.
+    This routine creates a new event poll set.
 
 Arguments:
 
-    None.
+    Create - Supplies a pointer to the creation parameters.
+
+    FileObject - Supplies a pointer where the new file object representing the
+        event poll set will be returned on success.
 
 Return Value:
 
-    Returns a pointer to the pipe directory.
+    Status code.
 
 --*/
 
 KSTATUS
-IopCreatePipe (
-    PCSTR Name,
-    ULONG NameSize,
-    PCREATE_PARAMETERS Create,
-    PFILE_OBJECT *FileObject
+IopCloseEventPoll (
+    PIO_HANDLE IoHandle
     );
 
 /*++
 
 Routine Description:
 
-    This routine actually creates a new pipe.
+    This routine is called when the last handle to an event poll set is
+    closed. It removes every entry from the set.
 
 Arguments:
 
-    Name - Supplies an optional pointer to the pipe name. This is only used for
-        named pipes created in the pipe directory.
-
-    NameSize - Supplies the size of the name in bytes including the null
-        terminator.
-
-    Create - Supplies a pointer to the creation parameters.
-
-    FileObject - Supplies a pointer where a pointer to a newly created pipe
-        file object will be returned on success.
+    IoHandle - Supplies a pointer to the I/O handle being closed.
 
 Return Value:
 
@@ -3117,54 +3415,56 @@ Return Value:
 
 --*/
 
-KSTATUS
-IopUnlinkPipe (
-    PFILE_OBJECT FileObject,
-    PBOOL Unlinked
+VOID
+IopEventPollReleaseReference (
+    PVOID EventPoll
     );
 
 /*++
 
 Routine Description:
 
-    This routine unlinks a pipe from the accessible namespace.
+    This routine releases a reference on an event poll set, destroying it if
+    this was the last reference.
 
 Arguments:
 
-    FileObject - Supplies a pointer to the pipe's file object.
-
-    Unlinked - Supplies a pointer to a boolean that receives whether or not the
-        terminal was successfully unlinked.
+    EventPoll - Supplies a pointer to the event poll set.
 
 Return Value:
 
-    Status code.
+    None.
 
 --*/
 
-KSTATUS
-IopOpenPipe (
-    PIO_HANDLE IoHandle
+VOID
+IopSignalEventPolls (
+    PIO_OBJECT_STATE IoState,
+    ULONG Events
     );
 
 /*++
 
 Routine Description:
 
-    This routine is called when a pipe is opened.
+    This routine queues every event poll entry watching the given I/O object
+    state that is interested in the given events onto its set's ready list.
+    This routine can be called at dispatch level.
 
 Arguments:
 
-    IoHandle - Supplies a pointer to the new I/O handle.
+    IoState - Supplies a pointer to the I/O object state that was signaled.
+
+    Events - Supplies the mask of poll events that were just set.
 
 Return Value:
 
-    Status code.
+    None.
 
 --*/
 
-KSTATUS
-IopClosePipe (
+VOID
+IopRemoveEventPollHandle (
     PIO_HANDLE IoHandle
     );
 
@@ -3172,7 +3472,8 @@ IopClosePipe (
 
 Routine Description:
 
-    This routine is called when a pipe is closed.
+    This routine removes the given I/O handle from every event poll set it is
+    registered with. It is called when the handle is closed.
 
 Arguments:
 
@@ -3180,51 +3481,52 @@ Routine Description:
 
 Return Value:
 
-    Status code.
+    None.
 
 --*/
 
 KSTATUS
-IopPerformPipeIoOperation (
-    PIO_HANDLE Handle,
-    PIO_CONTEXT IoContext
+IopCreateIoRing (
+    PCREATE_PARAMETERS Create,
+    PFILE_OBJECT *FileObject
     );
 
 /*++
 
 Routine Description:
 
-    This routine reads from or writes to a pipe.
+    This routine creates a new I/O ring. The shared memory is attached to the
+    ring afterwards by the creation system call.
 
 Arguments:
 
-    Handle - Supplies a pointer to the pipe I/O handle.
+    Create - Supplies a pointer to the creation parameters.
 
-    IoContext - Supplies a pointer to the I/O context.
+    FileObject - Supplies a pointer where the new file object representing the
+        I/O ring will be returned on success.
 
 Return Value:
 
-    Status code. A failing status code does not necessarily mean no I/O made it
-    in or out. Check the bytes completed value in the I/O context to find out
-    how much occurred.
+    Status code.
 
 --*/
 
 KSTATUS
-IopInitializeTerminalSupport (
-    VOID
+IopCloseIoRing (
+    PIO_HANDLE IoHandle
     );
 
 /*++
 
 Routine Description:
 
-    This routine is called during system initialization to set up support for
-    terminals.
+    This routine is called when the last handle to an I/O ring is closed. It
+    stops the ring from accepting new work and tells its workers to give up
+    on blocked requests.
 
 Arguments:
 
-    None.
+    IoHandle - Supplies a pointer to the I/O handle being closed.
 
 Return Value:
 
@@ -3232,62 +3534,293 @@ Return Value:
 
 --*/
 
-KSTATUS
-IopTerminalOpenMaster (
-    PIO_HANDLE IoHandle
+VOID
+IopIoRingReleaseReference (
+    PVOID IoRing
     );
 
 /*++
 
 Routine Description:
 
-    This routine is called when a master terminal was just opened.
+    This routine releases a reference on an I/O ring, destroying it if this
+    was the last reference.
 
 Arguments:
 
-    IoHandle - Supplies a pointer to the I/O handle for the terminal.
+    IoRing - Supplies a pointer to the I/O ring.
 
 Return Value:
 
-    Status code.
+    None.
 
 --*/
 
-KSTATUS
-IopTerminalCloseMaster (
-    PIO_HANDLE IoHandle
+POBJECT_HEADER
+IopGetPipeDirectory (
+    VOID
     );
 
 /*++
 
 Routine Description:
 
-    This routine is called when a master terminal was just closed.
+    This routine returns the pipe root directory in the object system. This is
+    the only place in the object system pipe creation is allowed.
 
 Arguments:
 
-    IoHandle - Supplies a pointer to the handle to close.
+    None.
 
 Return Value:
 
-    Status code.
+    Returns a pointer to the pipe directory.
 
 --*/
 
 KSTATUS
-IopTerminalOpenSlave (
-    PIO_HANDLE IoHandle
+IopCreatePipe (
+    PCSTR Name,
+    ULONG NameSize,
+    PCREATE_PARAMETERS Create,
+    PFILE_OBJECT *FileObject
     );
 
 /*++
 
 Routine Description:
 
-    This routine opens the slave side of a terminal object.
+    This routine actually creates a new pipe.
 
 Arguments:
 
-    IoHandle - Supplies a pointer to the I/O handle for the terminal.
+    Name - Supplies an optional pointer to the pipe name. This is only used for
+        named pipes created in the pipe directory.
+
+    NameSize - Supplies the size of the name in bytes including the null
+        terminator.
+
+    Create - Supplies a pointer to the creation parameters.
+
+    FileObject - Supplies a pointer where a pointer to a newly created pipe
+        file object will be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+IopUnlinkPipe (
+    PFILE_OBJECT FileObject,
+    PBOOL Unlinked
+    );
+
+/*++
+
+Routine Description:
+
+    This routine unlinks a pipe from the accessible namespace.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the pipe's file object.
+
+    Unlinked - Supplies a pointer to a boolean that receives whether or not the
+        terminal was successfully unlinked.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+IopOpenPipe (
+    PIO_HANDLE IoHandle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine is called when a pipe is opened.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the new I/O handle.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+IopClosePipe (
+    PIO_HANDLE IoHandle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine is called when a pipe is closed.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle being closed.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+IopPerformPipeIoOperation (
+    PIO_HANDLE Handle,
+    PIO_CONTEXT IoContext
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads from or writes to a pipe.
+
+Arguments:
+
+    Handle - Supplies a pointer to the pipe I/O handle.
+
+    IoContext - Supplies a pointer to the I/O context.
+
+Return Value:
+
+    Status code. A failing status code does not necessarily mean no I/O made it
+    in or out. Check the bytes completed value in the I/O context to find out
+    how much occurred.
+
+--*/
+
+KSTATUS
+IopGetSetPipeSize (
+    PIO_HANDLE Handle,
+    PULONG Size,
+    BOOL Set
+    );
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the capacity of a pipe.
+
+Arguments:
+
+    Handle - Supplies a pointer to the pipe I/O handle.
+
+    Size - Supplies a pointer that on input contains the requested size for set
+        operations. On output, returns the size of the pipe.
+
+    Set - Supplies a boolean indicating whether to get the size (FALSE) or set
+        it (TRUE).
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the handle is not a pipe.
+
+    STATUS_PERMISSION_DENIED if the caller tried to grow the pipe beyond the
+    system limit without the resources permission.
+
+    STATUS_RESOURCE_IN_USE if the pipe holds more data than would fit in the
+    requested size.
+
+    Other error codes on failure.
+
+--*/
+
+KSTATUS
+IopInitializeTerminalSupport (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine is called during system initialization to set up support for
+    terminals.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+IopTerminalOpenMaster (
+    PIO_HANDLE IoHandle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine is called when a master terminal was just opened.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle for the terminal.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+IopTerminalCloseMaster (
+    PIO_HANDLE IoHandle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine is called when a master terminal was just closed.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the handle to close.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+IopTerminalOpenSlave (
+    PIO_HANDLE IoHandle
+    );
+
+/*++
+
+Routine Description:
+
+    This routine opens the slave side of a terminal object.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle for the terminal.
 
 Return Value:
 
@@ -4063,6 +4596,30 @@ Return Value:
 
 --*/
 
+VOID
+IopPathLink (
+    PPATH_ENTRY Entry
+    );
+
+/*++
+
+Routine Description:
+
+    This routine links the given path entry into its parent's list of
+    children. This assumes the caller holds the parent path entry's file
+    object lock exclusively.
+
+Arguments:
+
+    Entry - Supplies a pointer to the path entry that is to be linked into the
+        path hierarchy. Its parent pointer must already be set.
+
+Return Value:
+
+    None.
+
+--*/
+
 VOID
 IopPathUnlink (
     PPATH_ENTRY Entry
@@ -4415,6 +4972,27 @@ Return Value:
 
 --*/
 
+VOID
+IopInitializeIrpCache (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes the cache of free IRPs.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
 KSTATUS
 IopSendStateChangeIrp (
     PDEVICE Device,
@@ -4508,7 +5086,8 @@ IopSendIoIrp (
 
 Routine Description:
 
-    This routine sends an I/O IRP.
+    This routine sends an I/O IRP. Requests to block devices are routed
+    through the device's I/O scheduler.
 
 Arguments:
 
@@ -4525,6 +5104,35 @@ Return Value:
 
 --*/
 
+KSTATUS
+IopIssueIoIrp (
+    PDEVICE Device,
+    IRP_MINOR_CODE MinorCodeNumber,
+    PIRP_READ_WRITE Request
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates an I/O IRP and sends it straight down the device's
+    driver stack, without going through the I/O scheduler.
+
+Arguments:
+
+    Device - Supplies a pointer to the device to send the IRP to.
+
+    MinorCodeNumber - Supplies the minor code number to send to the IRP.
+
+    Request - Supplies a pointer that on input contains the I/O request
+        parameters. On output, contains the completed request parameters.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 KSTATUS
 IopSendIoReadIrp (
     PDEVICE Device,
@@ -4861,3 +5469,194 @@ Return Value:
 
 --*/
 
+KSTATUS
+IopInitializeIoScheduler (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes support for block I/O scheduling.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+BOOL
+IopShouldScheduleIo (
+    PDEVICE Device,
+    PIRP_READ_WRITE Request
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not an I/O request should be queued
+    through the device's I/O scheduler rather than sent straight to the
+    device.
+
+Arguments:
+
+    Device - Supplies a pointer to the device the request is destined for.
+
+    Request - Supplies a pointer to the I/O request parameters.
+
+Return Value:
+
+    TRUE if the request should go through the I/O scheduler.
+
+    FALSE if the request should be sent directly to the device.
+
+--*/
+
+KSTATUS
+IopScheduleIo (
+    PDEVICE Device,
+    IRP_MINOR_CODE MinorCode,
+    PIRP_READ_WRITE Request
+    );
+
+/*++
+
+Routine Description:
+
+    This routine queues a block I/O request with the device's I/O scheduler
+    and waits for it to complete. The request may be merged with other
+    requests for adjacent blocks before it is sent to the device.
+
+Arguments:
+
+    Device - Supplies a pointer to the block device.
+
+    MinorCode - Supplies the minor code of the request, either read or write.
+
+    Request - Supplies a pointer that on input contains the I/O request
+        parameters. On output, contains the completed request parameters.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VOID
+IopDestroyIoScheduler (
+    PDEVICE Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine destroys the I/O scheduler for a device that is being
+    destroyed, if it has one.
+
+Arguments:
+
+    Device - Supplies a pointer to the device being destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+IopGetBlockQueueInformation (
+    PIO_BLOCK_QUEUE_INFORMATION Information,
+    PUINTN BufferSize
+    );
+
+/*++
+
+Routine Description:
+
+    This routine collects the I/O scheduler queue information for every block
+    device that has had requests scheduled.
+
+Arguments:
+
+    Information - Supplies a pointer to an array that receives one element
+        per block device.
+
+    BufferSize - Supplies a pointer to the size of the array in bytes. Upon
+        return this either holds the number of bytes actually used or, if the
+        buffer is too small, the expected buffer size.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_BUFFER_TOO_SMALL if the array cannot hold every device.
+
+--*/
+
+KSTATUS
+IopGetDeviceIoStatistics (
+    PIO_DEVICE_STATISTICS Statistics,
+    PUINTN BufferSize
+    );
+
+/*++
+
+Routine Description:
+
+    This routine collects the I/O statistics for every block device that has
+    had requests scheduled.
+
+Arguments:
+
+    Statistics - Supplies a pointer to an array that receives one element per
+        block device.
+
+    BufferSize - Supplies a pointer to the size of the array in bytes. Upon
+        return this either holds the number of bytes actually used or, if the
+        buffer is too small, the expected buffer size.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_BUFFER_TOO_SMALL if the array cannot hold every device.
+
+--*/
+
+KSTATUS
+IopSetBlockQueueInformation (
+    PIO_BLOCK_QUEUE_INFORMATION Information,
+    UINTN Count
+    );
+
+/*++
+
+Routine Description:
+
+    This routine changes the scheduler type and queue depth of the given block
+    devices.
+
+Arguments:
+
+    Information - Supplies a pointer to an array of settings. Elements whose
+        scheduler type or queue depth are zero leave that setting alone.
+
+    Count - Supplies the number of elements in the array.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_FOUND if one of the devices has no I/O scheduler.
+
+    STATUS_INVALID_PARAMETER if a scheduler type is not valid.
+
+--*/
+
@@ -0,0 +1,2750 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ioring.c
+
+Abstract:
+
+    This module implements I/O rings, which allow user mode to submit batches
+    of asynchronous I/O requests through a submission queue in shared memory
+    and reap their results from a completion queue in the same memory.
+    Requests that can complete without blocking are completed inline by the
+    submitting thread. Everything else is handed to a small pool of kernel
+    worker threads owned by the ring.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define IO_RING_ALLOCATION_TAG 0x6E695249 // 'niRI'
+
+//
+// Define the maximum number of worker threads a single ring will create.
+//
+
+#define IO_RING_MAX_WORKERS 16
+
+//
+// Define the amount of time a worker waits on a blocked request before
+// checking whether or not the ring is being closed.
+//
+
+#define IO_RING_WORKER_WAIT_INTERVAL 1000
+
+//
+// Define the amount of time an idle worker waits for new work before exiting.
+//
+
+#define IO_RING_WORKER_IDLE_TIMEOUT 10000
+
+//
+// Define the number of outstanding requests, as a multiple of the completion
+// queue size, beyond which submission stops. This bounds the number of
+// completions that can pile up on the overflow list.
+//
+
+#define IO_RING_PENDING_MULTIPLIER 2
+
+//
+// Define the object types whose I/O can be attempted without blocking and
+// whose readiness can be waited on through their I/O object state.
+//
+
+#define IO_RING_IS_POLLABLE_TYPE(_Type)   \
+    (((_Type) == IoObjectPipe) ||         \
+     ((_Type) == IoObjectSocket) ||       \
+     ((_Type) == IoObjectTerminalMaster) || \
+     ((_Type) == IoObjectTerminalSlave))
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines an I/O ring. It is allocated from paged pool, as
+    it is only ever touched at low level.
+
+Members:
+
+    ReferenceCount - Stores the reference count on the ring. The file object
+        holds one reference, each worker thread holds one, and each
+        outstanding request holds one.
+
+    SubmitLock - Stores a pointer to the queued lock that serializes consumers
+        of the submission queue.
+
+    Lock - Stores a pointer to the queued lock that protects the completion
+        queue, the overflow list, the work list, and the worker counts.
+
+    UserBuffer - Stores a pointer to the I/O buffer describing the user mode
+        view of the shared memory.
+
+    LockedBuffer - Stores a pointer to the I/O buffer that keeps the shared
+        memory locked and mapped into kernel mode.
+
+    Header - Stores the kernel mode mapping of the shared ring header.
+
+    Submissions - Stores the kernel mode mapping of the submission queue.
+
+    Completions - Stores the kernel mode mapping of the completion queue.
+
+    SubmissionCount - Stores the trusted number of submission queue entries.
+
+    CompletionCount - Stores the trusted number of completion queue entries.
+
+    SubmissionHead - Stores the kernel's copy of the submission head. User
+        mode can scribble on the shared copy, so this is the one that counts.
+
+    CompletionTail - Stores the kernel's copy of the completion tail.
+
+    OverflowList - Stores the list of finished requests that did not fit in
+        the completion queue.
+
+    PendingCount - Stores the number of requests that have been consumed from
+        the submission queue but whose completion has not yet been posted.
+
+    WorkList - Stores the list of requests waiting for a worker.
+
+    QueuedCount - Stores the number of requests on the work list.
+
+    WorkEvent - Stores a pointer to the event workers wait on for new work.
+
+    CompletionEvent - Stores a pointer to the event signaled whenever a
+        completion is posted.
+
+    WorkerCount - Stores the number of worker threads alive.
+
+    IdleWorkerCount - Stores the number of worker threads waiting for work.
+
+    Closing - Stores a boolean indicating that the last handle to the ring has
+        been closed, and outstanding requests should be abandoned.
+
+    Process - Stores a pointer to the process that created the ring. Accepted
+        connections are added to this process's handle table.
+
+    IoState - Stores a pointer to the ring's I/O object state. This is
+        signaled for read when completions are available.
+
+--*/
+
+typedef struct _IO_RING {
+    volatile ULONG ReferenceCount;
+    PQUEUED_LOCK SubmitLock;
+    PQUEUED_LOCK Lock;
+    PIO_BUFFER UserBuffer;
+    PIO_BUFFER LockedBuffer;
+    PIO_RING_HEADER Header;
+    PIO_RING_SUBMISSION Submissions;
+    PIO_RING_COMPLETION Completions;
+    ULONG SubmissionCount;
+    ULONG CompletionCount;
+    ULONG SubmissionHead;
+    ULONG CompletionTail;
+    LIST_ENTRY OverflowList;
+    ULONG PendingCount;
+    LIST_ENTRY WorkList;
+    ULONG QueuedCount;
+    PKEVENT WorkEvent;
+    PKEVENT CompletionEvent;
+    ULONG WorkerCount;
+    ULONG IdleWorkerCount;
+    BOOL Closing;
+    PKPROCESS Process;
+    PIO_OBJECT_STATE IoState;
+} IO_RING, *PIO_RING;
+
+/*++
+
+Structure Description:
+
+    This structure defines a single buffer of an I/O ring request that has
+    been locked so that a worker thread outside the process can use it.
+
+Members:
+
+    UserBuffer - Stores a pointer to the I/O buffer describing the user mode
+        memory.
+
+    LockedBuffer - Stores a pointer to the I/O buffer that locks the user mode
+        memory in place.
+
+    Size - Stores the size of the buffer in bytes.
+
+--*/
+
+typedef struct _IO_RING_BUFFER {
+    PIO_BUFFER UserBuffer;
+    PIO_BUFFER LockedBuffer;
+    UINTN Size;
+} IO_RING_BUFFER, *PIO_RING_BUFFER;
+
+/*++
+
+Structure Description:
+
+    This structure defines an I/O ring request as it makes its way from the
+    submission queue to the completion queue.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous requests on the work
+        list or the overflow list.
+
+    Ring - Stores a pointer to the ring that owns the request.
+
+    Submission - Stores a stable copy of the submission queue entry.
+
+    IoHandle - Stores a pointer to the I/O handle the request operates on. A
+        reference is held.
+
+    Vector - Stores a kernel copy of the I/O vector array for vectored
+        operations.
+
+    Buffers - Stores an array of locked buffers, one per buffer or vector
+        element. This is only filled in for requests handed to a worker.
+
+    BufferCount - Stores the number of elements in the buffer array.
+
+    Address - Stores a kernel copy of the network address.
+
+    AddressValid - Stores a boolean indicating whether the address is valid.
+
+    Path - Stores a kernel copy of the remote path for connects.
+
+    PathSize - Stores the size of the remote path in bytes.
+
+    Result - Stores the result to post in the completion queue.
+
+--*/
+
+typedef struct _IO_RING_REQUEST {
+    LIST_ENTRY ListEntry;
+    PIO_RING Ring;
+    IO_RING_SUBMISSION Submission;
+    PIO_HANDLE IoHandle;
+    PIO_VECTOR Vector;
+    PIO_RING_BUFFER Buffers;
+    UINTN BufferCount;
+    NETWORK_ADDRESS Address;
+    BOOL AddressValid;
+    PSTR Path;
+    UINTN PathSize;
+    LONGLONG Result;
+} IO_RING_REQUEST, *PIO_RING_REQUEST;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+IopGetIoRingFromHandle (
+    HANDLE Handle,
+    PIO_HANDLE *IoHandle,
+    PIO_RING *IoRing
+    );
+
+KSTATUS
+IopAttachIoRingMemory (
+    PIO_RING Ring,
+    PSYSTEM_CALL_CREATE_IO_RING Parameters
+    );
+
+KSTATUS
+IopIoRingSubmit (
+    PIO_RING Ring,
+    ULONG SubmitCount,
+    PULONG Submitted
+    );
+
+VOID
+IopIoRingStartRequest (
+    PIO_RING_REQUEST Request
+    );
+
+KSTATUS
+IopIoRingCopyVector (
+    PIO_RING_REQUEST Request
+    );
+
+BOOL
+IopIoRingTryInline (
+    PIO_RING_REQUEST Request
+    );
+
+KSTATUS
+IopIoRingPrepareRequest (
+    PIO_RING_REQUEST Request
+    );
+
+KSTATUS
+IopIoRingLockBuffer (
+    PIO_RING_BUFFER Buffer,
+    PVOID UserAddress,
+    UINTN Size
+    );
+
+VOID
+IopIoRingQueueRequest (
+    PIO_RING_REQUEST Request
+    );
+
+VOID
+IopIoRingWorkerThread (
+    PVOID Parameter
+    );
+
+VOID
+IopIoRingPerformRequest (
+    PIO_RING_REQUEST Request
+    );
+
+KSTATUS
+IopIoRingPerformTransfer (
+    PIO_RING_REQUEST Request,
+    PIO_BUFFER IoBuffer,
+    UINTN Size,
+    IO_OFFSET Offset,
+    ULONG TimeoutInMilliseconds,
+    PUINTN BytesCompleted
+    );
+
+KSTATUS
+IopIoRingPerformAccept (
+    PIO_RING_REQUEST Request,
+    PHANDLE Handle
+    );
+
+KSTATUS
+IopIoRingWaitForHandle (
+    PIO_RING_REQUEST Request,
+    ULONG Events,
+    PULONG ReturnedEvents
+    );
+
+BOOL
+IopIsIoRingWouldBlockStatus (
+    KSTATUS Status
+    );
+
+ULONG
+IopGetIoRingRequestEvents (
+    PIO_RING_REQUEST Request
+    );
+
+VOID
+IopIoRingCompleteRequest (
+    PIO_RING_REQUEST Request,
+    LONGLONG Result
+    );
+
+BOOL
+IopIoRingPostCompletion (
+    PIO_RING Ring,
+    ULONGLONG UserData,
+    LONGLONG Result
+    );
+
+VOID
+IopIoRingFlushOverflow (
+    PIO_RING Ring
+    );
+
+ULONG
+IopIoRingGetCompletionsReady (
+    PIO_RING Ring
+    );
+
+VOID
+IopIoRingReleaseRequestResources (
+    PIO_RING_REQUEST Request
+    );
+
+VOID
+IopIoRingAddReference (
+    PIO_RING Ring
+    );
+
+VOID
+IopDestroyIoRingRequest (
+    PIO_RING_REQUEST Request
+    );
+
+VOID
+IopDestroyIoRing (
+    PIO_RING Ring
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INTN
+IoSysCreateIoRing (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for creating a new I/O ring from
+    memory shared with user mode.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+{
+
+    CREATE_PARAMETERS Create;
+    ULONG HandleFlags;
+    PIO_HANDLE IoHandle;
+    PSYSTEM_CALL_CREATE_IO_RING Parameters;
+    PKPROCESS Process;
+    PIO_RING Ring;
+    KSTATUS Status;
+
+    Parameters = (PSYSTEM_CALL_CREATE_IO_RING)SystemCallParameter;
+    Parameters->Handle = INVALID_HANDLE;
+    Process = PsGetCurrentProcess();
+
+    ASSERT(Process != PsGetKernelProcess());
+
+    IoHandle = NULL;
+    if ((Parameters->OpenFlags & ~SYS_OPEN_FLAG_CLOSE_ON_EXECUTE) != 0) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto SysCreateIoRingEnd;
+    }
+
+    HandleFlags = 0;
+    if ((Parameters->OpenFlags & SYS_OPEN_FLAG_CLOSE_ON_EXECUTE) != 0) {
+        HandleFlags |= FILE_DESCRIPTOR_CLOSE_ON_EXECUTE;
+    }
+
+    Create.Type = IoObjectIoRing;
+    Create.Context = NULL;
+    Create.Permissions = FILE_PERMISSION_USER_READ | FILE_PERMISSION_USER_WRITE;
+    Create.Created = FALSE;
+    Status = IopOpen(FALSE,
+                     NULL,
+                     NULL,
+                     0,
+                     IO_ACCESS_READ,
+                     OPEN_FLAG_CREATE,
+                     &Create,
+                     &IoHandle);
+
+    if (!KSUCCESS(Status)) {
+        goto SysCreateIoRingEnd;
+    }
+
+    Ring = IoHandle->FileObject->SpecialIo;
+    Status = IopAttachIoRingMemory(Ring, Parameters);
+    if (!KSUCCESS(Status)) {
+        goto SysCreateIoRingEnd;
+    }
+
+    Status = ObCreateHandle(Process->HandleTable,
+                            IoHandle,
+                            HandleFlags,
+                            &(Parameters->Handle));
+
+SysCreateIoRingEnd:
+    if (!KSUCCESS(Status)) {
+        if (IoHandle != NULL) {
+            IoIoHandleReleaseReference(IoHandle);
+        }
+
+        Parameters->Handle = INVALID_HANDLE;
+    }
+
+    return Status;
+}
+
+INTN
+IoSysIoRingEnter (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for submitting requests from an
+    I/O ring's submission queue and waiting for completions.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or the number of requests submitted (a positive integer) on
+    success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
+{
+
+    ULONG Available;
+    ULONGLONG ElapsedTimeInMilliseconds;
+    ULONGLONG Frequency;
+    PSYSTEM_CALL_IO_RING_ENTER Parameters;
+    INTN Result;
+    PIO_RING Ring;
+    PIO_HANDLE RingHandle;
+    ULONGLONG StartTime;
+    KSTATUS Status;
+    ULONG Submitted;
+    ULONG Timeout;
+    ULONG WaitCount;
+
+    Parameters = (PSYSTEM_CALL_IO_RING_ENTER)SystemCallParameter;
+    Submitted = 0;
+    Status = IopGetIoRingFromHandle(Parameters->Ring, &RingHandle, &Ring);
+    if (!KSUCCESS(Status)) {
+        goto SysIoRingEnterEnd;
+    }
+
+    if (Ring->Header == NULL) {
+        Status = STATUS_NOT_READY;
+        goto SysIoRingEnterEnd;
+    }
+
+    //
+    // Consume the requested submissions. Only fail outright if nothing could
+    // be submitted at all.
+    //
+
+    if (Parameters->SubmitCount != 0) {
+        Status = IopIoRingSubmit(Ring, Parameters->SubmitCount, &Submitted);
+        if ((!KSUCCESS(Status)) && (Submitted == 0)) {
+            goto SysIoRingEnterEnd;
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+    WaitCount = Parameters->WaitCount;
+    if (WaitCount > Ring->CompletionCount) {
+        WaitCount = Ring->CompletionCount;
+    }
+
+    Timeout = Parameters->TimeoutInMilliseconds;
+    StartTime = 0;
+    if ((Timeout != 0) && (Timeout != WAIT_TIME_INDEFINITE)) {
+        StartTime = KeGetRecentTimeCounter();
+    }
+
+    //
+    // Wait for enough completions to show up. The completion event is
+    // unsignaled under the lock before the count is checked so that a
+    // completion posted in between is not missed.
+    //
+
+    while (TRUE) {
+        KeAcquireQueuedLock(Ring->Lock);
+        IopIoRingFlushOverflow(Ring);
+        Available = IopIoRingGetCompletionsReady(Ring);
+        if (Available == 0) {
+            IoSetIoObjectState(Ring->IoState, POLL_EVENT_IN, FALSE);
+        }
+
+        if ((Available >= WaitCount) || (Timeout == 0)) {
+            KeReleaseQueuedLock(Ring->Lock);
+            break;
+        }
+
+        KeSignalEvent(Ring->CompletionEvent, SignalOptionUnsignal);
+        KeReleaseQueuedLock(Ring->Lock);
+        Status = KeWaitForEvent(Ring->CompletionEvent, TRUE, Timeout);
+        if (Status == STATUS_TIMEOUT) {
+            Status = STATUS_SUCCESS;
+            break;
+        }
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        if (Timeout != WAIT_TIME_INDEFINITE) {
+            Frequency = HlQueryTimeCounterFrequency();
+            ElapsedTimeInMilliseconds = ((KeGetRecentTimeCounter() -
+                                          StartTime) *
+                                         MILLISECONDS_PER_SECOND) /
+                                        Frequency;
+
+            if (ElapsedTimeInMilliseconds <
+                Parameters->TimeoutInMilliseconds) {
+
+                Timeout = Parameters->TimeoutInMilliseconds -
+                          ElapsedTimeInMilliseconds;
+
+            } else {
+                Timeout = 0;
+            }
+        }
+    }
+
+    //
+    // An interrupted wait is only reported if nothing was submitted, as the
+    // caller needs to know how many submissions were consumed.
+    //
+
+    if ((Status == STATUS_INTERRUPTED) && (Submitted != 0)) {
+        Status = STATUS_SUCCESS;
+    }
+
+SysIoRingEnterEnd:
+    if (RingHandle != NULL) {
+        IoIoHandleReleaseReference(RingHandle);
+    }
+
+    Result = Status;
+    if (KSUCCESS(Result)) {
+        Result = Submitted;
+    }
+
+    return Result;
+}
+
+KSTATUS
+IopCreateIoRing (
+    PCREATE_PARAMETERS Create,
+    PFILE_OBJECT *FileObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new I/O ring. The shared memory is attached to the
+    ring afterwards by the creation system call.
+
+Arguments:
+
+    Create - Supplies a pointer to the creation parameters.
+
+    FileObject - Supplies a pointer where the new file object representing the
+        I/O ring will be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PFILE_OBJECT NewFileObject;
+    FILE_PROPERTIES Properties;
+    PIO_RING Ring;
+    KSTATUS Status;
+    PKTHREAD Thread;
+
+    ASSERT(*FileObject == NULL);
+
+    Create->Created = FALSE;
+    NewFileObject = NULL;
+    Ring = MmAllocatePagedPool(sizeof(IO_RING), IO_RING_ALLOCATION_TAG);
+    if (Ring == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateIoRingEnd;
+    }
+
+    RtlZeroMemory(Ring, sizeof(IO_RING));
+    Ring->ReferenceCount = 1;
+    INITIALIZE_LIST_HEAD(&(Ring->OverflowList));
+    INITIALIZE_LIST_HEAD(&(Ring->WorkList));
+    Ring->SubmitLock = KeCreateQueuedLock();
+    Ring->Lock = KeCreateQueuedLock();
+    Ring->WorkEvent = KeCreateEvent(NULL);
+    Ring->CompletionEvent = KeCreateEvent(NULL);
+    Ring->IoState = IoCreateIoObjectState(FALSE, FALSE);
+    if ((Ring->SubmitLock == NULL) ||
+        (Ring->Lock == NULL) ||
+        (Ring->WorkEvent == NULL) ||
+        (Ring->CompletionEvent == NULL) ||
+        (Ring->IoState == NULL)) {
+
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateIoRingEnd;
+    }
+
+    Ring->Process = PsGetCurrentProcess();
+    ObAddReference(Ring->Process);
+    Thread = KeGetCurrentThread();
+    RtlZeroMemory(&Properties, sizeof(FILE_PROPERTIES));
+    Properties.DeviceId = OBJECT_MANAGER_DEVICE_ID;
+    Properties.FileId = (UINTN)Ring;
+    Properties.Type = IoObjectIoRing;
+    Properties.UserId = Thread->Identity.EffectiveUserId;
+    Properties.GroupId = Thread->Identity.EffectiveGroupId;
+    Properties.HardLinkCount = 1;
+    Properties.Permissions = Create->Permissions;
+    KeGetSystemTime(&(Properties.StatusChangeTime));
+    RtlCopyMemory(&(Properties.ModifiedTime),
+                  &(Properties.StatusChangeTime),
+                  sizeof(SYSTEM_TIME));
+
+    RtlCopyMemory(&(Properties.AccessTime),
+                  &(Properties.StatusChangeTime),
+                  sizeof(SYSTEM_TIME));
+
+    Status = IopCreateOrLookupFileObject(&Properties,
+                                         ObGetRootObject(),
+                                         FILE_OBJECT_FLAG_EXTERNAL_IO_STATE,
+                                         0,
+                                         &NewFileObject,
+                                         &(Create->Created));
+
+    if (!KSUCCESS(Status)) {
+        goto CreateIoRingEnd;
+    }
+
+    ASSERT(Create->Created != FALSE);
+    ASSERT((NewFileObject->IoState == NULL) &&
+           ((NewFileObject->Flags & FILE_OBJECT_FLAG_EXTERNAL_IO_STATE) != 0));
+
+    //
+    // The file object takes over the initial reference on the ring.
+    //
+
+    NewFileObject->IoState = Ring->IoState;
+    NewFileObject->SpecialIo = Ring;
+    *FileObject = NewFileObject;
+    Status = STATUS_SUCCESS;
+
+CreateIoRingEnd:
+
+    //
+    // On both success and failure, the file object's ready event needs to be
+    // signaled. Other threads may be waiting on the event.
+    //
+
+    if (NewFileObject != NULL) {
+        KeSignalEvent(NewFileObject->ReadyEvent, SignalOptionSignalAll);
+    }
+
+    if (!KSUCCESS(Status)) {
+        if (NewFileObject != NULL) {
+            IopFileObjectReleaseReference(NewFileObject);
+        }
+
+        if (Ring != NULL) {
+            IopDestroyIoRing(Ring);
+        }
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopCloseIoRing (
+    PIO_HANDLE IoHandle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when the last handle to an I/O ring is closed. It
+    stops the ring from accepting new work and tells its workers to give up
+    on blocked requests.
+
+Arguments:
+
+    IoHandle - Supplies a pointer to the I/O handle being closed.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    LIST_ENTRY OverflowList;
+    PIO_RING_REQUEST Request;
+    PIO_RING Ring;
+
+    Ring = IoHandle->FileObject->SpecialIo;
+
+    ASSERT(IoHandle->FileObject->Properties.Type == IoObjectIoRing);
+
+    //
+    // Nobody is left to reap completions that did not fit, so throw away the
+    // overflow list. Requests that finish from here on are discarded if the
+    // completion queue is full.
+    //
+
+    INITIALIZE_LIST_HEAD(&OverflowList);
+    KeAcquireQueuedLock(Ring->Lock);
+    Ring->Closing = TRUE;
+    if (!LIST_EMPTY(&(Ring->OverflowList))) {
+        MOVE_LIST(&(Ring->OverflowList), &OverflowList);
+        INITIALIZE_LIST_HEAD(&(Ring->OverflowList));
+    }
+
+    KeSignalEvent(Ring->WorkEvent, SignalOptionSignalAll);
+    KeReleaseQueuedLock(Ring->Lock);
+    while (!LIST_EMPTY(&OverflowList)) {
+        Request = LIST_VALUE(OverflowList.Next, IO_RING_REQUEST, ListEntry);
+        LIST_REMOVE(&(Request->ListEntry));
+        RtlAtomicAdd32(&(Ring->PendingCount), -1);
+        IopDestroyIoRingRequest(Request);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopIoRingReleaseReference (
+    PVOID IoRing
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a reference on an I/O ring, destroying it if this
+    was the last reference.
+
+Arguments:
+
+    IoRing - Supplies a pointer to the I/O ring.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+    PIO_RING Ring;
+
+    Ring = IoRing;
+    OldReferenceCount = RtlAtomicAdd32(&(Ring->ReferenceCount), -1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x10000000));
+
+    if (OldReferenceCount == 1) {
+        IopDestroyIoRing(Ring);
+    }
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+IopGetIoRingFromHandle (
+    HANDLE Handle,
+    PIO_HANDLE *IoHandle,
+    PIO_RING *IoRing
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up an I/O ring from a user mode handle.
+
+Arguments:
+
+    Handle - Supplies the user mode handle to the I/O ring.
+
+    IoHandle - Supplies a pointer where the I/O handle will be returned on
+        success. The caller is responsible for releasing the reference added
+        to it. NULL is returned on failure.
+
+    IoRing - Supplies a pointer where a pointer to the I/O ring will be
+        returned on success.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_HANDLE if the handle is not valid.
+
+    STATUS_INVALID_PARAMETER if the handle is not an I/O ring.
+
+--*/
+
+{
+
+    PIO_HANDLE LocalHandle;
+    PKPROCESS Process;
+
+    *IoHandle = NULL;
+    *IoRing = NULL;
+    Process = PsGetCurrentProcess();
+    LocalHandle = ObGetHandleValue(Process->HandleTable, Handle, NULL);
+    if (LocalHandle == NULL) {
+        return STATUS_INVALID_HANDLE;
+    }
+
+    if (LocalHandle->FileObject->Properties.Type != IoObjectIoRing) {
+        IoIoHandleReleaseReference(LocalHandle);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *IoHandle = LocalHandle;
+    *IoRing = LocalHandle->FileObject->SpecialIo;
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IopAttachIoRingMemory (
+    PIO_RING Ring,
+    PSYSTEM_CALL_CREATE_IO_RING Parameters
+    )
+
+/*++
+
+Routine Description:
+
+    This routine validates the user mode memory for an I/O ring, locks it in
+    place, maps it into kernel mode, and initializes the ring header.
+
+Arguments:
+
+    Ring - Supplies a pointer to the newly created ring.
+
+    Parameters - Supplies a pointer to the creation parameters.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PIO_RING_HEADER Header;
+    PIO_BUFFER LockedBuffer;
+    BOOL LockedCopy;
+    ULONG SubmissionOffset;
+    KSTATUS Status;
+
+    ASSERT(Ring->Header == NULL);
+
+    if ((Parameters->SubmissionCount == 0) ||
+        (Parameters->SubmissionCount > IO_RING_MAX_ENTRIES) ||
+        (!POWER_OF_2(Parameters->SubmissionCount)) ||
+        (Parameters->CompletionCount == 0) ||
+        (Parameters->CompletionCount > IO_RING_MAX_ENTRIES) ||
+        (!POWER_OF_2(Parameters->CompletionCount)) ||
+        (!IS_POINTER_ALIGNED(Parameters->Ring, MmPageSize())) ||
+        (Parameters->RingSize < IO_RING_SIZE(Parameters->SubmissionCount,
+                                             Parameters->CompletionCount))) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Status = MmCreateIoBuffer(Parameters->Ring,
+                              Parameters->RingSize,
+                              0,
+                              &(Ring->UserBuffer));
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    LockedBuffer = Ring->UserBuffer;
+    Status = MmValidateIoBuffer(0,
+                                MAX_ULONGLONG,
+                                0,
+                                Parameters->RingSize,
+                                FALSE,
+                                &LockedBuffer,
+                                &LockedCopy);
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Ring->LockedBuffer = LockedBuffer;
+    Status = MmMapIoBuffer(LockedBuffer, FALSE, FALSE, TRUE);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Header = LockedBuffer->Fragment[0].VirtualAddress;
+    SubmissionOffset = ALIGN_RANGE_UP(sizeof(IO_RING_HEADER),
+                                      IO_RING_QUEUE_ALIGNMENT);
+
+    RtlZeroMemory(Header, sizeof(IO_RING_HEADER));
+    Header->SubmissionCount = Parameters->SubmissionCount;
+    Header->CompletionCount = Parameters->CompletionCount;
+    Header->SubmissionOffset = SubmissionOffset;
+    Header->CompletionOffset = SubmissionOffset +
+                               (Parameters->SubmissionCount *
+                                sizeof(IO_RING_SUBMISSION));
+
+    Ring->SubmissionCount = Parameters->SubmissionCount;
+    Ring->CompletionCount = Parameters->CompletionCount;
+    Ring->Submissions = (PVOID)Header + Header->SubmissionOffset;
+    Ring->Completions = (PVOID)Header + Header->CompletionOffset;
+    Ring->Header = Header;
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IopIoRingSubmit (
+    PIO_RING Ring,
+    ULONG SubmitCount,
+    PULONG Submitted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine consumes entries from the submission queue and starts each
+    one. Every consumed entry eventually produces exactly one completion.
+
+Arguments:
+
+    Ring - Supplies a pointer to the I/O ring.
+
+    SubmitCount - Supplies the maximum number of entries to consume.
+
+    Submitted - Supplies a pointer where the number of submission queue
+        entries consumed is returned. This is valid even on failure.
+
+Return Value:
+
+    STATUS_SUCCESS if every requested entry that was available was consumed.
+
+    STATUS_TRY_AGAIN if too many requests are outstanding.
+
+    STATUS_DATA_LENGTH_MISMATCH if the submission queue indices are corrupt.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+--*/
+
+{
+
+    ULONG Available;
+    ULONG Head;
+    ULONG Index;
+    ULONG PendingLimit;
+    PIO_RING_REQUEST Request;
+    KSTATUS Status;
+    ULONG Tail;
+
+    Status = STATUS_SUCCESS;
+    *Submitted = 0;
+    PendingLimit = Ring->CompletionCount * IO_RING_PENDING_MULTIPLIER;
+    KeAcquireQueuedLock(Ring->SubmitLock);
+    Head = Ring->SubmissionHead;
+    Tail = Ring->Header->SubmissionTail;
+    RtlMemoryBarrier();
+    Available = Tail - Head;
+    if (Available > Ring->SubmissionCount) {
+        Status = STATUS_DATA_LENGTH_MISMATCH;
+        goto IoRingSubmitEnd;
+    }
+
+    if (Available > SubmitCount) {
+        Available = SubmitCount;
+    }
+
+    while (*Submitted < Available) {
+
+        //
+        // Stop if too many requests are already outstanding. User mode needs
+        // to reap some completions first.
+        //
+
+        if (Ring->PendingCount >= PendingLimit) {
+            Status = STATUS_TRY_AGAIN;
+            break;
+        }
+
+        //
+        // Allocate the request before consuming the entry so that running
+        // out of memory leaves the entry in the queue rather than losing it.
+        //
+
+        Request = MmAllocatePagedPool(sizeof(IO_RING_REQUEST),
+                                      IO_RING_ALLOCATION_TAG);
+
+        if (Request == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        RtlZeroMemory(Request, sizeof(IO_RING_REQUEST));
+        Index = Head & (Ring->SubmissionCount - 1);
+        RtlCopyMemory(&(Request->Submission),
+                      &(Ring->Submissions[Index]),
+                      sizeof(IO_RING_SUBMISSION));
+
+        Head += 1;
+        Ring->SubmissionHead = Head;
+        Ring->Header->SubmissionHead = Head;
+        Request->Ring = Ring;
+        IopIoRingAddReference(Ring);
+        RtlAtomicAdd32(&(Ring->PendingCount), 1);
+        IopIoRingStartRequest(Request);
+        *Submitted += 1;
+    }
+
+IoRingSubmitEnd:
+    KeReleaseQueuedLock(Ring->SubmitLock);
+    return Status;
+}
+
+VOID
+IopIoRingStartRequest (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts a freshly consumed request. It is completed inline if
+    possible, or otherwise prepared and handed to a worker. This routine is
+    called in the context of the process that owns the ring.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PKPROCESS Process;
+    KSTATUS Status;
+    PIO_RING_SUBMISSION Submission;
+
+    Submission = &(Request->Submission);
+    if ((Submission->Operation >= IoRingOperationCount) ||
+        ((Submission->Flags & ~IO_RING_SUBMISSION_FLAG_MASK) != 0)) {
+
+        Status = STATUS_INVALID_PARAMETER;
+        goto IoRingStartRequestEnd;
+    }
+
+    if (Submission->Operation == IoRingOperationNop) {
+        IopIoRingCompleteRequest(Request, STATUS_SUCCESS);
+        return;
+    }
+
+    Process = PsGetCurrentProcess();
+    Request->IoHandle = ObGetHandleValue(Process->HandleTable,
+                                         Submission->Handle,
+                                         NULL);
+
+    if (Request->IoHandle == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto IoRingStartRequestEnd;
+    }
+
+    if ((Submission->Operation == IoRingOperationReadVector) ||
+        (Submission->Operation == IoRingOperationWriteVector)) {
+
+        Status = IopIoRingCopyVector(Request);
+        if (!KSUCCESS(Status)) {
+            goto IoRingStartRequestEnd;
+        }
+    }
+
+    if (((Submission->Flags & IO_RING_SUBMISSION_FLAG_ASYNC) == 0) &&
+        (IopIoRingTryInline(Request) != FALSE)) {
+
+        return;
+    }
+
+    //
+    // The request is going to a worker, which runs outside the process.
+    // Lock down the buffers and copy everything else it needs.
+    //
+
+    Status = IopIoRingPrepareRequest(Request);
+    if (!KSUCCESS(Status)) {
+        goto IoRingStartRequestEnd;
+    }
+
+    IopIoRingQueueRequest(Request);
+    return;
+
+IoRingStartRequestEnd:
+    IopIoRingCompleteRequest(Request, Status);
+    return;
+}
+
+KSTATUS
+IopIoRingCopyVector (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies a vectored request's I/O vector array from user mode.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    UINTN Count;
+    KSTATUS Status;
+
+    Count = Request->Submission.Length;
+    if ((Count == 0) || (Count > MAX_IO_VECTOR_COUNT)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    AllocationSize = Count * sizeof(IO_VECTOR);
+    Request->Vector = MmAllocatePagedPool(AllocationSize,
+                                          IO_RING_ALLOCATION_TAG);
+
+    if (Request->Vector == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Status = MmCopyFromUserMode(Request->Vector,
+                                Request->Submission.Buffer,
+                                AllocationSize);
+
+    return Status;
+}
+
+BOOL
+IopIoRingTryInline (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to complete a request without blocking, directly
+    against the user mode buffers. This routine is called in the context of
+    the process that owns the ring.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+Return Value:
+
+    TRUE if the request was completed.
+
+    FALSE if the request would block and needs to go to a worker.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    PIO_BUFFER IoBuffer;
+    PIO_OBJECT_STATE IoState;
+    IO_BUFFER LocalBuffer;
+    LONGLONG Result;
+    ULONG ReturnedEvents;
+    KSTATUS Status;
+    PIO_RING_SUBMISSION Submission;
+    IO_OBJECT_TYPE Type;
+    UINTN VectorIndex;
+    UINTN VectorSize;
+
+    BytesCompleted = 0;
+    Submission = &(Request->Submission);
+    IoState = Request->IoHandle->FileObject->IoState;
+    Type = Request->IoHandle->FileObject->Properties.Type;
+    if (Submission->Operation == IoRingOperationPoll) {
+        if (IoState == NULL) {
+            ReturnedEvents = POLL_NONMASKABLE_FILE_EVENTS &
+                             Submission->OperationFlags;
+
+        } else {
+            ReturnedEvents = IoState->Events &
+                             (Submission->OperationFlags |
+                              POLL_NONMASKABLE_EVENTS);
+        }
+
+        if (ReturnedEvents == 0) {
+            return FALSE;
+        }
+
+        IopIoRingCompleteRequest(Request, ReturnedEvents);
+        return TRUE;
+    }
+
+    //
+    // Only objects with readiness state can be tried without blocking. File
+    // and device I/O, flushes, accepts, and connects always go to a worker.
+    //
+
+    if (!IO_RING_IS_POLLABLE_TYPE(Type)) {
+        return FALSE;
+    }
+
+    IoBuffer = NULL;
+    switch (Submission->Operation) {
+    case IoRingOperationRead:
+    case IoRingOperationWrite:
+    case IoRingOperationSend:
+    case IoRingOperationReceive:
+        Status = MmInitializeIoBuffer(&LocalBuffer,
+                                      Submission->Buffer,
+                                      INVALID_PHYSICAL_ADDRESS,
+                                      Submission->Length,
+                                      0);
+
+        if (!KSUCCESS(Status)) {
+            goto IoRingTryInlineEnd;
+        }
+
+        IoBuffer = &LocalBuffer;
+        VectorSize = Submission->Length;
+        break;
+
+    case IoRingOperationReadVector:
+    case IoRingOperationWriteVector:
+        VectorSize = 0;
+        for (VectorIndex = 0;
+             VectorIndex < Submission->Length;
+             VectorIndex += 1) {
+
+            VectorSize += Request->Vector[VectorIndex].Length;
+        }
+
+        Status = MmCreateIoBufferFromVector(Request->Vector,
+                                            TRUE,
+                                            Submission->Length,
+                                            &IoBuffer);
+
+        if (!KSUCCESS(Status)) {
+            goto IoRingTryInlineEnd;
+        }
+
+        break;
+
+    default:
+        return FALSE;
+    }
+
+    Status = IopIoRingPerformTransfer(Request,
+                                      IoBuffer,
+                                      VectorSize,
+                                      Submission->Offset,
+                                      0,
+                                      &BytesCompleted);
+
+    if ((IoBuffer != NULL) && (IoBuffer != &LocalBuffer)) {
+        MmFreeIoBuffer(IoBuffer);
+    }
+
+    if ((BytesCompleted == 0) && (IopIsIoRingWouldBlockStatus(Status))) {
+        return FALSE;
+    }
+
+IoRingTryInlineEnd:
+    Result = Status;
+    if (BytesCompleted != 0) {
+        Result = BytesCompleted;
+    }
+
+    IopIoRingCompleteRequest(Request, Result);
+    return TRUE;
+}
+
+KSTATUS
+IopIoRingPrepareRequest (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prepares a request to be run by a worker thread, which runs
+    outside the address space of the process. Buffers are locked in memory
+    and addresses and paths are copied into kernel mode. This routine is
+    called in the context of the process that owns the ring.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    UINTN Count;
+    UINTN Index;
+    KSTATUS Status;
+    PIO_RING_SUBMISSION Submission;
+
+    Submission = &(Request->Submission);
+    Count = 0;
+    switch (Submission->Operation) {
+    case IoRingOperationRead:
+    case IoRingOperationWrite:
+    case IoRingOperationSend:
+    case IoRingOperationReceive:
+        Count = 1;
+        break;
+
+    case IoRingOperationReadVector:
+    case IoRingOperationWriteVector:
+        Count = Submission->Length;
+        break;
+
+    case IoRingOperationConnect:
+        if (Submission->Length != 0) {
+            Status = MmCreateCopyOfUserModeString(Submission->Buffer,
+                                                  Submission->Length,
+                                                  IO_RING_ALLOCATION_TAG,
+                                                  &(Request->Path));
+
+            if (!KSUCCESS(Status)) {
+                return Status;
+            }
+
+            Request->PathSize = Submission->Length;
+        }
+
+        break;
+
+    default:
+        break;
+    }
+
+    if ((Submission->Address != NULL) &&
+        ((Submission->Operation == IoRingOperationConnect) ||
+         (Submission->Operation == IoRingOperationSend))) {
+
+        Status = MmCopyFromUserMode(&(Request->Address),
+                                    Submission->Address,
+                                    sizeof(NETWORK_ADDRESS));
+
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        Request->AddressValid = TRUE;
+    }
+
+    if (Count == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    AllocationSize = Count * sizeof(IO_RING_BUFFER);
+    Request->Buffers = MmAllocatePagedPool(AllocationSize,
+                                           IO_RING_ALLOCATION_TAG);
+
+    if (Request->Buffers == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Request->Buffers, AllocationSize);
+    Request->BufferCount = Count;
+    if (Request->Vector == NULL) {
+        return IopIoRingLockBuffer(&(Request->Buffers[0]),
+                                   Submission->Buffer,
+                                   Submission->Length);
+    }
+
+    for (Index = 0; Index < Count; Index += 1) {
+        Status = IopIoRingLockBuffer(&(Request->Buffers[Index]),
+                                     Request->Vector[Index].Data,
+                                     Request->Vector[Index].Length);
+
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IopIoRingLockBuffer (
+    PIO_RING_BUFFER Buffer,
+    PVOID UserAddress,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine locks a user mode buffer in memory so that it can be used
+    from outside the process.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the ring buffer structure to fill in.
+
+    UserAddress - Supplies the user mode address of the buffer.
+
+    Size - Supplies the size of the buffer in bytes.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PIO_BUFFER LockedBuffer;
+    BOOL LockedCopy;
+    KSTATUS Status;
+
+    Buffer->Size = Size;
+    if (Size == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    Status = MmCreateIoBuffer(UserAddress, Size, 0, &(Buffer->UserBuffer));
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    LockedBuffer = Buffer->UserBuffer;
+    Status = MmValidateIoBuffer(0,
+                                MAX_ULONGLONG,
+                                0,
+                                Size,
+                                FALSE,
+                                &LockedBuffer,
+                                &LockedCopy);
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Buffer->LockedBuffer = LockedBuffer;
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopIoRingQueueRequest (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands a prepared request to the ring's workers, creating a
+    new worker if every existing one is busy.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL CreateWorker;
+    LIST_ENTRY FailedList;
+    PIO_RING Ring;
+    KSTATUS Status;
+
+    Ring = Request->Ring;
+    CreateWorker = FALSE;
+    KeAcquireQueuedLock(Ring->Lock);
+    INSERT_BEFORE(&(Request->ListEntry), &(Ring->WorkList));
+    Ring->QueuedCount += 1;
+    if ((Ring->QueuedCount > Ring->IdleWorkerCount) &&
+        (Ring->WorkerCount < IO_RING_MAX_WORKERS)) {
+
+        Ring->WorkerCount += 1;
+        CreateWorker = TRUE;
+    }
+
+    KeSignalEvent(Ring->WorkEvent, SignalOptionSignalAll);
+    KeReleaseQueuedLock(Ring->Lock);
+    if (CreateWorker != FALSE) {
+        IopIoRingAddReference(Ring);
+        Status = PsCreateKernelThread(IopIoRingWorkerThread,
+                                      Ring,
+                                      "IoRingWorker");
+
+        //
+        // If the thread could not be created, the request stays queued for
+        // the existing workers. If there are none, fail the whole work list.
+        //
+
+        if (!KSUCCESS(Status)) {
+            INITIALIZE_LIST_HEAD(&FailedList);
+            KeAcquireQueuedLock(Ring->Lock);
+            Ring->WorkerCount -= 1;
+            if ((Ring->WorkerCount == 0) && (!LIST_EMPTY(&(Ring->WorkList)))) {
+                MOVE_LIST(&(Ring->WorkList), &FailedList);
+                INITIALIZE_LIST_HEAD(&(Ring->WorkList));
+                Ring->QueuedCount = 0;
+            }
+
+            KeReleaseQueuedLock(Ring->Lock);
+            while (!LIST_EMPTY(&FailedList)) {
+                Request = LIST_VALUE(FailedList.Next,
+                                     IO_RING_REQUEST,
+                                     ListEntry);
+
+                LIST_REMOVE(&(Request->ListEntry));
+                IopIoRingCompleteRequest(Request, Status);
+            }
+
+            IopIoRingReleaseReference(Ring);
+        }
+    }
+
+    return;
+}
+
+VOID
+IopIoRingWorkerThread (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements an I/O ring worker thread. It runs requests off
+    of the work list until the list stays empty for a while.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the I/O ring. The creator added a
+        reference on behalf of this thread.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_REQUEST Request;
+    PIO_RING Ring;
+    KSTATUS Status;
+
+    Ring = Parameter;
+    while (TRUE) {
+        KeAcquireQueuedLock(Ring->Lock);
+        if (LIST_EMPTY(&(Ring->WorkList))) {
+
+            //
+            // Exit if the ring is going away or nothing showed up for a
+            // while.
+            //
+
+            if (Ring->Closing != FALSE) {
+                Ring->WorkerCount -= 1;
+                KeReleaseQueuedLock(Ring->Lock);
+                break;
+            }
+
+            KeSignalEvent(Ring->WorkEvent, SignalOptionUnsignal);
+            Ring->IdleWorkerCount += 1;
+            KeReleaseQueuedLock(Ring->Lock);
+            Status = KeWaitForEvent(Ring->WorkEvent,
+                                    FALSE,
+                                    IO_RING_WORKER_IDLE_TIMEOUT);
+
+            KeAcquireQueuedLock(Ring->Lock);
+            Ring->IdleWorkerCount -= 1;
+            if ((Status == STATUS_TIMEOUT) &&
+                (LIST_EMPTY(&(Ring->WorkList)))) {
+
+                Ring->WorkerCount -= 1;
+                KeReleaseQueuedLock(Ring->Lock);
+                break;
+            }
+
+            KeReleaseQueuedLock(Ring->Lock);
+            continue;
+        }
+
+        Request = LIST_VALUE(Ring->WorkList.Next, IO_RING_REQUEST, ListEntry);
+        LIST_REMOVE(&(Request->ListEntry));
+        Ring->QueuedCount -= 1;
+        KeReleaseQueuedLock(Ring->Lock);
+        if (Ring->Closing != FALSE) {
+            IopIoRingCompleteRequest(Request, STATUS_OPERATION_CANCELLED);
+
+        } else {
+            IopIoRingPerformRequest(Request);
+        }
+    }
+
+    IopIoRingReleaseReference(Ring);
+    return;
+}
+
+VOID
+IopIoRingPerformRequest (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine runs a request to completion on a worker thread.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_BUFFER Buffer;
+    UINTN BufferIndex;
+    UINTN BytesCompleted;
+    ULONG FlushFlags;
+    HANDLE Handle;
+    IO_OFFSET Offset;
+    PNETWORK_ADDRESS RemoteAddress;
+    LONGLONG Result;
+    ULONG ReturnedEvents;
+    KSTATUS Status;
+    PIO_RING_SUBMISSION Submission;
+    UINTN TotalBytes;
+
+    Submission = &(Request->Submission);
+    TotalBytes = 0;
+    switch (Submission->Operation) {
+    case IoRingOperationRead:
+    case IoRingOperationWrite:
+    case IoRingOperationSend:
+    case IoRingOperationReceive:
+    case IoRingOperationReadVector:
+    case IoRingOperationWriteVector:
+
+        //
+        // Run vectored requests one element at a time, as each element was
+        // locked separately. Stop at the first short transfer.
+        //
+
+        Offset = Submission->Offset;
+        Status = STATUS_SUCCESS;
+        for (BufferIndex = 0;
+             BufferIndex < Request->BufferCount;
+             BufferIndex += 1) {
+
+            Buffer = &(Request->Buffers[BufferIndex]);
+            if (Buffer->Size == 0) {
+                continue;
+            }
+
+            BytesCompleted = 0;
+            Status = IopIoRingPerformTransfer(Request,
+                                              Buffer->LockedBuffer,
+                                              Buffer->Size,
+                                              Offset,
+                                              IO_RING_WORKER_WAIT_INTERVAL,
+                                              &BytesCompleted);
+
+            TotalBytes += BytesCompleted;
+            if (Offset != IO_OFFSET_NONE) {
+                Offset += BytesCompleted;
+            }
+
+            if ((!KSUCCESS(Status)) || (BytesCompleted != Buffer->Size)) {
+                break;
+            }
+        }
+
+        Result = Status;
+        if (TotalBytes != 0) {
+            Result = TotalBytes;
+        }
+
+        break;
+
+    case IoRingOperationFlush:
+        FlushFlags = 0;
+        if ((Submission->OperationFlags & SYS_FLUSH_FLAG_READ) != 0) {
+            FlushFlags |= FLUSH_FLAG_READ;
+        }
+
+        if ((Submission->OperationFlags & SYS_FLUSH_FLAG_WRITE) != 0) {
+            FlushFlags |= FLUSH_FLAG_WRITE;
+        }
+
+        if ((Submission->OperationFlags & SYS_FLUSH_FLAG_DISCARD) != 0) {
+            FlushFlags |= FLUSH_FLAG_DISCARD;
+        }
+
+        Result = IoFlush(Request->IoHandle, 0, -1, FlushFlags);
+        break;
+
+    case IoRingOperationPoll:
+        Status = IopIoRingWaitForHandle(Request,
+                                        Submission->OperationFlags,
+                                        &ReturnedEvents);
+
+        Result = Status;
+        if (KSUCCESS(Status)) {
+            Result = ReturnedEvents;
+        }
+
+        break;
+
+    case IoRingOperationAccept:
+        Status = IopIoRingPerformAccept(Request, &Handle);
+        Result = Status;
+        if (KSUCCESS(Status)) {
+            Result = (UINTN)Handle;
+        }
+
+        break;
+
+    case IoRingOperationConnect:
+        RemoteAddress = NULL;
+        if (Request->AddressValid != FALSE) {
+            RemoteAddress = &(Request->Address);
+        }
+
+        Result = IoSocketConnect(TRUE,
+                                 Request->IoHandle,
+                                 RemoteAddress,
+                                 Request->Path,
+                                 Request->PathSize);
+
+        break;
+
+    default:
+
+        ASSERT(FALSE);
+
+        Result = STATUS_INVALID_PARAMETER;
+        break;
+    }
+
+    IopIoRingCompleteRequest(Request, Result);
+    return;
+}
+
+KSTATUS
+IopIoRingPerformTransfer (
+    PIO_RING_REQUEST Request,
+    PIO_BUFFER IoBuffer,
+    UINTN Size,
+    IO_OFFSET Offset,
+    ULONG TimeoutInMilliseconds,
+    PUINTN BytesCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a single read, write, send, or receive for a
+    request. With a zero timeout, this routine makes one attempt. Otherwise
+    it keeps trying, waiting on the object's state in between, until some
+    data moves, the request fails, or the ring is closed.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+    IoBuffer - Supplies a pointer to the I/O buffer to transfer to or from.
+
+    Size - Supplies the number of bytes to transfer.
+
+    Offset - Supplies the file offset to transfer at, or IO_OFFSET_NONE.
+
+    TimeoutInMilliseconds - Supplies zero to make a single non-blocking
+        attempt, or the interval to wait between checks for ring closure.
+
+    BytesCompleted - Supplies a pointer where the number of bytes transferred
+        is returned.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    BOOL FromKernelMode;
+    PIO_OBJECT_STATE IoState;
+    SOCKET_IO_PARAMETERS Parameters;
+    KSTATUS Status;
+    PIO_RING_SUBMISSION Submission;
+    ULONG Timeout;
+    IO_OBJECT_TYPE Type;
+
+    Submission = &(Request->Submission);
+    IoState = Request->IoHandle->FileObject->IoState;
+    Type = Request->IoHandle->FileObject->Properties.Type;
+
+    //
+    // A non-zero timeout means this is a worker, which runs outside the
+    // process and uses locked buffers and kernel copies of addresses.
+    // Objects with readiness state are always tried without blocking, and
+    // waited on separately so that closing the ring can interrupt the wait.
+    //
+
+    FromKernelMode = (TimeoutInMilliseconds != 0);
+    Timeout = WAIT_TIME_INDEFINITE;
+    if ((IoState != NULL) && (IO_RING_IS_POLLABLE_TYPE(Type))) {
+        Timeout = 0;
+    }
+
+    while (TRUE) {
+        *BytesCompleted = 0;
+        switch (Submission->Operation) {
+        case IoRingOperationRead:
+        case IoRingOperationReadVector:
+            Status = IoReadAtOffset(Request->IoHandle,
+                                    IoBuffer,
+                                    Offset,
+                                    Size,
+                                    0,
+                                    Timeout,
+                                    BytesCompleted,
+                                    NULL);
+
+            break;
+
+        case IoRingOperationWrite:
+        case IoRingOperationWriteVector:
+            Status = IoWriteAtOffset(Request->IoHandle,
+                                     IoBuffer,
+                                     Offset,
+                                     Size,
+                                     0,
+                                     Timeout,
+                                     BytesCompleted,
+                                     NULL);
+
+            if (Status == STATUS_BROKEN_PIPE) {
+                PsSignalProcess(Request->Ring->Process,
+                                SIGNAL_BROKEN_PIPE,
+                                NULL);
+            }
+
+            break;
+
+        case IoRingOperationSend:
+        case IoRingOperationReceive:
+            RtlZeroMemory(&Parameters, sizeof(SOCKET_IO_PARAMETERS));
+            Parameters.Size = Size;
+            Parameters.SocketIoFlags = Submission->OperationFlags;
+            Parameters.TimeoutInMilliseconds = Timeout;
+            if (Submission->Operation == IoRingOperationSend) {
+                Parameters.IoFlags = SYS_IO_FLAG_WRITE;
+                if (FromKernelMode == FALSE) {
+                    Parameters.NetworkAddress = Submission->Address;
+
+                } else if (Request->AddressValid != FALSE) {
+                    Parameters.NetworkAddress = &(Request->Address);
+                }
+
+                Status = IoSocketSendData(FromKernelMode,
+                                          Request->IoHandle,
+                                          &Parameters,
+                                          IoBuffer);
+
+                if ((Status == STATUS_BROKEN_PIPE) &&
+                    ((Parameters.SocketIoFlags & SOCKET_IO_NO_SIGNAL) == 0)) {
+
+                    PsSignalProcess(Request->Ring->Process,
+                                    SIGNAL_BROKEN_PIPE,
+                                    NULL);
+                }
+
+            } else {
+                Status = IoSocketReceiveData(FromKernelMode,
+                                             Request->IoHandle,
+                                             &Parameters,
+                                             IoBuffer);
+            }
+
+            *BytesCompleted = Parameters.BytesCompleted;
+            break;
+
+        default:
+
+            ASSERT(FALSE);
+
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        if ((TimeoutInMilliseconds == 0) ||
+            (*BytesCompleted != 0) ||
+            (!IopIsIoRingWouldBlockStatus(Status))) {
+
+            break;
+        }
+
+        //
+        // Wait for the object to become ready and try again.
+        //
+
+        Status = IopIoRingWaitForHandle(Request,
+                                        IopGetIoRingRequestEvents(Request),
+                                        NULL);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopIoRingPerformAccept (
+    PIO_RING_REQUEST Request,
+    PHANDLE Handle
+    )
+
+/*++
+
+Routine Description:
+
+    This routine accepts a new connection on behalf of a request, and adds
+    the new socket to the owning process's handle table.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+    Handle - Supplies a pointer where the new user mode handle is returned on
+        success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG HandleFlags;
+    PIO_HANDLE NewHandle;
+    PCSTR RemotePath;
+    UINTN RemotePathSize;
+    PIO_RING Ring;
+    KSTATUS Status;
+
+    NewHandle = NULL;
+    Ring = Request->Ring;
+    Status = IopIoRingWaitForHandle(Request, POLL_EVENT_IN, NULL);
+    if (!KSUCCESS(Status)) {
+        goto IoRingPerformAcceptEnd;
+    }
+
+    Status = IoSocketAccept(Request->IoHandle,
+                            &NewHandle,
+                            &(Request->Address),
+                            &RemotePath,
+                            &RemotePathSize);
+
+    if (!KSUCCESS(Status)) {
+        goto IoRingPerformAcceptEnd;
+    }
+
+    if ((Request->Submission.OperationFlags & SYS_OPEN_FLAG_NON_BLOCKING) !=
+        0) {
+
+        NewHandle->OpenFlags |= OPEN_FLAG_NON_BLOCKING;
+    }
+
+    HandleFlags = 0;
+    if ((Request->Submission.OperationFlags &
+         SYS_OPEN_FLAG_CLOSE_ON_EXECUTE) != 0) {
+
+        HandleFlags |= FILE_DESCRIPTOR_CLOSE_ON_EXECUTE;
+    }
+
+    //
+    // The process may be tearing down its handle table. Closing the ring is
+    // part of that, so only add the handle while the ring is still open.
+    //
+
+    KeAcquireQueuedLock(Ring->Lock);
+    if (Ring->Closing != FALSE) {
+        Status = STATUS_OPERATION_CANCELLED;
+
+    } else {
+        Status = ObCreateHandle(Ring->Process->HandleTable,
+                                NewHandle,
+                                HandleFlags,
+                                Handle);
+    }
+
+    KeReleaseQueuedLock(Ring->Lock);
+    if (!KSUCCESS(Status)) {
+        goto IoRingPerformAcceptEnd;
+    }
+
+    NewHandle = NULL;
+
+IoRingPerformAcceptEnd:
+    if (NewHandle != NULL) {
+        IoIoHandleReleaseReference(NewHandle);
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopIoRingWaitForHandle (
+    PIO_RING_REQUEST Request,
+    ULONG Events,
+    PULONG ReturnedEvents
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits on a worker thread for a request's I/O handle to
+    signal one of the given events, giving up if the ring is closed.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+    Events - Supplies the mask of poll events to wait for.
+
+    ReturnedEvents - Supplies an optional pointer where the signaled events
+        are returned.
+
+Return Value:
+
+    STATUS_SUCCESS if one of the events was signaled.
+
+    STATUS_OPERATION_CANCELLED if the ring was closed.
+
+    Other error codes on failure.
+
+--*/
+
+{
+
+    PIO_OBJECT_STATE IoState;
+    ULONG LocalEvents;
+    KSTATUS Status;
+
+    IoState = Request->IoHandle->FileObject->IoState;
+    if (IoState == NULL) {
+        LocalEvents = POLL_NONMASKABLE_FILE_EVENTS & Events;
+        if (ReturnedEvents != NULL) {
+            *ReturnedEvents = LocalEvents;
+        }
+
+        return STATUS_SUCCESS;
+    }
+
+    while (TRUE) {
+        if (Request->Ring->Closing != FALSE) {
+            Status = STATUS_OPERATION_CANCELLED;
+            break;
+        }
+
+        LocalEvents = 0;
+        Status = IoWaitForIoObjectState(IoState,
+                                        Events,
+                                        FALSE,
+                                        IO_RING_WORKER_WAIT_INTERVAL,
+                                        &LocalEvents);
+
+        if (Status != STATUS_TIMEOUT) {
+            break;
+        }
+    }
+
+    if (ReturnedEvents != NULL) {
+        *ReturnedEvents = LocalEvents;
+    }
+
+    return Status;
+}
+
+BOOL
+IopIsIoRingWouldBlockStatus (
+    KSTATUS Status
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given status indicates that an
+    operation could not proceed without blocking.
+
+Arguments:
+
+    Status - Supplies the status returned by the operation.
+
+Return Value:
+
+    TRUE if the operation would have blocked.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    if ((Status == STATUS_TIMEOUT) ||
+        (Status == STATUS_OPERATION_WOULD_BLOCK) ||
+        (Status == STATUS_TRY_AGAIN)) {
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+ULONG
+IopGetIoRingRequestEvents (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the poll events a data request waits for before
+    retrying.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+Return Value:
+
+    Returns the mask of poll events.
+
+--*/
+
+{
+
+    switch (Request->Submission.Operation) {
+    case IoRingOperationWrite:
+    case IoRingOperationWriteVector:
+    case IoRingOperationSend:
+        return POLL_EVENT_OUT;
+
+    default:
+        break;
+    }
+
+    return POLL_EVENT_IN;
+}
+
+VOID
+IopIoRingCompleteRequest (
+    PIO_RING_REQUEST Request,
+    LONGLONG Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finishes a request, posting its result to the completion
+    queue or the overflow list, and waking anyone waiting for completions.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+    Result - Supplies the result to report.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING Ring;
+
+    Ring = Request->Ring;
+    IopIoRingReleaseRequestResources(Request);
+    Request->Result = Result;
+    KeAcquireQueuedLock(Ring->Lock);
+
+    //
+    // Preserve ordering: if anything is already on the overflow list, this
+    // request goes behind it.
+    //
+
+    IopIoRingFlushOverflow(Ring);
+    if ((LIST_EMPTY(&(Ring->OverflowList))) &&
+        (IopIoRingPostCompletion(Ring,
+                                 Request->Submission.UserData,
+                                 Result) != FALSE)) {
+
+        RtlAtomicAdd32(&(Ring->PendingCount), -1);
+
+    } else if (Ring->Closing != FALSE) {
+        RtlAtomicAdd32(&(Ring->PendingCount), -1);
+
+    } else {
+        INSERT_BEFORE(&(Request->ListEntry), &(Ring->OverflowList));
+        Request = NULL;
+    }
+
+    IoSetIoObjectState(Ring->IoState, POLL_EVENT_IN, TRUE);
+    KeSignalEvent(Ring->CompletionEvent, SignalOptionSignalAll);
+    KeReleaseQueuedLock(Ring->Lock);
+    if (Request != NULL) {
+        IopDestroyIoRingRequest(Request);
+    }
+
+    return;
+}
+
+BOOL
+IopIoRingPostCompletion (
+    PIO_RING Ring,
+    ULONGLONG UserData,
+    LONGLONG Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes an entry into the completion queue. This routine
+    assumes the ring lock is held.
+
+Arguments:
+
+    Ring - Supplies a pointer to the I/O ring.
+
+    UserData - Supplies the opaque value from the submission.
+
+    Result - Supplies the result of the request.
+
+Return Value:
+
+    TRUE if the entry was posted.
+
+    FALSE if the completion queue is full.
+
+--*/
+
+{
+
+    PIO_RING_COMPLETION Completion;
+    ULONG Tail;
+
+    ASSERT(KeIsQueuedLockHeld(Ring->Lock) != FALSE);
+
+    Tail = Ring->CompletionTail;
+    if ((Tail - Ring->Header->CompletionHead) >= Ring->CompletionCount) {
+        return FALSE;
+    }
+
+    Completion = &(Ring->Completions[Tail & (Ring->CompletionCount - 1)]);
+    Completion->UserData = UserData;
+    Completion->Result = Result;
+
+    //
+    // Make sure the entry is visible before the tail that publishes it.
+    //
+
+    RtlMemoryBarrier();
+    Tail += 1;
+    Ring->CompletionTail = Tail;
+    Ring->Header->CompletionTail = Tail;
+    return TRUE;
+}
+
+VOID
+IopIoRingFlushOverflow (
+    PIO_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves as many finished requests as will fit from the
+    overflow list into the completion queue. This routine assumes the ring
+    lock is held.
+
+Arguments:
+
+    Ring - Supplies a pointer to the I/O ring.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_REQUEST Request;
+
+    ASSERT(KeIsQueuedLockHeld(Ring->Lock) != FALSE);
+
+    while (!LIST_EMPTY(&(Ring->OverflowList))) {
+        Request = LIST_VALUE(Ring->OverflowList.Next,
+                             IO_RING_REQUEST,
+                             ListEntry);
+
+        if (IopIoRingPostCompletion(Ring,
+                                    Request->Submission.UserData,
+                                    Request->Result) == FALSE) {
+
+            break;
+        }
+
+        LIST_REMOVE(&(Request->ListEntry));
+        RtlAtomicAdd32(&(Ring->PendingCount), -1);
+
+        //
+        // The request's resources were already released. The caller holds
+        // its own reference on the ring, so dropping the request's reference
+        // cannot destroy the ring out from under the lock.
+        //
+
+        ASSERT(Ring->ReferenceCount > 1);
+
+        MmFreePagedPool(Request);
+        IopIoRingReleaseReference(Ring);
+    }
+
+    return;
+}
+
+ULONG
+IopIoRingGetCompletionsReady (
+    PIO_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the number of completions sitting in the completion
+    queue that user mode has not yet consumed. This routine assumes the ring
+    lock is held.
+
+Arguments:
+
+    Ring - Supplies a pointer to the I/O ring.
+
+Return Value:
+
+    Returns the number of completions available.
+
+--*/
+
+{
+
+    ULONG Available;
+
+    Available = Ring->CompletionTail - Ring->Header->CompletionHead;
+    if (Available > Ring->CompletionCount) {
+        Available = Ring->CompletionCount;
+    }
+
+    return Available;
+}
+
+VOID
+IopIoRingReleaseRequestResources (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases everything a request holds other than the request
+    structure and its reference on the ring.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_BUFFER Buffer;
+    UINTN Index;
+
+    if (Request->Buffers != NULL) {
+        for (Index = 0; Index < Request->BufferCount; Index += 1) {
+            Buffer = &(Request->Buffers[Index]);
+            if ((Buffer->LockedBuffer != NULL) &&
+                (Buffer->LockedBuffer != Buffer->UserBuffer)) {
+
+                MmFreeIoBuffer(Buffer->LockedBuffer);
+            }
+
+            if (Buffer->UserBuffer != NULL) {
+                MmFreeIoBuffer(Buffer->UserBuffer);
+            }
+        }
+
+        MmFreePagedPool(Request->Buffers);
+        Request->Buffers = NULL;
+        Request->BufferCount = 0;
+    }
+
+    if (Request->Vector != NULL) {
+        MmFreePagedPool(Request->Vector);
+        Request->Vector = NULL;
+    }
+
+    if (Request->Path != NULL) {
+        MmFreePagedPool(Request->Path);
+        Request->Path = NULL;
+    }
+
+    if (Request->IoHandle != NULL) {
+        IoIoHandleReleaseReference(Request->IoHandle);
+        Request->IoHandle = NULL;
+    }
+
+    return;
+}
+
+VOID
+IopIoRingAddReference (
+    PIO_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a reference to an I/O ring.
+
+Arguments:
+
+    Ring - Supplies a pointer to the I/O ring.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+
+    OldReferenceCount = RtlAtomicAdd32(&(Ring->ReferenceCount), 1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x10000000));
+
+    return;
+}
+
+VOID
+IopDestroyIoRingRequest (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys an I/O ring request and releases its reference on
+    the ring.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING Ring;
+
+    Ring = Request->Ring;
+    IopIoRingReleaseRequestResources(Request);
+    MmFreePagedPool(Request);
+    IopIoRingReleaseReference(Ring);
+    return;
+}
+
+VOID
+IopDestroyIoRing (
+    PIO_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys an I/O ring.
+
+Arguments:
+
+    Ring - Supplies a pointer to the I/O ring.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_REQUEST Request;
+
+    ASSERT(LIST_EMPTY(&(Ring->WorkList)));
+
+    //
+    // Completions still on the overflow list hold ring references, so it
+    // must be empty by the time the last reference goes away.
+    //
+
+    while (!LIST_EMPTY(&(Ring->OverflowList))) {
+        Request = LIST_VALUE(Ring->OverflowList.Next,
+                             IO_RING_REQUEST,
+                             ListEntry);
+
+        LIST_REMOVE(&(Request->ListEntry));
+        MmFreePagedPool(Request);
+    }
+
+    if (Ring->LockedBuffer != NULL) {
+        if (Ring->LockedBuffer != Ring->UserBuffer) {
+            MmFreeIoBuffer(Ring->LockedBuffer);
+        }
+    }
+
+    if (Ring->UserBuffer != NULL) {
+        MmFreeIoBuffer(Ring->UserBuffer);
+    }
+
+    if (Ring->Process != NULL) {
+        ObReleaseReference(Ring->Process);
+    }
+
+    if (Ring->IoState != NULL) {
+        IoDestroyIoObjectState(Ring->IoState, FALSE);
+    }
+
+    if (Ring->WorkEvent != NULL) {
+        KeDestroyEvent(Ring->WorkEvent);
+    }
+
+    if (Ring->CompletionEvent != NULL) {
+        KeDestroyEvent(Ring->CompletionEvent);
+    }
+
+    if (Ring->SubmitLock != NULL) {
+        KeDestroyQueuedLock(Ring->SubmitLock);
+    }
+
+    if (Ring->Lock != NULL) {
+        KeDestroyQueuedLock(Ring->Lock);
+    }
+
+    MmFreePagedPool(Ring);
+    return;
+}
+
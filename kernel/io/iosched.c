@@ -0,0 +1,1812 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    iosched.c
+
+Abstract:
+
+    This module implements the block I/O scheduler. Each block device gets a
+    queue that limits how many requests are outstanding at the device. While
+    the device is busy, new requests wait in the queue, where requests for
+    adjacent blocks are merged into a single IRP and a pluggable policy picks
+    which request goes next. The queue also keeps the device's I/O
+    statistics.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define IO_SCHEDULER_ALLOCATION_TAG 0x68637349 // 'hcsI'
+
+//
+// Define the default number of requests that may be outstanding at a device.
+//
+
+#define IO_SCHEDULER_DEFAULT_QUEUE_DEPTH 4
+
+//
+// Define the largest request that merging may build.
+//
+
+#define IO_SCHEDULER_MAX_MERGE_SIZE _128KB
+
+//
+// Define how long reads and writes may wait in the queue before the deadline
+// scheduler sends them ahead of everything else, in milliseconds.
+//
+
+#define IO_SCHEDULER_READ_EXPIRE 500
+#define IO_SCHEDULER_WRITE_EXPIRE 5000
+
+//
+// Define the number of times the deadline scheduler may pick a read over a
+// waiting write before it must send a write.
+//
+
+#define IO_SCHEDULER_WRITES_STARVED 2
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _IO_SCHEDULER_DIRECTION {
+    IoSchedulerRead,
+    IoSchedulerWrite,
+    IoSchedulerDirectionCount
+} IO_SCHEDULER_DIRECTION, *PIO_SCHEDULER_DIRECTION;
+
+typedef enum _IO_SCHEDULER_REQUEST_STATE {
+    IoSchedulerRequestInvalid,
+    IoSchedulerRequestQueued,
+    IoSchedulerRequestDispatched,
+    IoSchedulerRequestComplete
+} IO_SCHEDULER_REQUEST_STATE, *PIO_SCHEDULER_REQUEST_STATE;
+
+/*++
+
+Structure Description:
+
+    This structure defines a request waiting in an I/O scheduler queue. It
+    lives on the stack of the thread that submitted it. Requests that get
+    merged ride along in the member list of the request they were merged
+    into, which is called the leader. The leader's thread sends the IRP for
+    the whole group.
+
+Members:
+
+    SortListEntry - Stores pointers to the next and previous leaders in the
+        queue, sorted by offset.
+
+    FifoListEntry - Stores pointers to the next and previous leaders in the
+        queue, in arrival order.
+
+    MemberListEntry - Stores pointers to the next and previous requests in the
+        group, sorted by offset.
+
+    MemberListHead - Stores the head of the list of requests in the group,
+        including the leader itself. This is only used by leaders.
+
+    MemberCount - Stores the number of requests in the group.
+
+    Parameters - Stores a pointer to the submitter's I/O parameters.
+
+    MinorCode - Stores the IRP minor code of the request.
+
+    Direction - Stores whether this is a read or a write.
+
+    Offset - Stores the device offset of the whole group.
+
+    Size - Stores the size of the whole group, in bytes.
+
+    Sequence - Stores the order in which this leader was queued.
+
+    QueueTime - Stores the time counter value when the request was queued.
+
+    Deadline - Stores the time counter value after which the request should
+        be sent as soon as possible.
+
+    IoBuffer - Stores the locked I/O buffer for the request's data.
+
+    Event - Stores a pointer to the event signaled when the leader may send
+        the group, or when a merged request is done.
+
+    State - Stores the request state.
+
+    Status - Stores the completion status of a merged request.
+
+--*/
+
+typedef struct _IO_SCHEDULER_REQUEST {
+    LIST_ENTRY SortListEntry;
+    LIST_ENTRY FifoListEntry;
+    LIST_ENTRY MemberListEntry;
+    LIST_ENTRY MemberListHead;
+    ULONG MemberCount;
+    PIRP_READ_WRITE Parameters;
+    IRP_MINOR_CODE MinorCode;
+    IO_SCHEDULER_DIRECTION Direction;
+    IO_OFFSET Offset;
+    UINTN Size;
+    ULONGLONG Sequence;
+    ULONGLONG QueueTime;
+    ULONGLONG Deadline;
+    PIO_BUFFER IoBuffer;
+    PKEVENT Event;
+    volatile IO_SCHEDULER_REQUEST_STATE State;
+    KSTATUS Status;
+} IO_SCHEDULER_REQUEST, *PIO_SCHEDULER_REQUEST;
+
+/*++
+
+Structure Description:
+
+    This structure defines the I/O scheduler state of a block device.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous schedulers in the
+        global list.
+
+    DeviceId - Stores the ID of the device.
+
+    Lock - Stores a pointer to the lock protecting the queue.
+
+    Type - Stores the policy used to pick the next request.
+
+    QueueDepth - Stores the maximum number of requests outstanding at the
+        device.
+
+    QueuedCount - Stores the number of requests waiting in the queue.
+
+    InFlightCount - Stores the number of requests at the device.
+
+    SortList - Stores the heads of the lists of waiting reads and writes,
+        sorted by offset.
+
+    FifoList - Stores the heads of the lists of waiting reads and writes, in
+        arrival order.
+
+    Expire - Stores how long reads and writes may wait, in time counter ticks.
+
+    NextOffset - Stores the offset just beyond the last request sent, where
+        the elevator continues from.
+
+    NextSequence - Stores the sequence number to give the next leader.
+
+    WritesStarved - Stores the number of times a read has been picked while
+        writes were waiting.
+
+    ReadCount - Stores the total number of reads submitted.
+
+    WriteCount - Stores the total number of writes submitted.
+
+    DispatchCount - Stores the total number of IRPs sent to the device.
+
+    BackMergeCount - Stores the number of back merges.
+
+    FrontMergeCount - Stores the number of front merges.
+
+    ExpiredCount - Stores the number of groups sent because their deadline
+        passed.
+
+    TotalWait - Stores the total time requests have waited, in time counter
+        ticks.
+
+    MaxWait - Stores the longest time a request has waited, in time counter
+        ticks.
+
+    CompletedCount - Stores the total number of reads and writes completed.
+
+    BytesCompleted - Stores the total number of bytes read and written.
+
+    ServiceTime - Stores the total time completed requests spent at the
+        device, in time counter ticks.
+
+    BusyTime - Stores the total time the device has had requests in flight,
+        not counting the current busy period, in time counter ticks.
+
+    BusyStart - Stores the time counter value when the in-flight count last
+        went from zero to one.
+
+--*/
+
+struct _IO_SCHEDULER {
+    LIST_ENTRY ListEntry;
+    DEVICE_ID DeviceId;
+    PQUEUED_LOCK Lock;
+    IO_SCHEDULER_TYPE Type;
+    ULONG QueueDepth;
+    ULONG QueuedCount;
+    ULONG InFlightCount;
+    LIST_ENTRY SortList[IoSchedulerDirectionCount];
+    LIST_ENTRY FifoList[IoSchedulerDirectionCount];
+    ULONGLONG Expire[IoSchedulerDirectionCount];
+    IO_OFFSET NextOffset;
+    ULONGLONG NextSequence;
+    ULONG WritesStarved;
+    ULONGLONG ReadCount;
+    ULONGLONG WriteCount;
+    ULONGLONG DispatchCount;
+    ULONGLONG BackMergeCount;
+    ULONGLONG FrontMergeCount;
+    ULONGLONG ExpiredCount;
+    ULONGLONG TotalWait;
+    ULONGLONG MaxWait;
+    ULONGLONG CompletedCount[IoSchedulerDirectionCount];
+    ULONGLONG BytesCompleted[IoSchedulerDirectionCount];
+    ULONGLONG ServiceTime;
+    ULONGLONG BusyTime;
+    ULONGLONG BusyStart;
+};
+
+typedef
+PIO_SCHEDULER_REQUEST
+(*PIO_SCHEDULER_SELECT) (
+    PIO_SCHEDULER Scheduler,
+    ULONGLONG CurrentTime
+    );
+
+/*++
+
+Routine Description:
+
+    This routine picks the next group to send to the device. It does not
+    remove it from the queue. The scheduler lock is held.
+
+Arguments:
+
+    Scheduler - Supplies a pointer to the scheduler.
+
+    CurrentTime - Supplies the current time counter value.
+
+Return Value:
+
+    Returns a pointer to the leader of the group to send next.
+
+    NULL if the queue is empty.
+
+--*/
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+PIO_SCHEDULER
+IopGetIoScheduler (
+    PDEVICE Device
+    );
+
+BOOL
+IopMergeScheduledIo (
+    PIO_SCHEDULER Scheduler,
+    PIO_SCHEDULER_REQUEST Request
+    );
+
+VOID
+IopInsertScheduledIo (
+    PIO_SCHEDULER Scheduler,
+    PIO_SCHEDULER_REQUEST Request
+    );
+
+VOID
+IopRunIoScheduler (
+    PIO_SCHEDULER Scheduler
+    );
+
+KSTATUS
+IopIssueScheduledIo (
+    PDEVICE Device,
+    PIO_SCHEDULER_REQUEST Leader
+    );
+
+KSTATUS
+IopIssueSingleScheduledIo (
+    PDEVICE Device,
+    PIO_SCHEDULER_REQUEST Request
+    );
+
+VOID
+IopStartScheduledIo (
+    PIO_SCHEDULER Scheduler
+    );
+
+VOID
+IopCompleteScheduledIo (
+    PIO_SCHEDULER Scheduler,
+    PIO_SCHEDULER_REQUEST Leader,
+    IO_SCHEDULER_DIRECTION Direction,
+    UINTN BytesCompleted,
+    ULONGLONG ServiceTime
+    );
+
+PIO_SCHEDULER_REQUEST
+IopSelectNoopRequest (
+    PIO_SCHEDULER Scheduler,
+    ULONGLONG CurrentTime
+    );
+
+PIO_SCHEDULER_REQUEST
+IopSelectDeadlineRequest (
+    PIO_SCHEDULER Scheduler,
+    ULONGLONG CurrentTime
+    );
+
+ULONGLONG
+IopConvertTimeCounterToMicroseconds (
+    ULONGLONG Ticks
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store the list of I/O schedulers and the lock that protects it.
+//
+
+LIST_ENTRY IoSchedulerList;
+PQUEUED_LOCK IoSchedulerListLock;
+
+//
+// Store the scheduler policies, indexed by scheduler type.
+//
+
+PIO_SCHEDULER_SELECT IoSchedulerSelectRoutines[IoSchedulerTypeCount] = {
+    NULL,
+    IopSelectNoopRequest,
+    IopSelectDeadlineRequest
+};
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+IopInitializeIoScheduler (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes support for block I/O scheduling.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    INITIALIZE_LIST_HEAD(&IoSchedulerList);
+    IoSchedulerListLock = KeCreateQueuedLock();
+    if (IoSchedulerListLock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+BOOL
+IopShouldScheduleIo (
+    PDEVICE Device,
+    PIRP_READ_WRITE Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not an I/O request should be queued
+    through the device's I/O scheduler rather than sent straight to the
+    device.
+
+Arguments:
+
+    Device - Supplies a pointer to the device the request is destined for.
+
+    Request - Supplies a pointer to the I/O request parameters.
+
+Return Value:
+
+    TRUE if the request should go through the I/O scheduler.
+
+    FALSE if the request should be sent directly to the device.
+
+--*/
+
+{
+
+    //
+    // Only block devices themselves are scheduled. Volumes pass their I/O on
+    // to the block device below, where it gets scheduled. No-allocate I/O
+    // cannot wait in a queue that needs memory to drain it.
+    //
+
+    if ((Device->Header.Type != ObjectDevice) ||
+        (Request->FileProperties == NULL) ||
+        (Request->FileProperties->Type != IoObjectBlockDevice) ||
+        (Request->IoSizeInBytes == 0) ||
+        ((Request->IoFlags & IO_FLAG_NO_ALLOCATE) != 0) ||
+        (KeGetRunLevel() != RunLevelLow)) {
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+KSTATUS
+IopScheduleIo (
+    PDEVICE Device,
+    IRP_MINOR_CODE MinorCode,
+    PIRP_READ_WRITE Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues a block I/O request with the device's I/O scheduler
+    and waits for it to complete. The request may be merged with other
+    requests for adjacent blocks before it is sent to the device.
+
+Arguments:
+
+    Device - Supplies a pointer to the block device.
+
+    MinorCode - Supplies the minor code of the request, either read or write.
+
+    Request - Supplies a pointer that on input contains the I/O request
+        parameters. On output, contains the completed request parameters.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONGLONG CurrentTime;
+    IO_SCHEDULER_DIRECTION Direction;
+    BOOL LockedCopy;
+    PIO_BUFFER OriginalBuffer;
+    IO_SCHEDULER_REQUEST Queued;
+    PIO_SCHEDULER Scheduler;
+    ULONGLONG StartTime;
+    KSTATUS Status;
+    BOOL Wait;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Scheduler = IopGetIoScheduler(Device);
+    if (Scheduler == NULL) {
+        return IopIssueIoIrp(Device, MinorCode, Request);
+    }
+
+    Direction = IoSchedulerRead;
+    if (MinorCode == IrpMinorIoWrite) {
+        Direction = IoSchedulerWrite;
+    }
+
+    //
+    // If the device has room and nothing is waiting, there is nothing to
+    // merge with or reorder. Send the request straight down.
+    //
+
+    KeAcquireQueuedLock(Scheduler->Lock);
+    if (Direction == IoSchedulerWrite) {
+        Scheduler->WriteCount += 1;
+
+    } else {
+        Scheduler->ReadCount += 1;
+    }
+
+    if ((Scheduler->QueuedCount == 0) &&
+        (Scheduler->InFlightCount < Scheduler->QueueDepth)) {
+
+        IopStartScheduledIo(Scheduler);
+        KeReleaseQueuedLock(Scheduler->Lock);
+        StartTime = HlQueryTimeCounter();
+        Status = IopIssueIoIrp(Device, MinorCode, Request);
+        IopCompleteScheduledIo(Scheduler,
+                               NULL,
+                               Direction,
+                               Request->IoBytesCompleted,
+                               HlQueryTimeCounter() - StartTime);
+
+        return Status;
+    }
+
+    KeReleaseQueuedLock(Scheduler->Lock);
+
+    //
+    // The request is going to wait. Lock its buffer now, outside the queue
+    // lock, so that it can be stitched together with other requests' buffers
+    // if it gets merged. With no alignment or address requirements this only
+    // pins the pages.
+    //
+
+    RtlZeroMemory(&Queued, sizeof(IO_SCHEDULER_REQUEST));
+    INITIALIZE_LIST_HEAD(&(Queued.MemberListHead));
+    Queued.Parameters = Request;
+    Queued.MinorCode = MinorCode;
+    Queued.Direction = Direction;
+    Queued.Offset = Request->IoOffset;
+    Queued.Size = Request->IoSizeInBytes;
+    OriginalBuffer = Request->IoBuffer;
+    Queued.IoBuffer = OriginalBuffer;
+    Status = MmValidateIoBuffer(0,
+                                MAX_ULONGLONG,
+                                0,
+                                Queued.Size,
+                                FALSE,
+                                &(Queued.IoBuffer),
+                                &LockedCopy);
+
+    if (!KSUCCESS(Status)) {
+        goto ScheduleIoEnd;
+    }
+
+    ASSERT((Queued.IoBuffer == OriginalBuffer) || (LockedCopy != FALSE));
+
+    Queued.Event = KeCreateEvent(NULL);
+    if (Queued.Event == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto ScheduleIoEnd;
+    }
+
+    CurrentTime = KeGetRecentTimeCounter();
+    Queued.QueueTime = CurrentTime;
+    Queued.Deadline = CurrentTime + Scheduler->Expire[Direction];
+    Wait = FALSE;
+    KeAcquireQueuedLock(Scheduler->Lock);
+    if ((Scheduler->QueuedCount == 0) &&
+        (Scheduler->InFlightCount < Scheduler->QueueDepth)) {
+
+        INSERT_BEFORE(&(Queued.MemberListEntry), &(Queued.MemberListHead));
+        Queued.MemberCount = 1;
+        Queued.State = IoSchedulerRequestDispatched;
+        IopStartScheduledIo(Scheduler);
+
+    //
+    // Once the request is queued, another thread will change its state and
+    // then signal the event. Always wait for that signal, even if the new
+    // state shows up first, so that the event outlives its use.
+    //
+
+    } else {
+        Wait = TRUE;
+        Queued.State = IoSchedulerRequestQueued;
+        if (IopMergeScheduledIo(Scheduler, &Queued) == FALSE) {
+            IopInsertScheduledIo(Scheduler, &Queued);
+        }
+
+        Scheduler->QueuedCount += 1;
+    }
+
+    KeReleaseQueuedLock(Scheduler->Lock);
+
+    //
+    // Wait to either be told to send the group this request leads, or for
+    // the leader of the group it was merged into to finish.
+    //
+
+    if (Wait != FALSE) {
+        KeWaitForEvent(Queued.Event, FALSE, WAIT_TIME_INDEFINITE);
+    }
+
+    if (Queued.State == IoSchedulerRequestComplete) {
+        Status = Queued.Status;
+        goto ScheduleIoEnd;
+    }
+
+    ASSERT(Queued.State == IoSchedulerRequestDispatched);
+
+    StartTime = HlQueryTimeCounter();
+    Status = IopIssueScheduledIo(Device, &Queued);
+    IopCompleteScheduledIo(Scheduler,
+                           &Queued,
+                           Direction,
+                           0,
+                           HlQueryTimeCounter() - StartTime);
+
+ScheduleIoEnd:
+    Request->IoBuffer = OriginalBuffer;
+    if (Queued.IoBuffer != OriginalBuffer) {
+        MmFreeIoBuffer(Queued.IoBuffer);
+    }
+
+    if (Queued.Event != NULL) {
+        KeDestroyEvent(Queued.Event);
+    }
+
+    return Status;
+}
+
+VOID
+IopDestroyIoScheduler (
+    PDEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys the I/O scheduler for a device that is being
+    destroyed, if it has one.
+
+Arguments:
+
+    Device - Supplies a pointer to the device being destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_SCHEDULER Scheduler;
+
+    Scheduler = Device->Scheduler;
+    if (Scheduler == NULL) {
+        return;
+    }
+
+    ASSERT(Scheduler->QueuedCount == 0);
+    ASSERT(Scheduler->InFlightCount == 0);
+
+    KeAcquireQueuedLock(IoSchedulerListLock);
+    LIST_REMOVE(&(Scheduler->ListEntry));
+    KeReleaseQueuedLock(IoSchedulerListLock);
+    KeDestroyQueuedLock(Scheduler->Lock);
+    MmFreeNonPagedPool(Scheduler);
+    Device->Scheduler = NULL;
+    return;
+}
+
+KSTATUS
+IopGetBlockQueueInformation (
+    PIO_BLOCK_QUEUE_INFORMATION Information,
+    PUINTN BufferSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine collects the I/O scheduler queue information for every block
+    device that has had requests scheduled.
+
+Arguments:
+
+    Information - Supplies a pointer to an array that receives one element
+        per block device.
+
+    BufferSize - Supplies a pointer to the size of the array in bytes. Upon
+        return this either holds the number of bytes actually used or, if the
+        buffer is too small, the expected buffer size.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_BUFFER_TOO_SMALL if the array cannot hold every device.
+
+--*/
+
+{
+
+    UINTN Count;
+    PLIST_ENTRY CurrentEntry;
+    PIO_BLOCK_QUEUE_INFORMATION Element;
+    PIO_SCHEDULER Scheduler;
+    KSTATUS Status;
+
+    KeAcquireQueuedLock(IoSchedulerListLock);
+    Count = 0;
+    CurrentEntry = IoSchedulerList.Next;
+    while (CurrentEntry != &IoSchedulerList) {
+        Count += 1;
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    if (*BufferSize < (Count * sizeof(IO_BLOCK_QUEUE_INFORMATION))) {
+        Status = STATUS_BUFFER_TOO_SMALL;
+        goto GetBlockQueueInformationEnd;
+    }
+
+    Element = Information;
+    CurrentEntry = IoSchedulerList.Next;
+    while (CurrentEntry != &IoSchedulerList) {
+        Scheduler = LIST_VALUE(CurrentEntry, IO_SCHEDULER, ListEntry);
+        KeAcquireQueuedLock(Scheduler->Lock);
+        Element->DeviceId = Scheduler->DeviceId;
+        Element->Scheduler = Scheduler->Type;
+        Element->QueueDepth = Scheduler->QueueDepth;
+        Element->QueuedCount = Scheduler->QueuedCount;
+        Element->InFlightCount = Scheduler->InFlightCount;
+        Element->ReadCount = Scheduler->ReadCount;
+        Element->WriteCount = Scheduler->WriteCount;
+        Element->DispatchCount = Scheduler->DispatchCount;
+        Element->BackMergeCount = Scheduler->BackMergeCount;
+        Element->FrontMergeCount = Scheduler->FrontMergeCount;
+        Element->ExpiredCount = Scheduler->ExpiredCount;
+        Element->TotalWaitMicroseconds =
+                      IopConvertTimeCounterToMicroseconds(Scheduler->TotalWait);
+
+        Element->MaxWaitMicroseconds =
+                        IopConvertTimeCounterToMicroseconds(Scheduler->MaxWait);
+
+        KeReleaseQueuedLock(Scheduler->Lock);
+        Element += 1;
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    Status = STATUS_SUCCESS;
+
+GetBlockQueueInformationEnd:
+    KeReleaseQueuedLock(IoSchedulerListLock);
+    *BufferSize = Count * sizeof(IO_BLOCK_QUEUE_INFORMATION);
+    return Status;
+}
+
+KSTATUS
+IopGetDeviceIoStatistics (
+    PIO_DEVICE_STATISTICS Statistics,
+    PUINTN BufferSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine collects the I/O statistics for every block device that has
+    had requests scheduled.
+
+Arguments:
+
+    Statistics - Supplies a pointer to an array that receives one element per
+        block device.
+
+    BufferSize - Supplies a pointer to the size of the array in bytes. Upon
+        return this either holds the number of bytes actually used or, if the
+        buffer is too small, the expected buffer size.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_BUFFER_TOO_SMALL if the array cannot hold every device.
+
+--*/
+
+{
+
+    ULONGLONG BusyTime;
+    UINTN Count;
+    PLIST_ENTRY CurrentEntry;
+    ULONGLONG CurrentTime;
+    PIO_DEVICE_STATISTICS Element;
+    PIO_SCHEDULER Scheduler;
+    KSTATUS Status;
+
+    KeAcquireQueuedLock(IoSchedulerListLock);
+    Count = 0;
+    CurrentEntry = IoSchedulerList.Next;
+    while (CurrentEntry != &IoSchedulerList) {
+        Count += 1;
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    if (*BufferSize < (Count * sizeof(IO_DEVICE_STATISTICS))) {
+        Status = STATUS_BUFFER_TOO_SMALL;
+        goto GetDeviceIoStatisticsEnd;
+    }
+
+    Element = Statistics;
+    CurrentEntry = IoSchedulerList.Next;
+    while (CurrentEntry != &IoSchedulerList) {
+        Scheduler = LIST_VALUE(CurrentEntry, IO_SCHEDULER, ListEntry);
+        KeAcquireQueuedLock(Scheduler->Lock);
+        Element->DeviceId = Scheduler->DeviceId;
+        Element->QueuedCount = Scheduler->QueuedCount;
+        Element->InFlightCount = Scheduler->InFlightCount;
+        Element->ReadCount = Scheduler->CompletedCount[IoSchedulerRead];
+        Element->WriteCount = Scheduler->CompletedCount[IoSchedulerWrite];
+        Element->BytesRead = Scheduler->BytesCompleted[IoSchedulerRead];
+        Element->BytesWritten = Scheduler->BytesCompleted[IoSchedulerWrite];
+        Element->QueueMicroseconds =
+                      IopConvertTimeCounterToMicroseconds(Scheduler->TotalWait);
+
+        Element->ServiceMicroseconds =
+                    IopConvertTimeCounterToMicroseconds(Scheduler->ServiceTime);
+
+        //
+        // Include the current busy period so that a device stuck on a long
+        // request still shows as busy.
+        //
+
+        BusyTime = Scheduler->BusyTime;
+        if (Scheduler->InFlightCount != 0) {
+            CurrentTime = HlQueryTimeCounter();
+            if (CurrentTime > Scheduler->BusyStart) {
+                BusyTime += CurrentTime - Scheduler->BusyStart;
+            }
+        }
+
+        Element->BusyMicroseconds =
+                               IopConvertTimeCounterToMicroseconds(BusyTime);
+
+        KeReleaseQueuedLock(Scheduler->Lock);
+        Element += 1;
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    Status = STATUS_SUCCESS;
+
+GetDeviceIoStatisticsEnd:
+    KeReleaseQueuedLock(IoSchedulerListLock);
+    *BufferSize = Count * sizeof(IO_DEVICE_STATISTICS);
+    return Status;
+}
+
+KSTATUS
+IopSetBlockQueueInformation (
+    PIO_BLOCK_QUEUE_INFORMATION Information,
+    UINTN Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine changes the scheduler type and queue depth of the given block
+    devices.
+
+Arguments:
+
+    Information - Supplies a pointer to an array of settings. Elements whose
+        scheduler type or queue depth are zero leave that setting alone.
+
+    Count - Supplies the number of elements in the array.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_FOUND if one of the devices has no I/O scheduler.
+
+    STATUS_INVALID_PARAMETER if a scheduler type is not valid.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    UINTN Index;
+    PIO_SCHEDULER Scheduler;
+    KSTATUS Status;
+
+    for (Index = 0; Index < Count; Index += 1) {
+        if (Information[Index].Scheduler >= IoSchedulerTypeCount) {
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+    KeAcquireQueuedLock(IoSchedulerListLock);
+    for (Index = 0; Index < Count; Index += 1) {
+        Scheduler = NULL;
+        CurrentEntry = IoSchedulerList.Next;
+        while (CurrentEntry != &IoSchedulerList) {
+            Scheduler = LIST_VALUE(CurrentEntry, IO_SCHEDULER, ListEntry);
+            if (Scheduler->DeviceId == Information[Index].DeviceId) {
+                break;
+            }
+
+            Scheduler = NULL;
+            CurrentEntry = CurrentEntry->Next;
+        }
+
+        if (Scheduler == NULL) {
+            Status = STATUS_NOT_FOUND;
+            continue;
+        }
+
+        //
+        // A deeper queue may let waiting requests go right away.
+        //
+
+        KeAcquireQueuedLock(Scheduler->Lock);
+        if (Information[Index].Scheduler != IoSchedulerInvalid) {
+            Scheduler->Type = Information[Index].Scheduler;
+        }
+
+        if (Information[Index].QueueDepth != 0) {
+            Scheduler->QueueDepth = Information[Index].QueueDepth;
+        }
+
+        IopRunIoScheduler(Scheduler);
+        KeReleaseQueuedLock(Scheduler->Lock);
+    }
+
+    KeReleaseQueuedLock(IoSchedulerListLock);
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+PIO_SCHEDULER
+IopGetIoScheduler (
+    PDEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the I/O scheduler for the given device, creating it
+    if this is the first request scheduled for the device.
+
+Arguments:
+
+    Device - Supplies a pointer to the block device.
+
+Return Value:
+
+    Returns a pointer to the device's I/O scheduler.
+
+    NULL if the scheduler could not be created.
+
+--*/
+
+{
+
+    ULONGLONG Frequency;
+    PIO_SCHEDULER NewScheduler;
+    PIO_SCHEDULER OldScheduler;
+
+    if (Device->Scheduler != NULL) {
+        return Device->Scheduler;
+    }
+
+    //
+    // The scheduler is non-paged since dirty pages are written out through
+    // it when memory is tight.
+    //
+
+    NewScheduler = MmAllocateNonPagedPool(sizeof(IO_SCHEDULER),
+                                          IO_SCHEDULER_ALLOCATION_TAG);
+
+    if (NewScheduler == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(NewScheduler, sizeof(IO_SCHEDULER));
+    NewScheduler->Lock = KeCreateQueuedLock();
+    if (NewScheduler->Lock == NULL) {
+        MmFreeNonPagedPool(NewScheduler);
+        return NULL;
+    }
+
+    NewScheduler->DeviceId = Device->DeviceId;
+    NewScheduler->Type = IoSchedulerDeadline;
+    NewScheduler->QueueDepth = IO_SCHEDULER_DEFAULT_QUEUE_DEPTH;
+    INITIALIZE_LIST_HEAD(&(NewScheduler->SortList[IoSchedulerRead]));
+    INITIALIZE_LIST_HEAD(&(NewScheduler->SortList[IoSchedulerWrite]));
+    INITIALIZE_LIST_HEAD(&(NewScheduler->FifoList[IoSchedulerRead]));
+    INITIALIZE_LIST_HEAD(&(NewScheduler->FifoList[IoSchedulerWrite]));
+    Frequency = HlQueryTimeCounterFrequency();
+    NewScheduler->Expire[IoSchedulerRead] =
+                                (Frequency * IO_SCHEDULER_READ_EXPIRE) / 1000;
+
+    NewScheduler->Expire[IoSchedulerWrite] =
+                               (Frequency * IO_SCHEDULER_WRITE_EXPIRE) / 1000;
+
+    //
+    // Try to atomically set the scheduler. Someone else may race and win.
+    //
+
+    OldScheduler = (PIO_SCHEDULER)RtlAtomicCompareExchange(
+                                                (PUINTN)&(Device->Scheduler),
+                                                (UINTN)NewScheduler,
+                                                (UINTN)NULL);
+
+    if (OldScheduler != NULL) {
+        KeDestroyQueuedLock(NewScheduler->Lock);
+        MmFreeNonPagedPool(NewScheduler);
+        return OldScheduler;
+    }
+
+    KeAcquireQueuedLock(IoSchedulerListLock);
+    INSERT_BEFORE(&(NewScheduler->ListEntry), &IoSchedulerList);
+    KeReleaseQueuedLock(IoSchedulerListLock);
+    return NewScheduler;
+}
+
+BOOL
+IopMergeScheduledIo (
+    PIO_SCHEDULER Scheduler,
+    PIO_SCHEDULER_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to merge a request onto the end or the front of a
+    queued group for the adjacent blocks. The scheduler lock is held.
+
+Arguments:
+
+    Scheduler - Supplies a pointer to the scheduler.
+
+    Request - Supplies a pointer to the request to merge.
+
+Return Value:
+
+    TRUE if the request was merged into a queued group.
+
+    FALSE if no group could take the request.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PIO_SCHEDULER_REQUEST Group;
+    PLIST_ENTRY Head;
+    PIO_SCHEDULER_REQUEST Next;
+    PIRP_READ_WRITE Parameters;
+
+    Parameters = Request->Parameters;
+    if ((Parameters->IoFlags & IO_FLAG_HARD_FLUSH) != 0) {
+        return FALSE;
+    }
+
+    Head = &(Scheduler->SortList[Request->Direction]);
+    CurrentEntry = Head->Next;
+    while (CurrentEntry != Head) {
+        Group = LIST_VALUE(CurrentEntry, IO_SCHEDULER_REQUEST, SortListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (Group->Offset > (Request->Offset + Request->Size)) {
+            break;
+        }
+
+        if ((Group->Parameters->DeviceContext != Parameters->DeviceContext) ||
+            (Group->Parameters->FileProperties !=
+             Parameters->FileProperties) ||
+            ((Group->Parameters->IoFlags & IO_FLAG_HARD_FLUSH) != 0) ||
+            ((Group->Size + Request->Size) > IO_SCHEDULER_MAX_MERGE_SIZE)) {
+
+            continue;
+        }
+
+        if ((Group->Offset + Group->Size) == Request->Offset) {
+            INSERT_BEFORE(&(Request->MemberListEntry),
+                          &(Group->MemberListHead));
+
+            Group->Size += Request->Size;
+            Group->MemberCount += 1;
+            Scheduler->BackMergeCount += 1;
+            return TRUE;
+        }
+
+        //
+        // A front merge moves the group's start, so put it back in the sorted
+        // list where it now belongs.
+        //
+
+        if ((Request->Offset + Request->Size) == Group->Offset) {
+            INSERT_AFTER(&(Request->MemberListEntry),
+                         &(Group->MemberListHead));
+
+            Group->Offset = Request->Offset;
+            Group->Size += Request->Size;
+            Group->MemberCount += 1;
+            Scheduler->FrontMergeCount += 1;
+            LIST_REMOVE(&(Group->SortListEntry));
+            CurrentEntry = Head->Next;
+            while (CurrentEntry != Head) {
+                Next = LIST_VALUE(CurrentEntry,
+                                  IO_SCHEDULER_REQUEST,
+                                  SortListEntry);
+
+                if (Next->Offset > Group->Offset) {
+                    break;
+                }
+
+                CurrentEntry = CurrentEntry->Next;
+            }
+
+            INSERT_BEFORE(&(Group->SortListEntry), CurrentEntry);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+VOID
+IopInsertScheduledIo (
+    PIO_SCHEDULER Scheduler,
+    PIO_SCHEDULER_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a request to the queue as the leader of a new group.
+    The scheduler lock is held.
+
+Arguments:
+
+    Scheduler - Supplies a pointer to the scheduler.
+
+    Request - Supplies a pointer to the request to insert.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PIO_SCHEDULER_REQUEST Group;
+    PLIST_ENTRY Head;
+
+    INSERT_BEFORE(&(Request->MemberListEntry), &(Request->MemberListHead));
+    Request->MemberCount = 1;
+    Request->Sequence = Scheduler->NextSequence;
+    Scheduler->NextSequence += 1;
+
+    //
+    // Requests tend to arrive in ascending order, so search from the back.
+    //
+
+    Head = &(Scheduler->SortList[Request->Direction]);
+    CurrentEntry = Head->Previous;
+    while (CurrentEntry != Head) {
+        Group = LIST_VALUE(CurrentEntry, IO_SCHEDULER_REQUEST, SortListEntry);
+        if (Group->Offset <= Request->Offset) {
+            break;
+        }
+
+        CurrentEntry = CurrentEntry->Previous;
+    }
+
+    INSERT_AFTER(&(Request->SortListEntry), CurrentEntry);
+    INSERT_BEFORE(&(Request->FifoListEntry),
+                  &(Scheduler->FifoList[Request->Direction]));
+
+    return;
+}
+
+VOID
+IopRunIoScheduler (
+    PIO_SCHEDULER Scheduler
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends queued groups to the device until either the queue is
+    empty or the device is full. The scheduler lock is held.
+
+Arguments:
+
+    Scheduler - Supplies a pointer to the scheduler.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    ULONGLONG CurrentTime;
+    PKEVENT Event;
+    PIO_SCHEDULER_REQUEST Leader;
+    PIO_SCHEDULER_REQUEST Member;
+    PIO_SCHEDULER_SELECT Select;
+    ULONGLONG Wait;
+
+    Select = IoSchedulerSelectRoutines[Scheduler->Type];
+    CurrentTime = KeGetRecentTimeCounter();
+    while (Scheduler->InFlightCount < Scheduler->QueueDepth) {
+        Leader = Select(Scheduler, CurrentTime);
+        if (Leader == NULL) {
+            break;
+        }
+
+        LIST_REMOVE(&(Leader->SortListEntry));
+        LIST_REMOVE(&(Leader->FifoListEntry));
+
+        ASSERT(Scheduler->QueuedCount >= Leader->MemberCount);
+
+        Scheduler->QueuedCount -= Leader->MemberCount;
+        IopStartScheduledIo(Scheduler);
+        Scheduler->NextOffset = Leader->Offset + Leader->Size;
+        CurrentEntry = Leader->MemberListHead.Next;
+        while (CurrentEntry != &(Leader->MemberListHead)) {
+            Member = LIST_VALUE(CurrentEntry,
+                                IO_SCHEDULER_REQUEST,
+                                MemberListEntry);
+
+            Wait = CurrentTime - Member->QueueTime;
+            if (CurrentTime < Member->QueueTime) {
+                Wait = 0;
+            }
+
+            Scheduler->TotalWait += Wait;
+            if (Wait > Scheduler->MaxWait) {
+                Scheduler->MaxWait = Wait;
+            }
+
+            CurrentEntry = CurrentEntry->Next;
+        }
+
+        //
+        // The leader's thread takes it from here. The leader may not be
+        // touched once its state changes, and the event may be destroyed as
+        // soon as it is signaled, so hold a reference on the event across
+        // the signal.
+        //
+
+        Event = Leader->Event;
+        ObAddReference(Event);
+        Leader->State = IoSchedulerRequestDispatched;
+        KeSignalEvent(Event, SignalOptionSignalAll);
+        ObReleaseReference(Event);
+    }
+
+    return;
+}
+
+KSTATUS
+IopIssueScheduledIo (
+    PDEVICE Device,
+    PIO_SCHEDULER_REQUEST Leader
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends a group of requests to the device as a single IRP and
+    divides the result among the members of the group.
+
+Arguments:
+
+    Device - Supplies a pointer to the block device.
+
+    Leader - Supplies a pointer to the leader of the group.
+
+Return Value:
+
+    Returns the status of the leader's own request.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    PLIST_ENTRY CurrentEntry;
+    UINTN FragmentCount;
+    PIO_BUFFER IoBuffer;
+    PIO_SCHEDULER_REQUEST Member;
+    IO_OFFSET MemberStart;
+    IRP_READ_WRITE Parameters;
+    KSTATUS Status;
+
+    if (Leader->MemberCount == 1) {
+        return IopIssueSingleScheduledIo(Device, Leader);
+    }
+
+    //
+    // Build a buffer out of all the members' pages. Each member's buffer is
+    // locked, so the combined buffer is too.
+    //
+
+    FragmentCount = 0;
+    CurrentEntry = Leader->MemberListHead.Next;
+    while (CurrentEntry != &(Leader->MemberListHead)) {
+        Member = LIST_VALUE(CurrentEntry,
+                            IO_SCHEDULER_REQUEST,
+                            MemberListEntry);
+
+        FragmentCount += Member->IoBuffer->FragmentCount;
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    IoBuffer = MmAllocateUninitializedIoBuffer(FragmentCount << MmPageShift(),
+                                               IO_BUFFER_FLAG_MEMORY_LOCKED);
+
+    Status = STATUS_INSUFFICIENT_RESOURCES;
+    RtlCopyMemory(&Parameters, Leader->Parameters, sizeof(IRP_READ_WRITE));
+    if (IoBuffer != NULL) {
+        CurrentEntry = Leader->MemberListHead.Next;
+        while (CurrentEntry != &(Leader->MemberListHead)) {
+            Member = LIST_VALUE(CurrentEntry,
+                                IO_SCHEDULER_REQUEST,
+                                MemberListEntry);
+
+            Status = MmAppendIoBuffer(IoBuffer,
+                                      Member->IoBuffer,
+                                      0,
+                                      Member->Parameters->IoSizeInBytes);
+
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+
+            Parameters.IoFlags |= Member->Parameters->IoFlags;
+            CurrentEntry = CurrentEntry->Next;
+        }
+    }
+
+    //
+    // If the combined buffer could not be built, fall back to sending each
+    // member on its own.
+    //
+
+    if (!KSUCCESS(Status)) {
+        CurrentEntry = Leader->MemberListHead.Next;
+        while (CurrentEntry != &(Leader->MemberListHead)) {
+            Member = LIST_VALUE(CurrentEntry,
+                                IO_SCHEDULER_REQUEST,
+                                MemberListEntry);
+
+            IopIssueSingleScheduledIo(Device, Member);
+            CurrentEntry = CurrentEntry->Next;
+        }
+
+        goto IssueScheduledIoEnd;
+    }
+
+    Parameters.IoOffset = Leader->Offset;
+    Parameters.IoSizeInBytes = Leader->Size;
+    Parameters.IoBytesCompleted = 0;
+    Parameters.NewIoOffset = Leader->Offset;
+    Parameters.IoBuffer = IoBuffer;
+    Status = IopIssueIoIrp(Device, Leader->MinorCode, &Parameters);
+
+    //
+    // Hand out the completed bytes in order. Members that got everything
+    // they asked for succeed even if the device came up short later on.
+    //
+
+    BytesCompleted = Parameters.IoBytesCompleted;
+    CurrentEntry = Leader->MemberListHead.Next;
+    while (CurrentEntry != &(Leader->MemberListHead)) {
+        Member = LIST_VALUE(CurrentEntry,
+                            IO_SCHEDULER_REQUEST,
+                            MemberListEntry);
+
+        MemberStart = Member->Parameters->IoOffset - Leader->Offset;
+        Member->Parameters->IoBytesCompleted = 0;
+        if (BytesCompleted > MemberStart) {
+            Member->Parameters->IoBytesCompleted = BytesCompleted - MemberStart;
+            if (Member->Parameters->IoBytesCompleted >
+                Member->Parameters->IoSizeInBytes) {
+
+                Member->Parameters->IoBytesCompleted =
+                                             Member->Parameters->IoSizeInBytes;
+            }
+        }
+
+        Member->Parameters->NewIoOffset = Member->Parameters->IoOffset +
+                                          Member->Parameters->IoBytesCompleted;
+
+        Member->Status = Status;
+        if (Member->Parameters->IoBytesCompleted ==
+            Member->Parameters->IoSizeInBytes) {
+
+            Member->Status = STATUS_SUCCESS;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+IssueScheduledIoEnd:
+    if (IoBuffer != NULL) {
+        MmFreeIoBuffer(IoBuffer);
+    }
+
+    return Leader->Status;
+}
+
+KSTATUS
+IopIssueSingleScheduledIo (
+    PDEVICE Device,
+    PIO_SCHEDULER_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends a single scheduled request to the device using its
+    locked buffer.
+
+Arguments:
+
+    Device - Supplies a pointer to the block device.
+
+    Request - Supplies a pointer to the request to send.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PIO_BUFFER OriginalBuffer;
+    PIRP_READ_WRITE Parameters;
+
+    Parameters = Request->Parameters;
+    OriginalBuffer = Parameters->IoBuffer;
+    Parameters->IoBuffer = Request->IoBuffer;
+    Request->Status = IopIssueIoIrp(Device, Request->MinorCode, Parameters);
+    Parameters->IoBuffer = OriginalBuffer;
+    return Request->Status;
+}
+
+VOID
+IopStartScheduledIo (
+    PIO_SCHEDULER Scheduler
+    )
+
+/*++
+
+Routine Description:
+
+    This routine counts a request or group being sent to the device. The
+    scheduler lock is held.
+
+Arguments:
+
+    Scheduler - Supplies a pointer to the scheduler.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Scheduler->InFlightCount == 0) {
+        Scheduler->BusyStart = HlQueryTimeCounter();
+    }
+
+    Scheduler->InFlightCount += 1;
+    Scheduler->DispatchCount += 1;
+    return;
+}
+
+VOID
+IopCompleteScheduledIo (
+    PIO_SCHEDULER Scheduler,
+    PIO_SCHEDULER_REQUEST Leader,
+    IO_SCHEDULER_DIRECTION Direction,
+    UINTN BytesCompleted,
+    ULONGLONG ServiceTime
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finishes a request that went to the device. It wakes the
+    other members of the group, adds the group to the device statistics, and
+    sends more queued requests down now that there is room.
+
+Arguments:
+
+    Scheduler - Supplies a pointer to the scheduler.
+
+    Leader - Supplies an optional pointer to the leader of the group that
+        completed. Requests that never waited in the queue supply NULL.
+
+    Direction - Supplies whether the request was a read or a write.
+
+    BytesCompleted - Supplies the number of bytes the request completed. This
+        is ignored if a leader is supplied, as the members' completed bytes
+        are added up instead.
+
+    ServiceTime - Supplies the time the request spent at the device, in time
+        counter ticks.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG CompletedCount;
+    PLIST_ENTRY CurrentEntry;
+    ULONGLONG CurrentTime;
+    PKEVENT Event;
+    PIO_SCHEDULER_REQUEST Member;
+
+    //
+    // Each member's stack frame may disappear as soon as it is signaled, so
+    // collect its results and move on to the next member first.
+    //
+
+    CompletedCount = 1;
+    if (Leader != NULL) {
+        BytesCompleted = 0;
+        CompletedCount = Leader->MemberCount;
+        CurrentEntry = Leader->MemberListHead.Next;
+        while (CurrentEntry != &(Leader->MemberListHead)) {
+            Member = LIST_VALUE(CurrentEntry,
+                                IO_SCHEDULER_REQUEST,
+                                MemberListEntry);
+
+            CurrentEntry = CurrentEntry->Next;
+            BytesCompleted += Member->Parameters->IoBytesCompleted;
+            if (Member == Leader) {
+                continue;
+            }
+
+            Event = Member->Event;
+            ObAddReference(Event);
+            Member->State = IoSchedulerRequestComplete;
+            KeSignalEvent(Event, SignalOptionSignalAll);
+            ObReleaseReference(Event);
+        }
+    }
+
+    KeAcquireQueuedLock(Scheduler->Lock);
+
+    ASSERT(Scheduler->InFlightCount != 0);
+
+    //
+    // Every member of a group waited on the same IRP.
+    //
+
+    Scheduler->CompletedCount[Direction] += CompletedCount;
+    Scheduler->BytesCompleted[Direction] += BytesCompleted;
+    Scheduler->ServiceTime += ServiceTime * CompletedCount;
+    Scheduler->InFlightCount -= 1;
+    if (Scheduler->InFlightCount == 0) {
+        CurrentTime = HlQueryTimeCounter();
+        if (CurrentTime > Scheduler->BusyStart) {
+            Scheduler->BusyTime += CurrentTime - Scheduler->BusyStart;
+        }
+    }
+
+    IopRunIoScheduler(Scheduler);
+    KeReleaseQueuedLock(Scheduler->Lock);
+    return;
+}
+
+PIO_SCHEDULER_REQUEST
+IopSelectNoopRequest (
+    PIO_SCHEDULER Scheduler,
+    ULONGLONG CurrentTime
+    )
+
+/*++
+
+Routine Description:
+
+    This routine picks the next group to send to the device in the order the
+    groups arrived, reads and writes alike.
+
+Arguments:
+
+    Scheduler - Supplies a pointer to the scheduler.
+
+    CurrentTime - Supplies the current time counter value.
+
+Return Value:
+
+    Returns a pointer to the leader of the group to send next.
+
+    NULL if the queue is empty.
+
+--*/
+
+{
+
+    PIO_SCHEDULER_REQUEST Read;
+    PIO_SCHEDULER_REQUEST Write;
+
+    Read = NULL;
+    Write = NULL;
+    if (LIST_EMPTY(&(Scheduler->FifoList[IoSchedulerRead])) == FALSE) {
+        Read = LIST_VALUE(Scheduler->FifoList[IoSchedulerRead].Next,
+                          IO_SCHEDULER_REQUEST,
+                          FifoListEntry);
+    }
+
+    if (LIST_EMPTY(&(Scheduler->FifoList[IoSchedulerWrite])) == FALSE) {
+        Write = LIST_VALUE(Scheduler->FifoList[IoSchedulerWrite].Next,
+                           IO_SCHEDULER_REQUEST,
+                           FifoListEntry);
+    }
+
+    if ((Read == NULL) ||
+        ((Write != NULL) && (Write->Sequence < Read->Sequence))) {
+
+        return Write;
+    }
+
+    return Read;
+}
+
+PIO_SCHEDULER_REQUEST
+IopSelectDeadlineRequest (
+    PIO_SCHEDULER Scheduler,
+    ULONGLONG CurrentTime
+    )
+
+/*++
+
+Routine Description:
+
+    This routine picks the next group to send to the device. Reads are
+    preferred over writes, since something is usually waiting on a read,
+    though writes get a turn after a few reads. Within a direction, the group
+    that has waited past its deadline goes first. Otherwise groups are sent in
+    ascending offset order, continuing from the last one sent.
+
+Arguments:
+
+    Scheduler - Supplies a pointer to the scheduler.
+
+    CurrentTime - Supplies the current time counter value.
+
+Return Value:
+
+    Returns a pointer to the leader of the group to send next.
+
+    NULL if the queue is empty.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    IO_SCHEDULER_DIRECTION Direction;
+    PIO_SCHEDULER_REQUEST Group;
+    PLIST_ENTRY Head;
+    BOOL Reads;
+    BOOL Writes;
+
+    Reads = FALSE;
+    if (LIST_EMPTY(&(Scheduler->FifoList[IoSchedulerRead])) == FALSE) {
+        Reads = TRUE;
+    }
+
+    Writes = FALSE;
+    if (LIST_EMPTY(&(Scheduler->FifoList[IoSchedulerWrite])) == FALSE) {
+        Writes = TRUE;
+    }
+
+    if ((Reads == FALSE) && (Writes == FALSE)) {
+        return NULL;
+    }
+
+    if ((Reads != FALSE) &&
+        ((Writes == FALSE) ||
+         (Scheduler->WritesStarved < IO_SCHEDULER_WRITES_STARVED))) {
+
+        Direction = IoSchedulerRead;
+        if (Writes != FALSE) {
+            Scheduler->WritesStarved += 1;
+        }
+
+    } else {
+        Direction = IoSchedulerWrite;
+        Scheduler->WritesStarved = 0;
+    }
+
+    Group = LIST_VALUE(Scheduler->FifoList[Direction].Next,
+                       IO_SCHEDULER_REQUEST,
+                       FifoListEntry);
+
+    if (Group->Deadline <= CurrentTime) {
+        Scheduler->ExpiredCount += 1;
+        return Group;
+    }
+
+    //
+    // Continue the sweep across the device, wrapping around to the lowest
+    // offset at the end.
+    //
+
+    Head = &(Scheduler->SortList[Direction]);
+    CurrentEntry = Head->Next;
+    while (CurrentEntry != Head) {
+        Group = LIST_VALUE(CurrentEntry, IO_SCHEDULER_REQUEST, SortListEntry);
+        if (Group->Offset >= Scheduler->NextOffset) {
+            return Group;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    return LIST_VALUE(Head->Next, IO_SCHEDULER_REQUEST, SortListEntry);
+}
+
+ULONGLONG
+IopConvertTimeCounterToMicroseconds (
+    ULONGLONG Ticks
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts a time counter duration into microseconds.
+
+Arguments:
+
+    Ticks - Supplies the number of time counter ticks.
+
+Return Value:
+
+    Returns the duration in microseconds.
+
+--*/
+
+{
+
+    ULONGLONG Frequency;
+
+    Frequency = HlQueryTimeCounterFrequency();
+    return ((Ticks / Frequency) * MICROSECONDS_PER_SECOND) +
+           (((Ticks % Frequency) * MICROSECONDS_PER_SECOND) / Frequency);
+}
+
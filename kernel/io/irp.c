@@ -36,6 +36,21 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// Define the largest IRP stack size that gets cached when an IRP is
+// destroyed, and the number of IRPs kept for each stack size.
+//
+
+#define IRP_CACHE_MAX_STACK_SIZE 8
+#define IRP_CACHE_DEPTH 16
+
+//
+// Define the number of IRP stack entries available to an IRP that lives on
+// the caller's stack. Deeper device stacks fall back to IoCreateIrp.
+//
+
+#define IRP_LOCAL_STACK_SIZE 8
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -98,6 +113,9 @@ Structure Description:
     Flags - Stores a set of informational flags about the IRP. See IRP_*
         definitions.
 
+    CacheListEntry - Stores pointers to the next and previous IRPs in the IRP
+        cache while this IRP is free.
+
 --*/
 
 typedef struct _IRP_INTERNAL {
@@ -109,8 +127,52 @@ typedef struct _IRP_INTERNAL {
     ULONG StackIndex;
     ULONG StackSize;
     ULONG Flags;
+    LIST_ENTRY CacheListEntry;
 } IRP_INTERNAL, *PIRP_INTERNAL;
 
+/*++
+
+Structure Description:
+
+    This structure defines an IRP that lives on the stack of the thread sending
+    it synchronously, along with enough IRP stack entries for most devices.
+
+Members:
+
+    Irp - Stores the IRP itself.
+
+    Stack - Stores the IRP stack entries.
+
+--*/
+
+typedef struct _LOCAL_IRP {
+    IRP_INTERNAL Irp;
+    IRP_STACK_ENTRY Stack[IRP_LOCAL_STACK_SIZE];
+} LOCAL_IRP, *PLOCAL_IRP;
+
+/*++
+
+Structure Description:
+
+    This structure defines the cache of free IRPs, sorted by stack size.
+
+Members:
+
+    Lock - Stores the spin lock protecting the cache.
+
+    FreeList - Stores the heads of the lists of free IRPs. The IRPs on list N
+        have a stack size of N + 1.
+
+    FreeCount - Stores the number of IRPs on each free list.
+
+--*/
+
+typedef struct _IRP_CACHE {
+    KSPIN_LOCK Lock;
+    LIST_ENTRY FreeList[IRP_CACHE_MAX_STACK_SIZE];
+    ULONG FreeCount[IRP_CACHE_MAX_STACK_SIZE];
+} IRP_CACHE, *PIRP_CACHE;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -130,6 +192,51 @@ IopAdvanceIrpStackLocation (
     PIRP_INTERNAL Irp
     );
 
+ULONG
+IopGetIrpStackSize (
+    PDEVICE Device
+    );
+
+PIRP_INTERNAL
+IopAllocateIrp (
+    ULONG StackSize
+    );
+
+VOID
+IopFreeIrp (
+    PIRP_INTERNAL Irp
+    );
+
+VOID
+IopResetIrp (
+    PIRP_INTERNAL Irp,
+    PDEVICE Device,
+    IRP_MAJOR_CODE MajorCode
+    );
+
+KSTATUS
+IopCreateIrpDriverState (
+    PIRP_INTERNAL Irp,
+    ULONG Flags
+    );
+
+VOID
+IopDestroyIrpDriverState (
+    PIRP_INTERNAL Irp
+    );
+
+KSTATUS
+IopInitializeLocalIrp (
+    PLOCAL_IRP LocalIrp,
+    PDEVICE Device,
+    IRP_MAJOR_CODE MajorCode
+    );
+
+VOID
+IopDestroyLocalIrp (
+    PLOCAL_IRP LocalIrp
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -140,6 +247,12 @@ IopAdvanceIrpStackLocation (
 
 POBJECT_HEADER IoIrpDirectory = NULL;
 
+//
+// Store the cache of free IRPs.
+//
+
+IRP_CACHE IoIrpCache;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -430,14 +543,8 @@ Return Value:
 
 {
 
-    ULONG AllocationSize;
-    PDRIVER_CREATE_IRP CreateIrp;
-    PLIST_ENTRY CurrentEntry;
-    PDRIVER_STACK_ENTRY CurrentStackEntry;
-    PDEVICE CurrentTarget;
-    PDRIVER_DISPATCH DestroyIrp;
-    ULONG EntryIndex;
     PIRP_INTERNAL Irp;
+    ULONG StackSize;
     KSTATUS Status;
 
     ASSERT(KeGetRunLevel() <= RunLevelDispatch);
@@ -461,151 +568,23 @@ Return Value:
     }
 
     //
-    // Attempt to allocate and initialize the IRP.
+    // Attempt to allocate (or pull from the cache) and initialize the IRP.
     //
 
-    Irp = ObCreateObject(ObjectIrp,
-                         IoIrpDirectory,
-                         NULL,
-                         0,
-                         sizeof(IRP_INTERNAL),
-                         NULL,
-                         0,
-                         IRP_ALLOCATION_TAG);
-
+    StackSize = IopGetIrpStackSize(Device);
+    Irp = IopAllocateIrp(StackSize);
     if (Irp == NULL) {
         Status = STATUS_INSUFFICIENT_RESOURCES;
         goto CreateIrpEnd;
     }
 
-    Irp->Magic = IRP_MAGIC_VALUE;
-    Irp->MajorCode = MajorCode;
-    Irp->Device = Device;
-    Irp->Public.Device = Device;
-    Irp->Public.MajorCode = MajorCode;
-    Irp->Flags = 0;
-    Irp->Stack = NULL;
-    Irp->StackIndex = 0;
-
-    //
-    // Figure out the size of the IRP stack, which is a chain of all the
-    // target devices. Don't follow the target device through volumes.
-    //
-
-    Irp->StackSize = 0;
-    CurrentTarget = Device;
-    while (CurrentTarget != NULL) {
-        Irp->StackSize += CurrentTarget->DriverStackSize;
-        if (CurrentTarget->Header.Type != ObjectDevice) {
-            break;
-        }
-
-        CurrentTarget = CurrentTarget->TargetDevice;
-    }
-
-    //
-    // Allocate the IRP stack.
-    //
-
-    AllocationSize = sizeof(IRP_STACK_ENTRY) * Irp->StackSize;
-    Irp->Stack = MmAllocateNonPagedPool(AllocationSize, IRP_ALLOCATION_TAG);
-    if (Irp->Stack == NULL) {
-        Status = STATUS_INSUFFICIENT_RESOURCES;
-    }
-
-    RtlZeroMemory(Irp->Stack, AllocationSize);
-    IoInitializeIrp(&(Irp->Public));
-
-    //
-    // Loop through every device in the IRP stack.
-    //
-
-    EntryIndex = 0;
-    CurrentTarget = Device;
-    while (CurrentTarget != NULL) {
-
-        //
-        // Loop through every driver on this device stack and allow it to
-        // create state with this IRP.
-        //
-
-        CurrentEntry = CurrentTarget->DriverStackHead.Next;
-        while (CurrentEntry != &(CurrentTarget->DriverStackHead)) {
-            CurrentStackEntry = LIST_VALUE(CurrentEntry,
-                                           DRIVER_STACK_ENTRY,
-                                           ListEntry);
-
-            CurrentEntry = CurrentEntry->Next;
-
-            ASSERT(EntryIndex < Irp->StackSize);
-
-            Irp->Stack[EntryIndex].DriverStackEntry = CurrentStackEntry;
-            CreateIrp = CurrentStackEntry->Driver->FunctionTable.CreateIrp;
-            if (CreateIrp != NULL) {
-                Status = CreateIrp((PIRP)Irp,
-                                   CurrentStackEntry->DriverContext,
-                                   &(Irp->Stack[EntryIndex].IrpContext),
-                                   Flags);
-
-                if (!KSUCCESS(Status)) {
-                    goto CreateIrpEnd;
-                }
-            }
-
-            EntryIndex += 1;
-        }
-
-        //
-        // Move to the next device in the chain, but don't follow the target
-        // device through a volume.
-        //
-
-        if (CurrentTarget->Header.Type != ObjectDevice) {
-            break;
-        }
-
-        CurrentTarget = CurrentTarget->TargetDevice;
-    }
-
-    Status = STATUS_SUCCESS;
+    IopResetIrp(Irp, Device, MajorCode);
+    Status = IopCreateIrpDriverState(Irp, Flags);
 
 CreateIrpEnd:
     if (!KSUCCESS(Status)) {
         if (Irp != NULL) {
-            if (Irp->Stack != NULL) {
-
-                //
-                // If a driver failed the allocation, then clean up everything
-                // up until then.
-                //
-
-                for (EntryIndex = 0;
-                     EntryIndex < Irp->StackSize;
-                     EntryIndex += 1) {
-
-                    if (Irp->Stack[EntryIndex].DriverStackEntry == NULL) {
-                        break;
-                    }
-
-                    DestroyIrp =
-                           CurrentStackEntry->Driver->FunctionTable.DestroyIrp;
-
-                    ASSERT((Irp->Stack[EntryIndex].IrpContext == NULL) ||
-                           (DestroyIrp != NULL));
-
-                    if (DestroyIrp != NULL) {
-                        DestroyIrp((PIRP)Irp,
-                                   CurrentStackEntry->DriverContext,
-                                   Irp->Stack[EntryIndex].IrpContext);
-                    }
-                }
-
-                MmFreeNonPagedPool(Irp->Stack);
-            }
-
-            ASSERT(Irp->Public.Header.ReferenceCount == 1);
-
-            ObReleaseReference(Irp);
+            IopFreeIrp(Irp);
             Irp = NULL;
         }
     }
@@ -638,16 +617,13 @@ Return Value:
 
 {
 
-    PDRIVER_DISPATCH DestroyIrp;
-    PDRIVER_STACK_ENTRY DriverStackEntry;
-    ULONG EntryIndex;
     PIRP_INTERNAL InternalIrp;
 
     InternalIrp = (PIRP_INTERNAL)Irp;
 
     ASSERT(KeGetRunLevel() <= RunLevelDispatch);
     ASSERT(Irp != NULL);
-    ASSERT((InternalIrp->Flags & IRP_ACTIVE) == 0);
+    ASSERT((InternalIrp->Flags & (IRP_ACTIVE | IRP_LOCAL)) == 0);
 
     //
     // Crash if the IRP was improperly allocated or modified.
@@ -671,28 +647,8 @@ Return Value:
                       0);
     }
 
-    //
-    // Loop through and call every driver that has the destroy IRP routine
-    // filled in.
-    //
-
-    for (EntryIndex = 0; EntryIndex < InternalIrp->StackSize; EntryIndex += 1) {
-        DriverStackEntry = InternalIrp->Stack[EntryIndex].DriverStackEntry;
-        DestroyIrp = DriverStackEntry->Driver->FunctionTable.DestroyIrp;
-
-        ASSERT((InternalIrp->Stack[EntryIndex].IrpContext == NULL) ||
-               (DestroyIrp != NULL));
-
-        if (DestroyIrp != NULL) {
-            DestroyIrp(Irp,
-                       DriverStackEntry->DriverContext,
-                       InternalIrp->Stack[EntryIndex].IrpContext);
-
-        }
-    }
-
-    MmFreeNonPagedPool(InternalIrp->Stack);
-    ObReleaseReference(Irp);
+    IopDestroyIrpDriverState(InternalIrp);
+    IopFreeIrp(InternalIrp);
     return;
 }
 
@@ -1184,6 +1140,40 @@ Return Value:
     return TotalStatus;
 }
 
+VOID
+IopInitializeIrpCache (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes the cache of free IRPs.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    KeInitializeSpinLock(&(IoIrpCache.Lock));
+    for (Index = 0; Index < IRP_CACHE_MAX_STACK_SIZE; Index += 1) {
+        INITIALIZE_LIST_HEAD(&(IoIrpCache.FreeList[Index]));
+        IoIrpCache.FreeCount[Index] = 0;
+    }
+
+    return;
+}
+
 KSTATUS
 IopSendStateChangeIrp (
     PDEVICE Device,
@@ -1380,7 +1370,8 @@ IopSendIoIrp (
 
 Routine Description:
 
-    This routine sends an I/O IRP.
+    This routine sends an I/O IRP. Requests to block devices are routed
+    through the device's I/O scheduler.
 
 Arguments:
 
@@ -1399,19 +1390,12 @@ Return Value:
 
 {
 
-    PIRP IoIrp;
     KSTATUS Status;
     PKTHREAD Thread;
 
     ASSERT((Device != NULL) && (Device != IoRootDevice));
     ASSERT(KeGetRunLevel() < RunLevelDispatch);
 
-    IoIrp = IoCreateIrp(Device, IrpMajorIo, 0);
-    if (IoIrp == NULL) {
-        Status = STATUS_INSUFFICIENT_RESOURCES;
-        goto SendIoIrpEnd;
-    }
-
     Thread = KeGetCurrentThread();
 
     //
@@ -1420,56 +1404,42 @@ Return Value:
     //
 
     Thread->Flags &= ~THREAD_FLAG_NON_IO_FAULT;
+    if (IopShouldScheduleIo(Device, Request) != FALSE) {
+        Status = IopScheduleIo(Device, MinorCodeNumber, Request);
 
-    //
-    // Copy the supplied contents in and send the IRP.
-    //
-
-    IoIrp->MinorCode = MinorCodeNumber;
-    RtlCopyMemory(&(IoIrp->U.ReadWrite), Request, sizeof(IRP_READ_WRITE));
-    IoIrp->U.ReadWrite.IoBufferState.IoBuffer = NULL;
-    Status = IoSendSynchronousIrp(IoIrp);
-    if (!KSUCCESS(Status)) {
-        goto SendIoIrpEnd;
+    } else {
+        Status = IopIssueIoIrp(Device, MinorCodeNumber, Request);
     }
 
-    ASSERT(IoIrp->U.ReadWrite.IoBufferState.IoBuffer == NULL);
+    //
+    // Charge the I/O to the thread that asked for it, even if another thread
+    // sent the IRP that carried it.
+    //
 
-    RtlCopyMemory(Request, &(IoIrp->U.ReadWrite), sizeof(IRP_READ_WRITE));
     if (Device->Header.Type == ObjectDevice) {
         if (MinorCodeNumber == IrpMinorIoWrite) {
             RtlAtomicAdd64(&(IoGlobalStatistics.BytesWritten),
-                           IoIrp->U.ReadWrite.IoBytesCompleted);
-
-            Thread->ResourceUsage.BytesWritten +=
-                                           IoIrp->U.ReadWrite.IoBytesCompleted;
+                           Request->IoBytesCompleted);
 
+            Thread->ResourceUsage.BytesWritten += Request->IoBytesCompleted;
             Thread->ResourceUsage.DeviceWrites += 1;
 
         } else {
             RtlAtomicAdd64(&(IoGlobalStatistics.BytesRead),
-                           IoIrp->U.ReadWrite.IoBytesCompleted);
-
-            Thread->ResourceUsage.BytesRead +=
-                                           IoIrp->U.ReadWrite.IoBytesCompleted;
+                           Request->IoBytesCompleted);
 
+            Thread->ResourceUsage.BytesRead += Request->IoBytesCompleted;
             Thread->ResourceUsage.DeviceReads += 1;
         }
     }
 
-    Status = IoGetIrpStatus(IoIrp);
-
-SendIoIrpEnd:
-    if (IoIrp != NULL) {
-        IoDestroyIrp(IoIrp);
-    }
-
     return Status;
 }
 
 KSTATUS
-IopSendIoReadIrp (
+IopIssueIoIrp (
     PDEVICE Device,
+    IRP_MINOR_CODE MinorCodeNumber,
     PIRP_READ_WRITE Request
     )
 
@@ -1477,17 +1447,17 @@ IopSendIoReadIrp (
 
 Routine Description:
 
-    This routine sends an I/O read IRP to the given device. It makes sure that
-    the bytes completed that are returned do not extend beyond the file size.
-    Here the file size is that which is currently on the device and not in the
-    system's cached view of the world.
+    This routine creates an I/O IRP and sends it straight down the device's
+    driver stack, without going through the I/O scheduler.
 
 Arguments:
 
     Device - Supplies a pointer to the device to send the IRP to.
 
+    MinorCodeNumber - Supplies the minor code number to send to the IRP.
+
     Request - Supplies a pointer that on input contains the I/O request
-        parameters.
+        parameters. On output, contains the completed request parameters.
 
 Return Value:
 
@@ -1497,17 +1467,103 @@ Return Value:
 
 {
 
-    PFILE_PROPERTIES FileProperties;
-    ULONGLONG FileSize;
+    PIRP IoIrp;
+    LOCAL_IRP LocalIrp;
     KSTATUS Status;
 
-    Status = IopSendIoIrp(Device, IrpMinorIoRead, Request);
-    FileProperties = Request->FileProperties;
-    FileSize = FileProperties->Size;
-    if ((Request->IoOffset + Request->IoBytesCompleted) > FileSize) {
-        if (Request->IoOffset > FileSize) {
-            Request->IoBytesCompleted = 0;
-            Request->NewIoOffset = Request->IoOffset;
+    ASSERT((Device != NULL) && (Device != IoRootDevice));
+    ASSERT(KeGetRunLevel() < RunLevelDispatch);
+
+    //
+    // The IRP never outlives this call, so build it on the stack. Only fall
+    // back to allocating one if the device stack is unusually deep.
+    //
+
+    IoIrp = NULL;
+    Status = IopInitializeLocalIrp(&LocalIrp, Device, IrpMajorIo);
+    if (KSUCCESS(Status)) {
+        IoIrp = &(LocalIrp.Irp.Public);
+
+    } else if (Status == STATUS_BUFFER_TOO_SMALL) {
+        IoIrp = IoCreateIrp(Device, IrpMajorIo, 0);
+        if (IoIrp == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto IssueIoIrpEnd;
+        }
+
+    } else {
+        goto IssueIoIrpEnd;
+    }
+
+    //
+    // Copy the supplied contents in and send the IRP.
+    //
+
+    IoIrp->MinorCode = MinorCodeNumber;
+    RtlCopyMemory(&(IoIrp->U.ReadWrite), Request, sizeof(IRP_READ_WRITE));
+    IoIrp->U.ReadWrite.IoBufferState.IoBuffer = NULL;
+    Status = IoSendSynchronousIrp(IoIrp);
+    if (!KSUCCESS(Status)) {
+        goto IssueIoIrpEnd;
+    }
+
+    ASSERT(IoIrp->U.ReadWrite.IoBufferState.IoBuffer == NULL);
+
+    RtlCopyMemory(Request, &(IoIrp->U.ReadWrite), sizeof(IRP_READ_WRITE));
+    Status = IoGetIrpStatus(IoIrp);
+
+IssueIoIrpEnd:
+    if (IoIrp == &(LocalIrp.Irp.Public)) {
+        IopDestroyLocalIrp(&LocalIrp);
+
+    } else if (IoIrp != NULL) {
+        IoDestroyIrp(IoIrp);
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopSendIoReadIrp (
+    PDEVICE Device,
+    PIRP_READ_WRITE Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends an I/O read IRP to the given device. It makes sure that
+    the bytes completed that are returned do not extend beyond the file size.
+    Here the file size is that which is currently on the device and not in the
+    system's cached view of the world.
+
+Arguments:
+
+    Device - Supplies a pointer to the device to send the IRP to.
+
+    Request - Supplies a pointer that on input contains the I/O request
+        parameters.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PFILE_PROPERTIES FileProperties;
+    ULONGLONG FileSize;
+    KSTATUS Status;
+
+    Status = IopSendIoIrp(Device, IrpMinorIoRead, Request);
+    FileProperties = Request->FileProperties;
+    FileSize = FileProperties->Size;
+    if ((Request->IoOffset + Request->IoBytesCompleted) > FileSize) {
+        if (Request->IoOffset > FileSize) {
+            Request->IoBytesCompleted = 0;
+            Request->NewIoOffset = Request->IoOffset;
 
         } else {
 
@@ -1939,3 +1995,499 @@ Return Value:
     return FALSE;
 }
 
+ULONG
+IopGetIrpStackSize (
+    PDEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines the size of the IRP stack needed to send an IRP to
+    the given device, which is a chain of all the target devices. The target
+    device is not followed through volumes.
+
+Arguments:
+
+    Device - Supplies a pointer to the device the IRP will be sent to.
+
+Return Value:
+
+    Returns the number of IRP stack entries needed.
+
+--*/
+
+{
+
+    PDEVICE CurrentTarget;
+    ULONG StackSize;
+
+    StackSize = 0;
+    CurrentTarget = Device;
+    while (CurrentTarget != NULL) {
+        StackSize += CurrentTarget->DriverStackSize;
+        if (CurrentTarget->Header.Type != ObjectDevice) {
+            break;
+        }
+
+        CurrentTarget = CurrentTarget->TargetDevice;
+    }
+
+    return StackSize;
+}
+
+PIRP_INTERNAL
+IopAllocateIrp (
+    ULONG StackSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates an IRP and its stack, preferring to reuse one from
+    the IRP cache. The returned IRP must be reset before use.
+
+Arguments:
+
+    StackSize - Supplies the number of IRP stack entries needed.
+
+Return Value:
+
+    Returns a pointer to the IRP on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    PIRP_INTERNAL Irp;
+    ULONG ListIndex;
+    RUNLEVEL OldRunLevel;
+
+    Irp = NULL;
+    if ((StackSize != 0) && (StackSize <= IRP_CACHE_MAX_STACK_SIZE)) {
+        ListIndex = StackSize - 1;
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(IoIrpCache.Lock));
+        if (LIST_EMPTY(&(IoIrpCache.FreeList[ListIndex])) == FALSE) {
+            Irp = LIST_VALUE(IoIrpCache.FreeList[ListIndex].Next,
+                             IRP_INTERNAL,
+                             CacheListEntry);
+
+            LIST_REMOVE(&(Irp->CacheListEntry));
+            IoIrpCache.FreeCount[ListIndex] -= 1;
+        }
+
+        KeReleaseSpinLock(&(IoIrpCache.Lock));
+        KeLowerRunLevel(OldRunLevel);
+        if (Irp != NULL) {
+
+            ASSERT(Irp->StackSize == StackSize);
+
+            return Irp;
+        }
+    }
+
+    Irp = ObCreateObject(ObjectIrp,
+                         IoIrpDirectory,
+                         NULL,
+                         0,
+                         sizeof(IRP_INTERNAL),
+                         NULL,
+                         0,
+                         IRP_ALLOCATION_TAG);
+
+    if (Irp == NULL) {
+        return NULL;
+    }
+
+    Irp->StackSize = StackSize;
+    Irp->Stack = MmAllocateNonPagedPool(sizeof(IRP_STACK_ENTRY) * StackSize,
+                                        IRP_ALLOCATION_TAG);
+
+    if (Irp->Stack == NULL) {
+        ObReleaseReference(Irp);
+        return NULL;
+    }
+
+    return Irp;
+}
+
+VOID
+IopFreeIrp (
+    PIRP_INTERNAL Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns an IRP to the IRP cache, or frees it if the cache is
+    full. The drivers must already be done with the IRP.
+
+Arguments:
+
+    Irp - Supplies a pointer to the IRP to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL Cached;
+    ULONG ListIndex;
+    RUNLEVEL OldRunLevel;
+
+    ASSERT((Irp->Flags & IRP_LOCAL) == 0);
+
+    //
+    // Only cache IRPs that nobody else holds a reference to, since the object
+    // is about to be handed out again.
+    //
+
+    Cached = FALSE;
+    if ((Irp->StackSize != 0) &&
+        (Irp->StackSize <= IRP_CACHE_MAX_STACK_SIZE) &&
+        (Irp->Public.Header.ReferenceCount == 1)) {
+
+        ListIndex = Irp->StackSize - 1;
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(IoIrpCache.Lock));
+        if (IoIrpCache.FreeCount[ListIndex] < IRP_CACHE_DEPTH) {
+            INSERT_AFTER(&(Irp->CacheListEntry),
+                         &(IoIrpCache.FreeList[ListIndex]));
+
+            IoIrpCache.FreeCount[ListIndex] += 1;
+            Cached = TRUE;
+        }
+
+        KeReleaseSpinLock(&(IoIrpCache.Lock));
+        KeLowerRunLevel(OldRunLevel);
+    }
+
+    if (Cached == FALSE) {
+        MmFreeNonPagedPool(Irp->Stack);
+        ObReleaseReference(Irp);
+    }
+
+    return;
+}
+
+VOID
+IopResetIrp (
+    PIRP_INTERNAL Irp,
+    PDEVICE Device,
+    IRP_MAJOR_CODE MajorCode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets a freshly allocated, cached, or stack-based IRP to a
+    clean state for the given device. The IRP's stack and stack size must
+    already be set.
+
+Arguments:
+
+    Irp - Supplies a pointer to the IRP to reset.
+
+    Device - Supplies a pointer to the device the IRP will be sent to.
+
+    MajorCode - Supplies the major code of the IRP.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIRP_STACK_ENTRY Stack;
+    ULONG StackSize;
+
+    Stack = Irp->Stack;
+    StackSize = Irp->StackSize;
+    RtlZeroMemory(&(Irp->Public.Header) + 1,
+                  sizeof(IRP_INTERNAL) - sizeof(OBJECT_HEADER));
+
+    ObSignalObject(Irp, SignalOptionUnsignal);
+    Irp->Magic = IRP_MAGIC_VALUE;
+    Irp->MajorCode = MajorCode;
+    Irp->Device = Device;
+    Irp->Public.Device = Device;
+    Irp->Public.MajorCode = MajorCode;
+    Irp->Stack = Stack;
+    Irp->StackSize = StackSize;
+    RtlZeroMemory(Stack, sizeof(IRP_STACK_ENTRY) * StackSize);
+    IoInitializeIrp(&(Irp->Public));
+    return;
+}
+
+KSTATUS
+IopCreateIrpDriverState (
+    PIRP_INTERNAL Irp,
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills out the IRP stack and gives every driver along it a
+    chance to create its own state for the IRP. On failure, the drivers that
+    already created state are given a chance to destroy it.
+
+Arguments:
+
+    Irp - Supplies a pointer to the reset IRP.
+
+    Flags - Supplies a bitmask of IRP creation flags. See IRP_FLAG_* for
+        definitions.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PDRIVER_CREATE_IRP CreateIrp;
+    PLIST_ENTRY CurrentEntry;
+    PDRIVER_STACK_ENTRY CurrentStackEntry;
+    PDEVICE CurrentTarget;
+    PDRIVER_DISPATCH DestroyIrp;
+    ULONG EntryIndex;
+    KSTATUS Status;
+
+    //
+    // Loop through every device in the IRP stack.
+    //
+
+    EntryIndex = 0;
+    CurrentTarget = Irp->Device;
+    while (CurrentTarget != NULL) {
+
+        //
+        // Loop through every driver on this device stack and allow it to
+        // create state with this IRP.
+        //
+
+        CurrentEntry = CurrentTarget->DriverStackHead.Next;
+        while (CurrentEntry != &(CurrentTarget->DriverStackHead)) {
+            CurrentStackEntry = LIST_VALUE(CurrentEntry,
+                                           DRIVER_STACK_ENTRY,
+                                           ListEntry);
+
+            CurrentEntry = CurrentEntry->Next;
+
+            ASSERT(EntryIndex < Irp->StackSize);
+
+            Irp->Stack[EntryIndex].DriverStackEntry = CurrentStackEntry;
+            CreateIrp = CurrentStackEntry->Driver->FunctionTable.CreateIrp;
+            if (CreateIrp != NULL) {
+                Status = CreateIrp((PIRP)Irp,
+                                   CurrentStackEntry->DriverContext,
+                                   &(Irp->Stack[EntryIndex].IrpContext),
+                                   Flags);
+
+                if (!KSUCCESS(Status)) {
+                    goto CreateIrpDriverStateEnd;
+                }
+            }
+
+            EntryIndex += 1;
+        }
+
+        //
+        // Move to the next device in the chain, but don't follow the target
+        // device through a volume.
+        //
+
+        if (CurrentTarget->Header.Type != ObjectDevice) {
+            break;
+        }
+
+        CurrentTarget = CurrentTarget->TargetDevice;
+    }
+
+    Status = STATUS_SUCCESS;
+
+CreateIrpDriverStateEnd:
+    if (!KSUCCESS(Status)) {
+
+        //
+        // If a driver failed the allocation, then clean up everything up
+        // until then.
+        //
+
+        while (EntryIndex != 0) {
+            EntryIndex -= 1;
+            CurrentStackEntry = Irp->Stack[EntryIndex].DriverStackEntry;
+            DestroyIrp = CurrentStackEntry->Driver->FunctionTable.DestroyIrp;
+
+            ASSERT((Irp->Stack[EntryIndex].IrpContext == NULL) ||
+                   (DestroyIrp != NULL));
+
+            if (DestroyIrp != NULL) {
+                DestroyIrp((PIRP)Irp,
+                           CurrentStackEntry->DriverContext,
+                           Irp->Stack[EntryIndex].IrpContext);
+            }
+        }
+    }
+
+    return Status;
+}
+
+VOID
+IopDestroyIrpDriverState (
+    PIRP_INTERNAL Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine calls every driver along the IRP stack that has a destroy IRP
+    routine so it can tear down its state for the IRP.
+
+Arguments:
+
+    Irp - Supplies a pointer to the IRP being destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PDRIVER_DISPATCH DestroyIrp;
+    PDRIVER_STACK_ENTRY DriverStackEntry;
+    ULONG EntryIndex;
+
+    for (EntryIndex = 0; EntryIndex < Irp->StackSize; EntryIndex += 1) {
+        DriverStackEntry = Irp->Stack[EntryIndex].DriverStackEntry;
+        DestroyIrp = DriverStackEntry->Driver->FunctionTable.DestroyIrp;
+
+        ASSERT((Irp->Stack[EntryIndex].IrpContext == NULL) ||
+               (DestroyIrp != NULL));
+
+        if (DestroyIrp != NULL) {
+            DestroyIrp((PIRP)Irp,
+                       DriverStackEntry->DriverContext,
+                       Irp->Stack[EntryIndex].IrpContext);
+        }
+    }
+
+    return;
+}
+
+KSTATUS
+IopInitializeLocalIrp (
+    PLOCAL_IRP LocalIrp,
+    PDEVICE Device,
+    IRP_MAJOR_CODE MajorCode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes an IRP that lives on the caller's stack. The IRP
+    gets a standalone object header that is not linked into the object tree,
+    so it must only be sent synchronously and must be torn down with
+    IopDestroyLocalIrp before the caller returns.
+
+Arguments:
+
+    LocalIrp - Supplies a pointer to the uninitialized IRP storage.
+
+    Device - Supplies a pointer to the device the IRP will be sent to.
+
+    MajorCode - Supplies the major code of the IRP.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_BUFFER_TOO_SMALL if the device stack is too deep for a local IRP.
+    The caller should use IoCreateIrp instead.
+
+    Other errors if a driver failed to create its IRP state.
+
+--*/
+
+{
+
+    POBJECT_HEADER Header;
+    PIRP_INTERNAL Irp;
+    ULONG StackSize;
+
+    ASSERT((Device->DriverStackSize != 0) &&
+           (LIST_EMPTY(&(Device->DriverStackHead)) == FALSE));
+
+    StackSize = IopGetIrpStackSize(Device);
+    if (StackSize > IRP_LOCAL_STACK_SIZE) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    Irp = &(LocalIrp->Irp);
+    Header = &(Irp->Public.Header);
+    RtlZeroMemory(Header, sizeof(OBJECT_HEADER));
+    Header->Type = ObjectIrp;
+    INITIALIZE_LIST_HEAD(&(Header->SiblingEntry));
+    INITIALIZE_LIST_HEAD(&(Header->ChildListHead));
+    ObInitializeWaitQueue(&(Header->WaitQueue), NotSignaled);
+    Header->ReferenceCount = 1;
+    Irp->Stack = LocalIrp->Stack;
+    Irp->StackSize = StackSize;
+    IopResetIrp(Irp, Device, MajorCode);
+    Irp->Flags |= IRP_LOCAL;
+    return IopCreateIrpDriverState(Irp, 0);
+}
+
+VOID
+IopDestroyLocalIrp (
+    PLOCAL_IRP LocalIrp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tears down an IRP initialized with IopInitializeLocalIrp.
+
+Arguments:
+
+    LocalIrp - Supplies a pointer to the local IRP.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIRP_INTERNAL Irp;
+
+    Irp = &(LocalIrp->Irp);
+
+    ASSERT((Irp->Flags & (IRP_ACTIVE | IRP_LOCAL)) == IRP_LOCAL);
+    ASSERT(Irp->Public.Header.ReferenceCount == 1);
+    ASSERT(LIST_EMPTY(&(Irp->Public.Header.WaitQueue.Waiters)) != FALSE);
+
+    IopDestroyIrpDriverState(Irp);
+    return;
+}
@@ -124,6 +124,31 @@ Module Name:
 
 #define PAGE_CACHE_ENTRY_FLAG_HARD_FLUSH_REQUESTED 0x00000040
 
+//
+// Set this flag if the page cache entry has been looked up since it was last
+// put on the inactive list or last aged on the active list. This is set
+// without the list lock.
+//
+
+#define PAGE_CACHE_ENTRY_FLAG_REFERENCED 0x00000080
+
+//
+// Set this flag if the page cache entry has been used more than once and
+// belongs on the active list rather than the inactive (clean) list. This is
+// only changed with the list lock held.
+//
+
+#define PAGE_CACHE_ENTRY_FLAG_ACTIVE 0x00000100
+
+//
+// Set this flag if the physical page and its mapping were lent by the device
+// whose storage is memory. The entry owns the page as far as the cache goes,
+// but never frees or unmaps it, and does not count it against the cache size.
+// Data written to the page lands on the device right away.
+//
+
+#define PAGE_CACHE_ENTRY_FLAG_BORROWED 0x00000200
+
 //
 // If any of the dirty mask bits are set, then the page cache entry needs to
 // be cleaned and flushed.
@@ -192,6 +217,22 @@ Module Name:
 
 #define PAGE_CACHE_CLEAN_DELAY_MIN (5000 * MICROSECONDS_PER_MILLISECOND)
 
+//
+// Define the portion of the page cache entries that may be on the active list
+// as a shift. Beyond this, the oldest active entries are aged back onto the
+// inactive list when the cache is trimmed.
+//
+
+#define PAGE_CACHE_ACTIVE_SHIFT 1
+
+//
+// Define the number of physical pages covered by each slot in the table of
+// shadow entries, as a shift, and the smallest size of that table.
+//
+
+#define PAGE_CACHE_SHADOW_SHIFT 2
+#define PAGE_CACHE_SHADOW_MINIMUM_COUNT 1024
+
 //
 // --------------------------------------------------------------------- Macros
 //
@@ -226,6 +267,34 @@ Module Name:
      (((_CacheFlags) & PAGE_CACHE_ENTRY_FLAG_HARD_FLUSH_REQUESTED) != 0) && \
      (((_CacheFlags) & PAGE_CACHE_ENTRY_FLAG_WAS_DIRTY) != 0))
 
+//
+// This macro returns the key of the given file offset in a page cache index.
+//
+
+#define PAGE_CACHE_INDEX_KEY(_Offset) ((ULONGLONG)(_Offset) >> MmPageShift())
+
+//
+// This macro returns the clean list that the given page cache entry belongs
+// on. The list lock must be held.
+//
+
+#define PAGE_CACHE_ENTRY_CLEAN_LIST(_Entry)                         \
+    ((((_Entry)->Flags & PAGE_CACHE_ENTRY_FLAG_ACTIVE) != 0) ?      \
+     &IoPageCacheActiveList :                                       \
+     &IoPageCacheCleanList)
+
+//
+// This macro hashes a file identity and page number into a shadow entry key.
+// The low bits pick the table slot and the high bits are kept to check that
+// a shadow entry belongs to the page being looked up.
+//
+
+#define PAGE_CACHE_SHADOW_HASH(_DeviceId, _FileId, _PageNumber)     \
+    ((((ULONGLONG)(_DeviceId) * 0x9E3779B97F4A7C15ULL) ^            \
+      ((ULONGLONG)(_FileId) * 0xC2B2AE3D27D4EB4FULL) ^              \
+      ((ULONGLONG)(_PageNumber) * 0x165667B19E3779F9ULL)) *         \
+     0xFF51AFD7ED558CCDULL)
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -244,9 +313,6 @@ Structure Description:
 
 Members:
 
-    Node - Stores the Red-Black tree node information for this page cache
-        entry.
-
     ListEntry - Stores this page cache entry's list entry in an LRU list, local
         list, or dirty list. This list entry is protected by the global page
         cache list lock.
@@ -270,10 +336,13 @@ Structure Description:
     Flags - Stores a bitmask of page cache entry flags. See
         PAGE_CACHE_ENTRY_FLAG_* for definitions.
 
+    Indexed - Stores a boolean indicating whether or not the entry is in its
+        file object's page cache index. This only changes with the file
+        object lock held exclusively.
+
 --*/
 
 struct _PAGE_CACHE_ENTRY {
-    RED_BLACK_TREE_NODE Node;
     LIST_ENTRY ListEntry;
     PFILE_OBJECT FileObject;
     IO_OFFSET Offset;
@@ -282,6 +351,7 @@ struct _PAGE_CACHE_ENTRY {
     PPAGE_CACHE_ENTRY BackingEntry;
     volatile ULONG ReferenceCount;
     volatile ULONG Flags;
+    BOOL Indexed;
 };
 
 //
@@ -306,7 +376,7 @@ IopDestroyPageCacheEntry (
     PPAGE_CACHE_ENTRY Entry
     );
 
-VOID
+KSTATUS
 IopInsertPageCacheEntry (
     PPAGE_CACHE_ENTRY NewEntry,
     PPAGE_CACHE_ENTRY LinkEntry
@@ -368,7 +438,7 @@ IopRemovePageCacheEntryVirtualAddress (
     );
 
 VOID
-IopRemovePageCacheEntryFromTree (
+IopRemovePageCacheEntryFromIndex (
     PPAGE_CACHE_ENTRY Entry
     );
 
@@ -378,6 +448,31 @@ IopUpdatePageCacheEntryList (
     BOOL Created
     );
 
+VOID
+IopMarkPageCacheEntryAccessed (
+    PPAGE_CACHE_ENTRY Entry
+    );
+
+VOID
+IopDeactivatePageCacheEntries (
+    UINTN Count
+    );
+
+VOID
+IopBalancePageCacheLists (
+    VOID
+    );
+
+VOID
+IopRecordPageCacheShadow (
+    PPAGE_CACHE_ENTRY Entry
+    );
+
+BOOL
+IopCheckPageCacheShadow (
+    PPAGE_CACHE_ENTRY Entry
+    );
+
 BOOL
 IopIsPageCacheTooBig (
     PUINTN FreePhysicalPages
@@ -398,13 +493,23 @@ IopCheckFileObjectPageCache (
 //
 
 //
-// Stores the list head for the page cache entries that are ordered from least
-// to most recently used. This will mostly contain clean entries, but could
-// have a few dirty entries on it.
+// Stores the list head for the inactive page cache entries, ordered from least
+// to most recently inserted. New entries start here, and entries are evicted
+// from here. This will mostly contain clean entries, but could have a few
+// dirty entries on it.
 //
 
 LIST_ENTRY IoPageCacheCleanList;
 
+//
+// Stores the list head for the active page cache entries: those that were
+// used again while on the inactive list. They are ordered from least to most
+// recently activated or aged, and are moved back to the inactive list when
+// the active list gets too big compared to the rest of the cache.
+//
+
+LIST_ENTRY IoPageCacheActiveList;
+
 //
 // Stores the list head for page cache entries that are clean but not mapped.
 // The unmap loop moves entries from the clean list to here to avoid iterating
@@ -570,6 +675,49 @@ PKTHREAD IoPageCacheThread;
 
 BOOL IoPageCacheDisableVirtualAddresses;
 
+//
+// Store the read-ahead counters, in pages.
+//
+
+volatile ULONGLONG IoReadAheadPageCount;
+volatile ULONGLONG IoReadAheadHitPageCount;
+volatile ULONGLONG IoReadAheadWastePageCount;
+
+//
+// Store the number of page cache entries in existence and the number of those
+// that are marked active.
+//
+
+volatile UINTN IoPageCacheEntryCount;
+volatile UINTN IoPageCacheActiveEntryCount;
+
+//
+// Store the table of shadow entries. When a page is evicted, a shadow entry
+// records the value of the eviction counter at that time, so that a page
+// coming back soon after can be put straight on the active list. The table is
+// lossy: a slot holds only the most recent eviction that hashed to it.
+//
+
+volatile ULONGLONG *IoPageCacheShadows;
+UINTN IoPageCacheShadowMask;
+
+//
+// Store the number of page cache entries evicted, which serves as the clock
+// for shadow entries.
+//
+
+volatile ULONG IoPageCacheEvictionCount;
+
+//
+// Store the page counters for cached reads and for pages that were read back
+// in after being evicted, in total and those that went to the active list.
+//
+
+volatile ULONGLONG IoPageCacheReadHitPageCount;
+volatile ULONGLONG IoPageCacheReadMissPageCount;
+volatile ULONGLONG IoPageCacheRefaultPageCount;
+volatile ULONGLONG IoPageCacheRefaultActivatePageCount;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -641,6 +789,29 @@ Return Value:
     Statistics->PhysicalPageCount = IoPageCachePhysicalPageCount;
     Statistics->DirtyPageCount = IoPageCacheDirtyPageCount;
     Statistics->LastCleanTime = LastCleanTime;
+    Statistics->ReadAheadPageCount =
+                            RtlAtomicOr64((PULONGLONG)&IoReadAheadPageCount, 0);
+
+    Statistics->ReadAheadHitPageCount =
+                         RtlAtomicOr64((PULONGLONG)&IoReadAheadHitPageCount, 0);
+
+    Statistics->ReadAheadWastePageCount =
+                       RtlAtomicOr64((PULONGLONG)&IoReadAheadWastePageCount, 0);
+
+    Statistics->EntryCount = IoPageCacheEntryCount;
+    Statistics->ActiveEntryCount = IoPageCacheActiveEntryCount;
+    Statistics->ReadHitPageCount =
+                     RtlAtomicOr64((PULONGLONG)&IoPageCacheReadHitPageCount, 0);
+
+    Statistics->ReadMissPageCount =
+                    RtlAtomicOr64((PULONGLONG)&IoPageCacheReadMissPageCount, 0);
+
+    Statistics->RefaultPageCount =
+                     RtlAtomicOr64((PULONGLONG)&IoPageCacheRefaultPageCount, 0);
+
+    Statistics->RefaultActivatePageCount =
+             RtlAtomicOr64((PULONGLONG)&IoPageCacheRefaultActivatePageCount, 0);
+
     return STATUS_SUCCESS;
 }
 
@@ -728,7 +899,8 @@ Return Value:
         if ((Entry->ListEntry.Next == NULL) &&
             ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0)) {
 
-            INSERT_BEFORE(&(Entry->ListEntry), &IoPageCacheCleanList);
+            INSERT_BEFORE(&(Entry->ListEntry),
+                          PAGE_CACHE_ENTRY_CLEAN_LIST(Entry));
         }
 
         KeReleaseQueuedLock(IoPageCacheListLock);
@@ -1008,6 +1180,11 @@ Return Value:
             INSERT_BEFORE(&(DirtyEntry->ListEntry),
                           &(DirtyEntry->FileObject->DirtyPageList));
 
+            IopSetPageCacheIndexTag(&(DirtyEntry->FileObject->PageCacheIndex),
+                                    PAGE_CACHE_INDEX_KEY(DirtyEntry->Offset),
+                                    DirtyEntry,
+                                    PageCacheIndexTagDirty);
+
             MarkDirty = TRUE;
         }
 
@@ -1053,11 +1230,13 @@ Return Value:
     ULONGLONG CurrentTime;
     ULONG PageShift;
     UINTN PhysicalPages;
+    UINTN ShadowCount;
     KSTATUS Status;
     UINTN TotalPhysicalPages;
     UINTN TotalVirtualMemory;
 
     INITIALIZE_LIST_HEAD(&IoPageCacheCleanList);
+    INITIALIZE_LIST_HEAD(&IoPageCacheActiveList);
     INITIALIZE_LIST_HEAD(&IoPageCacheCleanUnmappedList);
     INITIALIZE_LIST_HEAD(&IoPageCacheRemovalList);
     IoPageCacheListLock = KeCreateQueuedLock();
@@ -1160,6 +1339,32 @@ Return Value:
                                       PAGE_CACHE_LOW_MEMORY_CLEAN_PAGE_MAXIMUM;
     }
 
+    //
+    // Size the shadow entry table to a power of two proportional to physical
+    // memory. It only needs to remember evictions for about as long as the
+    // cache itself could hold the pages.
+    //
+
+    PhysicalPages = TotalPhysicalPages >> PAGE_CACHE_SHADOW_SHIFT;
+    if (PhysicalPages < PAGE_CACHE_SHADOW_MINIMUM_COUNT) {
+        PhysicalPages = PAGE_CACHE_SHADOW_MINIMUM_COUNT;
+    }
+
+    ShadowCount = 1L << ((sizeof(UINTN) * BITS_PER_BYTE) - 1 -
+                         RtlCountLeadingZeros(PhysicalPages));
+
+    IoPageCacheShadows = MmAllocateNonPagedPool(
+                                            ShadowCount * sizeof(ULONGLONG),
+                                            PAGE_CACHE_ALLOCATION_TAG);
+
+    if (IoPageCacheShadows == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializePageCacheEnd;
+    }
+
+    RtlZeroMemory((PVOID)IoPageCacheShadows, ShadowCount * sizeof(ULONGLONG));
+    IoPageCacheShadowMask = ShadowCount - 1;
+
     //
     // Determine an appropriate limit on the amount of virtual memory the page
     // cache is allowed to consume based on the total amount of system virtual
@@ -1223,6 +1428,11 @@ Return Value:
             MmDestroyBlockAllocator(IoPageCacheBlockAllocator);
             IoPageCacheBlockAllocator = NULL;
         }
+
+        if (IoPageCacheShadows != NULL) {
+            MmFreeNonPagedPool((PVOID)IoPageCacheShadows);
+            IoPageCacheShadows = NULL;
+        }
     }
 
     return Status;
@@ -1231,7 +1441,8 @@ Return Value:
 PPAGE_CACHE_ENTRY
 IopLookupPageCacheEntry (
     PFILE_OBJECT FileObject,
-    IO_OFFSET Offset
+    IO_OFFSET Offset,
+    BOOL MarkAccessed
     )
 
 /*++
@@ -1247,6 +1458,11 @@ Routine Description:
 
     Offset - Supplies an offset into the file or device.
 
+    MarkAccessed - Supplies a boolean indicating whether or not the lookup
+        counts as a use of the page for the purposes of eviction. Supply FALSE
+        for lookups on behalf of read-ahead, or for a page the caller already
+        counted.
+
 Return Value:
 
     Returns a pointer to the found page cache entry on success, or NULL on
@@ -1261,8 +1477,8 @@ Return Value:
     ASSERT(KeIsSharedExclusiveLockHeld(FileObject->Lock));
 
     FoundEntry = IopLookupPageCacheEntryHelper(FileObject, Offset);
-    if (FoundEntry != NULL) {
-        IopUpdatePageCacheEntryList(FoundEntry, FALSE);
+    if ((FoundEntry != NULL) && (MarkAccessed != FALSE)) {
+        IopMarkPageCacheEntryAccessed(FoundEntry);
     }
 
     if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_LOOKUP) != 0) {
@@ -1296,6 +1512,7 @@ IopCreateOrLookupPageCacheEntry (
     PHYSICAL_ADDRESS PhysicalAddress,
     IO_OFFSET Offset,
     PPAGE_CACHE_ENTRY LinkEntry,
+    BOOL Borrowed,
     PBOOL EntryCreated
     )
 
@@ -1324,6 +1541,10 @@ Routine Description:
         to share the physical address with this new page cache entry if it gets
         inserted.
 
+    Borrowed - Supplies a boolean indicating whether the physical page was
+        lent by the device. A new entry then caches the page in place, but
+        never frees it.
+
     EntryCreated - Supplies an optional pointer that receives a boolean
         indicating whether or not a new page cache entry was created.
 
@@ -1337,11 +1558,14 @@ Return Value:
 
     BOOL Created;
     PPAGE_CACHE_ENTRY NewEntry;
+    KSTATUS Status;
 
     ASSERT(KeIsSharedExclusiveLockHeldExclusive(FileObject->Lock));
     ASSERT((LinkEntry == NULL) ||
            (LinkEntry->PhysicalAddress == PhysicalAddress));
 
+    ASSERT((Borrowed == FALSE) || (LinkEntry == NULL));
+
     //
     // Check to see if there is an exiting cache entry. This may be called from
     // a block device read ahread, where only the beginning of the read is
@@ -1360,12 +1584,23 @@ Return Value:
             goto CreateOrLookupPageCacheEntryEnd;
         }
 
+        if (Borrowed != FALSE) {
+            NewEntry->Flags |= PAGE_CACHE_ENTRY_FLAG_BORROWED;
+        }
+
         //
         // The file object lock is held exclusively, so another entry cannot
         // sneak into the cache. Insert this new entry.
         //
 
-        IopInsertPageCacheEntry(NewEntry, LinkEntry);
+        Status = IopInsertPageCacheEntry(NewEntry, LinkEntry);
+        if (!KSUCCESS(Status)) {
+            NewEntry->ReferenceCount = 0;
+            IopDestroyPageCacheEntry(NewEntry);
+            NewEntry = NULL;
+            goto CreateOrLookupPageCacheEntryEnd;
+        }
+
         Created = TRUE;
     }
 
@@ -1451,6 +1686,7 @@ Return Value:
 {
 
     PPAGE_CACHE_ENTRY NewEntry;
+    KSTATUS Status;
 
     ASSERT(KeIsSharedExclusiveLockHeldExclusive(FileObject->Lock) != FALSE);
     ASSERT((LinkEntry == NULL) ||
@@ -1475,7 +1711,13 @@ Return Value:
 
     ASSERT(IopLookupPageCacheEntryHelper(FileObject, Offset) == NULL);
 
-    IopInsertPageCacheEntry(NewEntry, LinkEntry);
+    Status = IopInsertPageCacheEntry(NewEntry, LinkEntry);
+    if (!KSUCCESS(Status)) {
+        NewEntry->ReferenceCount = 0;
+        IopDestroyPageCacheEntry(NewEntry);
+        NewEntry = NULL;
+        goto CreateAndInsertPageCacheEntryEnd;
+    }
 
     //
     // Add the newly created page cach entry to the appropriate list.
@@ -1552,6 +1794,7 @@ Return Value:
 
 {
 
+    BOOL Borrowed;
     BOOL Created;
     PPAGE_CACHE_ENTRY DestinationEntry;
     PIO_BUFFER_FRAGMENT Fragment;
@@ -1571,6 +1814,17 @@ Return Value:
     ASSERT(IS_ALIGNED(SourceSize, PageSize) != FALSE);
     ASSERT(IS_ALIGNED(CopySize, PageSize) != FALSE);
 
+    //
+    // If a device lent its own memory to fill the source, cache those pages
+    // in place. Only block devices are asked to lend, as only their pages
+    // stay at the same offset for good.
+    //
+
+    Borrowed = MmIsIoBufferDeviceMemory(Source);
+
+    ASSERT((Borrowed == FALSE) ||
+           (FileObject->Properties.Type == IoObjectBlockDevice));
+
     Fragment = Source->Fragment;
     FragmentIndex = 0;
     FragmentOffset = 0;
@@ -1627,6 +1881,7 @@ Return Value:
                                                            PhysicalAddress,
                                                            FileOffset,
                                                            SourceEntry,
+                                                           Borrowed,
                                                            &Created);
 
         if (DestinationEntry == NULL) {
@@ -1740,18 +1995,20 @@ Return Value:
     PIO_BUFFER FlushBuffer;
     IO_OFFSET FlushNextOffset;
     UINTN FlushSize;
-    BOOL GetNextNode;
+    BOOL GetNextEntry;
+    PPAGE_CACHE_INDEX Index;
+    ULONGLONG Key;
     LIST_ENTRY LocalList;
-    PRED_BLACK_TREE_NODE Node;
     BOOL PageCacheThread;
     UINTN PagesFlushed;
     ULONG PageShift;
     ULONG PageSize;
-    PAGE_CACHE_ENTRY SearchEntry;
+    IO_OFFSET SearchOffset;
     BOOL SkipEntry;
     KSTATUS Status;
     KSTATUS TotalStatus;
     BOOL UseDirtyPageList;
+    BOOL UseDirtyTag;
 
     PageCacheThread = FALSE;
     BytesFlushed = FALSE;
@@ -1826,38 +2083,40 @@ Return Value:
     }
 
     PageSize = MmPageSize();
+    Index = &(FileObject->PageCacheIndex);
+    FlushNextOffset = Offset;
+    FlushSize = 0;
+    CleanStreak = 0;
+    SearchOffset = Offset;
 
     //
-    // Determine which page cache entry the flush should start on.
+    // Synchronized flushes also have to visit clean entries whose backing
+    // entries are dirty, so they walk every entry in the index. Everything
+    // else jumps straight from one dirty tagged entry to the next.
     //
 
-    SearchEntry.FileObject = FileObject;
-    FlushNextOffset = Offset;
-    FlushSize = 0;
-    CleanStreak = 0;
-    SearchEntry.Offset = Offset;
-    SearchEntry.Flags = 0;
-    Node = NULL;
+    UseDirtyTag = FALSE;
+    if ((Flags & IO_FLAG_DATA_SYNCHRONIZED) == 0) {
+        UseDirtyTag = TRUE;
+    }
 
     //
     // Loop over page cache entries. For non-synchronized flush-all operations,
     // iteration grabs the first entry in the dirty list, then iterates using
-    // the tree to maximize contiguous runs. Starting from the list avoids
-    // chewing up CPU time scanning through the tree. For explicit flush
-    // operations of a specific region, iterate using only the tree.
+    // the index to maximize contiguous runs. Starting from the list avoids
+    // chewing up CPU time walking the index. For explicit flush operations of
+    // a specific region, iterate using only the index.
     //
 
-    if (UseDirtyPageList == FALSE) {
-        Node = RtlRedBlackTreeSearchClosest(&(FileObject->PageCacheTree),
-                                            &(SearchEntry.Node),
-                                            TRUE);
+    GetNextEntry = TRUE;
+    if (UseDirtyPageList != FALSE) {
+        GetNextEntry = FALSE;
 
-    //
-    // Move all dirty entries over to a local list to avoid processing them
-    // many times over.
-    //
+        //
+        // Move all dirty entries over to a local list to avoid processing them
+        // many times over.
+        //
 
-    } else {
         KeAcquireQueuedLock(IoPageCacheListLock);
         if (!LIST_EMPTY(&(FileObject->DirtyPageList))) {
             MOVE_LIST(&(FileObject->DirtyPageList), &LocalList);
@@ -1867,43 +2126,55 @@ Return Value:
         KeReleaseQueuedLock(IoPageCacheListLock);
     }
 
-    //
-    // Either the first node was selected, or the node will be taken from the
-    // list. Don't move to the next node.
-    //
-
-    GetNextNode = FALSE;
     while (TRUE) {
+        CacheEntry = NULL;
 
         //
-        // Get the next greatest node in the tree if necessary.
+        // Get the next entry from the index if necessary. While a run is
+        // being built, look at the very next page so that a few clean pages
+        // can be absorbed into the run. Otherwise skip ahead to the next
+        // entry of interest.
         //
 
-        if ((Node != NULL) && (GetNextNode != FALSE)) {
-            Node = RtlRedBlackTreeGetNextNode(&(FileObject->PageCacheTree),
-                                              FALSE,
-                                              Node);
+        if (GetNextEntry != FALSE) {
+            Key = PAGE_CACHE_INDEX_KEY(SearchOffset);
+            if ((FlushSize != 0) &&
+                (SearchOffset == FlushNextOffset) &&
+                (CleanStreak < PAGE_CACHE_FLUSH_MAX_CLEAN_STREAK)) {
+
+                CacheEntry = IopLookupPageCacheIndex(Index, Key);
+            }
+
+            if (CacheEntry == NULL) {
+                if (UseDirtyTag != FALSE) {
+                    CacheEntry = IopFindTaggedPageCacheIndex(
+                                                       Index,
+                                                       Key,
+                                                       PageCacheIndexTagDirty);
+
+                } else {
+                    CacheEntry = IopFindPageCacheIndex(Index, Key);
+                }
+            }
         }
 
-        if ((Node == NULL) && (UseDirtyPageList != FALSE)) {
+        if ((CacheEntry == NULL) && (UseDirtyPageList != FALSE)) {
             KeAcquireQueuedLock(IoPageCacheListLock);
             while (!LIST_EMPTY(&LocalList)) {
                 CacheEntry = LIST_VALUE(LocalList.Next,
                                         PAGE_CACHE_ENTRY,
                                         ListEntry);
 
-                Node = &(CacheEntry->Node);
-
                 //
-                // The node might have been pulled from the tree while the file
-                // object lock was dropped, but that routine didn't yet get
-                // far enough to pull it off the list. Do it for them.
+                // The entry might have been pulled from the index while the
+                // file object lock was dropped, but that routine didn't yet
+                // get far enough to pull it off the list. Do it for them.
                 //
 
-                if (Node->Parent == NULL) {
+                if (CacheEntry->Indexed == FALSE) {
                     LIST_REMOVE(&(CacheEntry->ListEntry));
                     CacheEntry->ListEntry.Next = NULL;
-                    Node = NULL;
+                    CacheEntry = NULL;
                     continue;
                 }
 
@@ -1917,21 +2188,21 @@ Return Value:
         // Stop if there's nothing left.
         //
 
-        if (Node == NULL) {
+        if (CacheEntry == NULL) {
             break;
         }
 
-        CacheEntry = RED_BLACK_TREE_VALUE(Node, PAGE_CACHE_ENTRY, Node);
         if ((Size != -1ULL) && (CacheEntry->Offset >= (Offset + Size))) {
             break;
         }
 
         //
-        // Determine if the current entry can be skipped and plan to iterate to
-        // the next node on the next loop.
+        // Determine if the current entry can be skipped and plan to continue
+        // the walk just after it on the next loop.
         //
 
-        GetNextNode = TRUE;
+        SearchOffset = CacheEntry->Offset + PageSize;
+        GetNextEntry = TRUE;
         SkipEntry = FALSE;
         BackingEntry = CacheEntry->BackingEntry;
 
@@ -2000,7 +2271,7 @@ Return Value:
 
         if (SkipEntry != FALSE) {
             if (UseDirtyPageList != FALSE) {
-                Node = NULL;
+                GetNextEntry = FALSE;
             }
 
             continue;
@@ -2083,10 +2354,10 @@ Return Value:
         //
         // If this cache entry has not been dealt with, add it to the buffer
         // now. As the flush routine may release the lock (for block devices),
-        // also check to make sure the cache entry is still in the tree.
+        // also check to make sure the cache entry is still in the index.
         //
 
-        if ((CacheEntry != NULL) && (CacheEntry->Node.Parent != NULL)) {
+        if ((CacheEntry != NULL) && (CacheEntry->Indexed != FALSE)) {
             MmIoBufferAppendPage(FlushBuffer,
                                  CacheEntry,
                                  NULL,
@@ -2096,31 +2367,13 @@ Return Value:
             FlushNextOffset = CacheEntry->Offset + PageSize;
 
         //
-        // Reset the iteration if the dirty list is valid.
+        // Reset the iteration if the dirty list is valid. Otherwise the walk
+        // carries on after this entry, which works even if it was ripped out
+        // of the index while the lock was dropped during the flush.
         //
 
         } else if (UseDirtyPageList != FALSE) {
-            Node = NULL;
-
-        //
-        // If the node was ripped out of the tree while the lock was dropped
-        // during the flush, search for the next closest node. Make sure not to
-        // get the next node on the next loop, or else this one would be
-        // skipped.
-        //
-
-        } else if (Node->Parent == NULL) {
-            if (CacheEntry == NULL) {
-                CacheEntry = RED_BLACK_TREE_VALUE(Node, PAGE_CACHE_ENTRY, Node);
-            }
-
-            ASSERT(&(CacheEntry->Node) == Node);
-
-            Node = RtlRedBlackTreeSearchClosest(&(FileObject->PageCacheTree),
-                                                &(CacheEntry->Node),
-                                                TRUE);
-
-            GetNextNode = FALSE;
+            GetNextEntry = FALSE;
         }
 
         //
@@ -2283,11 +2536,10 @@ Return Value:
     PPAGE_CACHE_ENTRY CacheEntry;
     BOOL Destroyed;
     LIST_ENTRY DestroyListHead;
-    PRED_BLACK_TREE_NODE Node;
-    PAGE_CACHE_ENTRY SearchEntry;
+    ULONGLONG Key;
 
     //
-    // The tree is being modified, so the file object lock must be held
+    // The index is being modified, so the file object lock must be held
     // exclusively.
     //
 
@@ -2312,33 +2564,25 @@ Return Value:
     // Quickly exit if there is nothing to evict.
     //
 
-    if (RED_BLACK_TREE_EMPTY(&(FileObject->PageCacheTree)) != FALSE) {
+    if (PAGE_CACHE_INDEX_EMPTY(&(FileObject->PageCacheIndex)) != FALSE) {
         return;
     }
 
-    //
-    // Iterate over the file object's tree of page cache entries.
-    //
-
     INITIALIZE_LIST_HEAD(&DestroyListHead);
 
     //
-    // Find the page cache entry in the file object's tree that is closest (but
-    // greater than or equal) to the given eviction offset.
+    // Iterate over the file object's page cache entries, starting with the
+    // first one at or after the given eviction offset.
     //
 
-    SearchEntry.FileObject = FileObject;
-    SearchEntry.Offset = Offset;
-    SearchEntry.Flags = 0;
-    Node = RtlRedBlackTreeSearchClosest(&(FileObject->PageCacheTree),
-                                        &(SearchEntry.Node),
-                                        TRUE);
+    Key = PAGE_CACHE_INDEX_KEY(ALIGN_RANGE_UP(Offset, MmPageSize()));
+    while (TRUE) {
+        CacheEntry = IopFindPageCacheIndex(&(FileObject->PageCacheIndex), Key);
+        if (CacheEntry == NULL) {
+            break;
+        }
 
-    while (Node != NULL) {
-        CacheEntry = LIST_VALUE(Node, PAGE_CACHE_ENTRY, Node);
-        Node = RtlRedBlackTreeGetNextNode(&(FileObject->PageCacheTree),
-                                          FALSE,
-                                          Node);
+        Key = PAGE_CACHE_INDEX_KEY(CacheEntry->Offset) + 1;
 
         //
         // Assert this is a cache entry after the eviction offset.
@@ -2347,13 +2591,13 @@ Return Value:
         ASSERT(CacheEntry->Offset >= Offset);
 
         //
-        // Remove the node from the page cache tree. It should not be found on
-        // look-up again.
+        // Remove the entry from the page cache index. It should not be found
+        // on look-up again.
         //
 
-        ASSERT(CacheEntry->Node.Parent != NULL);
+        ASSERT(CacheEntry->Indexed != FALSE);
 
-        IopRemovePageCacheEntryFromTree(CacheEntry);
+        IopRemovePageCacheEntryFromIndex(CacheEntry);
 
         //
         // Remove the cache entry from its current list. If it has no
@@ -2634,6 +2878,11 @@ Return Value:
             ASSERT((OldFlags & PAGE_CACHE_ENTRY_FLAG_OWNER) != 0);
 
             RtlAtomicAdd(&IoPageCacheDirtyPageCount, (UINTN)-1);
+            if (Entry->FileObject->Writeback != NULL) {
+                RtlAtomicAdd(&(Entry->FileObject->Writeback->DirtyPageCount),
+                             (UINTN)-1);
+            }
+
             if ((OldFlags & PAGE_CACHE_ENTRY_FLAG_MAPPED) != 0) {
                 RtlAtomicAdd(&IoPageCacheMappedDirtyPageCount, (UINTN)-1);
             }
@@ -2654,17 +2903,21 @@ Return Value:
 
         //
         // As a page cache entry can be marked dirty-pending without the file
-        // object lock, double check the flags. Do not put the cache entry on
-        // the clean list if it's dirty pending. It needs to be on the dirty
-        // list.
+        // object lock, double check the flags. Do not untag the cache entry
+        // or put it on the clean list if it's dirty pending. It needs to be
+        // on the dirty list.
         //
 
         if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_PENDING) == 0) {
+            IopClearPageCacheIndexTag(&(Entry->FileObject->PageCacheIndex),
+                                      PAGE_CACHE_INDEX_KEY(Entry->Offset),
+                                      Entry,
+                                      PageCacheIndexTagDirty);
 
             //
-            // If requested, move the page cache entry to the back of the LRU
-            // list; assume that this page has been fairly recently used on
-            // account of it having been dirty. If the page is already on a
+            // If requested, move the page cache entry to the back of its
+            // clean list; assume that this page has been fairly recently used
+            // on account of it having been dirty. If the page is already on a
             // list, then leave it as its current location.
             //
 
@@ -2674,7 +2927,8 @@ Return Value:
                     Entry->ListEntry.Next = NULL;
                 }
 
-                INSERT_BEFORE(&(Entry->ListEntry), &IoPageCacheCleanList);
+                INSERT_BEFORE(&(Entry->ListEntry),
+                              PAGE_CACHE_ENTRY_CLEAN_LIST(Entry));
             }
         }
 
@@ -2771,6 +3025,10 @@ Return Value:
                (Entry->VirtualAddress == NULL));
 
         RtlAtomicAdd(&IoPageCacheDirtyPageCount, 1);
+        if (FileObject->Writeback != NULL) {
+            RtlAtomicAdd(&(FileObject->Writeback->DirtyPageCount), 1);
+        }
+
         if ((OldFlags & PAGE_CACHE_ENTRY_FLAG_MAPPED) != 0) {
             RtlAtomicAdd(&IoPageCacheMappedDirtyPageCount, 1);
         }
@@ -2793,6 +3051,11 @@ Return Value:
         INSERT_BEFORE(&(DirtyEntry->ListEntry),
                       &(FileObject->DirtyPageList));
 
+        IopSetPageCacheIndexTag(&(FileObject->PageCacheIndex),
+                                PAGE_CACHE_INDEX_KEY(DirtyEntry->Offset),
+                                DirtyEntry,
+                                PageCacheIndexTagDirty);
+
         KeReleaseQueuedLock(IoPageCacheListLock);
         IopMarkFileObjectDirty(DirtyEntry->FileObject);
 
@@ -2813,7 +3076,8 @@ IopCopyIoBufferToPageCacheEntry (
     ULONG PageOffset,
     PIO_BUFFER SourceBuffer,
     UINTN SourceOffset,
-    ULONG ByteCount
+    ULONG ByteCount,
+    BOOL MarkDirty
     )
 
 /*++
@@ -2837,6 +3101,10 @@ Routine Description:
 
     ByteCount - Supplies the number of bytes to copy.
 
+    MarkDirty - Supplies a boolean indicating whether the entry should be
+        marked dirty after the copy. Supply FALSE if the backing storage
+        already holds the copied data.
+
 Return Value:
 
     Status code.
@@ -2882,7 +3150,9 @@ Return Value:
         goto CopyIoBufferToPageCacheEntryEnd;
     }
 
-    IopMarkPageCacheEntryDirty(Entry);
+    if (MarkDirty != FALSE) {
+        IopMarkPageCacheEntryDirty(Entry);
+    }
 
 CopyIoBufferToPageCacheEntryEnd:
     MmFreeIoBuffer(&PageCacheBuffer);
@@ -3024,10 +3294,13 @@ Return Value:
 
     //
     // If the page cache entry that is to be updated has more than one
-    // reference then this cannot proceed.
+    // reference then this cannot proceed. Linking would also free the lower
+    // entry's page, which a borrowed entry cannot give up.
     //
 
-    if (LowerEntry->ReferenceCount != 1) {
+    if ((LowerEntry->ReferenceCount != 1) ||
+        ((LowerEntry->Flags & PAGE_CACHE_ENTRY_FLAG_BORROWED) != 0)) {
+
         return FALSE;
     }
 
@@ -3172,7 +3445,7 @@ Routine Description:
 
     This routine removes as many clean page cache entries as is necessary to
     bring the size of the page cache back down to a reasonable level. It evicts
-    the page cache entries in LRU order.
+    inactive page cache entries first, in the order they became inactive.
 
 Arguments:
 
@@ -3228,11 +3501,12 @@ Return Value:
     }
 
     //
-    // Iterate over the clean LRU page cache list trying to find which page
-    // cache entries can be removed. Stop as soon as the target count has been
-    // reached.
+    // Age the active list down to its share of the cache, then iterate over
+    // the inactive lists trying to find which page cache entries can be
+    // removed. Stop as soon as the target count has been reached.
     //
 
+    IopBalancePageCacheLists();
     INITIALIZE_LIST_HEAD(&DestroyListHead);
     if (!LIST_EMPTY(&IoPageCacheCleanUnmappedList)) {
         IopRemovePageCacheEntriesFromList(&IoPageCacheCleanUnmappedList,
@@ -3248,6 +3522,21 @@ Return Value:
                                           &TargetRemoveCount);
     }
 
+    //
+    // If the inactive list could not supply enough, the active list has to
+    // give up some entries too. Age them over and try once more.
+    //
+
+    if ((TargetRemoveCount != 0) && (!LIST_EMPTY(&IoPageCacheActiveList))) {
+        KeAcquireQueuedLock(IoPageCacheListLock);
+        IopDeactivatePageCacheEntries(TargetRemoveCount);
+        KeReleaseQueuedLock(IoPageCacheListLock);
+        IopRemovePageCacheEntriesFromList(&IoPageCacheCleanList,
+                                          &DestroyListHead,
+                                          TimidEffort,
+                                          &TargetRemoveCount);
+    }
+
     //
     // Destroy the evicted page cache entries. This will reduce the page
     // cache's physical page count for any page that it ends up releasing.
@@ -3292,7 +3581,7 @@ Return Value:
 
 BOOL
 IopIsPageCacheTooDirty (
-    VOID
+    PWRITEBACK_DEVICE Writeback
     )
 
 /*++
@@ -3305,7 +3594,10 @@ Routine Description:
 
 Arguments:
 
-    None.
+    Writeback - Supplies an optional pointer to the writeback state of the
+        device about to be dirtied. If supplied, the device's share of the
+        dirty limit is checked as well once the page cache is half way to its
+        limit.
 
 Return Value:
 
@@ -3318,89 +3610,84 @@ Return Value:
 
 {
 
+    UINTN DeviceLimit;
     UINTN DirtyPages;
-    UINTN FreePages;
-    UINTN IdealSize;
     UINTN MaxDirty;
 
     DirtyPages = IoPageCacheDirtyPageCount;
-    if (DirtyPages >= IoPageCacheMaxDirtyPages) {
+    MaxDirty = IopGetPageCacheDirtyLimit();
+    if (DirtyPages >= MaxDirty) {
         return TRUE;
     }
 
     //
-    // Determine the ideal page cache size.
-    //
-
-    FreePages = MmGetTotalFreePhysicalPages();
-    if (FreePages < IoPageCacheHeadroomPagesRetreat) {
-        IdealSize = IoPageCachePhysicalPageCount -
-                    (IoPageCacheHeadroomPagesRetreat - FreePages);
-
-    } else {
-        IdealSize = IoPageCachePhysicalPageCount +
-                    (FreePages - IoPageCacheHeadroomPagesRetreat);
-    }
-
-    //
-    // Only a portion of that ideal size should be dirty.
+    // Below half the limit everyone runs free. Above that, a device that is
+    // holding more than its share of the dirty pages gets its writers
+    // throttled, leaving room for devices that drain faster.
     //
 
-    MaxDirty = IdealSize >> PAGE_CACHE_MAX_DIRTY_SHIFT;
-    if (DirtyPages >= MaxDirty) {
-        return TRUE;
+    if ((Writeback != NULL) && (DirtyPages >= (MaxDirty >> 1))) {
+        DeviceLimit = IopGetWritebackDirtyLimit(Writeback, MaxDirty);
+        if (Writeback->DirtyPageCount >= DeviceLimit) {
+            return TRUE;
+        }
     }
 
     return FALSE;
 }
 
-COMPARISON_RESULT
-IopComparePageCacheEntries (
-    PRED_BLACK_TREE Tree,
-    PRED_BLACK_TREE_NODE FirstNode,
-    PRED_BLACK_TREE_NODE SecondNode
+UINTN
+IopGetPageCacheDirtyLimit (
+    VOID
     )
 
 /*++
 
 Routine Description:
 
-    This routine compares two Red-Black tree nodes contained inside file
-    objects.
+    This routine determines the maximum number of dirty pages the page cache
+    should hold, based on its ideal size.
 
 Arguments:
 
-    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
-
-    FirstNode - Supplies a pointer to the left side of the comparison.
-
-    SecondNode - Supplies a pointer to the second side of the comparison.
+    None.
 
 Return Value:
 
-    Same if the two nodes have the same value.
-
-    Ascending if the first node is less than the second node.
-
-    Descending if the second node is less than the first node.
+    Returns the system-wide dirty page limit.
 
 --*/
 
 {
 
-    PPAGE_CACHE_ENTRY FirstEntry;
-    PPAGE_CACHE_ENTRY SecondEntry;
+    UINTN FreePages;
+    UINTN IdealSize;
+    UINTN MaxDirty;
 
-    FirstEntry = RED_BLACK_TREE_VALUE(FirstNode, PAGE_CACHE_ENTRY, Node);
-    SecondEntry = RED_BLACK_TREE_VALUE(SecondNode, PAGE_CACHE_ENTRY, Node);
-    if (FirstEntry->Offset < SecondEntry->Offset) {
-        return ComparisonResultAscending;
+    //
+    // Determine the ideal page cache size.
+    //
 
-    } else if (FirstEntry->Offset > SecondEntry->Offset) {
-        return ComparisonResultDescending;
+    FreePages = MmGetTotalFreePhysicalPages();
+    if (FreePages < IoPageCacheHeadroomPagesRetreat) {
+        IdealSize = IoPageCachePhysicalPageCount -
+                    (IoPageCacheHeadroomPagesRetreat - FreePages);
+
+    } else {
+        IdealSize = IoPageCachePhysicalPageCount +
+                    (FreePages - IoPageCacheHeadroomPagesRetreat);
+    }
+
+    //
+    // Only a portion of that ideal size should be dirty.
+    //
+
+    MaxDirty = IdealSize >> PAGE_CACHE_MAX_DIRTY_SHIFT;
+    if (MaxDirty > IoPageCacheMaxDirtyPages) {
+        MaxDirty = IoPageCacheMaxDirtyPages;
     }
 
-    return ComparisonResultSame;
+    return MaxDirty;
 }
 
 //
@@ -3469,6 +3756,7 @@ Return Value:
     }
 
     NewEntry->ReferenceCount = 1;
+    RtlAtomicAdd(&IoPageCacheEntryCount, 1);
     if ((FileObject->Flags & FILE_OBJECT_FLAG_HARD_FLUSH_REQUIRED) != 0) {
         NewEntry->Flags |= PAGE_CACHE_ENTRY_FLAG_HARD_FLUSH_REQUIRED;
     }
@@ -3518,7 +3806,7 @@ Return Value:
         CurrentEntry->Next = NULL;
 
         ASSERT(CacheEntry->ReferenceCount == 0);
-        ASSERT(CacheEntry->Node.Parent == NULL);
+        ASSERT(CacheEntry->Indexed == FALSE);
 
         if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_EVICTION) != 0) {
             RtlDebugPrint("PAGE CACHE: Destroy entry 0x%08x: file object "
@@ -3585,13 +3873,21 @@ Return Value:
     ASSERT((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_WAS_DIRTY) == 0);
     ASSERT(Entry->ListEntry.Next == NULL);
     ASSERT(Entry->ReferenceCount == 0);
-    ASSERT(Entry->Node.Parent == NULL);
+    ASSERT(Entry->Indexed == FALSE);
 
     //
-    // If this is the page owner, then free the physical page.
+    // If this is the page owner, then free the physical page. A borrowed page
+    // goes back to the device untouched.
     //
 
-    if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_OWNER) != 0) {
+    if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_BORROWED) != 0) {
+
+        ASSERT((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_MAPPED) == 0);
+
+        Entry->VirtualAddress = NULL;
+        Entry->PhysicalAddress = INVALID_PHYSICAL_ADDRESS;
+
+    } else if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_OWNER) != 0) {
         if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_MAPPED) != 0) {
 
             ASSERT(Entry->VirtualAddress != NULL);
@@ -3628,6 +3924,12 @@ Return Value:
         Entry->BackingEntry = NULL;
     }
 
+    if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_ACTIVE) != 0) {
+        RtlAtomicAdd(&IoPageCacheActiveEntryCount, (UINTN)-1);
+    }
+
+    RtlAtomicAdd(&IoPageCacheEntryCount, (UINTN)-1);
+
     //
     // Release the reference on the file object.
     //
@@ -3642,7 +3944,7 @@ Return Value:
     return;
 }
 
-VOID
+KSTATUS
 IopInsertPageCacheEntry (
     PPAGE_CACHE_ENTRY NewEntry,
     PPAGE_CACHE_ENTRY LinkEntry
@@ -3654,8 +3956,8 @@ Routine Description:
 
     This routine inserts the new page cache entry into the page cache and links
     it to the link entry once it is inserted. This routine assumes that the
-    page cache tree lock is held exclusively and that there is not already an
-    entry for the same file and offset in the tree.
+    file object lock is held exclusively and that there is not already an
+    entry for the same file and offset in the index.
 
 Arguments:
 
@@ -3667,26 +3969,41 @@ Routine Description:
 
 Return Value:
 
-    None.
+    Status code. On failure, the entry is not inserted or linked.
 
 --*/
 
 {
 
     ULONG ClearFlags;
+    PFILE_OBJECT FileObject;
     IO_OBJECT_TYPE LinkType;
     IO_OBJECT_TYPE NewType;
     ULONG OldFlags;
+    KSTATUS Status;
     PVOID VirtualAddress;
 
-    ASSERT(KeIsSharedExclusiveLockHeldExclusive(NewEntry->FileObject->Lock));
+    FileObject = NewEntry->FileObject;
+
+    ASSERT(KeIsSharedExclusiveLockHeldExclusive(FileObject->Lock));
+    ASSERT(NewEntry->Indexed == FALSE);
 
     //
-    // Insert the new entry into its file object's tree.
+    // Insert the new entry into its file object's index. The list lock is
+    // held while nodes are linked in, as dirty tags get set without the file
+    // object lock.
     //
 
-    RtlRedBlackTreeInsert(&(NewEntry->FileObject->PageCacheTree),
-                          &(NewEntry->Node));
+    Status = IopInsertPageCacheIndex(&(FileObject->PageCacheIndex),
+                                     PAGE_CACHE_INDEX_KEY(NewEntry->Offset),
+                                     NewEntry,
+                                     IoPageCacheListLock);
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    NewEntry->Indexed = TRUE;
 
     //
     // Now link the new entry to the supplied link entry based on their I/O
@@ -3764,6 +4081,18 @@ Return Value:
             }
         }
 
+    //
+    // A borrowed page stays the device's. It is not counted, its mapping is
+    // never torn down, and MM is not told about it since the device's page
+    // may be cached by more than one entry (e.g. a disk and its partition).
+    //
+
+    } else if ((NewEntry->Flags & PAGE_CACHE_ENTRY_FLAG_BORROWED) != 0) {
+
+        ASSERT(NewEntry->VirtualAddress != NULL);
+
+        NewEntry->Flags |= PAGE_CACHE_ENTRY_FLAG_OWNER;
+
     } else {
         if (NewEntry->VirtualAddress != NULL) {
             NewEntry->Flags |= PAGE_CACHE_ENTRY_FLAG_MAPPED;
@@ -3776,7 +4105,7 @@ Return Value:
                                               NewEntry);
     }
 
-    return;
+    return STATUS_SUCCESS;
 }
 
 PPAGE_CACHE_ENTRY
@@ -3809,20 +4138,16 @@ Return Value:
 {
 
     PPAGE_CACHE_ENTRY FoundEntry;
-    PRED_BLACK_TREE_NODE FoundNode;
-    PAGE_CACHE_ENTRY SearchEntry;
 
-    SearchEntry.FileObject = FileObject;
-    SearchEntry.Offset = Offset;
-    SearchEntry.Flags = 0;
-    FoundNode = RtlRedBlackTreeSearch(&(FileObject->PageCacheTree),
-                                      &(SearchEntry.Node));
+    FoundEntry = IopLookupPageCacheIndex(&(FileObject->PageCacheIndex),
+                                         PAGE_CACHE_INDEX_KEY(Offset));
 
-    if (FoundNode == NULL) {
+    if (FoundEntry == NULL) {
         return NULL;
     }
 
-    FoundEntry = RED_BLACK_TREE_VALUE(FoundNode, PAGE_CACHE_ENTRY, Node);
+    ASSERT(FoundEntry->Offset == Offset);
+
     IoPageCacheEntryAddReference(FoundEntry);
     return FoundEntry;
 }
@@ -3836,8 +4161,9 @@ IopPageCacheThread (
 
 Routine Description:
 
-    This routine cleans cached pages and removes clean pages if the cache is
-    consuming too much memory.
+    This routine removes clean pages if the cache is consuming too much
+    memory, and cleans the dirty pages of file objects that have no writeback
+    device of their own.
 
 Arguments:
 
@@ -3898,6 +4224,15 @@ Return Value:
 
         ASSERT(KSUCCESS(Status));
 
+        //
+        // On a memory warning, get every device flushing now so there are
+        // clean pages to evict.
+        //
+
+        if (SignalingObject != IoPageCacheWorkTimer) {
+            IopWakeWritebackThreads();
+        }
+
         //
         // The page cache cleaning is about to start. Mark down the current
         // time as the last time the cleaning ran. The leaves a record that an
@@ -3933,10 +4268,13 @@ Return Value:
             IopTrimPageCache(FALSE);
 
             //
-            // Flush some dirty file objects.
+            // Flush the dirty file objects no device thread is looking after.
             //
 
-            Status = IopFlushFileObjects(0, IO_FLAG_HARD_FLUSH_ALLOWED, NULL);
+            Status = IopFlushFileObjects(FLUSH_DEVICE_ID_UNOWNED,
+                                         IO_FLAG_HARD_FLUSH_ALLOWED,
+                                         NULL);
+
             if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_DIRTY_LISTS) != 0) {
                 IopCheckDirtyFileObjectsList();
             }
@@ -3955,9 +4293,7 @@ Return Value:
 
             KeCancelTimer(IoPageCacheWorkTimer);
             RtlAtomicExchange32(&IoPageCacheState, PageCacheStateClean);
-            if ((!LIST_EMPTY(&IoFileObjectsDirtyList)) ||
-                (IoPageCacheDirtyPageCount != 0)) {
-
+            if (IopHasDirtyFileObjects(FLUSH_DEVICE_ID_UNOWNED) != FALSE) {
                 IopSchedulePageCacheThread();
             }
 
@@ -4011,8 +4347,10 @@ Return Value:
     IO_CONTEXT IoContext;
     BOOL MarkedClean;
     ULONG OldFlags;
+    UINTN PageCount;
     ULONG PageSize;
     KSTATUS Status;
+    PWRITEBACK_DEVICE Writeback;
 
     CacheEntry = MmGetIoBufferPageCacheEntry(FlushBuffer, 0);
     FileObject = CacheEntry->FileObject;
@@ -4046,7 +4384,7 @@ Return Value:
         // Evicted entries should never be in a flush buffer.
         //
 
-        ASSERT(CacheEntry->Node.Parent != NULL);
+        ASSERT(CacheEntry->Indexed != FALSE);
 
         MarkedClean = IopMarkPageCacheEntryClean(CacheEntry, TRUE);
         if (MarkedClean != FALSE) {
@@ -4122,7 +4460,25 @@ Return Value:
     IoContext.Flags = Flags;
     IoContext.TimeoutInMilliseconds = WAIT_TIME_INDEFINITE;
     IoContext.Write = TRUE;
+
+    //
+    // Account for the pages in flight against the device they are going to.
+    //
+
+    Writeback = FileObject->Writeback;
+    PageCount = ALIGN_RANGE_UP(BytesToWrite, PageSize) >> MmPageShift();
+    if (Writeback != NULL) {
+        RtlAtomicAdd(&(Writeback->WritebackPageCount), PageCount);
+    }
+
     Status = IopPerformNonCachedWrite(FileObject, &IoContext, NULL);
+    if (Writeback != NULL) {
+        RtlAtomicAdd(&(Writeback->WritebackPageCount), -PageCount);
+        if (KSUCCESS(Status)) {
+            RtlAtomicAdd(&(Writeback->WrittenPageCount), PageCount);
+        }
+    }
+
     if (FileObject->Properties.Type == IoObjectBlockDevice) {
         KeAcquireSharedExclusiveLockShared(FileObject->Lock);
     }
@@ -4330,7 +4686,7 @@ Return Value:
         // If the page cache entry has not been evicted, potentially skip it.
         //
 
-        if (CacheEntry->Node.Parent != NULL) {
+        if (CacheEntry->Indexed != FALSE) {
 
             //
             // Remove anything with a reference to avoid iterating through it
@@ -4352,7 +4708,7 @@ Return Value:
                 RtlMemoryBarrier();
                 if (CacheEntry->ReferenceCount == 0) {
                     INSERT_BEFORE(&(CacheEntry->ListEntry),
-                                  &IoPageCacheCleanList);
+                                  PAGE_CACHE_ENTRY_CLEAN_LIST(CacheEntry));
                 }
 
                 continue;
@@ -4382,9 +4738,9 @@ Return Value:
         if (TimidEffort != FALSE) {
             if (KeTryToAcquireSharedExclusiveLockExclusive(Lock) == FALSE) {
                 LIST_REMOVE(&(CacheEntry->ListEntry));
-                if (CacheEntry->Node.Parent != NULL) {
+                if (CacheEntry->Indexed != FALSE) {
                     INSERT_BEFORE(&(CacheEntry->ListEntry),
-                                  &IoPageCacheCleanList);
+                                  PAGE_CACHE_ENTRY_CLEAN_LIST(CacheEntry));
 
                 } else {
                     INSERT_BEFORE(&(CacheEntry->ListEntry),
@@ -4419,7 +4775,7 @@ Return Value:
             // just mark it clean and grab the flags.
             //
 
-            if (CacheEntry->Node.Parent == NULL) {
+            if (CacheEntry->Indexed == FALSE) {
                 IopMarkPageCacheEntryClean(CacheEntry, FALSE);
                 RtlAtomicAnd32(&(CacheEntry->Flags),
                                ~PAGE_CACHE_ENTRY_FLAG_WAS_DIRTY);
@@ -4455,10 +4811,11 @@ Return Value:
                     } else if ((CacheEntry->Flags &
                                 PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0) {
 
-                        IopRemovePageCacheEntryFromTree(CacheEntry);
+                        IopRemovePageCacheEntryFromIndex(CacheEntry);
                         RtlAtomicAnd32(&(CacheEntry->Flags),
                                        ~PAGE_CACHE_ENTRY_FLAG_WAS_DIRTY);
 
+                        IopRecordPageCacheShadow(CacheEntry);
                         PageTakenDown = TRUE;
                     }
                 }
@@ -4503,7 +4860,7 @@ Return Value:
         // If the page cache has been evicted, move it to the removal list.
         //
 
-        } else if (CacheEntry->Node.Parent == NULL) {
+        } else if (CacheEntry->Indexed == FALSE) {
             MoveList = &IoPageCacheRemovalList;
 
         //
@@ -4517,7 +4874,7 @@ Return Value:
 
         } else {
             if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0) {
-                MoveList = &IoPageCacheCleanList;
+                MoveList = PAGE_CACHE_ENTRY_CLEAN_LIST(CacheEntry);
             }
         }
 
@@ -4580,6 +4937,7 @@ Return Value:
     UINTN MappedCleanPageCount;
     PLIST_ENTRY MoveList;
     ULONG PageSize;
+    BOOL Refilled;
     LIST_ENTRY ReturnList;
     UINTN TargetUnmapCount;
     UINTN UnmapCount;
@@ -4589,7 +4947,8 @@ Return Value:
 
     TargetUnmapCount = 0;
     FreeVirtualPages = -1;
-    if ((LIST_EMPTY(&IoPageCacheCleanList)) ||
+    if (((LIST_EMPTY(&IoPageCacheCleanList)) &&
+         (LIST_EMPTY(&IoPageCacheActiveList))) ||
         (IopIsPageCacheTooMapped(&FreeVirtualPages) == FALSE)) {
 
         return;
@@ -4647,18 +5006,42 @@ Return Value:
     }
 
     //
-    // Iterate over the clean LRU page cache list trying to unmap page cache
+    // Iterate over the inactive page cache list trying to unmap page cache
     // entries. Stop as soon as the target count has been reached.
     //
 
+    Refilled = FALSE;
     UnmapStart = NULL;
     UnmapSize = 0;
     UnmapCount = 0;
     PageSize = MmPageSize();
     KeAcquireQueuedLock(IoPageCacheListLock);
-    while ((!LIST_EMPTY(&IoPageCacheCleanList)) &&
-           ((TargetUnmapCount != UnmapCount) ||
-            (MmGetVirtualMemoryWarningLevel() != MemoryWarningLevelNone))) {
+    while ((TargetUnmapCount != UnmapCount) ||
+           (MmGetVirtualMemoryWarningLevel() != MemoryWarningLevelNone)) {
+
+        //
+        // If the inactive list runs dry, age what's still needed over from
+        // the active list. Only do this once, so that a list full of busy
+        // entries doesn't get cycled forever.
+        //
+
+        if (LIST_EMPTY(&IoPageCacheCleanList)) {
+            if ((Refilled != FALSE) || (LIST_EMPTY(&IoPageCacheActiveList))) {
+                break;
+            }
+
+            if (TargetUnmapCount > UnmapCount) {
+                IopDeactivatePageCacheEntries(TargetUnmapCount - UnmapCount);
+
+            } else {
+                IopDeactivatePageCacheEntries(
+                                       IoPageCacheHeadroomVirtualPagesRetreat -
+                                       IoPageCacheHeadroomVirtualPagesTrigger);
+            }
+
+            Refilled = TRUE;
+            continue;
+        }
 
         CurrentEntry = IoPageCacheCleanList.Next;
         CacheEntry = LIST_VALUE(CurrentEntry, PAGE_CACHE_ENTRY, ListEntry);
@@ -4681,7 +5064,8 @@ Return Value:
 
             RtlMemoryBarrier();
             if (CacheEntry->ReferenceCount == 0) {
-                INSERT_BEFORE(&(CacheEntry->ListEntry), &IoPageCacheCleanList);
+                INSERT_BEFORE(&(CacheEntry->ListEntry),
+                              PAGE_CACHE_ENTRY_CLEAN_LIST(CacheEntry));
             }
 
             continue;
@@ -4789,13 +5173,17 @@ Return Value:
         //
 
         MoveList = NULL;
-        if (CacheEntry->Node.Parent == NULL) {
+        if (CacheEntry->Indexed == FALSE) {
             MoveList = &IoPageCacheRemovalList;
 
         } else {
             if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0) {
-                if (((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_MAPPED) == 0) &&
-                    (CacheEntry->BackingEntry == NULL)) {
+                if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_ACTIVE) != 0) {
+                    MoveList = &IoPageCacheActiveList;
+
+                } else if (((CacheEntry->Flags &
+                             PAGE_CACHE_ENTRY_FLAG_MAPPED) == 0) &&
+                           (CacheEntry->BackingEntry == NULL)) {
 
                     MoveList = &IoPageCacheCleanUnmappedList;
 
@@ -4938,7 +5326,7 @@ Return Value:
         CacheEntry = MmGetIoBufferPageCacheEntry(IoBuffer, BufferOffset);
         if ((CacheEntry == NULL) ||
             (CacheEntry->FileObject != FileObject) ||
-            (CacheEntry->Node.Parent == NULL) ||
+            (CacheEntry->Indexed == FALSE) ||
             (CacheEntry->Offset != FileOffset)) {
 
             return FALSE;
@@ -5137,7 +5525,7 @@ Return Value:
 }
 
 VOID
-IopRemovePageCacheEntryFromTree (
+IopRemovePageCacheEntryFromIndex (
     PPAGE_CACHE_ENTRY Entry
     )
 
@@ -5145,8 +5533,9 @@ IopRemovePageCacheEntryFromTree (
 
 Routine Description:
 
-    This routine removes a page cache entry from the page cache tree. This
-    routine assumes that the page cache's tree lock is held exclusively.
+    This routine removes a page cache entry from its file object's page cache
+    index. This routine assumes that the file object lock is held exclusively
+    and that the page cache list lock is not held.
 
 Arguments:
 
@@ -5161,20 +5550,27 @@ Return Value:
 {
 
     ASSERT(KeIsSharedExclusiveLockHeldExclusive(Entry->FileObject->Lock));
-    ASSERT(Entry->Node.Parent != NULL);
+    ASSERT(Entry->Indexed != FALSE);
 
     //
     // If a backing entry exists, then MM needs to know that the backing entry
     // now owns the page. It may have always been the owner, but just make sure.
+    // MM is never told about borrowed pages.
     //
 
-    if (Entry->BackingEntry != NULL) {
+    if ((Entry->BackingEntry != NULL) &&
+        ((Entry->BackingEntry->Flags &
+          PAGE_CACHE_ENTRY_FLAG_BORROWED) == 0)) {
+
         MmSetPageCacheEntryForPhysicalAddress(Entry->PhysicalAddress,
                                               Entry->BackingEntry);
     }
 
-    RtlRedBlackTreeRemove(&(Entry->FileObject->PageCacheTree), &(Entry->Node));
-    Entry->Node.Parent = NULL;
+    IopDeletePageCacheIndex(&(Entry->FileObject->PageCacheIndex),
+                            PAGE_CACHE_INDEX_KEY(Entry->Offset),
+                            IoPageCacheListLock);
+
+    Entry->Indexed = FALSE;
     if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_EVICTION) != 0) {
         RtlDebugPrint("PAGE CACHE: Remove PAGE_CACHE_ENTRY 0x%08x: FILE_OBJECT "
                       "0x%08x, offset 0x%I64x, physical address "
@@ -5201,8 +5597,10 @@ IopUpdatePageCacheEntryList (
 Routine Description:
 
     This routine updates a page cache entry's list entry by putting it on the
-    appropriate list. This should be used when a page cache entry is looked up
-    or when it is created.
+    appropriate list. This should be used when a page cache entry is created,
+    or when an existing entry may need to move off of the clean unmapped list.
+    It does not count as a use of the page; see
+    IopMarkPageCacheEntryAccessed for that.
 
 Arguments:
 
@@ -5220,13 +5618,25 @@ Return Value:
 
 {
 
+    BOOL Activate;
+
+    //
+    // A new entry whose page was evicted recently enough goes straight to the
+    // active list. Check the shadow entries before acquiring the list lock.
+    //
+
+    Activate = FALSE;
+    if (Created != FALSE) {
+        Activate = IopCheckPageCacheShadow(Entry);
+    }
+
     KeAcquireQueuedLock(IoPageCacheListLock);
 
     //
     // If the page cache entry is not new, then it might already be on a
-    // list. If it's on a clean list, move it to the back. If it's clean
-    // and not on a list, then it probably got ripped off the list because
-    // there are references on it.
+    // list. If it's on a clean list, move it to the back of the list it
+    // belongs on. If it's clean and not on a list, then it probably got ripped
+    // off the list because there are references on it.
     //
 
     if (Created == FALSE) {
@@ -5242,12 +5652,14 @@ Return Value:
             (Entry->ListEntry.Next != NULL)) {
 
             LIST_REMOVE(&(Entry->ListEntry));
-            INSERT_BEFORE(&(Entry->ListEntry), &IoPageCacheCleanList);
+            INSERT_BEFORE(&(Entry->ListEntry),
+                          PAGE_CACHE_ENTRY_CLEAN_LIST(Entry));
         }
 
     //
-    // New pages do not start on a list. Stick it on the back of the clean
-    // list.
+    // New pages do not start on a list. Stick it on the back of the inactive
+    // list, where it has to be used again to earn a place on the active list,
+    // unless it just came back from being evicted.
     //
 
     } else {
@@ -5255,13 +5667,312 @@ Return Value:
         ASSERT(Entry->ListEntry.Next == NULL);
         ASSERT((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0);
 
+        if (Activate != FALSE) {
+            RtlAtomicOr32(&(Entry->Flags), PAGE_CACHE_ENTRY_FLAG_ACTIVE);
+            RtlAtomicAdd(&IoPageCacheActiveEntryCount, 1);
+        }
+
+        INSERT_BEFORE(&(Entry->ListEntry), PAGE_CACHE_ENTRY_CLEAN_LIST(Entry));
+    }
+
+    KeReleaseQueuedLock(IoPageCacheListLock);
+    return;
+}
+
+VOID
+IopMarkPageCacheEntryAccessed (
+    PPAGE_CACHE_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records a use of the given page cache entry. The first use of
+    an inactive entry only marks it referenced. A second use moves it to the
+    active list, so that a single pass over a large file cannot push out
+    pages that are used over and over. Uses of active entries only mark them
+    referenced, which gives them another trip around the active list when it
+    is aged.
+
+Arguments:
+
+    Entry - Supplies a pointer to the page cache entry that was used.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Flags;
+
+    //
+    // Most uses do not need the list lock at all.
+    //
+
+    Flags = Entry->Flags;
+    if (((Flags & PAGE_CACHE_ENTRY_FLAG_ACTIVE) != 0) ||
+        ((Flags & PAGE_CACHE_ENTRY_FLAG_REFERENCED) == 0)) {
+
+        if ((Flags & PAGE_CACHE_ENTRY_FLAG_REFERENCED) == 0) {
+            RtlAtomicOr32(&(Entry->Flags), PAGE_CACHE_ENTRY_FLAG_REFERENCED);
+        }
+
+        return;
+    }
+
+    //
+    // This is the second use of an inactive entry. Activate it. If it's
+    // dirty or off of the lists because it has references, it will be put on
+    // the active list when it's cleaned or released.
+    //
+
+    KeAcquireQueuedLock(IoPageCacheListLock);
+    if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_ACTIVE) == 0) {
+        RtlAtomicAnd32(&(Entry->Flags), ~PAGE_CACHE_ENTRY_FLAG_REFERENCED);
+        RtlAtomicOr32(&(Entry->Flags), PAGE_CACHE_ENTRY_FLAG_ACTIVE);
+        RtlAtomicAdd(&IoPageCacheActiveEntryCount, 1);
+        if (((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0) &&
+            (Entry->ListEntry.Next != NULL)) {
+
+            LIST_REMOVE(&(Entry->ListEntry));
+            INSERT_BEFORE(&(Entry->ListEntry), &IoPageCacheActiveList);
+        }
+    }
+
+    KeReleaseQueuedLock(IoPageCacheListLock);
+    return;
+}
+
+VOID
+IopDeactivatePageCacheEntries (
+    UINTN Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine ages entries off the front of the active list onto the back
+    of the inactive list. Entries that were referenced since they were last
+    looked at get another trip around the active list instead. The list lock
+    must already be held.
+
+Arguments:
+
+    Count - Supplies the number of entries to move to the inactive list.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPAGE_CACHE_ENTRY Entry;
+    UINTN ScanCount;
+
+    ASSERT(KeIsQueuedLockHeld(IoPageCacheListLock) != FALSE);
+
+    //
+    // Every entry on the active list is counted as active, so after scanning
+    // that many the referenced bits have all been cleared once. Don't go
+    // around forever if other threads keep setting them.
+    //
+
+    ScanCount = IoPageCacheActiveEntryCount + Count;
+    while ((Count != 0) &&
+           (ScanCount != 0) &&
+           (!LIST_EMPTY(&IoPageCacheActiveList))) {
+
+        ScanCount -= 1;
+        Entry = LIST_VALUE(IoPageCacheActiveList.Next,
+                           PAGE_CACHE_ENTRY,
+                           ListEntry);
+
+        ASSERT((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_ACTIVE) != 0);
+
+        LIST_REMOVE(&(Entry->ListEntry));
+        if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_REFERENCED) != 0) {
+            RtlAtomicAnd32(&(Entry->Flags), ~PAGE_CACHE_ENTRY_FLAG_REFERENCED);
+            INSERT_BEFORE(&(Entry->ListEntry), &IoPageCacheActiveList);
+            continue;
+        }
+
+        RtlAtomicAnd32(&(Entry->Flags), ~PAGE_CACHE_ENTRY_FLAG_ACTIVE);
+        RtlAtomicAdd(&IoPageCacheActiveEntryCount, -1);
         INSERT_BEFORE(&(Entry->ListEntry), &IoPageCacheCleanList);
+        Count -= 1;
+    }
+
+    return;
+}
+
+VOID
+IopBalancePageCacheLists (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine ages entries from the active list to the inactive list until
+    the active list holds no more than its share of the page cache entries.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN ActiveLimit;
+
+    ActiveLimit = IoPageCacheEntryCount >> PAGE_CACHE_ACTIVE_SHIFT;
+    if (IoPageCacheActiveEntryCount <= ActiveLimit) {
+        return;
+    }
+
+    KeAcquireQueuedLock(IoPageCacheListLock);
+    if (IoPageCacheActiveEntryCount > ActiveLimit) {
+        IopDeactivatePageCacheEntries(IoPageCacheActiveEntryCount -
+                                      ActiveLimit);
     }
 
     KeReleaseQueuedLock(IoPageCacheListLock);
+    if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_SIZE_MANAGEMENT) != 0) {
+        RtlDebugPrint("PAGE CACHE: Balanced lists: %lu of %lu entries "
+                      "active.\n",
+                      IoPageCacheActiveEntryCount,
+                      IoPageCacheEntryCount);
+    }
+
     return;
 }
 
+VOID
+IopRecordPageCacheShadow (
+    PPAGE_CACHE_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine leaves a shadow entry behind for a page cache entry that is
+    being evicted, and advances the eviction clock.
+
+Arguments:
+
+    Entry - Supplies a pointer to the page cache entry being evicted.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Clock;
+    PFILE_OBJECT FileObject;
+    ULONGLONG Hash;
+    UINTN Slot;
+
+    FileObject = Entry->FileObject;
+    Hash = PAGE_CACHE_SHADOW_HASH(FileObject->Properties.DeviceId,
+                                  FileObject->Properties.FileId,
+                                  PAGE_CACHE_INDEX_KEY(Entry->Offset));
+
+    Slot = (UINTN)(Hash ^ (Hash >> 29)) & IoPageCacheShadowMask;
+    Clock = RtlAtomicAdd32(&IoPageCacheEvictionCount, 1);
+    RtlAtomicExchange64((PULONGLONG)&(IoPageCacheShadows[Slot]),
+                        (Hash & 0xFFFFFFFF00000000ULL) | Clock);
+
+    return;
+}
+
+BOOL
+IopCheckPageCacheShadow (
+    PPAGE_CACHE_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks for a shadow entry left behind when the page for the
+    given new page cache entry was last evicted. The page has been refaulted
+    if one is found. If fewer pages were evicted since then than there are
+    active entries, the page would have stayed cached had it been on the
+    active list, so it should go there now.
+
+Arguments:
+
+    Entry - Supplies a pointer to the newly created page cache entry.
+
+Return Value:
+
+    TRUE if the entry should start out on the active list.
+
+    FALSE if the entry should start out on the inactive list.
+
+--*/
+
+{
+
+    ULONG Distance;
+    PFILE_OBJECT FileObject;
+    ULONGLONG Hash;
+    ULONGLONG Shadow;
+    UINTN Slot;
+
+    FileObject = Entry->FileObject;
+    Hash = PAGE_CACHE_SHADOW_HASH(FileObject->Properties.DeviceId,
+                                  FileObject->Properties.FileId,
+                                  PAGE_CACHE_INDEX_KEY(Entry->Offset));
+
+    Slot = (UINTN)(Hash ^ (Hash >> 29)) & IoPageCacheShadowMask;
+    Shadow = RtlAtomicOr64((PULONGLONG)&(IoPageCacheShadows[Slot]), 0);
+    if ((Shadow == 0) ||
+        ((Shadow & 0xFFFFFFFF00000000ULL) !=
+         (Hash & 0xFFFFFFFF00000000ULL))) {
+
+        return FALSE;
+    }
+
+    //
+    // Consume the shadow entry so that it only counts once. Losing a race
+    // with another thread here just means the refault isn't counted.
+    //
+
+    if (RtlAtomicCompareExchange64((PULONGLONG)&(IoPageCacheShadows[Slot]),
+                                   0,
+                                   Shadow) != Shadow) {
+
+        return FALSE;
+    }
+
+    RtlAtomicAdd64((PULONGLONG)&IoPageCacheRefaultPageCount, 1);
+    Distance = IoPageCacheEvictionCount - (ULONG)Shadow;
+    if (Distance > IoPageCacheActiveEntryCount) {
+        return FALSE;
+    }
+
+    RtlAtomicAdd64((PULONGLONG)&IoPageCacheRefaultActivatePageCount, 1);
+    return TRUE;
+}
+
 BOOL
 IopIsPageCacheTooBig (
     PUINTN FreePhysicalPages
@@ -5404,7 +6115,8 @@ Return Value:
 
     PLIST_ENTRY CurrentEntry;
     PPAGE_CACHE_ENTRY Entry;
-    PRED_BLACK_TREE_NODE TreeNode;
+    PPAGE_CACHE_INDEX Index;
+    ULONGLONG Key;
 
     //
     // This routine produces a lot of false negatives for block devices because
@@ -5417,10 +6129,27 @@ Return Value:
 
     KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
     KeAcquireQueuedLock(IoPageCacheListLock);
-    TreeNode = RtlRedBlackTreeGetLowestNode(&(FileObject->PageCacheTree));
-    while (TreeNode != NULL) {
-        Entry = RED_BLACK_TREE_VALUE(TreeNode, PAGE_CACHE_ENTRY, Node);
+    Index = &(FileObject->PageCacheIndex);
+    Key = 0;
+    while (TRUE) {
+        Entry = IopFindPageCacheIndex(Index, Key);
+        if (Entry == NULL) {
+            break;
+        }
+
+        Key = PAGE_CACHE_INDEX_KEY(Entry->Offset) + 1;
         if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) != 0) {
+            if (IopIsPageCacheIndexTagged(Index,
+                                          Key - 1,
+                                          PageCacheIndexTagDirty) == FALSE) {
+
+                RtlDebugPrint("PAGE_CACHE_ENTRY 0x%x for FILE_OBJECT 0x%x "
+                              "Offset 0x%I64x dirty but not tagged.\n",
+                              Entry,
+                              FileObject,
+                              Entry->Offset);
+            }
+
             if (Entry->ListEntry.Next == NULL) {
                 RtlDebugPrint("PAGE_CACHE_ENTRY 0x%x for FILE_OBJECT 0x%x "
                               "Offset 0x%I64x dirty but not in list.\n",
@@ -5446,10 +6175,6 @@ Return Value:
                 }
             }
         }
-
-        TreeNode = RtlRedBlackTreeGetNextNode(&(FileObject->PageCacheTree),
-                                              FALSE,
-                                              TreeNode);
     }
 
     KeReleaseQueuedLock(IoPageCacheListLock);
@@ -51,6 +51,30 @@ Module Name:
 
 extern LIST_ENTRY IoFileObjectsDirtyList;
 
+//
+// Store the interval, in time ticks, that flushers wait to let writes pool.
+//
+
+extern ULONGLONG IoPageCacheCleanInterval;
+
+//
+// Store the read-ahead counters, in pages: the number of pages read ahead,
+// the number of those later consumed by sequential reads, and the number
+// abandoned when the reader stopped being sequential.
+//
+
+extern volatile ULONGLONG IoReadAheadPageCount;
+extern volatile ULONGLONG IoReadAheadHitPageCount;
+extern volatile ULONGLONG IoReadAheadWastePageCount;
+
+//
+// Store the number of pages cached reads found in the cache and the number
+// they had to read in.
+//
+
+extern volatile ULONGLONG IoPageCacheReadHitPageCount;
+extern volatile ULONGLONG IoPageCacheReadMissPageCount;
+
 //
 // -------------------------------------------------------- Function Prototypes
 //
@@ -79,7 +103,8 @@ Return Value:
 PPAGE_CACHE_ENTRY
 IopLookupPageCacheEntry (
     PFILE_OBJECT FileObject,
-    IO_OFFSET Offset
+    IO_OFFSET Offset,
+    BOOL MarkAccessed
     );
 
 /*++
@@ -95,6 +120,11 @@ Routine Description:
 
     Offset - Supplies an offset into the file or device.
 
+    MarkAccessed - Supplies a boolean indicating whether or not the lookup
+        counts as a use of the page for the purposes of eviction. Supply FALSE
+        for lookups on behalf of read-ahead, or for a page the caller already
+        counted.
+
 Return Value:
 
     Returns a pointer to the found page cache entry on success, or NULL on
@@ -109,6 +139,7 @@ IopCreateOrLookupPageCacheEntry (
     PHYSICAL_ADDRESS PhysicalAddress,
     IO_OFFSET Offset,
     PPAGE_CACHE_ENTRY LinkEntry,
+    BOOL Borrowed,
     PBOOL EntryCreated
     );
 
@@ -137,6 +168,10 @@ Routine Description:
         to share the physical address with this new page cache entry if it gets
         inserted.
 
+    Borrowed - Supplies a boolean indicating whether the physical page was
+        lent by the device. A new entry then caches the page in place, but
+        never frees it.
+
     EntryCreated - Supplies an optional pointer that receives a boolean
         indicating whether or not a new page cache entry was created.
 
@@ -442,7 +477,8 @@ IopCopyIoBufferToPageCacheEntry (
     ULONG PageOffset,
     PIO_BUFFER SourceBuffer,
     UINTN SourceOffset,
-    ULONG ByteCount
+    ULONG ByteCount,
+    BOOL MarkDirty
     );
 
 /*++
@@ -466,6 +502,10 @@ Routine Description:
 
     ByteCount - Supplies the number of bytes to copy.
 
+    MarkDirty - Supplies a boolean indicating whether the entry should be
+        marked dirty after the copy. Supply FALSE if the backing storage
+        already holds the copied data.
+
 Return Value:
 
     Status code.
@@ -559,7 +599,7 @@ Return Value:
 
 BOOL
 IopIsPageCacheTooDirty (
-    VOID
+    PWRITEBACK_DEVICE Writeback
     );
 
 /*++
@@ -572,7 +612,10 @@ Routine Description:
 
 Arguments:
 
-    None.
+    Writeback - Supplies an optional pointer to the writeback state of the
+        device about to be dirtied. If supplied, the device's share of the
+        dirty limit is checked as well once the page cache is half way to its
+        limit.
 
 Return Value:
 
@@ -583,35 +626,435 @@ Return Value:
 
 --*/
 
-COMPARISON_RESULT
-IopComparePageCacheEntries (
-    PRED_BLACK_TREE Tree,
-    PRED_BLACK_TREE_NODE FirstNode,
-    PRED_BLACK_TREE_NODE SecondNode
+UINTN
+IopGetPageCacheDirtyLimit (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines the maximum number of dirty pages the page cache
+    should hold, based on its ideal size.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the system-wide dirty page limit.
+
+--*/
+
+KSTATUS
+IopInitializeWriteback (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes support for per-device page cache writeback.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+IopGetWritebackDevice (
+    PDEVICE Device,
+    PWRITEBACK_DEVICE *Writeback
+    );
+
+/*++
+
+Routine Description:
+
+    This routine looks up or creates the writeback state for the device that
+    stores the given device's data, and takes a reference on it. Volumes are
+    backed by their target device.
+
+Arguments:
+
+    Device - Supplies a pointer to the device or volume that owns a file
+        object.
+
+    Writeback - Supplies a pointer where a pointer to the writeback state will
+        be returned on success. The caller is responsible for releasing the
+        reference.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VOID
+IopWritebackDeviceReleaseReference (
+    PWRITEBACK_DEVICE Writeback
+    );
+
+/*++
+
+Routine Description:
+
+    This routine releases a reference on a writeback device. When the last
+    file object using it goes away, its flusher thread is told to exit and
+    destroy it.
+
+Arguments:
+
+    Writeback - Supplies a pointer to the writeback device.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+IopScheduleWriteback (
+    PFILE_OBJECT FileObject
+    );
+
+/*++
+
+Routine Description:
+
+    This routine schedules the flusher responsible for the given file object
+    to run some time in the future. File objects without a writeback device
+    are left to the page cache thread.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object that was dirtied.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+IopWakeWritebackThreads (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine wakes every writeback thread to flush its device now,
+    rather than waiting for writes to pool.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+UINTN
+IopGetWritebackDirtyLimit (
+    PWRITEBACK_DEVICE Writeback,
+    UINTN DirtyLimit
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines how many dirty pages the given device may hold
+    before writers to it get throttled. Each device gets a share of the
+    system-wide limit proportional to how fast it has recently been writing.
+
+Arguments:
+
+    Writeback - Supplies a pointer to the writeback device.
+
+    DirtyLimit - Supplies the system-wide dirty page limit.
+
+Return Value:
+
+    Returns the device's dirty page limit.
+
+--*/
+
+VOID
+IopInitializePageCacheIndex (
+    PPAGE_CACHE_INDEX Index
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes an empty page cache index.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to initialize.
+
+Return Value:
+
+    None.
+
+--*/
+
+PVOID
+IopLookupPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the value stored in the page cache index at the given
+    key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to search.
+
+    Key - Supplies the page number to look up.
+
+Return Value:
+
+    Returns the value stored at the given key, or NULL if there is none.
+
+--*/
+
+PVOID
+IopFindPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the value in the page cache index with the lowest key
+    greater than or equal to the given key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to search.
+
+    Key - Supplies the page number to start searching at.
+
+Return Value:
+
+    Returns the first value at or after the given key, or NULL if there is
+    none.
+
+--*/
+
+PVOID
+IopFindTaggedPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PAGE_CACHE_INDEX_TAG Tag
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the value in the page cache index with the lowest key
+    greater than or equal to the given key that has the given tag set. Whole
+    untagged subtrees are skipped without being visited.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to search.
+
+    Key - Supplies the page number to start searching at.
+
+    Tag - Supplies the tag to search for.
+
+Return Value:
+
+    Returns the first tagged value at or after the given key, or NULL if there
+    is none.
+
+--*/
+
+KSTATUS
+IopInsertPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PVOID Value,
+    PQUEUED_LOCK Lock
     );
 
 /*++
 
 Routine Description:
 
-    This routine compares two Red-Black tree nodes contained inside file
-    objects.
+    This routine inserts a value into the page cache index. The caller must
+    have exclusive access to the index, and there must not already be a value
+    at the given key.
 
 Arguments:
 
-    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+    Index - Supplies a pointer to the index to insert into.
 
-    FirstNode - Supplies a pointer to the left side of the comparison.
+    Key - Supplies the page number to insert at.
 
-    SecondNode - Supplies a pointer to the second side of the comparison.
+    Value - Supplies the value to store. This must not be NULL.
+
+    Lock - Supplies an optional pointer to the lock that synchronizes tag
+        updates. It is held while the shape of the index changes, but not
+        while memory is allocated.
 
 Return Value:
 
-    Same if the two nodes have the same value.
+    STATUS_SUCCESS on success.
 
-    Ascending if the first node is less than the second node.
+    STATUS_INSUFFICIENT_RESOURCES if a node could not be allocated.
 
-    Descending if the second node is less than the first node.
+--*/
+
+PVOID
+IopDeletePageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PQUEUED_LOCK Lock
+    );
+
+/*++
+
+Routine Description:
+
+    This routine removes the value at the given key from the page cache index,
+    clearing its tags and freeing any nodes left empty. The caller must have
+    exclusive access to the index.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to remove from.
+
+    Key - Supplies the page number to remove.
+
+    Lock - Supplies an optional pointer to the lock that synchronizes tag
+        updates. It is held while the shape of the index changes, but not
+        while memory is freed.
+
+Return Value:
+
+    Returns the value that was removed, or NULL if there was none.
+
+--*/
+
+VOID
+IopSetPageCacheIndexTag (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PVOID Value,
+    PAGE_CACHE_INDEX_TAG Tag
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets a tag on the given key in the page cache index and on
+    every node above it. The caller must hold the lock that synchronizes tag
+    updates, but only needs the file object lock if the value could otherwise
+    be removed from the index.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number to tag.
+
+    Value - Supplies the value expected at the key. Nothing is tagged if the
+        key holds something else.
+
+    Tag - Supplies the tag to set.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+IopClearPageCacheIndexTag (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PVOID Value,
+    PAGE_CACHE_INDEX_TAG Tag
+    );
+
+/*++
+
+Routine Description:
+
+    This routine clears a tag on the given key in the page cache index, and on
+    each node above it that no longer has anything tagged beneath it. The
+    caller must hold the lock that synchronizes tag updates.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number to clear the tag on.
+
+    Value - Supplies the value expected at the key. Nothing is cleared if the
+        key holds something else.
+
+    Tag - Supplies the tag to clear.
+
+Return Value:
+
+    None.
+
+--*/
+
+BOOL
+IopIsPageCacheIndexTagged (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PAGE_CACHE_INDEX_TAG Tag
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given key in the page cache index has
+    the given tag set.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number to query.
+
+    Tag - Supplies the tag to test.
+
+Return Value:
+
+    TRUE if the key is present and tagged.
+
+    FALSE otherwise.
 
 --*/
 
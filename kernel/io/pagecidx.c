@@ -0,0 +1,879 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    pagecidx.c
+
+Abstract:
+
+    This module implements the radix index that maps page numbers within a
+    file object to page cache entries.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+#include "pagecach.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define PAGE_CACHE_INDEX_ALLOCATION_TAG 0x78496350 // 'xIcP'
+
+//
+// Define the maximum number of levels an index can have, which is enough to
+// resolve every bit of a 64-bit key.
+//
+
+#define PAGE_CACHE_INDEX_MAX_HEIGHT \
+    ((64 + PAGE_CACHE_INDEX_SHIFT - 1) / PAGE_CACHE_INDEX_SHIFT)
+
+//
+// This macro evaluates to non-zero if the given key falls within the range
+// covered by the given node.
+//
+
+#define PAGE_CACHE_INDEX_NODE_COVERS(_Node, _Key)                   \
+    ((((_Node)->Shift + PAGE_CACHE_INDEX_SHIFT) >= 64) ||           \
+     (((_Key) >> ((_Node)->Shift + PAGE_CACHE_INDEX_SHIFT)) == 0))
+
+//
+// This macro returns the slot within the given node that the given key
+// passes through.
+//
+
+#define PAGE_CACHE_INDEX_SLOT(_Node, _Key) \
+    ((ULONG)((_Key) >> (_Node)->Shift) & PAGE_CACHE_INDEX_MASK)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+PPAGE_CACHE_INDEX_NODE
+IopGetPageCacheIndexLeaf (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    );
+
+PVOID
+IopSearchPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PAGE_CACHE_INDEX_TAG Tag
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+VOID
+IopInitializePageCacheIndex (
+    PPAGE_CACHE_INDEX Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes an empty page cache index.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to initialize.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Index->Root = NULL;
+    return;
+}
+
+PVOID
+IopLookupPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the value stored in the page cache index at the given
+    key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to search.
+
+    Key - Supplies the page number to look up.
+
+Return Value:
+
+    Returns the value stored at the given key, or NULL if there is none.
+
+--*/
+
+{
+
+    PPAGE_CACHE_INDEX_NODE Leaf;
+
+    Leaf = IopGetPageCacheIndexLeaf(Index, Key);
+    if (Leaf == NULL) {
+        return NULL;
+    }
+
+    return Leaf->Slots[PAGE_CACHE_INDEX_SLOT(Leaf, Key)];
+}
+
+PVOID
+IopFindPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the value in the page cache index with the lowest key
+    greater than or equal to the given key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to search.
+
+    Key - Supplies the page number to start searching at.
+
+Return Value:
+
+    Returns the first value at or after the given key, or NULL if there is
+    none.
+
+--*/
+
+{
+
+    return IopSearchPageCacheIndex(Index, Key, PageCacheIndexTagCount);
+}
+
+PVOID
+IopFindTaggedPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PAGE_CACHE_INDEX_TAG Tag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the value in the page cache index with the lowest key
+    greater than or equal to the given key that has the given tag set. Whole
+    untagged subtrees are skipped without being visited.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to search.
+
+    Key - Supplies the page number to start searching at.
+
+    Tag - Supplies the tag to search for.
+
+Return Value:
+
+    Returns the first tagged value at or after the given key, or NULL if there
+    is none.
+
+--*/
+
+{
+
+    ASSERT(Tag < PageCacheIndexTagCount);
+
+    return IopSearchPageCacheIndex(Index, Key, Tag);
+}
+
+KSTATUS
+IopInsertPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PVOID Value,
+    PQUEUED_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine inserts a value into the page cache index. The caller must
+    have exclusive access to the index, and there must not already be a value
+    at the given key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to insert into.
+
+    Key - Supplies the page number to insert at.
+
+    Value - Supplies the value to store. This must not be NULL.
+
+    Lock - Supplies an optional pointer to the lock that synchronizes tag
+        updates. It is held while the shape of the index changes, but not
+        while memory is allocated.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if a node could not be allocated.
+
+--*/
+
+{
+
+    PPAGE_CACHE_INDEX_NODE Child;
+    ULONG Needed;
+    PPAGE_CACHE_INDEX_NODE NewNodes[PAGE_CACHE_INDEX_MAX_HEIGHT * 2];
+    PPAGE_CACHE_INDEX_NODE Node;
+    ULONG RootShift;
+    ULONG Shift;
+    ULONG Slot;
+    KSTATUS Status;
+    ULONG Tag;
+    ULONG Used;
+
+    ASSERT(Value != NULL);
+
+    //
+    // Figure out the shift of the smallest root that covers the key.
+    //
+
+    Shift = 0;
+    while (((Shift + PAGE_CACHE_INDEX_SHIFT) < 64) &&
+           ((Key >> (Shift + PAGE_CACHE_INDEX_SHIFT)) != 0)) {
+
+        Shift += PAGE_CACHE_INDEX_SHIFT;
+    }
+
+    //
+    // Count the nodes that are going to be needed: new levels on top of the
+    // existing root plus anything missing along the key's path. Allocate them
+    // all up front so that nothing is allocated with the lock held.
+    //
+
+    Node = Index->Root;
+    if (Node == NULL) {
+        Needed = (Shift / PAGE_CACHE_INDEX_SHIFT) + 1;
+
+    } else {
+        RootShift = Node->Shift;
+        if (Shift < RootShift) {
+            Shift = RootShift;
+        }
+
+        Needed = (Shift - RootShift) / PAGE_CACHE_INDEX_SHIFT;
+
+        //
+        // A key beyond the current root lives entirely under new nodes.
+        //
+
+        if (!PAGE_CACHE_INDEX_NODE_COVERS(Node, Key)) {
+            Needed += Shift / PAGE_CACHE_INDEX_SHIFT;
+
+        } else {
+            while (Node->Shift != 0) {
+                Child = Node->Slots[PAGE_CACHE_INDEX_SLOT(Node, Key)];
+                if (Child == NULL) {
+                    Needed += Node->Shift / PAGE_CACHE_INDEX_SHIFT;
+                    break;
+                }
+
+                Node = Child;
+            }
+        }
+    }
+
+    ASSERT(Needed <= (PAGE_CACHE_INDEX_MAX_HEIGHT * 2));
+
+    for (Used = 0; Used < Needed; Used += 1) {
+        Node = MmAllocateNonPagedPool(sizeof(PAGE_CACHE_INDEX_NODE),
+                                      PAGE_CACHE_INDEX_ALLOCATION_TAG);
+
+        if (Node == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto InsertPageCacheIndexEnd;
+        }
+
+        RtlZeroMemory(Node, sizeof(PAGE_CACHE_INDEX_NODE));
+        NewNodes[Used] = Node;
+    }
+
+    Used = 0;
+    if (Lock != NULL) {
+        KeAcquireQueuedLock(Lock);
+    }
+
+    if (Index->Root == NULL) {
+        Node = NewNodes[Used];
+        Used += 1;
+        Node->Shift = Shift;
+        Index->Root = Node;
+    }
+
+    //
+    // Grow the index upwards until the root covers the key. The old root
+    // becomes the first child of the new one, carrying its tags with it.
+    //
+
+    while (Index->Root->Shift < Shift) {
+        Child = Index->Root;
+        Node = NewNodes[Used];
+        Used += 1;
+        Node->Shift = Child->Shift + PAGE_CACHE_INDEX_SHIFT;
+        Node->Slots[0] = Child;
+        Node->Present = 1;
+        for (Tag = 0; Tag < PageCacheIndexTagCount; Tag += 1) {
+            if (Child->Tags[Tag] != 0) {
+                Node->Tags[Tag] = 1;
+            }
+        }
+
+        Child->Parent = Node;
+        Child->ParentSlot = 0;
+        Index->Root = Node;
+    }
+
+    //
+    // Walk down to the leaf, filling in any missing levels along the way.
+    //
+
+    Node = Index->Root;
+    while (Node->Shift != 0) {
+        Slot = PAGE_CACHE_INDEX_SLOT(Node, Key);
+        Child = Node->Slots[Slot];
+        if (Child == NULL) {
+            Child = NewNodes[Used];
+            Used += 1;
+            Child->Parent = Node;
+            Child->ParentSlot = Slot;
+            Child->Shift = Node->Shift - PAGE_CACHE_INDEX_SHIFT;
+            Node->Slots[Slot] = Child;
+            Node->Present |= 1ULL << Slot;
+        }
+
+        Node = Child;
+    }
+
+    Slot = PAGE_CACHE_INDEX_SLOT(Node, Key);
+
+    ASSERT(Node->Slots[Slot] == NULL);
+
+    Node->Slots[Slot] = Value;
+    Node->Present |= 1ULL << Slot;
+    if (Lock != NULL) {
+        KeReleaseQueuedLock(Lock);
+    }
+
+    ASSERT(Used == Needed);
+
+    Status = STATUS_SUCCESS;
+
+InsertPageCacheIndexEnd:
+    if (!KSUCCESS(Status)) {
+        while (Used != 0) {
+            Used -= 1;
+            MmFreeNonPagedPool(NewNodes[Used]);
+        }
+    }
+
+    return Status;
+}
+
+PVOID
+IopDeletePageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PQUEUED_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes the value at the given key from the page cache index,
+    clearing its tags and freeing any nodes left empty. The caller must have
+    exclusive access to the index.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to remove from.
+
+    Key - Supplies the page number to remove.
+
+    Lock - Supplies an optional pointer to the lock that synchronizes tag
+        updates. It is held while the shape of the index changes, but not
+        while memory is freed.
+
+Return Value:
+
+    Returns the value that was removed, or NULL if there was none.
+
+--*/
+
+{
+
+    PPAGE_CACHE_INDEX_NODE Child;
+    ULONG FreeCount;
+    PPAGE_CACHE_INDEX_NODE FreeNodes[PAGE_CACHE_INDEX_MAX_HEIGHT * 2];
+    PPAGE_CACHE_INDEX_NODE Node;
+    PPAGE_CACHE_INDEX_NODE Parent;
+    ULONG Slot;
+    ULONG Tag;
+    PVOID Value;
+
+    Node = IopGetPageCacheIndexLeaf(Index, Key);
+    if (Node == NULL) {
+        return NULL;
+    }
+
+    Slot = PAGE_CACHE_INDEX_SLOT(Node, Key);
+    Value = Node->Slots[Slot];
+    if (Value == NULL) {
+        return NULL;
+    }
+
+    FreeCount = 0;
+    if (Lock != NULL) {
+        KeAcquireQueuedLock(Lock);
+    }
+
+    for (Tag = 0; Tag < PageCacheIndexTagCount; Tag += 1) {
+        IopClearPageCacheIndexTag(Index, Key, Value, Tag);
+    }
+
+    Node->Slots[Slot] = NULL;
+    Node->Present &= ~(1ULL << Slot);
+
+    //
+    // Free nodes on the way up until one is found that still has something
+    // in it.
+    //
+
+    while (Node->Present == 0) {
+
+        ASSERT(FreeCount < (PAGE_CACHE_INDEX_MAX_HEIGHT * 2));
+
+        FreeNodes[FreeCount] = Node;
+        FreeCount += 1;
+        Parent = Node->Parent;
+        if (Parent == NULL) {
+            Index->Root = NULL;
+            break;
+        }
+
+        Slot = Node->ParentSlot;
+
+        ASSERT((Parent->Tags[PageCacheIndexTagDirty] & (1ULL << Slot)) == 0);
+
+        Parent->Slots[Slot] = NULL;
+        Parent->Present &= ~(1ULL << Slot);
+        Node = Parent;
+    }
+
+    //
+    // Shrink the index while the root only uses its first slot, so that
+    // lookups do not wade through needless levels.
+    //
+
+    Node = Index->Root;
+    while ((Node != NULL) && (Node->Shift != 0) && (Node->Present == 1)) {
+
+        ASSERT(FreeCount < (PAGE_CACHE_INDEX_MAX_HEIGHT * 2));
+
+        Child = Node->Slots[0];
+        Child->Parent = NULL;
+        Child->ParentSlot = 0;
+        Index->Root = Child;
+        FreeNodes[FreeCount] = Node;
+        FreeCount += 1;
+        Node = Child;
+    }
+
+    if (Lock != NULL) {
+        KeReleaseQueuedLock(Lock);
+    }
+
+    while (FreeCount != 0) {
+        FreeCount -= 1;
+        MmFreeNonPagedPool(FreeNodes[FreeCount]);
+    }
+
+    return Value;
+}
+
+VOID
+IopSetPageCacheIndexTag (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PVOID Value,
+    PAGE_CACHE_INDEX_TAG Tag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets a tag on the given key in the page cache index and on
+    every node above it. The caller must hold the lock that synchronizes tag
+    updates, but only needs the file object lock if the value could otherwise
+    be removed from the index.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number to tag.
+
+    Value - Supplies the value expected at the key. Nothing is tagged if the
+        key holds something else.
+
+    Tag - Supplies the tag to set.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG Mask;
+    PPAGE_CACHE_INDEX_NODE Node;
+    ULONG Slot;
+
+    ASSERT(Tag < PageCacheIndexTagCount);
+
+    Node = IopGetPageCacheIndexLeaf(Index, Key);
+    if (Node == NULL) {
+        return;
+    }
+
+    Slot = PAGE_CACHE_INDEX_SLOT(Node, Key);
+    if (Node->Slots[Slot] != Value) {
+        return;
+    }
+
+    //
+    // Stop at the first node that already has the tag, as everything above
+    // it must too.
+    //
+
+    while (Node != NULL) {
+        Mask = 1ULL << Slot;
+        if ((Node->Tags[Tag] & Mask) != 0) {
+            break;
+        }
+
+        Node->Tags[Tag] |= Mask;
+        Slot = Node->ParentSlot;
+        Node = Node->Parent;
+    }
+
+    return;
+}
+
+VOID
+IopClearPageCacheIndexTag (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PVOID Value,
+    PAGE_CACHE_INDEX_TAG Tag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine clears a tag on the given key in the page cache index, and on
+    each node above it that no longer has anything tagged beneath it. The
+    caller must hold the lock that synchronizes tag updates.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number to clear the tag on.
+
+    Value - Supplies the value expected at the key. Nothing is cleared if the
+        key holds something else.
+
+    Tag - Supplies the tag to clear.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPAGE_CACHE_INDEX_NODE Node;
+    ULONG Slot;
+
+    ASSERT(Tag < PageCacheIndexTagCount);
+
+    Node = IopGetPageCacheIndexLeaf(Index, Key);
+    if (Node == NULL) {
+        return;
+    }
+
+    Slot = PAGE_CACHE_INDEX_SLOT(Node, Key);
+    if (Node->Slots[Slot] != Value) {
+        return;
+    }
+
+    while (Node != NULL) {
+        Node->Tags[Tag] &= ~(1ULL << Slot);
+        if (Node->Tags[Tag] != 0) {
+            break;
+        }
+
+        Slot = Node->ParentSlot;
+        Node = Node->Parent;
+    }
+
+    return;
+}
+
+BOOL
+IopIsPageCacheIndexTagged (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PAGE_CACHE_INDEX_TAG Tag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given key in the page cache index has
+    the given tag set.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number to query.
+
+    Tag - Supplies the tag to test.
+
+Return Value:
+
+    TRUE if the key is present and tagged.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    PPAGE_CACHE_INDEX_NODE Leaf;
+    ULONGLONG Mask;
+
+    ASSERT(Tag < PageCacheIndexTagCount);
+
+    Leaf = IopGetPageCacheIndexLeaf(Index, Key);
+    if (Leaf == NULL) {
+        return FALSE;
+    }
+
+    Mask = 1ULL << PAGE_CACHE_INDEX_SLOT(Leaf, Key);
+    if ((Leaf->Tags[Tag] & Mask) != 0) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+PPAGE_CACHE_INDEX_NODE
+IopGetPageCacheIndexLeaf (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the leaf node that would hold the given key.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to search.
+
+    Key - Supplies the page number to find.
+
+Return Value:
+
+    Returns a pointer to the leaf node, or NULL if no such leaf exists.
+
+--*/
+
+{
+
+    PPAGE_CACHE_INDEX_NODE Node;
+
+    Node = Index->Root;
+    if ((Node == NULL) || (!PAGE_CACHE_INDEX_NODE_COVERS(Node, Key))) {
+        return NULL;
+    }
+
+    while (Node->Shift != 0) {
+        Node = Node->Slots[PAGE_CACHE_INDEX_SLOT(Node, Key)];
+        if (Node == NULL) {
+            break;
+        }
+    }
+
+    return Node;
+}
+
+PVOID
+IopSearchPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PAGE_CACHE_INDEX_TAG Tag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the first value at or after the given key, optionally
+    only considering tagged slots.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to search.
+
+    Key - Supplies the page number to start searching at.
+
+    Tag - Supplies the tag to search for. Supply PageCacheIndexTagCount to
+        consider every slot in use.
+
+Return Value:
+
+    Returns the first matching value, or NULL if there is none.
+
+--*/
+
+{
+
+    ULONGLONG Bitmap;
+    ULONG NextSlot;
+    PPAGE_CACHE_INDEX_NODE Node;
+    BOOL OnPath;
+    ULONG Slot;
+
+    Node = Index->Root;
+    if ((Node == NULL) || (!PAGE_CACHE_INDEX_NODE_COVERS(Node, Key))) {
+        return NULL;
+    }
+
+    //
+    // While the walk is still following the key's own path, each level starts
+    // at the key's slot. Once it steps to a later slot, everything beneath
+    // that is beyond the key and is searched from the beginning.
+    //
+
+    OnPath = TRUE;
+    Slot = PAGE_CACHE_INDEX_SLOT(Node, Key);
+    while (TRUE) {
+        if (Tag == PageCacheIndexTagCount) {
+            Bitmap = Node->Present;
+
+        } else {
+            Bitmap = Node->Tags[Tag];
+        }
+
+        Bitmap &= MAX_ULONGLONG << Slot;
+
+        //
+        // If nothing remains in this node, pop up to the next slot of the
+        // nearest ancestor that has one.
+        //
+
+        if (Bitmap == 0) {
+            OnPath = FALSE;
+            do {
+                if (Node->Parent == NULL) {
+                    return NULL;
+                }
+
+                Slot = Node->ParentSlot + 1;
+                Node = Node->Parent;
+
+            } while (Slot == PAGE_CACHE_INDEX_SLOTS);
+
+            continue;
+        }
+
+        NextSlot = RtlCountTrailingZeros64(Bitmap);
+        if (NextSlot != Slot) {
+            OnPath = FALSE;
+        }
+
+        Slot = NextSlot;
+        if (Node->Shift == 0) {
+            return Node->Slots[Slot];
+        }
+
+        Node = Node->Slots[Slot];
+        if (OnPath != FALSE) {
+            Slot = PAGE_CACHE_INDEX_SLOT(Node, Key);
+
+        } else {
+            Slot = 0;
+        }
+    }
+
+    return NULL;
+}
+
@@ -58,10 +58,46 @@ Module Name:
 
 #define PATH_UNREACHABLE_PATH_PREFIX "(unreachable)/"
 
+//
+// Define the number of reader slots used to track lock-free path walks, and
+// the size each slot is padded out to so that processors entering and
+// exiting walks do not share cache lines.
+//
+
+#define PATH_WALK_READER_SLOTS 32
+#define PATH_WALK_READER_SLOT_SIZE 64
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines a slot of counters used to track lock-free path
+    walks. Each walk increments an enter count when it starts and the exit
+    count of the same phase when it finishes. A phase has drained once the
+    sums of its enter and exit counts across all slots match.
+
+Members:
+
+    EnterCount - Stores the number of walks that have started in each phase
+        using this slot.
+
+    ExitCount - Stores the number of walks that have finished in each phase
+        using this slot.
+
+    Padding - Stores padding to keep each slot on its own cache line.
+
+--*/
+
+typedef struct _PATH_WALK_READERS {
+    volatile UINTN EnterCount[2];
+    volatile UINTN ExitCount[2];
+    UCHAR Padding[PATH_WALK_READER_SLOT_SIZE - (4 * sizeof(UINTN))];
+} PATH_WALK_READERS, *PPATH_WALK_READERS;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -134,6 +170,61 @@ IopGetPathEntryCacheTargetSize (
     VOID
     );
 
+KSTATUS
+IopResizePathEntryHashTable (
+    PPATH_ENTRY Entry,
+    ULONG NewSize
+    );
+
+KSTATUS
+IopPathWalkCached (
+    BOOL FromKernelMode,
+    PPATH_POINT Start,
+    PCSTR *Path,
+    PULONG PathSize,
+    PPATH_POINT Result
+    );
+
+PPATH_ENTRY
+IopFindPathEntryCached (
+    PPATH_ENTRY Directory,
+    ULONG Sequence,
+    PCSTR Name,
+    ULONG NameSize,
+    ULONG Hash
+    );
+
+VOID
+IopBeginPathEntryChildUpdate (
+    PPATH_ENTRY Entry
+    );
+
+VOID
+IopEndPathEntryChildUpdate (
+    PPATH_ENTRY Entry
+    );
+
+ULONG
+IopBeginCachedPathWalk (
+    PPATH_WALK_READERS *Slot
+    );
+
+VOID
+IopEndCachedPathWalk (
+    PPATH_WALK_READERS Slot,
+    ULONG Phase
+    );
+
+VOID
+IopSynchronizePathWalks (
+    VOID
+    );
+
+VOID
+IopWaitForPathWalkPhase (
+    ULONG Phase
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -159,6 +250,22 @@ LIST_ENTRY IoPathEntryList;
 UINTN IoPathEntryListSize;
 UINTN IoPathEntryListMaxSize;
 
+//
+// Store the path generation number, bumped by mounts and renames so that
+// lock-free path walks can detect that the tree changed shape under them.
+//
+
+volatile ULONG IoPathGeneration;
+
+//
+// Store the state used to wait out lock-free path walks before freeing the
+// path entries or hash tables they might be looking at.
+//
+
+PATH_WALK_READERS IoPathWalkReaders[PATH_WALK_READER_SLOTS];
+volatile ULONG IoPathWalkPhase;
+PQUEUED_LOCK IoPathWalkLock;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -462,6 +569,12 @@ Return Value:
         goto InitializePathSupportEnd;
     }
 
+    IoPathWalkLock = KeCreateQueuedLock();
+    if (IoPathWalkLock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializePathSupportEnd;
+    }
+
     INITIALIZE_LIST_HEAD(&IoPathEntryList);
     IoPathEntryListSize = 0;
     MaxMemory = MmGetTotalPhysicalPages() * MmPageSize();
@@ -504,6 +617,11 @@ Return Value:
             IoPathEntryListLock = NULL;
         }
 
+        if (IoPathWalkLock != NULL) {
+            KeDestroyQueuedLock(IoPathWalkLock);
+            IoPathWalkLock = NULL;
+        }
+
         if (RootObject != NULL) {
             ObReleaseReference(RootObject);
         }
@@ -1025,6 +1143,84 @@ Return Value:
     return FALSE;
 }
 
+VOID
+IopPathLink (
+    PPATH_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine links the given path entry into its parent's list of
+    children. This assumes the caller holds the parent path entry's file
+    object lock exclusively.
+
+Arguments:
+
+    Entry - Supplies a pointer to the path entry that is to be linked into the
+        path hierarchy. Its parent pointer must already be set.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG NewSize;
+    PPATH_ENTRY Parent;
+    ULONG Size;
+
+    Parent = Entry->Parent;
+
+    ASSERT(Parent != NULL);
+    ASSERT(Entry->SiblingListEntry.Next == NULL);
+    ASSERT(Entry->HashListEntry.Next == NULL);
+
+    IopBeginPathEntryChildUpdate(Parent);
+    INSERT_BEFORE(&(Entry->SiblingListEntry), &(Parent->ChildList));
+    Parent->ChildCount += 1;
+
+    //
+    // Start hashing the children once there are enough of them, and grow the
+    // table as the directory fills up. Resizing rehashes the whole child
+    // list, including the new entry.
+    //
+
+    NewSize = 0;
+    Size = Parent->ChildHashTableSize;
+    if (Parent->ChildHashTable == NULL) {
+        if (Parent->ChildCount > PATH_ENTRY_HASH_THRESHOLD) {
+            NewSize = PATH_ENTRY_HASH_MINIMUM_SIZE;
+        }
+
+    } else if (Parent->ChildCount > (Size * PATH_ENTRY_HASH_LOAD_FACTOR)) {
+        NewSize = Size << 1;
+    }
+
+    if ((NewSize != 0) &&
+        (KSUCCESS(IopResizePathEntryHashTable(Parent, NewSize)))) {
+
+        goto PathLinkEnd;
+    }
+
+    //
+    // If the table didn't get rebuilt, just add the entry to its bucket. A
+    // failure to allocate a table only costs lookup speed.
+    //
+
+    if (Parent->ChildHashTable != NULL) {
+        INSERT_BEFORE(&(Entry->HashListEntry),
+                      &(Parent->ChildHashTable[Entry->Hash & (Size - 1)]));
+    }
+
+PathLinkEnd:
+    IopEndPathEntryChildUpdate(Parent);
+    return;
+}
+
 VOID
 IopPathUnlink (
     PPATH_ENTRY Entry
@@ -1051,7 +1247,12 @@ Return Value:
 
 {
 
-    ASSERT(Entry->Parent != NULL);
+    PPATH_ENTRY Parent;
+    ULONG Size;
+
+    Parent = Entry->Parent;
+
+    ASSERT(Parent != NULL);
 
     //
     // The path entry must be pulled out of the list (as opposed to converting
@@ -1060,8 +1261,37 @@ Return Value:
     //
 
     if (Entry->SiblingListEntry.Next != NULL) {
+        IopBeginPathEntryChildUpdate(Parent);
         LIST_REMOVE(&(Entry->SiblingListEntry));
         Entry->SiblingListEntry.Next = NULL;
+
+        ASSERT(Parent->ChildCount != 0);
+
+        Parent->ChildCount -= 1;
+        if (Entry->HashListEntry.Next != NULL) {
+            LIST_REMOVE(&(Entry->HashListEntry));
+            Entry->HashListEntry.Next = NULL;
+        }
+
+        //
+        // Shrink the hash table as the directory empties out, and drop it
+        // altogether once a linear search is cheap again. A failure to
+        // shrink leaves the larger table in place.
+        //
+
+        Size = Parent->ChildHashTableSize;
+        if (Parent->ChildHashTable != NULL) {
+            if (Parent->ChildCount < (PATH_ENTRY_HASH_THRESHOLD / 2)) {
+                IopResizePathEntryHashTable(Parent, 0);
+
+            } else if ((Size > PATH_ENTRY_HASH_MINIMUM_SIZE) &&
+                       (Parent->ChildCount < (Size / 4))) {
+
+                IopResizePathEntryHashTable(Parent, Size >> 1);
+            }
+        }
+
+        IopEndPathEntryChildUpdate(Parent);
     }
 
     return;
@@ -1963,6 +2193,7 @@ Return Value:
     ULONG OldMountCount;
 
     OldMountCount = RtlAtomicAdd32(&(PathEntry->MountCount), 1);
+    RtlAtomicAdd32(&IoPathGeneration, 1);
 
     ASSERT(OldMountCount < 0x10000000);
 
@@ -1995,6 +2226,7 @@ Return Value:
     ULONG OldMountCount;
 
     OldMountCount = RtlAtomicAdd32(&(PathEntry->MountCount), (ULONG)-1);
+    RtlAtomicAdd32(&IoPathGeneration, 1);
 
     ASSERT((OldMountCount != 0) && (OldMountCount < 0x10000000));
 
@@ -2257,6 +2489,29 @@ Return Value:
     IO_PATH_POINT_ADD_REFERENCE(&Entry);
     KeReleaseQueuedLock(Process->Paths.Lock);
 
+    //
+    // Lookups that don't create anything first try to resolve the whole path
+    // out of the path entry cache without taking any locks or references
+    // along the way. Fall back to the careful walk if that doesn't pan out.
+    //
+
+    if (Create == NULL) {
+        Status = IopPathWalkCached(FromKernelMode,
+                                   &Entry,
+                                   &CurrentPath,
+                                   &CurrentPathSize,
+                                   &NextEntry);
+
+        if (Status != STATUS_TRY_AGAIN) {
+            if (KSUCCESS(Status)) {
+                IO_PATH_POINT_RELEASE_REFERENCE(&Entry);
+                IO_COPY_PATH_POINT(&Entry, &NextEntry);
+            }
+
+            goto PathWalkWorkerEnd;
+        }
+    }
+
     //
     // Loop walking path components.
     //
@@ -2662,11 +2917,13 @@ Return Value:
             KeGetSystemTime(&(Properties.AccessTime));
             Properties.ModifiedTime = Properties.AccessTime;
             Properties.StatusChangeTime = Properties.AccessTime;
+            FileObjectFlags = 0;
             Status = IopSendCreateRequest(PathRoot,
                                           DirectoryFileObject,
                                           Name,
                                           NameSize,
-                                          &Properties);
+                                          &Properties,
+                                          &FileObjectFlags);
 
             //
             // If the create request worked, create a file object for it. If
@@ -2680,7 +2937,6 @@ Return Value:
 
                 ASSERT(Properties.DeviceId == PathRoot->DeviceId);
 
-                FileObjectFlags = 0;
                 if ((OpenFlags & OPEN_FLAG_NO_PAGE_CACHE) != 0) {
                     FileObjectFlags |= FILE_OBJECT_FLAG_NO_PAGE_CACHE;
                 }
@@ -3145,13 +3401,14 @@ Return Value:
                (FileObject->Device == PathRoot) &&
                (Result->MountPoint == Directory->MountPoint));
 
-        Result->PathEntry->Negative = FALSE;
-        Result->PathEntry->DoNotCache = DoNotCache;
-
         ASSERT(FileObject != NULL);
         ASSERT(FileObject->ReferenceCount >= 2);
 
+        IopBeginPathEntryChildUpdate(DirectoryEntry);
+        Result->PathEntry->Negative = FALSE;
+        Result->PathEntry->DoNotCache = DoNotCache;
         Result->PathEntry->FileObject = FileObject;
+        IopEndPathEntryChildUpdate(DirectoryEntry);
         IopFileObjectAddPathEntryReference(Result->PathEntry->FileObject);
 
     //
@@ -3183,9 +3440,7 @@ Return Value:
         ASSERT((FileObject == NULL) ||
                (FileObject->Properties.HardLinkCount != 0));
 
-        INSERT_BEFORE(&(PathEntry->SiblingListEntry),
-                      &(DirectoryEntry->ChildList));
-
+        IopPathLink(PathEntry);
         Result->PathEntry = PathEntry;
         IoMountPointAddReference(Directory->MountPoint);
         Result->MountPoint = Directory->MountPoint;
@@ -3431,22 +3686,44 @@ Return Value:
     PPATH_ENTRY Entry;
     PMOUNT_POINT FoundMountPoint;
     PPATH_ENTRY FoundPathEntry;
+    BOOL Hashed;
+    PLIST_ENTRY ListHead;
+    PPATH_ENTRY ParentEntry;
     PFILE_OBJECT ParentFileObject;
     BOOL ResultValid;
 
     ResultValid = FALSE;
-    ParentFileObject = Parent->PathEntry->FileObject;
+    ParentEntry = Parent->PathEntry;
+    ParentFileObject = ParentEntry->FileObject;
 
     ASSERT(NameSize != 0);
     ASSERT(KeIsSharedExclusiveLockHeld(ParentFileObject->Lock) != FALSE);
 
     //
-    // Cruise through the cached list looking for this entry.
+    // Cruise through the cached entries looking for this one. Large
+    // directories only need to search the bucket for this hash.
     //
 
-    CurrentEntry = Parent->PathEntry->ChildList.Next;
-    while (CurrentEntry != &(Parent->PathEntry->ChildList)) {
-        Entry = LIST_VALUE(CurrentEntry, PATH_ENTRY, SiblingListEntry);
+    Hashed = FALSE;
+    ListHead = &(ParentEntry->ChildList);
+    if (ParentEntry->ChildHashTable != NULL) {
+
+        ASSERT(POWER_OF_2(ParentEntry->ChildHashTableSize) != FALSE);
+
+        Hashed = TRUE;
+        ListHead = &(ParentEntry->ChildHashTable[
+                                Hash & (ParentEntry->ChildHashTableSize - 1)]);
+    }
+
+    CurrentEntry = ListHead->Next;
+    while (CurrentEntry != ListHead) {
+        if (Hashed != FALSE) {
+            Entry = LIST_VALUE(CurrentEntry, PATH_ENTRY, HashListEntry);
+
+        } else {
+            Entry = LIST_VALUE(CurrentEntry, PATH_ENTRY, SiblingListEntry);
+        }
+
         CurrentEntry = CurrentEntry->Next;
 
         //
@@ -3763,6 +4040,7 @@ Return Value:
     //
 
     ASSERT(LIST_EMPTY(&(Entry->ChildList)) != FALSE);
+    ASSERT(Entry->ChildCount == 0);
     ASSERT(Entry->CacheListEntry.Next == NULL);
     ASSERT(Entry != IoPathPointRoot.PathEntry);
 
@@ -3771,19 +4049,28 @@ Return Value:
         //
         // If a path entry is created but never actually added because
         // someone beat it to the punch then it could have a parent
-        // but not be on the list. Hence the check for null. This is
+        // but not be on the list. The unlink routine handles that. This is
         // also necessary when releasing unmounted mount point path
         // entries.
         //
 
-        if (Entry->SiblingListEntry.Next != NULL) {
-            LIST_REMOVE(&(Entry->SiblingListEntry));
-            Entry->SiblingListEntry.Next = NULL;
-        }
+        IopPathUnlink(Entry);
 
         ASSERT(ParentFileObject != NULL);
 
         KeReleaseSharedExclusiveLockExclusive(ParentFileObject->Lock);
+
+        //
+        // A lock-free path walk may have found this entry before it was
+        // unlinked. Wait for any such walks to finish before tearing it down.
+        //
+
+        IopSynchronizePathWalks();
+    }
+
+    if (Entry->ChildHashTable != NULL) {
+        MmFreePagedPool(Entry->ChildHashTable);
+        Entry->ChildHashTable = NULL;
     }
 
     //
@@ -3866,3 +4153,694 @@ Return Value:
     return 0;
 }
 
+KSTATUS
+IopResizePathEntryHashTable (
+    PPATH_ENTRY Entry,
+    ULONG NewSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine rebuilds the hash table indexing the given path entry's
+    children. This assumes the path entry's file object lock is held
+    exclusively and that a child update is in progress.
+
+Arguments:
+
+    Entry - Supplies a pointer to the path entry whose child hash table should
+        be resized.
+
+    NewSize - Supplies the new number of buckets, which must be a power of
+        two. Supply zero to free the table and go back to searching the child
+        list linearly.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if the new table could not be allocated. The
+    existing table is left untouched in this case.
+
+--*/
+
+{
+
+    PPATH_ENTRY Child;
+    PLIST_ENTRY CurrentEntry;
+    ULONG Index;
+    PLIST_ENTRY NewTable;
+    PLIST_ENTRY OldTable;
+
+    ASSERT(POWER_OF_2(NewSize) != FALSE);
+    ASSERT((Entry->ChildSequence & 0x1) != 0);
+
+    NewTable = NULL;
+    if (NewSize != 0) {
+        NewTable = MmAllocatePagedPool(sizeof(LIST_ENTRY) * NewSize,
+                                       PATH_ALLOCATION_TAG);
+
+        if (NewTable == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        for (Index = 0; Index < NewSize; Index += 1) {
+            INITIALIZE_LIST_HEAD(&(NewTable[Index]));
+        }
+    }
+
+    //
+    // Rehash every child. The old buckets are simply abandoned, so there is no
+    // need to unlink the children from them first.
+    //
+
+    CurrentEntry = Entry->ChildList.Next;
+    while (CurrentEntry != &(Entry->ChildList)) {
+        Child = LIST_VALUE(CurrentEntry, PATH_ENTRY, SiblingListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (NewTable != NULL) {
+            INSERT_BEFORE(&(Child->HashListEntry),
+                          &(NewTable[Child->Hash & (NewSize - 1)]));
+
+        } else {
+            Child->HashListEntry.Next = NULL;
+        }
+    }
+
+    OldTable = Entry->ChildHashTable;
+    Entry->ChildHashTable = NewTable;
+    Entry->ChildHashTableSize = NewSize;
+
+    //
+    // Lock-free path walks may still be looking at the old buckets. Wait for
+    // them to finish before freeing the table out from under them.
+    //
+
+    if (OldTable != NULL) {
+        IopSynchronizePathWalks();
+        MmFreePagedPool(OldTable);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IopPathWalkCached (
+    BOOL FromKernelMode,
+    PPATH_POINT Start,
+    PCSTR *Path,
+    PULONG PathSize,
+    PPATH_POINT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to walk the given path using only the path entry
+    cache, without acquiring any locks or references on the intermediate
+    directories. Each directory's child sequence number is checked after
+    every step to detect concurrent changes. Only the final path entry gets a
+    reference, which is taken under its parent's lock. Anything out of the
+    ordinary (dot-dot, symbolic links, mount points, cache misses, or
+    concurrent changes) causes the routine to bail out so the caller can do
+    the walk the careful way.
+
+Arguments:
+
+    FromKernelMode - Supplies a boolean indicating whether or not this request
+        is coming directly from kernel mode, in which case search permissions
+        are not checked.
+
+    Start - Supplies a pointer to the path point to start the walk from. The
+        caller must have a reference on this path point.
+
+    Path - Supplies a pointer that on input contains a pointer to the string
+        of the path to walk. On success or definitive failure this pointer is
+        advanced the same way the careful walk would have advanced it. It is
+        left untouched if STATUS_TRY_AGAIN is returned.
+
+    PathSize - Supplies a pointer that on input contains the size of the
+        remaining path string in bytes, not including the null terminator.
+        This is updated along with the path pointer.
+
+    Result - Supplies a pointer to a path point that receives the resulting
+        path entry and mount point on success, with a reference taken on each.
+
+Return Value:
+
+    STATUS_SUCCESS if the path was resolved from the cache.
+
+    STATUS_PATH_NOT_FOUND if a negative path entry was found.
+
+    STATUS_TRY_AGAIN if the path could not be resolved without locks, and the
+    caller should perform a regular path walk.
+
+--*/
+
+{
+
+    ULONG ComponentSize;
+    PCSTR CurrentPath;
+    ULONG CurrentPathSize;
+    PPATH_ENTRY Directory;
+    PATH_POINT DirectoryPoint;
+    PPATH_ENTRY Entry;
+    PFILE_OBJECT FileObject;
+    ULONG Generation;
+    ULONG Hash;
+    ULONG MountCount;
+    PMOUNT_POINT MountPoint;
+    BOOL Negative;
+    PCSTR NextSeparator;
+    PPATH_ENTRY Parent;
+    ULONG ParentSequence;
+    ULONG Phase;
+    ULONG RemainingSize;
+    ULONG Sequence;
+    PPATH_WALK_READERS Slot;
+    KSTATUS Status;
+
+    CurrentPath = *Path;
+    CurrentPathSize = *PathSize;
+    Entry = Start->PathEntry;
+    MountPoint = Start->MountPoint;
+    Parent = NULL;
+    ParentSequence = 0;
+    Status = STATUS_TRY_AGAIN;
+    Generation = IoPathGeneration;
+    Phase = IopBeginCachedPathWalk(&Slot);
+    while (CurrentPathSize != 0) {
+
+        //
+        // Get past any separators.
+        //
+
+        while ((CurrentPathSize != 0) && (*CurrentPath == PATH_SEPARATOR)) {
+            CurrentPath += 1;
+            CurrentPathSize -= 1;
+        }
+
+        if ((*CurrentPath == '\0') || (CurrentPathSize == 0)) {
+            break;
+        }
+
+        RemainingSize = CurrentPathSize;
+        NextSeparator = CurrentPath;
+        while ((*NextSeparator != PATH_SEPARATOR) && (*NextSeparator != '\0') &&
+               (RemainingSize != 0)) {
+
+            RemainingSize -= 1;
+            NextSeparator += 1;
+        }
+
+        if ((*NextSeparator == '\0') || (RemainingSize == 0)) {
+            NextSeparator = NULL;
+        }
+
+        ComponentSize = CurrentPathSize - RemainingSize;
+
+        //
+        // Dot and dot-dot need the mount tree, which is beyond the scope of
+        // this quick walk.
+        //
+
+        if ((IopArePathsEqual(".", CurrentPath, ComponentSize + 1) != FALSE) ||
+            (IopArePathsEqual("..", CurrentPath, ComponentSize + 1) != FALSE)) {
+
+            goto PathWalkCachedEnd;
+        }
+
+        Directory = Entry;
+        FileObject = Directory->FileObject;
+        if ((FileObject->Properties.Type != IoObjectRegularDirectory) &&
+            (FileObject->Properties.Type != IoObjectObjectDirectory)) {
+
+            goto PathWalkCachedEnd;
+        }
+
+        if (FromKernelMode == FALSE) {
+            DirectoryPoint.PathEntry = Directory;
+            DirectoryPoint.MountPoint = MountPoint;
+            if (!KSUCCESS(IopCheckPermissions(FromKernelMode,
+                                              &DirectoryPoint,
+                                              IO_ACCESS_EXECUTE))) {
+
+                goto PathWalkCachedEnd;
+            }
+        }
+
+        //
+        // Sample the directory's sequence number, look for the child, and
+        // then make sure nothing changed while the child was being examined.
+        //
+
+        Sequence = Directory->ChildSequence;
+        if ((Sequence & 0x1) != 0) {
+            goto PathWalkCachedEnd;
+        }
+
+        RtlMemoryBarrier();
+        Hash = IopHashPathString(CurrentPath, ComponentSize + 1);
+        Entry = IopFindPathEntryCached(Directory,
+                                       Sequence,
+                                       CurrentPath,
+                                       ComponentSize + 1,
+                                       Hash);
+
+        if (Entry == NULL) {
+            goto PathWalkCachedEnd;
+        }
+
+        Negative = Entry->Negative;
+        FileObject = Entry->FileObject;
+        MountCount = Entry->MountCount;
+        RtlMemoryBarrier();
+        if ((Directory->ChildSequence != Sequence) || (MountCount != 0)) {
+            goto PathWalkCachedEnd;
+        }
+
+        //
+        // A negative entry means the path doesn't exist. Leave the path
+        // pointing at the missing component, as the careful walk would.
+        //
+
+        if (Negative != FALSE) {
+            Status = STATUS_PATH_NOT_FOUND;
+            goto PathWalkCachedEnd;
+        }
+
+        if (FileObject->Properties.Type == IoObjectSymbolicLink) {
+            goto PathWalkCachedEnd;
+        }
+
+        Parent = Directory;
+        ParentSequence = Sequence;
+        CurrentPath += ComponentSize;
+        CurrentPathSize -= ComponentSize;
+        if (NextSeparator == NULL) {
+            break;
+        }
+
+        //
+        // Let the careful walk generate the error if there are more
+        // components but this isn't a directory.
+        //
+
+        if ((FileObject->Properties.Type != IoObjectRegularDirectory) &&
+            (FileObject->Properties.Type != IoObjectObjectDirectory)) {
+
+            goto PathWalkCachedEnd;
+        }
+    }
+
+    //
+    // Paths that never left the starting point aren't worth the trouble.
+    //
+
+    if (Parent == NULL) {
+        goto PathWalkCachedEnd;
+    }
+
+    //
+    // Take a reference on the final entry. Holding the parent's lock keeps
+    // the entry from being destroyed, and the sequence number proves the
+    // entry is still linked where it was found. Don't wait on the lock, as
+    // doing so here would hold up anyone synchronizing with path walks.
+    //
+
+    FileObject = Parent->FileObject;
+    if (KeTryToAcquireSharedExclusiveLockShared(FileObject->Lock) == FALSE) {
+        goto PathWalkCachedEnd;
+    }
+
+    if ((Parent->ChildSequence == ParentSequence) &&
+        (IoPathGeneration == Generation)) {
+
+        IoPathEntryAddReference(Entry);
+        IoMountPointAddReference(MountPoint);
+        Result->PathEntry = Entry;
+        Result->MountPoint = MountPoint;
+        Status = STATUS_SUCCESS;
+    }
+
+    KeReleaseSharedExclusiveLockShared(FileObject->Lock);
+
+PathWalkCachedEnd:
+
+    //
+    // A negative result is only trustworthy if nothing moved during the walk.
+    //
+
+    if ((Status == STATUS_PATH_NOT_FOUND) &&
+        (IoPathGeneration != Generation)) {
+
+        Status = STATUS_TRY_AGAIN;
+    }
+
+    IopEndCachedPathWalk(Slot, Phase);
+    if (Status != STATUS_TRY_AGAIN) {
+        *Path = CurrentPath;
+        *PathSize = CurrentPathSize;
+    }
+
+    return Status;
+}
+
+PPATH_ENTRY
+IopFindPathEntryCached (
+    PPATH_ENTRY Directory,
+    ULONG Sequence,
+    PCSTR Name,
+    ULONG NameSize,
+    ULONG Hash
+    )
+
+/*++
+
+Routine Description:
+
+    This routine searches a directory's cached children for the given name
+    without holding the directory's lock. The caller must be inside a cached
+    path walk. The directory's child sequence number is rechecked before
+    each list pointer is followed, so a concurrent change makes the search
+    fail rather than wander off into freed or rearranged entries.
+
+Arguments:
+
+    Directory - Supplies a pointer to the path entry to search.
+
+    Sequence - Supplies the even child sequence number the caller sampled
+        from the directory.
+
+    Name - Supplies a pointer the query string, which may not be null
+        terminated.
+
+    NameSize - Supplies the size of the string including the assumed null
+        terminator that is never checked.
+
+    Hash - Supplies the hash of the name query string.
+
+Return Value:
+
+    Returns a pointer to the matching child on success. No reference is
+    taken, and the caller must recheck the sequence number after reading
+    anything out of it.
+
+    NULL if no matching child was found or the directory changed.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PPATH_ENTRY Entry;
+    BOOL Hashed;
+    PLIST_ENTRY ListHead;
+    PLIST_ENTRY Table;
+    ULONG TableSize;
+
+    Hashed = FALSE;
+    ListHead = &(Directory->ChildList);
+    Table = Directory->ChildHashTable;
+    TableSize = Directory->ChildHashTableSize;
+    if (Table != NULL) {
+        Hashed = TRUE;
+        ListHead = &(Table[Hash & (TableSize - 1)]);
+    }
+
+    CurrentEntry = ListHead;
+    while (TRUE) {
+        RtlMemoryBarrier();
+        if (Directory->ChildSequence != Sequence) {
+            break;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+        RtlMemoryBarrier();
+        if ((Directory->ChildSequence != Sequence) ||
+            (CurrentEntry == ListHead)) {
+
+            break;
+        }
+
+        if (Hashed != FALSE) {
+            Entry = LIST_VALUE(CurrentEntry, PATH_ENTRY, HashListEntry);
+
+        } else {
+            Entry = LIST_VALUE(CurrentEntry, PATH_ENTRY, SiblingListEntry);
+        }
+
+        if ((Entry->Hash == Hash) && (Entry->Name != NULL) &&
+            (IopArePathsEqual(Entry->Name, Name, NameSize) != FALSE)) {
+
+            return Entry;
+        }
+    }
+
+    return NULL;
+}
+
+VOID
+IopBeginPathEntryChildUpdate (
+    PPATH_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine marks the start of a change to a path entry's children,
+    making its child sequence number odd. The caller must hold the path
+    entry's file object lock exclusively.
+
+Arguments:
+
+    Entry - Supplies a pointer to the path entry whose children are about to
+        change.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldSequence;
+
+    OldSequence = RtlAtomicAdd32(&(Entry->ChildSequence), 1);
+
+    ASSERT((OldSequence & 0x1) == 0);
+
+    RtlMemoryBarrier();
+    return;
+}
+
+VOID
+IopEndPathEntryChildUpdate (
+    PPATH_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine marks the end of a change to a path entry's children, making
+    its child sequence number even again.
+
+Arguments:
+
+    Entry - Supplies a pointer to the path entry whose children changed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldSequence;
+
+    RtlMemoryBarrier();
+    OldSequence = RtlAtomicAdd32(&(Entry->ChildSequence), 1);
+
+    ASSERT((OldSequence & 0x1) != 0);
+
+    return;
+}
+
+ULONG
+IopBeginCachedPathWalk (
+    PPATH_WALK_READERS *Slot
+    )
+
+/*++
+
+Routine Description:
+
+    This routine announces the start of a lock-free path walk. Path entries
+    and hash tables seen during the walk will not be freed until the walk
+    ends.
+
+Arguments:
+
+    Slot - Supplies a pointer where the reader slot used is returned. This
+        must be passed to the end routine.
+
+Return Value:
+
+    Returns the phase the walk was counted in, which must also be passed to
+    the end routine.
+
+--*/
+
+{
+
+    ULONG Phase;
+    PPATH_WALK_READERS Readers;
+
+    Readers = &(IoPathWalkReaders[KeGetCurrentProcessorNumber() %
+                                  PATH_WALK_READER_SLOTS]);
+
+    Phase = IoPathWalkPhase & 0x1;
+    RtlAtomicAdd(&(Readers->EnterCount[Phase]), 1);
+    RtlMemoryBarrier();
+    *Slot = Readers;
+    return Phase;
+}
+
+VOID
+IopEndCachedPathWalk (
+    PPATH_WALK_READERS Slot,
+    ULONG Phase
+    )
+
+/*++
+
+Routine Description:
+
+    This routine announces the end of a lock-free path walk.
+
+Arguments:
+
+    Slot - Supplies the reader slot returned when the walk began.
+
+    Phase - Supplies the phase returned when the walk began.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RtlMemoryBarrier();
+    RtlAtomicAdd(&(Slot->ExitCount[Phase]), 1);
+    return;
+}
+
+VOID
+IopSynchronizePathWalks (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for any lock-free path walks currently in progress to
+    finish. Once it returns, no walk can still be looking at a path entry or
+    hash table that was unlinked before the call. Walks never block, so this
+    wait is short.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Phase;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    //
+    // Flip new walks over to the other phase and wait for the current phase
+    // to drain. The other phase is drained first in case walks from a
+    // previous flip are still finishing up in it.
+    //
+
+    KeAcquireQueuedLock(IoPathWalkLock);
+    RtlMemoryBarrier();
+    Phase = IoPathWalkPhase & 0x1;
+    IopWaitForPathWalkPhase(Phase ^ 0x1);
+    RtlAtomicAdd32(&IoPathWalkPhase, 1);
+    IopWaitForPathWalkPhase(Phase);
+    KeReleaseQueuedLock(IoPathWalkLock);
+    return;
+}
+
+VOID
+IopWaitForPathWalkPhase (
+    ULONG Phase
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits until every lock-free path walk counted in the given
+    phase has finished.
+
+Arguments:
+
+    Phase - Supplies the phase to wait on.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN EnterCount;
+    UINTN ExitCount;
+    ULONG Index;
+
+    while (TRUE) {
+
+        //
+        // Sum the exits before the enters. Counts only ever go up, so if the
+        // totals match then every walk that had started was done.
+        //
+
+        ExitCount = 0;
+        for (Index = 0; Index < PATH_WALK_READER_SLOTS; Index += 1) {
+            ExitCount += IoPathWalkReaders[Index].ExitCount[Phase];
+        }
+
+        RtlMemoryBarrier();
+        EnterCount = 0;
+        for (Index = 0; Index < PATH_WALK_READER_SLOTS; Index += 1) {
+            EnterCount += IoPathWalkReaders[Index].EnterCount[Phase];
+        }
+
+        if (EnterCount == ExitCount) {
+            break;
+        }
+
+        KeYield();
+    }
+
+    return;
+}
@@ -826,6 +826,75 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+IopGetSetPipeSize (
+    PIO_HANDLE Handle,
+    PULONG Size,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the capacity of a pipe.
+
+Arguments:
+
+    Handle - Supplies a pointer to the pipe I/O handle.
+
+    Size - Supplies a pointer that on input contains the requested size for set
+        operations. On output, returns the size of the pipe.
+
+    Set - Supplies a boolean indicating whether to get the size (FALSE) or set
+        it (TRUE).
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the handle is not a pipe.
+
+    STATUS_PERMISSION_DENIED if the caller tried to grow the pipe beyond the
+    system limit without the resources permission.
+
+    STATUS_RESOURCE_IN_USE if the pipe holds more data than would fit in the
+    requested size.
+
+    Other error codes on failure.
+
+--*/
+
+{
+
+    PFILE_OBJECT FileObject;
+    PPIPE Pipe;
+    KSTATUS Status;
+
+    FileObject = Handle->FileObject;
+    if (FileObject->Properties.Type != IoObjectPipe) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Pipe = FileObject->SpecialIo;
+    if (Set != FALSE) {
+        if (*Size > PIPE_MAX_SIZE) {
+            Status = PsCheckPermission(PERMISSION_RESOURCES);
+            if (!KSUCCESS(Status)) {
+                return Status;
+            }
+        }
+
+        Status = IoStreamBufferSetSize(Pipe->StreamBuffer, *Size);
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+    }
+
+    *Size = IoStreamBufferGetSize(Pipe->StreamBuffer);
+    return STATUS_SUCCESS;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
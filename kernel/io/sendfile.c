@@ -0,0 +1,411 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    sendfile.c
+
+Abstract:
+
+    This module implements support for transferring data between two I/O
+    handles without bouncing it through a user mode buffer.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the maximum number of bytes moved per read/write pair. This must be
+// a multiple of the page size.
+//
+
+#define SEND_FILE_CHUNK_SIZE (128 * _1KB)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KERNEL_API
+KSTATUS
+IoSendFile (
+    PIO_HANDLE Destination,
+    PIO_HANDLE Source,
+    PIO_OFFSET Offset,
+    UINTN SizeInBytes,
+    ULONG TimeoutInMilliseconds,
+    PUINTN BytesCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine transfers data from one I/O handle to another without
+    passing through a caller-supplied buffer. When the source is backed by the
+    page cache, the destination is handed the page cache pages directly, so
+    the data is copied at most once.
+
+Arguments:
+
+    Destination - Supplies the handle to write the data to.
+
+    Source - Supplies the handle to read the data from.
+
+    Offset - Supplies a pointer to the offset in the source to start reading
+        from. Supply IO_OFFSET_NONE to use and update the source's current
+        file position. On return, this is updated to the offset just beyond
+        the last byte transferred, unless IO_OFFSET_NONE was supplied.
+
+    SizeInBytes - Supplies the number of bytes to transfer.
+
+    TimeoutInMilliseconds - Supplies the number of milliseconds that each
+        read and write should be waited on before timing out. Use
+        WAIT_TIME_INDEFINITE to wait forever.
+
+    BytesCompleted - Supplies a pointer where the number of bytes actually
+        transferred will be returned.
+
+Return Value:
+
+    Status code. A failing status code does not necessarily mean no data was
+    transferred. Check the bytes completed value to find out how much was.
+
+--*/
+
+{
+
+    UINTN Available;
+    UINTN BytesRead;
+    UINTN BytesWritten;
+    BOOL Cacheable;
+    IO_OFFSET CurrentOffset;
+    PFILE_OBJECT FileObject;
+    PIO_BUFFER IoBuffer;
+    UINTN PageSize;
+    IO_OFFSET ReadOffset;
+    UINTN ReadSize;
+    UINTN Skip;
+    KSTATUS Status;
+    UINTN ThisRound;
+    UINTN TotalBytes;
+    BOOL UseCurrentOffset;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    FileObject = Source->FileObject;
+    IoBuffer = NULL;
+    PageSize = MmPageSize();
+    Status = STATUS_SUCCESS;
+    TotalBytes = 0;
+    if ((Destination->HandleType != IoHandleTypeDefault) ||
+        (Source->HandleType != IoHandleTypeDefault)) {
+
+        Status = STATUS_INVALID_HANDLE;
+        goto SendFileEnd;
+    }
+
+    if (((Source->Access & IO_ACCESS_READ) == 0) ||
+        ((Destination->Access & IO_ACCESS_WRITE) == 0)) {
+
+        Status = STATUS_ACCESS_DENIED;
+        goto SendFileEnd;
+    }
+
+    if (SizeInBytes == 0) {
+        goto SendFileEnd;
+    }
+
+    //
+    // Only offsets within seekable objects make sense. Everything else is
+    // read from the current position.
+    //
+
+    UseCurrentOffset = FALSE;
+    CurrentOffset = *Offset;
+    if (CurrentOffset == IO_OFFSET_NONE) {
+        UseCurrentOffset = TRUE;
+        CurrentOffset = RtlAtomicOr64((PULONGLONG)&(Source->CurrentOffset), 0);
+
+    } else if (CurrentOffset < 0) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto SendFileEnd;
+    }
+
+    //
+    // Reading into an empty, extendable buffer lets the page cache append its
+    // own pages rather than copying into the buffer. Anything that does not
+    // go through the cache needs real memory to land in.
+    //
+
+    Cacheable = IO_IS_FILE_OBJECT_CACHEABLE(FileObject);
+    if (Cacheable != FALSE) {
+        IoBuffer = MmAllocateUninitializedIoBuffer(SEND_FILE_CHUNK_SIZE, 0);
+
+    } else {
+        IoBuffer = MmAllocateNonPagedIoBuffer(0,
+                                              MAX_ULONGLONG,
+                                              0,
+                                              SEND_FILE_CHUNK_SIZE,
+                                              0);
+    }
+
+    if (IoBuffer == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto SendFileEnd;
+    }
+
+    while (TotalBytes < SizeInBytes) {
+        ThisRound = SizeInBytes - TotalBytes;
+        Skip = 0;
+        ReadOffset = CurrentOffset;
+        if (Cacheable != FALSE) {
+
+            //
+            // Page cache entries can only be appended whole, so read from the
+            // start of the page and skip the leading bytes on the way out.
+            //
+
+            MmResetIoBuffer(IoBuffer);
+            Skip = REMAINDER(CurrentOffset, PageSize);
+            ReadOffset = CurrentOffset - Skip;
+            if (ThisRound > SEND_FILE_CHUNK_SIZE - Skip) {
+                ThisRound = SEND_FILE_CHUNK_SIZE - Skip;
+            }
+
+            ReadSize = ALIGN_RANGE_UP(Skip + ThisRound, PageSize);
+
+        } else {
+            if (ThisRound > SEND_FILE_CHUNK_SIZE) {
+                ThisRound = SEND_FILE_CHUNK_SIZE;
+            }
+
+            ReadSize = ThisRound;
+        }
+
+        Status = IoReadAtOffset(Source,
+                                IoBuffer,
+                                ReadOffset,
+                                ReadSize,
+                                0,
+                                TimeoutInMilliseconds,
+                                &BytesRead,
+                                NULL);
+
+        if (Status == STATUS_END_OF_FILE) {
+            Status = STATUS_SUCCESS;
+        }
+
+        if (BytesRead <= Skip) {
+            break;
+        }
+
+        Available = BytesRead - Skip;
+        if (Available > ThisRound) {
+            Available = ThisRound;
+        }
+
+        //
+        // Push out whatever was read, even if the read itself ended in
+        // failure.
+        //
+
+        if (Skip != 0) {
+            MmIoBufferIncrementOffset(IoBuffer, Skip);
+        }
+
+        Status = IoWrite(Destination,
+                         IoBuffer,
+                         Available,
+                         0,
+                         TimeoutInMilliseconds,
+                         &BytesWritten);
+
+        if (Skip != 0) {
+            MmIoBufferDecrementOffset(IoBuffer, Skip);
+        }
+
+        TotalBytes += BytesWritten;
+        CurrentOffset += BytesWritten;
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        //
+        // Stop on a short write or a short read; the caller will come back
+        // for the rest.
+        //
+
+        if ((BytesWritten != Available) || (Available != ThisRound)) {
+            break;
+        }
+    }
+
+    if (UseCurrentOffset != FALSE) {
+        RtlAtomicExchange64((PULONGLONG)&(Source->CurrentOffset),
+                            CurrentOffset);
+
+    } else {
+        *Offset = CurrentOffset;
+    }
+
+SendFileEnd:
+    if (IoBuffer != NULL) {
+        MmFreeIoBuffer(IoBuffer);
+    }
+
+    *BytesCompleted = TotalBytes;
+    return Status;
+}
+
+INTN
+IoSysSendFile (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for transferring data from a file
+    to another handle within the kernel.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or the number of bytes transferred (a positive integer) on
+    success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    PKPROCESS CurrentProcess;
+    PIO_HANDLE Destination;
+    PSYSTEM_CALL_SEND_FILE Parameters;
+    INTN Result;
+    PIO_HANDLE Source;
+    KSTATUS Status;
+
+    CurrentProcess = PsGetCurrentProcess();
+    Parameters = (PSYSTEM_CALL_SEND_FILE)SystemCallParameter;
+    BytesCompleted = 0;
+    Source = NULL;
+    Destination = ObGetHandleValue(CurrentProcess->HandleTable,
+                                   Parameters->Destination,
+                                   NULL);
+
+    if (Destination == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto SysSendFileEnd;
+    }
+
+    Source = ObGetHandleValue(CurrentProcess->HandleTable,
+                              Parameters->Source,
+                              NULL);
+
+    if (Source == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto SysSendFileEnd;
+    }
+
+    if (Parameters->Size <= 0) {
+        Status = STATUS_SUCCESS;
+        goto SysSendFileEnd;
+    }
+
+    Status = IoSendFile(Destination,
+                        Source,
+                        &(Parameters->Offset),
+                        Parameters->Size,
+                        WAIT_TIME_INDEFINITE,
+                        &BytesCompleted);
+
+    if (Status == STATUS_BROKEN_PIPE) {
+
+        ASSERT(CurrentProcess != PsGetKernelProcess());
+
+        PsSignalProcess(CurrentProcess, SIGNAL_BROKEN_PIPE, NULL);
+    }
+
+SysSendFileEnd:
+    if (Destination != NULL) {
+        IoIoHandleReleaseReference(Destination);
+    }
+
+    if (Source != NULL) {
+        IoIoHandleReleaseReference(Source);
+    }
+
+    //
+    // If the transfer got interrupted before anything moved, then the system
+    // call can be restarted. If bytes were transferred, report them.
+    //
+
+    if (Status == STATUS_INTERRUPTED) {
+        if (BytesCompleted == 0) {
+            Status = STATUS_RESTART_AFTER_SIGNAL;
+
+        } else {
+            Status = STATUS_SUCCESS;
+        }
+    }
+
+    Result = Status;
+    if (KSUCCESS(Status) ||
+        ((Status == STATUS_TIMEOUT) && (BytesCompleted != 0))) {
+
+        ASSERT(BytesCompleted <= (UINTN)MAX_INTN);
+
+        Result = (INTN)BytesCompleted;
+    }
+
+    return Result;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
@@ -44,6 +44,29 @@ Module Name:
 
 /*++
 
+Structure Description:
+
+    This structure describes one page of a stream buffer's ring.
+
+Members:
+
+    Data - Stores a pointer to the page of memory owned by the stream buffer.
+        This is allocated the first time data is copied into the page.
+
+    Gift - Stores an optional pointer to an I/O buffer holding a page cache
+        page that was handed to the stream buffer in place of copying its
+        contents. When this is set, the page's data lives here rather than in
+        the data page.
+
+--*/
+
+typedef struct _STREAM_BUFFER_PAGE {
+    PVOID Data;
+    PIO_BUFFER Gift;
+} STREAM_BUFFER_PAGE, *PSTREAM_BUFFER_PAGE;
+
+/*++
+
 Structure Description:
 
     This structure describes characteristics about a data stream buffer.
@@ -53,15 +76,18 @@ Structure Description:
     Flags - Stores a bitfield of flags governing the state of the stream buffer.
         See STREAM_BUFFER_FLAG_* definitions.
 
-    Size - Stores the size of the buffer, in bytes.
+    Size - Stores the size of the buffer, in bytes. This is always a multiple
+        of the page size.
 
-    Buffer - Stores a pointer to the actual stream buffer.
+    PageCount - Stores the number of elements in the page array.
 
-    NextReadOffset - Stores the offset from the beginning of the buffer where
-        the next read should occur (points to the first unread byte).
+    Pages - Stores the ring of pages that make up the buffer.
 
-    NextWriteOffset - Stores the offset from the beginning of the buffer where
-        the next write should occur (points to the first unused offset).
+    ReadOffset - Stores the offset from the beginning of the ring where the
+        next read should occur (points to the first unread byte).
+
+    DataSize - Stores the number of unread bytes in the ring. The next write
+        occurs this many bytes beyond the read offset.
 
     AtomicWriteSize - Stores the number of bytes that can always be written
         to the stream atomically (without interleaving).
@@ -76,9 +102,10 @@ Structure Description:
 struct _STREAM_BUFFER {
     ULONG Flags;
     ULONG Size;
-    PVOID Buffer;
-    ULONG NextReadOffset;
-    ULONG NextWriteOffset;
+    ULONG PageCount;
+    PSTREAM_BUFFER_PAGE Pages;
+    ULONG ReadOffset;
+    ULONG DataSize;
     ULONG AtomicWriteSize;
     PQUEUED_LOCK Lock;
     PIO_OBJECT_STATE IoState;
@@ -88,6 +115,47 @@ struct _STREAM_BUFFER {
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+KSTATUS
+IopStreamBufferCopyIn (
+    PSTREAM_BUFFER StreamBuffer,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset,
+    UINTN ByteCount,
+    PUINTN BytesCopied
+    );
+
+KSTATUS
+IopStreamBufferCopyOut (
+    PSTREAM_BUFFER StreamBuffer,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset,
+    UINTN ByteCount,
+    PUINTN BytesCopied
+    );
+
+BOOL
+IopStreamBufferGiftPage (
+    PSTREAM_BUFFER_PAGE Page,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset
+    );
+
+KSTATUS
+IopStreamBufferPreparePage (
+    PSTREAM_BUFFER_PAGE Page
+    );
+
+VOID
+IopStreamBufferReleaseGift (
+    PSTREAM_BUFFER_PAGE Page
+    );
+
+VOID
+IopStreamBufferDestroyPages (
+    PSTREAM_BUFFER_PAGE Pages,
+    ULONG PageCount
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -119,7 +187,7 @@ Routine Description:
         buffer. See STREAM_BUFFER_FLAG_* definitions.
 
     BufferSize - Supplies the size of the buffer. Supply zero to use a default
-        system value.
+        system value. The size is rounded up to a multiple of the page size.
 
     AtomicWriteSize - Supplies the number of bytes that can always be written
         to the stream atomically (without interleaving).
@@ -134,27 +202,31 @@ Return Value:
 
 {
 
+    UINTN AllocationSize;
+    ULONG PageSize;
     KSTATUS Status;
     PSTREAM_BUFFER StreamBuffer;
 
+    PageSize = MmPageSize();
     if (AtomicWriteSize == 0) {
         AtomicWriteSize = 1;
     }
 
     if (BufferSize == 0) {
         BufferSize = DEFAULT_STREAM_BUFFER_SIZE;
+    }
+
+    if (BufferSize < AtomicWriteSize) {
+        BufferSize = AtomicWriteSize;
+    }
 
     //
-    // Bump up the internal buffer size since one byte of the buffer is always
-    // wasted.
+    // The buffer is made up of whole pages, so round the size up.
     //
 
-    } else {
-        BufferSize += 1;
-    }
-
-    if (BufferSize < AtomicWriteSize) {
-        BufferSize = AtomicWriteSize + 1;
+    BufferSize = ALIGN_RANGE_UP(BufferSize, PageSize);
+    if (BufferSize == 0) {
+        return NULL;
     }
 
     //
@@ -171,6 +243,7 @@ Return Value:
 
     RtlZeroMemory(StreamBuffer, sizeof(STREAM_BUFFER));
     StreamBuffer->Size = BufferSize;
+    StreamBuffer->PageCount = BufferSize / PageSize;
     StreamBuffer->AtomicWriteSize = AtomicWriteSize;
     StreamBuffer->Lock = KeCreateQueuedLock();
     if (StreamBuffer->Lock == NULL) {
@@ -179,17 +252,21 @@ Return Value:
     }
 
     //
-    // Create the buffer itself.
+    // Create the ring of pages. The pages themselves are allocated as data
+    // shows up.
     //
 
-    StreamBuffer->Buffer = MmAllocatePagedPool(BufferSize,
-                                               FI_ALLOCATION_TAG);
+    AllocationSize = StreamBuffer->PageCount * sizeof(STREAM_BUFFER_PAGE);
+    StreamBuffer->Pages = MmAllocatePagedPool(AllocationSize,
+                                              FI_ALLOCATION_TAG);
 
-    if (StreamBuffer->Buffer == NULL) {
+    if (StreamBuffer->Pages == NULL) {
         Status = STATUS_INSUFFICIENT_RESOURCES;
         goto CreateStreamBufferEnd;
     }
 
+    RtlZeroMemory(StreamBuffer->Pages, AllocationSize);
+
     //
     // Use the given I/O object state or create one.
     //
@@ -208,8 +285,8 @@ Return Value:
                 KeDestroyQueuedLock(StreamBuffer->Lock);
             }
 
-            if (StreamBuffer->Buffer != NULL) {
-                MmFreePagedPool(StreamBuffer->Buffer);
+            if (StreamBuffer->Pages != NULL) {
+                MmFreePagedPool(StreamBuffer->Pages);
             }
 
             MmFreePagedPool(StreamBuffer);
@@ -249,9 +326,11 @@ Return Value:
     }
 
     StreamBuffer->IoState = NULL;
-    if (StreamBuffer->Buffer != NULL) {
-        MmFreePagedPool(StreamBuffer->Buffer);
-        StreamBuffer->Buffer = NULL;
+    if (StreamBuffer->Pages != NULL) {
+        IopStreamBufferDestroyPages(StreamBuffer->Pages,
+                                    StreamBuffer->PageCount);
+
+        StreamBuffer->Pages = NULL;
     }
 
     MmFreePagedPool(StreamBuffer);
@@ -303,11 +382,10 @@ Return Value:
 
 {
 
-    ULONG BytesAvailable;
-    ULONG BytesReadHere;
-    ULONG BytesToRead;
+    UINTN BytesCopied;
+    UINTN BytesReadHere;
+    UINTN BytesToRead;
     ULONG EventsMask;
-    ULONG NextWriteOffset;
     ULONG ReturnedEvents;
     KSTATUS Status;
 
@@ -354,7 +432,7 @@ Return Value:
         // Start over if there's nothing to read.
         //
 
-        if (StreamBuffer->NextReadOffset == StreamBuffer->NextWriteOffset) {
+        if (StreamBuffer->DataSize == 0) {
 
             //
             // If the IN flag is set, then that would mean this routine is
@@ -393,96 +471,25 @@ Return Value:
             }
         }
 
-        //
-        // Now read the buffer, at least going to the end of the buffer.
-        // Wraparounds will be handled later on.
-        //
-
-        NextWriteOffset = StreamBuffer->NextWriteOffset;
-
-        ASSERT(NextWriteOffset < StreamBuffer->Size);
-
-        if (NextWriteOffset > StreamBuffer->NextReadOffset) {
-            BytesAvailable = NextWriteOffset - StreamBuffer->NextReadOffset;
-
-        } else {
-            BytesAvailable = StreamBuffer->Size - StreamBuffer->NextReadOffset;
-        }
-
-        BytesToRead = BytesAvailable;
+        BytesToRead = StreamBuffer->DataSize;
         if (ByteCount < BytesToRead) {
             BytesToRead = ByteCount;
         }
 
-        Status = MmCopyIoBufferData(
-                           IoBuffer,
-                           StreamBuffer->Buffer + StreamBuffer->NextReadOffset,
-                           *BytesRead,
-                           BytesToRead,
-                           TRUE);
-
-        if (!KSUCCESS(Status)) {
-            KeReleaseQueuedLock(StreamBuffer->Lock);
-            return Status;
-        }
-
-        //
-        // Update the read offset so that it always contains a valid value.
-        //
-
-        if (StreamBuffer->NextReadOffset + BytesToRead == StreamBuffer->Size) {
-            StreamBuffer->NextReadOffset = 0;
-
-        } else {
-            StreamBuffer->NextReadOffset += BytesToRead;
-        }
-
-        ASSERT(StreamBuffer->NextReadOffset < StreamBuffer->Size);
-
-        *BytesRead += BytesToRead;
-        BytesReadHere += BytesToRead;
-        ByteCount -= BytesToRead;
-
         //
-        // The first copy is done, but it's possible that the eligible read
-        // content wraps around. Grab the rest of that data if so.
+        // Don't break out of the loop on failure right away, as the I/O state
+        // events need to be adjusted for any partial copy that happened.
         //
 
-        if ((ByteCount != 0) &&
-            (StreamBuffer->NextReadOffset != NextWriteOffset)) {
-
-            ASSERT(StreamBuffer->NextReadOffset == 0);
-            ASSERT(NextWriteOffset > StreamBuffer->NextReadOffset);
-
-            BytesAvailable = NextWriteOffset - StreamBuffer->NextReadOffset;
-            BytesToRead = BytesAvailable;
-            if (ByteCount < BytesToRead) {
-                BytesToRead = ByteCount;
-            }
-
-            //
-            // Don't break out of the loop on failure right away, as the
-            // I/O state events need to be adjusted for the successful first
-            // copy that happened.
-            //
-
-            Status = MmCopyIoBufferData(
-                           IoBuffer,
-                           StreamBuffer->Buffer + StreamBuffer->NextReadOffset,
-                           *BytesRead,
-                           BytesToRead,
-                           TRUE);
+        Status = IopStreamBufferCopyOut(StreamBuffer,
+                                        IoBuffer,
+                                        *BytesRead,
+                                        BytesToRead,
+                                        &BytesCopied);
 
-            if (KSUCCESS(Status)) {
-                StreamBuffer->NextReadOffset += BytesToRead;
-
-                ASSERT(StreamBuffer->NextReadOffset < StreamBuffer->Size);
-
-                *BytesRead += BytesToRead;
-                BytesReadHere += BytesToRead;
-                ByteCount -= BytesToRead;
-            }
-        }
+        *BytesRead += BytesCopied;
+        BytesReadHere += BytesCopied;
+        ByteCount -= BytesCopied;
 
         //
         // Signal the write event (since more space was just made), and signal
@@ -493,7 +500,7 @@ Return Value:
 
         if ((ReturnedEvents & POLL_ERROR_EVENTS) == 0) {
             IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, TRUE);
-            if (StreamBuffer->NextReadOffset != StreamBuffer->NextWriteOffset) {
+            if (StreamBuffer->DataSize != 0) {
                 IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, TRUE);
 
             } else {
@@ -504,7 +511,7 @@ Return Value:
         KeReleaseQueuedLock(StreamBuffer->Lock);
 
         //
-        // If that second copy failed, now's the time to break out.
+        // If the copy failed, now's the time to break out.
         //
 
         if (!KSUCCESS(Status)) {
@@ -560,13 +567,12 @@ Return Value:
 
 {
 
-    ULONG BytesAvailable;
-    ULONG BytesToWrite;
+    UINTN BytesCopied;
+    UINTN BytesToWrite;
     ULONG EventsMask;
-    ULONG NextReadOffset;
     ULONG ReturnedEvents;
     KSTATUS Status;
-    ULONG TotalBytesAvailable;
+    UINTN TotalBytesAvailable;
 
     *BytesWritten = 0;
     EventsMask = POLL_EVENT_OUT | POLL_ERROR_EVENTS;
@@ -603,42 +609,9 @@ Return Value:
         // Figure out how much room there is.
         //
 
-        NextReadOffset = StreamBuffer->NextReadOffset;
-
-        ASSERT(NextReadOffset < StreamBuffer->Size);
-
-        if (NextReadOffset <= StreamBuffer->NextWriteOffset) {
-
-            //
-            // The total available is the entire buffer (minus one) minus the
-            // distance between the read and write pointers.
-            //
+        ASSERT(StreamBuffer->DataSize <= StreamBuffer->Size);
 
-            TotalBytesAvailable = (StreamBuffer->Size - 1) -
-                                  (StreamBuffer->NextWriteOffset -
-                                   NextReadOffset);
-
-            //
-            // The first copy goes from the next write offset to the end, but
-            // if the read offset is right at zero then the padding byte is at
-            // the end there.
-            //
-
-            BytesAvailable = StreamBuffer->Size - StreamBuffer->NextWriteOffset;
-            if (NextReadOffset == 0) {
-                BytesAvailable -= 1;
-            }
-
-        } else {
-
-            //
-            // The total available space is the distance between the write
-            // catching up to the read, minus the one buffer byte.
-            //
-
-            BytesAvailable = NextReadOffset - StreamBuffer->NextWriteOffset - 1;
-            TotalBytesAvailable = BytesAvailable;
-        }
+        TotalBytesAvailable = StreamBuffer->Size - StreamBuffer->DataSize;
 
         //
         // Start over if the buffer is full. The stream stipulates that it will
@@ -663,98 +636,34 @@ Return Value:
             }
         }
 
-        //
-        // Now write to the buffer, at least going to the end of the buffer.
-        // Wraparounds will be handled later on.
-        //
-
-        ASSERT(BytesAvailable != 0);
-
-        BytesToWrite = BytesAvailable;
+        BytesToWrite = TotalBytesAvailable;
         if (ByteCount < BytesToWrite) {
             BytesToWrite = ByteCount;
         }
 
-        Status = MmCopyIoBufferData(
-                          IoBuffer,
-                          StreamBuffer->Buffer + StreamBuffer->NextWriteOffset,
-                          *BytesWritten,
-                          BytesToWrite,
-                          FALSE);
-
-        if (!KSUCCESS(Status)) {
-            KeReleaseQueuedLock(StreamBuffer->Lock);
-            return Status;
-        }
-
         //
-        // Update the next write pointer in a manner that ensures its value is
-        // always valid.
+        // Don't break out of the loop on failure right away, as the I/O state
+        // events need to be adjusted for any partial copy that happened.
         //
 
-        if (StreamBuffer->NextWriteOffset + BytesToWrite ==
-            StreamBuffer->Size) {
-
-            StreamBuffer->NextWriteOffset = 0;
-
-        } else {
-            StreamBuffer->NextWriteOffset += BytesToWrite;
-        }
+        Status = IopStreamBufferCopyIn(StreamBuffer,
+                                       IoBuffer,
+                                       *BytesWritten,
+                                       BytesToWrite,
+                                       &BytesCopied);
 
-        *BytesWritten += BytesToWrite;
-        ByteCount -= BytesToWrite;
-        TotalBytesAvailable -= BytesToWrite;
-
-        //
-        // The first copy is done, but it's possible that the eligible space
-        // wraps around. Write the remainder if so.
-        //
-
-        if ((ByteCount != 0) &&
-            (((StreamBuffer->NextWriteOffset + 1) % StreamBuffer->Size) !=
-                                                             NextReadOffset)) {
-
-            ASSERT(StreamBuffer->NextWriteOffset == 0);
-            ASSERT(NextReadOffset > StreamBuffer->NextWriteOffset + 1);
-
-            BytesAvailable = NextReadOffset - StreamBuffer->NextWriteOffset - 1;
-            BytesToWrite = BytesAvailable;
-            if (ByteCount < BytesToWrite) {
-                BytesToWrite = ByteCount;
-            }
-
-            //
-            // Don't break out of the loop on failure right away, as the
-            // I/O state events need to be adjusted for the successful first
-            // copy that happened.
-            //
-
-            Status = MmCopyIoBufferData(
-                          IoBuffer,
-                          StreamBuffer->Buffer + StreamBuffer->NextWriteOffset,
-                          *BytesWritten,
-                          BytesToWrite,
-                          FALSE);
-
-            if (KSUCCESS(Status)) {
-                StreamBuffer->NextWriteOffset += BytesToWrite;
-
-                ASSERT(StreamBuffer->NextWriteOffset < StreamBuffer->Size);
-
-                *BytesWritten += BytesToWrite;
-                ByteCount -= BytesToWrite;
-                TotalBytesAvailable -= BytesToWrite;
-            }
-        }
+        *BytesWritten += BytesCopied;
+        ByteCount -= BytesCopied;
+        TotalBytesAvailable -= BytesCopied;
 
         //
         // Signal the read event (since there's now stuff to read), and signal
         // the write event if there is still space left.
         //
 
-        IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, TRUE);
-
-        ASSERT(TotalBytesAvailable < StreamBuffer->Size);
+        if (StreamBuffer->DataSize != 0) {
+            IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, TRUE);
+        }
 
         if (TotalBytesAvailable >= StreamBuffer->AtomicWriteSize) {
             IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, TRUE);
@@ -766,7 +675,7 @@ Return Value:
         KeReleaseQueuedLock(StreamBuffer->Lock);
 
         //
-        // If that second copy failed, now is the time to exit.
+        // If the copy failed, now is the time to exit.
         //
 
         if (!KSUCCESS(Status)) {
@@ -809,27 +718,7 @@ Return Value:
     // Figure out how much space there is.
     //
 
-    if (StreamBuffer->NextReadOffset <= StreamBuffer->NextWriteOffset) {
-
-        //
-        // The total available is the entire buffer (minus one) minus the
-        // distance between the read and write pointers.
-        //
-
-        TotalBytesAvailable = (StreamBuffer->Size - 1) -
-                              (StreamBuffer->NextWriteOffset -
-                               StreamBuffer->NextReadOffset);
-
-    } else {
-
-        //
-        // The total available space is the distance between the write
-        // catching up to the read, minus the one buffer byte.
-        //
-
-        TotalBytesAvailable = StreamBuffer->NextReadOffset -
-                              StreamBuffer->NextWriteOffset - 1;
-    }
+    TotalBytesAvailable = StreamBuffer->Size - StreamBuffer->DataSize;
 
     //
     // Signal the write event if there's space to be written.
@@ -846,7 +735,7 @@ Return Value:
     // Signal the read event if there's data in there.
     //
 
-    if (TotalBytesAvailable != StreamBuffer->Size - 1) {
+    if (StreamBuffer->DataSize != 0) {
         IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_IN, TRUE);
 
     } else {
@@ -883,7 +772,640 @@ Return Value:
     return StreamBuffer->IoState;
 }
 
+ULONG
+IoStreamBufferGetSize (
+    PSTREAM_BUFFER StreamBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the capacity of a stream buffer.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer.
+
+Return Value:
+
+    Returns the number of bytes the stream buffer can hold.
+
+--*/
+
+{
+
+    return StreamBuffer->Size;
+}
+
+KSTATUS
+IoStreamBufferSetSize (
+    PSTREAM_BUFFER StreamBuffer,
+    ULONG Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine changes the capacity of a stream buffer. Any data sitting in
+    the buffer is preserved.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer.
+
+    Size - Supplies the new size of the buffer, in bytes. This is rounded up
+        to a multiple of the page size, and is never made smaller than the
+        atomic write size.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_RESOURCE_IN_USE if the buffer currently holds more data than would
+    fit in the new size.
+
+    STATUS_INVALID_PARAMETER if the size is too large.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    UINTN BytesCopied;
+    UINTN CopySize;
+    PSTREAM_BUFFER_PAGE Destination;
+    ULONG DestinationOffset;
+    BOOL LockHeld;
+    ULONG NewPageCount;
+    PSTREAM_BUFFER_PAGE NewPages;
+    ULONG PageCount;
+    ULONG PageIndex;
+    ULONG PageShift;
+    ULONG PageSize;
+    ULONG ReadOffset;
+    PSTREAM_BUFFER_PAGE Source;
+    ULONG SourceIndex;
+    ULONG SourceOffset;
+    KSTATUS Status;
+    ULONG TotalBytesAvailable;
+
+    LockHeld = FALSE;
+    NewPageCount = 0;
+    NewPages = NULL;
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    if (Size < StreamBuffer->AtomicWriteSize) {
+        Size = StreamBuffer->AtomicWriteSize;
+    }
+
+    Size = ALIGN_RANGE_UP(Size, PageSize);
+    if (Size == 0) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto StreamBufferSetSizeEnd;
+    }
+
+    NewPageCount = Size >> PageShift;
+    AllocationSize = NewPageCount * sizeof(STREAM_BUFFER_PAGE);
+    NewPages = MmAllocatePagedPool(AllocationSize, FI_ALLOCATION_TAG);
+    if (NewPages == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto StreamBufferSetSizeEnd;
+    }
+
+    RtlZeroMemory(NewPages, AllocationSize);
+    KeAcquireQueuedLock(StreamBuffer->Lock);
+    LockHeld = TRUE;
+    if (Size == StreamBuffer->Size) {
+        Status = STATUS_SUCCESS;
+        goto StreamBufferSetSizeEnd;
+    }
+
+    if (Size < StreamBuffer->DataSize) {
+        Status = STATUS_RESOURCE_IN_USE;
+        goto StreamBufferSetSizeEnd;
+    }
+
+    //
+    // The new ring starts with the first unread byte. If that byte sits at
+    // the start of a page, the existing pages (gifted or not) can just be
+    // moved over in order.
+    //
+
+    PageCount = StreamBuffer->PageCount;
+    ReadOffset = StreamBuffer->ReadOffset;
+    if (REMAINDER(ReadOffset, PageSize) == 0) {
+        SourceIndex = ReadOffset >> PageShift;
+        PageIndex = 0;
+        while ((PageIndex << PageShift) < StreamBuffer->DataSize) {
+            Source = &(StreamBuffer->Pages[SourceIndex]);
+            NewPages[PageIndex] = *Source;
+            Source->Data = NULL;
+            Source->Gift = NULL;
+            PageIndex += 1;
+            SourceIndex += 1;
+            if (SourceIndex == PageCount) {
+                SourceIndex = 0;
+            }
+        }
+
+    //
+    // Otherwise copy the data down to the start of the new ring. This only
+    // happens if the buffer is resized with a partially read page in it.
+    //
+
+    } else {
+        BytesCopied = 0;
+        while (BytesCopied < StreamBuffer->DataSize) {
+            Source = &(StreamBuffer->Pages[ReadOffset >> PageShift]);
+            SourceOffset = REMAINDER(ReadOffset, PageSize);
+            Destination = &(NewPages[BytesCopied >> PageShift]);
+            DestinationOffset = REMAINDER(BytesCopied, PageSize);
+            CopySize = StreamBuffer->DataSize - BytesCopied;
+            if (CopySize > PageSize - SourceOffset) {
+                CopySize = PageSize - SourceOffset;
+            }
+
+            if (CopySize > PageSize - DestinationOffset) {
+                CopySize = PageSize - DestinationOffset;
+            }
+
+            Status = IopStreamBufferPreparePage(Source);
+            if (!KSUCCESS(Status)) {
+                goto StreamBufferSetSizeEnd;
+            }
+
+            Status = IopStreamBufferPreparePage(Destination);
+            if (!KSUCCESS(Status)) {
+                goto StreamBufferSetSizeEnd;
+            }
+
+            RtlCopyMemory(Destination->Data + DestinationOffset,
+                          Source->Data + SourceOffset,
+                          CopySize);
+
+            BytesCopied += CopySize;
+            ReadOffset += CopySize;
+            if (ReadOffset == StreamBuffer->Size) {
+                ReadOffset = 0;
+            }
+        }
+    }
+
+    //
+    // Swap in the new ring. Whatever is left in the old one is freed below.
+    //
+
+    Source = StreamBuffer->Pages;
+    StreamBuffer->Pages = NewPages;
+    StreamBuffer->PageCount = NewPageCount;
+    StreamBuffer->Size = Size;
+    StreamBuffer->ReadOffset = 0;
+    NewPages = Source;
+    NewPageCount = PageCount;
+
+    //
+    // Let writers know about the change in space, unless the other side has
+    // gone away.
+    //
+
+    if ((StreamBuffer->IoState->Events & POLL_ERROR_EVENTS) == 0) {
+        TotalBytesAvailable = StreamBuffer->Size - StreamBuffer->DataSize;
+        if (TotalBytesAvailable >= StreamBuffer->AtomicWriteSize) {
+            IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, TRUE);
+
+        } else {
+            IoSetIoObjectState(StreamBuffer->IoState, POLL_EVENT_OUT, FALSE);
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+
+StreamBufferSetSizeEnd:
+    if (LockHeld != FALSE) {
+        KeReleaseQueuedLock(StreamBuffer->Lock);
+    }
+
+    if (NewPages != NULL) {
+        IopStreamBufferDestroyPages(NewPages, NewPageCount);
+    }
+
+    return Status;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
 
+KSTATUS
+IopStreamBufferCopyIn (
+    PSTREAM_BUFFER StreamBuffer,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset,
+    UINTN ByteCount,
+    PUINTN BytesCopied
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies data into the free space of a stream buffer, starting
+    just beyond the last unread byte. Whole, page aligned pages that come from
+    the page cache are taken by reference instead of being copied. This
+    routine assumes the stream buffer lock is held.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer to write to.
+
+    IoBuffer - Supplies a pointer to the I/O buffer containing the data.
+
+    IoBufferOffset - Supplies the offset into the I/O buffer where the data
+        starts.
+
+    ByteCount - Supplies the number of bytes to copy. The caller must make
+        sure this much space is free.
+
+    BytesCopied - Supplies a pointer where the number of bytes added to the
+        stream buffer will be returned, even on failure.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN CopySize;
+    BOOL Gifted;
+    PSTREAM_BUFFER_PAGE Page;
+    ULONG PageOffset;
+    ULONG PageSize;
+    KSTATUS Status;
+    ULONG WriteOffset;
+
+    ASSERT(ByteCount <= StreamBuffer->Size - StreamBuffer->DataSize);
+
+    *BytesCopied = 0;
+    PageSize = MmPageSize();
+    Status = STATUS_SUCCESS;
+    while (ByteCount != 0) {
+        WriteOffset = StreamBuffer->ReadOffset + StreamBuffer->DataSize;
+        if (WriteOffset >= StreamBuffer->Size) {
+            WriteOffset -= StreamBuffer->Size;
+        }
+
+        Page = &(StreamBuffer->Pages[WriteOffset >> MmPageShift()]);
+        PageOffset = REMAINDER(WriteOffset, PageSize);
+        CopySize = PageSize - PageOffset;
+        if (CopySize > ByteCount) {
+            CopySize = ByteCount;
+        }
+
+        //
+        // If a whole page of the source lines up with a whole free page of
+        // the ring, see if the source page can be handed over rather than
+        // copied. As with splice elsewhere, later changes to the file page
+        // may show through to a reader that has not gotten to it yet.
+        //
+
+        Gifted = FALSE;
+        if ((CopySize == PageSize) &&
+            (IS_ALIGNED(MmGetIoBufferCurrentOffset(IoBuffer) + IoBufferOffset,
+                        PageSize) != FALSE)) {
+
+            Gifted = IopStreamBufferGiftPage(Page, IoBuffer, IoBufferOffset);
+        }
+
+        if (Gifted == FALSE) {
+            Status = IopStreamBufferPreparePage(Page);
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+
+            Status = MmCopyIoBufferData(IoBuffer,
+                                        Page->Data + PageOffset,
+                                        IoBufferOffset,
+                                        CopySize,
+                                        FALSE);
+
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+        }
+
+        StreamBuffer->DataSize += CopySize;
+        IoBufferOffset += CopySize;
+        ByteCount -= CopySize;
+        *BytesCopied += CopySize;
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopStreamBufferCopyOut (
+    PSTREAM_BUFFER StreamBuffer,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset,
+    UINTN ByteCount,
+    PUINTN BytesCopied
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies data out of a stream buffer, consuming it. Gifted
+    pages are released as soon as the last of their data is consumed. This
+    routine assumes the stream buffer lock is held.
+
+Arguments:
+
+    StreamBuffer - Supplies a pointer to the stream buffer to read from.
+
+    IoBuffer - Supplies a pointer to the I/O buffer where the data will be
+        returned.
+
+    IoBufferOffset - Supplies the offset into the I/O buffer where the data
+        should go.
+
+    ByteCount - Supplies the number of bytes to copy. The caller must make
+        sure this much data is available.
+
+    BytesCopied - Supplies a pointer where the number of bytes consumed from
+        the stream buffer will be returned, even on failure.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN CopySize;
+    PSTREAM_BUFFER_PAGE Page;
+    ULONG PageOffset;
+    ULONG PageSize;
+    KSTATUS Status;
+
+    ASSERT(ByteCount <= StreamBuffer->DataSize);
+
+    *BytesCopied = 0;
+    PageSize = MmPageSize();
+    Status = STATUS_SUCCESS;
+    while (ByteCount != 0) {
+        Page = &(StreamBuffer->Pages[StreamBuffer->ReadOffset >>
+                                     MmPageShift()]);
+
+        PageOffset = REMAINDER(StreamBuffer->ReadOffset, PageSize);
+        CopySize = PageSize - PageOffset;
+        if (CopySize > ByteCount) {
+            CopySize = ByteCount;
+        }
+
+        if (Page->Gift != NULL) {
+            Status = MmCopyIoBuffer(IoBuffer,
+                                    IoBufferOffset,
+                                    Page->Gift,
+                                    PageOffset,
+                                    CopySize);
+
+        } else {
+
+            ASSERT(Page->Data != NULL);
+
+            Status = MmCopyIoBufferData(IoBuffer,
+                                        Page->Data + PageOffset,
+                                        IoBufferOffset,
+                                        CopySize,
+                                        TRUE);
+        }
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        StreamBuffer->ReadOffset += CopySize;
+        if (StreamBuffer->ReadOffset == StreamBuffer->Size) {
+            StreamBuffer->ReadOffset = 0;
+        }
+
+        StreamBuffer->DataSize -= CopySize;
+        IoBufferOffset += CopySize;
+        ByteCount -= CopySize;
+        *BytesCopied += CopySize;
+
+        //
+        // Once a gifted page has been consumed, drop it so the page cache can
+        // have it back. When the buffer drains, start over at the beginning
+        // so that the next writer is page aligned again.
+        //
+
+        if ((PageOffset + CopySize == PageSize) ||
+            (StreamBuffer->DataSize == 0)) {
+
+            IopStreamBufferReleaseGift(Page);
+        }
+
+        if (StreamBuffer->DataSize == 0) {
+            StreamBuffer->ReadOffset = 0;
+        }
+    }
+
+    return Status;
+}
+
+BOOL
+IopStreamBufferGiftPage (
+    PSTREAM_BUFFER_PAGE Page,
+    PIO_BUFFER IoBuffer,
+    UINTN IoBufferOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to take a reference on the page cache page backing
+    the given page of an I/O buffer and stick it in the ring, rather than
+    copying the data.
+
+Arguments:
+
+    Page - Supplies a pointer to the free ring page to fill.
+
+    IoBuffer - Supplies a pointer to the I/O buffer containing the data.
+
+    IoBufferOffset - Supplies the page aligned offset into the I/O buffer of
+        the page to take.
+
+Return Value:
+
+    TRUE if the page was taken.
+
+    FALSE if the page is not backed by the page cache or the gift could not be
+    set up. The caller should copy the data instead.
+
+--*/
+
+{
+
+    PIO_BUFFER Gift;
+    PVOID PageCacheEntry;
+
+    ASSERT(Page->Gift == NULL);
+
+    PageCacheEntry = MmGetIoBufferPageCacheEntry(IoBuffer, IoBufferOffset);
+    if (PageCacheEntry == NULL) {
+        return FALSE;
+    }
+
+    //
+    // Appending the page cache entry to the I/O buffer takes a reference on
+    // it, which is dropped when the I/O buffer is freed.
+    //
+
+    Gift = MmAllocateUninitializedIoBuffer(MmPageSize(), 0);
+    if (Gift == NULL) {
+        return FALSE;
+    }
+
+    MmIoBufferAppendPage(Gift, PageCacheEntry, NULL, INVALID_PHYSICAL_ADDRESS);
+    Page->Gift = Gift;
+    return TRUE;
+}
+
+KSTATUS
+IopStreamBufferPreparePage (
+    PSTREAM_BUFFER_PAGE Page
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets a ring page ready to be written to or copied directly,
+    allocating its data page if needed and pulling any gifted data into it.
+
+Arguments:
+
+    Page - Supplies a pointer to the ring page.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG PageSize;
+    KSTATUS Status;
+
+    PageSize = MmPageSize();
+    if (Page->Data == NULL) {
+        Page->Data = MmAllocatePagedPool(PageSize, FI_ALLOCATION_TAG);
+        if (Page->Data == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    //
+    // A writer wrapping around into a partially read gifted page needs the
+    // data to be in memory the stream buffer owns.
+    //
+
+    if (Page->Gift != NULL) {
+        Status = MmCopyIoBufferData(Page->Gift,
+                                    Page->Data,
+                                    0,
+                                    PageSize,
+                                    FALSE);
+
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        IopStreamBufferReleaseGift(Page);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopStreamBufferReleaseGift (
+    PSTREAM_BUFFER_PAGE Page
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases the gifted page cache page in a ring page, if any.
+
+Arguments:
+
+    Page - Supplies a pointer to the ring page.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Page->Gift != NULL) {
+        MmFreeIoBuffer(Page->Gift);
+        Page->Gift = NULL;
+    }
+
+    return;
+}
+
+VOID
+IopStreamBufferDestroyPages (
+    PSTREAM_BUFFER_PAGE Pages,
+    ULONG PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees an array of ring pages and everything in them.
+
+Arguments:
+
+    Pages - Supplies a pointer to the array of ring pages.
+
+    PageCount - Supplies the number of elements in the array.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG PageIndex;
+
+    for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+        IopStreamBufferReleaseGift(&(Pages[PageIndex]));
+        if (Pages[PageIndex].Data != NULL) {
+            MmFreePagedPool(Pages[PageIndex].Data);
+        }
+    }
+
+    MmFreePagedPool(Pages);
+    return;
+}
+
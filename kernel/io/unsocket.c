@@ -58,6 +58,21 @@ Module Name:
 
 #define UNIX_SOCKET_MAX_CONTROL_DATA 32768
 
+//
+// Define the data capacity of a cacheable Unix socket packet. Sends at or
+// below this size are carved from a small per-socket cache of free packets
+// rather than from paged pool, and small stream sends are coalesced into the
+// spare room of the last packet on the receive queue.
+//
+
+#define UNIX_SOCKET_PACKET_CACHE_DATA_SIZE 512
+
+//
+// Define the maximum number of free packets each socket keeps cached.
+//
+
+#define UNIX_SOCKET_PACKET_CACHE_MAX 16
+
 //
 // Define local socket flags.
 //
@@ -127,6 +142,10 @@ Structure Description:
 
     Length - Stores the length of the data, in bytes.
 
+    Capacity - Stores the size of the data buffer, in bytes. Packets with a
+        capacity of UNIX_SOCKET_PACKET_CACHE_DATA_SIZE are returned to the
+        sender's packet cache when destroyed.
+
     Offset - Stores the number of bytes the receiver has already returned.
 
     Sender - Stores a pointer to the sender. This structure holds a reference
@@ -146,6 +165,7 @@ typedef struct _UNIX_SOCKET_PACKET {
     LIST_ENTRY ListEntry;
     PVOID Data;
     UINTN Length;
+    UINTN Capacity;
     UINTN Offset;
     PUNIX_SOCKET Sender;
     UNIX_SOCKET_CREDENTIALS Credentials;
@@ -202,6 +222,12 @@ Structure Description:
     Credentials - Stores the credentials of the process when the socket was
         connected.
 
+    PacketCache - Stores the head of the list of free packets this socket can
+        reuse when sending small amounts of data. This list is protected by
+        the socket lock.
+
+    PacketCacheCount - Stores the number of packets on the packet cache list.
+
 --*/
 
 struct _UNIX_SOCKET {
@@ -220,6 +246,8 @@ struct _UNIX_SOCKET {
     PUNIX_SOCKET Remote;
     ULONG Flags;
     UNIX_SOCKET_CREDENTIALS Credentials;
+    LIST_ENTRY PacketCache;
+    UINTN PacketCacheCount;
 };
 
 //
@@ -251,6 +279,18 @@ IopUnixSocketDestroyPacket (
     PUNIX_SOCKET_PACKET Packet
     );
 
+VOID
+IopUnixSocketFreePacket (
+    PUNIX_SOCKET Sender,
+    PUNIX_SOCKET_PACKET Packet
+    );
+
+BOOL
+IopUnixSocketCoalescePacket (
+    PUNIX_SOCKET Receiver,
+    PUNIX_SOCKET_PACKET Packet
+    );
+
 KSTATUS
 IopUnixSocketSendControlData (
     BOOL FromKernelMode,
@@ -466,6 +506,7 @@ Return Value:
     Socket->State = UnixSocketStateInitialized;
     INITIALIZE_LIST_HEAD(&(Socket->ReceiveList));
     INITIALIZE_LIST_HEAD(&(Socket->ConnectionListEntry));
+    INITIALIZE_LIST_HEAD(&(Socket->PacketCache));
     Socket->SendListMax = UNIX_SOCKET_DEFAULT_SEND_MAX;
     Socket->Credentials.ProcessId = -1;
     Socket->Credentials.UserId = -1;
@@ -515,6 +556,7 @@ Return Value:
 
 {
 
+    PUNIX_SOCKET_PACKET Packet;
     PUNIX_SOCKET UnixSocket;
 
     UnixSocket = (PUNIX_SOCKET)Socket;
@@ -524,6 +566,17 @@ Return Value:
     ASSERT(UnixSocket->SendListSize == 0);
     ASSERT(LIST_EMPTY(&(UnixSocket->ReceiveList)) != FALSE);
 
+    while (LIST_EMPTY(&(UnixSocket->PacketCache)) == FALSE) {
+        Packet = LIST_VALUE(UnixSocket->PacketCache.Next,
+                            UNIX_SOCKET_PACKET,
+                            ListEntry);
+
+        LIST_REMOVE(&(Packet->ListEntry));
+        MmFreePagedPool(Packet);
+    }
+
+    UnixSocket->PacketCacheCount = 0;
+
     if (UnixSocket->PathPoint.PathEntry != NULL) {
         IO_PATH_POINT_RELEASE_REFERENCE(&(UnixSocket->PathPoint));
         UnixSocket->PathPoint.PathEntry = NULL;
@@ -1347,6 +1400,7 @@ Return Value:
 {
 
     UINTN BytesCompleted;
+    BOOL Coalesced;
     PNETWORK_ADDRESS Destination;
     NETWORK_ADDRESS DestinationLocal;
     PFILE_OBJECT FileObject;
@@ -1674,19 +1728,38 @@ Return Value:
             goto UnixSocketSendDataEnd;
         }
 
-        INSERT_BEFORE(&(Packet->ListEntry), &(RemoteUnixSocket->ReceiveList));
-
         //
-        // If this is the only item on the list, signal the remote socket.
+        // Small stream sends get folded into the last packet on the queue if
+        // there is room. Otherwise queue the packet, and if this is the only
+        // item on the list, signal the remote socket.
         //
 
-        if (Packet->ListEntry.Previous == &(RemoteUnixSocket->ReceiveList)) {
-            IoSetIoObjectState(RemoteUnixSocket->KernelSocket.IoState,
-                               POLL_EVENT_IN,
-                               TRUE);
+        Coalesced = IopUnixSocketCoalescePacket(RemoteUnixSocket, Packet);
+        if (Coalesced == FALSE) {
+            INSERT_BEFORE(&(Packet->ListEntry),
+                          &(RemoteUnixSocket->ReceiveList));
+
+            if (Packet->ListEntry.Previous ==
+                &(RemoteUnixSocket->ReceiveList)) {
+
+                IoSetIoObjectState(RemoteUnixSocket->KernelSocket.IoState,
+                                   POLL_EVENT_IN,
+                                   TRUE);
+            }
         }
 
         KeReleaseQueuedLock(RemoteUnixSocket->Lock);
+
+        //
+        // The data from a coalesced packet now lives in the queued packet
+        // (which carries the charge), so the empty shell can go back to the
+        // cache.
+        //
+
+        if (Coalesced != FALSE) {
+            IopUnixSocketDestroyPacket(Packet);
+        }
+
         Packet = NULL;
         BytesCompleted += PacketSize;
         Size -= PacketSize;
@@ -1716,6 +1789,13 @@ Return Value:
                 IoSetIoObjectState(Socket->IoState, POLL_EVENT_OUT, TRUE);
             }
 
+            //
+            // Destroying the packet may acquire the socket lock to return it
+            // to the cache.
+            //
+
+            KeReleaseQueuedLock(UnixSocket->Lock);
+            UnixSocketLockHeld = FALSE;
             IopUnixSocketDestroyPacket(Packet);
         }
     }
@@ -2680,7 +2760,8 @@ IopUnixSocketCreatePacket (
 Routine Description:
 
     This routine creates a socket packet structure, and takes a reference on
-    the sender on success.
+    the sender on success. Small packets are taken from the sender's packet
+    cache if possible. This routine assumes the sender's lock is held.
 
 Arguments:
 
@@ -2704,19 +2785,40 @@ Return Value:
 
 {
 
-    UINTN AllocationSize;
+    UINTN Capacity;
     PUNIX_SOCKET_PACKET Packet;
     KSTATUS Status;
 
-    AllocationSize = sizeof(UNIX_SOCKET_PACKET) + DataSize;
-    Packet = MmAllocatePagedPool(AllocationSize, UNIX_SOCKET_ALLOCATION_TAG);
+    Packet = NULL;
+    Capacity = DataSize;
+    if (DataSize <= UNIX_SOCKET_PACKET_CACHE_DATA_SIZE) {
+        Capacity = UNIX_SOCKET_PACKET_CACHE_DATA_SIZE;
+        if (LIST_EMPTY(&(Sender->PacketCache)) == FALSE) {
+            Packet = LIST_VALUE(Sender->PacketCache.Next,
+                                UNIX_SOCKET_PACKET,
+                                ListEntry);
+
+            LIST_REMOVE(&(Packet->ListEntry));
+
+            ASSERT(Sender->PacketCacheCount != 0);
+
+            Sender->PacketCacheCount -= 1;
+        }
+    }
+
     if (Packet == NULL) {
-        return STATUS_INSUFFICIENT_RESOURCES;
+        Packet = MmAllocatePagedPool(sizeof(UNIX_SOCKET_PACKET) + Capacity,
+                                     UNIX_SOCKET_ALLOCATION_TAG);
+
+        if (Packet == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
     }
 
     Packet->Sender = Sender;
     Packet->Data = (PVOID)(Packet + 1);
     Packet->Length = DataSize;
+    Packet->Capacity = Capacity;
     Packet->Offset = 0;
     Packet->Credentials.ProcessId = -1;
     Packet->Credentials.UserId = -1;
@@ -2731,7 +2833,7 @@ Return Value:
                                     FALSE);
 
         if (!KSUCCESS(Status)) {
-            MmFreePagedPool(Packet);
+            IopUnixSocketFreePacket(Sender, Packet);
             return Status;
         }
     }
@@ -2750,7 +2852,9 @@ IopUnixSocketDestroyPacket (
 
 Routine Description:
 
-    This routine destroys a socket packet structure.
+    This routine destroys a socket packet structure. This routine acquires
+    the sender's lock to return small packets to its cache, so it must not be
+    called with that lock held.
 
 Arguments:
 
@@ -2766,6 +2870,7 @@ Return Value:
 
     UINTN Index;
     PIO_HANDLE *IoHandleArray;
+    PUNIX_SOCKET Sender;
 
     //
     // Release any handles and free the array if present.
@@ -2780,11 +2885,133 @@ Return Value:
         MmFreePagedPool(IoHandleArray);
     }
 
-    IoSocketReleaseReference(&(Packet->Sender->KernelSocket));
-    MmFreePagedPool(Packet);
+    //
+    // The packet holds a reference on the sender, so the sender is still
+    // around to take the packet back.
+    //
+
+    Sender = Packet->Sender;
+    if (Packet->Capacity == UNIX_SOCKET_PACKET_CACHE_DATA_SIZE) {
+        KeAcquireQueuedLock(Sender->Lock);
+        IopUnixSocketFreePacket(Sender, Packet);
+        KeReleaseQueuedLock(Sender->Lock);
+
+    } else {
+        MmFreePagedPool(Packet);
+    }
+
+    IoSocketReleaseReference(&(Sender->KernelSocket));
+    return;
+}
+
+VOID
+IopUnixSocketFreePacket (
+    PUNIX_SOCKET Sender,
+    PUNIX_SOCKET_PACKET Packet
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the memory backing a socket packet, placing it on the
+    sender's packet cache if there is room. This routine does not release any
+    handles or references held by the packet. It assumes the sender's lock is
+    held.
+
+Arguments:
+
+    Sender - Supplies a pointer to the socket that created the packet.
+
+    Packet - Supplies a pointer to the packet to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if ((Packet->Capacity == UNIX_SOCKET_PACKET_CACHE_DATA_SIZE) &&
+        (Sender->PacketCacheCount < UNIX_SOCKET_PACKET_CACHE_MAX)) {
+
+        INSERT_AFTER(&(Packet->ListEntry), &(Sender->PacketCache));
+        Sender->PacketCacheCount += 1;
+
+    } else {
+        MmFreePagedPool(Packet);
+    }
+
     return;
 }
 
+BOOL
+IopUnixSocketCoalescePacket (
+    PUNIX_SOCKET Receiver,
+    PUNIX_SOCKET_PACKET Packet
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to append the data from a new stream packet onto the
+    last packet in the receiver's queue. This only succeeds if both packets
+    came from the same sender, neither carries ancillary data, and the queued
+    packet has enough spare capacity. This routine assumes the receiver's lock
+    is held.
+
+Arguments:
+
+    Receiver - Supplies a pointer to the socket receiving the packet.
+
+    Packet - Supplies a pointer to the new packet.
+
+Return Value:
+
+    TRUE if the data was appended to an existing packet. The caller should
+    destroy the new packet, whose send charge is now carried by the queued
+    packet.
+
+    FALSE if the packet needs to be queued on its own.
+
+--*/
+
+{
+
+    PUNIX_SOCKET_PACKET Tail;
+
+    if ((Receiver->KernelSocket.Type != NetSocketStream) ||
+        (LIST_EMPTY(&(Receiver->ReceiveList)) != FALSE)) {
+
+        return FALSE;
+    }
+
+    Tail = LIST_VALUE(Receiver->ReceiveList.Previous,
+                      UNIX_SOCKET_PACKET,
+                      ListEntry);
+
+    if ((Tail->Sender != Packet->Sender) ||
+        (Tail->HandleCount != 0) ||
+        (Packet->HandleCount != 0) ||
+        (Tail->Credentials.ProcessId != -1) ||
+        (Tail->Credentials.UserId != -1) ||
+        (Tail->Credentials.GroupId != -1) ||
+        (Packet->Credentials.ProcessId != -1) ||
+        (Packet->Credentials.UserId != -1) ||
+        (Packet->Credentials.GroupId != -1) ||
+        (Tail->Capacity - Tail->Length < Packet->Length)) {
+
+        return FALSE;
+    }
+
+    RtlCopyMemory(Tail->Data + Tail->Length, Packet->Data, Packet->Length);
+    Tail->Length += Packet->Length;
+    Packet->Length = 0;
+    return TRUE;
+}
+
 KSTATUS
 IopUnixSocketSendControlData (
     BOOL FromKernelMode,
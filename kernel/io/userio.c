@@ -50,7 +50,8 @@ Module Name:
            (SYS_OPEN_FLAG_NO_CONTROLLING_TERMINAL == \
             OPEN_FLAG_NO_CONTROLLING_TERMINAL) && \
            (SYS_OPEN_FLAG_NO_ACCESS_TIME == OPEN_FLAG_NO_ACCESS_TIME)  && \
-           (SYS_OPEN_FLAG_ASYNCHRONOUS == OPEN_FLAG_ASYNCHRONOUS))
+           (SYS_OPEN_FLAG_ASYNCHRONOUS == OPEN_FLAG_ASYNCHRONOUS) && \
+           (SYS_OPEN_FLAG_DIRECT == OPEN_FLAG_DIRECT))
 
 //
 // ---------------------------------------------------------------- Definitions
@@ -2195,6 +2196,41 @@ Return Value:
 
         break;
 
+    case FileControlCommandGetPipeSize:
+        Status = IopGetSetPipeSize(IoHandle,
+                                   &(LocalParameters.PipeSize),
+                                   FALSE);
+
+        if (KSUCCESS(Status)) {
+            CopyOutSize = sizeof(ULONG);
+        }
+
+        break;
+
+    case FileControlCommandSetPipeSize:
+        if (FileControl->Parameters == NULL) {
+            Status = STATUS_INVALID_PARAMETER;
+            goto SysFileControlEnd;
+        }
+
+        Status = MmCopyFromUserMode(&LocalParameters,
+                                    FileControl->Parameters,
+                                    sizeof(ULONG));
+
+        if (!KSUCCESS(Status)) {
+            goto SysFileControlEnd;
+        }
+
+        Status = IopGetSetPipeSize(IoHandle,
+                                   &(LocalParameters.PipeSize),
+                                   TRUE);
+
+        if (KSUCCESS(Status)) {
+            CopyOutSize = sizeof(ULONG);
+        }
+
+        break;
+
     default:
         Status = STATUS_INVALID_PARAMETER;
         break;
@@ -0,0 +1,866 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    writebk.c
+
+Abstract:
+
+    This module implements per-device page cache writeback. Each backing
+    device gets its own flusher thread and dirty page accounting, so a slow
+    device cannot hold up writeback to a fast one, and writers to a device are
+    throttled according to how quickly that device drains.
+
+Author:
+
+    Evan Green 18-Oct-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+#include "pagecach.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define WRITEBACK_ALLOCATION_TAG 0x6B426257 // 'kBbW'
+
+//
+// Define the minimum number of pages a flush pass must write before it is
+// trusted as a bandwidth sample.
+//
+
+#define WRITEBACK_BANDWIDTH_MINIMUM_SAMPLE 32
+
+//
+// Define the weight of each new bandwidth sample, as a shift. A shift of 2
+// folds a quarter of each new sample into the average.
+//
+
+#define WRITEBACK_BANDWIDTH_SHIFT 2
+
+//
+// Define the smallest share of the dirty limit any device gets, as a shift.
+// This lets a device that has not yet shown any bandwidth make progress.
+//
+
+#define WRITEBACK_MINIMUM_SHARE_SHIFT 3
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+PWRITEBACK_DEVICE
+IopCreateWritebackDevice (
+    DEVICE_ID DeviceId
+    );
+
+VOID
+IopDestroyWritebackDevice (
+    PWRITEBACK_DEVICE Writeback
+    );
+
+VOID
+IopScheduleWritebackDevice (
+    PWRITEBACK_DEVICE Writeback
+    );
+
+VOID
+IopWritebackThread (
+    PVOID Parameter
+    );
+
+VOID
+IopUpdateWritebackBandwidth (
+    PWRITEBACK_DEVICE Writeback,
+    ULONGLONG StartTime,
+    UINTN StartWrittenPageCount
+    );
+
+PWRITEBACK_DEVICE
+IopLookupWritebackDevice (
+    DEVICE_ID DeviceId
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store the list of writeback devices, and the lock that protects it along
+// with each device's reference count.
+//
+
+LIST_ENTRY IoWritebackDeviceList;
+PQUEUED_LOCK IoWritebackDeviceListLock;
+
+//
+// Store the sum of the bandwidth of every writeback device, in pages per
+// second.
+//
+
+volatile UINTN IoWritebackTotalBandwidth;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+IoGetWritebackStatistics (
+    PIO_WRITEBACK_STATISTICS Statistics,
+    PUINTN BufferSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine collects the page cache writeback statistics for every
+    backing device that currently has file objects in the system.
+
+Arguments:
+
+    Statistics - Supplies a pointer to an array that receives one element per
+        backing device.
+
+    BufferSize - Supplies a pointer to the size of the array in bytes. Upon
+        return this either holds the number of bytes actually used or, if the
+        buffer is too small, the expected buffer size.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_BUFFER_TOO_SMALL if the array cannot hold every device.
+
+--*/
+
+{
+
+    UINTN Count;
+    PLIST_ENTRY CurrentEntry;
+    UINTN DirtyLimit;
+    UINTN Index;
+    KSTATUS Status;
+    PWRITEBACK_DEVICE Writeback;
+
+    DirtyLimit = IopGetPageCacheDirtyLimit();
+    KeAcquireQueuedLock(IoWritebackDeviceListLock);
+    Count = 0;
+    CurrentEntry = IoWritebackDeviceList.Next;
+    while (CurrentEntry != &IoWritebackDeviceList) {
+        Count += 1;
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    if (*BufferSize < (Count * sizeof(IO_WRITEBACK_STATISTICS))) {
+        Status = STATUS_BUFFER_TOO_SMALL;
+        goto GetWritebackStatisticsEnd;
+    }
+
+    Index = 0;
+    CurrentEntry = IoWritebackDeviceList.Next;
+    while (CurrentEntry != &IoWritebackDeviceList) {
+        Writeback = LIST_VALUE(CurrentEntry, WRITEBACK_DEVICE, ListEntry);
+        Statistics[Index].DeviceId = Writeback->DeviceId;
+        Statistics[Index].DirtyPageCount = Writeback->DirtyPageCount;
+        Statistics[Index].WritebackPageCount = Writeback->WritebackPageCount;
+        Statistics[Index].WrittenPageCount = Writeback->WrittenPageCount;
+        Statistics[Index].Bandwidth = Writeback->Bandwidth;
+        Statistics[Index].DirtyLimit = IopGetWritebackDirtyLimit(Writeback,
+                                                                 DirtyLimit);
+
+        Index += 1;
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    Status = STATUS_SUCCESS;
+
+GetWritebackStatisticsEnd:
+    KeReleaseQueuedLock(IoWritebackDeviceListLock);
+    *BufferSize = Count * sizeof(IO_WRITEBACK_STATISTICS);
+    return Status;
+}
+
+KSTATUS
+IopInitializeWriteback (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes support for per-device page cache writeback.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    INITIALIZE_LIST_HEAD(&IoWritebackDeviceList);
+    IoWritebackDeviceListLock = KeCreateQueuedLock();
+    if (IoWritebackDeviceListLock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+IopGetWritebackDevice (
+    PDEVICE Device,
+    PWRITEBACK_DEVICE *Writeback
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up or creates the writeback state for the device that
+    stores the given device's data, and takes a reference on it. Volumes are
+    backed by their target device.
+
+Arguments:
+
+    Device - Supplies a pointer to the device or volume that owns a file
+        object.
+
+    Writeback - Supplies a pointer where a pointer to the writeback state will
+        be returned on success. The caller is responsible for releasing the
+        reference.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PDEVICE BackingDevice;
+    PWRITEBACK_DEVICE Existing;
+    PWRITEBACK_DEVICE NewWriteback;
+
+    ASSERT(IS_DEVICE_OR_VOLUME(Device) != FALSE);
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    BackingDevice = Device;
+    if ((Device->Header.Type == ObjectVolume) &&
+        (Device->TargetDevice != NULL)) {
+
+        BackingDevice = Device->TargetDevice;
+    }
+
+    KeAcquireQueuedLock(IoWritebackDeviceListLock);
+    Existing = IopLookupWritebackDevice(BackingDevice->DeviceId);
+    if (Existing != NULL) {
+        Existing->ReferenceCount += 1;
+    }
+
+    KeReleaseQueuedLock(IoWritebackDeviceListLock);
+    if (Existing != NULL) {
+        *Writeback = Existing;
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // Create the new writeback device and its thread outside the lock, then
+    // check again in case someone else beat this thread to it.
+    //
+
+    NewWriteback = IopCreateWritebackDevice(BackingDevice->DeviceId);
+    if (NewWriteback == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeAcquireQueuedLock(IoWritebackDeviceListLock);
+    Existing = IopLookupWritebackDevice(BackingDevice->DeviceId);
+    if (Existing != NULL) {
+        Existing->ReferenceCount += 1;
+
+    } else {
+        INSERT_BEFORE(&(NewWriteback->ListEntry), &IoWritebackDeviceList);
+        Existing = NewWriteback;
+        NewWriteback = NULL;
+    }
+
+    KeReleaseQueuedLock(IoWritebackDeviceListLock);
+
+    //
+    // If the new one lost the race, tell its thread to tear it down.
+    //
+
+    if (NewWriteback != NULL) {
+        NewWriteback->Exiting = TRUE;
+        KeSignalEvent(NewWriteback->Event, SignalOptionSignalAll);
+    }
+
+    *Writeback = Existing;
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopWritebackDeviceReleaseReference (
+    PWRITEBACK_DEVICE Writeback
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a reference on a writeback device. When the last
+    file object using it goes away, its flusher thread is told to exit and
+    destroy it.
+
+Arguments:
+
+    Writeback - Supplies a pointer to the writeback device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL Destroy;
+
+    Destroy = FALSE;
+    KeAcquireQueuedLock(IoWritebackDeviceListLock);
+
+    ASSERT((Writeback->ReferenceCount != 0) &&
+           (Writeback->ReferenceCount < 0x10000000));
+
+    Writeback->ReferenceCount -= 1;
+    if (Writeback->ReferenceCount == 0) {
+        LIST_REMOVE(&(Writeback->ListEntry));
+        Writeback->ListEntry.Next = NULL;
+        Destroy = TRUE;
+    }
+
+    KeReleaseQueuedLock(IoWritebackDeviceListLock);
+    if (Destroy != FALSE) {
+
+        ASSERT(Writeback->DirtyPageCount == 0);
+
+        Writeback->Exiting = TRUE;
+        KeSignalEvent(Writeback->Event, SignalOptionSignalAll);
+    }
+
+    return;
+}
+
+VOID
+IopScheduleWriteback (
+    PFILE_OBJECT FileObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine schedules the flusher responsible for the given file object
+    to run some time in the future. File objects without a writeback device
+    are left to the page cache thread.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object that was dirtied.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (FileObject->Writeback == NULL) {
+        IopSchedulePageCacheThread();
+
+    } else {
+        IopScheduleWritebackDevice(FileObject->Writeback);
+    }
+
+    return;
+}
+
+VOID
+IopWakeWritebackThreads (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine wakes every writeback thread to flush its device now,
+    rather than waiting for writes to pool.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PWRITEBACK_DEVICE Writeback;
+
+    KeAcquireQueuedLock(IoWritebackDeviceListLock);
+    CurrentEntry = IoWritebackDeviceList.Next;
+    while (CurrentEntry != &IoWritebackDeviceList) {
+        Writeback = LIST_VALUE(CurrentEntry, WRITEBACK_DEVICE, ListEntry);
+        KeSignalEvent(Writeback->Event, SignalOptionSignalAll);
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    KeReleaseQueuedLock(IoWritebackDeviceListLock);
+    return;
+}
+
+UINTN
+IopGetWritebackDirtyLimit (
+    PWRITEBACK_DEVICE Writeback,
+    UINTN DirtyLimit
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines how many dirty pages the given device may hold
+    before writers to it get throttled. Each device gets a share of the
+    system-wide limit proportional to how fast it has recently been writing.
+
+Arguments:
+
+    Writeback - Supplies a pointer to the writeback device.
+
+    DirtyLimit - Supplies the system-wide dirty page limit.
+
+Return Value:
+
+    Returns the device's dirty page limit.
+
+--*/
+
+{
+
+    UINTN Bandwidth;
+    ULONGLONG Limit;
+    UINTN Minimum;
+    UINTN TotalBandwidth;
+
+    Bandwidth = Writeback->Bandwidth;
+    TotalBandwidth = IoWritebackTotalBandwidth;
+    if ((TotalBandwidth == 0) || (Bandwidth >= TotalBandwidth)) {
+        return DirtyLimit;
+    }
+
+    Limit = ((ULONGLONG)DirtyLimit * Bandwidth) / TotalBandwidth;
+    Minimum = DirtyLimit >> WRITEBACK_MINIMUM_SHARE_SHIFT;
+    if (Limit < Minimum) {
+        Limit = Minimum;
+    }
+
+    return (UINTN)Limit;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+PWRITEBACK_DEVICE
+IopCreateWritebackDevice (
+    DEVICE_ID DeviceId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a writeback device and starts its flusher thread.
+
+Arguments:
+
+    DeviceId - Supplies the ID of the backing device.
+
+Return Value:
+
+    Returns a pointer to the new writeback device with one reference on
+    success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    KSTATUS Status;
+    PWRITEBACK_DEVICE Writeback;
+
+    Writeback = MmAllocateNonPagedPool(sizeof(WRITEBACK_DEVICE),
+                                       WRITEBACK_ALLOCATION_TAG);
+
+    if (Writeback == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(Writeback, sizeof(WRITEBACK_DEVICE));
+    Writeback->DeviceId = DeviceId;
+    Writeback->ReferenceCount = 1;
+    Writeback->State = WritebackStateClean;
+    Writeback->Timer = KeCreateTimer(WRITEBACK_ALLOCATION_TAG);
+    if (Writeback->Timer == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateWritebackDeviceEnd;
+    }
+
+    Writeback->Event = KeCreateEvent(NULL);
+    if (Writeback->Event == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateWritebackDeviceEnd;
+    }
+
+    Status = PsCreateKernelThread(IopWritebackThread,
+                                  Writeback,
+                                  "IopWritebackThread");
+
+CreateWritebackDeviceEnd:
+    if (!KSUCCESS(Status)) {
+        IopDestroyWritebackDevice(Writeback);
+        Writeback = NULL;
+    }
+
+    return Writeback;
+}
+
+VOID
+IopDestroyWritebackDevice (
+    PWRITEBACK_DEVICE Writeback
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a writeback device. Its thread must not be running.
+
+Arguments:
+
+    Writeback - Supplies a pointer to the writeback device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Writeback->ListEntry.Next == NULL);
+
+    if (Writeback->Timer != NULL) {
+        KeCancelTimer(Writeback->Timer);
+        KeDestroyTimer(Writeback->Timer);
+    }
+
+    if (Writeback->Event != NULL) {
+        KeDestroyEvent(Writeback->Event);
+    }
+
+    MmFreeNonPagedPool(Writeback);
+    return;
+}
+
+VOID
+IopScheduleWritebackDevice (
+    PWRITEBACK_DEVICE Writeback
+    )
+
+/*++
+
+Routine Description:
+
+    This routine schedules a flush of the given device for some time in the
+    future.
+
+Arguments:
+
+    Writeback - Supplies a pointer to the writeback device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    WRITEBACK_STATE OldState;
+    KSTATUS Status;
+
+    //
+    // Do a quick exit check without the atomic first.
+    //
+
+    if (Writeback->State == WritebackStateDirty) {
+        return;
+    }
+
+    //
+    // Try to take the state from clean to dirty. If this thread won, then
+    // queue the timer.
+    //
+
+    OldState = RtlAtomicCompareExchange32(&(Writeback->State),
+                                          WritebackStateDirty,
+                                          WritebackStateClean);
+
+    if (OldState == WritebackStateClean) {
+
+        ASSERT(IoPageCacheCleanInterval != 0);
+
+        Status = KeQueueTimer(Writeback->Timer,
+                              TimerQueueSoftWake,
+                              0,
+                              IoPageCacheCleanInterval,
+                              0,
+                              NULL);
+
+        ASSERT(KSUCCESS(Status));
+    }
+
+    return;
+}
+
+VOID
+IopWritebackThread (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine flushes the dirty file objects of a single backing device.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the writeback device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID SignalingObject;
+    ULONGLONG StartTime;
+    UINTN StartWrittenPageCount;
+    KSTATUS Status;
+    PVOID WaitObjectArray[2];
+    PWRITEBACK_DEVICE Writeback;
+
+    Writeback = Parameter;
+    Writeback->Thread = KeGetCurrentThread();
+
+    ASSERT(2 < BUILTIN_WAIT_BLOCK_ENTRY_COUNT);
+
+    WaitObjectArray[0] = Writeback->Timer;
+    WaitObjectArray[1] = Writeback->Event;
+    while (TRUE) {
+        Status = ObWaitOnObjects(WaitObjectArray,
+                                 2,
+                                 0,
+                                 WAIT_TIME_INDEFINITE,
+                                 NULL,
+                                 &SignalingObject);
+
+        ASSERT(KSUCCESS(Status));
+
+        //
+        // Unsignal the event before checking for exit, so that an exit
+        // request arriving in between leaves the event signaled.
+        //
+
+        KeSignalEvent(Writeback->Event, SignalOptionUnsignal);
+        if (Writeback->Exiting != FALSE) {
+            break;
+        }
+
+        StartTime = HlQueryTimeCounter();
+        StartWrittenPageCount = Writeback->WrittenPageCount;
+        IopFlushFileObjects(Writeback->DeviceId,
+                            IO_FLAG_HARD_FLUSH_ALLOWED,
+                            NULL);
+
+        IopUpdateWritebackBandwidth(Writeback,
+                                    StartTime,
+                                    StartWrittenPageCount);
+
+        //
+        // Go dormant, then see if any dirtiness snuck in while that was
+        // happening.
+        //
+
+        KeCancelTimer(Writeback->Timer);
+        RtlAtomicExchange32(&(Writeback->State), WritebackStateClean);
+        if ((Writeback->DirtyPageCount != 0) ||
+            (IopHasDirtyFileObjects(Writeback->DeviceId) != FALSE)) {
+
+            IopScheduleWritebackDevice(Writeback);
+        }
+    }
+
+    //
+    // Only this thread updates the bandwidth, so it is the one to take the
+    // device back out of the total.
+    //
+
+    RtlAtomicAdd(&IoWritebackTotalBandwidth, -Writeback->Bandwidth);
+    IopDestroyWritebackDevice(Writeback);
+    return;
+}
+
+VOID
+IopUpdateWritebackBandwidth (
+    PWRITEBACK_DEVICE Writeback,
+    ULONGLONG StartTime,
+    UINTN StartWrittenPageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine folds the rate observed over a flush pass into the device's
+    bandwidth estimate. Only the device's own thread calls this.
+
+Arguments:
+
+    Writeback - Supplies a pointer to the writeback device.
+
+    StartTime - Supplies the time counter value when the pass started.
+
+    StartWrittenPageCount - Supplies the device's written page count when the
+        pass started.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN Bandwidth;
+    ULONGLONG Elapsed;
+    UINTN OldBandwidth;
+    ULONGLONG Sample;
+    UINTN Written;
+
+    Written = Writeback->WrittenPageCount - StartWrittenPageCount;
+    Elapsed = HlQueryTimeCounter() - StartTime;
+    if ((Written < WRITEBACK_BANDWIDTH_MINIMUM_SAMPLE) || (Elapsed == 0)) {
+        return;
+    }
+
+    Sample = ((ULONGLONG)Written * HlQueryTimeCounterFrequency()) / Elapsed;
+    if (Sample > MAX_UINTN) {
+        Sample = MAX_UINTN;
+    }
+
+    OldBandwidth = Writeback->Bandwidth;
+    if (OldBandwidth == 0) {
+        Bandwidth = (UINTN)Sample;
+
+    } else {
+        Bandwidth = OldBandwidth -
+                    (OldBandwidth >> WRITEBACK_BANDWIDTH_SHIFT) +
+                    ((UINTN)Sample >> WRITEBACK_BANDWIDTH_SHIFT);
+    }
+
+    Writeback->Bandwidth = Bandwidth;
+    RtlAtomicAdd(&IoWritebackTotalBandwidth, Bandwidth - OldBandwidth);
+    return;
+}
+
+PWRITEBACK_DEVICE
+IopLookupWritebackDevice (
+    DEVICE_ID DeviceId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the writeback device for the given backing device.
+    This routine assumes the writeback device list lock is held.
+
+Arguments:
+
+    DeviceId - Supplies the ID of the backing device.
+
+Return Value:
+
+    Returns a pointer to the writeback device, or NULL if there is none.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PWRITEBACK_DEVICE Writeback;
+
+    CurrentEntry = IoWritebackDeviceList.Next;
+    while (CurrentEntry != &IoWritebackDeviceList) {
+        Writeback = LIST_VALUE(CurrentEntry, WRITEBACK_DEVICE, ListEntry);
+        if (Writeback->DeviceId == DeviceId) {
+            return Writeback;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    return NULL;
+}
+
@@ -221,6 +221,18 @@ SYSTEM_CALL_TABLE_ENTRY KeSystemCallTable[SystemCallCount] = {
     {MmSysSetBreak,
         sizeof(SYSTEM_CALL_SET_BREAK),
         sizeof(SYSTEM_CALL_SET_BREAK)},
+    {IoSysCreateEventPoll,
+        sizeof(SYSTEM_CALL_CREATE_EVENT_POLL),
+        sizeof(SYSTEM_CALL_CREATE_EVENT_POLL)},
+    {IoSysEventPollControl, sizeof(SYSTEM_CALL_EVENT_POLL_CONTROL), 0},
+    {IoSysEventPollWait, sizeof(SYSTEM_CALL_EVENT_POLL_WAIT), 0},
+    {IoSysCreateIoRing,
+        sizeof(SYSTEM_CALL_CREATE_IO_RING),
+        sizeof(SYSTEM_CALL_CREATE_IO_RING)},
+    {IoSysIoRingEnter, sizeof(SYSTEM_CALL_IO_RING_ENTER), 0},
+    {IoSysSendFile,
+        sizeof(SYSTEM_CALL_SEND_FILE),
+        sizeof(SYSTEM_CALL_SEND_FILE)},
 };
 
 //
@@ -1216,6 +1216,7 @@ Return Value:
     ULONG PageSize;
     BOOL ParentDestroyed;
     KSTATUS Status;
+    UINTN TouchedSize;
 
     ImageSectionList = NULL;
     NewSection = NULL;
@@ -1408,11 +1409,30 @@ Return Value:
     INSERT_BEFORE(&(NewSection->CopyListEntry), &(SectionToCopy->ChildList));
 
     //
-    // Convert the mapping to read-only and copy the mappings to the
+    // Large anonymous sections are copied lazily. Only convert the mappings
+    // to read-only in the source; the destination maps the inherited pages
+    // as it faults on them. This keeps fork cheap for processes with a large
+    // resident set, especially when the child is just going to exec.
+    //
+
+    TouchedSize = SectionToCopy->MaxTouched - SectionToCopy->MinTouched;
+    if ((SectionToCopy->MinTouched < SectionToCopy->MaxTouched) &&
+        ((SectionToCopy->Flags & IMAGE_SECTION_NO_IMAGE_BACKING) != 0) &&
+        (TouchedSize >= IMAGE_SECTION_LAZY_COPY_SIZE)) {
+
+        if ((SectionToCopy->Flags & IMAGE_SECTION_WRITABLE) != 0) {
+            MmpChangeMemoryRegionAccess(SectionToCopy->MinTouched,
+                                        TouchedSize >> PageShift,
+                                        MAP_FLAG_READ_ONLY,
+                                        MAP_FLAG_READ_ONLY);
+        }
+
+    //
+    // Otherwise convert the mapping to read-only and copy the mappings to the
     // destination in one skillful maneuver.
     //
 
-    if (SectionToCopy->MinTouched < SectionToCopy->MaxTouched) {
+    } else if (SectionToCopy->MinTouched < SectionToCopy->MaxTouched) {
         Status = MmpCopyAndChangeSectionMappings(
                         DestinationAddressSpace,
                         SectionToCopy->AddressSpace,
@@ -1704,18 +1724,16 @@ Return Value:
                        MmpGetPageCacheEntryForPhysicalAddress(PhysicalAddress);
 
             //
-            // The page cache entry must be present. It was mapped and the only
-            // way for it to be removed is for the page cache to have unmapped
-            // it, which requires obtaining the image section lock.
+            // The page cache entry is present unless the page was lent to the
+            // page cache by a device whose storage is memory. The only way for
+            // it to be removed is for the page cache to have unmapped it,
+            // which requires obtaining the image section lock. A lent page
+            // was written in place, so there is nothing to mark.
             //
 
-            ASSERT(CacheEntry != NULL);
-
-            //
-            // Mark it dirty.
-            //
-
-            IoMarkPageCacheEntryDirty(CacheEntry);
+            if (CacheEntry != NULL) {
+                IoMarkPageCacheEntryDirty(CacheEntry);
+            }
         }
     }
 
@@ -3860,9 +3878,14 @@ Return Value:
             PageCacheEntry = MmpGetPageCacheEntryForPhysicalAddress(
                                                               PhysicalAddress);
 
-            ASSERT(PageCacheEntry != NULL);
+            //
+            // Pages lent to the page cache by a device have no entry here and
+            // were already written in place.
+            //
 
-            IoMarkPageCacheEntryDirty(PageCacheEntry);
+            if (PageCacheEntry != NULL) {
+                IoMarkPageCacheEntryDirty(PageCacheEntry);
+            }
         }
 
         //
@@ -4240,10 +4263,13 @@ Return Value:
                                                               PhysicalAddress);
 
             //
-            // Mark it dirty.
+            // Mark it dirty, unless it is a page lent by a device, which was
+            // written in place.
             //
 
-            IoMarkPageCacheEntryDirty(PageCacheEntry);
+            if (PageCacheEntry != NULL) {
+                IoMarkPageCacheEntryDirty(PageCacheEntry);
+            }
         }
 
         CurrentAddress += PageSize;
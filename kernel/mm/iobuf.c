@@ -105,6 +105,13 @@ MmpSplitIoBufferFragment (
     UINTN NewSize
     );
 
+UINTN
+MmpFindIoBufferFragment (
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    PUINTN FragmentOffset
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -663,7 +670,6 @@ Return Value:
 {
 
     PVOID Address;
-    PIO_VECTOR AllocatedVector;
     UINTN AllocationSize;
     PIO_BUFFER_FRAGMENT Fragment;
     UINTN FragmentIndex;
@@ -675,32 +681,49 @@ Return Value:
     KSTATUS Status;
     UINTN TotalSize;
     UINTN VectorIndex;
+    UINTN VectorOffset;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
-    AllocatedVector = NULL;
     IoBuffer = NULL;
     if ((VectorCount > MAX_IO_VECTOR_COUNT) || (VectorCount == 0)) {
         Status = STATUS_INVALID_PARAMETER;
         goto CreateIoBufferFromVectorEnd;
     }
 
+    //
+    // Create an I/O buffer structure, set up for a paged user-mode buffer with
+    // a fragment for each vector. A user mode vector too big for the stack
+    // gets copied into the tail of the same allocation, so that a large
+    // readv or writev doesn't cost a second trip to pool.
+    //
+
+    AllocationSize = sizeof(IO_BUFFER);
+    if (VectorCount > 1) {
+        AllocationSize += VectorCount * sizeof(IO_BUFFER_FRAGMENT);
+    }
+
+    VectorOffset = AllocationSize;
+    if ((VectorInKernelMode == FALSE) &&
+        (VectorCount > LOCAL_IO_VECTOR_COUNT)) {
+
+        AllocationSize += VectorCount * sizeof(IO_VECTOR);
+    }
+
+    IoBuffer = MmAllocatePagedPool(AllocationSize, MM_IO_ALLOCATION_TAG);
+    if (IoBuffer == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateIoBufferFromVectorEnd;
+    }
+
+    RtlZeroMemory(IoBuffer, VectorOffset);
     IoVector = Vector;
     if (VectorInKernelMode == FALSE) {
-        if (VectorCount < LOCAL_IO_VECTOR_COUNT) {
+        if (VectorCount <= LOCAL_IO_VECTOR_COUNT) {
             IoVector = LocalVector;
 
         } else {
-            AllocatedVector = MmAllocatePagedPool(
-                                               sizeof(IO_VECTOR) * VectorCount,
-                                               MM_IO_ALLOCATION_TAG);
-
-            if (AllocatedVector == NULL) {
-                Status = STATUS_INSUFFICIENT_RESOURCES;
-                goto CreateIoBufferFromVectorEnd;
-            }
-
-            IoVector = AllocatedVector;
+            IoVector = (PVOID)IoBuffer + VectorOffset;
         }
 
         Status = MmCopyFromUserMode(IoVector,
@@ -712,23 +735,6 @@ Return Value:
         }
     }
 
-    //
-    // Create an I/O buffer structure, set up for a paged user-mode buffer with
-    // a fragment for each vector.
-    //
-
-    AllocationSize = sizeof(IO_BUFFER);
-    if (VectorCount > 1) {
-        AllocationSize += VectorCount * sizeof(IO_BUFFER_FRAGMENT);
-    }
-
-    IoBuffer = MmAllocatePagedPool(AllocationSize, MM_IO_ALLOCATION_TAG);
-    if (IoBuffer == NULL) {
-        Status = STATUS_INSUFFICIENT_RESOURCES;
-        goto CreateIoBufferFromVectorEnd;
-    }
-
-    RtlZeroMemory(IoBuffer, AllocationSize);
     IoBuffer->Internal.Flags = IO_BUFFER_INTERNAL_FLAG_USER_MODE |
                                IO_BUFFER_INTERNAL_FLAG_MAPPED;
 
@@ -809,10 +815,6 @@ Return Value:
         }
     }
 
-    if (AllocatedVector != NULL) {
-        MmFreePagedPool(AllocatedVector);
-    }
-
     *NewIoBuffer = IoBuffer;
     return Status;
 }
@@ -1284,6 +1286,8 @@ Return Value:
     IoBuffer->FragmentCount = 0;
     IoBuffer->Internal.TotalSize = 0;
     IoBuffer->Internal.CurrentOffset = 0;
+    IoBuffer->Internal.LookupFragment = 0;
+    IoBuffer->Internal.LookupOffset = 0;
     IoBuffer->Internal.Flags &= ~(IO_BUFFER_INTERNAL_FLAG_VA_OWNED |
                                   IO_BUFFER_INTERNAL_FLAG_MAPPED |
                                   IO_BUFFER_INTERNAL_FLAG_VA_CONTIGUOUS);
@@ -1642,46 +1646,21 @@ Return Value:
     // starting fragment for both buffers.
     //
 
-    DestinationFragment = NULL;
-    DestinationFragmentOffset = 0;
-    for (FragmentIndex = 0;
-         FragmentIndex < Destination->FragmentCount;
-         FragmentIndex += 1) {
-
-        DestinationFragment = &(Destination->Fragment[FragmentIndex]);
-        if ((DestinationFragmentOffset + DestinationFragment->Size) >
-            DestinationOffset) {
-
-            DestinationFragmentOffset = DestinationOffset -
-                                        DestinationFragmentOffset;
+    FragmentIndex = MmpFindIoBufferFragment(Destination,
+                                            DestinationOffset,
+                                            &DestinationFragmentOffset);
 
-            break;
-        }
-
-        DestinationFragmentOffset += DestinationFragment->Size;
-    }
-
-    ASSERT(DestinationFragment != NULL);
     ASSERT(FragmentIndex != Destination->FragmentCount);
 
-    SourceFragment = NULL;
-    SourceFragmentOffset = 0;
-    for (FragmentIndex = 0;
-         FragmentIndex < Source->FragmentCount;
-         FragmentIndex += 1) {
-
-        SourceFragment = &(Source->Fragment[FragmentIndex]);
-        if ((SourceFragmentOffset + SourceFragment->Size) > SourceOffset) {
-            SourceFragmentOffset = SourceOffset - SourceFragmentOffset;
-            break;
-        }
-
-        SourceFragmentOffset += SourceFragment->Size;
-    }
+    DestinationFragment = &(Destination->Fragment[FragmentIndex]);
+    FragmentIndex = MmpFindIoBufferFragment(Source,
+                                            SourceOffset,
+                                            &SourceFragmentOffset);
 
-    ASSERT(SourceFragment != NULL);
     ASSERT(FragmentIndex != Source->FragmentCount);
 
+    SourceFragment = &(Source->Fragment[FragmentIndex]);
+
     //
     // Now execute the copy fragment by fragment.
     //
@@ -1837,8 +1816,11 @@ Return Value:
         return Status;
     }
 
-    FragmentIndex = 0;
-    CurrentOffset = 0;
+    FragmentIndex = MmpFindIoBufferFragment(IoBuffer,
+                                            Offset,
+                                            &FragmentOffset);
+
+    CurrentOffset = Offset - FragmentOffset;
     while (ByteCount != 0) {
         if (FragmentIndex >= IoBuffer->FragmentCount) {
             return STATUS_INCORRECT_BUFFER_SIZE;
@@ -1974,8 +1956,8 @@ Return Value:
         return Status;
     }
 
-    FragmentIndex = 0;
-    CurrentOffset = 0;
+    FragmentIndex = MmpFindIoBufferFragment(IoBuffer, Offset, &CopyOffset);
+    CurrentOffset = Offset - CopyOffset;
     while (Size != 0) {
         if (FragmentIndex >= IoBuffer->FragmentCount) {
             return STATUS_INCORRECT_BUFFER_SIZE;
@@ -2826,6 +2808,139 @@ Return Value:
     return IoBuffer->Internal.PageCacheEntries[PageIndex];
 }
 
+KERNEL_API
+KSTATUS
+MmIoBufferAppendDeviceMemory (
+    PIO_BUFFER IoBuffer,
+    PVOID VirtualAddress,
+    PHYSICAL_ADDRESS PhysicalAddress,
+    UINTN SizeInBytes
+    )
+
+/*++
+
+Routine Description:
+
+    This routine appends a run of memory owned by a device to the end of the
+    given I/O buffer. A device whose storage is memory (like a RAM disk) can
+    use this to hand its own pages to a read that is filling an empty,
+    extendable I/O buffer rather than copying into freshly allocated pages.
+    The pages remain the device's; they are never freed with the buffer.
+
+Arguments:
+
+    IoBuffer - Supplies a pointer to the I/O buffer. It must be extendable and
+        not yet backed by any pages beyond its current offset.
+
+    VirtualAddress - Supplies the page aligned virtual address of the device
+        memory. It must stay mapped for as long as the device exists.
+
+    PhysicalAddress - Supplies the page aligned physical address of the device
+        memory.
+
+    SizeInBytes - Supplies the number of bytes to append. This must be a
+        multiple of the page size and must fill the rest of the buffer.
+
+Return Value:
+
+    STATUS_SUCCESS if the device memory now backs the I/O buffer.
+
+    STATUS_NOT_SUPPORTED if the I/O buffer or memory cannot be used this way.
+    The caller should copy the data instead.
+
+--*/
+
+{
+
+    UINTN EndPage;
+    ULONG Flags;
+    UINTN PageCount;
+    UINTN PageIndex;
+    ULONG PageShift;
+    ULONG PageSize;
+
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    Flags = IoBuffer->Internal.Flags;
+    if (((Flags & IO_BUFFER_INTERNAL_FLAG_EXTENDABLE) == 0) ||
+        ((Flags & IO_BUFFER_INTERNAL_FLAG_USER_MODE) != 0) ||
+        (IoBuffer->Internal.TotalSize != IoBuffer->Internal.CurrentOffset) ||
+        (IS_ALIGNED(IoBuffer->Internal.TotalSize, PageSize) == FALSE) ||
+        (IS_POINTER_ALIGNED(VirtualAddress, PageSize) == FALSE) ||
+        (IS_ALIGNED(PhysicalAddress, PageSize) == FALSE) ||
+        (IS_ALIGNED(SizeInBytes, PageSize) == FALSE) ||
+        (SizeInBytes == 0)) {
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    //
+    // The memory has to fill the rest of the buffer exactly. A partially
+    // backed buffer would get regular pages from a later extension, and those
+    // would then be mistaken for the device's.
+    //
+
+    PageCount = SizeInBytes >> PageShift;
+    EndPage = (IoBuffer->Internal.TotalSize >> PageShift) + PageCount;
+    if ((EndPage != IoBuffer->Internal.PageCacheEntryCount) ||
+        ((IoBuffer->FragmentCount + PageCount) >
+         IoBuffer->Internal.MaxFragmentCount)) {
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+        MmIoBufferAppendPage(IoBuffer, NULL, VirtualAddress, PhysicalAddress);
+        VirtualAddress += PageSize;
+        PhysicalAddress += PageSize;
+    }
+
+    //
+    // Device memory is not pageable, so it counts as locked. It is not owned,
+    // so releasing the buffer leaves it alone.
+    //
+
+    IoBuffer->Internal.Flags |= IO_BUFFER_INTERNAL_FLAG_DEVICE_MEMORY |
+                                IO_BUFFER_INTERNAL_FLAG_MEMORY_LOCKED;
+
+    return STATUS_SUCCESS;
+}
+
+BOOL
+MmIsIoBufferDeviceMemory (
+    PIO_BUFFER IoBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not the given I/O buffer was filled
+    with memory lent by a device.
+
+Arguments:
+
+    IoBuffer - Supplies a pointer to an I/O buffer.
+
+Return Value:
+
+    TRUE if the I/O buffer's pages belong to a device.
+
+    FALSE if the I/O buffer's pages are ordinary memory.
+
+--*/
+
+{
+
+    if ((IoBuffer->Internal.Flags &
+         IO_BUFFER_INTERNAL_FLAG_DEVICE_MEMORY) != 0) {
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
 KERNEL_API
 UINTN
 MmGetIoBufferSize (
@@ -4356,6 +4471,80 @@ Return Value:
     Fragment = &(IoBuffer->Fragment[Index]);
     Fragment->Size = NewSize;
     IoBuffer->FragmentCount += 1;
+
+    //
+    // Fragments after the split moved down an index, so forget the last
+    // lookup.
+    //
+
+    IoBuffer->Internal.LookupFragment = 0;
+    IoBuffer->Internal.LookupOffset = 0;
     return;
 }
 
+UINTN
+MmpFindIoBufferFragment (
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    PUINTN FragmentOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the fragment containing the given byte offset of an
+    I/O buffer. The search starts at the fragment found last time if the
+    offset is at or beyond it, so a copy that walks a many-fragment buffer
+    page by page does not rescan it from the beginning on every page.
+
+Arguments:
+
+    IoBuffer - Supplies a pointer to an I/O buffer.
+
+    Offset - Supplies the byte offset from the beginning of the buffer, not
+        including the buffer's current offset.
+
+    FragmentOffset - Supplies a pointer where the offset within the returned
+        fragment will be returned.
+
+Return Value:
+
+    Returns the index of the fragment containing the offset.
+
+    Returns the fragment count if the offset is beyond the end of the buffer.
+
+--*/
+
+{
+
+    UINTN FragmentIndex;
+    UINTN FragmentStart;
+
+    FragmentIndex = 0;
+    FragmentStart = 0;
+    if ((IoBuffer->Internal.LookupFragment < IoBuffer->FragmentCount) &&
+        (IoBuffer->Internal.LookupOffset <= Offset)) {
+
+        FragmentIndex = IoBuffer->Internal.LookupFragment;
+        FragmentStart = IoBuffer->Internal.LookupOffset;
+    }
+
+    while (FragmentIndex < IoBuffer->FragmentCount) {
+        if ((FragmentStart + IoBuffer->Fragment[FragmentIndex].Size) >
+            Offset) {
+
+            IoBuffer->Internal.LookupFragment = FragmentIndex;
+            IoBuffer->Internal.LookupOffset = FragmentStart;
+            *FragmentOffset = Offset - FragmentStart;
+            return FragmentIndex;
+        }
+
+        FragmentStart += IoBuffer->Fragment[FragmentIndex].Size;
+        FragmentIndex += 1;
+    }
+
+    *FragmentOffset = Offset - FragmentStart;
+    return FragmentIndex;
+}
+
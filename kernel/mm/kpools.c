@@ -47,7 +47,8 @@ Module Name:
 #define INITIAL_NON_PAGED_POOL_SIZE (512 * 1024)
 
 //
-// Define the number of default-sized kernel stacks to keep around.
+// Define the default number of default-sized kernel stacks to keep around on
+// the global list, in addition to those cached on each processor.
 //
 
 #define KERNEL_STACK_CACHE_SIZE 10
@@ -115,6 +116,12 @@ MmpHandlePoolCorruption (
     PVOID Parameter
     );
 
+VOID
+MmpDestroyKernelStack (
+    PVOID StackBase,
+    UINTN Size
+    );
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -136,13 +143,16 @@ PQUEUED_LOCK MmPagedPoolLock = NULL;
 
 //
 // Keep a little cache of kernel stacks to avoid the constant mapping and
-// unmapping associated with thread creation.
-// TODO: Maintain the kernel stack cache so it doesn't just keep growing.
+// unmapping associated with thread creation. Each processor caches a couple
+// of stacks without taking any locks, and overflows onto the global list,
+// which is capped by the watermark. Both are emptied when physical memory
+// runs low.
 //
 
 KSPIN_LOCK MmFreeKernelStackLock;
 LIST_ENTRY MmFreeKernelStackList;
 ULONG MmFreeKernelStackCount;
+ULONG MmFreeKernelStackWatermark = KERNEL_STACK_CACHE_SIZE;
 
 //
 // ------------------------------------------------------------------ Functions
@@ -699,8 +709,10 @@ Return Value:
 
     UINTN Alignment;
     PLIST_ENTRY Entry;
+    ULONG Index;
     RUNLEVEL OldRunLevel;
     ULONG PageSize;
+    PPROCESSOR_BLOCK ProcessorBlock;
     BOOL RangeAllocated;
     PVOID Stack;
     KSTATUS Status;
@@ -717,13 +729,27 @@ Return Value:
 
     //
     // If the stack size requested is the default (it always is), then look in
-    // the cache for a previously allocated kernel stack.
+    // the caches for a previously allocated kernel stack, starting with this
+    // processor's cache, which needs no lock.
     //
 
     if (Size == DEFAULT_KERNEL_STACK_SIZE) {
         Alignment = DEFAULT_KERNEL_STACK_SIZE_ALIGNMENT;
-        if (MmFreeKernelStackCount != 0) {
-            OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        ProcessorBlock = KeGetCurrentProcessorBlock();
+        for (Index = 0; Index < PROCESSOR_KERNEL_STACK_CACHE_SIZE; Index += 1) {
+            if (ProcessorBlock->KernelStackCache[Index] != 0) {
+                VaRequest.Address = (PVOID)RtlAtomicExchange(
+                                    &(ProcessorBlock->KernelStackCache[Index]),
+                                    0);
+
+                if (VaRequest.Address != NULL) {
+                    break;
+                }
+            }
+        }
+
+        if ((VaRequest.Address == NULL) && (MmFreeKernelStackCount != 0)) {
             KeAcquireSpinLock(&MmFreeKernelStackLock);
             if (!LIST_EMPTY(&MmFreeKernelStackList)) {
 
@@ -736,9 +762,10 @@ Return Value:
             }
 
             KeReleaseSpinLock(&MmFreeKernelStackLock);
-            KeLowerRunLevel(OldRunLevel);
         }
 
+        KeLowerRunLevel(OldRunLevel);
+
     //
     // The alignment is the size (rounded up to the next power of 2) to ensure
     // that kernel stacks don't span page directory entries, which would cause
@@ -840,50 +867,171 @@ Return Value:
 {
 
     PLIST_ENTRY Entry;
+    ULONG Index;
     RUNLEVEL OldRunLevel;
-    ULONG PageSize;
-    ULONG UnmapFlags;
+    UINTN Previous;
+    PPROCESSOR_BLOCK ProcessorBlock;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
+    if (Size != DEFAULT_KERNEL_STACK_SIZE) {
+        MmpDestroyKernelStack(StackBase, Size);
+        return;
+    }
+
+    //
+    // Don't hang on to stacks if memory is tight. Give back the ones already
+    // cached too.
+    //
+
+    if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevelNone) {
+        MmpDestroyKernelStack(StackBase, Size);
+        MmpTrimKernelStackCache();
+        return;
+    }
+
+    //
+    // Try to stash the stack in this processor's cache first. The guard page
+    // below the stack stays reserved and unmapped while the stack is cached.
+    //
+
+    Entry = NULL;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    ProcessorBlock = KeGetCurrentProcessorBlock();
+    for (Index = 0; Index < PROCESSOR_KERNEL_STACK_CACHE_SIZE; Index += 1) {
+        if (ProcessorBlock->KernelStackCache[Index] == 0) {
+            Previous = RtlAtomicCompareExchange(
+                                    &(ProcessorBlock->KernelStackCache[Index]),
+                                    (UINTN)StackBase,
+                                    0);
+
+            if (Previous == 0) {
+                Entry = StackBase;
+                break;
+            }
+        }
+    }
+
     //
-    // If there's room, put the stack back onto the cached list of stacks for
+    // If there's room, put the stack back onto the global list of stacks for
     // the next thread to use. This first check of the count is unprotected
     // by the lock and could be wrong, but it's really just a best effort and
     // avoids doing the heavy lock acquire all the time.
     //
 
-    Entry = NULL;
-    if (MmFreeKernelStackCount < KERNEL_STACK_CACHE_SIZE) {
-        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    if ((Entry == NULL) &&
+        (MmFreeKernelStackCount < MmFreeKernelStackWatermark)) {
+
         KeAcquireSpinLock(&MmFreeKernelStackLock);
-        if (MmFreeKernelStackCount < KERNEL_STACK_CACHE_SIZE) {
+        if (MmFreeKernelStackCount < MmFreeKernelStackWatermark) {
             MmFreeKernelStackCount += 1;
             Entry = StackBase;
             INSERT_AFTER(Entry, &MmFreeKernelStackList);
         }
 
         KeReleaseSpinLock(&MmFreeKernelStackLock);
-        KeLowerRunLevel(OldRunLevel);
-        if (Entry != NULL) {
-            return;
+    }
+
+    KeLowerRunLevel(OldRunLevel);
+    if (Entry != NULL) {
+        return;
+    }
+
+    //
+    // Actually do the work of freeing the stack, the cache is full.
+    //
+
+    MmpDestroyKernelStack(StackBase, Size);
+    return;
+}
+
+VOID
+MmpTrimKernelStackCache (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees every cached kernel stack, both on the global list and
+    in each processor's cache. It is called when physical memory is running
+    low.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY Entry;
+    LIST_ENTRY FreeList;
+    ULONG Index;
+    RUNLEVEL OldRunLevel;
+    ULONG Processor;
+    PPROCESSOR_BLOCK ProcessorBlock;
+    ULONG ProcessorCount;
+    PVOID Stack;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    //
+    // Pull everything off the global list while holding the lock, then free
+    // the stacks with the lock released.
+    //
+
+    INITIALIZE_LIST_HEAD(&FreeList);
+    if (MmFreeKernelStackCount != 0) {
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&MmFreeKernelStackLock);
+        if (!LIST_EMPTY(&MmFreeKernelStackList)) {
+            MOVE_LIST(&MmFreeKernelStackList, &FreeList);
+            INITIALIZE_LIST_HEAD(&MmFreeKernelStackList);
+            MmFreeKernelStackCount = 0;
         }
+
+        KeReleaseSpinLock(&MmFreeKernelStackLock);
+        KeLowerRunLevel(OldRunLevel);
+    }
+
+    while (!LIST_EMPTY(&FreeList)) {
+        Entry = FreeList.Next;
+        LIST_REMOVE(Entry);
+        MmpDestroyKernelStack(Entry, DEFAULT_KERNEL_STACK_SIZE);
     }
 
     //
-    // Actually do the work of freeing the stack, the cache is full. Remember
-    // that there is a guard page there as well to release.
+    // Steal the stacks out of every processor's cache. The atomic exchange
+    // makes this safe against the owning processor using its cache.
     //
 
-    PageSize = MmPageSize();
-    UnmapFlags = UNMAP_FLAG_FREE_PHYSICAL_PAGES |
-                 UNMAP_FLAG_SEND_INVALIDATE_IPI;
+    ProcessorCount = KeGetActiveProcessorCount();
+    for (Processor = 0; Processor < ProcessorCount; Processor += 1) {
+        ProcessorBlock = KeGetProcessorBlock(Processor);
+        if (ProcessorBlock == NULL) {
+            continue;
+        }
 
-    MmpFreeAccountingRange(NULL,
-                           StackBase - PageSize,
-                           Size + PageSize,
-                           FALSE,
-                           UnmapFlags);
+        for (Index = 0; Index < PROCESSOR_KERNEL_STACK_CACHE_SIZE; Index += 1) {
+            if (ProcessorBlock->KernelStackCache[Index] == 0) {
+                continue;
+            }
+
+            Stack = (PVOID)RtlAtomicExchange(
+                                    &(ProcessorBlock->KernelStackCache[Index]),
+                                    0);
+
+            if (Stack != NULL) {
+                MmpDestroyKernelStack(Stack, DEFAULT_KERNEL_STACK_SIZE);
+            }
+        }
+    }
 
     return;
 }
@@ -1384,3 +1532,50 @@ Return Value:
     return;
 }
 
+VOID
+MmpDestroyKernelStack (
+    PVOID StackBase,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine unmaps and releases a kernel stack along with its guard page.
+
+Arguments:
+
+    StackBase - Supplies the base of the stack (the lowest address in the
+        allocation).
+
+    Size - Supplies the number of bytes allocated for the stack.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG PageSize;
+    ULONG UnmapFlags;
+
+    //
+    // Remember that there is a guard page there as well to release.
+    //
+
+    PageSize = MmPageSize();
+    UnmapFlags = UNMAP_FLAG_FREE_PHYSICAL_PAGES |
+                 UNMAP_FLAG_SEND_INVALIDATE_IPI;
+
+    MmpFreeAccountingRange(NULL,
+                           StackBase - PageSize,
+                           Size + PageSize,
+                           FALSE,
+                           UnmapFlags);
+
+    return;
+}
+
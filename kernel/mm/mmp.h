@@ -51,6 +51,15 @@ Module Name:
 
 #define IMAGE_SECTION_FLUSH_FLAG_ASYNC 0x00000001
 
+//
+// Define the touched size at or above which an anonymous image section is
+// copied lazily during fork. Rather than copying every mapping into the child,
+// the parent's mappings are simply made read-only and the child maps the
+// parent's pages on demand as it faults on them.
+//
+
+#define IMAGE_SECTION_LAZY_COPY_SIZE _128KB
+
 //
 // Define the set of unmap flags.
 //
@@ -132,6 +141,14 @@ Module Name:
 
 #define IO_BUFFER_INTERNAL_FLAG_LOCK_OWNED 0x00000400
 
+//
+// This flag is set if the I/O buffer was filled with physical pages lent by a
+// device whose storage is memory. Those pages belong to the device; they are
+// never freed with the buffer.
+//
+
+#define IO_BUFFER_INTERNAL_FLAG_DEVICE_MEMORY 0x00000800
+
 //
 // --------------------------------------------------------------------- Macros
 //
@@ -2137,6 +2154,29 @@ Return Value:
 
 --*/
 
+VOID
+MmpTrimKernelStackCache (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine frees every cached kernel stack, both on the global list and
+    in each processor's cache. It is called when physical memory is running
+    low.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
 VOID
 MmpSendTlbInvalidateIpi (
     PADDRESS_SPACE AddressSpace,
@@ -800,6 +800,7 @@ Return Value:
     return Status;
 }
 
+KERNEL_API
 KSTATUS
 MmAllocatePageFileSpace (
     PIMAGE_BACKING ImageBacking,
@@ -916,6 +917,7 @@ Return Value:
     return Status;
 }
 
+KERNEL_API
 VOID
 MmFreePageFileSpace (
     PIMAGE_BACKING ImageBacking,
@@ -1016,6 +1018,7 @@ Return Value:
     return;
 }
 
+KERNEL_API
 KSTATUS
 MmPageFilePerformIo (
     PIMAGE_BACKING ImageBacking,
@@ -2636,11 +2639,16 @@ Return Value:
         ASSERT(KSUCCESS(Status));
 
         //
-        // If the memory warning event signaled for something other than
-        // warning level 1, ignore it.
+        // Release any cached kernel stacks on a memory warning. If the memory
+        // warning event signaled for something other than warning level 1,
+        // don't page anything out.
         //
 
         if (SignalingObject == PhysicalMemoryWarningEvent) {
+            if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevelNone) {
+                MmpTrimKernelStackCache();
+            }
+
             if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevel1) {
                 continue;
             }
@@ -2718,6 +2726,7 @@ Return Value:
     ULONG IoBufferFlags;
     BOOL LockHeld;
     BOOL LockPage;
+    ULONG MapFlags;
     BOOL NonPaged;
     PIMAGE_SECTION OwningSection;
     ULONG PageShift;
@@ -2807,6 +2816,42 @@ Return Value:
             break;
         }
 
+        //
+        // Large anonymous sections do not get copies of their parent's
+        // mappings during fork. If the page is inherited and still resident
+        // in the owning section, map that same page read-only here. Writes
+        // will isolate the page like any other inherited page.
+        //
+
+        if ((OwningSection != ImageSection) &&
+            (VirtualAddress < KERNEL_VA_START) &&
+            ((ImageSection->Flags & IMAGE_SECTION_DESTROYED) == 0) &&
+            ((ImageSection->Size >> PageShift) > PageOffset)) {
+
+            ExistingPhysicalAddress = MmpVirtualToPhysicalInOtherProcess(
+                                                  OwningSection->AddressSpace,
+                                                  VirtualAddress);
+
+            if (ExistingPhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
+                MapFlags = ImageSection->MapFlags | MAP_FLAG_PAGABLE |
+                           MAP_FLAG_USER_MODE | MAP_FLAG_READ_ONLY;
+
+                if ((ImageSection->Flags & IMAGE_SECTION_EXECUTABLE) != 0) {
+                    MapFlags |= MAP_FLAG_EXECUTE;
+                }
+
+                if ((ImageSection->Flags &
+                     (IMAGE_SECTION_READABLE | IMAGE_SECTION_WRITABLE)) != 0) {
+
+                    MapFlags |= MAP_FLAG_PRESENT;
+                }
+
+                MmpMapPage(ExistingPhysicalAddress, VirtualAddress, MapFlags);
+                Status = STATUS_SUCCESS;
+                break;
+            }
+        }
+
         //
         // Figure out if the page is clean or dirty.
         //
@@ -1612,6 +1612,15 @@ Return Value:
         LocalPte = Pte[TableIndex];
         *((PULONG)&(Pte[TableIndex])) = 0;
 
+        ASSERT(VirtualAddress < USER_VA_END);
+
+        MmpUpdateResidentSetCounter(&(Space->Common), -1);
+
+    //
+    // Lazily copied sections may never have mapped the page in this process,
+    // in which case there is nothing to account for.
+    //
+
     } else {
 
         ASSERT(Pte[TableIndex].Present == 0);
@@ -1622,10 +1631,6 @@ Return Value:
         *PageWasDirty = TRUE;
     }
 
-    ASSERT(VirtualAddress < USER_VA_END);
-
-    MmpUpdateResidentSetCounter(&(Space->Common), -1);
-
 UnmapPageInOtherProcessEnd:
     MmpUnmapPages(Pte, 1, 0, NULL);
     KeLowerRunLevel(OldRunLevel);
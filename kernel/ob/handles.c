@@ -98,6 +98,28 @@ typedef struct _HANDLE_TABLE_ENTRY {
 
 /*++
 
+Structure Description:
+
+    This structure defines the array of entries in a handle table. Lookups
+    read the array without holding the table lock, so the size travels with
+    the array, and a replaced array is not freed until every lookup that
+    might be using it is done.
+
+Members:
+
+    Size - Stores the number of elements in the array.
+
+    Entries - Stores the handle table entries.
+
+--*/
+
+typedef struct _HANDLE_TABLE_ARRAY {
+    ULONG Size;
+    HANDLE_TABLE_ENTRY Entries[ANYSIZE_ARRAY];
+} HANDLE_TABLE_ARRAY, *PHANDLE_TABLE_ARRAY;
+
+/*++
+
 Structure Description:
 
     This structure defines a handle table.
@@ -110,25 +132,34 @@ Structure Description:
 
     MaxDescriptor - Stores the maximum valid descriptor number.
 
-    Entries - Stores the actual array of handles.
+    Array - Stores a pointer to the current array of handles. This is read
+        without the lock by lookups, and replaced under the lock when the
+        table grows.
 
-    ArraySize - Stores the number of elements in the array.
-
-    Lock - Stores a pointer to a lock protecting access to the handle table.
+    Lock - Stores a pointer to a lock protecting changes to the handle table.
+        Lookups do not acquire it.
 
     LookupCallback - Stores an optional pointer to a routine that is called
         whenever a handle is looked up.
 
+    LookupEpoch - Stores the current lookup epoch. Lookups register in the
+        count for the current epoch. Removing a handle advances the epoch and
+        waits for the lookups from the previous epoch to drain.
+
+    LookupCount - Stores the number of lookups in flight for even and odd
+        epochs.
+
 --*/
 
 struct _HANDLE_TABLE {
     PKPROCESS Process;
     ULONG NextDescriptor;
     ULONG MaxDescriptor;
-    PHANDLE_TABLE_ENTRY Entries;
-    ULONG ArraySize;
+    volatile PHANDLE_TABLE_ARRAY Array;
     PQUEUED_LOCK Lock;
     PHANDLE_TABLE_LOOKUP_CALLBACK LookupCallback;
+    volatile ULONG LookupEpoch;
+    volatile ULONG LookupCount[2];
 };
 
 //
@@ -141,6 +172,22 @@ ObpExpandHandleTable (
     ULONG Descriptor
     );
 
+ULONG
+ObpStartHandleLookup (
+    PHANDLE_TABLE Table
+    );
+
+VOID
+ObpEndHandleLookup (
+    PHANDLE_TABLE Table,
+    ULONG Epoch
+    );
+
+VOID
+ObpWaitForHandleLookups (
+    PHANDLE_TABLE Table
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -204,24 +251,29 @@ Return Value:
     HandleTable->NextDescriptor = 0;
     HandleTable->MaxDescriptor = 0;
     HandleTable->LookupCallback = LookupCallbackRoutine;
-    AllocationSize = HANDLE_TABLE_INITIAL_SIZE * sizeof(HANDLE_TABLE_ENTRY);
-    HandleTable->Entries = MmAllocatePagedPool(AllocationSize,
-                                               HANDLE_TABLE_ALLOCATION_TAG);
+    HandleTable->LookupEpoch = 0;
+    HandleTable->LookupCount[0] = 0;
+    HandleTable->LookupCount[1] = 0;
+    AllocationSize = FIELD_OFFSET(HANDLE_TABLE_ARRAY, Entries) +
+                     (HANDLE_TABLE_INITIAL_SIZE * sizeof(HANDLE_TABLE_ENTRY));
 
-    if (HandleTable->Entries == NULL) {
+    HandleTable->Array = MmAllocatePagedPool(AllocationSize,
+                                             HANDLE_TABLE_ALLOCATION_TAG);
+
+    if (HandleTable->Array == NULL) {
         Status = STATUS_INSUFFICIENT_RESOURCES;
         goto CreateHandleTableEnd;
     }
 
-    RtlZeroMemory(HandleTable->Entries, AllocationSize);
-    HandleTable->ArraySize = HANDLE_TABLE_INITIAL_SIZE;
+    RtlZeroMemory(HandleTable->Array, AllocationSize);
+    HandleTable->Array->Size = HANDLE_TABLE_INITIAL_SIZE;
     Status = STATUS_SUCCESS;
 
 CreateHandleTableEnd:
     if (!KSUCCESS(Status)) {
         if (HandleTable != NULL) {
-            if (HandleTable->Entries != NULL) {
-                MmFreePagedPool(HandleTable->Entries);
+            if (HandleTable->Array != NULL) {
+                MmFreePagedPool(HandleTable->Array);
             }
 
             MmFreePagedPool(HandleTable);
@@ -262,8 +314,11 @@ Return Value:
         KeDestroyQueuedLock(HandleTable->Lock);
     }
 
-    if (HandleTable->Entries != NULL) {
-        MmFreePagedPool(HandleTable->Entries);
+    ASSERT((HandleTable->LookupCount[0] == 0) &&
+           (HandleTable->LookupCount[1] == 0));
+
+    if (HandleTable->Array != NULL) {
+        MmFreePagedPool(HandleTable->Array);
     }
 
     if (HandleTable->Process != NULL) {
@@ -350,6 +405,7 @@ Return Value:
 
 {
 
+    PHANDLE_TABLE_ENTRY Entry;
     ULONG Descriptor;
     KSTATUS Status;
 
@@ -376,8 +432,9 @@ Return Value:
     // Loop until a free slot is found.
     //
 
-    while ((Descriptor < Table->ArraySize) &&
-           ((Table->Entries[Descriptor].Flags & HANDLE_FLAG_ALLOCATED) != 0)) {
+    while ((Descriptor < Table->Array->Size) &&
+           ((Table->Array->Entries[Descriptor].Flags &
+             HANDLE_FLAG_ALLOCATED) != 0)) {
 
         Descriptor += 1;
     }
@@ -390,7 +447,7 @@ Return Value:
     // Expand the table if needed.
     //
 
-    if (Descriptor >= Table->ArraySize) {
+    if (Descriptor >= Table->Array->Size) {
         Status = ObpExpandHandleTable(Table, Descriptor);
         if (!KSUCCESS(Status)) {
             goto CreateHandleEnd;
@@ -399,10 +456,15 @@ Return Value:
 
     ASSERT(HandleValue != NULL);
 
-    Table->Entries[Descriptor].Flags = HANDLE_FLAG_ALLOCATED |
-                                       (Flags & HANDLE_FLAG_MASK);
+    //
+    // Lookups treat a non-null value as a live handle, so fill in the flags
+    // first.
+    //
 
-    Table->Entries[Descriptor].HandleValue = HandleValue;
+    Entry = &(Table->Array->Entries[Descriptor]);
+    Entry->Flags = HANDLE_FLAG_ALLOCATED | (Flags & HANDLE_FLAG_MASK);
+    RtlMemoryBarrier();
+    Entry->HandleValue = HandleValue;
     *NewHandle = (HANDLE)(UINTN)Descriptor;
     if (Descriptor > Table->MaxDescriptor) {
         Table->MaxDescriptor = Descriptor;
@@ -442,6 +504,7 @@ Return Value:
 {
 
     ULONG Descriptor;
+    PHANDLE_TABLE_ENTRY Entry;
 
     ASSERT((Table->Process == NULL) ||
            (Table->Process->ThreadCount == 0) ||
@@ -449,20 +512,28 @@ Return Value:
 
     Descriptor = (UINTN)Handle;
     OB_ACQUIRE_HANDLE_TABLE_LOCK(Table);
-    if (Descriptor >= Table->ArraySize) {
+    if (Descriptor >= Table->Array->Size) {
         goto DestroyHandleEnd;
     }
 
-    if ((Table->Entries[Descriptor].Flags & HANDLE_FLAG_ALLOCATED) == 0) {
+    Entry = &(Table->Array->Entries[Descriptor]);
+    if ((Entry->Flags & HANDLE_FLAG_ALLOCATED) == 0) {
         goto DestroyHandleEnd;
     }
 
-    Table->Entries[Descriptor].HandleValue = NULL;
-    Table->Entries[Descriptor].Flags = 0;
+    Entry->HandleValue = NULL;
+    Entry->Flags = 0;
     if (Table->NextDescriptor > Descriptor) {
         Table->NextDescriptor = Descriptor;
     }
 
+    //
+    // The caller is likely to release the handle value as soon as this
+    // returns, so wait out any lookup that may have already grabbed it.
+    //
+
+    ObpWaitForHandleLookups(Table);
+
 DestroyHandleEnd:
     OB_RELEASE_HANDLE_TABLE_LOCK(Table);
     return;
@@ -515,6 +586,8 @@ Return Value:
 {
 
     ULONG Descriptor;
+    PHANDLE_TABLE_ENTRY Entry;
+    PVOID OldValue;
     KSTATUS Status;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
@@ -527,7 +600,7 @@ Return Value:
     ASSERT(Handle != INVALID_HANDLE);
 
     Descriptor = (UINTN)Handle;
-    if (Descriptor >= Table->ArraySize) {
+    if (Descriptor >= Table->Array->Size) {
         Status = ObpExpandHandleTable(Table, Descriptor);
         if (!KSUCCESS(Status)) {
             goto ReplaceHandleValueEnd;
@@ -536,22 +609,32 @@ Return Value:
 
     ASSERT(NewHandleValue != NULL);
 
+    Entry = &(Table->Array->Entries[Descriptor]);
+    OldValue = Entry->HandleValue;
     if (OldFlags != NULL) {
-        *OldFlags = Table->Entries[Descriptor].Flags & HANDLE_FLAG_MASK;
+        *OldFlags = Entry->Flags & HANDLE_FLAG_MASK;
     }
 
     if (OldHandleValue != NULL) {
-        *OldHandleValue = Table->Entries[Descriptor].HandleValue;
+        *OldHandleValue = OldValue;
     }
 
-    Table->Entries[Descriptor].Flags = HANDLE_FLAG_ALLOCATED |
-                                       (NewFlags & HANDLE_FLAG_MASK);
-
-    Table->Entries[Descriptor].HandleValue = NewHandleValue;
+    Entry->Flags = HANDLE_FLAG_ALLOCATED | (NewFlags & HANDLE_FLAG_MASK);
+    RtlMemoryBarrier();
+    Entry->HandleValue = NewHandleValue;
     if (Descriptor > Table->MaxDescriptor) {
         Table->MaxDescriptor = Descriptor;
     }
 
+    //
+    // Wait out any lookup that grabbed the old value before the caller gets
+    // a chance to release it.
+    //
+
+    if (OldValue != NULL) {
+        ObpWaitForHandleLookups(Table);
+    }
+
     Status = STATUS_SUCCESS;
 
 ReplaceHandleValueEnd:
@@ -571,7 +654,7 @@ ObGetHandleValue (
 Routine Description:
 
     This routine looks up the given handle and returns the value associated
-    with that handle.
+    with that handle. This routine does not acquire the handle table lock.
 
 Arguments:
 
@@ -592,7 +675,9 @@ Return Value:
 
 {
 
+    PHANDLE_TABLE_ARRAY Array;
     ULONG Descriptor;
+    ULONG Epoch;
     ULONG LocalFlags;
     PVOID Value;
 
@@ -603,23 +688,29 @@ Return Value:
     Descriptor = (UINTN)Handle;
     LocalFlags = 0;
     Value = NULL;
-    OB_ACQUIRE_HANDLE_TABLE_LOCK(Table);
-    if (Descriptor >= Table->ArraySize) {
+    Epoch = ObpStartHandleLookup(Table);
+    Array = Table->Array;
+    if (Descriptor >= Array->Size) {
         goto GetHandleValueEnd;
     }
 
-    LocalFlags = Table->Entries[Descriptor].Flags;
-    if ((LocalFlags & HANDLE_FLAG_ALLOCATED) == 0) {
+    //
+    // The value is cleared before the flags when a handle is destroyed, and
+    // set after them when it is created, so a non-null value is live.
+    //
+
+    Value = *((PVOID volatile *)&(Array->Entries[Descriptor].HandleValue));
+    if (Value == NULL) {
         goto GetHandleValueEnd;
     }
 
-    Value = Table->Entries[Descriptor].HandleValue;
+    LocalFlags = Array->Entries[Descriptor].Flags;
     if (Table->LookupCallback != NULL) {
         Table->LookupCallback(Table, (HANDLE)(UINTN)Descriptor, Value);
     }
 
 GetHandleValueEnd:
-    OB_RELEASE_HANDLE_TABLE_LOCK(Table);
+    ObpEndHandleLookup(Table, Epoch);
     if ((Flags != NULL) && (Value != NULL)) {
         *Flags = LocalFlags & HANDLE_FLAG_MASK;
     }
@@ -669,6 +760,7 @@ Return Value:
 {
 
     ULONG Descriptor;
+    PHANDLE_TABLE_ENTRY Entry;
     ULONG NewValue;
     ULONG OriginalValue;
     KSTATUS Status;
@@ -680,21 +772,22 @@ Return Value:
     Status = STATUS_INVALID_HANDLE;
     Descriptor = (UINTN)Handle;
     OB_ACQUIRE_HANDLE_TABLE_LOCK(Table);
-    if (Descriptor >= Table->ArraySize) {
+    if (Descriptor >= Table->Array->Size) {
         goto GetSetHandleFlagsEnd;
     }
 
-    if ((Table->Entries[Descriptor].Flags & HANDLE_FLAG_ALLOCATED) == 0) {
+    Entry = &(Table->Array->Entries[Descriptor]);
+    if ((Entry->Flags & HANDLE_FLAG_ALLOCATED) == 0) {
         goto GetSetHandleFlagsEnd;
     }
 
     Status = STATUS_SUCCESS;
     NewValue = *Flags;
-    OriginalValue = Table->Entries[Descriptor].Flags;
+    OriginalValue = Entry->Flags;
     *Flags = OriginalValue & HANDLE_FLAG_MASK;
     if (Set != FALSE) {
-        Table->Entries[Descriptor].Flags = (NewValue & HANDLE_FLAG_MASK) |
-                                           (OriginalValue & ~HANDLE_FLAG_MASK);
+        Entry->Flags = (NewValue & HANDLE_FLAG_MASK) |
+                       (OriginalValue & ~HANDLE_FLAG_MASK);
     }
 
 GetSetHandleFlagsEnd:
@@ -728,6 +821,7 @@ Return Value:
 {
 
     ULONG Descriptor;
+    PHANDLE_TABLE_ENTRY Entries;
     HANDLE Handle;
 
     ASSERT((Table->Process == NULL) ||
@@ -736,11 +830,12 @@ Return Value:
 
     Handle = INVALID_HANDLE;
     OB_ACQUIRE_HANDLE_TABLE_LOCK(Table);
+    Entries = Table->Array->Entries;
     Descriptor = Table->MaxDescriptor;
 
-    ASSERT(Descriptor < Table->ArraySize);
+    ASSERT(Descriptor < Table->Array->Size);
 
-    while ((Table->Entries[Descriptor].Flags & HANDLE_FLAG_ALLOCATED) == 0) {
+    while ((Entries[Descriptor].Flags & HANDLE_FLAG_ALLOCATED) == 0) {
         if (Descriptor == 0) {
             break;
         }
@@ -748,7 +843,7 @@ Return Value:
         Descriptor -= 1;
     }
 
-    if ((Table->Entries[Descriptor].Flags & HANDLE_FLAG_ALLOCATED) != 0) {
+    if ((Entries[Descriptor].Flags & HANDLE_FLAG_ALLOCATED) != 0) {
         Handle = (HANDLE)(UINTN)Descriptor;
     }
 
@@ -792,6 +887,7 @@ Return Value:
 {
 
     ULONG Descriptor;
+    PHANDLE_TABLE_ENTRY Entry;
 
     ASSERT((Table->Process == NULL) ||
            (Table->Process->ThreadCount == 0) ||
@@ -799,14 +895,15 @@ Return Value:
 
     OB_ACQUIRE_HANDLE_TABLE_LOCK(Table);
     for (Descriptor = 0; Descriptor <= Table->MaxDescriptor; Descriptor += 1) {
-        if ((Table->Entries[Descriptor].Flags & HANDLE_FLAG_ALLOCATED) == 0) {
+        Entry = &(Table->Array->Entries[Descriptor]);
+        if ((Entry->Flags & HANDLE_FLAG_ALLOCATED) == 0) {
             continue;
         }
 
         IterateRoutine(Table,
                        (HANDLE)(UINTN)Descriptor,
-                       Table->Entries[Descriptor].Flags & HANDLE_FLAG_MASK,
-                       Table->Entries[Descriptor].HandleValue,
+                       Entry->Flags & HANDLE_FLAG_MASK,
+                       Entry->HandleValue,
                        IterateRoutineContext);
     }
 
@@ -829,7 +926,7 @@ ObpExpandHandleTable (
 Routine Description:
 
     This routine expands the given handle table to support a given number of
-    descriptors.
+    descriptors. This routine assumes the handle table lock is held.
 
 Arguments:
 
@@ -847,8 +944,9 @@ Return Value:
 {
 
     UINTN AllocationSize;
-    PVOID NewBuffer;
+    PHANDLE_TABLE_ARRAY NewArray;
     UINTN NewCapacity;
+    PHANDLE_TABLE_ARRAY OldArray;
     KSTATUS Status;
 
     if (Descriptor >= OB_MAX_HANDLES) {
@@ -860,45 +958,54 @@ Return Value:
     // Expand the table if needed.
     //
 
-    if (Descriptor >= Table->ArraySize) {
-        NewCapacity = Table->ArraySize * 2;
+    OldArray = Table->Array;
+    if (Descriptor >= OldArray->Size) {
+        NewCapacity = OldArray->Size * 2;
         while ((NewCapacity <= Descriptor) &&
-               (NewCapacity >= Table->ArraySize)) {
+               (NewCapacity >= OldArray->Size)) {
 
             NewCapacity *= 2;
         }
 
         AllocationSize = NewCapacity * sizeof(HANDLE_TABLE_ENTRY);
         if ((NewCapacity <= Descriptor) ||
-            (NewCapacity < Table->ArraySize) ||
+            (NewCapacity < OldArray->Size) ||
             ((AllocationSize / sizeof(HANDLE_TABLE_ENTRY)) != NewCapacity)) {
 
             Status = STATUS_TOO_MANY_HANDLES;
             goto ExpandHandleTableEnd;
         }
 
-        ASSERT((NewCapacity > Table->ArraySize) &&
+        ASSERT((NewCapacity > OldArray->Size) &&
                (NewCapacity > Table->NextDescriptor));
 
-        NewBuffer = MmAllocatePagedPool(AllocationSize,
-                                        HANDLE_TABLE_ALLOCATION_TAG);
+        AllocationSize += FIELD_OFFSET(HANDLE_TABLE_ARRAY, Entries);
+        NewArray = MmAllocatePagedPool(AllocationSize,
+                                       HANDLE_TABLE_ALLOCATION_TAG);
 
-        if (NewBuffer == NULL) {
+        if (NewArray == NULL) {
             Status = STATUS_INSUFFICIENT_RESOURCES;
             goto ExpandHandleTableEnd;
         }
 
-        RtlCopyMemory(NewBuffer,
-                      Table->Entries,
-                      Table->ArraySize * sizeof(HANDLE_TABLE_ENTRY));
+        NewArray->Size = NewCapacity;
+        RtlCopyMemory(NewArray->Entries,
+                      OldArray->Entries,
+                      OldArray->Size * sizeof(HANDLE_TABLE_ENTRY));
 
         RtlZeroMemory(
-                NewBuffer + (Table->ArraySize * sizeof(HANDLE_TABLE_ENTRY)),
-                (NewCapacity - Table->ArraySize) * sizeof(HANDLE_TABLE_ENTRY));
-
-        MmFreePagedPool(Table->Entries);
-        Table->Entries = NewBuffer;
-        Table->ArraySize = NewCapacity;
+                  &(NewArray->Entries[OldArray->Size]),
+                  (NewCapacity - OldArray->Size) * sizeof(HANDLE_TABLE_ENTRY));
+
+        //
+        // Publish the new array once its contents are visible, then wait for
+        // lookups that may still be reading the old one before freeing it.
+        //
+
+        RtlMemoryBarrier();
+        Table->Array = NewArray;
+        ObpWaitForHandleLookups(Table);
+        MmFreePagedPool(OldArray);
     }
 
     Status = STATUS_SUCCESS;
@@ -907,3 +1014,135 @@ Return Value:
     return Status;
 }
 
+ULONG
+ObpStartHandleLookup (
+    PHANDLE_TABLE Table
+    )
+
+/*++
+
+Routine Description:
+
+    This routine registers a lookup that is about to read the handle table
+    without the lock.
+
+Arguments:
+
+    Table - Supplies a pointer to the handle table.
+
+Return Value:
+
+    Returns the epoch the lookup was registered in, which must be passed to
+    the end lookup routine.
+
+--*/
+
+{
+
+    ULONG Epoch;
+
+    //
+    // Without a lock, the table is only used by one thread.
+    //
+
+    if (Table->Lock == NULL) {
+        return 0;
+    }
+
+    //
+    // Count the lookup in the current epoch. If the epoch advanced in the
+    // meantime, the remover may have already checked that count, so try again
+    // in the new epoch.
+    //
+
+    while (TRUE) {
+        Epoch = Table->LookupEpoch;
+        RtlAtomicAdd32(&(Table->LookupCount[Epoch & 0x1]), 1);
+        if (Table->LookupEpoch == Epoch) {
+            break;
+        }
+
+        RtlAtomicAdd32(&(Table->LookupCount[Epoch & 0x1]), (ULONG)-1);
+    }
+
+    return Epoch;
+}
+
+VOID
+ObpEndHandleLookup (
+    PHANDLE_TABLE Table,
+    ULONG Epoch
+    )
+
+/*++
+
+Routine Description:
+
+    This routine unregisters a lookup that has finished with the handle
+    table.
+
+Arguments:
+
+    Table - Supplies a pointer to the handle table.
+
+    Epoch - Supplies the epoch returned when the lookup started.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Table->Lock == NULL) {
+        return;
+    }
+
+    RtlAtomicAdd32(&(Table->LookupCount[Epoch & 0x1]), (ULONG)-1);
+    return;
+}
+
+VOID
+ObpWaitForHandleLookups (
+    PHANDLE_TABLE Table
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits until every lookup that might have seen the handle
+    table before the caller's changes has finished. Lookups that start after
+    this routine advances the epoch see the changes. This routine assumes the
+    handle table lock is held, which serializes epoch changes.
+
+Arguments:
+
+    Table - Supplies a pointer to the handle table.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Epoch;
+
+    if (Table->Lock == NULL) {
+        return;
+    }
+
+    RtlMemoryBarrier();
+    Epoch = Table->LookupEpoch;
+    Table->LookupEpoch = Epoch + 1;
+    RtlMemoryBarrier();
+    while (Table->LookupCount[Epoch & 0x1] != 0) {
+        KeYield();
+    }
+
+    return;
+}
+
@@ -54,6 +54,13 @@ Module Name:
 
 #define WAIT_BLOCK_MAX_CAPACITY MAX_USHORT
 
+//
+// Define the largest wait block a thread keeps around between waits, in
+// entries. Anything bigger is freed when the wait finishes.
+//
+
+#define WAIT_BLOCK_MAX_SPARE_CAPACITY 128
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -63,6 +70,21 @@ ObpWaitFast (
     PWAIT_QUEUE WaitQueue
     );
 
+BOOL
+ObpTryWaitFast (
+    PWAIT_QUEUE WaitQueue
+    );
+
+PWAIT_BLOCK
+ObpAcquireWaitBlock (
+    ULONG Count
+    );
+
+VOID
+ObpReleaseWaitBlock (
+    PWAIT_BLOCK WaitBlock
+    );
+
 VOID
 ObpCleanUpWaitBlock (
     PWAIT_BLOCK WaitBlock,
@@ -739,7 +761,8 @@ Routine Description:
 
     This routine creates a wait block. While this can be done on the fly,
     creating a wait block ahead of time is potentially faster if the number of
-    elements being waited on is fairly large (greater than approximately 7).
+    elements being waited on is fairly large (greater than approximately 15)
+    and varies between waits.
 
 Arguments:
 
@@ -1215,29 +1238,59 @@ Return Value:
     PVOID LocalSignalingObject;
     ULONG ObjectIndex;
     KSTATUS Status;
-    PKTHREAD Thread;
     POBJECT_HEADER *TypedObjectArray;
     PWAIT_BLOCK WaitBlock;
-    BOOL WaitBlockAllocated;
 
     LocalSignalingObject = NULL;
     TypedObjectArray = (POBJECT_HEADER *)ObjectArray;
-    WaitBlockAllocated = FALSE;
+    WaitBlock = NULL;
+
+    //
+    // Look for an object that is already signaled before touching the wait
+    // block or any queue locks. Poll and the user mode synchronization
+    // primitives often find something ready.
+    //
+
+    if ((Flags & WAIT_FLAG_ALL) == 0) {
+        for (ObjectIndex = 0; ObjectIndex < ObjectCount; ObjectIndex += 1) {
+            if (ObpTryWaitFast(&(TypedObjectArray[ObjectIndex]->WaitQueue)) !=
+                FALSE) {
+
+                LocalSignalingObject = TypedObjectArray[ObjectIndex];
+                Status = STATUS_SUCCESS;
+                goto WaitForObjectsEnd;
+            }
+        }
+
+    //
+    // A wait for all objects only gets to skip the wait if every object is
+    // signaled for everyone. Grabbing some signaled-for-one objects and then
+    // blocking on the rest would steal them from other waiters.
+    //
+
+    } else if (ObjectCount != 0) {
+        for (ObjectIndex = 0; ObjectIndex < ObjectCount; ObjectIndex += 1) {
+            if (TypedObjectArray[ObjectIndex]->WaitQueue.State != Signaled) {
+                break;
+            }
+        }
+
+        if (ObjectIndex == ObjectCount) {
+            LocalSignalingObject = TypedObjectArray[ObjectCount - 1];
+            Status = STATUS_SUCCESS;
+            goto WaitForObjectsEnd;
+        }
+    }
+
     if (PreallocatedWaitBlock != NULL) {
         WaitBlock = PreallocatedWaitBlock;
 
-    } else if (ObjectCount + 1 <= BUILTIN_WAIT_BLOCK_ENTRY_COUNT) {
-        Thread = KeGetCurrentThread();
-        WaitBlock = Thread->BuiltinWaitBlock;
-
     } else {
-        WaitBlock = ObCreateWaitBlock(ObjectCount);
+        WaitBlock = ObpAcquireWaitBlock(ObjectCount);
         if (WaitBlock == NULL) {
             Status = STATUS_INSUFFICIENT_RESOURCES;
             goto WaitForObjectsEnd;
         }
-
-        WaitBlockAllocated = TRUE;
     }
 
     ASSERT(ObjectCount + 1 <= WaitBlock->Capacity);
@@ -1261,8 +1314,8 @@ Return Value:
     }
 
 WaitForObjectsEnd:
-    if (WaitBlockAllocated != FALSE) {
-        ObDestroyWaitBlock(WaitBlock);
+    if ((WaitBlock != NULL) && (WaitBlock != PreallocatedWaitBlock)) {
+        ObpReleaseWaitBlock(WaitBlock);
     }
 
     if (SignalingObject != NULL) {
@@ -1328,27 +1381,47 @@ Return Value:
     PWAIT_QUEUE LocalSignalingQueue;
     ULONG ObjectIndex;
     KSTATUS Status;
-    PKTHREAD Thread;
     PWAIT_BLOCK WaitBlock;
-    BOOL WaitBlockAllocated;
 
     LocalSignalingQueue = NULL;
-    WaitBlockAllocated = FALSE;
+    WaitBlock = NULL;
+
+    //
+    // As with objects, try to satisfy the wait without setting anything up.
+    //
+
+    if ((Flags & WAIT_FLAG_ALL) == 0) {
+        for (ObjectIndex = 0; ObjectIndex < Count; ObjectIndex += 1) {
+            if (ObpTryWaitFast(QueueArray[ObjectIndex]) != FALSE) {
+                LocalSignalingQueue = QueueArray[ObjectIndex];
+                Status = STATUS_SUCCESS;
+                goto WaitOnQueuesEnd;
+            }
+        }
+
+    } else if (Count != 0) {
+        for (ObjectIndex = 0; ObjectIndex < Count; ObjectIndex += 1) {
+            if (QueueArray[ObjectIndex]->State != Signaled) {
+                break;
+            }
+        }
+
+        if (ObjectIndex == Count) {
+            LocalSignalingQueue = QueueArray[Count - 1];
+            Status = STATUS_SUCCESS;
+            goto WaitOnQueuesEnd;
+        }
+    }
+
     if (PreallocatedWaitBlock != NULL) {
         WaitBlock = PreallocatedWaitBlock;
 
-    } else if (Count + 1 <= BUILTIN_WAIT_BLOCK_ENTRY_COUNT) {
-        Thread = KeGetCurrentThread();
-        WaitBlock = Thread->BuiltinWaitBlock;
-
     } else {
-        WaitBlock = ObCreateWaitBlock(Count);
+        WaitBlock = ObpAcquireWaitBlock(Count);
         if (WaitBlock == NULL) {
             Status = STATUS_INSUFFICIENT_RESOURCES;
             goto WaitOnQueuesEnd;
         }
-
-        WaitBlockAllocated = TRUE;
     }
 
     ASSERT(Count + 1 <= WaitBlock->Capacity);
@@ -1366,8 +1439,8 @@ Return Value:
     LocalSignalingQueue = WaitBlock->SignalingQueue;
 
 WaitOnQueuesEnd:
-    if (WaitBlockAllocated != FALSE) {
-        ObDestroyWaitBlock(WaitBlock);
+    if ((WaitBlock != NULL) && (WaitBlock != PreallocatedWaitBlock)) {
+        ObpReleaseWaitBlock(WaitBlock);
     }
 
     if (SignalingQueue != NULL) {
@@ -2478,6 +2551,168 @@ Return Value:
     return FALSE;
 }
 
+BOOL
+ObpTryWaitFast (
+    PWAIT_QUEUE WaitQueue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to satisfy a wait on a queue without acquiring any
+    locks. Unlike the regular fast wait, it never commits to blocking, so it
+    can be tried on several queues in turn before setting up a real wait.
+
+Arguments:
+
+    WaitQueue - Supplies a pointer to the queue to check.
+
+Return Value:
+
+    TRUE if the queue was signaled and the wait on it is satisfied. If the
+    queue was signaled for one, this thread has consumed that signal.
+
+    FALSE if the queue is not signaled.
+
+--*/
+
+{
+
+    SIGNAL_STATE State;
+
+    State = WaitQueue->State;
+    if (State == SignaledForOne) {
+        State = RtlAtomicCompareExchange32(&(WaitQueue->State),
+                                           NotSignaled,
+                                           State);
+
+        if (State == SignaledForOne) {
+            return TRUE;
+        }
+    }
+
+    if (State == Signaled) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+PWAIT_BLOCK
+ObpAcquireWaitBlock (
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets a wait block big enough for the current thread to wait
+    on the given number of queues. It hands out the thread's built-in wait
+    block if that fits, then the thread's spare wait block, and only then
+    allocates a new one.
+
+Arguments:
+
+    Count - Supplies the number of queues to be waited on, not including the
+        timeout timer.
+
+Return Value:
+
+    Returns a pointer to the wait block. Release it with
+    ObpReleaseWaitBlock.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    ULONG Capacity;
+    PKTHREAD Thread;
+    PWAIT_BLOCK WaitBlock;
+
+    Thread = KeGetCurrentThread();
+    Capacity = Count + 1;
+    if (Capacity <= BUILTIN_WAIT_BLOCK_ENTRY_COUNT) {
+        return Thread->BuiltinWaitBlock;
+    }
+
+    //
+    // Take the spare wait block off of the thread while it is in use, so
+    // that nothing else can grab it out from under this wait.
+    //
+
+    WaitBlock = Thread->SpareWaitBlock;
+    if (WaitBlock != NULL) {
+        Thread->SpareWaitBlock = NULL;
+        if (Capacity <= WaitBlock->Capacity) {
+            return WaitBlock;
+        }
+
+        ObDestroyWaitBlock(WaitBlock);
+    }
+
+    //
+    // Round the size up so that a thread whose waits slowly grow does not
+    // reallocate on every new high. Blocks too big to keep are sized exactly.
+    //
+
+    if (Capacity <= WAIT_BLOCK_MAX_SPARE_CAPACITY) {
+        Capacity = (ULONG)ALIGN_RANGE_UP(Capacity,
+                                         BUILTIN_WAIT_BLOCK_ENTRY_COUNT);
+    }
+
+    return ObCreateWaitBlock(Capacity - 1);
+}
+
+VOID
+ObpReleaseWaitBlock (
+    PWAIT_BLOCK WaitBlock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a wait block handed out by ObpAcquireWaitBlock. A
+    reasonably sized allocated wait block is kept as the thread's spare for
+    the next large wait.
+
+Arguments:
+
+    WaitBlock - Supplies a pointer to the wait block to release. It must not
+        be actively waiting on anything.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PKTHREAD Thread;
+
+    ASSERT((WaitBlock->Flags & WAIT_BLOCK_FLAG_ACTIVE) == 0);
+
+    Thread = KeGetCurrentThread();
+    if (WaitBlock == Thread->BuiltinWaitBlock) {
+        return;
+    }
+
+    if ((WaitBlock->Capacity <= WAIT_BLOCK_MAX_SPARE_CAPACITY) &&
+        (Thread->SpareWaitBlock == NULL)) {
+
+        Thread->SpareWaitBlock = WaitBlock;
+        return;
+    }
+
+    ObDestroyWaitBlock(WaitBlock);
+    return;
+}
+
 VOID
 ObpCleanUpWaitBlock (
     PWAIT_BLOCK WaitBlock,
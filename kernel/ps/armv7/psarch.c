@@ -1051,6 +1051,35 @@ Return Value:
     return Status;
 }
 
+PVOID
+PspArchGetUserStackPointer (
+    PTRAP_FRAME TrapFrame
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the user mode stack pointer saved in the given trap
+    frame.
+
+Arguments:
+
+    TrapFrame - Supplies a pointer to a complete user mode trap frame.
+
+Return Value:
+
+    Returns the user mode stack pointer.
+
+--*/
+
+{
+
+    ASSERT(IS_TRAP_FRAME_FROM_PRIVILEGED_MODE(TrapFrame) == FALSE);
+
+    return (PVOID)(TrapFrame->UserSp);
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -72,6 +72,11 @@ PspProcessChildrenOfTerminatingProcess (
     PKPROCESS Process
     );
 
+VOID
+PspCompleteVfork (
+    PKPROCESS Process
+    );
+
 VOID
 PspLoaderThread (
     PVOID Context
@@ -402,11 +407,55 @@ Return Value:
     PKPROCESS NewProcess;
     INTN NewProcessId;
     PSYSTEM_CALL_FORK Parameters;
+    PVOID RestoreBuffer;
+    UINTN RestoreSize;
+    PVOID RestoreStart;
     KSTATUS Status;
 
     CurrentThread = KeGetCurrentThread();
     NewProcess = NULL;
     Parameters = (PSYSTEM_CALL_FORK)SystemCallParameter;
+    RestoreBuffer = NULL;
+    RestoreSize = 0;
+    RestoreStart = NULL;
+
+    //
+    // The vfork child runs on the parent's stack. Save the region between the
+    // current user stack pointer and the supplied restore base so it can be
+    // put back once the child is done with the address space.
+    //
+
+    if (((Parameters->Flags & FORK_FLAG_VFORK) != 0) &&
+        (Parameters->FrameRestoreBase != NULL)) {
+
+        RestoreStart = PspArchGetUserStackPointer(CurrentThread->TrapFrame);
+        if ((RestoreStart > Parameters->FrameRestoreBase) ||
+            (Parameters->FrameRestoreBase > USER_VA_END)) {
+
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        RestoreSize = Parameters->FrameRestoreBase - RestoreStart;
+        if (RestoreSize > VFORK_MAX_FRAME_RESTORE_SIZE) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        if (RestoreSize != 0) {
+            RestoreBuffer = MmAllocatePagedPool(RestoreSize, PS_ALLOCATION_TAG);
+            if (RestoreBuffer == NULL) {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            Status = MmCopyFromUserMode(RestoreBuffer,
+                                        RestoreStart,
+                                        RestoreSize);
+
+            if (!KSUCCESS(Status)) {
+                goto SysForkProcessEnd;
+            }
+        }
+    }
+
     Status = PspCopyProcess(CurrentThread->OwningProcess,
                             CurrentThread,
                             CurrentThread->TrapFrame,
@@ -415,11 +464,31 @@ Return Value:
 
     if (!KSUCCESS(Status)) {
         RtlDebugPrint("Failed to fork %d\n", Status);
-        return Status;
+        goto SysForkProcessEnd;
     }
 
     NewProcessId = NewProcess->Identifiers.ProcessId;
-    ObReleaseReference(NewProcess);
+
+    //
+    // For vfork, wait for the child to execute a new image or exit, at which
+    // point it no longer touches this process' memory. The wait is not
+    // interruptible, as this thread must not touch its stack while the child
+    // is using it.
+    //
+
+    if ((Parameters->Flags & FORK_FLAG_VFORK) != 0) {
+        KeWaitForEvent(NewProcess->VforkEvent, FALSE, WAIT_TIME_INDEFINITE);
+        ObReleaseReference(NewProcess);
+
+        //
+        // The child exists at this point, so report success even if the
+        // stack region could not be put back. The parent will fault on its
+        // own when it returns.
+        //
+
+        if (RestoreBuffer != NULL) {
+            MmCopyToUserMode(RestoreStart, RestoreBuffer, RestoreSize);
+        }
 
     //
     // Yield to the child. This alleviates extra work during image section
@@ -428,7 +497,22 @@ Return Value:
     // going to wait on its new child.
     //
 
-    KeYield();
+    } else {
+        ObReleaseReference(NewProcess);
+        KeYield();
+    }
+
+    Status = STATUS_SUCCESS;
+
+SysForkProcessEnd:
+    if (RestoreBuffer != NULL) {
+        MmFreePagedPool(RestoreBuffer);
+    }
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
     return NewProcessId;
 }
 
@@ -601,6 +685,13 @@ Return Value:
         goto SysExecuteProcessEnd;
     }
 
+    //
+    // If this is a vfork child, switch over to its own address space and let
+    // the parent continue before tearing down the current address space.
+    //
+
+    PspCompleteVfork(Process);
+
     //
     // Destroy all timers.
     //
@@ -1960,23 +2051,48 @@ Return Value:
     }
 
     //
-    // Copy the process address space.
+    // A vfork child borrows the parent's address space until it executes a
+    // new image or exits. Its own (empty) address space is set aside until
+    // then. The image list is not copied, as the child does not own any of
+    // the images it is running. Make sure the new kernel stack is mapped in
+    // the parent's page directory, since that's what the child will run on.
     //
 
-    Status = MmCloneAddressSpace(Process->AddressSpace,
-                                 NewProcess->AddressSpace);
+    if ((Flags & FORK_FLAG_VFORK) != 0) {
+        NewProcess->VforkEvent = KeCreateEvent(NULL);
+        if (NewProcess->VforkEvent == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto CopyProcessEnd;
+        }
 
-    if (!KSUCCESS(Status)) {
-        goto CopyProcessEnd;
-    }
+        MmUpdatePageDirectory(Process->AddressSpace,
+                              KernelStack,
+                              DEFAULT_KERNEL_STACK_SIZE);
 
-    //
-    // Copy the image list.
-    //
+        NewProcess->VforkAddressSpace = NewProcess->AddressSpace;
+        NewProcess->AddressSpace = Process->AddressSpace;
 
-    Status = PspImCloneProcessImages(Process, NewProcess);
-    if (!KSUCCESS(Status)) {
-        goto CopyProcessEnd;
+    } else {
+
+        //
+        // Copy the process address space.
+        //
+
+        Status = MmCloneAddressSpace(Process->AddressSpace,
+                                     NewProcess->AddressSpace);
+
+        if (!KSUCCESS(Status)) {
+            goto CopyProcessEnd;
+        }
+
+        //
+        // Copy the image list.
+        //
+
+        Status = PspImCloneProcessImages(Process, NewProcess);
+        if (!KSUCCESS(Status)) {
+            goto CopyProcessEnd;
+        }
     }
 
     //
@@ -2971,6 +3087,13 @@ Return Value:
 
     PPATH_POINT PathPoint;
 
+    //
+    // Give the address space back to the parent if this process was a vfork
+    // child that never executed a new image.
+    //
+
+    PspCompleteVfork(Process);
+
     //
     // Proceed to destroy the process structures.
     //
@@ -3382,6 +3505,11 @@ Return Value:
         Process->StopEvent = NULL;
     }
 
+    if (Process->VforkEvent != NULL) {
+        KeDestroyEvent(Process->VforkEvent);
+        Process->VforkEvent = NULL;
+    }
+
     if (Process->QueuedLock != NULL) {
         KeDestroyQueuedLock(Process->QueuedLock);
     }
@@ -3393,6 +3521,59 @@ Return Value:
     return;
 }
 
+VOID
+PspCompleteVfork (
+    PKPROCESS Process
+    )
+
+/*++
+
+Routine Description:
+
+    This routine ends a vfork child's use of its parent's address space. The
+    process is switched over to its own address space and the waiting parent
+    is released. If the process is not borrowing an address space, this
+    routine does nothing.
+
+Arguments:
+
+    Process - Supplies a pointer to the process that is executing a new image
+        or terminating. If this is the current process, the current processor
+        is switched to the process' own address space.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RUNLEVEL OldRunLevel;
+
+    if (Process->VforkAddressSpace == NULL) {
+        return;
+    }
+
+    //
+    // Raise to dispatch so that the swap of the address space pointer and
+    // the processor's active page tables can't be separated by a context
+    // switch.
+    //
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Process->AddressSpace = Process->VforkAddressSpace;
+    Process->VforkAddressSpace = NULL;
+    if (Process == PsGetCurrentProcess()) {
+        MmSwitchAddressSpace(KeGetCurrentProcessorBlock(),
+                             Process->AddressSpace);
+    }
+
+    KeLowerRunLevel(OldRunLevel);
+    KeSignalEvent(Process->VforkEvent, SignalOptionSignalAll);
+    return;
+}
+
 VOID
 PspProcessChildrenOfTerminatingProcess (
     PKPROCESS Process
@@ -3764,8 +3945,10 @@ PspHandleTableLookupCallback (
 
 Routine Description:
 
-    This routine is called whenever a handle is looked up. It is called with
-    the handle table lock still held.
+    This routine is called whenever a handle is looked up. It is called
+    without the handle table lock held, but the handle value is guaranteed not
+    to be released by a destroy or replace of the handle until this routine
+    returns.
 
 Arguments:
 
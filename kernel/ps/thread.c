@@ -1140,12 +1140,15 @@ Return Value:
 
     //
     // The user stack is presumed to be set up in the new process at the same
-    // place.
+    // place. A vfork child is only borrowing the parent's stack, so it does
+    // not take ownership of it (and won't free it on exec or exit).
     //
 
     NewThread->BlockedSignals = Thread->BlockedSignals;
-    NewThread->UserStack = Thread->UserStack;
-    NewThread->UserStackSize = Thread->UserStackSize;
+    if (DestinationProcess->VforkAddressSpace == NULL) {
+        NewThread->UserStack = Thread->UserStack;
+        NewThread->UserStackSize = Thread->UserStackSize;
+    }
     PspPrepareThreadForFirstRun(NewThread, TrapFrame, FALSE);
     NewThread->ThreadPointer = Thread->ThreadPointer;
     NewThread->ThreadIdPointer = Thread->ThreadIdPointer;
@@ -1889,6 +1892,15 @@ Return Value:
         ObDestroyWaitBlock(Thread->BuiltinWaitBlock);
     }
 
+    //
+    // Destroy the spare wait block if the thread ever waited on enough objects
+    // to need one.
+    //
+
+    if (Thread->SpareWaitBlock != NULL) {
+        ObDestroyWaitBlock(Thread->SpareWaitBlock);
+    }
+
     Process = Thread->OwningProcess;
 
     //